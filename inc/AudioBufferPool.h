@@ -0,0 +1,118 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CODAL_AUDIO_BUFFER_POOL_H
+#define CODAL_AUDIO_BUFFER_POOL_H
+
+#include "CodalConfig.h"
+#include "ManagedBuffer.h"
+
+// Size of each block in the pool, in bytes. Requests for larger buffers are served from the heap.
+#ifndef CONFIG_AUDIO_BUFFER_POOL_BLOCK_SIZE
+#define CONFIG_AUDIO_BUFFER_POOL_BLOCK_SIZE     512
+#endif
+
+// Maximum number of blocks the pool will hold. Set to zero to disable pooling.
+#ifndef CONFIG_AUDIO_BUFFER_POOL_SIZE
+#define CONFIG_AUDIO_BUFFER_POOL_SIZE           12
+#endif
+
+namespace codal
+{
+    /**
+     * Class definition for an AudioBufferPool.
+     *
+     * Provides a fixed set of recycled, reference counted blocks that audio components can use
+     * in place of allocating a new ManagedBuffer from the heap on every pull().
+     *
+     * Blocks are allocated on demand up to the configured limit, and are never returned to the heap.
+     * A block becomes available for reuse as soon as the last ManagedBuffer referencing it is released.
+     * Should the pool be exhausted, buffers are allocated from the heap as before.
+     *
+     * @note the contents of pooled buffers are not cleared between uses.
+     */
+    class AudioBufferPool
+    {
+        BufferData      **blocks;               // The blocks owned by this pool.
+        int             blockSize;              // The payload size of each block, in bytes.
+        int             maxBlocks;              // The maximum number of blocks this pool may hold.
+        int             blockCount;             // The number of blocks currently allocated.
+        int             nextBlock;              // Index at which to start searching for a free block.
+        uint16_t        idleRefCount;           // The reference count of a block held only by this pool.
+        uint32_t        misses;                 // The number of requests served from the heap.
+
+        public:
+
+        static AudioBufferPool *defaultPool;    // Pool shared by the audio pipeline, created on demand.
+
+        /**
+         * Constructor.
+         * Creates an empty pool. No memory is allocated until the first buffer is requested.
+         *
+         * @param blockSize The size of each block, in bytes.
+         * @param maxBlocks The maximum number of blocks to hold.
+         */
+        AudioBufferPool(int blockSize = CONFIG_AUDIO_BUFFER_POOL_BLOCK_SIZE, int maxBlocks = CONFIG_AUDIO_BUFFER_POOL_SIZE);
+
+        /**
+         * Destructor.
+         * Releases the pool's reference to each block. Blocks still in use are freed when their last user releases them.
+         */
+        ~AudioBufferPool();
+
+        /**
+         * Determine the pool shared by the audio pipeline, creating it if necessary.
+         * @return the default AudioBufferPool.
+         */
+        static AudioBufferPool& getDefault();
+
+        /**
+         * Provide a ManagedBuffer of the given length, taken from the pool where possible.
+         *
+         * @param length The length of the buffer required, in bytes.
+         * @return A ManagedBuffer of the requested length.
+         */
+        ManagedBuffer allocate(int length);
+
+        /**
+         * Determine the number of blocks currently allocated by this pool.
+         * @return the number of blocks.
+         */
+        int getBlockCount();
+
+        /**
+         * Determine the number of allocated blocks not currently in use.
+         * @return the number of free blocks.
+         */
+        int getFreeCount();
+
+        /**
+         * Determine the number of requests that could not be served from the pool.
+         * @return the number of heap allocations performed on behalf of callers.
+         */
+        uint32_t getMissCount();
+    };
+}
+
+#endif
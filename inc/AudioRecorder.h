@@ -0,0 +1,194 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef AUDIO_RECORDER_H
+#define AUDIO_RECORDER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "CodalFiber.h"
+#include "DataStream.h"
+#include "Event.h"
+#include "ImaAdpcm.h"
+
+// Number of blocks of compressed audio buffered between the audio pipeline and storage.
+// While one block is being written, the others continue to fill.
+#ifndef CONFIG_AUDIO_RECORDER_BUFFERS
+#define CONFIG_AUDIO_RECORDER_BUFFERS               2
+#endif
+
+#define DEVICE_ID_AUDIO_RECORDER                    3041
+
+#define AUDIO_RECORDER_STATUS_RECORDING             0x01
+#define AUDIO_RECORDER_STATUS_HIGH_NIBBLE           0x02        // The next code is written to the high nibble of the current byte.
+
+#define AUDIO_RECORDER_EVT_BLOCK_READY              1           // A block of compressed audio is ready to be written.
+#define AUDIO_RECORDER_EVT_DONE                     2           // Recording has stopped.
+
+class MicroBitFileSystem;
+
+namespace codal
+{
+    class FSCache;
+    class NVMController;
+
+    /**
+     * Class definition for an AudioRecorder.
+     *
+     * Compresses a stream of audio (typically from the microphone) to IMA ADPCM, and writes it sequentially to
+     * storage in blocks of CONFIG_IMA_ADPCM_BLOCK_SIZE bytes. Compression takes place as samples arrive, and
+     * completed blocks are written to storage from a fiber, so capture continues while writes are in progress.
+     * The result can be played back with a FlashAudioSource, at the sample rate of the recorded stream.
+     *
+     * @code
+     * AudioRecorder recorder(*uBit.audio.getSplitter());
+     * int fd = uBit.fs.open("rec.raw", MB_WRITE | MB_CREAT);
+     * recorder.record(uBit.fs, fd);
+     * uBit.sleep(5000);
+     * recorder.stop();
+     * @endcode
+     */
+    class AudioRecorder : public DataSink, public CodalComponent
+    {
+        private:
+        DataSource              &upstream;              // The stream of audio to record.
+        FiberLock               writeLock;              // Serialises writes to storage.
+
+        MicroBitFileSystem      *fs;                    // File system to record into, if any.
+        int                     fd;                     // File handle to record into.
+        FSCache                 *cache;                 // Cache to record into, if any.
+        uint32_t                address;                // Next address to write to in the cache.
+        uint32_t                limit;                  // End of the region of the cache being recorded into.
+
+        uint8_t                 *blocks;                // CONFIG_AUDIO_RECORDER_BUFFERS blocks of compressed audio.
+        volatile int            full;                   // Number of completed blocks waiting to be written.
+        int                     head;                   // Index of the block being filled.
+        int                     tail;                   // Index of the next block to be written.
+        int                     position;               // Byte offset in the block being filled.
+        ImaAdpcmState           adpcm;                  // Encoder state.
+
+        uint32_t                length;                 // Bytes written to storage.
+        uint32_t                dropped;                // Samples lost because storage could not keep up.
+        int                     result;                 // Outcome of the last write to storage.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The stream of audio to record. 8 and 16 bit signed and unsigned formats are supported.
+         * @param id The event ID to raise AUDIO_RECORDER_EVT_DONE on when recording stops.
+         */
+        AudioRecorder(DataSource &source, uint16_t id = DEVICE_ID_AUDIO_RECORDER);
+
+        /**
+         * Destructor. Stops any recording in progress.
+         */
+        ~AudioRecorder();
+
+        /**
+         * Start recording into a file, from its current seek position.
+         * The file must remain open until recording stops.
+         *
+         * @param fs The file system holding the file.
+         * @param fd A file handle, opened with MB_WRITE.
+         * @return DEVICE_OK on success, DEVICE_BUSY if already recording, DEVICE_NOT_SUPPORTED if the
+         * source format is not supported, or DEVICE_NO_RESOURCES if buffers could not be allocated.
+         */
+        int record(MicroBitFileSystem &fs, int fd);
+
+        /**
+         * Start recording into a region of non-volatile memory, through the given cache.
+         * The whole region is erased before capture begins, so that no erase cycles are needed while
+         * recording (erasing pages of MicroBitUSBFlashManager can stall for longer than our buffers last).
+         * Recording stops automatically when the region is full.
+         *
+         * @param cache The cache used to write to memory.
+         * @param flash The memory controller behind the cache.
+         * @param address The logical address of the region. Must be aligned to a page boundary.
+         * @param length The length of the region, in bytes.
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the region is invalid, or as for record().
+         */
+        int record(FSCache &cache, NVMController &flash, uint32_t address, uint32_t length);
+
+        /**
+         * Stop recording, and write any remaining audio to storage.
+         * @return DEVICE_OK on success, or the error code of the first failed write to storage.
+         */
+        int stop();
+
+        /**
+         * Determine if a recording is in progress.
+         * @return true if recording, false otherwise.
+         */
+        bool isRecording();
+
+        /**
+         * Determine the amount of compressed audio written to storage by the current (or last) recording.
+         * @return the length, in bytes.
+         */
+        uint32_t getLength();
+
+        /**
+         * Determine the number of samples lost because storage could not keep up with the audio stream.
+         * @return the number of samples dropped during the current (or last) recording.
+         */
+        uint32_t getDroppedSamples();
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest() override;
+
+        private:
+
+        /**
+         * Allocate buffers and begin capture.
+         */
+        int start();
+
+        /**
+         * Write completed blocks to storage.
+         * Called with writeLock held.
+         */
+        void drain();
+
+        /**
+         * Write the given compressed audio to storage.
+         */
+        int store(uint8_t *data, int len);
+
+        /**
+         * Stop capture, if in progress, and notify listeners.
+         */
+        void halt();
+
+        /**
+         * Event handler, run on a fiber whenever a block is ready to be written.
+         */
+        void onBlockReady(Event);
+    };
+}
+
+#endif
@@ -25,20 +25,52 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalCompat.h"
 
 #define FSCACHE_FLAG_PINNED				0x01
+#define FSCACHE_FLAG_DIRTY				0x02
+#define FSCACHE_FLAG_REFERENCED			0x04
+#define FSCACHE_FLAG_BUSY				0x08			// The block's page is being read or written by the memory controller.
 
 #define CODAL_FS_CACHE_VALIDATE			1
 #define CODAL_FS_DEFAULT_CACHE_SZE		4
 
+// Cache pages of this size are recycled through a pool shared by all caches, rather than returned to the heap.
+#ifndef CODAL_FS_CACHE_POOL_BLOCK_SIZE
+#define CODAL_FS_CACHE_POOL_BLOCK_SIZE	256
+#endif
+
+// The maximum number of free pages held in the shared pool. Any more are returned to the heap.
+#ifndef CODAL_FS_CACHE_POOL_SIZE
+#define CODAL_FS_CACHE_POOL_SIZE		4
+#endif
+
+// The largest read (in bytes) made of the memory controller when reading ahead.
+#ifndef CODAL_FS_CACHE_MAX_READ_LENGTH
+#define CODAL_FS_CACHE_MAX_READ_LENGTH	1024
+#endif
+
 namespace codal
 {
 	struct CacheEntry
 	{
 		uint32_t address;
-		uint16_t lastUsed;
 		uint16_t flags;
+		uint16_t dirtyStart;			// Offset of the first modified byte not yet written back (32-bit aligned).
+		uint16_t dirtyEnd;				// Offset just beyond the last modified byte not yet written back (32-bit aligned).
 		uint8_t  *page;
 	};
 
+	struct FSCacheStatistics
+	{
+		uint32_t reads;					// Number of calls to read().
+		uint32_t writes;				// Number of calls to write().
+		uint32_t hits;					// Number of blocks requested that were already in the cache.
+		uint32_t misses;				// Number of blocks requested that had to be loaded from the memory controller.
+		uint32_t evictions;				// Number of blocks replaced to make space for another.
+		uint32_t nvmReads;				// Number of read operations issued to the memory controller.
+		uint32_t nvmWrites;				// Number of write operations issued to the memory controller.
+		uint32_t nvmBytesRead;			// Number of bytes read from the memory controller.
+		uint32_t nvmBytesWritten;		// Number of bytes written to the memory controller.
+	};
+
 	class FSCache
 	{
 		private:
@@ -46,7 +78,64 @@ namespace codal
 			CacheEntry* cache;
 			int blockSize;
 			int cacheSize;
-			uint16_t operationCount;
+			int cacheUsed;					// Number of entries in cache that hold a block.
+			int clockHand;					// Next entry to consider for replacement.
+			uint16_t *index;				// Open addressing hash table of (entry number + 1), indexed by block address. Zero marks an empty slot.
+			uint32_t indexMask;				// Number of slots in index, less one. The table holds at least twice cacheSize slots.
+			bool writeBack;
+			bool validate;					// Set if writes should be checked for operations that would need an erase.
+			int readAhead;					// Number of blocks to read in advance, when reads are sequential.
+			uint32_t lastMiss;				// Address of the last block read from the memory controller.
+			FSCacheStatistics stats;		// Usage counters, since construction or the last resetStatistics().
+			FSCache *nextInstance;			// The next cache in the list of all caches.
+
+			static FSCache *instances;		// List of all caches, so memory can be reclaimed from idle ones.
+			static uint8_t *pool;			// Free pages of CODAL_FS_CACHE_POOL_BLOCK_SIZE bytes, linked through their first word.
+			static int poolCount;			// Number of pages in the pool.
+
+			/**
+			 * Determine if any block of this cache is being read or written by the memory controller.
+			 * The memory controller may yield during I/O, so the entries of a busy cache must not be moved or freed.
+			 */
+			bool isBusy();
+
+			/**
+			 * Allocate a page of blockSize bytes, from the shared pool if possible. Unless DEVICE_PANIC_HEAP_FULL is set
+			 * (in which case the heap panics rather than failing), memory is reclaimed from other caches and the
+			 * allocation retried if the heap is exhausted.
+			 * @return the page, or NULL if no memory is available.
+			 */
+			uint8_t *allocatePage();
+
+			/**
+			 * Return a page allocated by allocatePage() to the shared pool, or to the heap if the pool is full.
+			 */
+			void releasePage(uint8_t *page);
+
+			/**
+			 * Remove the given entry from the cache, and return its page. Its block must not be dirty.
+			 */
+			void releaseEntry(CacheEntry *c);
+
+			/**
+			 * Choose a cache entry to hold a new block, writing back and unindexing its previous block if necessary.
+			 */
+			CacheEntry *allocateEntry();
+
+			/**
+			 * Determine the home slot in the index of the given block address.
+			 */
+			uint32_t indexSlot(uint32_t address);
+
+			/**
+			 * Add the given cache entry to the index.
+			 */
+			void indexInsert(CacheEntry *c);
+
+			/**
+			 * Remove the given cache entry from the index.
+			 */
+			void indexRemove(CacheEntry *c);
 
 		public:
 		  /**
@@ -56,11 +145,94 @@ namespace codal
 			*/
 			FSCache(NVMController &nvm, int blockSize, int size = CODAL_FS_DEFAULT_CACHE_SZE);
 
+			/**
+			 * Destructor. Writes back any modified data, and releases all memory.
+			 */
+			~FSCache();
+
+			/**
+			 * Release the memory held by unmodified, unpinned blocks in every cache, and by the shared pool.
+			 * Caches with I/O in progress are left untouched. The caches continue to work with fewer blocks, and grow
+			 * again as memory allows, up to their size. It may be called by an application that is short of memory.
+			 * If DEVICE_PANIC_HEAP_FULL is not set, it is also called when a cache cannot allocate a page.
+			 *
+			 * @param except a cache to leave untouched, or NULL.
+			 * @return the number of bytes returned to the heap.
+			 */
+			static uint32_t releaseMemory(FSCache *except = NULL);
+
 			/**
 			 * Clear all cache entries, and free any allocated RAM.
+			 * In write back mode, any data not yet written back is discarded. Use flush() first to keep it.
 			 */
 			void clear();
 
+			/**
+			 * Enable or disable write back mode.
+			 * By default the cache is write through: every write() is passed straight to the memory controller.
+			 * In write back mode, writes update the cache only, and the modified range of each block is written
+			 * back in a single operation when the block is evicted, or when flush() is called.
+			 * Disabling write back mode writes back any modified data.
+			 *
+			 * @param enable true to enable write back mode, false to return to write through mode.
+			 * @return DEVICE_OK on success.
+			 */
+			int setWriteBack(bool enable);
+
+			/**
+			 * Set the number of blocks to read in advance when sequential access is detected.
+			 * When a block is missed just after the last block read from the memory controller, it is read along
+			 * with the following blocks in a single read operation.
+			 *
+			 * @param blocks the number of blocks to read in advance, or zero to disable. This is limited to half
+			 * the size of the cache, and by CODAL_FS_CACHE_MAX_READ_LENGTH.
+			 * @return DEVICE_OK on success.
+			 */
+			int setReadAhead(int blocks);
+
+			/**
+			 * Enable or disable validation of writes. Validation is only available if CODAL_FS_CACHE_VALIDATE is defined,
+			 * and is enabled by default. When enabled, a write that would need an erase cycle is rejected.
+			 *
+			 * @param enable true to validate writes, false otherwise.
+			 */
+			void setValidation(bool enable);
+
+			/**
+			 * Retrieve the usage counters of this cache, since it was created or resetStatistics() was last called.
+			 * Operations issued to the memory controller are counted as calls to the NVMController, which may
+			 * divide them into smaller transfers.
+			 *
+			 * @return a copy of the counters.
+			 */
+			FSCacheStatistics getStatistics();
+
+			/**
+			 * Determine the heap memory held by this cache: its tables, and the blocks it currently holds.
+			 * Free pages in the shared pool are not included.
+			 *
+			 * @return the number of bytes allocated.
+			 */
+			uint32_t getMemoryUsage();
+
+			/**
+			 * Reset all usage counters to zero.
+			 */
+			void resetStatistics();
+
+			/**
+			 * Write back all modified data to the memory controller. Has no effect in write through mode.
+			 * @return DEVICE_OK on success.
+			 */
+			int flush();
+
+			/**
+			 * Write back the modified data in the given cache entry, if any.
+			 * @param c the cache entry to write back.
+			 * @return DEVICE_OK on success.
+			 */
+			int flush(CacheEntry *c);
+
 			/**
 			 * Erase a single page of FLASH memory at the given address
 			 */
@@ -97,7 +269,9 @@ namespace codal
 			CacheEntry *getCacheEntry(uint32_t address);
 
 			/**
-			 * Page a given block into the cache, replacing the LRU block if necessary.
+			 * Page a given block into the cache, replacing an unpinned block if necessary.
+			 * Blocks are replaced using the CLOCK (second chance) policy: a block is only replaced if it has not
+			 * been used since the clock hand last passed it.
 			 * @param address the logical address of the block to cache.
 			 * @return a pointer to the relevant cache entry.
 			 */
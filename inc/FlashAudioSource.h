@@ -0,0 +1,200 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FLASH_AUDIO_SOURCE_H
+#define FLASH_AUDIO_SOURCE_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "ImaAdpcm.h"
+
+// Number of bytes of 16 bit audio delivered to the mixer by each pull().
+#ifndef CONFIG_FLASH_AUDIO_BUFFER_SIZE
+#define CONFIG_FLASH_AUDIO_BUFFER_SIZE              512
+#endif
+
+// Default sample rate of stored audio, in Hz.
+#ifndef CONFIG_FLASH_AUDIO_SAMPLE_RATE
+#define CONFIG_FLASH_AUDIO_SAMPLE_RATE              11025
+#endif
+
+#define DEVICE_ID_FLASH_AUDIO_SOURCE                3040
+
+// Encodings of stored audio.
+#define FLASH_AUDIO_FORMAT_PCM8                     1           // 8 bit unsigned PCM.
+#define FLASH_AUDIO_FORMAT_PCM16                    2           // 16 bit signed little endian PCM.
+#define FLASH_AUDIO_FORMAT_IMA_ADPCM                3           // 4 bit IMA ADPCM, in blocks of CONFIG_IMA_ADPCM_BLOCK_SIZE bytes.
+
+// Sample range of the output stream, to be used when adding a FlashAudioSource to a mixer.
+#define FLASH_AUDIO_SOURCE_RANGE                    65535
+
+#define FLASH_AUDIO_SOURCE_STATUS_PLAYING           0x01
+#define FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING    0x02        // A decoded sample is waiting to be written.
+
+#define FLASH_AUDIO_SOURCE_EVT_DONE                 1
+
+class MicroBitFileSystem;
+
+namespace codal
+{
+    class NRF52FlashManager;
+
+    /**
+     * Class definition for a FlashAudioSource.
+     *
+     * Streams stored PCM or IMA ADPCM audio into the audio pipeline, as 16 bit signed samples.
+     * Audio is read in place from memory mapped FLASH, either from a raw region or from a file in a
+     * MicroBitFileSystem, so sounds need not be held in RAM. Only the buffer passed downstream is allocated.
+     *
+     * @code
+     * FlashAudioSource prompt;
+     * uBit.audio.mixer.addChannel(prompt, prompt.getSampleRate(), FLASH_AUDIO_SOURCE_RANGE);
+     * prompt.play(flash, 0, length, FLASH_AUDIO_FORMAT_IMA_ADPCM);
+     * @endcode
+     */
+    class FlashAudioSource : public DataSource, public CodalComponent
+    {
+        private:
+        DataSink                *downStream;
+        int                     sampleRate;
+        int                     encoding;
+
+        const uint8_t           *in;                    // Next byte of stored audio to be read.
+        const uint8_t           *end;                   // End of the contiguous region of stored audio at in.
+        MicroBitFileSystem      *fs;                    // File system to read further regions from, if any.
+        int                     fd;                     // File handle to read further regions from.
+
+        ImaAdpcmState           adpcm;                  // ADPCM decoder state.
+        int                     blockRemaining;         // Bytes of ADPCM data left in the current block.
+        int16_t                 pendingSample;          // Second sample of an ADPCM byte that didn't fit in the last buffer.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param sampleRate The sample rate of the stored audio, in Hz.
+         * @param id The event ID to raise FLASH_AUDIO_SOURCE_EVT_DONE on when playback completes.
+         */
+        FlashAudioSource(int sampleRate = CONFIG_FLASH_AUDIO_SAMPLE_RATE, uint16_t id = DEVICE_ID_FLASH_AUDIO_SOURCE);
+
+        /**
+         * Play audio held in memory mapped FLASH (or RAM).
+         * The data must remain valid until playback completes.
+         *
+         * @param data The address of the audio.
+         * @param length The length of the audio, in bytes.
+         * @param encoding The encoding of the audio, one of FLASH_AUDIO_FORMAT_PCM8, FLASH_AUDIO_FORMAT_PCM16 or FLASH_AUDIO_FORMAT_IMA_ADPCM.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int play(const uint8_t *data, uint32_t length, int encoding = FLASH_AUDIO_FORMAT_PCM8);
+
+        /**
+         * Play audio held in a region of internal FLASH.
+         *
+         * @param flash The flash manager holding the audio.
+         * @param address The logical address of the audio within the flash manager.
+         * @param length The length of the audio, in bytes.
+         * @param encoding The encoding of the audio.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the region is out of range.
+         */
+        int play(NRF52FlashManager &flash, uint32_t address, uint32_t length, int encoding = FLASH_AUDIO_FORMAT_PCM8);
+
+        /**
+         * Play audio held in a file, from its current seek position to the end of the file.
+         * The file must remain open until playback completes.
+         *
+         * @param fs The file system holding the file.
+         * @param fd A file handle, opened with MB_READ.
+         * @param encoding The encoding of the audio.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int play(MicroBitFileSystem &fs, int fd, int encoding = FLASH_AUDIO_FORMAT_PCM8);
+
+        /**
+         * Stop any audio currently playing.
+         * @return DEVICE_OK on success.
+         */
+        int stop();
+
+        /**
+         * Determine if audio is currently being played.
+         * @return true if audio is playing, false otherwise.
+         */
+        bool isPlaying();
+
+        /**
+         * Determine the sample rate of the stored audio.
+         * @return the sample rate, in Hz.
+         */
+        int getSampleRate();
+
+        /**
+         * Define a downstream component for data stream.
+         *
+         * @sink The component that data will be delivered to, when it is availiable
+         */
+        virtual void connect(DataSink &sink) override;
+
+        /**
+         *  Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat() override;
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull() override;
+
+        private:
+
+        /**
+         * Begin playout of the given region, optionally followed by further regions of the given file.
+         */
+        int start(const uint8_t *data, uint32_t length, int encoding, MicroBitFileSystem *fs, int fd);
+
+        /**
+         * Move on to the next contiguous region of stored audio.
+         * @return true if more data is available, false at the end of the audio.
+         */
+        bool refill();
+
+        /**
+         * Read bytes of stored audio that may span regions.
+         * @return true on success, false if the end of the audio was reached first.
+         */
+        bool readBytes(uint8_t *buffer, int length);
+
+        /**
+         * Decode stored audio into the given buffer.
+         * @return a pointer one beyond the last sample written.
+         */
+        int16_t *decodePCM8(int16_t *out, int16_t *outEnd);
+        int16_t *decodePCM16(int16_t *out, int16_t *outEnd);
+        int16_t *decodeADPCM(int16_t *out, int16_t *outEnd);
+    };
+}
+
+#endif
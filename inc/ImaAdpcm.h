@@ -0,0 +1,163 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include "CodalConfig.h"
+
+// Size of each independently decodable block of IMA ADPCM data, in bytes. Each block starts with a four byte
+// header (16 bit predictor, 8 bit step index, one reserved byte), followed by packed 4 bit samples, low nibble first.
+// This is the layout used by mono IMA ADPCM WAV files. The default matches MBFS_BLOCK_SIZE, so blocks never
+// straddle file system blocks.
+#ifndef CONFIG_IMA_ADPCM_BLOCK_SIZE
+#define CONFIG_IMA_ADPCM_BLOCK_SIZE                 256
+#endif
+
+#define IMA_ADPCM_HEADER_SIZE                       4
+#define IMA_ADPCM_MAX_INDEX                         88
+
+// Number of samples held in a block of the given size (the header holds the first sample).
+#define IMA_ADPCM_SAMPLES_PER_BLOCK(size)           ((((size) - IMA_ADPCM_HEADER_SIZE) * 2) + 1)
+
+namespace codal
+{
+    extern const int16_t ima_adpcm_step_table[IMA_ADPCM_MAX_INDEX + 1];
+    extern const int8_t ima_adpcm_index_table[16];
+
+    /**
+     * State of an IMA ADPCM encoder or decoder, between samples.
+     */
+    struct ImaAdpcmState
+    {
+        int32_t     predictor;                  // The last sample value.
+        int32_t     index;                      // Index into the step table.
+    };
+
+    /**
+     * Decode a single 4 bit IMA ADPCM code.
+     *
+     * @param state The decoder state, which is updated.
+     * @param code The 4 bit code to decode.
+     * @return the decoded 16 bit sample.
+     */
+    inline int16_t ima_adpcm_decode(ImaAdpcmState &state, int code)
+    {
+        int step = ima_adpcm_step_table[state.index];
+        int diff = step >> 3;
+
+        if (code & 1)
+            diff += step >> 2;
+        if (code & 2)
+            diff += step >> 1;
+        if (code & 4)
+            diff += step;
+
+        int p = (code & 8) ? state.predictor - diff : state.predictor + diff;
+        p = p > 32767 ? 32767 : p < -32768 ? -32768 : p;
+
+        int i = state.index + ima_adpcm_index_table[code & 0x0F];
+        state.index = i < 0 ? 0 : i > IMA_ADPCM_MAX_INDEX ? IMA_ADPCM_MAX_INDEX : i;
+        state.predictor = p;
+
+        return (int16_t) p;
+    }
+
+    /**
+     * Encode a single sample as a 4 bit IMA ADPCM code.
+     * The state tracks that of a decoder exactly, so quantization errors do not accumulate.
+     *
+     * @param state The encoder state, which is updated.
+     * @param sample The 16 bit sample to encode.
+     * @return the 4 bit code.
+     */
+    inline int ima_adpcm_encode(ImaAdpcmState &state, int sample)
+    {
+        int step = ima_adpcm_step_table[state.index];
+        int diff = sample - state.predictor;
+        int code = 0;
+
+        if (diff < 0)
+        {
+            code = 8;
+            diff = -diff;
+        }
+
+        if (diff >= step)
+        {
+            code |= 4;
+            diff -= step;
+        }
+
+        step >>= 1;
+        if (diff >= step)
+        {
+            code |= 2;
+            diff -= step;
+        }
+
+        step >>= 1;
+        if (diff >= step)
+            code |= 1;
+
+        ima_adpcm_decode(state, code);
+
+        return code;
+    }
+
+    /**
+     * Read the header at the start of a block of IMA ADPCM data.
+     *
+     * @param state The decoder state to initialise.
+     * @param header The first IMA_ADPCM_HEADER_SIZE bytes of the block.
+     * @return the first sample of the block.
+     */
+    inline int16_t ima_adpcm_read_header(ImaAdpcmState &state, const uint8_t *header)
+    {
+        state.predictor = (int16_t) (header[0] | (header[1] << 8));
+        state.index = header[2] > IMA_ADPCM_MAX_INDEX ? IMA_ADPCM_MAX_INDEX : header[2];
+
+        return (int16_t) state.predictor;
+    }
+
+    /**
+     * Write the header at the start of a block of IMA ADPCM data.
+     * The given sample is stored verbatim, and becomes the predictor for the rest of the block.
+     *
+     * @param state The encoder state, which is updated.
+     * @param header The first IMA_ADPCM_HEADER_SIZE bytes of the block.
+     * @param sample The first sample of the block.
+     */
+    inline void ima_adpcm_write_header(ImaAdpcmState &state, uint8_t *header, int16_t sample)
+    {
+        state.predictor = sample;
+
+        header[0] = sample & 0xFF;
+        header[1] = (sample >> 8) & 0xFF;
+        header[2] = state.index;
+        header[3] = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef INTEGER_MATH_H
+#define INTEGER_MATH_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    /**
+     * Integer square root, rounded down. Used where a floating point square root would be too slow.
+     *
+     * @param v The value to find the square root of.
+     * @return the largest integer whose square is no greater than v.
+     */
+    inline uint32_t integer_sqrt(uint32_t v)
+    {
+        uint32_t r = 0;
+        uint32_t b = 1UL << 30;
+
+        while (b > v)
+            b >>= 2;
+
+        while (b)
+        {
+            if (v >= r + b)
+            {
+                v -= r + b;
+                r = (r >> 1) + b;
+            }
+            else
+            {
+                r >>= 1;
+            }
+
+            b >>= 2;
+        }
+
+        return r;
+    }
+}
+
+#endif
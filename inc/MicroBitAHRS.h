@@ -0,0 +1,262 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_AHRS_H
+#define MICROBIT_AHRS_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "MicroBitAccelerometer.h"
+#include "MicroBitCompass.h"
+#include "MicroBitSampleBuffer.h"
+
+#define DEVICE_ID_AHRS                              3048
+
+//
+// Events raised by the AHRS.
+//
+#define MICROBIT_AHRS_EVT_UPDATE                    1           // Raised each time the orientation estimate is updated.
+
+//
+// Component Status flags
+//
+#define MICROBIT_AHRS_STATUS_ENABLED                0x01
+#define MICROBIT_AHRS_STATUS_INITIALISED            0x02        // The orientation estimate has been initialised from the sensors.
+
+//
+// Default time between orientation updates (milliseconds). Samples received in between are averaged.
+//
+#ifndef CONFIG_MICROBIT_AHRS_PERIOD
+#define CONFIG_MICROBIT_AHRS_PERIOD                 20
+#endif
+
+//
+// Default gain of the feedback that corrects the orientation estimate towards the sensors (per second).
+// Higher gains track faster, lower gains reject more noise and transient acceleration.
+//
+#ifndef CONFIG_MICROBIT_AHRS_GAIN
+#define CONFIG_MICROBIT_AHRS_GAIN                   2.0f
+#endif
+
+//
+// The magnitude of gravity, as reported by the accelerometer (milli-g).
+//
+#define MICROBIT_AHRS_GRAVITY                       1024
+
+namespace codal
+{
+    /**
+     * An orientation, as a unit quaternion that rotates vectors from the device's North-East-Down frame to the earth's.
+     */
+    typedef struct {
+        float           w;
+        float           x;
+        float           y;
+        float           z;
+    } MicroBitQuaternion;
+
+    /**
+     * Class definition for MicroBitAHRS.
+     *
+     * An attitude and heading reference system, which fuses accelerometer and compass samples into a single, stable
+     * estimate of the orientation of the device. Each new sample is read from the sensors' sample buffers, and samples
+     * are averaged into an update at a configurable rate. Each update applies a fixed cost Mahony style complementary
+     * filter: the estimated directions of gravity and magnetic north are rotated towards the measured ones by a
+     * proportional feedback gain. As the micro:bit has no gyroscope, this feedback alone drives the estimate, so the gain
+     * sets the trade off between responsiveness and noise.
+     *
+     * The compass is used only once it is calibrated. Until then, the yaw is held where it was initialised.
+     */
+    class MicroBitAHRS : public CodalComponent
+    {
+        MicroBitAccelerometer   &accelerometer;
+        MicroBitCompass         &compass;
+
+        MicroBitSampleCursor    accelerometerCursor;                // Our position in the accelerometer's sample buffer.
+        MicroBitSampleCursor    compassCursor;                      // Our position in the compass's sample buffer.
+        int8_t                  transform[3][3];                    // Maps samples from the sensors' default coordinate system to North-East-Down.
+
+        MicroBitQuaternion      q;                                  // The orientation estimate.
+        float                   gain;                               // The feedback gain (per second).
+        int                     period;                             // The time between updates (milliseconds).
+        CODAL_TIMESTAMP         lastUpdate;                         // The timestamp of the last sample included in an update.
+
+        float                   acceleration[3];                    // The sum (and after an update, the mean) of accelerometer samples since the last update.
+        int                     accelerationCount;                  // The number of samples in that sum.
+        float                   magnetic[3];                        // The latest compass sample.
+        bool                    magneticValid;                      // Whether or not a compass sample has been received.
+        float                   linear[3];                          // The acceleration, less gravity, at the last update (milli-g, North-East-Down).
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Create an attitude and heading reference system. It does nothing until enabled.
+         *
+         * @param accelerometer The accelerometer to read samples from.
+         * @param compass The compass to read samples from.
+         * @param id The id the AHRS should use when sending events on the MessageBus. Defaults to DEVICE_ID_AHRS.
+         */
+        MicroBitAHRS(MicroBitAccelerometer &accelerometer, MicroBitCompass &compass, uint16_t id = DEVICE_ID_AHRS);
+
+        /**
+         * Starts estimating orientation. The estimate is initialised directly from the next samples received.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int enable();
+
+        /**
+         * Stops estimating orientation.
+         *
+         * @return MICROBIT_OK on success.
+         */
+        int disable();
+
+        /**
+         * Determines if orientation is being estimated.
+         *
+         * @return true if enabled, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Sets the time between updates of the orientation estimate. Samples received in between are averaged.
+         *
+         * @param period The time between updates, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the period is not positive.
+         */
+        int setPeriod(int period);
+
+        /**
+         * Reads the time between updates of the orientation estimate.
+         *
+         * @return The time between updates, in milliseconds.
+         */
+        int getPeriod();
+
+        /**
+         * Sets the gain of the feedback that corrects the orientation estimate towards the sensors.
+         *
+         * The estimate settles with a time constant of roughly 1/gain seconds.
+         *
+         * @param gain The gain, per second.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the gain is not positive.
+         */
+        int setGain(float gain);
+
+        /**
+         * Reads the gain of the feedback that corrects the orientation estimate towards the sensors.
+         *
+         * @return The gain, per second.
+         */
+        float getGain();
+
+        /**
+         * Reads the orientation estimate.
+         *
+         * @return A unit quaternion, rotating vectors from the device's North-East-Down frame to the earth's.
+         */
+        MicroBitQuaternion getQuaternion();
+
+        /**
+         * Reads the roll of the device (rotation about its North axis), using the aerospace convention.
+         *
+         * @return The roll, in the range -PI..PI radians.
+         */
+        float getRollRadians();
+
+        /**
+         * Reads the pitch of the device (rotation about its East axis), using the aerospace convention.
+         *
+         * @return The pitch, in the range -PI/2..PI/2 radians.
+         */
+        float getPitchRadians();
+
+        /**
+         * Reads the yaw of the device (rotation about the Down axis, from magnetic north), using the aerospace convention.
+         *
+         * @return The yaw, in the range -PI..PI radians.
+         */
+        float getYawRadians();
+
+        /**
+         * Reads the roll of the device (rotation about its North axis), using the aerospace convention.
+         *
+         * @return The roll, in the range -180..180 degrees.
+         */
+        int getRoll();
+
+        /**
+         * Reads the pitch of the device (rotation about its East axis), using the aerospace convention.
+         *
+         * @return The pitch, in the range -90..90 degrees.
+         */
+        int getPitch();
+
+        /**
+         * Reads the yaw of the device, as a heading from magnetic north.
+         *
+         * @return The yaw, in the range 0..359 degrees.
+         */
+        int getYaw();
+
+        /**
+         * Reads the acceleration of the device with gravity removed, at the last update.
+         *
+         * @return The acceleration in milli-g, in the accelerometer's default coordinate system.
+         */
+        Sample3D getLinearAcceleration();
+
+        /**
+         * Reads any new samples from the sensors' sample buffers, and updates the orientation estimate
+         * when the update period has elapsed.
+         */
+        virtual void idleCallback() override;
+
+        private:
+
+        /**
+         * Initialises the orientation estimate directly from the mean acceleration and latest compass sample.
+         */
+        void initialise();
+
+        /**
+         * Corrects the orientation estimate towards the mean acceleration and latest compass sample.
+         *
+         * @param dt The time since the last update, in seconds.
+         */
+        void update(float dt);
+
+        /**
+         * Calculates the acceleration, less gravity, from the mean acceleration and the orientation estimate.
+         */
+        void updateLinearAcceleration();
+    };
+}
+
+#endif
@@ -33,6 +33,45 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/driver-models/I2C.h"
 #include "codal-core/inc/driver-models/Pin.h"
 #include "codal-core/inc/types/CoordinateSystem.h"
+#include "MicroBitSampleBuffer.h"
+#include "MicroBitOrientation.h"
+#include "MicroBitSensorDemand.h"
+
+// LSM303AGR accelerometer registers used by stream mode.
+#define MICROBIT_ACCELEROMETER_LSM303_ADDRESS       0x32
+#define MICROBIT_ACCELEROMETER_LSM303_CTRL_REG2     0x21
+#define MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3     0x22
+#define MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5     0x24
+#define MICROBIT_ACCELEROMETER_LSM303_REFERENCE     0x26
+#define MICROBIT_ACCELEROMETER_LSM303_OUT_X_L       0x28
+#define MICROBIT_ACCELEROMETER_LSM303_FIFO_CTRL     0x2E
+#define MICROBIT_ACCELEROMETER_LSM303_FIFO_SRC      0x2F
+#define MICROBIT_ACCELEROMETER_LSM303_INT1_CFG      0x30
+#define MICROBIT_ACCELEROMETER_LSM303_INT1_SRC      0x31
+#define MICROBIT_ACCELEROMETER_LSM303_INT1_THS      0x32
+#define MICROBIT_ACCELEROMETER_LSM303_INT1_DURATION 0x33
+
+#define MICROBIT_ACCELEROMETER_LSM303_FIFO_SIZE     32          // Number of samples held by the hardware FIFO.
+
+// Number of samples in the hardware FIFO that raise the watermark interrupt in stream mode, in the range 1..31.
+#ifndef MICROBIT_ACCELEROMETER_FIFO_WATERMARK
+#define MICROBIT_ACCELEROMETER_FIFO_WATERMARK       25
+#endif
+
+// Change in acceleration on any axis that wakes gesture processing when motion wake is enabled, in milli-g.
+#ifndef MICROBIT_ACCELEROMETER_MOTION_THRESHOLD
+#define MICROBIT_ACCELEROMETER_MOTION_THRESHOLD     96
+#endif
+
+// Time without motion after which gesture processing sleeps when motion wake is enabled, in milliseconds.
+#ifndef MICROBIT_ACCELEROMETER_MOTION_TIMEOUT
+#define MICROBIT_ACCELEROMETER_MOTION_TIMEOUT       2000
+#endif
+
+// Number of samples held in the accelerometer's sample buffer.
+#ifndef MICROBIT_ACCELEROMETER_SAMPLE_BUFFER_SIZE
+#define MICROBIT_ACCELEROMETER_SAMPLE_BUFFER_SIZE   64
+#endif
 
 
 /**
@@ -40,6 +79,63 @@ DEALINGS IN THE SOFTWARE.
  */
 class MicroBitAccelerometer : public Accelerometer
 {
+        MicroBitI2C             &i2cBus;                // The I2C bus the accelerometer is attached to.
+        MicroBitSampleBuffer    *samples;               // Timestamped samples, allocated when first requested.
+        bool                    streaming;              // Whether or not the hardware FIFO is in use.
+        uint8_t                 streamWatermark;        // The FIFO level at which the watermark interrupt is raised.
+        uint8_t                 streamInterrupts;       // The interrupt configuration of the driver, restored when streaming stops.
+        bool                    motionWake;             // Whether or not gesture processing sleeps until the hardware detects motion.
+        bool                    motionStream;           // Whether or not streaming was started by setMotionWake().
+        bool                    dozing;                 // Whether or not gesture processing is waiting for the motion interrupt.
+        int                     motionThreshold;        // The change in acceleration that counts as motion, in milli-g.
+        CODAL_TIMESTAMP         lastMotion;             // The time motion was last detected.
+        MicroBitOrientationAccuracy orientationAccuracy; // The accuracy with which pitch and roll are calculated.
+        bool                    orientationValid;       // Whether or not the cached pitch and roll are of orientationSample.
+        Sample3D                orientationSample;      // The sample the cached pitch and roll were calculated from.
+        float                   pitchRadians;           // The cached pitch, in radians.
+        float                   rollRadians;            // The cached roll, in radians.
+
+        /**
+         * Configures the hardware FIFO in stream mode, raising the watermark interrupt on irq1.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the accelerometer could not be configured.
+         */
+        int configureStream();
+
+        /**
+         * Reads all samples held in the hardware FIFO in a single burst, and adds them to the stream.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the FIFO could not be read.
+         */
+        int readStream();
+
+        /**
+         * Configures (or removes) the high-pass filtered motion interrupt on INT1, used by motion wake.
+         *
+         * @param enable true to detect motion, false to stop.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the accelerometer could not be configured.
+         */
+        int configureMotion(bool enable);
+
+        /**
+         * Runs the accelerometer at the sample period required by its consumers, or stops it if there are none.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+         */
+        int applyDemand();
+
+        /**
+         * Adds each new sample read by the driver to the sample buffer.
+         */
+        void onSampleUpdate(MicroBitEvent);
+
+        /**
+         * Recalculates the pitch and roll with the approximations selected by setOrientationAccuracy(),
+         * unless they have already been calculated from the latest sample.
+         */
+        void updateOrientation();
+
     public:
 
         static Accelerometer* driver;                     // The instance of an Accelerometer driver.
@@ -86,6 +182,28 @@ class MicroBitAccelerometer : public Accelerometer
          */
         int getPeriod();
 
+        /**
+         * Records the sample period a consumer of the accelerometer requires, and runs the accelerometer at the shortest
+         * period any consumer has requested. Consumers should release their request once they no longer need samples.
+         *
+         * @param consumer The id of the consuming component, e.g. MICROBIT_ID_GESTURE.
+         * @param period The longest time between samples the consumer can accept, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer id is zero or the period is not positive,
+         * MICROBIT_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered, or MICROBIT_I2C_ERROR.
+         */
+        int requestPeriod(uint16_t consumer, int period);
+
+        /**
+         * Removes the sample period a consumer requested with requestPeriod(). Once no consumers remain, background
+         * sampling stops and the accelerometer is put to sleep, until a new request is made, or it is read through this object.
+         *
+         * @param consumer The id of the consuming component.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer has no request recorded, or MICROBIT_I2C_ERROR.
+         */
+        int releasePeriod(uint16_t consumer);
+
         /**
          * Attempts to set the sample range of the accelerometer to the specified value (in g).
          *
@@ -215,6 +333,26 @@ class MicroBitAccelerometer : public Accelerometer
          */
         float getRollRadians();
 
+        /**
+         * Selects the accuracy with which pitch and roll are calculated.
+         *
+         * The approximations are considerably quicker than the precise maths library functions, and suit applications
+         * that read the orientation every frame. However accurate, the pitch and roll are only calculated once for each
+         * sample, so repeated calls between updates are free.
+         *
+         * @param accuracy ORIENTATION_ACCURACY_PRECISE, ORIENTATION_ACCURACY_FAST or ORIENTATION_ACCURACY_FASTEST.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+         */
+        int setOrientationAccuracy(MicroBitOrientationAccuracy accuracy);
+
+        /**
+         * Determines the accuracy with which pitch and roll are calculated.
+         *
+         * @return The accuracy, which defaults to MICROBIT_ORIENTATION_ACCURACY.
+         */
+        MicroBitOrientationAccuracy getOrientationAccuracy();
+
         /**
          * Retrieves the last recorded gesture.
          *
@@ -229,6 +367,101 @@ class MicroBitAccelerometer : public Accelerometer
          */
         uint16_t getGesture();
 
+        /**
+         * Starts streaming samples through the accelerometer's hardware FIFO.
+         *
+         * Samples collect in the FIFO until the watermark level is reached, and irq1 is raised. The whole FIFO is then
+         * read in a single burst I2C transaction, and each sample is timestamped and added to a ring buffer that is
+         * read with readSamples(). This takes far fewer bus transactions than reading each sample individually.
+         * While streaming, getSample(), gestures and tilt compensation are all driven from the streamed samples.
+         *
+         * @param watermark The number of samples to collect before they are read, in the range 1..31.
+         *        Defaults to MICROBIT_ACCELEROMETER_FIFO_WATERMARK.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the watermark is out of range,
+         *         MICROBIT_NOT_SUPPORTED if the accelerometer has no FIFO, or MICROBIT_I2C_ERROR.
+         */
+        int startStream(int watermark = MICROBIT_ACCELEROMETER_FIFO_WATERMARK);
+
+        /**
+         * Stops streaming samples, returning the accelerometer to reading one sample at a time.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+         */
+        int stopStream();
+
+        /**
+         * Determines if samples are being streamed through the hardware FIFO.
+         *
+         * @return true if streaming, false otherwise.
+         */
+        bool isStreaming();
+
+        /**
+         * Enables or disables motion wake, which lets gesture processing sleep while the device is still.
+         *
+         * Samples are streamed through the hardware FIFO, and the accelerometer's motion interrupt (a high-pass
+         * filtered threshold on every axis) is also routed to irq1. Once no motion has been detected for
+         * MICROBIT_ACCELEROMETER_MOTION_TIMEOUT milliseconds, the watermark interrupt is masked, so no samples are
+         * read over I2C, and no gestures processed, until the motion interrupt fires. The FIFO is then read in one burst,
+         * and the samples leading up to the motion classified as usual. While asleep, the last sample and gesture are
+         * reported unchanged.
+         *
+         * @param enable true to enable motion wake, false to disable it.
+         * @param threshold The change in acceleration on any axis that counts as motion, in milli-g.
+         *        Defaults to MICROBIT_ACCELEROMETER_MOTION_THRESHOLD.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the accelerometer has no FIFO, or MICROBIT_I2C_ERROR.
+         */
+        int setMotionWake(bool enable, int threshold = MICROBIT_ACCELEROMETER_MOTION_THRESHOLD);
+
+        /**
+         * Determines if motion wake is enabled.
+         *
+         * @return true if enabled, false otherwise.
+         */
+        bool isMotionWake();
+
+        /**
+         * Determines if gesture processing is asleep, waiting for motion.
+         *
+         * @return true if asleep, false otherwise.
+         */
+        bool isDozing();
+
+        /**
+         * Provides the buffer of recent timestamped samples, starting to record them if this is the first request.
+         *
+         * Every sample is recorded, whether read one at a time by the driver or in bursts while streaming.
+         * Each consumer opens its own MicroBitSampleCursor on the buffer, and so reads every sample at its own pace,
+         * with any it falls too far behind to read counted as overruns.
+         *
+         * @return The sample buffer.
+         *
+         * @code
+         * MicroBitSampleCursor cursor;
+         * accelerometer.getSampleBuffer().open(cursor);
+         * ...
+         * int n = accelerometer.getSampleBuffer().read(cursor, samples, 16);
+         * @endcode
+         */
+        MicroBitSampleBuffer& getSampleBuffer();
+
+        /**
+         * Reads recorded samples, oldest first, using the sample buffer's own cursor.
+         *
+         * @param buffer The memory to read the samples into.
+         * @param count The maximum number of samples to read.
+         *
+         * @return The number of samples read.
+         */
+        int readSamples(MicroBitSample *buffer, int count);
+
+        /**
+         * Checks for streamed samples waiting in the hardware FIFO, when the scheduler is idle.
+         */
+        virtual void idleCallback() override;
+
         /**
          * Destructor.
          */
@@ -34,29 +34,60 @@ DEALINGS IN THE SOFTWARE.
 #include "StreamSplitter.h"
 #include "LevelDetector.h"
 #include "LevelDetectorSPL.h"
+#include "MicrophoneFilter.h"
 #include "LowPassFilter.h"
+#include "SpectrumAnalyser.h"
+#include "SoundLevelDetector.h"
+#include "MicroBitMemoryConsumer.h"
 
 // Status Flags
 #define MICROBIT_AUDIO_STATUS_DEEPSLEEP       0x0001
 #define CONFIG_DEFAULT_MICROPHONE_GAIN 0.1f
 
+// Set to 1 to build each stage of the microphone pipeline only when it is first used, saving RAM in programs
+// that never use the microphone. The member pointers are then NULL until requested through their accessors,
+// so this is only safe for code that never dereferences them directly. By default the pipeline is built up front.
+#ifndef CONFIG_MICROBIT_AUDIO_LAZY_MIC
+#define CONFIG_MICROBIT_AUDIO_LAZY_MIC 0
+#endif
+
+// micFilter used to be a LowPassFilter, and is now a MicrophoneFilter: the same response, in fixed point.
+// Set to 1 to keep the LowPassFilter, for code that depends on its type. Portable code should use MicroBitAudio::MicFilter.
+#ifndef CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER
+#define CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER 0
+#endif
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER) && CONFIG_MICROPHONE_FILTER_DECIMATION != 1
+#error "CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER can't decimate: set CONFIG_MICROPHONE_FILTER_DECIMATION to 1"
+#endif
+
 namespace codal
 {
     /**
      * Class definition for MicroBitAudio
      */
-    class MicroBitAudio : public CodalComponent
+    class MicroBitAudio : public CodalComponent, public MicroBitMemoryConsumer
     {
         public:
+#if CONFIG_ENABLED(CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER)
+        typedef LowPassFilter MicFilter;        // The type of micFilter.
+#else
+        typedef MicrophoneFilter MicFilter;     // The type of micFilter.
+#endif
+
         static MicroBitAudio    *instance;      // Primary instance of MicroBitAudio, on demand activated.
         Mixer2                  mixer;          // Multi channel audio mixer
         NRF52ADCChannel *mic;                   // Microphone ADC Channel from uBit.IO
+
+        // Stages of the microphone pipeline. With CONFIG_MICROBIT_AUDIO_LAZY_MIC, each is NULL until first requested through its accessor below.
         StreamNormalizer        *processor;     // Stream Normaliser instance
         StreamSplitter          *splitter;      // Stream Splitter instance (8bit normalized output)
         StreamSplitter          *rawSplitter;   // Stream Splitter instance (raw input)
         LevelDetector           *level;         // Level Detector instance
         LevelDetectorSPL        *levelSPL;      // Level Detector SPL instance
-        LowPassFilter           *micFilter;     // Low pass filter to remove high frequency noise on the mic
+        MicFilter               *micFilter;     // Low pass filter to remove high frequency noise on the mic
+        SpectrumAnalyser        *spectrum;      // Shared spectrum analyser on the mic, created on first use
+        SoundLevelDetector      *soundLevel;    // Fixed point sound level detector on the raw mic stream
 
         private:
         bool speakerEnabled;                    // State of on board speaker
@@ -66,6 +97,7 @@ namespace codal
         SoundEmojiSynthesizer synth;            // Synthesizer used bfor SoundExpressions
         MixerChannel *soundExpressionChannel;   // Mixer channel associated with sound expression audio
         NRF52PWM *pwm;                          // PWM driver used for sound generation (mixer output)
+        int sampleRate;                         // Output sample rate of the mixer and PWM driver (samples per second)
         NRF52ADC &adc;                          // ADC from MicroBitConstructor
         NRF52Pin &microphone;                   // Microphone pin passed from MicroBit constructor
         NRF52Pin &runmic;                       // Runmic pin passed from MicroBit constructor
@@ -97,6 +129,12 @@ namespace codal
           */
         void onSplitterEvent(MicroBitEvent);
 
+        /**
+          * Catch events from the mixer, so that the PWM can be powered down while the mixer is suspended.
+          * @param MicroBitEvent
+          */
+        void onMixerEvent(MicroBitEvent);
+
         /**
           * Activate Mic
           */
@@ -112,6 +150,82 @@ namespace codal
           */
         void deactivateLevelSPL();
 
+        /**
+          * Obtain the low pass filtered (and decimated, if CONFIG_MICROPHONE_FILTER_DECIMATION is above 1)
+          * microphone stream, creating it if necessary.
+          * @return the microphone filter.
+          */
+        MicFilter *getMicFilter();
+
+        /**
+          * Obtain the splitter carrying the raw (filtered, but not normalised) microphone stream, creating it if necessary.
+          * @return the raw splitter.
+          */
+        StreamSplitter *getRawSplitter();
+
+        /**
+          * Obtain the normaliser for the microphone stream, creating it (and its upstream stages) if necessary.
+          * @return the stream normaliser.
+          */
+        StreamNormalizer *getProcessor();
+
+        /**
+          * Obtain the splitter carrying the normalised 8 bit microphone stream, creating it if necessary.
+          * @return the normalised splitter.
+          */
+        StreamSplitter *getSplitter();
+
+        /**
+          * Obtain the level detector on the normalised microphone stream, creating it if necessary.
+          * @return the level detector.
+          */
+        LevelDetector *getLevelDetector();
+
+        /**
+          * Obtain the sound pressure level detector on the raw microphone stream, creating it if necessary.
+          * @return the SPL level detector.
+          */
+        LevelDetectorSPL *getLevelDetectorSPL();
+
+        /**
+          * Obtain the fixed point sound level detector on the raw microphone stream, creating it if necessary.
+          * It processes audio only while polled, or while activated for event listeners.
+          * @return the sound level detector.
+          */
+        SoundLevelDetector *getSoundLevelDetector();
+
+        /**
+          * Obtain the spectrum analyser shared by all users of the microphone, creating it if necessary.
+          * Analysis starts when the analyser is first queried, or a band is monitored.
+          * @return the shared SpectrumAnalyser.
+          */
+        SpectrumAnalyser *getSpectrumAnalyser();
+
+        /**
+          * Stop the microphone and free every stage of its pipeline, returning the memory to the heap.
+          * Stages are rebuilt on demand the next time they are requested.
+          *
+          * @note Any pointer previously obtained to a stage (or a component connected to one) is invalid afterwards.
+          * @return DEVICE_OK.
+          */
+        int releaseMicrophone();
+
+        /**
+          * Determine how much heap memory the microphone pipeline currently holds.
+          * @return The number of bytes allocated to pipeline stages, or zero if none have been created.
+          */
+        int getMicrophoneHeapUsage();
+
+        /**
+          * Determine how much heap memory audio currently holds: the microphone pipeline, and the PWM driver
+          * created when sound is first played.
+          *
+          * @note The pipeline is not freed by releaseMemory(), as that would invalidate pointers to its stages.
+          * Use releaseMicrophone() once they are no longer needed.
+          * @return The number of bytes allocated.
+          */
+        virtual uint32_t getMemoryUsage();
+
         /**
           * Set normaliser gain
           * @param gain value to set the microphone gain to
@@ -141,6 +255,20 @@ namespace codal
         */
         int setVolume(int volume);
 
+        /**
+        * Define the output sample rate of the audio pipeline.
+        * Lower rates reduce the CPU time spent mixing, at the expense of audio quality.
+        * @param sampleRate The new sample rate in samples per second. Defaults to 44100.
+        * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER
+        */
+        int setSampleRate(int sampleRate);
+
+        /**
+         * Get the current output sample rate.
+         * @return The output sample rate in samples per second.
+         */
+        int getSampleRate();
+
         /**
          * Enable or disable use of the on-board speaker.
          * @param on New value.
@@ -54,6 +54,9 @@ class MicroBitBLEChar
     bool indicateChrValue(  microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
     bool writeChrValue(     microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
 
+    // Notify the value already held by the attribute, returning the SoftDevice's error code.
+    uint32_t notifyCurrentValue( microbit_gaphandle_t connection, uint16_t length);
+
     microbit_charhandles_t  *charHandles() { return &handles; }
     
     bool cccdNotify()   { return cccd & BLE_GATT_HVX_NOTIFICATION; }
@@ -38,6 +38,8 @@ DEALINGS IN THE SOFTWARE.
   */
 class MicroBitBLEService
 {
+    friend class MicroBitBLEServices;
+
     public:
 
     typedef struct microbit_onDataRead_t
@@ -101,8 +103,25 @@ class MicroBitBLEService
     bool setChrValue( int idx, const uint8_t *data, uint16_t length)
     { return characteristicPtr( idx)->setChrValue( getConnectionHandle(), data, length); }
 
-    bool notifyChrValue( int idx, const uint8_t *data, uint16_t length)
-    { return characteristicPtr( idx)->notifyChrValue( getConnectionHandle(), data, length); }
+    /**
+      * Notify a value, if the SoftDevice can queue it now and this service has a credit to send it.
+      * @return true if the notification was queued. Otherwise the caller may retry in onHVNTxComplete().
+      */
+    bool notifyChrValue( int idx, const uint8_t *data, uint16_t length);
+
+    /**
+      * Notify a value, or hold it until the SoftDevice has room, in place of any value already held for
+      * the characteristic. Suits characteristics where only the latest value matters.
+      * @return true if the notification was queued or held.
+      */
+    bool queueChrValue( int idx, const uint8_t *data, uint16_t length);
+
+    /**
+      * Set the number of notifications this service may have queued in the SoftDevice at once,
+      * so that a busy service leaves room for others.
+      * @param credits from 1 to MICROBIT_BLE_HVN_TX_QUEUE_SIZE.
+      */
+    void setTxCredits( int credits);
 
     bool indicateChrValue( int idx, const uint8_t *data, uint16_t len)
     { return characteristicPtr( idx)->indicateChrValue( getConnectionHandle(), data, len); }
@@ -132,12 +151,16 @@ class MicroBitBLEService
     virtual void onAuthorizeRead(       const microbit_ble_evt_t *p_ble_evt);
     virtual void onAuthorizeWrite(      const microbit_ble_evt_t *p_ble_evt);
     virtual void onHVC(                 const microbit_ble_evt_t *p_ble_evt);
+    virtual void onHVNTxComplete(       const microbit_ble_evt_t *p_ble_evt);
 
     protected:
 
     uint8_t                     bs_uuid_type;
     microbit_servicehandle_t    bs_service_handle;
 
+    uint8_t                     bs_tx_credits;
+    uint8_t                     bs_tx_in_flight;
+
     static const uint8_t        bs_base_uuid[16];
 };
 
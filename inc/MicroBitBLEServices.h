@@ -41,9 +41,18 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_BLE_SERVICES_OBSERVER_PRIO 2
 #endif
 
+// Number of characteristics that can hold a value waiting for room in the SoftDevice, c.f. MicroBitBLEService::queueChrValue()
+#ifndef MICROBIT_BLE_SERVICES_HELD_MAX
+#define MICROBIT_BLE_SERVICES_HELD_MAX 16
+#endif
+
 
 /**
   * Class definition for MicroBitBLEServices.
+  *
+  * Also shares the SoftDevice's notification queue between services. The service sending each queued
+  * notification is recorded, so that its credit is returned once it has been transmitted, and values held
+  * by MicroBitBLEService::queueChrValue() are sent, oldest first, as the queue empties.
   */
 class MicroBitBLEServices
 {
@@ -70,8 +79,56 @@ class MicroBitBLEServices
     
     void onBleEvent( microbit_ble_evt_t const * p_ble_evt);
 
+    /**
+      * Record a notification queued by a service, taking one of its credits.
+      */
+    void txQueued( MicroBitBLEService *service);
+
+    /**
+      * Hold the latest value of a characteristic, already set in its attribute, to notify when there is room.
+      * @return true if the value is held.
+      */
+    bool txHold( MicroBitBLEService *service, int idx, uint16_t length);
+
+    /**
+      * Determine whether a value is held for a characteristic.
+      */
+    bool txHeld( MicroBitBLEService *service, int idx);
+
+    private:
+
+    /**
+      * Return the credits of notifications transmitted, and send held values while there is room.
+      */
+    void txComplete( int count);
+
+    /**
+      * Forget all queued and held notifications, as on disconnection.
+      */
+    void txReset();
+
+    typedef struct microbit_held_t
+    {
+        MicroBitBLEService  *service;
+        uint8_t             idx;
+        uint16_t            length;
+    } microbit_held_t;
+
+    public:
+
     int                  bs_services_count;
     MicroBitBLEService   *bs_services[ MICROBIT_BLE_SERVICES_MAX];
+
+    private:
+
+    // The service that queued each notification in the SoftDevice, oldest first.
+    MicroBitBLEService   *bs_tx_owner[ MICROBIT_BLE_HVN_TX_QUEUE_SIZE];
+    int                  bs_tx_head;
+    int                  bs_tx_count;
+
+    // Characteristics with a value waiting for room, oldest first.
+    microbit_held_t      bs_held[ MICROBIT_BLE_SERVICES_HELD_MAX];
+    int                  bs_held_count;
 };
 
 
@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BOOT_TRACE_H
+#define MICROBIT_BOOT_TRACE_H
+
+#include "CodalConfig.h"
+
+// The maximum number of phases of startup that can be recorded.
+#ifndef MICROBIT_BOOT_TRACE_MAX_PHASES
+#define MICROBIT_BOOT_TRACE_MAX_PHASES          16
+#endif
+
+namespace codal
+{
+    /**
+     * The completion of one phase of startup.
+     */
+    struct MicroBitBootPhase
+    {
+        const char  *name;              // The name of the phase, or NULL if no such phase was recorded.
+        uint32_t    time;               // When the phase completed, in microseconds since the system timer started.
+    };
+
+    /**
+     * Class definition for MicroBitBootTrace.
+     *
+     * Records when each phase of startup completes, so that the time taken to reach user code can be
+     * measured and attributed.
+     */
+    class MicroBitBootTrace
+    {
+        MicroBitBootPhase   phases[MICROBIT_BOOT_TRACE_MAX_PHASES];
+        int                 count;
+
+        public:
+
+        /**
+         * Constructor. Creates an empty trace.
+         */
+        MicroBitBootTrace();
+
+        /**
+         * Records that a phase of startup has just completed.
+         *
+         * @param name The name of the phase. This is not copied, so should be a string literal.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if MICROBIT_BOOT_TRACE_MAX_PHASES phases have already been recorded.
+         */
+        int record(const char *name);
+
+        /**
+         * Reads the number of phases recorded.
+         *
+         * @return The number of phases.
+         */
+        int getCount();
+
+        /**
+         * Reads a recorded phase.
+         *
+         * @param index The index of the phase, in the order recorded.
+         *
+         * @return The phase, or one with a NULL name if the index is out of range.
+         */
+        MicroBitBootPhase getPhase(int index);
+
+        /**
+         * Reads the time between two recorded phases.
+         *
+         * @param from The index of the earlier phase, or -1 to measure from the start of the system timer.
+         * @param to The index of the later phase.
+         *
+         * @return The time between the phases, in microseconds, or MICROBIT_INVALID_PARAMETER if either index is out of range.
+         */
+        int getDuration(int from, int to);
+
+        /**
+         * Writes the trace to the debug log, with the duration of each phase.
+         */
+        void print();
+    };
+}
+
+#endif
@@ -29,12 +29,44 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitComponent.h"
 #include "CoordinateSystem.h"
 #include "MicroBitAccelerometer.h"
+#include "MicroBitSampleBuffer.h"
+#include "MicroBitOrientation.h"
+
+// Number of samples held in the compass's sample buffer.
+#ifndef MICROBIT_COMPASS_SAMPLE_BUFFER_SIZE
+#define MICROBIT_COMPASS_SAMPLE_BUFFER_SIZE         32
+#endif
 
 /**
  * Class definition for a general e-compass.
  */
 class MicroBitCompass : public Compass
 {
+        MicroBitSampleBuffer*       samples;          // Timestamped samples, allocated when first requested.
+        MicroBitOrientationAccuracy orientationAccuracy; // The accuracy with which the heading is calculated.
+        bool                        headingValid;     // Whether or not the cached heading is of headingSample and headingGravity.
+        Sample3D                    headingSample;    // The magnetometer sample the cached heading was calculated from.
+        Sample3D                    headingGravity;   // The accelerometer sample the cached heading was calculated from.
+        int                         headingDegrees;   // The cached heading, in degrees.
+
+        /**
+         * Adds each new sample read by the driver to the sample buffer.
+         */
+        void onSampleUpdate(MicroBitEvent);
+
+        /**
+         * Recalculates the tilt compensated heading with the approximations selected by setOrientationAccuracy(),
+         * unless it has already been calculated from the latest magnetometer and accelerometer samples.
+         */
+        void updateHeading();
+
+        /**
+         * Runs the compass at the sample period required by its consumers, or stops it if there are none.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+         */
+        int applyDemand();
+
     public:
         static Compass*             driver;          // The instance of a MicroBitAcelerometer driver.
         MicroBitAccelerometer*      accelerometer;    // The accelerometer to use for tilt compensation.
@@ -75,6 +107,26 @@ class MicroBitCompass : public Compass
          */
         int heading();
 
+        /**
+         * Selects the accuracy with which the tilt compensated heading is calculated.
+         *
+         * The approximations are considerably quicker than the precise maths library functions, and suit applications
+         * that read the heading every frame. Approximated headings are only calculated once for each pair of
+         * magnetometer and accelerometer samples, so repeated calls between updates are free.
+         *
+         * @param accuracy ORIENTATION_ACCURACY_PRECISE, ORIENTATION_ACCURACY_FAST or ORIENTATION_ACCURACY_FASTEST.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+         */
+        int setOrientationAccuracy(MicroBitOrientationAccuracy accuracy);
+
+        /**
+         * Determines the accuracy with which the tilt compensated heading is calculated.
+         *
+         * @return The accuracy, which defaults to MICROBIT_ORIENTATION_ACCURACY.
+         */
+        MicroBitOrientationAccuracy getOrientationAccuracy();
+
         /**
          * Determines the overall magnetic field strength based on the latest update from the magnetometer.
          *
@@ -176,6 +228,28 @@ class MicroBitCompass : public Compass
          */
         int getPeriod();
 
+        /**
+         * Records the sample period a consumer of the compass requires, and runs the compass at the shortest
+         * period any consumer has requested. Consumers should release their request once they no longer need samples.
+         *
+         * @param consumer The id of the consuming component, e.g. DEVICE_ID_AHRS.
+         * @param period The longest time between samples the consumer can accept, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer id is zero or the period is not positive,
+         * MICROBIT_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered, or MICROBIT_I2C_ERROR.
+         */
+        int requestPeriod(uint16_t consumer, int period);
+
+        /**
+         * Removes the sample period a consumer requested with requestPeriod(). Once no consumers remain, background
+         * sampling stops and the compass is put to sleep, until a new request is made, or it is read through this object.
+         *
+         * @param consumer The id of the consuming component.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer has no request recorded, or MICROBIT_I2C_ERROR.
+         */
+        int releasePeriod(uint16_t consumer);
+
         /**
          * Poll to see if new data is available from the hardware. If so, update it.
          * n.b. it is not necessary to explicitly call this funciton to update data
@@ -241,6 +315,23 @@ class MicroBitCompass : public Compass
          */
         int getZ();
 
+        /**
+         * Provides the buffer of recent timestamped samples, starting to record them if this is the first request.
+         *
+         * Each consumer opens its own MicroBitSampleCursor on the buffer, and so reads every sample at its own pace,
+         * with any it falls too far behind to read counted as overruns.
+         *
+         * @return The sample buffer.
+         *
+         * @code
+         * MicroBitSampleCursor cursor;
+         * compass.getSampleBuffer().open(cursor);
+         * ...
+         * int n = compass.getSampleBuffer().read(cursor, samples, 16);
+         * @endcode
+         */
+        MicroBitSampleBuffer& getSampleBuffer();
+
         /**
          * updateSample() method maintained here as an inline method purely for backward compatibility.
          */
@@ -32,6 +32,28 @@ DEALINGS IN THE SOFTWARE.
 #include "Accelerometer.h"
 #include "MicroBitDisplay.h"
 #include "MicroBitStorage.h"
+#include "MicroBitCompassFit.h"
+
+// Whether or not calibration corrects for soft iron distortion, by fitting an ellipsoid rather than a sphere.
+#ifndef MICROBIT_COMPASS_CALIBRATION_SOFT_IRON
+#define MICROBIT_COMPASS_CALIBRATION_SOFT_IRON        1
+#endif
+
+// The number of samples background calibration collects for each fit.
+#ifndef MICROBIT_COMPASS_BACKGROUND_SAMPLES
+#define MICROBIT_COMPASS_BACKGROUND_SAMPLES           48
+#endif
+
+// The minimum distance between samples collected by background calibration, in nano teslas.
+// Samples closer than this to the last one collected add little to the fit, and are ignored.
+#ifndef MICROBIT_COMPASS_BACKGROUND_SPACING
+#define MICROBIT_COMPASS_BACKGROUND_SPACING           5000
+#endif
+
+// The largest residual error of a background fit, as a fraction of its radius, that is applied to the compass.
+#ifndef MICROBIT_COMPASS_BACKGROUND_MAXIMUM_ERROR
+#define MICROBIT_COMPASS_BACKGROUND_MAXIMUM_ERROR     0.03f
+#endif
 
 namespace codal
 {
@@ -39,8 +61,9 @@ namespace codal
      * Class definition for an interactive compass calibration algorithm.
      *
      * The algorithm uses an accelerometer to ensure that a broad range of sample data has been gathered
-     * from the compass module, then performs a least mean squares optimisation of the
-     * results to determine the calibration data for the compass.
+     * from the compass module, then performs a least squares fit of the results to a sphere (or ellipsoid)
+     * to determine the calibration data for the compass. The fit is accumulated as each sample is gathered,
+     * so the calibration is ready as soon as the last sample is taken.
      *
      * The LED matrix display is used to provide feedback to the user on the gestures required.
      *
@@ -53,6 +76,16 @@ namespace codal
         Accelerometer&          accelerometer;
         MicroBitDisplay&        display;
         MicroBitStorage*        storage;
+        MicroBitCompassFit*     background;             // The fit of background calibration, allocated while it is running.
+        Sample3D                backgroundLast;         // The last sample collected by background calibration.
+        Sample3D                backgroundMin;          // The smallest value collected on each axis, to measure coverage.
+        Sample3D                backgroundMax;          // The largest value collected on each axis, to measure coverage.
+
+        /**
+         * Adds each sufficiently distinct compass sample to the background fit, and applies the fit
+         * to the compass once enough samples are collected, if it is good enough.
+         */
+        void onBackgroundSample(MicroBitEvent);
 
         public:
 
@@ -101,6 +134,35 @@ namespace codal
       * This function is, by design, synchronous and only returns once calibration is complete.
       */
     void calibrateUX(MicroBitEvent);
+
+    /**
+      * Starts refining the hard iron calibration of the compass in the background.
+      *
+      * Samples are collected from the compass as it is used, and fitted to a sphere once MICROBIT_COMPASS_BACKGROUND_SAMPLES
+      * are collected. The centre of the fit replaces that of the compass calibration (keeping any soft iron scale) if the
+      * samples cover at least a radius on each axis, and their residual error is within MICROBIT_COMPASS_BACKGROUND_MAXIMUM_ERROR.
+      * Otherwise they are discarded, and collection starts again. Background updates are not written to storage.
+      *
+      * Each sample costs a few dozen multiplications, and each fit a small linear solve, so there are no CPU spikes.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the fit could not be allocated.
+      */
+    int startBackgroundCalibration();
+
+    /**
+      * Stops refining the calibration of the compass in the background, discarding any samples collected.
+      *
+      * @return MICROBIT_OK.
+      */
+    int stopBackgroundCalibration();
+
+    /**
+      * Determines if the calibration of the compass is being refined in the background.
+      *
+      * @return true if background calibration is running, false otherwise.
+      */
+    bool isBackgroundCalibrating();
+
      /**
       * Calculates an independent X, Y, Z scale factor and centre for a given set of data points,
       * assumed to be on a bounding sphere
@@ -112,47 +174,23 @@ namespace codal
       * points provides a more robust calculation.
       *
       * @return A calibration structure containing the a calculated centre point, the radius of the
-      * minimum enclosing spere of points and a scaling factor for each axis that places those
-      * points as close as possible to the surface of the containing sphere.
+      * sphere the points are scaled onto, and a scaling factor for each axis that places those
+      * points as close as possible to the surface of that sphere.
       */
      static CompassCalibration calibrate(Sample3D *data, int samples);
 
-    private:
-
-    /**
-     * Scoring function for a hill climb algorithm.
-     *
-     * @param c An approximated centre point
-     * @param data a collection of data points
-     * @param samples the number of samples in the 'data' array
-     *
-     * @return The deviation between the closest and further point in the data array from the point given. 
-     */
-    static float measureScore(Sample3D &c, Sample3D *data, int samples);
-
-    /*
-     * Performs an interative approximation (hill descent) algorithm to determine an
-     * estimated centre point of a sphere upon which the given data points reside.
-     *
-     * @param data an array containing sample points
-     * @param samples the number of sample points in the 'data' array.
-     *
-     * @return the approximated centre point of the points in the 'data' array.
-     */
-    static Sample3D approximateCentre(Sample3D *data, int samples);
-
     /**
-     * Calculates an independent scale factor for X,Y and Z axes that places the given data points on a bounding sphere
-     *
-     * @param centre A proviously calculated centre point of all data.
-     * @param data An array of all data points
-     * @param samples The number of samples in the 'data' array.
-     *
-     * @return A calibration structure containing the centre point provided, the radius of the minimum
-     * enclosing spere of points and a scaling factor for each axis that places those points as close as possible
-     * to the surface of the containing sphere.
-     */
-    static CompassCalibration spherify(Sample3D centre, Sample3D *data, int samples);
+      * Calculates the calibration from a least squares fit of samples to a sphere or ellipsoid.
+      *
+      * If the samples do not determine a fit, the centre of mass of the samples is used, unscaled, with a radius of zero.
+      *
+      * @param fit The fit, with all samples added.
+      *
+      * @return A calibration structure containing the calculated centre point, the radius of the
+      * sphere the points are scaled onto, and a scaling factor for each axis that places those
+      * points as close as possible to the surface of that sphere.
+      */
+     static CompassCalibration calibrate(MicroBitCompassFit &fit);
 };
 }
 
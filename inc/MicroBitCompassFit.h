@@ -0,0 +1,124 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_COMPASS_FIT_H
+#define MICROBIT_COMPASS_FIT_H
+
+#include "CodalConfig.h"
+#include "Compass.h"
+
+#define MICROBIT_COMPASS_FIT_TERMS              7           // The terms of each sample accumulated: x^2, y^2, z^2, x, y, z and 1.
+
+namespace codal
+{
+    /**
+     * Class definition for an incremental least squares fit of compass samples to a sphere or ellipsoid.
+     *
+     * Each sample added updates the sums of the normal equations of the fit, so no samples need to be kept, and a fit
+     * is available at any time by solving a small linear system. A sphere fit determines the hard iron offset of the
+     * compass. An axis aligned ellipsoid fit also determines a soft iron scale factor for each axis.
+     */
+    class MicroBitCompassFit
+    {
+        Sample3D                origin;                     // The first sample, subtracted from all samples to condition the sums.
+        int                     count;                      // The number of samples accumulated.
+        float                   error;                      // The residual error of the last fit.
+        double                  sums[MICROBIT_COMPASS_FIT_TERMS][MICROBIT_COMPASS_FIT_TERMS];   // Sums of products of terms (upper triangle).
+
+        /**
+         * Reads the sum of the products of two terms over all samples.
+         */
+        double sum(int i, int j);
+
+        /**
+         * Solves the normal equations for a linear least squares fit of one combination of terms to others.
+         *
+         * @param terms The indexes of the terms to fit with.
+         * @param n The number of terms in 'terms'.
+         * @param weights The weight of each term in the combination being fitted.
+         * @param coefficients The fitted coefficient of each of the n terms.
+         *
+         * @return The residual sum of squares of the fit, or a negative value if the samples do not determine a fit.
+         */
+        double solve(const int *terms, int n, const double *weights, double *coefficients);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Create an empty fit.
+         */
+        MicroBitCompassFit();
+
+        /**
+         * Discards all accumulated samples.
+         */
+        void reset();
+
+        /**
+         * Adds a raw (uncalibrated) compass sample to the fit.
+         *
+         * @param sample The sample to add.
+         */
+        void add(Sample3D sample);
+
+        /**
+         * Determines how many samples have been added since the fit was last reset.
+         *
+         * @return The number of samples.
+         */
+        int getSampleCount();
+
+        /**
+         * Determines the centre of mass of the samples added since the fit was last reset.
+         *
+         * @return The mean of the samples.
+         */
+        Sample3D getMean();
+
+        /**
+         * Fits the samples added so far to a sphere or an axis aligned ellipsoid.
+         *
+         * If an ellipsoid is requested but the samples do not determine one (for example if they all lie in a plane,
+         * or do not describe a closed surface), a sphere is fitted instead.
+         *
+         * @param calibration The calibration to store the result in: the centre of the fit, the radius of the sphere
+         *        the samples are scaled onto, and the scale factor for each axis (in 1/1024ths), which is 1024 for a sphere.
+         * @param ellipsoid true to fit an ellipsoid, correcting for soft iron distortion, or false to fit a sphere.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the samples do not determine a sphere.
+         */
+        int fit(CompassCalibration &calibration, bool ellipsoid = true);
+
+        /**
+         * Determines the residual error of the last successful fit.
+         *
+         * @return The root mean square distance of the samples from the fitted surface, as a fraction of its radius.
+         */
+        float getError();
+    };
+}
+
+#endif
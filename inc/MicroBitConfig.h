@@ -119,14 +119,55 @@
 #endif
 
 //
-// FileSystem writeback cache size, in bytes. Defines how many bytes will be stored
+// Default FileSystem writeback cache size, in bytes. Defines how many bytes will be stored
 // in RAM before being written back to FLASH. Set to zero to disable this feature.
-// Should be <= MBFS_BLOCK_SIZE.
+// May span several blocks, and can be overridden for each file when it is opened.
 //
 #ifndef MBFS_CACHE_SIZE
 #define MBFS_CACHE_SIZE        0
 #endif
 
+//
+// Number of recently used directory entries remembered by the file system, such that files
+// can be reopened without scanning their directory. Set to zero to disable this feature.
+//
+#ifndef MBFS_DIRECTORY_CACHE_SIZE
+#define MBFS_DIRECTORY_CACHE_SIZE   4
+#endif
+
+//
+// Time a file system in internal flash may spend compacting deleted blocks from the idle callback, in milliseconds.
+// This keeps block recycling out of the foreground write path. Set to zero to disable this feature.
+//
+#ifndef MBFS_COMPACTION_BUDGET
+#define MBFS_COMPACTION_BUDGET      10
+#endif
+
+//
+// Blocks released by deleted files are compacted in the background once fewer than this percentage
+// of the file system's blocks remain unused. Until then, deletions are left to accumulate such that
+// each page can be recycled in one go, which minimises wear.
+//
+#ifndef MBFS_COMPACTION_RESERVE
+#define MBFS_COMPACTION_RESERVE     25
+#endif
+
+//
+// Number of blocks held in RAM by a file system placed on an NVMController, such as the interface chip FLASH.
+// Each block uses MBFS_BLOCK_SIZE bytes. The file table and directories are read through this cache.
+//
+#ifndef MBFS_NVM_CACHE_SIZE
+#define MBFS_NVM_CACHE_SIZE         4
+#endif
+
+//
+// Maximum number of bytes of data that may be queued by MicroBitFileSystem::writeAsync() at any one time.
+// Each queued write also uses a small header, allocated from the heap.
+//
+#ifndef MBFS_ASYNC_QUEUE_SIZE
+#define MBFS_ASYNC_QUEUE_SIZE       1024
+#endif
+
 // Address of the end of the current program in FLASH memory.
 // This is recorded by the C/C++ linker, but the symbol name varies depending on which compiler is used.
 #if defined(__arm)
@@ -145,6 +186,29 @@ extern uint32_t __data_end__;
 #endif
 #endif
 
+// Enable/Disable the NVMC instruction cache, which hides FLASH wait states from code executed in place.
+// Set '1' to enable.
+#ifndef CONFIG_MICROBIT_ICACHE
+#define CONFIG_MICROBIT_ICACHE                  1
+#endif
+
+// Enable/Disable running the hottest interrupt handlers and DSP loops from RAM, so that their timing does not depend
+// on FLASH wait states or stalls while FLASH is erased. Functions marked MICROBIT_RAMFUNC are copied to RAM at startup
+// alongside initialised data, so each costs its code size in RAM as well as FLASH. Set '0' to keep them in FLASH.
+#ifndef CONFIG_MICROBIT_RAMFUNC
+#define CONFIG_MICROBIT_RAMFUNC                 1
+#endif
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_RAMFUNC)
+#define MICROBIT_RAMFUNC                        __attribute__((section(".ramfunc"), noinline, long_call))
+#else
+#define MICROBIT_RAMFUNC
+#endif
+
+// Forces a small helper inline into its callers, so that it runs from RAM (or FLASH) with whichever
+// MICROBIT_RAMFUNC calls it, rather than being left behind as an out of line call into FLASH.
+#define MICROBIT_FORCE_INLINE                   inline __attribute__((always_inline))
+
 // Enable/Disable BLE during normal operation.
 // Set '1' to enable.
 #ifndef MICROBIT_BLE_ENABLED
@@ -224,6 +288,29 @@ extern uint32_t __data_end__;
 #define MICROBIT_BLE_ADVERTISING_INTERVAL        50
 #endif
 
+// Advertising starts at the interval requested (MICROBIT_BLE_ADVERTISING_INTERVAL by default), so a
+// central finds us quickly after boot, a disconnection or a button press. After this many seconds
+// it backs off to MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL to save power. Set to '0' to never back off.
+#ifndef MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT
+#define MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT   30
+#endif
+
+// Define the advertising interval in ms used once the fast advertising period has passed.
+#ifndef MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL
+#define MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL  1000
+#endif
+
+// If enabled, pressing button A or B while advertising has backed off returns to the fast interval.
+#ifndef MICROBIT_BLE_ADVERTISING_WAKE_ON_BUTTON
+#define MICROBIT_BLE_ADVERTISING_WAKE_ON_BUTTON 1
+#endif
+
+// If enabled, the micro:bit first advertises directly to the last bonded central after it disconnects,
+// for 1.28s at a high duty cycle, so that it can reconnect straight away.
+#ifndef MICROBIT_BLE_DIRECTED_ADVERTISING
+#define MICROBIT_BLE_DIRECTED_ADVERTISING       1
+#endif
+
 // Defines default power level of the BLE radio transmitter.
 // Valid values are in the range 0..7 inclusive, with 0 being the lowest power and 7 the highest power.
 // Based on trials undertaken by the BBC, the radio is normally set to a low power level
@@ -253,6 +340,49 @@ extern uint32_t __data_end__;
 #define MICROBIT_BLE_NORDIC_STYLE_UART 0
 #endif 
 
+// Number of notifications the SoftDevice may queue for each connection, so that several can be sent in each
+// connection event. The largest ATT MTU and link layer packet (Data Length Extension) are set by NRF_SDH_BLE_GATT_MAX_MTU_SIZE
+// and NRF_SDH_BLE_GAP_DATA_LENGTH in target.json. Each falls back to the SoftDevice default if it lacks the RAM for it.
+#ifndef MICROBIT_BLE_HVN_TX_QUEUE_SIZE
+#define MICROBIT_BLE_HVN_TX_QUEUE_SIZE          4
+#endif
+
+// Default number of those notifications any one service may have queued at once, c.f. MicroBitBLEService::setTxCredits().
+// Lower this to keep room in the queue for other services while one is streaming.
+#ifndef MICROBIT_BLE_SERVICE_TX_CREDITS
+#define MICROBIT_BLE_SERVICE_TX_CREDITS         MICROBIT_BLE_HVN_TX_QUEUE_SIZE
+#endif
+
+// Size, in bytes, of the SoftDevice's GATT attribute table. Services and characteristics added beyond this
+// fail to register, so raise it for programs that create several BLE services; lower it to free RAM.
+// Any RAM reserved for the SoftDevice that the resulting configuration doesn't use is added to the heap.
+#ifndef MICROBIT_BLE_GATTS_ATTR_TAB_SIZE
+#define MICROBIT_BLE_GATTS_ATTR_TAB_SIZE        NRF_SDH_BLE_GATTS_ATTR_TAB_SIZE
+#endif
+
+// Longest time, in milliseconds, that the accelerometer service holds a sample before sending a batch of them.
+#ifndef MICROBIT_ACCELEROMETER_SERVICE_BATCH_LATENCY
+#define MICROBIT_ACCELEROMETER_SERVICE_BATCH_LATENCY  100
+#endif
+
+// Number of message bus events the event service can hold while the SoftDevice's notification queue is full.
+// Those waiting are sent together, as many as fit into the negotiated MTU.
+#ifndef MICROBIT_EVENT_SERVICE_QUEUE_SIZE
+#define MICROBIT_EVENT_SERVICE_QUEUE_SIZE       16
+#endif
+
+// Default time, in milliseconds, between samples of the pins the IO pin service is monitoring. Changes found are
+// combined into one notification per sample, so this also limits the notification rate.
+#ifndef MICROBIT_IO_PIN_SERVICE_PERIOD
+#define MICROBIT_IO_PIN_SERVICE_PERIOD          20
+#endif
+
+// Default change, in the 8 bit units reported, that an analog input monitored by the IO pin service must make before
+// it is notified.
+#ifndef MICROBIT_IO_PIN_SERVICE_DEADBAND
+#define MICROBIT_IO_PIN_SERVICE_DEADBAND        1
+#endif
+
 // Versioning options.
 // We use semantic versioning (http://semver.org/) to identify differnet versions of the micro:bit runtime.
 // Where possible we use yotta (an ARM mbed build tool) to help us track versions.
@@ -262,6 +392,23 @@ extern uint32_t __data_end__;
 #define MICROBIT_DAL_VERSION                    "unknown"
 #endif
 
+// Record statistics of the I2C transactions made with the USB interface chip by MicroBitUSBFlashManager and
+// MicroBitPowerManager: per command counts, retries, busy responses and a latency histogram.
+// Uses around 1KB of RAM per component when enabled.
+//
+// Set to '1' to enable
+#ifndef CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+#define CONFIG_MICROBIT_USB_INTERFACE_STATISTICS 0
+#endif
+
+// Track the time the display, radio, audio and BLE spend powered, and estimate their current draw.
+// See MicroBitPowerProfiler.h.
+//
+// Set to '1' to enable
+#ifndef CONFIG_MICROBIT_POWER_PROFILER
+#define CONFIG_MICROBIT_POWER_PROFILER 0
+#endif
+
 // Allow USB serial events to wake the board from deep sleep.
 // 
 // Set to '1' to enable
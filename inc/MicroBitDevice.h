@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/types/Event.h"
 #include "CodalDevice.h"
 #include "MicroBitConfig.h"
+#include "MicroBitTrace.h"
 
 #define MICROBIT_NAME_LENGTH                    5
 #define MICROBIT_NAME_CODE_LETTERS              5
@@ -51,6 +52,10 @@ namespace codal
         /**
          * Seed the pseudo random number generator using the hardware random number generator.
          *
+         * Never waits on the generator. If MicroBitEntropy has not yet gathered enough entropy, a provisional seed
+         * derived from the serial number and the system timer is used, and replaced by a hardware seed within
+         * a millisecond or so. While BLE is running, the seed is drawn from the SoftDevice.
+         *
          * @code
          * uBit.seedRandom();
          * @endcode
@@ -59,6 +64,7 @@ namespace codal
 
        /**
          * Seed the pseudo random number generator using the given value.
+         * Cancels any hardware reseed still outstanding from seedRandom(), so the sequence is reproducible.
          *
          * @param seed The 32-bit value to seed the generator with.
          *
@@ -67,6 +73,31 @@ namespace codal
          * @endcode
          */
        virtual int seedRandom(uint32_t seed) override;
+
+        /**
+         * Reads the CPU time spent within a trace point, since the running totals were last reset.
+         * Trace points cover interrupt handlers and other hot paths, and are only recorded if CONFIG_MICROBIT_TRACE is enabled.
+         *
+         * @param point The trace point, such as MICROBIT_TRACE_RADIO_IRQ.
+         *
+         * @return The number of times the trace point was entered, and the total and greatest number of CPU cycles spent within it.
+         */
+        MicroBitTraceSummary getCpuUsage(uint16_t point);
+
+        /**
+         * Reads the heap memory committed by a component.
+         *
+         * @param name The name of the component, as reported by MicroBitMemoryConsumer::getMemoryName(),
+         *        or NULL for the total committed by all components.
+         *
+         * @return The number of bytes currently allocated, or zero if there is no such component.
+         */
+        uint32_t getHeapUsage(const char *name = NULL);
+
+        /**
+         * Writes the CPU time spent within each trace point, and the heap memory committed by each component, to the debug log.
+         */
+        void printUsage();
     };
 
     /**
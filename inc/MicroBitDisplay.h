@@ -31,6 +31,11 @@ DEALINGS IN THE SOFTWARE.
 #include "NRF52LedMatrix.h"
 #include "AnimatedDisplay.h"
 
+// The longest string (in characters) that is pre-rendered into the scroll cache. Longer strings scroll uncached.
+#ifndef MICROBIT_DISPLAY_SCROLL_CACHE_LENGTH
+#define MICROBIT_DISPLAY_SCROLL_CACHE_LENGTH    64
+#endif
+
 namespace codal
 {
     /**
@@ -38,6 +43,18 @@ namespace codal
      */
     class MicroBitDisplay : public NRF52LEDMatrix, public AnimatedDisplay
     {
+        ManagedString           scrollText;     // The text currently held in the scroll cache.
+        Image                   scrollStrip;    // scrollText, pre-rendered into a single strip ready to be animated.
+
+        /**
+         * Renders the given text into the scroll cache, unless it is already held there.
+         *
+         * @param s The text to render.
+         *
+         * @return true if the scroll cache holds the text, false if it is too long to be cached.
+         */
+        bool cacheScrollText(ManagedString s);
+
         public:
 
         /**
@@ -52,6 +69,62 @@ namespace codal
          */
         MicroBitDisplay(const MatrixMap &map, uint16_t id = DEVICE_ID_DISPLAY);
 
+        /**
+         * Scrolls the given string across the display, from right to left, without blocking.
+         *
+         * The whole string is rendered once into a cached strip, so each step of the scroll is a copy of the
+         * visible window, and scrolling the same string again needs no rendering at all.
+         *
+         * @param s The string to display.
+         * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+         *
+         * @return DEVICE_OK, DEVICE_BUSY if the display is already in use, or DEVICE_INVALID_PARAMETER if delay is not positive.
+         *
+         * @code
+         * display.scrollAsync("abc123",100);
+         * @endcode
+         */
+        int scrollAsync(ManagedString s, int delay = DISPLAY_DEFAULT_SCROLL_SPEED);
+
+        /**
+         * Scrolls the given number across the display, from right to left, without blocking.
+         *
+         * @param number The number to display.
+         * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+         *
+         * @return DEVICE_OK, DEVICE_BUSY if the display is already in use, or DEVICE_INVALID_PARAMETER if delay is not positive.
+         */
+        int scrollAsync(int number, int delay = DISPLAY_DEFAULT_SCROLL_SPEED);
+
+        /**
+         * Scrolls the given string across the display, from right to left.
+         * Blocks the calling thread until all text has been displayed.
+         *
+         * The whole string is rendered once into a cached strip, so each step of the scroll is a copy of the
+         * visible window, and scrolling the same string again needs no rendering at all.
+         *
+         * @param s The string to display.
+         * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+         *
+         * @return DEVICE_OK, DEVICE_CANCELLED or DEVICE_INVALID_PARAMETER.
+         *
+         * @code
+         * display.scroll("abc123",100);
+         * @endcode
+         */
+        int scroll(ManagedString s, int delay = DISPLAY_DEFAULT_SCROLL_SPEED);
+
+        /**
+         * Scrolls the given number across the display, from right to left.
+         * Blocks the calling thread until all text has been displayed.
+         *
+         * @param number The number to display.
+         * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+         *
+         * @return DEVICE_OK, DEVICE_CANCELLED or DEVICE_INVALID_PARAMETER.
+         */
+        int scroll(int number, int delay = DISPLAY_DEFAULT_SCROLL_SPEED);
+
         /**
          * Destructor.
          */
@@ -0,0 +1,111 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ENTROPY_H
+#define MICROBIT_ENTROPY_H
+
+#include "CodalConfig.h"
+
+// The number of bytes of hardware entropy kept ready for use. The RNG is stopped whenever the pool is full.
+#ifndef MICROBIT_ENTROPY_POOL_SIZE
+#define MICROBIT_ENTROPY_POOL_SIZE              16
+#endif
+
+// Priority of the RNG interrupt that fills the pool.
+#ifndef MICROBIT_ENTROPY_IRQ_PRIORITY
+#define MICROBIT_ENTROPY_IRQ_PRIORITY           7
+#endif
+
+namespace codal
+{
+    /**
+     * A pool of hardware entropy, used to seed the pseudo random number generator without waiting on the RNG.
+     *
+     * While the SoftDevice is disabled, the pool is filled in the background by the RNG interrupt, with the RNG's
+     * bias correction enabled, and the RNG is stopped once the pool is full to save power. While the SoftDevice
+     * is enabled it owns the RNG, so entropy is taken from the SoftDevice's own pool instead.
+     */
+    class MicroBitEntropy
+    {
+        public:
+
+        /**
+         * Starts filling the pool in the background, if it is not already full.
+         * Also completes any seed requested with requestSeed() that is waiting on the SoftDevice.
+         */
+        static void start();
+
+        /**
+         * Stops the RNG and disables its interrupt, keeping any entropy already gathered.
+         * This must be called before the SoftDevice is enabled, as the RNG is then reserved for its use.
+         */
+        static void stop();
+
+        /**
+         * Determines the number of bytes of entropy that can be read without waiting.
+         *
+         * @return The number of bytes available.
+         */
+        static int available();
+
+        /**
+         * Removes entropy from the pool. Never waits for more to be generated.
+         *
+         * @param buffer The memory to copy the entropy into.
+         *
+         * @param length The number of bytes wanted.
+         *
+         * @return The number of bytes copied into buffer, which may be less than length, or zero if no entropy
+         * is available at present. The pool then starts to refill.
+         */
+        static int read(uint8_t *buffer, int length);
+
+        /**
+         * Requests 32 bits of fresh entropy, to be passed to the given function as soon as they are generated.
+         * This takes around half a millisecond after the RNG starts, and the function is called from interrupt
+         * context. Any previous request that is still waiting is replaced.
+         *
+         * @param handler The function to call with the entropy.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if handler is NULL.
+         */
+        static int requestSeed(void (*handler)(uint32_t seed));
+
+        /**
+         * Cancels a seed requested with requestSeed(), if it is still waiting and was made with the given function.
+         *
+         * @param handler The function passed to requestSeed().
+         */
+        static void cancelSeed(void (*handler)(uint32_t seed));
+
+        /**
+         * Handles the RNG interrupt, moving the value generated into the pool or a pending seed request.
+         *
+         * @note for internal use only.
+         */
+        static void onValue(uint8_t value);
+    };
+}
+
+#endif
@@ -24,8 +24,15 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitConfig.h"
 #include "MicroBitFlash.h"
+#include "FSCache.h"
+#include "CodalComponent.h"
+#include "EventModel.h"
+#include "CodalFiber.h"
 
 
+// Component ID, used to register for idle callbacks.
+#define DEVICE_ID_FILE_SYSTEM       3044
+
 // Configuration options.
 #define MBFS_FILENAME_LENGTH        16        
 #define MBFS_MAGIC                  "MICROBIT_FS_1_0"
@@ -43,6 +50,14 @@ DEALINGS IN THE SOFTWARE.
 
 // Status flags
 #define MBFS_STATUS_INITIALISED           0x01
+#define MBFS_STATUS_COMPACT_DIRECTORIES   0x02
+#define MBFS_STATUS_ASYNC_LISTENING       0x04
+#define MBFS_STATUS_ASYNC_RUNNING         0x08
+#define MBFS_STATUS_LOCKED                0x10
+
+// Events. MBFS_EVT_ASYNC_COMPLETE(fd) is raised each time an asynchronous operation on the given file completes.
+#define MBFS_EVT_ASYNC_QUEUED             1
+#define MBFS_EVT_ASYNC_COMPLETE(fd)       (2 + (fd))
 
 // FileTable codes
 #define MBFS_UNUSED                       0xFFFF
@@ -83,6 +98,17 @@ struct Directory
     DirectoryEntry entry[0];
 };
 
+//
+// A DirectoryCacheEntry remembers where a recently used file was found in its directory.
+// The hash of the file name is held to avoid string comparisons against unrelated entries.
+//
+struct DirectoryCacheEntry
+{
+    uint32_t directory;                         // Address of the directory searched.
+    uint32_t dirent;                            // Address of the entry found, or zero if this cache entry is unused.
+    uint32_t hash;                              // Hash of the file name.
+};
+
 //
 // A FileDescriptor holds contextual information needed for each OPEN file.
 //
@@ -100,18 +126,36 @@ struct FileDescriptor
     // the current file size. n.b. this may be different to that stored in the DirectoryEntry.
     uint32_t length;
 
-    // the directory entry of this file. 
-    DirectoryEntry *dirent;
+    // the address of the directory entry of this file. 
+    uint32_t dirent;
 
-    // the directory entry of our parent directory. 
-    DirectoryEntry *directory;
+    // the address of the directory entry of our parent directory. 
+    uint32_t directory;
 
     // We maintain a chain of open file descriptors. Reference to the next FileDescriptor in the chain.
     FileDescriptor *next;
 
     // Optional writeback cache, to minimise FLASH write operations at the expense of RAM.
+    // Allocated when the file is opened, and may span several blocks.
     uint16_t cacheLength;
-    uint8_t cache[MBFS_CACHE_SIZE];
+    uint16_t cacheSize;
+    uint8_t *cache;
+
+    // Number of asynchronous operations queued for this file, and the result of the last one to complete.
+    uint16_t asyncPending;
+    int asyncResult;
+};
+
+//
+// An MBFSAsyncRequest holds an operation queued by writeAsync() or flushAsync(),
+// followed by a copy of the data to be written.
+//
+struct MBFSAsyncRequest
+{
+    FileDescriptor *file;                       // The file to operate on.
+    MBFSAsyncRequest *next;                     // The next request in the queue.
+    int length;                                 // Number of bytes to write, or -1 to flush the file.
+    uint8_t data[0];                            // The data to write.
 };
 
 /**
@@ -125,23 +169,30 @@ struct FileDescriptor
   * - seek()
   * - remove()
   *
+  * The file system is held in memory mapped internal FLASH by default, or may be placed on any
+  * NVMController (such as the interface chip FLASH of MicroBitUSBFlashManager), accessed through an FSCache.
+  *
   * Only a single instance shoud exist at any given time.
   */
-class MicroBitFileSystem
+class MicroBitFileSystem : public codal::CodalComponent
 {
     private:
 
-    // Status flags
-    uint32_t status;
-
-    // The instance of MicroBitFlash - the interface used for all flash writes/erasures
+    // The instance of MicroBitFlash - the interface used for all internal flash writes/erasures
     MicroBitFlash flash;
 
+    // The memory controller holding the file system, and the cache used to access it. NULL if the file system is in internal FLASH.
+    codal::NVMController *nvm;
+    codal::FSCache *cache;
+
+    // Address of the page used as scratch space when no free page is available.
+    uint32_t scratchPage;
+
     // Total Number of logical pages available for file data (including the file table)
     int    fileSystemSize;
 
-    // Memory address of the start of the file system.
-    uint16_t* fileSystemTable;
+    // Address of the start of the file system, which holds the file table.
+    uint32_t fileSystemStart;
 
     // Size of the file table (blocks)
     uint16_t fileSystemTableSize;
@@ -149,12 +200,41 @@ class MicroBitFileSystem
     // Cache of the last block allocated. Used to enable round robin use of blocks.
     uint16_t lastBlockAllocated;
 
-    // Reference to the root directory of the file system.
-    DirectoryEntry *rootDirectory;
+    // Bitmap of the blocks marked as UNUSED in the file table, one bit per block. Held in RAM to speed up allocation.
+    // This is built when first needed rather than when the file system is mounted, and is NULL until then.
+    uint32_t *freeBlockMap;
+
+    // Number of blocks marked as UNUSED and DELETED in the file table.
+    uint16_t freeBlockCount;
+    uint16_t deletedBlockCount;
+
+    // Address of the root directory of the file system.
+    uint32_t rootDirectory;
 
     // Chain of open files.
     FileDescriptor *openFiles;
 
+    // Recently used directory entries, and the next cache entry to replace.
+    DirectoryCacheEntry directoryCache[MBFS_DIRECTORY_CACHE_SIZE];
+    uint8_t directoryCacheNext;
+
+    // Time budget for compaction from the idle callback, in milliseconds. Zero if idle compaction is disabled.
+    uint32_t compactionBudget;
+
+    // The next block to be considered by the compactor.
+    uint16_t compactionBlock;
+
+    // Number of times each physical page has been erased by the file system since it was mounted, or NULL if not tracked.
+    // Used to steer scratch page selection towards the least worn pages.
+    uint16_t *pageEraseCount;
+
+    // Queue of asynchronous operations waiting to be performed, and the number of bytes of data it holds.
+    MBFSAsyncRequest *asyncQueue;
+    int asyncQueueLength;
+
+    // Serialises operations on the file system between fibers, including the background worker.
+    codal::FiberLock mutex;
+
     /**
       * Initialize the flash storage system
       *
@@ -179,33 +259,96 @@ class MicroBitFileSystem
     /**
       * Allocate a free logical block.
       * A round robin algorithm is used to even out the wear on the physical device.
-      * @return NULL on error, page address on success
+      * Free blocks are found using the free block map, rather than by walking the file table.
+      * @return a valid, unused block address on success, or zero if no space is available.
       */
     uint16_t getFreeBlock();
 
+    /**
+      * Build the free block map and counts from the file table, allocating the map if necessary.
+      * Used when the map is first needed, and when the file table is recycled in bulk.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the map could not be allocated.
+      */
+    int buildFreeBlockMap();
+
     /**
     * Allocates a free physical block.
-    * A round robin algorithm is used to even out the wear on the physical device.
-    * @return NULL on error, page address on success
+    * The least worn empty page is chosen, with ties broken in round robin order, to even out the wear on the physical device.
+    * @return page address on success
+    */
+    uint32_t getFreePage();
+
+    /**
+    * Erase the given physical page, updating its erase count if it lies within the file system.
+    *
+    * @param page The address of the page to erase.
+    */
+    void erasePage(uint32_t page);
+
+    /**
+    * Read data from the memory holding the file system.
+    *
+    * @param address The address to read from.
+    * @param data The buffer to read into.
+    * @param length The number of bytes to read.
+    * @return MICROBIT_OK on success.
+    */
+    int readFlash(uint32_t address, void *data, int length);
+
+    /**
+    * Write data to the memory holding the file system.
+    * If the data can not be written without an erase, the page holding it is rewritten via the given scratch page.
+    *
+    * @param address The address to write to. The data written must not cross a page boundary.
+    * @param data The data to write.
+    * @param length The number of bytes to write.
+    * @param scratch The address of an erased page to use if the page must be rewritten, or zero to use the default scratch page.
+    * @return MICROBIT_OK on success.
     */
-    uint32_t* getFreePage();
+    int writeFlash(uint32_t address, const void *data, int length, uint32_t scratch = 0);
+
+    /**
+    * Copy data from one location in the memory holding the file system to another.
+    *
+    * @param to The address to write to. The region written must be erased, and must not cross a page boundary.
+    * @param from The address to read from.
+    * @param length The number of bytes to copy.
+    * @return MICROBIT_OK on success.
+    */
+    int copyFlash(uint32_t to, uint32_t from, int length);
 
     /**
     * Retrieve the DirectoryEntry assoiated with the given file's DIRECTORY (not the file itself).
     *
     * @param filename A fully qualified filename, from the root.
-    * @return A pointer to the DirectoryEntry for the given file's directory, or NULL if no entry is found.
+    * @return The address of the DirectoryEntry for the given file's directory, or zero if no entry is found.
     */
-    DirectoryEntry* getDirectoryOf(char const * filename);
+    uint32_t getDirectoryOf(char const * filename);
 
     /**
     * Retrieve the DirectoryEntry for the given filename.
+    * Recently used entries are found in the directory cache, without scanning the directory.
     *
     * @param filename A fully or partially qualified filename.
-    * @param directory The directory to search. If ommitted, the root directory will be used.
-    * @return A pointer to the DirectoryEntry for the given file, or NULL if no entry is found.
+    * @param directory The address of the directory to search. If ommitted, the root directory will be used.
+    * @return The address of the DirectoryEntry for the given file, or zero if no entry is found.
+    */
+    uint32_t getDirectoryEntry(char const * filename, uint32_t directory = 0);
+
+    /**
+    * Calculate the hash of a file name, as used by the directory cache.
+    *
+    * @param name The file name, excluding any path.
+    * @return The hash of the given name.
+    */
+    static uint32_t hashFilename(char const * name);
+
+    /**
+    * Forget all entries in the directory cache.
+    * Called whenever a directory is changed such that a cached entry may no longer be valid.
     */
-    DirectoryEntry* getDirectoryEntry(char const * filename, const DirectoryEntry *directory = NULL);
+    void invalidateDirectoryCache();
     
     /**
     * Create a new DirectoryEntry with the given filename and flags.
@@ -214,17 +357,17 @@ class MicroBitFileSystem
     * @param directory The directory in which to create the entry
     * @param isDirectory true if the entry being created is itself a directory
     *
-    * @return A pointer to the new DirectoryEntry for the given file, or NULL if it was not possible to allocated resources.
+    * @return The address of the new DirectoryEntry for the given file, or zero if it was not possible to allocated resources.
     */
-    DirectoryEntry* createFile(char const * filename, DirectoryEntry *directory, bool isDirectory);
+    uint32_t createFile(char const * filename, uint32_t directory, bool isDirectory);
 
     /**
     * Allocate a free DiretoryEntry in the given directory, extending and refreshing the directory block if necessary.
     *
     * @param directory The directory to add a DirectoryEntry to
-    * @return A pointer to the new DirectoryEntry for the given file, or NULL if it was not possible to allocated resources.
+    * @return The address of the new DirectoryEntry for the given file, or zero if it was not possible to allocated resources.
     */
-    DirectoryEntry* createDirectoryEntry(DirectoryEntry *directory);
+    uint32_t createDirectoryEntry(uint32_t directory);
 
     /**
     * Refresh the physical page associated with the given block.
@@ -246,22 +389,47 @@ class MicroBitFileSystem
     int recycleFileTable();
 
     /**
-    * Retrieve a memory pointer for the start of the physical memory page containing the given block.
+    * Determine if the FLASH memory of the given blocks is erased.
     *
     * @param block A valid block number.
+    * @param blocks The number of consecutive blocks to check.
+    * @return true if every byte of the blocks is erased, false otherwise.
+    */
+    bool isErased(uint16_t block, int blocks = 1);
+
+    /**
+    * Recycle the first block of the given directory (or its subdirectories) that holds deleted entries but no free ones.
+    *
+    * @param directory The address of the directory to compact.
+    * @return true if a block was recycled, false if there was nothing to do.
+    */
+    bool compactDirectory(uint32_t directory);
+
+    /**
+    * Perform one unit of compaction work, by recycling a directory block, a page of deleted blocks or the file table.
     *
-    * @return A pointer to the physical page in FLASH memory holding the given block.
+    * @param reclaimBlocks true if deleted blocks should be recycled, false if only directories should be compacted.
+    * @return true if any work was done, false if there was nothing to do.
     */
-    uint32_t *getPage(uint16_t block);
+    bool compactStep(bool reclaimBlocks);
 
     /**
-    * Retrieve a memory pointer for the start of the given block.
+    * Retrieve the address of the start of the physical memory page containing the given block.
     *
     * @param block A valid block number.
     *
-    * @return A pointer to the FLASH memory associated with the given block.
+    * @return The address of the physical page in FLASH memory holding the given block.
     */
-    uint32_t *getBlock(uint16_t block);
+    uint32_t getPage(uint16_t block);
+
+    /**
+    * Retrieve the address of the start of the given block.
+    *
+    * @param block A valid block number.
+    *
+    * @return The address of the FLASH memory associated with the given block.
+    */
+    uint32_t getBlock(uint16_t block);
 
     /**
     * Retrieve the next block in a chain.
@@ -279,7 +447,7 @@ class MicroBitFileSystem
     *
     * @return The block number containing the given address.
     */
-    uint16_t getBlockNumber(void *address);
+    uint16_t getBlockNumber(uint32_t address);
 
     /**
     * Determine the number of logical blocks required to hold the file table.
@@ -324,6 +492,7 @@ class MicroBitFileSystem
 
     /**
       * Write a given buffer to the file provided.
+      * Physically adjacent blocks on the same FLASH page are written in a single operation.
       * 
       * @param file FileDescriptor of the file to write
       * @param buffer The start of the buffer to write
@@ -332,6 +501,125 @@ class MicroBitFileSystem
       */
     int writeBuffer(FileDescriptor *file, uint8_t* buffer, int length);
 
+    /**
+      * Determine the block that follows the given block of a file being written,
+      * extending the file with a newly allocated block if the given block is the last.
+      *
+      * @param block A valid block number of the file.
+      * @return The next block of the file, or zero if the file could not be extended.
+      */
+    uint16_t getNextWriteBlock(uint16_t block);
+
+    /**
+      * Write data to the given file, via its writeback cache if it has one.
+      * @param file FileDescriptor of the file to write
+      * @param buffer The start of the buffer to write
+      * @param size The number of bytes to write
+      * @return The number of bytes written.
+      */
+    int writeFile(FileDescriptor *file, uint8_t* buffer, int size);
+
+    /**
+      * Write back all state associated with the given file to FLASH memory.
+      * @param file FileDescriptor of the file to flush.
+      * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the file system is too full to
+      *         record the new length of the file.
+      */
+    int flushFile(FileDescriptor *file);
+
+    /**
+      * Add an operation to the asynchronous queue, waking the background worker if necessary.
+      * @param file FileDescriptor of the file to operate on.
+      * @param buffer The data to write, or NULL to flush the file.
+      * @param size The number of bytes to write.
+      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the scheduler is not running,
+      *         or MICROBIT_NO_RESOURCES if the queue is full.
+      */
+    int queueAsync(FileDescriptor *file, uint8_t* buffer, int size);
+
+    /**
+      * Block the calling fiber until all asynchronous operations queued for the given file are complete.
+      * Must be called with the file system lock held, which is released while waiting.
+      * @param file FileDescriptor of the file.
+      */
+    void waitForAsync(FileDescriptor *file);
+
+    /**
+      * Obtain exclusive access to the file system, blocking the calling fiber until any other operation is complete.
+      */
+    void lock();
+
+    /**
+      * Release exclusive access to the file system, obtained with lock().
+      */
+    void unlock();
+
+    /**
+      * Background worker. Performs queued asynchronous operations in order,
+      * raising MBFS_EVT_ASYNC_COMPLETE(fd) as each completes.
+      */
+    void onAsyncRequest(codal::Event);
+
+    /**
+      * Implementation of createDirectory(), called with the file system lock held.
+      */
+    int _createDirectory(char const *name);
+
+    /**
+      * Implementation of open(), called with the file system lock held.
+      */
+    int _open(char const * filename, uint32_t flags, int bufferSize);
+
+    /**
+      * Implementation of flush(), called with the file system lock held.
+      */
+    int _flush(int fd);
+
+    /**
+      * Implementation of close(), called with the file system lock held.
+      */
+    int _close(int fd);
+
+    /**
+      * Implementation of seek(), called with the file system lock held.
+      */
+    int _seek(int fd, int offset, uint8_t flags);
+
+    /**
+      * Implementation of read(), called with the file system lock held.
+      */
+    int _read(int fd, uint8_t* buffer, int size);
+
+    /**
+      * Implementation of readInPlace(), called with the file system lock held.
+      */
+    int _readInPlace(int fd, const uint8_t **data, int size);
+
+    /**
+      * Implementation of map(), called with the file system lock held.
+      */
+    int _map(int fd, uint32_t offset, const uint8_t **data, uint32_t *length);
+
+    /**
+      * Implementation of write(), called with the file system lock held.
+      */
+    int _write(int fd, uint8_t* buffer, int size);
+
+    /**
+      * Implementation of remove(), called with the file system lock held.
+      */
+    int _remove(char const * filename);
+
+    /**
+      * Implementation of getFreeSpace(), called with the file system lock held.
+      */
+    int _getFreeSpace();
+
+    /**
+      * Implementation of compact(), called with the file system lock held.
+      */
+    int _compact(uint32_t budget);
+
 
     /**
      * Determines if the given filename is a valid filename for use in MicroBitFileSystem. 
@@ -348,10 +636,29 @@ class MicroBitFileSystem
     static MicroBitFileSystem *defaultFileSystem;
 
     /**
-      * Constructor. Creates an instance of a MicroBitFileSystem.
+      * Constructor. Creates an instance of a MicroBitFileSystem in internal FLASH.
       */
     MicroBitFileSystem(uint32_t flashStart = 0, int flashPages = 0);
 
+    /**
+      * Constructor. Creates an instance of a MicroBitFileSystem on the given memory controller.
+      *
+      * The last page of the region is reserved as scratch space. The memory must not be shared with
+      * other users, such as MicroBitLog. Any existing data is erased if no file system is found.
+      * map() and readInPlace() are not supported, as the memory is not mapped into the address space of the processor.
+      * Deleted blocks are not compacted from the idle thread, as the memory controller may block. Use compact() instead.
+      *
+      * @param nvm The memory controller to use, such as MicroBitUSBFlashManager.
+      * @param flashStart The address of the start of the file system, or zero to use the start of the memory controller.
+      * The address must be aligned to a page, and pages must be MICROBIT_CODEPAGESIZE bytes in size.
+      * @param flashPages The number of pages to use, including the scratch page, or zero to use the rest of the memory controller.
+      *
+      * @code
+      * MicroBitFileSystem fs(uBit.flash);
+      * @endcode
+      */
+    MicroBitFileSystem(codal::NVMController &nvm, uint32_t flashStart = 0, int flashPages = 0);
+
     /**
       * Open a new file, and obtain a new file handle (int) to
       * read/write/seek the file. The flags are:
@@ -364,9 +671,11 @@ class MicroBitFileSystem
       *
       * @param filename name of the file to open, must contain only printable characters.
       * @param flags One or more of MB_READ, MB_WRITE or MB_CREAT. 
+      * @param bufferSize The size of the writeback cache to use for this file, in bytes. Writes smaller than this
+      *        are held in RAM and written back to FLASH together. Zero disables the cache. Defaults to MBFS_CACHE_SIZE.
       * @return return the file handle,MICROBIT_NOT_SUPPORTED if the file system has
       *         not been initialised MICROBIT_INVALID_PARAMETER if the filename is
-      *         too large, MICROBIT_NO_RESOURCES if the file system is full.
+      *         too large or the bufferSize is invalid, MICROBIT_NO_RESOURCES if the file system is full.
       *
       * @code
       * MicroBitFileSystem f();
@@ -375,7 +684,7 @@ class MicroBitFileSystem
       *    print("file open error");
       * @endcode
       */
-    int open(char const * filename, uint32_t flags);
+    int open(char const * filename, uint32_t flags, int bufferSize = MBFS_CACHE_SIZE);
 
     /**
      * Writes back all state associated with the given file to FLASH memory, 
@@ -384,7 +693,8 @@ class MicroBitFileSystem
      * @param fd file descriptor - obtained with open().
      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not
      *         been initialised, MICROBIT_INVALID_PARAMETER if the given file handle
-     *         is invalid.
+     *         is invalid, MICROBIT_NO_RESOURCES if the file system is too full to
+     *         record the new length of the file.
      *
      * @code
      * MicroBitFileSystem f();
@@ -397,11 +707,35 @@ class MicroBitFileSystem
      */
     int flush(int fd);
 
+    /**
+     * Writes back all state associated with the given file to FLASH memory asynchronously.
+     * The flush is performed by a background fiber once any operations already queued for the file
+     * are complete. MBFS_EVT_ASYNC_COMPLETE(fd) is then raised on DEVICE_ID_FILE_SYSTEM, and the
+     * result of the flush (as returned by flush()) can be obtained with getAsyncResult().
+     *
+     * @param fd file descriptor - obtained with open().
+     * @return MICROBIT_OK if the flush was queued, MICROBIT_NOT_SUPPORTED if the file system has not
+     *         been initialised or the scheduler is not running, MICROBIT_INVALID_PARAMETER if the given
+     *         file handle is invalid, or MICROBIT_NO_RESOURCES if there is not enough memory to queue it.
+     */
+    int flushAsync(int fd);
+
+    /**
+     * Determine the result of the last asynchronous operation to complete on the given file.
+     *
+     * @param fd file descriptor - obtained with open().
+     * @return MICROBIT_BUSY if asynchronous operations are still queued for the file, MICROBIT_INVALID_PARAMETER
+     *         if the given file handle is invalid, otherwise the value that write() or flush() would have returned
+     *         for the last operation (MICROBIT_OK if there has been none).
+     */
+    int getAsyncResult(int fd);
+
     /**
       * Close the specified file handle.
       * File handle resources are then made available for future open() calls.
       *
       * close() must be called to ensure all pending data is written back to FLASH memory. 
+      * Any asynchronous operations queued for the file are completed first.
       *
       * @param fd file descriptor - obtained with open().
       * @return non-zero on success, MICROBIT_NOT_SUPPORTED if the file system has not
@@ -466,6 +800,33 @@ class MicroBitFileSystem
       */
     int write(int fd, uint8_t* buffer, int size);
 
+    /**
+      * Write data to the file asynchronously.
+      * The data is copied into a queue, and written at the current seek position by a background fiber,
+      * so the caller does not wait for FLASH to be erased or programmed. MBFS_EVT_ASYNC_COMPLETE(fd) is
+      * raised on DEVICE_ID_FILE_SYSTEM once the data has been written, and the number of bytes written
+      * can then be obtained with getAsyncResult(). Operations queued for a file are performed in order,
+      * and any other call on the same file (such as read(), write() or close()) first waits for them to complete.
+      *
+      * @param fd File handle
+      * @param buffer the buffer from which to write data. This may be reused as soon as the call returns.
+      * @param size number of bytes to write
+      * @return MICROBIT_OK if the data was queued, MICROBIT_NOT_SUPPORTED if the file system has not been
+      *         initialised or the scheduler is not running, MICROBIT_INVALID_PARAMETER if the given file
+      *         handle is invalid, or MICROBIT_NO_RESOURCES if more than MBFS_ASYNC_QUEUE_SIZE bytes
+      *         would be queued, or there is not enough memory to queue the data.
+      *
+      * @code
+      * MicroBitFileSystem f();
+      * int fd = f.open("test.txt", MB_WRITE);
+      * f.writeAsync(fd, (uint8_t *)"hello!", 7);
+      * fiber_wait_for_event(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_COMPLETE(fd));
+      * if(f.getAsyncResult(fd) != 7)
+      *    print("error writing");
+      * @endcode
+      */
+    int writeAsync(int fd, uint8_t* buffer, int size);
+
     /**
       * Read data from the file.
       *
@@ -490,6 +851,67 @@ class MicroBitFileSystem
       */
     int read(int fd, uint8_t* buffer, int size);
 
+    /**
+      * Read data from the file, without copying it.
+      *
+      * Provides the address in memory mapped FLASH of the data at the current seek
+      * position of the file, and the number of bytes that can be read contiguously from there.
+      * This is limited to the end of the current run of physically contiguous blocks (see map()),
+      * so the data of a whole file may take several calls to obtain. The seek position of the file
+      * handle is incremented by the number of bytes returned.
+      *
+      * @param fd File handle, obtained with open()
+      * @param data set to the address of the data on success.
+      * @param size maximum number of bytes to read
+      * @return number of bytes available at data on success (zero at end of file), MICROBIT_NOT_SUPPORTED
+      *         if the file system is not initialised or is not in memory mapped FLASH, or MICROBIT_INVALID_PARAMETER
+      *         if the given file handle is invalid.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * const uint8_t *data;
+      * int fd = f.open("read.txt", MB_READ);
+      * int len;
+      * while ((len = f.readInPlace(fd, &data, 512)) > 0)
+      *    process(data, len);
+      * @endcode
+      */
+    int readInPlace(int fd, const uint8_t **data, int size);
+
+    /**
+      * Map part of a file into memory, without copying it.
+      *
+      * Provides the address in memory mapped FLASH of the data at the given offset in the file,
+      * and the number of bytes that can be read contiguously from there. Consecutive blocks of a
+      * file are usually stored next to each other, so this typically spans many blocks.
+      * When the file's blocks are not contiguous, the data of a whole file may take several calls to obtain.
+      * The seek position of the file handle is not changed.
+      *
+      * The data remains valid until the file is next written or removed.
+      *
+      * @param fd File handle, obtained with open()
+      * @param offset The offset in the file, in bytes.
+      * @param data set to the address of the data on success.
+      * @param length set to the number of bytes available at data on success (zero at end of file).
+      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised or is not in memory
+      *         mapped FLASH, or MICROBIT_INVALID_PARAMETER if the given file handle is invalid or the offset is beyond
+      *         the end of the file.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * const uint8_t *data;
+      * uint32_t offset = 0;
+      * uint32_t len;
+      * int fd = f.open("image.bin", MB_READ);
+      * while (f.map(fd, offset, &data, &len) == MICROBIT_OK && len > 0)
+      * {
+      *    process(data, len);
+      *    offset += len;
+      * }
+      * @endcode
+      */
+    int map(int fd, uint32_t offset, const uint8_t **data, uint32_t *length);
+
     /**
       * Remove a file from the system, and free allocated assets
       * (including assigned blocks which are returned for use by other files).
@@ -515,6 +937,63 @@ class MicroBitFileSystem
     * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the path is invalid, or MICROBT_NO_RESOURCES if the FileSystem is full.
     */
     int createDirectory(char const *name);
+
+    /**
+      * Determine the amount of space available for file data.
+      * This includes blocks released by deleted files, which are recycled on demand.
+      *
+      * @return the number of bytes available, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+      *         or MICROBIT_NO_RESOURCES if there is not enough memory to track free blocks.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * if (f.getFreeSpace() < 1024)
+      *     print("file system nearly full");
+      * @endcode
+      */
+    int getFreeSpace();
+
+    /**
+      * Determine how many times a physical page of the file system has been erased since it was mounted.
+      * Erase counts are held in RAM only, and restart from zero each time the file system is mounted.
+      *
+      * @param page The page to query, counting from zero at the start of the file system.
+      *
+      * @return the number of erases, MICROBIT_INVALID_PARAMETER if the page is out of range,
+      *         or MICROBIT_NOT_SUPPORTED if the file system is not initialised or erase counts are not available.
+      */
+    int getEraseCount(int page);
+
+    /**
+      * Recycle blocks and directory entries released by deleted files, such that later writes need not do so.
+      *
+      * Directory blocks full of deleted entries are recycled first. Then each physical page holding the data of
+      * deleted files is erased in turn, and the file table is recycled once they all have been.
+      * This continues until nothing is left to compact, or the given time has passed.
+      * At least one page is processed, and a page erase can not be interrupted, so the budget may be exceeded.
+      *
+      * @param budget The time to spend compacting, in milliseconds.
+      * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+      *         or MICROBIT_NO_RESOURCES if there is not enough memory to track free blocks.
+      */
+    int compact(uint32_t budget);
+
+    /**
+      * Define how long the file system may spend compacting deleted blocks each time the processor is idle.
+      *
+      * @param budget The time to spend compacting, in milliseconds, or zero to disable idle compaction.
+      *
+      * @note Idle compaction is not available on a memory controller, whose I/O may block the idle thread
+      * or interleave with a foreground operation. Call compact() from a fiber instead.
+      */
+    void setCompactionBudget(uint32_t budget);
+
+    /**
+      * Periodic callback from the scheduler idle thread.
+      * Compacts directories, and deleted blocks once fewer than MBFS_COMPACTION_RESERVE percent of blocks are unused,
+      * within the compaction budget.
+      */
+    virtual void idleCallback() override;
 };
 
 #endif
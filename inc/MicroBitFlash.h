@@ -24,6 +24,21 @@ DEALINGS IN THE SOFTWARE.
 
 #include "nrf.h"
 
+// The number of words of a page that are merged in RAM before being programmed.
+#ifndef MICROBIT_FLASH_BURN_WORDS
+#define MICROBIT_FLASH_BURN_WORDS       64
+#endif
+
+/**
+  * A region of flash memory to write, and the data to write to it.
+  */
+struct MicroBitFlashSegment
+{
+    void*   address;        // location in flash to write to.
+    void*   buffer;         // location in memory to write from.
+    int     length;         // number of bytes to write.
+};
+
 class MicroBitFlash
 {
     private:
@@ -40,6 +55,17 @@ class MicroBitFlash
       * @return non-zero if erase required, zero otherwise.
       */
     int need_erase(uint8_t* source, uint8_t* flash_addr, int len);
+
+    /**
+      * Write to flash memory, assuming that a write is valid (using need_erase),
+      * programming only the words that differ from the data already held.
+      * Consecutive words that differ are programmed in a single operation.
+      *
+      * @param addr address of memory to write to. Must be word aligned.
+      * @param buffer address to write from, must be word-aligned.
+      * @param len number of uint32_t words to write.
+      */
+    void flash_update(uint32_t* addr, uint32_t* buffer, int len);
  
     public:
     /**
@@ -67,6 +93,21 @@ class MicroBitFlash
     int flash_write(void* address, void* buffer, int length, 
                     void* scratch_addr = NULL);
 
+    /**
+      * Writes a number of regions of a single page of flash memory.
+      * Only the words changed are programmed. If any bit needs to be set, the page is
+      * rewritten once via the scratch page, however many of the regions need it.
+      * Where regions overlap, the last one given takes precedence.
+      *
+      * @param segments the regions to write. All must lie within the same page.
+      * @param count the number of regions.
+      * @param scratch_addr if specified, scratch page to use. Use default
+      *                     otherwise.
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+      */
+    int flash_write(MicroBitFlashSegment* segments, int count,
+                    void* scratch_addr = NULL);
+
     /**
       * Erase an entire page.
       * @param page_address address of first word of page.
@@ -96,6 +96,8 @@ DEALINGS IN THE SOFTWARE.
 #include "FSCache.h"
 #include "NRF52Serial.h"
 #include "ManagedString.h"
+#include "EventModel.h"
+#include "MicroBitMemoryConsumer.h"
 
 #ifndef CONFIG_MICROBIT_LOG_METADATA_SIZE
 #define CONFIG_MICROBIT_LOG_METADATA_SIZE      2048
@@ -110,6 +112,18 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE    256
 #endif
 
+// If set, the cache holds modified blocks in RAM and writes each back in one operation, when the block is
+// evicted or the journal is committed. This saves many small flash writes, at the cost of losing any data
+// written since the last journal entry if power is lost.
+#ifndef CONFIG_MICROBIT_LOG_CACHE_WRITE_BACK
+#define CONFIG_MICROBIT_LOG_CACHE_WRITE_BACK    0
+#endif
+
+// Number of cache blocks read in advance when the log is read sequentially, such as when it is exported.
+#ifndef CONFIG_MICROBIT_LOG_CACHE_READ_AHEAD
+#define CONFIG_MICROBIT_LOG_CACHE_READ_AHEAD    1
+#endif
+
 #ifndef CONFIG_MICROBIT_LOG_FULL_ERASE_BY_DEFAULT
 #define CONFIG_MICROBIT_LOG_FULL_ERASE_BY_DEFAULT    false
 #endif
@@ -118,16 +132,101 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE  '_'
 #endif
 
+#ifndef CONFIG_MICROBIT_LOG_DEFAULT_PRECISION
+#define CONFIG_MICROBIT_LOG_DEFAULT_PRECISION   2
+#endif
+
+#define MICROBIT_LOG_MAX_PRECISION          6
+
+#ifndef CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE
+#define CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE     64
+#endif
+
+// Size (in bytes) of the RAM queue used to write committed rows to flash in the background.
+// Zero disables the queue, so rows are written to flash before endRow() returns.
+#ifndef CONFIG_MICROBIT_LOG_QUEUE_SIZE
+#define CONFIG_MICROBIT_LOG_QUEUE_SIZE          0
+#endif
+
+// Percentage occupancy of the queue at which MICROBIT_LOG_EVT_QUEUE_HIGH is raised.
+#ifndef CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK
+#define CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK    75
+#endif
+
+// Default journal commit policy. The journal is updated once this many bytes of data have been written
+// since the last entry, after this many rows (zero to disable) or after this many ms (zero to disable),
+// whichever comes first. The journal only speeds up mounting: data written since the last entry is
+// recovered by scanning for the end of the data.
+#ifndef CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_BYTES
+#define CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_BYTES    CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE
+#endif
+
+#ifndef CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_ROWS
+#define CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_ROWS     0
+#endif
+
+#ifndef CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_PERIOD
+#define CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_PERIOD   0
+#endif
+
+// Size (in bytes) of the read ahead buffer used by beginExport() / readExport().
+#ifndef CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE
+#define CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE      CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE
+#endif
+
+// Size (in bytes) of the time index held at the end of the flash, after the data. Must be a multiple of the flash
+// page size. Zero disables the index, so seekToTime() is not supported and binary data is expanded from the start.
+#ifndef CONFIG_MICROBIT_LOG_INDEX_SIZE
+#define CONFIG_MICROBIT_LOG_INDEX_SIZE          8192
+#endif
+
+// Minimum number of bytes of data between index entries. This is raised if needed, so that the index can cover the whole log.
+#ifndef CONFIG_MICROBIT_LOG_INDEX_INTERVAL
+#define CONFIG_MICROBIT_LOG_INDEX_INTERVAL      4096
+#endif
+
+// Initial number of columns to allocate space for. Capacity doubles each time it is exhausted.
+#ifndef CONFIG_MICROBIT_LOG_COLUMN_CAPACITY
+#define CONFIG_MICROBIT_LOG_COLUMN_CAPACITY     8
+#endif
+
+#if CONFIG_MICROBIT_LOG_COLUMN_CAPACITY < 1
+#error "CONFIG_MICROBIT_LOG_COLUMN_CAPACITY must be at least 1"
+#endif
+
 #define MICROBIT_LOG_VERSION                "UBIT_LOG_FS_V_002\n"           // MUST be 18 characters.
+#define MICROBIT_LOG_VERSION_BINARY         "UBIT_LOG_FS_V_B02\n"           // MUST be 18 characters, and share the first 14 with MICROBIT_LOG_VERSION.
+#define MICROBIT_LOG_VERSION_CIRCULAR       "UBIT_LOG_FS_V_R02\n"           // MUST be 18 characters, and share the first 14 with MICROBIT_LOG_VERSION.
+#define MICROBIT_LOG_VERSION_FORMAT_INDEX   14                              // Offset of the character that distinguishes them.
 #define MICROBIT_LOG_JOURNAL_ENTRY_SIZE     8
 
 #define MICROBIT_LOG_STATUS_INITIALIZED     0x0001
 #define MICROBIT_LOG_STATUS_ROW_STARTED     0x0002
 #define MICROBIT_LOG_STATUS_FULL            0x0004
 #define MICROBIT_LOG_STATUS_SERIAL_MIRROR   0x0008
+#define MICROBIT_LOG_STATUS_QUEUE_LISTENING 0x0010
+#define MICROBIT_LOG_STATUS_QUEUE_DRAINING  0x0020
+#define MICROBIT_LOG_STATUS_QUEUE_HIGH      0x0040
+#define MICROBIT_LOG_STATUS_INVALIDATE_PENDING  0x0080
+#define MICROBIT_LOG_STATUS_INVALIDATE_LISTENING 0x0100
 
 
 #define MICROBIT_LOG_EVT_LOG_FULL           1
+#define MICROBIT_LOG_EVT_QUEUE_HIGH         2
+#define MICROBIT_LOG_EVT_QUEUE_DRAIN        3
+#define MICROBIT_LOG_EVT_INVALIDATE         4
+
+// Record types used by StorageFormat::Binary.
+// No byte of a binary record is ever 0xFF, so the end of the log can be found in the same way as for text.
+#define MICROBIT_LOG_RECORD_TEXT            0x01        // Literal text (column headings, or logString()): length, then the text.
+#define MICROBIT_LOG_RECORD_ROW             0x02        // A row of data: column count, packed column types, then the values.
+#define MICROBIT_LOG_RECORD_SYNC            0x03        // Resets the base of every delta encoded column to zero.
+
+// Column types within a MICROBIT_LOG_RECORD_ROW, packed three to a byte.
+#define MICROBIT_LOG_COLUMN_EMPTY           0           // No value.
+#define MICROBIT_LOG_COLUMN_INTEGER         1           // Zigzag encoded delta from the column's previous numeric value.
+#define MICROBIT_LOG_COLUMN_STRING          2           // Length, then the text.
+#define MICROBIT_LOG_COLUMN_DECIMAL         3           // Number of decimal places, then a delta as for MICROBIT_LOG_COLUMN_INTEGER.
 
 namespace codal
 {
@@ -144,6 +243,21 @@ namespace codal
         public:
         ManagedString key;
         ManagedString value;
+        int32_t number;             // Numeric value of this column, if numeric is set. Rendered with the given decimal places.
+        uint8_t decimals;
+        bool numeric;               // True if the value is held in number, rather than value.
+        int32_t previous;           // Last numeric value stored in this column, the base of delta encoding.
+        uint32_t hash;              // Hash of key, used to locate this column in the column index.
+
+        ColumnEntry() : number(0), decimals(0), numeric(false), previous(0), hash(0) {}
+
+        /**
+         * Determines if this column has a value in the current row.
+         */
+        bool hasValue()
+        {
+            return numeric || value.length() > 0;
+        }
     };
 
     
@@ -184,6 +298,18 @@ namespace codal
     };
 
 
+    /**
+     * An entry in the time index, recording where a row starts and when it was logged.
+     * Entries invalidated when the log is mounted are zeroed.
+     */
+    struct MicroBitLogIndexEntry
+    {
+        uint32_t    offset;         // Offset of the row in the CSV data.
+        uint32_t    address;        // Logical address of the row in flash, or zero if the entry is invalid.
+        uint32_t    time;           // Time the row was logged, in ms since the micro:bit started.
+        uint32_t    session;        // The number of the session (power on, or clear) in which the row was logged.
+    };
+
     enum class DataFormat
     {
         HTMLHeader = 0,   // The HTML header without the data
@@ -191,11 +317,29 @@ namespace codal
         CSV = 2           // CSV data
     };
 
+    enum class StorageFormat
+    {
+        Text = 0,         // Rows are stored as CSV text, readable directly from the MICROBIT drive.
+        Binary = 1        // Rows are stored as compact binary records, and expanded to CSV when read.
+    };
+
+    enum class SerialMirrorPolicy
+    {
+        Block = 0,            // Logging waits for the serial port, so every row is mirrored.
+        DropRow = 1           // Rows that do not fit in the serial transmit buffer are not mirrored, so logging never waits.
+    };
+
+    enum class RetentionPolicy
+    {
+        StopWhenFull = 0,     // Logging stops once the log is full.
+        OverwriteOldest = 1   // The oldest data is erased to make space, so the log holds the most recent data.
+    };
+
     /**
      * Class definition for MicroBitLog. A simple text only, append only, single file log file system.
      * Also contains a key/value pair abstraction to enable dynamic creation of CSV based logfiles.
      */
-    class MicroBitLog 
+    class MicroBitLog : public MicroBitMemoryConsumer
     {
         private:
         MicroBitUSBFlashManager         &flash;             // Non-volatile memory controller to use for storage.
@@ -209,6 +353,12 @@ namespace codal
         uint32_t                        journalPages;       // Number of physical pages allocated to journalling.
         uint32_t                        journalStart;       // logical address of the start of the journal section.
         uint32_t                        journalHead;        // Logical address of the last valid journal entry.
+        uint32_t                        journalCommitted;   // Length of data recorded by the last valid journal entry.
+        uint32_t                        journalRows;        // Number of rows written since the last journal entry.
+        CODAL_TIMESTAMP                 journalTime;        // Time of the last journal entry.
+        uint32_t                        journalCommitBytes; // Journal commit policy: bytes between entries (zero to disable).
+        uint32_t                        journalCommitRows;  // Journal commit policy: rows between entries (zero to disable).
+        uint32_t                        journalCommitPeriod;// Journal commit policy: ms between entries (zero to disable).
         uint32_t                        dataStart;          // Logical address of the start of the Data section.
         uint32_t                        dataEnd;            // Logical address of the end of valid data.
         uint32_t                        logEnd;             // Logical address of the end of the file system space.
@@ -216,13 +366,55 @@ namespace codal
         uint32_t                        headingLength;      // The length (in bytes) of the column header data.
         uint32_t                        headingCount;       // Total number of headings in the current log.
         bool                            headingsChanged;    // Flag to indicate if a row has been added that contains new columns.
+        ManagedString                   headings;           // The current column headings, formatted as a line of CSV.
         bool                            timeStampChanged;   // Flag to indicate if a timestamp format has changed.
 
         struct ColumnEntry*             rowData;            // Collection of key/value pairs. Used to accumulate each data row.
+        uint32_t                        columnCapacity;     // Number of entries allocated in rowData.
+        uint16_t                        *columnIndex;       // Open addressing hash table of (column number + 1), indexed by key hash. Zero marks an empty slot.
+        uint32_t                        columnIndexSize;    // Number of slots in columnIndex. A power of two, at least twice columnCapacity.
         struct MicroBitLogMetaData      metaData;           // Snapshot of the metadata held in flash storage.
         TimeStampFormat                 timeStampFormat;    // The format of timestamp to log on each row.
         ManagedString                   timeStampHeading;   // The title of the timestamp column, including units.
 
+        StorageFormat                   storageFormat;      // The format rows are stored in.
+        RetentionPolicy                 retention;          // What happens when the log is full.
+        uint32_t                        ringSize;           // Size of the ring of whole pages used by RetentionPolicy::OverwriteOldest.
+        uint32_t                        ringBase;           // Logical offset of dataStart in the current lap of the ring. Zero for a linear log.
+        uint32_t                        ringSkipFrom;       // Logical start of retained data that ringSkip refers to. Zero if ringSkip is unknown.
+        uint32_t                        ringSkip;           // Number of bytes from ringSkipFrom to the first complete row.
+        SerialMirrorPolicy              mirrorPolicy;       // What happens to mirrored rows when the serial port is busy.
+        uint32_t                        mirroredRows;       // Number of rows sent to the serial port.
+        uint32_t                        droppedRows;        // Number of rows not sent to the serial port, as it was busy.
+        bool                            syncPending;        // Flag to indicate delta bases must be reset before the next binary row.
+        bool                            csvLengthValid;     // Flag to indicate csvLength is up to date.
+        uint32_t                        csvLength;          // The length of the stored data when expanded to CSV.
+
+        uint32_t                        readAddress;        // Logical address of the next binary record to expand.
+        uint32_t                        readOffset;         // Offset of readRecord within the expanded CSV.
+        ManagedString                   readRecord;         // The most recently expanded binary record.
+        int32_t                         *readBase;          // Delta encoding bases of each column, at readAddress.
+        uint32_t                        readBaseCount;      // Number of entries in readBase.
+
+        DataFormat                      exportFormat;       // The format of the export in progress.
+        uint32_t                        exportLength;       // Total length of the export in progress.
+        uint32_t                        exportIndex;        // Index of the next byte to be returned by readExport().
+        uint8_t                         *exportBuffer;      // Read ahead buffer for the export. Allocated by beginExport().
+        uint32_t                        exportBufferStart;  // Index of the first byte held in exportBuffer.
+        uint32_t                        exportBufferLength; // Number of bytes held in exportBuffer.
+
+        uint8_t                         *queue;             // Ring buffer of data waiting to be written to flash. Allocated on first use.
+        uint32_t                        queueSize;          // Capacity of the queue, in bytes. Zero if the queue is disabled.
+        uint32_t                        queueHead;          // Offset of the oldest byte in the queue.
+        uint32_t                        queueLength;        // Number of bytes held in the queue.
+
+        uint32_t                        indexStart;         // Logical address of the start of the time index. Zero if the log has no index.
+        uint32_t                        indexCount;         // Number of entries written to the index, including any invalidated.
+        uint32_t                        indexInterval;      // Number of bytes of data between index entries.
+        uint32_t                        indexLast;          // Logical address of the row recorded by the last entry of this session.
+        uint32_t                        indexSession;       // Session number recorded in the entries of this session.
+        bool                            indexOpen;          // Flag to indicate an entry has been written during this session.
+
         const static uint8_t            header[2048];       // static header to prepend to FS in physical storage.
 
         public:
@@ -263,8 +455,11 @@ namespace codal
          * Clears the current log, including any previously defined keys.
          * By default a "fast format" approach is typically adopted, where only the FS metadata is reset. Any previously
          * stored user data will not be visible, but could still be extracted using forensic techniques.
+         * The header and metadata are only rewritten if they have changed, and the journal and data pages are erased
+         * as they are next needed, so clearing a log that is already present takes little time.
          * A full erase option is is supported that elimates all trace of user data, but this is not recommended
-         * unless strictly necessary as it will take a long time to complete and promotes excessive flash wear.
+         * unless strictly necessary as it promotes excessive flash wear. Once the scheduler is running, the old data
+         * is erased in the background.
          *
          * @param fullErase if set to true, all data will be hard erased from storage.
          */
@@ -273,8 +468,11 @@ namespace codal
         /**
          * Marks an existing Log as invalid. The log will be cleared with the default settings the next time
          * a user attempts to use it. If no valid log is present, this method has no effect.
+         *
+         * @param deferred If true, return at once, and invalidate the log in the background once the scheduler is running.
+         * The log is still invalidated before any other use of it. Defaults to false.
          */
-        void invalidate();
+        void invalidate(bool deferred = false);
 
 
         /**
@@ -289,10 +487,82 @@ namespace codal
         /**
          * Defines if data logging should also be streamed over the serial port.
          *
+         * With SerialMirrorPolicy::DropRow, each row is queued for transmission only if it fits in the serial
+         * transmit buffer in full, so the serial port never limits the rate of logging. Rows that do not fit
+         * are counted by getSerialMirrorDropped(). The default transmit buffer (CODAL_SERIAL_DEFAULT_BUFFER_SIZE,
+         * 20 bytes) is smaller than most rows, so enlarge it with uBit.serial.setTxBufferSize() to hold the
+         * longest row plus two bytes for its line ending. Rows too long for even an empty buffer are truncated
+         * to fit once the buffer has drained, rather than always dropped.
+         *
          * @param enable True to enable serial port streaming, false to disable.
+         * @param policy What to do with a row when the serial port cannot accept it immediately.
          */
-        void setSerialMirroring(bool enable);
+        void setSerialMirroring(bool enable, SerialMirrorPolicy policy = SerialMirrorPolicy::Block);
 
+        /**
+         * Determines the number of rows sent to the serial port since the counters were last reset.
+         * @return The number of rows mirrored.
+         */
+        uint32_t getSerialMirrorCount();
+
+        /**
+         * Determines the number of rows not sent to the serial port, because its transmit buffer was full.
+         * @return The number of rows dropped.
+         */
+        uint32_t getSerialMirrorDropped();
+
+        /**
+         * Resets the serial mirroring counters to zero.
+         */
+        void resetSerialMirrorCounters();
+
+
+        /**
+         * Defines how rows are stored in flash.
+         *
+         * StorageFormat::Binary stores numbers as typed, delta encoded values, typically fitting several times
+         * as many rows in the same space, and making endRow() faster. getDataLength() and readData() expand the
+         * data back into the same CSV and HTML views as StorageFormat::Text. However, the MY_DATA.HTM file
+         * presented on the MICROBIT drive is served directly from flash, so shows no data in this format.
+         *
+         * The format can only be changed while the log is empty. It is recorded in the log, so persists
+         * across a reset, and is retained when the log is cleared.
+         *
+         * @param format The format to store rows in.
+         * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the log already contains data, or DEVICE_NOT_SUPPORTED
+         * if the format cannot be used with the current retention policy.
+         */
+        int setStorageFormat(StorageFormat format);
+
+        /**
+         * Determines how rows are stored in flash.
+         * @return The current storage format.
+         */
+        StorageFormat getStorageFormat();
+
+        /**
+         * Defines what happens when the log is full.
+         *
+         * With RetentionPolicy::OverwriteOldest, the data section is used as a ring of flash pages. The page ahead
+         * of the data is erased as the data reaches it, so logging never stops and the log holds the most recent
+         * data. getDataLength() and readData() present the retained rows in order, following the latest column
+         * headings. As with StorageFormat::Binary, MY_DATA.HTM on the MICROBIT drive is served directly from
+         * flash, so shows no data in this mode. Only StorageFormat::Text is supported.
+         *
+         * The policy can only be changed while the log is empty. It is recorded in the log, so persists
+         * across a reset, and is retained when the log is cleared.
+         *
+         * @param policy The retention policy to use.
+         * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the log already contains data, or
+         * DEVICE_NOT_SUPPORTED if the policy cannot be used with the current storage format or flash size.
+         */
+        int setRetention(RetentionPolicy policy);
+
+        /**
+         * Determines what happens when the log is full.
+         * @return The current retention policy.
+         */
+        RetentionPolicy getRetention();
 
         /**
          * Creates a new row in the log, ready to be populated by logData()
@@ -319,6 +589,38 @@ namespace codal
          */
         int logData(ManagedString key, ManagedString value);
 
+        /**
+         * Populates the current row with the given key and integer value.
+         * The value is stored as a number, and only formatted when the row is committed (or read, in binary format),
+         * so once the column exists no heap memory is allocated.
+         *
+         * @param key the name of the key column) to set.
+         * @param value the value to insert
+         *
+         * @return DEVICE_OK on success.
+         */
+        int logData(const char *key, int value);
+
+        /**
+         * Populates the current row with the given key and floating point value.
+         * The value is stored as a fixed point number with the given number of decimal places, and only formatted
+         * when the row is committed (or read, in binary format), so once the column exists no heap memory is allocated.
+         *
+         * @param key the name of the key column) to set.
+         * @param value the value to insert
+         * @param precision the number of decimal places to record, up to MICROBIT_LOG_MAX_PRECISION. Fewer are
+         * recorded if the value would not otherwise fit in 32 bits.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int logData(const char *key, float value, int precision = CONFIG_MICROBIT_LOG_DEFAULT_PRECISION);
+
+        /**
+         * Populates the current row with the given key and floating point value.
+         * Equivalent to logData(const char *, float, int), provided so that double arguments are not ambiguous.
+         */
+        int logData(const char *key, double value, int precision = CONFIG_MICROBIT_LOG_DEFAULT_PRECISION);
+
         /**
          * Complete a row in the log, and pushes to persistent storage.
          * @return DEVICE_OK on success.
@@ -361,6 +663,133 @@ namespace codal
          */
         int readData(void *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length);
 
+        /**
+         * Finds where the rows logged since a given time start in the CSV data, using the time index, so that a
+         * partial export takes the same time however long the log is. The offset returned is that of an indexed row
+         * logged no later than the time given, so up to one index interval (at least CONFIG_MICROBIT_LOG_INDEX_INTERVAL
+         * bytes) of earlier rows may precede the first one wanted. Only rows logged since the micro:bit last started are
+         * considered, and rows are indexed as endRow() writes them, so text added by logString() is never the start of an
+         * indexed range.
+         *
+         * @param time the time in ms since the micro:bit started, as given by system_timer_current_time().
+         * @return the offset into the CSV data from which readRange() should read, which is the length of the data
+         * if no rows have been logged since the micro:bit started, or DEVICE_NOT_SUPPORTED if the log has no index
+         * (such as a log formatted without one, or a circular log).
+         */
+        int seekToTime(uint32_t time);
+
+        /**
+         * Reads part of the recorded data as CSV, such as from the offset given by seekToTime().
+         * In a binary log, rows are expanded from the nearest indexed row before the offset, rather than from the start.
+         *
+         * @param data pointer to memory to store the data.
+         * @param index the offset into the CSV data of the first byte to read.
+         * @param len the maximum number of bytes to read.
+         * @return the number of bytes read, zero if index is at or past the end of the data, or DEVICE_INVALID_PARAMETER
+         * if the data could not be read.
+         */
+        int readRange(void *data, uint32_t index, uint32_t len);
+
+        /**
+         * Starts a sequential export of the recorded data, such as a transfer over BLE or serial.
+         * Unlike readData(), the export keeps its position between calls and reads ahead from flash in blocks of
+         * CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE bytes, so the whole log is exported in linear time however small
+         * the chunks requested. The export covers the data recorded when it is started. Rows logged afterwards
+         * are not included. Starting a new export abandons any export in progress.
+         *
+         * @param format the data format to export.
+         * @return the total length of the export in bytes, or DEVICE_NO_RESOURCES if the read ahead buffer could not
+         * be allocated.
+         */
+        int beginExport(DataFormat format = DataFormat::CSV);
+
+        /**
+         * Reads the next part of the export started by beginExport().
+         *
+         * @param data pointer to memory to store the data.
+         * @param len the maximum number of bytes to read.
+         * @return the number of bytes read, zero at the end of the export (or if no export is in progress, or the log
+         * has been cleared since it started), or DEVICE_INVALID_PARAMETER if the data could not be read.
+         */
+        int readExport(void *data, uint32_t len);
+
+        /**
+         * Moves the position of the export started by beginExport(), such as to resume an interrupted transfer.
+         *
+         * @param index the offset into the export to continue from.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no export is in progress or the index is beyond its end.
+         */
+        int seekExport(uint32_t index);
+
+        /**
+         * Ends the export started by beginExport(), and releases its read ahead buffer.
+         */
+        void endExport();
+
+        /**
+         * Sets the size of the RAM queue used to write committed rows to flash in the background.
+         * With a queue, endRow() and logString() return once the data is queued. A background fiber then
+         * writes it out, so the caller does not wait for the flash. If the queue fills, the caller writes
+         * the queue to flash itself, so no data is lost. MICROBIT_LOG_EVT_QUEUE_HIGH is raised when the queue
+         * passes CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK percent full.
+         *
+         * @param size the size of the queue in bytes, or zero to write rows to flash before endRow() returns.
+         * @return DEVICE_OK on success.
+         *
+         * @note queued data is lost if the device is reset before it is written. Use flush() where this matters.
+         */
+        int setQueueSize(uint32_t size);
+
+        /**
+         * Writes any queued data to flash, returning once it has been stored.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int flush();
+
+        /**
+         * Defines how often the journal is updated. A journal entry is written once any enabled limit is reached.
+         * Fewer entries reduce flash writes. Data written since the last entry is never lost, but has to
+         * be found by scanning when the log is next mounted.
+         *
+         * @param bytes the number of bytes of data to write between journal entries, or zero to disable.
+         * @param rows the number of rows to write between journal entries, or zero to disable.
+         * @param period the time in ms between journal entries, or zero to disable. Only checked as data is written.
+         */
+        void setJournalPolicy(uint32_t bytes, uint32_t rows = 0, uint32_t period = 0);
+
+        /**
+         * Writes any queued data to flash, and records the end of the data in the journal.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int sync();
+
+        /**
+         * Retrieves the usage counters of the log's flash cache, such as hits, misses and the number of operations
+         * issued to the interface chip. Useful when tuning CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE and the cache size.
+         * @return a copy of the counters.
+         */
+        FSCacheStatistics getCacheStatistics();
+
+        /**
+         * Resets the usage counters of the log's flash cache to zero.
+         */
+        void resetCacheStatistics();
+
+        /**
+         * Determines the heap memory committed by the log: its flash cache, column table, write queue and export buffer.
+         *
+         * @return The number of bytes currently allocated.
+         */
+        virtual uint32_t getMemoryUsage();
+
+        /**
+         * Frees the unmodified blocks held by the flash cache, the write queue while it is empty, and the
+         * export buffer if no export is in progress. Each is allocated again when next needed.
+         *
+         * @return The number of bytes returned to the heap.
+         */
+        virtual uint32_t releaseMemory();
+
     private:
 
         /**
@@ -368,6 +797,74 @@ namespace codal
          */
         void init();
 
+        /**
+         * Locate the most recent journal entry, and set journalHead and dataEnd from it.
+         */
+        void _mountJournal();
+
+        /**
+         * Move dataEnd on from the position recorded in the journal to the first unused (0xFF) byte of the data section.
+         */
+        void _mountData();
+
+        /**
+         * Determines if the header and metadata held in flash match header[] and metaData, so need not be written again.
+         */
+        bool _headerMatches();
+
+        /**
+         * Load the time index, invalidating any entries that refer to data which never reached flash.
+         */
+        void _mountIndex();
+
+        /**
+         * Record the start of the row about to be written in the time index, if it is due an entry.
+         */
+        void _indexRow();
+
+        /**
+         * Read the given entry of the time index.
+         */
+        void _readIndex(uint32_t entry, MicroBitLogIndexEntry &e);
+
+        /**
+         * Find the last valid entry of the time index at or before the given offset in the CSV data.
+         * @return true if such an entry was found, false otherwise.
+         */
+        bool _findIndex(uint32_t offset, MicroBitLogIndexEntry &e);
+
+        /**
+         * Position the binary reader at or before the given offset in the CSV data, moving it on to the nearest
+         * indexed row if that is closer than the current position.
+         */
+        void _seekReader(uint32_t offset);
+
+        /**
+         * Determines if the log holds no data, including any waiting in the queue.
+         */
+        bool _isEmpty();
+
+        /**
+         * Determine the logical length of the data written, including any data overwritten in a circular log.
+         */
+        uint32_t _dataLength();
+
+        /**
+         * Determine the number of bytes that can still be written in one go.
+         */
+        uint32_t _freeSpace();
+
+        /**
+         * Determine the logical offset of the first complete row retained in a circular log.
+         */
+        uint32_t _ringFirstRow();
+
+        /**
+         * Read retained data from a circular log, preceded by the latest column headings if older rows have been overwritten.
+         * Parameters are as for _readSource().
+         */
+        int _readCircular( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen);
+
         /*
          * Private APIs methods.
          * These methods enable the functionality of the public APIs, but assume mutual exclusion has already been acquired.
@@ -380,10 +877,15 @@ namespace codal
         int _beginRow();
         int _endRow();
         int _logData(ManagedString key, ManagedString value);
+        int _logData(const char *key, int32_t number, int decimals);
         int _logString(const char *s);
+        int _logString(const char *s, uint32_t l);
         int _logString(ManagedString s);
 
         int _readData(uint8_t *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length);
+        uint32_t _getDataLength(DataFormat format);
+        int _seekToTime(uint32_t time);
+        int _readRange(uint8_t *data, uint32_t index, uint32_t len);
         
         /**
          * Read the source data from local memory or interface flash
@@ -399,6 +901,127 @@ namespace codal
          */
         int _readSource( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, const void *srcPtr, uint32_t srcAddress, uint32_t srcLen);
 
+        /**
+         * Read data stored in StorageFormat::Binary, expanded to CSV.
+         * @param data pointer reference to memory to store the data
+         * @param index  reference to the index into the data
+         * @param len reference to the length of the data to fetch
+         * @param srcIndex reference to the index where the expanded data should begin
+         * @param srcLen the length of the expanded data
+         * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+         * @note On success, the referenced pointers, indices and lengths are updated ready for the next call
+         */
+        int _readExpanded( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen);
+
+        /**
+         * Append raw data to the data section, maintaining the journal.
+         * @param data the data to write.
+         * @param len the number of bytes to write.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _append(const void *data, uint32_t len);
+
+        /**
+         * Write raw data to the end of the data section, maintaining the journal.
+         * @param data the data to write.
+         * @param len the number of bytes to write.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _write(const void *data, uint32_t len);
+
+        /**
+         * Write up to the given number of bytes from the front of the queue to flash.
+         * @param len the maximum number of bytes to write.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int _drainQueue(uint32_t len);
+
+        /**
+         * Write all queued data to flash.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int _flush();
+
+        /**
+         * Write all queued data to flash, and record the end of the data in the journal.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+         */
+        int _sync();
+
+        /**
+         * Write a journal entry recording the current end of the data.
+         */
+        void _commitJournal();
+
+        /**
+         * Background writer. Drains the queue in blocks, releasing the mutex between each one.
+         */
+        void onQueueDrain(Event);
+
+        /**
+         * Background invalidation, requested by invalidate(true).
+         */
+        void onInvalidate(Event);
+
+        /**
+         * Invalidates the log now if invalidate(true) has been called, and it has not been done yet.
+         */
+        void _invalidatePending();
+
+        /**
+         * Encode the current row as a binary record, and append it to the log.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _logRow();
+
+        /**
+         * Serialise the current row as a line of CSV, and append it to the log.
+         * The row is formatted in a stack buffer where it fits, and is written to the log in one operation.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+         */
+        int _logRowText();
+
+        /**
+         * Determines the worst case length of the current row, when serialised as a line of CSV.
+         * @return the maximum length in bytes, or zero if the row holds no values.
+         */
+        uint32_t _rowTextLength();
+
+        /**
+         * Serialise the current row as a line of CSV.
+         * @param row the buffer to write into, of at least _rowTextLength() bytes.
+         * @return the length of the line, in bytes, including its line ending.
+         */
+        uint32_t _renderRow(char *row);
+
+        /**
+         * Send a line of text to the serial port, according to the mirroring policy.
+         * @param s the line to send, ending in a newline, which is sent as "\r\n".
+         * @param l the length of the line, in bytes.
+         */
+        void _mirror(const char *s, uint32_t l);
+
+        /**
+         * Determine the length of the stored data, when expanded to CSV.
+         */
+        uint32_t _getCsvLength();
+
+        /**
+         * Restart expansion of binary records from the start of the data section.
+         */
+        void _resetReader();
+
+        /**
+         * Expand the binary record at readAddress into readRecord, and move readAddress on to the next record.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if there are no more records.
+         */
+        int _expandRecord();
+
+        /**
+         * Read an unsigned integer stored in base 127 from the given address, and move the address on past it.
+         */
+        uint32_t _readVarint(uint32_t &address);
+
         /**
          * Add the given heading to the list of headings in use. If the heading already exists,
          * this method has no effect.
@@ -409,6 +1032,31 @@ namespace codal
          */
         void addHeading(ManagedString key, ManagedString value, bool head = false);
 
+        /**
+         * Locate the column with the given heading.
+         *
+         * @param key the heading to find.
+         * @param length the length of key, in bytes.
+         * @return the index of the column in rowData, or -1 if no such column exists.
+         */
+        int _findColumn(const char *key, uint32_t length);
+
+        /**
+         * Ensure rowData has space for at least the given number of columns, preserving any existing columns.
+         * @param count the number of columns required.
+         */
+        void _reserveColumns(uint32_t count);
+
+        /**
+         * Rebuild the column index from the headings in rowData.
+         */
+        void _indexColumns();
+
+        /**
+         * Release all column headings and the column index.
+         */
+        void _freeColumns();
+
         /**
          * Clean the given buffer of invalid LogFS symbols ("-->" and optionally ",\t\n")
          *
@@ -0,0 +1,111 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_MEMORY_CONSUMER_H
+#define MICROBIT_MEMORY_CONSUMER_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    /**
+     * Class definition for MicroBitMemoryConsumer.
+     *
+     * A component that commits heap memory on first use. Every consumer is listed, so that the RAM footprint
+     * of each can be reported, and memory not currently in use reclaimed from all of them when the heap runs short.
+     * Memory released is committed again the next time the component needs it.
+     */
+    class MicroBitMemoryConsumer
+    {
+        const char                      *memoryName;        // The name of the component, in reports.
+        MicroBitMemoryConsumer          *nextConsumer;      // The next consumer in the list of all consumers.
+
+        static MicroBitMemoryConsumer   *consumers;         // List of all consumers.
+
+        public:
+
+        /**
+         * Constructor. Adds the component to the list of consumers.
+         *
+         * @param name The name of the component, in reports. This is not copied, so should be a string literal.
+         */
+        MicroBitMemoryConsumer(const char *name);
+
+        /**
+         * Destructor. Removes the component from the list of consumers.
+         */
+        virtual ~MicroBitMemoryConsumer();
+
+        /**
+         * Reads the name of the component, as used in reports.
+         *
+         * @return The name.
+         */
+        const char *getMemoryName();
+
+        /**
+         * Determines the heap memory committed by the component.
+         *
+         * @return The number of bytes currently allocated.
+         */
+        virtual uint32_t getMemoryUsage() = 0;
+
+        /**
+         * Frees any memory the component has committed but is not currently using.
+         *
+         * @return The number of bytes returned to the heap.
+         */
+        virtual uint32_t releaseMemory();
+
+        /**
+         * Finds a consumer by name.
+         *
+         * @param name The name of the component, as given to its constructor.
+         *
+         * @return The consumer, or NULL if there is no such consumer.
+         */
+        static MicroBitMemoryConsumer *find(const char *name);
+
+        /**
+         * Frees the memory that every consumer has committed but is not currently using.
+         *
+         * @return The number of bytes returned to the heap.
+         */
+        static uint32_t releaseAll();
+
+        /**
+         * Determines the heap memory committed by all consumers.
+         *
+         * @return The number of bytes currently allocated.
+         */
+        static uint32_t getTotalUsage();
+
+        /**
+         * Writes the heap memory committed by each consumer to the debug log.
+         */
+        static void printMemoryUsage();
+    };
+}
+
+#endif
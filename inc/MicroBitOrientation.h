@@ -0,0 +1,78 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_ORIENTATION_H
+#define MICROBIT_ORIENTATION_H
+
+#include "MicroBitConfig.h"
+
+#define MICROBIT_ORIENTATION_PI                     3.14159265f
+
+/**
+ * The accuracy with which orientation (pitch, roll and heading) is calculated.
+ *
+ * The precise calculation uses the double precision functions of the maths library, which the nRF52 FPU does not
+ * accelerate. The approximations use only single precision arithmetic, with the maximum errors stated below.
+ */
+enum MicroBitOrientationAccuracy
+{
+    ORIENTATION_ACCURACY_PRECISE = 0,               // Maths library atan2 and sqrt.
+    ORIENTATION_ACCURACY_FAST,                      // atan2 within 0.0016 radians (0.09 degrees).
+    ORIENTATION_ACCURACY_FASTEST                    // atan2 within 0.0040 radians (0.23 degrees).
+};
+
+// The accuracy with which the accelerometer and compass calculate orientation, until changed by the application.
+#ifndef MICROBIT_ORIENTATION_ACCURACY
+#define MICROBIT_ORIENTATION_ACCURACY               ORIENTATION_ACCURACY_PRECISE
+#endif
+
+/**
+ * Calculates the angle of the vector (x, y) from the positive x axis.
+ *
+ * The angle is reduced to a single octant, where it is approximated by a polynomial in y/x, and then
+ * mapped back to the full circle.
+ *
+ * @param y The y component of the vector.
+ * @param x The x component of the vector.
+ * @param accuracy The accuracy required.
+ *
+ * @return The angle in radians, in the range -PI..PI.
+ */
+float microbit_atan2(float y, float x, MicroBitOrientationAccuracy accuracy);
+
+/**
+ * Calculates the reciprocal of the square root of the given value.
+ *
+ * The approximations refine an initial estimate, taken from the floating point exponent, with Newton-Raphson
+ * iterations: one iteration for ORIENTATION_ACCURACY_FASTEST (within 0.18%), and two for ORIENTATION_ACCURACY_FAST
+ * (within 0.0005%).
+ *
+ * @param x The value, which must be greater than zero.
+ * @param accuracy The accuracy required.
+ *
+ * @return 1 / sqrt(x).
+ */
+float microbit_inv_sqrt(float x, MicroBitOrientationAccuracy accuracy);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_POWER_GOVERNOR_H
+#define MICROBIT_POWER_GOVERNOR_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "Accelerometer.h"
+#include "Compass.h"
+#include "MicroBitPowerManager.h"
+#include "MicroBitDisplay.h"
+#include "MicroBitRadio.h"
+#include "MicroBitAudio.h"
+
+#define DEVICE_ID_POWER_GOVERNOR                    3045
+
+//
+// Power levels, in order of decreasing quality of service.
+//
+#define MICROBIT_POWER_LEVEL_FULL                   0
+#define MICROBIT_POWER_LEVEL_REDUCED                1
+#define MICROBIT_POWER_LEVEL_LOW                    2
+#define MICROBIT_POWER_LEVEL_CRITICAL               3
+#define MICROBIT_POWER_LEVELS                       4
+
+//
+// Events raised when the governor moves to a new power level. The event value is the new level + 1.
+//
+#define MICROBIT_POWER_GOVERNOR_EVT_FULL            1
+#define MICROBIT_POWER_GOVERNOR_EVT_REDUCED         2
+#define MICROBIT_POWER_GOVERNOR_EVT_LOW             3
+#define MICROBIT_POWER_GOVERNOR_EVT_CRITICAL        4
+
+//
+// Component Status flags
+//
+#define MICROBIT_POWER_GOVERNOR_STATUS_ENABLED      0x01
+
+//
+// Battery voltages below which the governor moves to each power level (millivolts).
+//
+#ifndef CONFIG_MICROBIT_POWER_GOVERNOR_REDUCED_MV
+#define CONFIG_MICROBIT_POWER_GOVERNOR_REDUCED_MV   2700
+#endif
+
+#ifndef CONFIG_MICROBIT_POWER_GOVERNOR_LOW_MV
+#define CONFIG_MICROBIT_POWER_GOVERNOR_LOW_MV       2400
+#endif
+
+#ifndef CONFIG_MICROBIT_POWER_GOVERNOR_CRITICAL_MV
+#define CONFIG_MICROBIT_POWER_GOVERNOR_CRITICAL_MV  2200
+#endif
+
+//
+// Rise in battery voltage above a threshold required before the governor returns to a higher power level (millivolts).
+//
+#ifndef CONFIG_MICROBIT_POWER_GOVERNOR_HYSTERESIS_MV
+#define CONFIG_MICROBIT_POWER_GOVERNOR_HYSTERESIS_MV 50
+#endif
+
+//
+// Period at which the governor asks the power manager to sample the battery voltage (milliseconds).
+//
+#ifndef CONFIG_MICROBIT_POWER_GOVERNOR_PERIOD
+#define CONFIG_MICROBIT_POWER_GOVERNOR_PERIOD       10000
+#endif
+
+namespace codal
+{
+    /**
+     * The settings applied to each subsystem at a reduced power level.
+     * Each setting acts as a limit: the governor never raises the quality of a subsystem above the value the application chose.
+     */
+    typedef struct {
+        uint8_t         displayFrequency;           // Maximum display frame update frequency (Hz).
+        uint8_t         displayBrightness;          // Maximum display brightness (0..255).
+        uint8_t         radioPower;                 // Maximum radio transmit power (0..7).
+        uint16_t        sensorPeriod;               // Minimum accelerometer and compass sample period (milliseconds).
+        uint16_t        audioSampleRate;            // Maximum audio output sample rate (samples per second).
+    } MicroBitPowerPolicy;
+
+    /**
+     * Class definition for MicroBitPowerGovernor.
+     *
+     * Monitors the battery voltage through the telemetry cache of the power manager and, when running from battery alone,
+     * reduces the quality of service of the display, radio, motion sensors and audio output as the voltage falls.
+     * The settings chosen by the application are restored when the voltage recovers or USB power is connected.
+     */
+    class MicroBitPowerGovernor : public CodalComponent
+    {
+        MicroBitPowerManager    &power;
+        MicroBitDisplay         &display;
+        MicroBitRadio           &radio;
+        Accelerometer           &accelerometer;
+        Compass                 &compass;
+        MicroBitAudio           &audio;
+
+        int                     level;                              // The power level currently applied.
+        uint32_t                thresholds[MICROBIT_POWER_LEVELS-1];// Battery voltages below which each reduced level applies (microvolts).
+        MicroBitPowerPolicy     policy[MICROBIT_POWER_LEVELS-1];    // The settings applied at each reduced level.
+        MicroBitPowerPolicy     baseline;                           // The application settings, recorded on leaving MICROBIT_POWER_LEVEL_FULL.
+        uint16_t                compassPeriod;                      // The compass period chosen by the application, recorded with baseline.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param power The power manager to obtain battery telemetry from.
+         * @param display The display to govern.
+         * @param radio The radio to govern.
+         * @param accelerometer The accelerometer to govern.
+         * @param compass The compass to govern.
+         * @param audio The audio pipeline to govern.
+         * @param id The id the governor should use when sending events on the MessageBus. Defaults to DEVICE_ID_POWER_GOVERNOR.
+         */
+        MicroBitPowerGovernor(MicroBitPowerManager &power, MicroBitDisplay &display, MicroBitRadio &radio, Accelerometer &accelerometer, Compass &compass, MicroBitAudio &audio, uint16_t id = DEVICE_ID_POWER_GOVERNOR);
+
+        /**
+         * Starts governing. Periodic telemetry sampling is started on the power manager,
+         * and the power level is evaluated immediately.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if telemetry sampling could not be started.
+         */
+        int enable();
+
+        /**
+         * Stops governing, and restores the settings chosen by the application.
+         *
+         * @return DEVICE_OK on success.
+         */
+        int disable();
+
+        /**
+         * Determines if the governor is active.
+         *
+         * @return true if enabled, false otherwise.
+         */
+        bool isEnabled();
+
+        /**
+         * Determines the power level currently applied.
+         *
+         * @return One of MICROBIT_POWER_LEVEL_FULL, MICROBIT_POWER_LEVEL_REDUCED, MICROBIT_POWER_LEVEL_LOW or MICROBIT_POWER_LEVEL_CRITICAL.
+         */
+        int getLevel();
+
+        /**
+         * Defines the battery voltages below which each reduced power level applies.
+         *
+         * @param reduced The voltage below which MICROBIT_POWER_LEVEL_REDUCED applies (millivolts).
+         * @param low The voltage below which MICROBIT_POWER_LEVEL_LOW applies (millivolts).
+         * @param critical The voltage below which MICROBIT_POWER_LEVEL_CRITICAL applies (millivolts).
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the voltages are not in decreasing order.
+         */
+        int setThresholds(uint32_t reduced, uint32_t low, uint32_t critical);
+
+        /**
+         * Defines the settings applied at the given power level. MICROBIT_POWER_LEVEL_FULL always applies the settings chosen by the application.
+         *
+         * @param level One of MICROBIT_POWER_LEVEL_REDUCED, MICROBIT_POWER_LEVEL_LOW or MICROBIT_POWER_LEVEL_CRITICAL.
+         * @param settings The settings to apply.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the level is out of range.
+         */
+        int setPolicy(int level, const MicroBitPowerPolicy &settings);
+
+        /**
+         * Re-evaluates the power level from the latest telemetry, and applies it if it has changed.
+         *
+         * @return The power level applied.
+         */
+        int update();
+
+        /**
+         * Destructor.
+         */
+        ~MicroBitPowerGovernor();
+
+        private:
+
+        /**
+         * Telemetry event handler.
+         */
+        void onTelemetry(Event);
+
+        /**
+         * Determines the power level for the given battery voltage, allowing for hysteresis around the current level.
+         *
+         * @param microVolts The battery voltage.
+         */
+        int levelFor(uint32_t microVolts);
+
+        /**
+         * Applies the settings of the given power level, limited by the settings chosen by the application.
+         *
+         * @param level The power level to apply.
+         */
+        void apply(int level);
+    };
+}
+
+#endif
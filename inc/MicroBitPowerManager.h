@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitConfig.h"
 #include "MicroBitCompat.h"
 #include "MicroBitIO.h"
+#include "MicroBitUSBInterfaceStatistics.h"
 #include "codal-core/inc/core/CodalComponent.h"
 #include "codal-core/inc/driver-models/I2C.h"
 #include "codal-core/inc/driver-models/Pin.h"
@@ -46,6 +47,9 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_UIPM_MAX_BUFFER_SIZE               12
 #define MICROBIT_UIPM_MAX_RETRIES                   20
 #define MICROBIT_USB_INTERFACE_IRQ_THRESHOLD        30
+#define MICROBIT_UIPM_READY_POLL_PERIOD             10          // Interval between polls of the interface chip while waiting for it to come online (milliseconds)
+#define MICROBIT_USB_INTERFACE_IRQ_DEBOUNCE         5           // Time the combined irq line must be held before the interface chip is read (milliseconds)
+#define MICROBIT_USB_INTERFACE_IRQ_HOLD_PERIOD      20          // Interval between reads while the combined irq line remains held (milliseconds)
 
 //
 // Command codes for the USB Interface Chip
@@ -136,6 +140,14 @@ typedef struct {
     float estimatedPowerConsumption;
 } MicroBitPowerData;
 
+typedef struct {
+    uint32_t cycles;                // Number of deep sleeps entered (including timed sleeps).
+    uint32_t entryLatency;          // Time from the deep sleep request to the CPU sleeping, for the last deep sleep (microseconds).
+    uint32_t wakeLatency;           // Time from the CPU waking to the peripherals being operational again, for the last deep sleep (microseconds).
+    uint32_t maxWakeLatency;        // Longest wakeLatency recorded (microseconds).
+    uint64_t sleepTime;             // Total time spent with the CPU asleep in deep sleep (microseconds).
+} MicroBitDeepSleepTiming;
+
 //
 // USB Interface Chip Power States
 //
@@ -149,6 +161,37 @@ typedef struct {
 #define MICROBIT_USB_INTERFACE_VERSION_LOADED      0x02
 #define MICROBIT_USB_INTERFACE_ALWAYS_NOP          0x04
 #define MICROBIT_USB_INTERFACE_BUSY_FLAG_SUPPORTED 0x20
+#define MICROBIT_USB_INTERFACE_POWER_DATA_CACHED   0x40
+#define MICROBIT_USB_INTERFACE_POWER_SOURCE_CACHED 0x80
+#define MICROBIT_USB_INTERFACE_USB_STATUS_CACHED   0x100
+#define MICROBIT_USB_INTERFACE_TELEMETRY_BASELINE  0x200
+#define MICROBIT_USB_INTERFACE_IRQ_ENABLED         0x400
+
+//
+// Events raised by the power manager. 
+// Values from MICROBIT_POWER_EVT_RESERVED upwards are never used for deep sleep wake up timers.
+//
+#define MICROBIT_POWER_EVT_RESERVED                 0xFF00
+#define MICROBIT_POWER_EVT_TELEMETRY_SAMPLE         0xFF00
+#define MICROBIT_POWER_EVT_POWER_DATA_CHANGED       0xFF01
+#define MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED     0xFF02
+#define MICROBIT_POWER_EVT_USB_STATUS_CHANGED       0xFF03
+#define MICROBIT_POWER_EVT_INTERFACE_IRQ            0xFF04
+
+//
+// Maximum age of cached power telemetry before it is read again from the interface chip (milliseconds).
+// Set to zero to always read from the interface chip.
+//
+#ifndef CONFIG_MICROBIT_POWER_TELEMETRY_MAX_AGE
+#define CONFIG_MICROBIT_POWER_TELEMETRY_MAX_AGE     100
+#endif
+
+//
+// Default change in battery or supply voltage required to raise MICROBIT_POWER_EVT_POWER_DATA_CHANGED (microvolts).
+//
+#ifndef CONFIG_MICROBIT_POWER_TELEMETRY_THRESHOLD
+#define CONFIG_MICROBIT_POWER_TELEMETRY_THRESHOLD   50000
+#endif
 
 //
 // Minimum deep sleep time (milliseconds)
@@ -157,6 +200,30 @@ typedef struct {
 #define CONFIG_MINIMUM_DEEP_SLEEP_TIME  100
 #endif
 
+//
+// Maximum time the scheduler tick may be suppressed when idle (milliseconds).
+// Fibers sleeping and button presses may be noticed up to this much later than usual.
+// Set to zero to disable tickless idle.
+//
+#ifndef CONFIG_MICROBIT_TICKLESS_IDLE_SLACK
+#define CONFIG_MICROBIT_TICKLESS_IDLE_SLACK  0
+#endif
+
+//
+// Minimum idle period worth suppressing the scheduler tick for (milliseconds)
+//
+#ifndef CONFIG_MICROBIT_TICKLESS_IDLE_MINIMUM
+#define CONFIG_MICROBIT_TICKLESS_IDLE_MINIMUM  10
+#endif
+
+//
+// Deep sleeps shorter than this leave the power LED state of the USB interface chip untouched (milliseconds),
+// avoiding two blocking I2C transactions on the way in and out of each sleep. Set to zero to always update it.
+//
+#ifndef CONFIG_MICROBIT_POWER_LED_SLEEP_THRESHOLD
+#define CONFIG_MICROBIT_POWER_LED_SLEEP_THRESHOLD  0
+#endif
+
 //
 // Minimum time between power up and power down (milliseconds)
 //
@@ -193,10 +260,20 @@ class MicroBitPowerManager : public CodalComponent
          */
         MicroBitPowerManager(MicroBitI2C &i2c, MicroBitIO &ioPins, NRFLowLevelTimer &systemTimer, uint16_t id = MICROBIT_ID_POWER_MANAGER);
 
+        /**
+         * Starts interrupt driven handling of requests from the USB interface chip.
+         * Edges on the combined irq line are debounced with a timer event, and the interface chip is read from fiber context
+         * only once the line has been held for MICROBIT_USB_INTERFACE_IRQ_DEBOUNCE milliseconds. Until this is called,
+         * the line is polled from the idle thread.
+         * 
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if there is no message bus.
+         */
+        virtual int init() override;
+
         /**
          * Attempts to determine the power source currently in use on this micro:bit.
          * 
-         * @note This will query the USB interface chip via I2C, and wait for completion.
+         * @note This will query the USB interface chip via I2C and wait for completion, unless read within the telemetry max age.
          * 
          * @return the current power source used by this micro:bit
          */
@@ -217,7 +294,7 @@ class MicroBitPowerManager : public CodalComponent
         /**
          * Requests the current power data from the interface chip, and calculates some approximate, but potentially useful values.
          * 
-         * @note This will query the USB interface chip via I2C, and wait for completion.
+         * @note This will query the USB interface chip via I2C and wait for completion, unless read within the telemetry max age.
          * 
          * @warning Values in micro-volts in the returned structure are measured, whereas <code>estimatedPowerConsumption</code> is an approximation and subject to change.
          * 
@@ -237,11 +314,41 @@ class MicroBitPowerManager : public CodalComponent
         /**
          * Attempts to determine the status of the USB interface on this micro:bit.
          * 
-         * @note This will query the USB interface chip via I2C, and wait for completion.
+         * @note This will query the USB interface chip via I2C and wait for completion, unless read within the telemetry max age.
          * 
          * @return the current status of the USB interface on this micro:bit
          */
         MicroBitUSBStatus getUSBStatus();
+
+        /**
+         * Reads the power data, USB status and power source from the interface chip in one pass, 
+         * regardless of the age of the cached values.
+         * 
+         * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR if any property could not be read.
+         */
+        int refreshTelemetry();
+
+        /**
+         * Sets the maximum age of cached power data, power source and USB status.
+         * Calls to getPowerData(), getPowerSource() and getUSBStatus() within this time of the last read
+         * of the property return the cached value without communicating with the interface chip.
+         * 
+         * @param maxAge the maximum age in milliseconds, or zero to always read from the interface chip.
+         */
+        void setTelemetryMaxAge(uint32_t maxAge);
+
+        /**
+         * Starts or stops periodic background sampling of the power data, power source and USB status.
+         * While sampling, MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED and MICROBIT_POWER_EVT_USB_STATUS_CHANGED are raised
+         * when those values change, and MICROBIT_POWER_EVT_POWER_DATA_CHANGED is raised when the battery or supply voltage
+         * moves by at least the given threshold from the value last reported.
+         * 
+         * @param period the sampling period in milliseconds, or zero to stop sampling.
+         * @param threshold the change in voltage required to raise MICROBIT_POWER_EVT_POWER_DATA_CHANGED, in microvolts.
+         * 
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if a timer event could not be allocated.
+         */
+        int setTelemetrySampling(uint32_t period, uint32_t threshold = CONFIG_MICROBIT_POWER_TELEMETRY_THRESHOLD);
         
         /**
          * Attempts to issue a control packet to the USB interface chip.
@@ -280,6 +387,26 @@ class MicroBitPowerManager : public CodalComponent
          */
         ManagedBuffer readProperty(int property);
 
+        /**
+         * Determines the statistics recorded for transactions with the interface chip.
+         * Statistics are only recorded if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS is enabled.
+         * 
+         * @param property the property of the transactions (e.g. MICROBIT_UIPM_PROPERTY_POWER_SOURCE), or zero for the total of all properties.
+         * 
+         * @return the statistics, or NULL if none are recorded for the given property.
+         */
+        const MicroBitUSBInterfaceStatistics *getStatistics(int property = 0);
+
+        /**
+         * Resets the statistics recorded for transactions with the interface chip.
+         */
+        void resetStatistics();
+
+        /**
+         * Outputs the statistics recorded for transactions with the interface chip over DMESG.
+         */
+        void printStatistics();
+
         /**
          * Perform a NULL opertion I2C transcation wit the interface chip.
          * This is used to awken the KL27 interface chip from light sleep, 
@@ -287,6 +414,18 @@ class MicroBitPowerManager : public CodalComponent
          */
         void nop();
 
+        /**
+         * Waits for the USB interface chip to come online, as it does some time after a hard power-on reset,
+         * by polling until it acknowledges its I2C address.
+         *
+         * @param timeout The longest time to wait, in milliseconds.
+         *
+         * @return MICROBIT_OK once the interface chip responds, or MICROBIT_BUSY if it did not respond within the timeout.
+         *
+         * @note This does not use the scheduler, so may be called before it is running.
+         */
+        int awaitInterface(int timeout);
+
         /**
          * Powers down the CPU and USB interface and enters STANDBY state. All user code and peripherals will cease operation. 
          * Device can subsequently be awoken only via a RESET. User program state will be lost and will restart
@@ -414,6 +553,37 @@ class MicroBitPowerManager : public CodalComponent
          */
         void cancelDeepSleep();
 
+        /**
+         * Sets how long the scheduler tick may be suppressed when the scheduler is idle.
+         * While suppressed, the CPU sleeps until the next wake up timer event or interrupt, so fibers sleeping 
+         * and button presses are noticed up to this much later than usual.
+         *
+         * @param slack the maximum time to suppress the scheduler tick for in milliseconds, or zero to disable tickless idle.
+         */
+        void setTicklessIdle(uint32_t slack);
+
+        /**
+         * For library use.
+         * Sleeps the CPU with the scheduler tick suppressed, until the next wake up timer event, an interrupt or the tickless idle slack expires.
+         * Nothing is powered down, so peripherals continue to operate.
+         *
+         * @return DEVICE_OK if the tick was suppressed, DEVICE_NOT_SUPPORTED if tickless idle is disabled or busy,
+         * or DEVICE_INVALID_STATE if the next wake up is too soon to be worthwhile.
+         */
+        int ticklessIdle();
+
+        /**
+         * Provides the entry and wake latency of deep sleep, measured since start up or the last call to resetDeepSleepTiming().
+         *
+         * @return The deep sleep timing record.
+         */
+        const MicroBitDeepSleepTiming &getDeepSleepTiming();
+
+        /**
+         * Clears the deep sleep timing record.
+         */
+        void resetDeepSleepTiming();
+
         private:
 
         /**
@@ -440,6 +610,52 @@ class MicroBitPowerManager : public CodalComponent
          */
         void setPowerLED(bool doSleep);
         
+        /**
+         * Records the statistics of a completed transaction with the interface chip.
+         * @param property The property the transaction related to.
+         * @param start The time at which the transaction started (microseconds).
+         * @param success true if a valid response was received, false otherwise.
+         */
+        void recordTransaction(int property, CODAL_TIMESTAMP start, bool success);
+
+        /**
+         * Reads a property holding power telemetry from the interface chip, and updates the cached value if successful.
+         * 
+         * @param property One of MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION, MICROBIT_UIPM_PROPERTY_USB_STATE or MICROBIT_UIPM_PROPERTY_POWER_SOURCE.
+         * 
+         * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR if no valid response was received.
+         */
+        int readTelemetry(int property);
+
+        /**
+         * Determines if a cached telemetry value may be used.
+         * 
+         * @param flag The status flag indicating the value is cached.
+         * @param time The time the value was last read (milliseconds).
+         */
+        bool telemetryCached(uint32_t flag, CODAL_TIMESTAMP time);
+
+        /**
+         * Periodic telemetry sample handler.
+         */
+        void onTelemetrySample(Event);
+
+        /**
+         * Enables edge events on the combined irq line, and starts the debounce timer if the line is already held.
+         */
+        void enableInterfaceIRQ();
+
+        /**
+         * Edge handler for the combined irq line. Runs in interrupt context.
+         */
+        void onInterfaceEdge(Event);
+
+        /**
+         * Debounce timer handler for the combined irq line.
+         * Services any request raised by the USB interface chip if the line is still held.
+         */
+        void onInterfaceIRQ(Event);
+
         static volatile uint16_t timer_irq_channels;
         static void deepSleepTimerIRQ(uint16_t chan);
 
@@ -448,6 +664,22 @@ class MicroBitPowerManager : public CodalComponent
         CODAL_TIMESTAMP         powerUpTime;
         uint16_t                eventValue;
 
+        uint32_t                telemetryMaxAge;                    // Maximum age of cached telemetry (milliseconds).
+        uint32_t                telemetryThreshold;                 // Voltage change that raises MICROBIT_POWER_EVT_POWER_DATA_CHANGED (microvolts).
+        CODAL_TIMESTAMP         powerDataTime;                      // Time the cached power data was read.
+        CODAL_TIMESTAMP         powerSourceTime;                    // Time the cached power source was read.
+        CODAL_TIMESTAMP         usbStatusTime;                      // Time the cached USB status was read.
+        MicroBitPowerData       reportedPowerData;                  // Power data last reported by the background sampler.
+        MicroBitPowerSource     reportedPowerSource;                // Power source last reported by the background sampler.
+        MicroBitUSBStatus       reportedUSBStatus;                  // USB status last reported by the background sampler.
+        uint32_t                ticklessSlack;                      // Maximum time the scheduler tick may be suppressed when idle (milliseconds).
+        MicroBitDeepSleepTiming deepSleepTiming;                    // Entry and wake latency of deep sleep.
+
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+        MicroBitUSBInterfaceStatistics  transaction;                                            // The transaction in progress.
+        MicroBitUSBInterfaceStatistics  statistics[MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT + 1]; // Indexed by property. Index zero holds the total.
+#endif
+
         /**
          * Check if there are suitable wake-up sources for deep sleep
          *
@@ -478,5 +710,18 @@ class MicroBitPowerManager : public CodalComponent
          * @return DEVICE_OK if deep sleep occurred, or DEVICE_INVALID_STATE if no usable wake up source is available
          */
         int simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wakeUpTime, bool wakeUpSources, NRF52Pin *wakeUpPin);
+
+        /**
+         * Suspends timer events and sleeps the CPU until the given time, or until an interrupt other than the system timer occurs.
+         * The system timer keeps counting throughout, and timer events that fall due in the meantime are processed on return.
+         *
+         * @param wakeOnTime    Set to true to wake up at time wakeUpTime
+         * @param wakeUpTime    Time to trigger wake up. Ignored if wakeOnTime == false;
+         * @param timeEntry     Time the sleep was requested, used to compensate for the time taken to enter and leave it.
+         * @param deep          Set to true to enable wake up from the KL27 interrupt line and the wake up pin, as needed by deep sleep.
+         * @param wakeUpSources Set to true to use wake up sources externally configured by, for example, pin->wakeOnActive(true)
+         * @param wakeUpPin     Pin to trigger wake up. Ignored if wakeUpSources == true.
+         */
+        void timedSleep( bool wakeOnTime, CODAL_TIMESTAMP wakeUpTime, CODAL_TIMESTAMP timeEntry, bool deep, bool wakeUpSources, NRF52Pin *wakeUpPin);
 };
 #endif
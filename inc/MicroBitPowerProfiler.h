@@ -0,0 +1,159 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_POWER_PROFILER_H
+#define MICROBIT_POWER_PROFILER_H
+
+#include "MicroBitConfig.h"
+
+//
+// Peripherals tracked by the power profiler.
+//
+#define MICROBIT_POWER_PROFILE_DISPLAY              0
+#define MICROBIT_POWER_PROFILE_RADIO                1
+#define MICROBIT_POWER_PROFILE_SPEAKER              2
+#define MICROBIT_POWER_PROFILE_MICROPHONE           3
+#define MICROBIT_POWER_PROFILE_BLE_ADVERTISING      4
+#define MICROBIT_POWER_PROFILE_BLE_CONNECTED        5
+#define MICROBIT_POWER_PROFILE_COUNT                6
+
+//
+// Pass to the estimation functions to include all peripherals and the baseline current.
+//
+#define MICROBIT_POWER_PROFILE_TOTAL                MICROBIT_POWER_PROFILE_COUNT
+
+//
+// Default current models of the peripherals while active (microamps).
+// These are rough averages for a typical configuration, and can be refined with MicroBitPowerProfiler::setCurrent().
+//
+#ifndef MICROBIT_POWER_PROFILE_BASELINE_CURRENT
+#define MICROBIT_POWER_PROFILE_BASELINE_CURRENT          3000        // CPU, sensors and interface chip
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_DISPLAY_CURRENT
+#define MICROBIT_POWER_PROFILE_DISPLAY_CURRENT           8000        // LED matrix and refresh timer, at full brightness
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_RADIO_CURRENT
+#define MICROBIT_POWER_PROFILE_RADIO_CURRENT             6500        // Continuous receive, including HFXO
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_SPEAKER_CURRENT
+#define MICROBIT_POWER_PROFILE_SPEAKER_CURRENT           3000        // PWM output and speaker
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_MICROPHONE_CURRENT
+#define MICROBIT_POWER_PROFILE_MICROPHONE_CURRENT        900         // Microphone and ADC sampling
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_BLE_ADVERTISING_CURRENT
+#define MICROBIT_POWER_PROFILE_BLE_ADVERTISING_CURRENT   300         // Average over the advertising interval
+#endif
+
+#ifndef MICROBIT_POWER_PROFILE_BLE_CONNECTED_CURRENT
+#define MICROBIT_POWER_PROFILE_BLE_CONNECTED_CURRENT     400         // Average over the connection interval
+#endif
+
+class MicroBitPowerManager;
+
+/**
+ * Tracks the time each power hungry peripheral spends active, and estimates the current it draws
+ * from a simple per-peripheral current model. Drivers report their transitions through setActive().
+ *
+ * All tracking compiles away unless CONFIG_MICROBIT_POWER_PROFILER is enabled.
+ */
+class MicroBitPowerProfiler
+{
+    public:
+
+#if CONFIG_MICROBIT_POWER_PROFILER
+    /**
+     * Records a change in the power state of a peripheral. May be called from interrupt context.
+     *
+     * @param peripheral the peripheral, e.g. MICROBIT_POWER_PROFILE_RADIO.
+     * @param active true if the peripheral is now powered, false otherwise.
+     */
+    static void setActive(int peripheral, bool active);
+#else
+    static inline void setActive(int, bool) {}
+#endif
+
+    /**
+     * Sets the current model of a peripheral.
+     *
+     * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL to set the baseline current of the board.
+     * @param microAmps the average current drawn while the peripheral is active.
+     *
+     * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER or MICROBIT_NOT_SUPPORTED if the profiler is disabled.
+     */
+    static int setCurrent(int peripheral, uint32_t microAmps);
+
+    /**
+     * Restarts profiling from now. Peripherals that are active remain so.
+     */
+    static void reset();
+
+    /**
+     * Determines the time a peripheral has been active since profiling started.
+     *
+     * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL for the time since profiling started.
+     *
+     * @return the time in milliseconds.
+     */
+    static uint32_t getActiveTime(int peripheral);
+
+    /**
+     * Determines the proportion of time a peripheral has been active since profiling started.
+     *
+     * @param peripheral the peripheral.
+     *
+     * @return the duty cycle in parts per thousand.
+     */
+    static int getDutyCycle(int peripheral);
+
+    /**
+     * Determines the number of times a peripheral has been activated since profiling started.
+     *
+     * @param peripheral the peripheral.
+     */
+    static uint32_t getActivations(int peripheral);
+
+    /**
+     * Estimates the average current drawn since profiling started, from the duty cycle and current model.
+     *
+     * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL for the whole board, including the baseline current.
+     *
+     * @return the estimated average current in microamps.
+     */
+    static uint32_t getAverageCurrent(int peripheral = MICROBIT_POWER_PROFILE_TOTAL);
+
+    /**
+     * Outputs the profile over DMESG: the active time, duty cycle, activations and estimated current of each peripheral.
+     *
+     * @param power if provided, the interface chip power measurements are read and reported alongside the estimate.
+     */
+    static void printReport(MicroBitPowerManager *power = NULL);
+};
+
+#endif
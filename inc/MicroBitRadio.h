@@ -37,6 +37,10 @@ namespace codal
 #include "PacketBuffer.h"
 #include "MicroBitRadioDatagram.h"
 #include "MicroBitRadioEvent.h"
+#include "MicroBitRadioBulk.h"
+#include "MicroBitRadioLink.h"
+#include "MicroBitRadioTDMA.h"
+#include "MicroBitMemoryConsumer.h"
 
 /**
  * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
@@ -52,9 +56,9 @@ namespace codal
  * TODO: Meshing should also be considered - again a GLOSSY approach may be effective here, and highly complementary to
  * the master/slave arachitecture of BLE.
  *
- * TODO: This implementation only operates whilst the BLE stack is disabled. The nrf51822 provides a timeslot API to allow
- * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
- * creation of wireless BLE bridges.
+ * If the BLE stack is running when the radio is enabled, the RADIO is shared with it through the SoftDevice timeslot API
+ * (c.f. CONFIG_MICROBIT_RADIO_TIMESLOT). Packets are then sent and received only within the timeslots granted to us,
+ * which may allow for the creation of wireless BLE bridges.
  *
  * NOTE: This API does not contain any form of encryption, authentication or authorization. It's purpose is solely for use as a
  * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
@@ -65,23 +69,125 @@ namespace codal
 #define MICROBIT_RADIO_STATUS_INITIALISED       0x0001
 #define MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ     0x0002
 #define MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT    0x0004
+#define MICROBIT_RADIO_STATUS_DEEPSLEEP_STATE   0x0008
+#define MICROBIT_RADIO_STATUS_CCA_LISTENER      0x0010
+#define MICROBIT_RADIO_STATUS_LOW_LATENCY       0x0020
+#define MICROBIT_RADIO_STATUS_TIMESLOT          0x0040
+
+// The software interrupt used to dispatch datagrams and events as soon as they are received, c.f. setLowLatency().
+// The SoftDevice reserves SWI1, SWI2, SWI4 and SWI5, so SWI3 remains free whether or not BLE is in use.
+#define MICROBIT_RADIO_DISPATCH_IRQn            SWI3_EGU3_IRQn
+
+// Priority of the dispatch interrupt. Lower than the RADIO interrupt, so reception continues while handlers run.
+#ifndef CONFIG_MICROBIT_RADIO_DISPATCH_PRIORITY
+#define CONFIG_MICROBIT_RADIO_DISPATCH_PRIORITY 7
+#endif
+
+// Share the RADIO with the BLE stack using SoftDevice timeslots, rather than refusing to run while BLE is enabled.
+#ifndef CONFIG_MICROBIT_RADIO_TIMESLOT
+#define CONFIG_MICROBIT_RADIO_TIMESLOT          1
+#endif
+
+// Length of each timeslot requested, in microseconds. Slots are extended by this much at a time for as long as the
+// SoftDevice allows, so the RADIO is only handed back (and reception paused) when the BLE stack needs it.
+#ifndef CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US
+#define CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US    10000
+#endif
+
+// Time reserved at the end of each timeslot (or extension), in microseconds, to extend it or hand the RADIO back to the SoftDevice.
+#ifndef CONFIG_MICROBIT_RADIO_TIMESLOT_MARGIN_US
+#define CONFIG_MICROBIT_RADIO_TIMESLOT_MARGIN_US    1000
+#endif
+
+// Longest the SoftDevice may take to grant each timeslot, in microseconds, before the request is cancelled and made again.
+#ifndef CONFIG_MICROBIT_RADIO_TIMESLOT_TIMEOUT_US
+#define CONFIG_MICROBIT_RADIO_TIMESLOT_TIMEOUT_US   100000
+#endif
 
 // Default configuration values
 #define MICROBIT_RADIO_BASE_ADDRESS             0x75626974
 #define MICROBIT_RADIO_DEFAULT_GROUP            0
 #define MICROBIT_RADIO_DEFAULT_TX_POWER         7
 #define MICROBIT_RADIO_DEFAULT_FREQUENCY        7
-#define MICROBIT_RADIO_MAX_PACKET_SIZE          32
+#define MICROBIT_RADIO_LEGACY_PACKET_SIZE       32
 #define MICROBIT_RADIO_HEADER_SIZE              4
-#define MICROBIT_RADIO_MAXIMUM_RX_BUFFERS       4
+#define MICROBIT_RADIO_MAXIMUM_RX_BUFFERS       4       // Default depth of the receive queue, c.f. setReceiveQueueSize().
 #define MICROBIT_RADIO_POWER_LEVELS             10
 
+// Physical layers, selected with setPHY()
+#define MICROBIT_RADIO_PHY_1MBIT                0       // Nordic proprietary 1Mbps. The default, understood by all micro:bits.
+#define MICROBIT_RADIO_PHY_2MBIT                1       // Nordic proprietary 2Mbps.
+#define MICROBIT_RADIO_PHY_LR500                2       // BLE coded PHY at 500kbps (S=2).
+#define MICROBIT_RADIO_PHY_LR125                3       // BLE coded PHY at 125kbps (S=8), for the longest range.
+#define MICROBIT_RADIO_PHY_COUNT                4
+
+// Largest frame that may be sent or received, and so the size of every FrameBuffer. Frames longer than
+// MICROBIT_RADIO_LEGACY_PACKET_SIZE are only understood by peers built with a matching configuration.
+#ifndef CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE
+#define CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE   MICROBIT_RADIO_LEGACY_PACKET_SIZE
+#endif
+
+#if CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE < MICROBIT_RADIO_LEGACY_PACKET_SIZE || CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE > 251
+#error "CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE must be in the range 32..251"
+#endif
+
+#define MICROBIT_RADIO_MAX_PACKET_SIZE          CONFIG_MICROBIT_RADIO_MAX_PACKET_SIZE
+
+// Number of receive buffers preallocated when the radio is first enabled. This covers the buffer in use by the
+// RADIO hardware, the receive queue, and packets held by MicroBitRadioDatagram or the application.
+// Packets arriving when all are in use are dropped. At most 32. setReceiveQueueSize() adds or removes two buffers
+// for each entry by which it changes the depth of the queue from MICROBIT_RADIO_MAXIMUM_RX_BUFFERS.
+#ifndef CONFIG_MICROBIT_RADIO_RX_POOL_SIZE
+#define CONFIG_MICROBIT_RADIO_RX_POOL_SIZE      (2 * MICROBIT_RADIO_MAXIMUM_RX_BUFFERS + 2)
+#endif
+
+// Largest receive queue depth that may be selected with setReceiveQueueSize(). At most 100.
+#ifndef CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE
+#define CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE 64
+#endif
+
+// Number of packets that may be queued for transmission by sendAsync().
+#ifndef CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE
+#define CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE     4
+#endif
+
+// If set, disable() returns the receive buffers and transmit queue to the heap, once nothing remains in them.
+// They are allocated again when the radio is next enabled or used.
+#ifndef CONFIG_MICROBIT_RADIO_RELEASE_ON_DISABLE
+#define CONFIG_MICROBIT_RADIO_RELEASE_ON_DISABLE 1
+#endif
+
+// Maximum time (in microseconds) to defer transmission when clear channel assessment finds the channel busy.
+// The actual delay is randomised between this and twice this value.
+#ifndef CONFIG_MICROBIT_RADIO_CCA_BACKOFF_US
+#define CONFIG_MICROBIT_RADIO_CCA_BACKOFF_US    500
+#endif
+
+// Number of RSSI histogram buckets in MicroBitRadioStatistics, each 10dBm wide. The first counts packets stronger
+// than -40dBm, and the last those at -100dBm or weaker.
+#define MICROBIT_RADIO_RSSI_BUCKETS             8
+
+// Number of groups that may be received at once, one per RADIO logical address. Fixed by the hardware.
+#define MICROBIT_RADIO_MAX_GROUPS               8
+
 // Known Protocol Numbers
 #define MICROBIT_RADIO_PROTOCOL_DATAGRAM        1       // A simple, single frame datagram. a little like UDP but with smaller packets. :-)
 #define MICROBIT_RADIO_PROTOCOL_EVENTBUS        2       // Transparent propogation of events from one micro:bit to another.
+#define MICROBIT_RADIO_PROTOCOL_BULK            3       // Fragments of messages of up to a few KB, reassembled by MicroBitRadioBulk.
+#define MICROBIT_RADIO_PROTOCOL_LINK            4       // Acknowledged unicast messages and their acknowledgements, handled by MicroBitRadioLink.
+#define MICROBIT_RADIO_PROTOCOL_TDMA            5       // Beacons and slot requests, handled by MicroBitRadioTDMA.
+#define MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED 6      // Several events in one frame, sent by MicroBitRadioEvent when forwarding a burst.
+
+// Frame versions
+#define MICROBIT_RADIO_FRAME_VERSION            1       // A frame no longer than MICROBIT_RADIO_LEGACY_PACKET_SIZE, understood by all micro:bits.
+#define MICROBIT_RADIO_FRAME_VERSION_LARGE      2       // A longer frame, dropped by peers using the legacy frame size.
 
 // Events
 #define MICROBIT_RADIO_EVT_DATAGRAM             1       // Event to signal that a new datagram has been received.
+#define MICROBIT_RADIO_EVT_TX_COMPLETE          2       // Event to signal that a packet queued by sendAsync() has been transmitted.
+#define MICROBIT_RADIO_EVT_BULK                 3       // Event to signal that a new bulk message has been reassembled.
+#define MICROBIT_RADIO_EVT_TX_BACKOFF           4       // Internal event, to retry transmission after clear channel assessment found the channel busy.
+#define MICROBIT_RADIO_EVT_EVENT_FLUSH          5       // Internal event, to transmit the events MicroBitRadioEvent is holding back.
 
 namespace codal
 {
@@ -89,26 +195,95 @@ namespace codal
     {
         uint8_t         length;                             // The length of the remaining bytes in the packet. includes protocol/version/group fields, excluding the length field itself.
         uint8_t         version;                            // Protocol version code.
-        uint8_t         group;                              // ID of the group to which this packet belongs.
+        uint8_t         group;                              // ID of the group to which this packet belongs. Set on receipt from the address it matched.
         uint8_t         protocol;                           // Inner protocol number c.f. those issued by IANA for IP protocols
 
         uint8_t         payload[MICROBIT_RADIO_MAX_PACKET_SIZE];    // User / higher layer protocol data
         FrameBuffer     *next;                              // Linkage, to allow this and other protocols to queue packets pending processing.
         int             rssi;                               // Received signal strength of this frame.
+        uint8_t         phy;                                // The MICROBIT_RADIO_PHY_* on which this frame was received.
+        uint32_t        timestamp;                          // The time (in microseconds, modulo 2^32) at which this frame finished arriving.
+
+        /**
+         * Returns buffers from the receive pool to the pool, and frees any others.
+         * This allows packets returned by MicroBitRadio::recv() to be deleted as usual.
+         */
+        static void operator delete(void *p);
     };
 
 
-    class MicroBitRadio : CodalComponent
+    /**
+     * A snapshot of the RADIO configuration, used to reinstate it directly after deep sleep.
+     */
+    struct MicroBitRadioState
+    {
+        uint32_t        frequency;
+        uint32_t        txpower;
+        uint32_t        mode;
+        uint32_t        base0;
+        uint32_t        base1;
+        uint32_t        prefix0;
+        uint32_t        prefix1;
+        uint32_t        pcnf0;
+        uint32_t        pcnf1;
+        uint32_t        crccnf;
+        uint32_t        crcinit;
+        uint32_t        crcpoly;
+        uint32_t        datawhiteiv;
+        uint32_t        shorts;
+    };
+
+    /**
+     * Counters describing the behaviour of the radio, used to tune buffering, channel and power by measurement.
+     */
+    struct MicroBitRadioStatistics
+    {
+        uint32_t        rxPackets;                          // Number of packets received and queued for processing.
+        uint32_t        crcErrors;                          // Number of packets dropped because their CRC was invalid.
+        uint32_t        queueFull;                          // Number of packets dropped because the receive queue was full.
+        uint32_t        noBuffer;                           // Number of packets dropped because no receive buffer was free in the pool.
+        uint32_t        txPackets;                          // Number of packets transmitted.
+        uint32_t        txTime;                             // Total time (in microseconds) the transmitter has been on, including ramp up.
+        uint32_t        rssi[MICROBIT_RADIO_RSSI_BUCKETS];  // Number of packets received in each 10dBm band of signal strength, strongest first.
+    };
+
+    class MicroBitRadio : CodalComponent, public MicroBitMemoryConsumer
     {
         uint8_t                 group;      // The radio group to which this micro:bit belongs.
-        uint8_t                 queueDepth; // The number of packets in the receiver queue.
+        uint8_t                 groups[MICROBIT_RADIO_MAX_GROUPS];  // The group received on each logical address. Entry 0 mirrors group.
+        uint8_t                 groupMask;  // The logical addresses in use, one bit each, as written to RXADDRESSES. Bit 0 is always set.
         int                     rssi;
-        FrameBuffer             *rxQueue;   // A linear list of incoming packets, queued awaiting processing.
+        uint8_t                 txPower;    // The output power level last set by setTransmitPower().
+        uint8_t                 frequency;  // The frequency band last set by setFrequencyBand().
+        uint8_t                 frameSize;  // The maximum frame size last set by setFrameSize().
+        uint8_t                 phy;        // The physical layer last set by setPHY().
+        volatile uint8_t        rxHead;     // Index in rxQueue of the next packet to be processed. Written only by recv().
+        volatile uint8_t        rxTail;     // Index in rxQueue of the next packet to be received. Written only by the RADIO IRQ.
+        uint8_t                 rxQueueSize;    // The depth of the receive queue last set by setReceiveQueueSize().
+        FrameBuffer             **rxQueue;  // A ring of rxQueueSize + 1 incoming packets, queued awaiting processing. Allocated by enable().
         FrameBuffer             *rxBuf;     // A pointer to the buffer being actively used by the RADIO hardware.
+        FrameBuffer             *txQueue;   // A ring of copies of packets awaiting transmission, allocated on first use of sendAsync().
+        volatile uint8_t        txHead;     // Index in txQueue of the packet being transmitted. Written only by the RADIO IRQ.
+        volatile uint8_t        txTail;     // Index in txQueue of the next free entry. Written only by sendAsync().
+        volatile bool           txActive;   // true while the RADIO is being driven through txQueue by the RADIO IRQ.
+        volatile bool           txSending;  // true while the packet at txHead is being transmitted.
+        volatile bool           txGate;     // false while packets queued by sendAsync() are held back, e.g. outside our TDMA slot.
+        volatile bool           txBackoff;  // true while waiting to retry after clear channel assessment found the channel busy.
+        int8_t                  ccaThreshold;   // Signal strength (in dBm) above which the channel is busy, or 0 if clear channel assessment is disabled.
+        uint32_t                txStarted;  // The time (in microseconds) at which the transmitter started ramping up for the packet at txHead.
+        MicroBitRadioStatistics stats;      // Usage counters, since construction or the last resetStatistics().
+        volatile uint8_t        txCompleted;    // Packets transmitted within timeslots. Written only by the timeslot callback.
+        volatile uint8_t        txReported;     // Packets for which MICROBIT_RADIO_EVT_TX_COMPLETE has been raised by deferredCallback().
+
+        friend class MicroBitRadioTDMA;
+        MicroBitRadioState      sleepState; // The RADIO configuration at the start of deep sleep.
 
         public:
         MicroBitRadioDatagram   datagram;   // A simple datagram service.
         MicroBitRadioEvent      event;      // A simple event handling service.
+        MicroBitRadioBulk       bulk;       // A fragmenting transport for larger messages.
+        MicroBitRadioLink       link;       // An acknowledged, unicast transport.
+        MicroBitRadioTDMA       tdma;       // A beacon synchronised, slotted access scheduler.
         static MicroBitRadio    *instance;  // A singleton reference, used purely by the interrupt service routine.
 
         /**
@@ -130,13 +305,20 @@ namespace codal
          */
         int setTransmitPower(int power);
 
+        /**
+         * Determines the output power level of the transmitter.
+         *
+         * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+         */
+        int getTransmitPower();
+
         /**
          * Change the transmission and reception band of the radio to the given channel
          *
          * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the value is out of range,
-         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
          */
         int setFrequencyBand(int band);
 
@@ -150,9 +332,10 @@ namespace codal
 
         /**
          * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+         * The replacement receive buffer is taken from a pool allocated by enable(), so no memory is allocated here.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if a replacement receiver buffer
-         *         could not be allocated (either by policy or memory exhaustion).
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the queue is full or no replacement
+         *         receive buffer is free in the pool.
          */
         int queueRxBuf();
 
@@ -167,6 +350,40 @@ namespace codal
          */
         int setRSSI(int rssi);
 
+        /**
+         * Records a packet dropped because its CRC was invalid.
+         *
+         * @note should only be called from RADIO_IRQHandler...
+         */
+        void crcError();
+
+        /**
+         * Retrieve the usage counters of the radio, since it was created or resetStatistics() was last called.
+         *
+         * @return a copy of the counters.
+         */
+        MicroBitRadioStatistics getStatistics();
+
+        /**
+         * Reset all usage counters to zero.
+         */
+        void resetStatistics();
+
+        /**
+         * Determines the heap memory committed by the radio: its receive buffers and queue, and its transmit queue.
+         *
+         * @return The number of bytes currently allocated.
+         */
+        virtual uint32_t getMemoryUsage();
+
+        /**
+         * Frees the receive buffers and queue, and the transmit queue, while the radio is disabled (other than for deep sleep) and none of them hold a packet.
+         * They are allocated again when the radio is next enabled or used.
+         *
+         * @return The number of bytes returned to the heap.
+         */
+        virtual uint32_t releaseMemory();
+
         /**
          * Retrieves the current RSSI for the most recent packet.
          * The return value is measured in -dbm. The higher the value, the stronger the signal.
@@ -179,32 +396,181 @@ namespace codal
         /**
          * Initialises the radio for use as a multipoint sender/receiver
          *
-         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
          */
         int enable();
 
         /**
          * Disables the radio for use as a multipoint sender/receiver.
          *
-         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
          */
         int disable();
 
         /**
          * Sets the radio to listen to packets sent with the given group id.
          *
-         * @param group The group to join. A micro:bit can only listen to one group ID at any time.
+         * @param group The group to join. A micro:bit sends to one group at a time, but may receive others added with addGroup().
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
          */
         int setGroup(uint8_t group);
 
         /**
-         * A background, low priority callback that is triggered whenever the processor is idle.
+         * Additionally receives packets sent to the given group, using the RADIO's hardware address matching.
+         * Packets are still sent to the group last set by setGroup(). Each received packet records the group
+         * it was sent to in FrameBuffer::group.
+         *
+         * @param group The group to receive.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_NO_RESOURCES if MICROBIT_RADIO_MAX_GROUPS groups are already
+         *         being received, or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+         */
+        int addGroup(uint8_t group);
+
+        /**
+         * Stops receiving packets sent to a group added with addGroup().
+         *
+         * @param group The group to stop receiving.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the group was not added with addGroup(),
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+         */
+        int removeGroup(uint8_t group);
+
+        /**
+         * Sets the number of received packets that may be queued awaiting processing. Packets arriving while the
+         * queue is full are dropped, so a deeper queue allows bursts to be absorbed between idle passes of the scheduler.
+         *
+         * Each entry costs two receive buffers of sizeof(FrameBuffer) bytes (one queued, and one held by a protocol
+         * such as MicroBitRadioDatagram awaiting recv()), plus a pointer. getReceiveMemory() reports the total.
+         *
+         * @param size The depth of the queue, in the range 1..CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the size is out of range,
+         *         MICROBIT_INVALID_STATE if the radio is enabled, MICROBIT_BUSY if received packets have not yet been deleted,
+         *         or MICROBIT_NO_RESOURCES if the memory could not be allocated.
+         */
+        int setReceiveQueueSize(int size);
+
+        /**
+         * Determines the number of received packets that may be queued awaiting processing.
+         *
+         * @return The depth last set by setReceiveQueueSize(), or MICROBIT_RADIO_MAXIMUM_RX_BUFFERS by default.
+         */
+        int getReceiveQueueSize();
+
+        /**
+         * Determines the memory allocated for receive buffers and the receive queue.
+         *
+         * @return The number of bytes allocated, or zero if the radio has not yet been enabled.
+         */
+        int getReceiveMemory();
+
+        /**
+         * Selects the physical layer (modulation and data rate) used to send and receive packets.
+         *
+         * MICROBIT_RADIO_PHY_1MBIT is understood by all micro:bits. MICROBIT_RADIO_PHY_2MBIT halves the time on air for each
+         * packet, while the BLE coded PHYs (MICROBIT_RADIO_PHY_LR500 and MICROBIT_RADIO_PHY_LR125) trade throughput for range.
+         * Only peers using the same PHY will receive our packets.
+         *
+         * @param phy The physical layer to use, one of the MICROBIT_RADIO_PHY_* values.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the value is out of range,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT, or MICROBIT_BUSY if called from an
+         *         interrupt while packets queued by sendAsync() are being transmitted.
+         */
+        int setPHY(int phy);
+
+        /**
+         * Determines the physical layer used to send and receive packets.
+         *
+         * @return The MICROBIT_RADIO_PHY_* value last set by setPHY(), or MICROBIT_RADIO_PHY_1MBIT by default.
+         */
+        int getPHY();
+
+        /**
+         * Sets the maximum size of the frames sent and received by the radio.
+         *
+         * Frames no larger than MICROBIT_RADIO_LEGACY_PACKET_SIZE can be exchanged with all micro:bits.
+         * Larger frames carry far more data per transmission, but are only received by peers using the same frame size,
+         * and are marked as MICROBIT_RADIO_FRAME_VERSION_LARGE.
+         *
+         * @param size The maximum frame size, in the range MICROBIT_RADIO_LEGACY_PACKET_SIZE..MICROBIT_RADIO_MAX_PACKET_SIZE.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the size is out of range,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+         */
+        int setFrameSize(int size);
+
+        /**
+         * Determines the maximum size of the frames sent and received by the radio.
+         *
+         * @return The frame size last set by setFrameSize(), or MICROBIT_RADIO_MAX_PACKET_SIZE by default.
+         */
+        int getFrameSize();
+
+        /**
+         * A background, low priority callback that is triggered when the processor is idle and a packet has been queued.
          * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
          */
         virtual void idleCallback();
 
+        /**
+         * Passes queued packets to their protocol handlers.
+         *
+         * @param interrupt true if called from the dispatch interrupt, in which case only datagrams and events are handled,
+         *        stopping at the first packet of another protocol, which is left for idleCallback().
+         *
+         * @note should only be called from idleCallback() or the dispatch interrupt...
+         */
+        void dispatch(bool interrupt);
+
+        /**
+         * Enables or disables low latency dispatch. When enabled, datagrams and events are passed to their protocol handlers
+         * from a low priority interrupt as soon as they are received, rather than waiting for the scheduler to go idle.
+         * MICROBIT_RADIO_EVT_DATAGRAM and forwarded events are then raised within microseconds, however busy the fibers are.
+         * Other protocols, and any packets queued behind them, are still handled by idleCallback().
+         *
+         * @param enable true to dispatch from the interrupt, false to dispatch only when the processor is idle.
+         *
+         * @return MICROBIT_OK on success.
+         *
+         * @note Listeners registered with MESSAGE_BUS_LISTENER_IMMEDIATE run in interrupt context while this is enabled.
+         */
+        int setLowLatency(bool enable);
+
+        /**
+         * Bottom half of the RADIO and timeslot interrupts. Raises MICROBIT_RADIO_EVT_TX_COMPLETE for packets sent
+         * within timeslots, and dispatches received packets if low latency dispatch is enabled.
+         *
+         * @note should only be called from the dispatch interrupt...
+         */
+        void deferredCallback();
+
+        /**
+         * Handles a signal from the SoftDevice while we hold (or have asked for) a timeslot.
+         *
+         * Each timeslot starts by configuring the RADIO and sending whatever is in the transmit queue,
+         * then listens for the remainder of the slot. Shortly before the slot ends, we ask to extend it by another
+         * CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US, so reception continues unbroken while the BLE stack can spare the RADIO.
+         * Once it can't, the RADIO is handed back and the next slot requested.
+         *
+         * @param signal The NRF_RADIO_CALLBACK_SIGNAL_TYPE_* received.
+         *
+         * @return The NRF_RADIO_SIGNAL_CALLBACK_ACTION_* to take.
+         *
+         * @note should only be called from the timeslot signal callback...
+         */
+        int timeslotSignal(uint8_t signal);
+
+        /**
+         * Handles a SoC event from the SoftDevice, requesting another timeslot if our session has gone idle.
+         *
+         * @param evt The NRF_EVT_* received.
+         */
+        void timeslotEvent(uint32_t evt);
+
         /**
          * Determines the number of packets ready to be processed.
          *
@@ -228,16 +594,158 @@ namespace codal
          * Transmits the given buffer onto the broadcast radio.
          * The call will wait until the transmission of the packet has completed before returning.
          *
+         * While transmissions are gated or subject to clear channel assessment, the packet is sent through the
+         * transmit queue, and the call waits for the queue to drain.
+         *
          * @param data The packet contents to transmit.
          *
-         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
          */
         int send(FrameBuffer *buffer);
 
+        /**
+         * Queues the given buffer for transmission onto the broadcast radio, and returns immediately.
+         * The buffer is copied, so may be reused as soon as the call returns.
+         *
+         * Queued packets are sent back to back, with the RADIO interrupt and hardware shortcuts moving between
+         * transmit and receive, and the receiver is restarted as soon as the queue is empty.
+         * A MICROBIT_RADIO_EVT_TX_COMPLETE event is raised as each packet is transmitted.
+         *
+         * @param buffer The packet contents to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_BUSY if CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE packets are already queued,
+         *         MICROBIT_INVALID_PARAMETER if the buffer is invalid, MICROBIT_NO_RESOURCES if the queue could not be allocated,
+         *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT or the radio is not enabled.
+         */
+        int sendAsync(FrameBuffer *buffer);
+
+        /**
+         * Holds back, or releases, packets queued by sendAsync(). While closed, packets wait in the transmit queue,
+         * and a burst already on air finishes with the packet being transmitted. Used by MicroBitRadioTDMA to confine
+         * transmissions to our slot.
+         *
+         * @param open false to hold packets back, true to release them.
+         */
+        void setTransmitGate(bool open);
+
+        /**
+         * Enables clear channel assessment. Before each burst of queued packets, the signal strength on the channel is
+         * measured, and transmission is deferred for a short, random period while it is above the given threshold.
+         *
+         * @param threshold The signal strength (in dBm) above which the channel is considered busy, in the range -100..-30,
+         *        or 0 to disable clear channel assessment.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the threshold is out of range.
+         *
+         * @note The RADIO's own CCA is only available in IEEE 802.15.4 mode, so this measures RSSI while receiving instead.
+         */
+        int setClearChannelAssessment(int threshold);
+
+        /**
+         * Measures the signal strength currently on the channel.
+         *
+         * @return The signal strength in dBm, or MICROBIT_INVALID_STATE if the radio is not receiving.
+         */
+        int getChannelRSSI();
+
+        /**
+         * Determines the number of packets queued by sendAsync() that are yet to be transmitted.
+         *
+         * @return The number of packets awaiting transmission, including any being transmitted.
+         */
+        int txPending();
+
+        /**
+         * Determines if the RADIO is being driven through the transmit queue, rather than receiving.
+         *
+         * @return true if packets queued by sendAsync() are being transmitted.
+         */
+        bool isTransmitting();
+
+        /**
+         * Moves the RADIO on to the next packet in the transmit queue, or back to receiving when the queue is empty.
+         *
+         * @note should only be called from RADIO_IRQHandler, on the DISABLED event...
+         */
+        void txDisabled();
+
         /**
           * Puts the component in (or out of) sleep (low power) mode.
           */
         virtual int setSleep(bool doSleep) override;
+
+        private:
+
+        /**
+          * Transmits the given buffer immediately, bypassing the transmit queue, gate and clear channel assessment.
+          * The call will wait until the transmission of the packet has completed before returning.
+          */
+        int transmit(FrameBuffer *buffer);
+
+        /**
+          * Starts transmitting the packets in the transmit queue, if the gate is open and the channel is clear.
+          * Called with interrupts disabled.
+          */
+        void tryStartTx();
+
+        /**
+          * Retries transmission once the clear channel assessment backoff period has passed.
+          */
+        void onBackoff(Event);
+
+        /**
+          * Records the configuration of the RADIO module, once it has been disabled for deep sleep.
+          */
+        void saveState();
+
+        /**
+          * Reinstates the configuration recorded by saveState() and resumes reception, 
+          * without recalculating it as enable() would.
+          */
+        void restoreState();
+
+        /**
+          * Writes the groups we receive into the PREFIX and RXADDRESSES registers.
+          */
+        void writeAddresses();
+
+        /**
+          * Writes our configuration into the RADIO module. Used by enable(), and at the start of each timeslot
+          * while sharing the RADIO with the BLE stack.
+          */
+        void configure();
+
+        /**
+          * Opens a SoftDevice timeslot session and requests the first timeslot.
+          *
+          * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the session could not be opened.
+          */
+        int timeslotOpen();
+
+        /**
+          * Closes our SoftDevice timeslot session, handing the RADIO back to the BLE stack.
+          */
+        void timeslotClose();
+
+        /**
+          * Transmits packets from the transmit queue for as long as the current timeslot allows.
+          *
+          * @note should only be called from the timeslot signal callback...
+          */
+        void timeslotTransmit();
+
+        /**
+          * Starts listening for the next packet for the rest of the current timeslot.
+          *
+          * @note should only be called from the timeslot signal callback...
+          */
+        void timeslotListen();
+
+        /**
+          * Switches the RADIO from receiving to transmitting the packet at the head of the transmit queue.
+          * Called with the RADIO interrupt disabled, or from the RADIO IRQ.
+          */
+        void startTx();
     };
 }
 
@@ -0,0 +1,164 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_BULK_H
+#define MICROBIT_RADIO_BULK_H
+
+#include "CodalConfig.h"
+#include "MicroBitRadio.h"
+#include "ManagedBuffer.h"
+
+// Largest message that may be sent or received. Messages are split into at most 256 fragments.
+#ifndef CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE
+#define CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE     4096
+#endif
+
+// Time (in milliseconds) after the last fragment of a message arrives before a partly reassembled message is abandoned.
+#ifndef CONFIG_MICROBIT_RADIO_BULK_TIMEOUT
+#define CONFIG_MICROBIT_RADIO_BULK_TIMEOUT      500
+#endif
+
+// Number of reassembled messages held awaiting recv(). Further messages are dropped.
+#ifndef CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE
+#define CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE    2
+#endif
+
+// Time (in milliseconds) to pause after each burst of MICROBIT_RADIO_MAXIMUM_RX_BUFFERS fragments, allowing
+// receivers to empty their receive queue. Zero sends every fragment back to back.
+#ifndef CONFIG_MICROBIT_RADIO_BULK_BURST_GAP
+#define CONFIG_MICROBIT_RADIO_BULK_BURST_GAP    1
+#endif
+
+// Fragment header: message id, fragment index, index of the last fragment, and the message length (little endian).
+#define MICROBIT_RADIO_BULK_HEADER_SIZE         5
+#define MICROBIT_RADIO_BULK_MAX_FRAGMENTS       256
+
+// Each legacy sized frame carries 24 bytes of a message.
+#if CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE > MICROBIT_RADIO_BULK_MAX_FRAGMENTS * 24
+#error "CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE is too large to send in 256 legacy sized frames"
+#endif
+
+namespace codal
+{
+    /**
+     * Provides a bulk transport for messages of up to CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE bytes, built upon MicroBitRadio.
+     *
+     * Each message is split into sequence numbered fragments that fill the radio's frame size, which are queued back to back
+     * using MicroBitRadio::sendAsync(). Receivers reassemble fragments in any order, and raise MICROBIT_RADIO_EVT_BULK once
+     * a message is complete. Like datagrams, delivery is best effort: a message missing any fragment is abandoned
+     * CONFIG_MICROBIT_RADIO_BULK_TIMEOUT milliseconds after its last fragment arrived.
+     *
+     * @note Only one message is reassembled at a time, so senders in the same group should not send bulk messages concurrently.
+     */
+    class MicroBitRadioBulk
+    {
+        MicroBitRadio       &radio;         // The underlying radio module used to send and receive data.
+        uint8_t             txId;           // The message id given to the next message sent.
+
+        ManagedBuffer       rxBuffer;       // The message being reassembled, or an empty buffer if there is none.
+        uint8_t             rxId;           // The message id of the message being reassembled.
+        int16_t             rxDone;         // The message id of the last message completed, or -1. Repeated fragments of it are ignored.
+        uint8_t             rxLast;         // The index of the last fragment of the message being reassembled.
+        uint16_t            rxRemaining;    // The number of fragments of the message yet to arrive.
+        CODAL_TIMESTAMP     rxTime;         // The time at which the last fragment arrived.
+        uint32_t            rxFragments[MICROBIT_RADIO_BULK_MAX_FRAGMENTS / 32];   // Bitmap of fragments received.
+
+        ManagedBuffer       rxQueue[CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE];     // A ring of reassembled messages, awaiting recv().
+        uint8_t             rxHead;         // Index in rxQueue of the next message to be returned by recv().
+        uint8_t             rxCount;        // Number of messages in rxQueue.
+
+        uint32_t            dropped;        // Number of messages abandoned or dropped since startup.
+
+        /**
+         * Abandons any partly reassembled message once CONFIG_MICROBIT_RADIO_BULK_TIMEOUT has passed since its last fragment,
+         * and forgets the last message completed.
+         */
+        void checkTimeout();
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * Creates an instance of a MicroBitRadioBulk which offers the ability to broadcast
+         * messages of a few kilobytes to other micro:bits in the vicinity.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitRadioBulk(MicroBitRadio &r);
+
+        /**
+         * Retrieves the next reassembled message.
+         *
+         * @return the message received, or an empty ManagedBuffer if no message is available.
+         */
+        ManagedBuffer recv();
+
+        /**
+         * Transmits the given buffer onto the broadcast radio, as a sequence of fragments.
+         *
+         * Fragments are queued using MicroBitRadio::sendAsync(), with the calling fiber yielding while the transmit queue is full.
+         * The call returns once the last fragment is queued. This must be called from a fiber, not an interrupt.
+         *
+         * @param buffer The message contents to transmit.
+         *
+         * @param len The number of bytes to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the buffer is invalid, the number of bytes to transmit is
+         *         greater than CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE or needs more than MICROBIT_RADIO_BULK_MAX_FRAGMENTS fragments,
+         *         or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int send(uint8_t *buffer, int len);
+
+        /**
+         * Transmits the given buffer onto the broadcast radio, as a sequence of fragments.
+         *
+         * Fragments are queued using MicroBitRadio::sendAsync(), with the calling fiber yielding while the transmit queue is full.
+         * The call returns once the last fragment is queued. This must be called from a fiber, not an interrupt.
+         *
+         * @param data The message contents to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the buffer is empty or its length is
+         *         greater than CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE, or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int send(ManagedBuffer data);
+
+        /**
+         * Determines the number of messages abandoned with fragments missing, or dropped because the receive queue was full.
+         *
+         * @return The number of messages lost since startup.
+         */
+        uint32_t getDropped();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet marked as a bulk fragment.
+         *
+         * This function places the fragment in the message being reassembled, and queues the message for user
+         * reception once it is complete.
+         */
+        void packetReceived();
+    };
+}
+
+#endif
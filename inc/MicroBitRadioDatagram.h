@@ -95,7 +95,7 @@ namespace codal
          * @param len The number of bytes to transmit.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+         *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
          */
         int send(uint8_t *buffer, int len);
 
@@ -108,7 +108,7 @@ namespace codal
          * @param data The packet contents to transmit.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+         *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
          */
         int send(PacketBuffer data);
 
@@ -121,7 +121,7 @@ namespace codal
          * @param data The packet contents to transmit.
          *
          * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the buffer is invalid,
-         *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+         *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
          */
         int send(ManagedString data);
 
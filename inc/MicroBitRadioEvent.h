@@ -29,6 +29,19 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitRadio.h"
 #include "codal-core/inc/types/Event.h"
 
+// Longest time (in microseconds) a forwarded event is held back, so that a burst of events can share a frame.
+// Shared frames use MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED, which micro:bits running older firmware ignore, so
+// only enable this if every receiver understands them. By default (0) each event is sent as soon as it is raised,
+// in a MICROBIT_RADIO_PROTOCOL_EVENTBUS frame of its own.
+#ifndef CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US
+#define CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US     0
+#endif
+
+// Largest number of events packed into one frame. The default fills a legacy frame.
+#ifndef CONFIG_MICROBIT_RADIO_EVENT_MAX_PACKED
+#define CONFIG_MICROBIT_RADIO_EVENT_MAX_PACKED      7
+#endif
+
 namespace codal
 {
     /**
@@ -47,6 +60,10 @@ namespace codal
     class MicroBitRadioEvent
     {
         bool            suppressForwarding;     // A private flag used to prevent event forwarding loops.
+        bool            flushScheduled;         // true while a MICROBIT_RADIO_EVT_EVENT_FLUSH event is pending.
+        bool            flushListener;          // true once we listen for MICROBIT_RADIO_EVT_EVENT_FLUSH.
+        uint8_t         pendingCount;           // The number of events held back in pending.
+        uint16_t        pending[2 * CONFIG_MICROBIT_RADIO_EVENT_MAX_PACKED];    // Source and value of each event held back.
         MicroBitRadio   &radio;                 // A reference to the underlying radio module to use.
 
         public:
@@ -128,7 +145,7 @@ namespace codal
         /**
          * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
          *
-         * This function process this packet, and fires the event contained inside onto the default EventModel.
+         * This function process this packet, and fires the event (or events, for a packed frame) contained inside onto the default EventModel.
          */
         void packetReceived();
 
@@ -136,8 +153,46 @@ namespace codal
          * Event handler callback. This is called whenever an event is received matching one of those registered through
          * the registerEvent() method described above. Upon receiving such an event, it is wrapped into
          * a radio packet and transmitted to any other micro:bits in the same group.
+         *
+         * If CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US is set, events are held back for up to that long, so that a burst
+         * of them can share a frame. Events are queued for transmission rather than waiting for the radio.
          */
         void eventReceived(Event e);
+
+        /**
+         * Transmits the events held back by eventReceived(), if any.
+         *
+         * A single event is sent as a MICROBIT_RADIO_PROTOCOL_EVENTBUS frame, understood by all micro:bits.
+         * Several events are packed into one MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED frame.
+         */
+        void flush();
+
+        private:
+
+        /**
+         * Transmits the held back events once the coalescing delay has passed.
+         */
+        void onFlush(Event);
+
+        /**
+         * Determines the number of events that fit in one frame, at the radio's current frame size.
+         * This is always one unless coalescing is enabled, so that only frames understood by every micro:bit are sent.
+         */
+        int frameCapacity();
+
+        /**
+         * Moves up to the given number of held back events into a frame. Must be called with interrupts disabled.
+         *
+         * @param buf the frame to fill.
+         * @param capacity the maximum number of events to take.
+         * @return the number of events taken.
+         */
+        int takePending(FrameBuffer &buf, int capacity);
+
+        /**
+         * Transmits a frame filled by takePending(), waiting for the radio only if the transmit queue is full.
+         */
+        void sendFrame(FrameBuffer &buf);
     };
 }
 #endif
@@ -0,0 +1,272 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_LINK_H
+#define MICROBIT_RADIO_LINK_H
+
+#include "CodalConfig.h"
+#include "MicroBitRadio.h"
+#include "PacketBuffer.h"
+#include "codal-core/inc/types/Event.h"
+
+#define DEVICE_ID_RADIO_LINK                        3046
+
+// Events
+#define MICROBIT_RADIO_LINK_EVT_TIMER               1       // Internal retransmission timer.
+#define MICROBIT_RADIO_LINK_EVT_DATA                2       // A message has been received, and is ready to recv().
+#define MICROBIT_RADIO_LINK_EVT_DELIVERED           3       // A message has been acknowledged by its destination.
+#define MICROBIT_RADIO_LINK_EVT_FAILED              4       // A message was abandoned after CONFIG_MICROBIT_RADIO_LINK_MAX_RETRIES retransmissions.
+
+// Number of messages that may await acknowledgement at once. A power of two, at most 8.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_WINDOW
+#define CONFIG_MICROBIT_RADIO_LINK_WINDOW           4
+#endif
+
+// Number of peers for which sequence state is kept. The least recently heard idle peer is replaced when a new one is seen.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_PEERS
+#define CONFIG_MICROBIT_RADIO_LINK_PEERS            4
+#endif
+
+// Time (in milliseconds) to wait for an acknowledgement before the first retransmission. This doubles with each retry.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_RETRY_TIMEOUT
+#define CONFIG_MICROBIT_RADIO_LINK_RETRY_TIMEOUT    20
+#endif
+
+// Number of times an unacknowledged message is retransmitted before it is abandoned.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_MAX_RETRIES
+#define CONFIG_MICROBIT_RADIO_LINK_MAX_RETRIES      5
+#endif
+
+// Period (in milliseconds) at which retransmission deadlines are checked while messages await acknowledgement.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_TICK
+#define CONFIG_MICROBIT_RADIO_LINK_TICK             5
+#endif
+
+// Signal strengths (in dBm) of acknowledgements above which the transmit power used for a peer is reduced, and below which it is raised.
+#ifndef CONFIG_MICROBIT_RADIO_LINK_RSSI_STRONG
+#define CONFIG_MICROBIT_RADIO_LINK_RSSI_STRONG      -55
+#endif
+
+#ifndef CONFIG_MICROBIT_RADIO_LINK_RSSI_WEAK
+#define CONFIG_MICROBIT_RADIO_LINK_RSSI_WEAK        -80
+#endif
+
+#if CONFIG_MICROBIT_RADIO_LINK_WINDOW < 1 || CONFIG_MICROBIT_RADIO_LINK_WINDOW > 8
+#error "CONFIG_MICROBIT_RADIO_LINK_WINDOW must be in the range 1..8"
+#endif
+
+// Held messages are indexed by sequence number modulo the window, which must divide the 8 bit sequence space.
+#if (CONFIG_MICROBIT_RADIO_LINK_WINDOW & (CONFIG_MICROBIT_RADIO_LINK_WINDOW - 1)) != 0
+#error "CONFIG_MICROBIT_RADIO_LINK_WINDOW must be a power of two"
+#endif
+
+// Frame header: type, source serial number, destination serial number (both little endian), then for data frames the
+// sequence number and the oldest sequence number still awaiting acknowledgement, and for acknowledgements the next
+// sequence number expected and a bitmap of the later frames already received. Finally, the session of the sequence
+// numbers: chosen at random by the sender whenever it starts numbering afresh, and echoed back in acknowledgements.
+#define MICROBIT_RADIO_LINK_TYPE_DATA               0
+#define MICROBIT_RADIO_LINK_TYPE_ACK                1
+#define MICROBIT_RADIO_LINK_HEADER_SIZE             12
+
+namespace codal
+{
+    struct MicroBitRadioLinkPeer
+    {
+        uint32_t            serial;         // Serial number of the peer, or 0 if this entry is unused.
+        uint8_t             txSeq;          // The sequence number given to the next message sent to the peer.
+        uint8_t             rxNext;         // The sequence number of the next message expected from the peer.
+        uint8_t             power;          // The transmit power level used for the peer, when adaptive power is enabled.
+        uint8_t             txSession;      // The session of the sequence numbers used for messages sent to the peer.
+        uint8_t             rxSession;      // The session of the sequence numbers of messages received from the peer.
+        bool                synced;         // true once a message has been received from the peer, setting rxNext and rxSession.
+        bool                ackPending;     // true if messages have been received from the peer since it was last acknowledged.
+        CODAL_TIMESTAMP     lastHeard;      // The time at which we last heard from, or sent to, the peer.
+        FrameBuffer         *rxHeld[CONFIG_MICROBIT_RADIO_LINK_WINDOW];    // Messages received out of order, indexed by sequence number.
+    };
+
+    struct MicroBitRadioLinkSlot
+    {
+        FrameBuffer         *frame;         // A copy of a message awaiting acknowledgement, or NULL if this slot is free.
+        uint8_t             peer;           // Index of the destination in the peer table.
+        uint8_t             retries;        // Number of retransmissions so far.
+        bool                fastRetry;      // Set once the message has been retransmitted early, in response to a selective acknowledgement.
+        CODAL_TIMESTAMP     deadline;       // The time at which the message is next retransmitted.
+    };
+
+    /**
+     * Provides an acknowledged, unicast link between micro:bits identified by serial number, built upon MicroBitRadio.
+     *
+     * Up to CONFIG_MICROBIT_RADIO_LINK_WINDOW messages may await acknowledgement at once. Receivers acknowledge each message
+     * as soon as it is processed, using the transmit queue's turnaround onto the air, with a bitmap that lets the sender
+     * retransmit only the messages that were lost. Unacknowledged messages are retransmitted with exponential, randomised backoff.
+     * Messages are delivered to the receiver once, and in order.
+     *
+     * Optionally, the transmit power used for each peer is adapted to the signal strength of its acknowledgements.
+     */
+    class MicroBitRadioLink
+    {
+        MicroBitRadio           &radio;         // The underlying radio module used to send and receive data.
+        MicroBitRadioLinkPeer   peers[CONFIG_MICROBIT_RADIO_LINK_PEERS];
+        MicroBitRadioLinkSlot   slots[CONFIG_MICROBIT_RADIO_LINK_WINDOW];
+        FrameBuffer             *rxQueue;       // A linear list of messages received in order, awaiting recv().
+        uint8_t                 maxPower;       // The transmit power in use when adaptive power was enabled, used as a ceiling.
+        bool                    adaptivePower;  // true if the transmit power is adapted per peer.
+        bool                    listening;      // true once the retransmission timer handler is registered.
+        bool                    ticking;        // true if the retransmission timer is running.
+        uint32_t                retransmissions;
+        uint32_t                failures;
+
+        /**
+         * Finds the given peer in the peer table, optionally adding it.
+         *
+         * @param serial The serial number of the peer.
+         *
+         * @param create true to add the peer if it is not already known, replacing the least recently heard idle peer if necessary.
+         *
+         * @return The index of the peer, or -1 if it is not known and could not be added.
+         */
+        int findPeer(uint32_t serial, bool create);
+
+        /**
+         * Transmits the message in the given slot, refreshing the oldest sequence number awaiting acknowledgement.
+         *
+         * @return DEVICE_OK on success, or the error returned by MicroBitRadio::sendAsync().
+         */
+        int transmit(MicroBitRadioLinkSlot &slot);
+
+        /**
+         * Sends an acknowledgement of the messages received so far from the given peer.
+         */
+        void sendAck(int peer);
+
+        /**
+         * Delivers held messages from the given peer that are now in order, while there is room in the receive queue.
+         */
+        void deliverHeld(int peer);
+
+        /**
+         * Places the given message at the tail of the receive queue.
+         */
+        void deliver(FrameBuffer *frame);
+
+        /**
+         * Sets the transmit power to that chosen for the given peer, if adaptive power is enabled and the transmit queue is idle.
+         */
+        void applyPower(int peer);
+
+        /**
+         * Retransmission timer handler. Retransmits messages whose deadline has passed, and abandons those that have run out of retries.
+         */
+        void onTimer(Event);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitRadioLink(MicroBitRadio &r);
+
+        /**
+         * Transmits the given buffer to the micro:bit with the given serial number.
+         *
+         * Waits for a free place in the window if CONFIG_MICROBIT_RADIO_LINK_WINDOW messages already await acknowledgement,
+         * then returns once the message has been queued. Its outcome is reported by a MICROBIT_RADIO_LINK_EVT_DELIVERED
+         * or MICROBIT_RADIO_LINK_EVT_FAILED event. This must be called from a fiber, not an interrupt.
+         *
+         * @param destination The serial number of the recipient, as returned by microbit_serial_number().
+         *
+         * @param buffer The message contents to transmit.
+         *
+         * @param len The number of bytes to transmit, at most getFrameSize() - MICROBIT_RADIO_HEADER_SIZE + 1 - MICROBIT_RADIO_LINK_HEADER_SIZE.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are invalid, MICROBIT_NO_RESOURCES
+         *         if the peer table is full of peers with messages in flight, or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int send(uint32_t destination, uint8_t *buffer, int len);
+
+        /**
+         * Transmits the given buffer to the micro:bit with the given serial number.
+         *
+         * @param destination The serial number of the recipient, as returned by microbit_serial_number().
+         *
+         * @param data The message contents to transmit.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are invalid, MICROBIT_NO_RESOURCES
+         *         if the peer table is full of peers with messages in flight, or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int send(uint32_t destination, PacketBuffer data);
+
+        /**
+         * Retrieves the next message received.
+         *
+         * @param source If not NULL, set to the serial number of the sender.
+         *
+         * @return the message received, or an empty PacketBuffer if no message is available.
+         */
+        PacketBuffer recv(uint32_t *source = NULL);
+
+        /**
+         * Determines the number of messages awaiting acknowledgement.
+         *
+         * @return The number of messages in flight.
+         */
+        int pending();
+
+        /**
+         * Enables or disables adaptation of the transmit power to the signal strength of each peer's acknowledgements.
+         * The transmit power in use when enabled is used as a ceiling, and restored when disabled.
+         *
+         * @param enabled true to adapt the transmit power.
+         */
+        void setAdaptivePower(bool enabled);
+
+        /**
+         * Determines the number of retransmissions made since startup.
+         */
+        uint32_t getRetransmissions();
+
+        /**
+         * Determines the number of messages abandoned without acknowledgement since startup.
+         */
+        uint32_t getFailures();
+
+        /**
+         * Sends any acknowledgements owed for messages received. Called by MicroBitRadio once its receive queue is empty,
+         * so that a burst of messages is acknowledged once, after it has finished arriving.
+         */
+        void sendAcks();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet marked as a link frame.
+         *
+         * Messages addressed to us are acknowledged and queued for user reception in order. Acknowledgements
+         * release the messages they cover from the window.
+         */
+        void packetReceived();
+    };
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_TDMA_H
+#define MICROBIT_RADIO_TDMA_H
+
+#include "CodalConfig.h"
+#include "MicroBitRadio.h"
+#include "codal-core/inc/types/Event.h"
+
+#define DEVICE_ID_RADIO_TDMA                        3047
+
+// Events. Apart from MICROBIT_RADIO_TDMA_EVT_SLOT_ASSIGNED, these are raised by timers, and also drive the scheduler.
+#define MICROBIT_RADIO_TDMA_EVT_BEACON              1       // Time for the coordinator to send a beacon.
+#define MICROBIT_RADIO_TDMA_EVT_SLOT_START          2       // Start of our slot.
+#define MICROBIT_RADIO_TDMA_EVT_SLOT_END            3       // End of our slot.
+#define MICROBIT_RADIO_TDMA_EVT_CONTENTION          4       // Start of our attempt to use the contention slot.
+#define MICROBIT_RADIO_TDMA_EVT_SYNC_LOST           5       // Beacons have stopped arriving, so transmissions fall back to clear channel assessment.
+#define MICROBIT_RADIO_TDMA_EVT_SLOT_ASSIGNED       6       // The coordinator has assigned us a slot.
+
+// Modes
+#define MICROBIT_RADIO_TDMA_OFF                     0
+#define MICROBIT_RADIO_TDMA_COORDINATOR             1
+#define MICROBIT_RADIO_TDMA_MEMBER                  2
+
+// Default number of slots the coordinator can assign, one per member (including itself). At most 254.
+#ifndef CONFIG_MICROBIT_RADIO_TDMA_SLOTS
+#define CONFIG_MICROBIT_RADIO_TDMA_SLOTS            32
+#endif
+
+// Default slot length, in microseconds. A slot holds a burst of a few packets from the transmit queue.
+#ifndef CONFIG_MICROBIT_RADIO_TDMA_SLOT_LENGTH_US
+#define CONFIG_MICROBIT_RADIO_TDMA_SLOT_LENGTH_US   2000
+#endif
+
+// Time (in microseconds) at the end of each slot in which no new burst is started, to absorb clock drift and the last packet.
+#ifndef CONFIG_MICROBIT_RADIO_TDMA_GUARD_US
+#define CONFIG_MICROBIT_RADIO_TDMA_GUARD_US         400
+#endif
+
+// Number of consecutive beacons that may be missed before members fall back to unsynchronised transmission.
+#ifndef CONFIG_MICROBIT_RADIO_TDMA_MAX_MISSED
+#define CONFIG_MICROBIT_RADIO_TDMA_MAX_MISSED       3
+#endif
+
+// Clear channel assessment threshold (in dBm) applied while the scheduler is running.
+#ifndef CONFIG_MICROBIT_RADIO_TDMA_CCA_THRESHOLD
+#define CONFIG_MICROBIT_RADIO_TDMA_CCA_THRESHOLD    -75
+#endif
+
+// Frame layout. A beacon holds its type, the coordinator's epoch, the number of slots and the slot length, followed by as many
+// slot assignments (serial number and slot) as fit. A join request holds its type and the serial number of the member.
+#define MICROBIT_RADIO_TDMA_TYPE_BEACON             0
+#define MICROBIT_RADIO_TDMA_TYPE_JOIN               1
+#define MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE      5
+#define MICROBIT_RADIO_TDMA_ENTRY_SIZE              5
+
+namespace codal
+{
+    /**
+     * Provides beacon synchronised, slotted access to the radio for large groups.
+     *
+     * A coordinator divides time into superframes: a beacon slot, one slot per member, and a final contention slot.
+     * Members without a slot ask for one in the contention slot, and learn their assignment from later beacons.
+     * Each member then releases packets queued by MicroBitRadio::sendAsync() (and so MicroBitRadio::send(),
+     * MicroBitRadioBulk and MicroBitRadioLink) only during its own slot, timed from the arrival of each beacon.
+     * Clear channel assessment guards every burst, and is the only protection when beacons stop arriving.
+     */
+    class MicroBitRadioTDMA
+    {
+        MicroBitRadio       &radio;         // The underlying radio module used to send and receive data.
+        uint8_t             mode;           // One of the MICROBIT_RADIO_TDMA_* modes.
+        uint8_t             epoch;          // Identifies the coordinator's current slot assignments. Changes when it restarts.
+        uint8_t             slots;          // The number of assignable slots.
+        uint8_t             slot;           // Our slot, in the range 1..slots, or 0 if we don't have one.
+        uint16_t            slotLength;     // The length of each slot, in microseconds.
+        bool                synced;         // true while we are following a coordinator's beacons.
+        bool                listening;      // true once our event handler is registered.
+        uint32_t            *members;       // Coordinator only: the serial number assigned each slot, or 0 if unassigned.
+        uint8_t             announce;       // Coordinator only: the next assignment to include in a beacon.
+        int16_t             joined;         // Coordinator only: the most recent assignment, announced first, or -1.
+
+        /**
+         * Schedules our slot in the superframe that started with a beacon at the given time.
+         *
+         * @param beacon The time (in microseconds, modulo 2^32) at which the beacon finished.
+         */
+        void scheduleSlots(uint32_t beacon);
+
+        /**
+         * Builds and transmits a beacon, then schedules our own slot from it.
+         */
+        void sendBeacon();
+
+        /**
+         * Stops all of the scheduler's timers.
+         */
+        void cancelTimers();
+
+        /**
+         * Handles the scheduler's timer events.
+         */
+        void onTimer(Event e);
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitRadioTDMA(MicroBitRadio &r);
+
+        /**
+         * Starts coordinating the group: sending a beacon at the start of each superframe, and assigning slots to members
+         * (taking the first for ourselves).
+         *
+         * @param slots The number of assignable slots, in the range 1..254.
+         *
+         * @param slotLength The length of each slot, in microseconds, at least twice CONFIG_MICROBIT_RADIO_TDMA_GUARD_US.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the parameters are out of range,
+         *         MICROBIT_NO_RESOURCES if the slot table could not be allocated, or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int startCoordinator(int slots = CONFIG_MICROBIT_RADIO_TDMA_SLOTS, int slotLength = CONFIG_MICROBIT_RADIO_TDMA_SLOT_LENGTH_US);
+
+        /**
+         * Starts following a coordinator's beacons. Until the first beacon arrives, transmissions are unsynchronised,
+         * with clear channel assessment.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the radio is not enabled.
+         */
+        int startMember();
+
+        /**
+         * Stops the scheduler, returning the radio to unrestricted transmission.
+         */
+        void stop();
+
+        /**
+         * Determines the role of this micro:bit in the scheduler.
+         *
+         * @return One of the MICROBIT_RADIO_TDMA_* modes.
+         */
+        int getMode();
+
+        /**
+         * Determines the slot assigned to us.
+         *
+         * @return Our slot, in the range 1..slots, or 0 if we don't have one.
+         */
+        int getSlot();
+
+        /**
+         * Determines if we are following a coordinator's beacons.
+         *
+         * @return true if a beacon has been received within the last CONFIG_MICROBIT_RADIO_TDMA_MAX_MISSED superframes,
+         *         or if we are the coordinator.
+         */
+        bool isSynchronised();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a beacon or join request.
+         */
+        void packetReceived();
+    };
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SAMPLE_BUFFER_H
+#define MICROBIT_SAMPLE_BUFFER_H
+
+#include "MicroBitConfig.h"
+#include "codal-core/inc/types/CoordinateSystem.h"
+
+/**
+ * A single timestamped sensor sample.
+ */
+struct MicroBitSample
+{
+    Sample3D            sample;             // The sample, in the sensor's default coordinate system.
+    CODAL_TIMESTAMP     timestamp;          // The time the sample was taken, in milliseconds.
+};
+
+/**
+ * The read position of an independent reader of a MicroBitSampleBuffer.
+ */
+struct MicroBitSampleCursor
+{
+    uint32_t            position;           // The sequence number of the next sample to read.
+    uint32_t            overruns;           // The number of samples overwritten before this reader read them.
+};
+
+/**
+ * Class definition for MicroBitSampleBuffer.
+ *
+ * A fixed size ring buffer of timestamped sensor samples. Samples are pushed by the sensor as they are read,
+ * and read back oldest first by any number of readers, each with their own MicroBitSampleCursor.
+ * If a reader falls behind, the samples it missed are skipped and counted as overruns against that reader alone.
+ */
+class MicroBitSampleBuffer
+{
+    MicroBitSample      *samples;               // The ring of samples.
+    uint32_t            size;                   // The number of samples the ring can hold (a power of two).
+    uint32_t            written;                // The sequence number of the next sample to be pushed.
+    MicroBitSampleCursor reader;                // The cursor used by read() and available().
+
+    /**
+     * Moves a cursor that has fallen behind on to the oldest sample still held, counting the samples it missed.
+     */
+    void catchUp(MicroBitSampleCursor &cursor);
+
+    public:
+
+    /**
+     * Constructor.
+     *
+     * @param size The number of samples the buffer can hold. This is rounded up to a power of two.
+     */
+    MicroBitSampleBuffer(int size);
+
+    /**
+     * Adds a sample to the buffer, overwriting the oldest sample if the buffer is full.
+     *
+     * @param sample The sample to add.
+     * @param timestamp The time the sample was taken, in milliseconds.
+     */
+    void push(Sample3D sample, CODAL_TIMESTAMP timestamp);
+
+    /**
+     * Initialises a cursor, so that it reads the samples pushed from now on.
+     *
+     * @param cursor The cursor to initialise.
+     */
+    void open(MicroBitSampleCursor &cursor);
+
+    /**
+     * Reads samples from the buffer, oldest first, and advances the given cursor past them.
+     *
+     * @param cursor The reader's cursor.
+     * @param buffer The memory to read the samples into.
+     * @param count The maximum number of samples to read.
+     *
+     * @return The number of samples read.
+     */
+    int read(MicroBitSampleCursor &cursor, MicroBitSample *buffer, int count);
+
+    /**
+     * Determines the number of samples waiting to be read through the given cursor.
+     *
+     * @param cursor The reader's cursor.
+     *
+     * @return The number of unread samples.
+     */
+    int available(MicroBitSampleCursor &cursor);
+
+    /**
+     * Determines the number of samples that were overwritten before they were read through the given cursor.
+     *
+     * @param cursor The reader's cursor.
+     *
+     * @return The total number of samples lost by this reader.
+     */
+    uint32_t getOverruns(MicroBitSampleCursor &cursor);
+
+    /**
+     * Reads samples from the buffer, oldest first, using the buffer's own cursor.
+     *
+     * @param buffer The memory to read the samples into.
+     * @param count The maximum number of samples to read.
+     *
+     * @return The number of samples read.
+     */
+    int read(MicroBitSample *buffer, int count);
+
+    /**
+     * Determines the number of samples waiting to be read using the buffer's own cursor.
+     *
+     * @return The number of unread samples.
+     */
+    int available();
+
+    /**
+     * Determines the number of samples that were overwritten before they were read using the buffer's own cursor.
+     *
+     * @return The total number of samples lost.
+     */
+    uint32_t getOverruns();
+
+    /**
+     * Destructor.
+     */
+    ~MicroBitSampleBuffer();
+};
+
+#endif
@@ -0,0 +1,98 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SENSOR_DEMAND_H
+#define MICROBIT_SENSOR_DEMAND_H
+
+#include "CodalConfig.h"
+
+// The maximum number of consumers that can register their demand with a sensor.
+#ifndef MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS
+#define MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS    8
+#endif
+
+// The sample period a sensor falls back to when nobody needs it, if it cannot be put to sleep (in ms).
+#ifndef MICROBIT_SENSOR_DEMAND_IDLE_PERIOD
+#define MICROBIT_SENSOR_DEMAND_IDLE_PERIOD      1000
+#endif
+
+namespace codal
+{
+    /**
+     * The sample period required by one consumer of a sensor.
+     */
+    struct MicroBitSensorConsumer
+    {
+        uint16_t    id;                 // The id of the consuming component, or zero if unused.
+        int         period;             // The longest time between samples the consumer can accept, in milliseconds.
+    };
+
+    /**
+     * Class definition for MicroBitSensorDemand.
+     *
+     * Records the sample period each consumer of a sensor requires, so that the sensor can be run
+     * at the highest rate anyone needs, and stopped when nobody needs it at all.
+     */
+    class MicroBitSensorDemand
+    {
+        MicroBitSensorConsumer  consumers[MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS];
+
+        public:
+
+        /**
+         * Constructor. Creates a record with no consumers.
+         */
+        MicroBitSensorDemand();
+
+        /**
+         * Records the sample period a consumer requires, replacing any it previously requested.
+         *
+         * @param id The id of the consuming component, e.g. MICROBIT_ID_GESTURE.
+         *
+         * @param period The longest time between samples the consumer can accept, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the id is zero or the period is not positive,
+         * or MICROBIT_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered.
+         */
+        int request(uint16_t id, int period);
+
+        /**
+         * Removes the sample period a consumer requested.
+         *
+         * @param id The id of the consuming component.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the consumer has no request recorded.
+         */
+        int release(uint16_t id);
+
+        /**
+         * Determines the sample period that satisfies every consumer.
+         *
+         * @return The shortest period requested, in milliseconds, or zero if there are no consumers.
+         */
+        int getPeriod();
+    };
+}
+
+#endif
@@ -28,6 +28,17 @@ DEALINGS IN THE SOFTWARE.
 
 #define MICROBIT_THERMOMETER_PERIOD             1000
 
+// The default maximum age of a temperature returned by getTemperature() (in ms). Readings any older are refreshed
+// before being returned, so this should exceed MICROBIT_THERMOMETER_PERIOD for callers never to wait.
+#ifndef MICROBIT_THERMOMETER_MAX_AGE
+#define MICROBIT_THERMOMETER_MAX_AGE            2000
+#endif
+
+// The priority of the TEMP interrupt, which collects the result of each background conversion.
+#ifndef CONFIG_MICROBIT_THERMOMETER_IRQ_PRIORITY
+#define CONFIG_MICROBIT_THERMOMETER_IRQ_PRIORITY 7
+#endif
+
 /*
  * Temperature events
  */
@@ -46,11 +57,20 @@ namespace codal
     {
         unsigned long           sampleTime;
         uint32_t                samplePeriod;
+        uint32_t                maxAge;
         int16_t                 temperature;
         int16_t                 offset;
+        CODAL_TIMESTAMP         lastSample;             // When the current temperature was measured, valid once sampled is set.
+        bool                    sampled;
+        volatile bool           converting;             // Set while a background conversion is in progress.
+        volatile bool           converted;              // Set by the TEMP interrupt, until the conversion has been reported.
+        volatile int32_t        conversion;             // The raw result of the last background conversion.
+        CODAL_TIMESTAMP         conversionStart;        // When the last background conversion was started.
 
         public:
 
+        static MicroBitThermometer *instance;           // The thermometer receiving TEMP interrupts.
+
         /**
          * Constructor.
          * Create new MicroBitThermometer that gives an indication of the current temperature.
@@ -82,6 +102,28 @@ namespace codal
          */
         int getPeriod();
 
+        /**
+         * Sets the maximum age of the temperature returned by getTemperature() (in ms).
+         *
+         * Temperatures are measured in the background every sample period, without waiting for the conversion
+         * to complete, and getTemperature() returns the most recent of these. Only if it is older than the
+         * maximum age does getTemperature() wait for a new measurement.
+         *
+         * The default maximum age is MICROBIT_THERMOMETER_MAX_AGE. An age of zero measures the temperature whenever it is read, at most once a millisecond.
+         *
+         * @param age the maximum age of a temperature reading, in milliseconds.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the age is negative.
+         */
+        int setMaxAge(int age);
+
+        /**
+         * Reads the maximum age of the temperature returned by getTemperature().
+         *
+         * @return The maximum age, in milliseconds.
+         */
+        int getMaxAge();
+
         /**
          * Set the value that is used to offset the raw silicon temperature.
          *
@@ -125,8 +167,36 @@ namespace codal
          */
         virtual void idleCallback();
 
+        /**
+         * Records the result of a background conversion.
+         *
+         * @param raw The value of the TEMP register, in quarters of a degree celsius.
+         *
+         * @note should only be called from TEMP_IRQHandler...
+         */
+        void conversionComplete(int32_t raw);
+
         private:
 
+        /**
+         * Starts a background conversion, with its result collected by the TEMP interrupt.
+         */
+        void startConversion();
+
+        /**
+         * Measures the temperature now, waiting for the conversion to complete.
+         */
+        void measure();
+
+        /**
+         * Records a new temperature reading, and sends an event to indicate that it has been updated.
+         *
+         * @param raw The measured temperature, in quarters of a degree celsius.
+         *
+         * @param t The time at which the temperature was measured.
+         */
+        void record(int32_t raw, CODAL_TIMESTAMP t);
+
         /**
          * Determines if we're due to take another temperature reading
          *
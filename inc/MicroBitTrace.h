@@ -0,0 +1,207 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_TRACE_H
+#define MICROBIT_TRACE_H
+
+#include "CodalConfig.h"
+
+// Enables the cycle counting trace points. Each costs a few tens of cycles when enabled, and nothing otherwise.
+#ifndef CONFIG_MICROBIT_TRACE
+#define CONFIG_MICROBIT_TRACE                   0
+#endif
+
+// The number of entries held by the trace buffer. Must be a power of two. Each entry uses 8 bytes of RAM.
+#ifndef MICROBIT_TRACE_BUFFER_SIZE
+#define MICROBIT_TRACE_BUFFER_SIZE              256
+#endif
+
+// The number of distinct trace points that can be summarised, and for which running totals are kept.
+#ifndef MICROBIT_TRACE_MAX_POINTS
+#define MICROBIT_TRACE_MAX_POINTS               32
+#endif
+
+// Trace points used within this library. Applications may use identifiers from MICROBIT_TRACE_USER upwards.
+#define MICROBIT_TRACE_LEDMATRIX_RENDER         1
+#define MICROBIT_TRACE_RADIO_IRQ                2
+#define MICROBIT_TRACE_MIXER_PULL               3
+#define MICROBIT_TRACE_FSCACHE_READ             4
+#define MICROBIT_TRACE_FSCACHE_WRITE            5
+#define MICROBIT_TRACE_FSCACHE_FLUSH            6
+#define MICROBIT_TRACE_BLE_EVENT                7
+#define MICROBIT_TRACE_RADIO_DISPATCH           8
+#define MICROBIT_TRACE_RADIO_IDLE               9
+#define MICROBIT_TRACE_TEMP_IRQ                 10
+#define MICROBIT_TRACE_USER                     16
+
+// Flags held in each trace entry.
+#define MICROBIT_TRACE_FLAG_EXIT                0x0001
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_TRACE)
+#define MICROBIT_TRACE_SCOPE(point)             codal::MicroBitTraceScope microbitTraceScope(point)
+#else
+#define MICROBIT_TRACE_SCOPE(point)             do {} while (0)
+#endif
+
+namespace codal
+{
+    /**
+     * A single trace entry, as held in the trace buffer and returned by MicroBitTrace::read().
+     * Entries are little endian, and 8 bytes long.
+     */
+    struct MicroBitTraceEntry
+    {
+        uint32_t    cycles;             // The value of the CPU cycle counter when the entry was recorded.
+        uint16_t    point;              // The trace point entered or left.
+        uint16_t    flags;              // MICROBIT_TRACE_FLAG_EXIT if the trace point was left, zero if it was entered.
+    };
+
+    /**
+     * A summary of the time spent within one trace point.
+     */
+    struct MicroBitTraceSummary
+    {
+        uint32_t    count;              // The number of times the trace point was entered and left.
+        uint32_t    total;              // The total number of CPU cycles spent within the trace point.
+        uint32_t    max;                // The greatest number of CPU cycles spent within the trace point at once.
+    };
+
+    /**
+     * Class definition for MicroBitTrace.
+     *
+     * Records the CPU cycle counter as trace points are entered and left, in a ring buffer that holds the most
+     * recent MICROBIT_TRACE_BUFFER_SIZE entries. Trace points are normally marked with MICROBIT_TRACE_SCOPE(),
+     * which compiles to nothing unless CONFIG_MICROBIT_TRACE is enabled. Entries may be recorded from interrupt context.
+     *
+     * The buffer can be drained as binary entries with read(), to be passed on over serial or Bluetooth,
+     * or summarised on the device with getSummary() and print().
+     *
+     * Running totals are also kept for each of the first MICROBIT_TRACE_MAX_POINTS trace points, which cover
+     * the whole time since they were last reset rather than just the entries held in the buffer.
+     */
+    class MicroBitTrace
+    {
+        public:
+
+        /**
+         * Starts the CPU cycle counter and clears the trace buffer.
+         * This is done automatically when the first entry is recorded.
+         */
+        static void enable();
+
+        /**
+         * Records an entry in the trace buffer, overwriting the oldest if it is full.
+         *
+         * @param point The trace point entered or left.
+         *
+         * @param exit true if the trace point was left, false if it was entered.
+         */
+        static void record(uint16_t point, bool exit);
+
+        /**
+         * Removes entries from the trace buffer, oldest first.
+         *
+         * @param buffer The memory to copy the entries into, as a sequence of MicroBitTraceEntry.
+         *
+         * @param length The size of the buffer, in bytes. Only whole entries are copied.
+         *
+         * @return The number of bytes copied, which is zero once the trace buffer is empty.
+         */
+        static int read(uint8_t *buffer, int length);
+
+        /**
+         * Reads the number of entries overwritten before they could be read, since the trace buffer was last cleared.
+         *
+         * @return The number of entries lost.
+         */
+        static uint32_t getDropped();
+
+        /**
+         * Summarises the time spent within a trace point, from the entries currently held in the trace buffer.
+         * Each pair of matching entries is counted, and the time includes that spent in any nested trace points.
+         *
+         * @param point The trace point to summarise.
+         *
+         * @return The summary, which has a count of zero if the trace point was not entered and left.
+         */
+        static MicroBitTraceSummary getSummary(uint16_t point);
+
+        /**
+         * Reads the running total of time spent within a trace point, since the totals were last reset.
+         * The time includes that spent in any nested trace points.
+         *
+         * @param point The trace point, which must be less than MICROBIT_TRACE_MAX_POINTS.
+         *
+         * @return The running total, which has a count of zero if the trace point has not been entered and left.
+         */
+        static MicroBitTraceSummary getTotal(uint16_t point);
+
+        /**
+         * Resets the running totals of every trace point to zero.
+         */
+        static void resetTotals();
+
+        /**
+         * Discards all entries held in the trace buffer.
+         */
+        static void clear();
+
+        /**
+         * Writes a summary of each trace point found in the trace buffer to the debug log, one line per point:
+         * TRACE,point,count,total_cycles,max_cycles
+         */
+        static void print();
+    };
+
+    /**
+     * Records entry to a trace point when constructed, and exit from it when destroyed.
+     * Normally used through MICROBIT_TRACE_SCOPE().
+     */
+    class MicroBitTraceScope
+    {
+        uint16_t    point;
+
+        public:
+
+        /**
+         * Constructor. Records entry to the trace point.
+         *
+         * @param point The trace point entered.
+         */
+        MicroBitTraceScope(uint16_t point) : point(point)
+        {
+            MicroBitTrace::record(point, false);
+        }
+
+        /**
+         * Destructor. Records exit from the trace point.
+         */
+        ~MicroBitTraceScope()
+        {
+            MicroBitTrace::record(point, true);
+        }
+    };
+}
+
+#endif
@@ -32,7 +32,10 @@ DEALINGS IN THE SOFTWARE.
 #include "codal-core/inc/driver-models/I2C.h"
 #include "codal-core/inc/driver-models/Pin.h"
 #include "MicroBitPowerManager.h"
+#include "MicroBitUSBInterfaceStatistics.h"
 #include "NVMController.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
 
 
 // Constants for USB Interface Flash Management Protocol
@@ -53,10 +56,41 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_USB_FLASH_MAX_RX_RETRIES           20
 #endif
 
+// Time for which the interrupt line is polled without yielding after a request is sent, and the interval between polls (microseconds).
+// The interface chip usually responds well within this time. Thereafter, the line is polled every millisecond.
+#ifndef MICROBIT_USB_FLASH_POLL_TIME
+#define MICROBIT_USB_FLASH_POLL_TIME                1000
+#endif
+
+#ifndef MICROBIT_USB_FLASH_POLL_PERIOD
+#define MICROBIT_USB_FLASH_POLL_PERIOD              20
+#endif
+
 #ifndef MICROBIT_USB_FLASH_MAX_FLASH_STORAGE
 #define MICROBIT_USB_FLASH_MAX_FLASH_STORAGE        0x1F000
 #endif
 
+// Largest transfers made in a single transaction with interface chips implementing I2C protocol version 2 or later (bytes).
+// Longer reads and writes are streamed as a sequence of transactions of this size. Must be a multiple of 4.
+// The first release of the protocol is limited to 64 byte writes.
+#ifndef MICROBIT_USB_FLASH_MAX_WRITE_LENGTH
+#define MICROBIT_USB_FLASH_MAX_WRITE_LENGTH         64
+#endif
+
+#ifndef MICROBIT_USB_FLASH_MAX_READ_LENGTH
+#define MICROBIT_USB_FLASH_MAX_READ_LENGTH          1024
+#endif
+
+// Set to 1 to erase a range of pages in a single transaction on interface chips that report their busy status (I2C protocol
+// version 2 or later), and to poll for the completion of erase operations rather than waiting a fixed time before doing so.
+// Disabled by default, as not all released interface firmware handles multi-page erase requests.
+#ifndef MICROBIT_USB_FLASH_MULTI_PAGE_ERASE
+#define MICROBIT_USB_FLASH_MULTI_PAGE_ERASE         0
+#endif
+
+// The largest number of physical blocks whose erased state is tracked. The geometry reports up to 255 blocks.
+#define MICROBIT_USB_FLASH_MAX_BLOCKS               256
+
 
 //
 // Command codes for the USB Interface Chip
@@ -98,6 +132,14 @@ typedef struct
 #define MICROBIT_USB_FLASH_USE_NULL_TRANSACTION     0x10
 #define MICROBIT_USB_FLASH_BUSY_FLAG_SUPPORTED      0x20
 #define MICROBIT_USB_FLASH_100MS_AFTER_ERASE        0x40
+#define MICROBIT_USB_FLASH_ERASE_AHEAD_LISTENING    0x80
+#define MICROBIT_USB_FLASH_ERASE_AHEAD_RUNNING      0x100
+#define MICROBIT_USB_FLASH_POLL_ERASE               0x200
+
+//
+// Events
+//
+#define MICROBIT_USB_FLASH_EVT_ERASE_AHEAD          1
 
 
 /**
@@ -112,6 +154,13 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
         MicroBitUSBFlashConfig      config;                             // Current configuration of the USB File interface
         MicroBitUSBFlashGeometry    geometry;                           // Current geomtry of the USB File interface
         int                         maxWriteLength;                     // The maximum number of bytes that can be written in a single transaction.
+        int                         maxReadLength;                      // The maximum number of bytes that can be read in a single transaction.
+        FiberLock                   transactionLock;                    // Serialises transactions with the interface chip.
+        uint8_t                     erasedBlocks[MICROBIT_USB_FLASH_MAX_BLOCKS/8];  // Bitmap of physical blocks known to be erased.
+        uint8_t                     eraseAheadBlocks[MICROBIT_USB_FLASH_MAX_BLOCKS/8];  // Bitmap of physical blocks queued for a background erase.
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+        MicroBitUSBInterfaceStatistics  statistics[MICROBIT_USB_FLASH_ERASE_CMD + 1];   // Transaction statistics, indexed by command (zero holds the total).
+#endif
 
     public:
         /**
@@ -168,6 +217,7 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
 
         /**
          * Reads data from the specified location in the USB file storage area.
+         * Long reads are streamed as a sequence of the largest transactions supported by the interface chip.
          * 
          * @param address the logical address of the memory to read.
          * @param length the number of 32-bit words to read.
@@ -178,10 +228,12 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
 
         /**
          * Reads a block of memory from non-volatile memory into RAM
+         * Long reads are streamed as a sequence of the largest transactions supported by the interface chip.
          * 
          * @param dest The address in RAM in which to store the result of the read operation
          * @param address The logical address in non-voltile memory to read from
          * @param length The number 32-bit words to read.
+         * @return DEVICE_OK on success, or DEVICE_NO_DATA if the data could not be read.
          */ 
         virtual int read(uint32_t* dest, uint32_t address, uint32_t length) override;
 
@@ -214,6 +266,7 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
          * If the specified region is not aligned to physical block boundaries as
          * defined by the disks geometry, areas in an overlapping block outside the given 
          * range will be automatically read, erased and rewritten. 
+         * Blocks known to be erased already (see eraseAhead()) are not erased again.
          * 
          * @param address the logical address of the memory to start the erase operation.
          * @param length the number of 32-bit words to erase.
@@ -229,6 +282,31 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
          */
         virtual int erase(uint32_t page) override;
 
+        /**
+         * Queues one or more physical blocks in the USB file storage area to be erased in the background.
+         * Once erased, a subsequent erase() of the block completes without communicating with the interface
+         * chip, so callers that know which pages they will need next (such as a log approaching a page boundary)
+         * can avoid waiting for the erase. Any data in the given blocks is lost.
+         * 
+         * @param address the logical address of the first block to erase. Must be block aligned.
+         * @param length the number of 32-bit words to erase. Defaults to a single block.
+         * 
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the region is not block aligned or out of range,
+         * DEVICE_I2C_ERROR if the geometry could not be read,
+         * or DEVICE_NOT_SUPPORTED if the scheduler is not running.
+         */
+        int eraseAhead(uint32_t address, uint32_t length = 0);
+
+        /**
+         * Determines if a physical block in the USB file storage area is known to be erased,
+         * as a result of an earlier erase() or eraseAhead() with no write to the block since.
+         * 
+         * @param address the logical address of the block.
+         * 
+         * @return true if the block is known to be erased, false otherwise.
+         */
+        bool isErased(uint32_t address);
+
 
         /**
          * Determines the logical address of the start of non-volatile memory region
@@ -261,6 +339,26 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
          */
         virtual uint32_t getFlashSize() override;
 
+        /**
+         * Determines the statistics recorded for transactions with the interface chip.
+         * Statistics are only recorded if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS is enabled.
+         * 
+         * @param command the command code of the transactions (e.g. MICROBIT_USB_FLASH_READ_CMD), or zero for the total of all commands.
+         * 
+         * @return the statistics, or NULL if none are recorded for the given command.
+         */
+        const MicroBitUSBInterfaceStatistics *getStatistics(int command = 0);
+
+        /**
+         * Resets the statistics recorded for transactions with the interface chip.
+         */
+        void resetStatistics();
+
+        /**
+         * Outputs the statistics recorded for transactions with the interface chip over DMESG.
+         */
+        void printStatistics();
+
         /**
          * Destructor.
          */
@@ -277,6 +375,29 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
         ManagedBuffer transact(ManagedBuffer request, int responseLength);
         ManagedBuffer _transact(ManagedBuffer request, int responseLength);
 
+        /**
+         * Performs a flash storage transaction with the interface chip. The caller must hold the transaction lock.
+         * @param packet The data to write to the interface chip as a request operation.
+         * @param responseLength The length of the expected reponse packet.
+         * @return a buffer containing the response to the request, or a zero length buffer on failure.
+         */
+        ManagedBuffer exchange(ManagedBuffer request, int responseLength);
+
+        /**
+         * Records the statistics of a completed transaction with the interface chip.
+         * @param command The command code of the transaction.
+         * @param transaction The retries, polls, busy responses, errors and wait time of the transaction.
+         * @param start The time at which the transaction started (microseconds).
+         * @param success true if a valid response was received, false otherwise.
+         */
+        void recordTransaction(int command, const MicroBitUSBInterfaceStatistics &transaction, CODAL_TIMESTAMP start, bool success);
+
+        /**
+         * Acquires the transaction lock, recording the time spent waiting for other users of the interface chip.
+         * @param command The command code of the transaction to be performed.
+         */
+        void lock(int command);
+
         /**
          * Performs a flash storage transaction with the interface chip.
          * @param command Identifier of a command to issue (one byte write operation).
@@ -284,6 +405,28 @@ class MicroBitUSBFlashManager : public CodalComponent, public NVMController
          */
         ManagedBuffer transact(int command);
 
+        /**
+         * Erases the inclusive range of physical blocks given, batching them into a single transaction if permitted.
+         * Blocks already known to be erased are skipped. The caller must hold the transaction lock.
+         * @param eraseStart The logical address of the first block to erase.
+         * @param eraseEnd The logical address of the last block to erase.
+         * @return DEVICE_OK on success, or DEVICE_I2C_ERROR.
+         */
+        int eraseBlocks(uint32_t eraseStart, uint32_t eraseEnd);
+
+        /**
+         * Updates the erased and erase ahead state of the blocks overlapping the given region.
+         * @param address The logical address of the start of the region.
+         * @param length The length of the region in bytes.
+         * @param erased true if the blocks have been erased, false if they may hold data.
+         */
+        void setErased(uint32_t address, uint32_t length, bool erased);
+
+        /**
+         * Background eraser. Erases the blocks queued by eraseAhead(), releasing the transaction lock between each batch.
+         */
+        void onEraseAhead(Event);
+
         /**
          * Determines if the given char is valid for an 8.3 filename.
          */
@@ -0,0 +1,77 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_USB_INTERFACE_STATISTICS_H
+#define MICROBIT_USB_INTERFACE_STATISTICS_H
+
+#include "MicroBitConfig.h"
+
+//
+// Latency histogram. Bucket 0 counts transactions completing in under MICROBIT_USB_INTERFACE_LATENCY_BASE microseconds,
+// and each subsequent bucket covers twice the time of the one before. The last bucket counts all longer transactions.
+//
+#define MICROBIT_USB_INTERFACE_LATENCY_BUCKETS      12
+#define MICROBIT_USB_INTERFACE_LATENCY_BASE         128
+
+/**
+ * Statistics of the I2C transactions of one kind made with the USB interface chip.
+ * All times are in microseconds.
+ */
+struct MicroBitUSBInterfaceStatistics
+{
+    uint32_t    count;                                              // Number of transactions made.
+    uint32_t    failures;                                           // Number of transactions that received no valid response.
+    uint32_t    i2cErrors;                                          // Number of I2C reads or writes that failed (e.g. were NACKed).
+    uint32_t    retries;                                            // Number of times a request was resent.
+    uint32_t    polls;                                              // Number of times a response was awaited, but not ready.
+    uint32_t    busy;                                               // Number of busy responses received.
+    uint32_t    waitTime;                                           // Total time spent waiting for other users of the interface chip.
+    uint32_t    totalTime;                                          // Total duration of the transactions.
+    uint32_t    maxTime;                                            // Duration of the longest transaction.
+    uint32_t    latency[MICROBIT_USB_INTERFACE_LATENCY_BUCKETS];    // Histogram of transaction durations.
+
+    /**
+     * Resets all statistics to zero.
+     */
+    void clear();
+
+    /**
+     * Adds the statistics of a completed transaction.
+     *
+     * @param transaction the retries, polls, busy responses, errors and wait time of the transaction.
+     * @param time the duration of the transaction.
+     * @param success true if a valid response was received, false otherwise.
+     */
+    void add(const MicroBitUSBInterfaceStatistics &transaction, uint32_t time, bool success);
+
+    /**
+     * Outputs the statistics over DMESG, if there is anything to report.
+     *
+     * @param name a name identifying the component.
+     * @param command the command code the statistics relate to, or zero for the total of all commands.
+     */
+    void dmesg(const char *name, int command) const;
+};
+
+#endif
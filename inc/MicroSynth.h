@@ -38,19 +38,38 @@ namespace codal {
 
 
 static constexpr int SynthBlockSize = 256;
+// number of samples between updates of control rate values (envelopes, LFOs, filter coefficients)
+static constexpr int SynthControlBlockSize = 16;
+
+// Default CPU cycle budget for rendering SynthBlockSize samples, used to adapt polyphony under load.
+// Defaults to half of the real time available at 64MHz. Zero disables the limit.
+#ifndef CONFIG_POLYSYNTH_CYCLE_BUDGET
+#define CONFIG_POLYSYNTH_CYCLE_BUDGET (64000000 / SynthSampleRate * SynthBlockSize / 2)
+#endif
 static constexpr int SynthSampleRate = 44100;
 static constexpr float SynthSampleRate_f = static_cast<float>(SynthSampleRate);
 
+static constexpr int SynthWavetableSize = 256;
+static constexpr int SynthWavetableLevels = 8;
+static constexpr int SynthFilterTableSize = 128;
+
 /** 
  * Class containing certain precalculated synth data.
+ * All tables are constant, and held in flash.
  */
 class SynthTables
 {
-    static float notetab_[129]; // including guard point
-    static bool inited_;
+    static const float notetab_[129]; // including guard point
 public:
+    // Band-limited single cycle waveforms in Q14, one table per octave, each including a guard point.
+    // Level k holds (SynthWavetableSize/2) >> k harmonics.
+    static const int16_t sawtab_[SynthWavetableLevels][SynthWavetableSize + 1];
+    static const int16_t tritab_[SynthWavetableLevels][SynthWavetableSize + 1];
+    // State variable filter gain for cutoff 0 to 0.5, including guard point.
+    static const float svftab_[SynthFilterTableSize + 1];
+
     /**
-     * Calculates tables. Must be called once before using rest of class.
+     * Formerly calculated tables at runtime. Tables are now constant, so this is no longer required.
      */
     static void init();
     /**
@@ -60,6 +79,12 @@ public:
      * @return scale factor. Note number 69 returns 1.0
      */
     static float noteToScaler(float ind);
+    /**
+     * Select the wavetable level with as many harmonics as possible below nyquist.
+     * @param delta oscillator phase increment per sample, in the range 0 to 2
+     * @return wavetable level, 0 to SynthWavetableLevels-1
+     */
+    static int wavetableLevel(float delta);
 };
 
 enum class OscType : uint8_t
@@ -131,9 +156,11 @@ struct SynthPreset
   */
 class StateVariableFilter
 {
-    float g_, g1_, d_;
+    float g_, g1_, d_;          // coefficients in use, ramped towards the targets by block processing
+    float tg_, tg1_, td_;       // target coefficients from the last call to set()
+    float cutoff_, res_;        // parameters the targets were calculated from
     float s1_, s2_;
-    float tan(float x);
+    bool ramp_;                 // false until set() is called after a reset, so the first coefficients apply at once
 public:
     /** 
      * Constructor. 
@@ -141,6 +168,8 @@ public:
     StateVariableFilter();
     /**
      * Set filter cutoff frequency and resonance.
+     * Coefficients are taken from a lookup table and only recalculated when the parameters change.
+     * Block processing ramps between the previous and new coefficients to avoid zipper noise.
      * @param cutoff cutoff frequency, range 0 to 0.5 corresponding to 0 hz and nyquist
      * @param res resonance level, range 0 (no resonance) to 1 (self resonating)
      */
@@ -153,7 +182,14 @@ public:
      */
     float process(float x, FilterType f = FilterType::LPF);
     /**
-     * Resets internal filter history.
+     * Filter a block of samples in place.
+     * @param buf samples to filter
+     * @param num number of samples
+     * @param f filter type to use
+     */
+    void process(float* buf, int num, FilterType f = FilterType::LPF);
+    /**
+     * Resets internal filter history. The next coefficients set are applied without a ramp.
      */
     void reset();
 };
@@ -180,10 +216,11 @@ public:
      */
     ADSREnv();
     /** 
-     * Generate next envelope value.
+     * Advance the envelope and generate its next value.
+     * @param num number of samples to advance the envelope by
      * @return envelope value
      */
-    float process();
+    float process(int num = 1);
     /** 
      * Set envelope gate state. 
      * @param g gate status. True for active gate. 
@@ -214,12 +251,18 @@ public:
 };
 
 /**
- * Class containing naive oscillators with plenty of aliasing.
+ * Class containing band-limited wavetable oscillators.
+ * The wavetable is chosen per octave when the frequency is set, so the per sample cost is a
+ * table lookup (two for Pulse) and the output is free of most aliasing.
  */
 class Oscillator
 {
     float acc_ = 0.f, delta_ = 0.f, pw_ = 0.f;
     OscType wave_ = OscType::Saw;
+    const int16_t* table_ = SynthTables::sawtab_[0];
+    void select_table();
+    float lookup(float phase) const;
+    float output(float phase) const;
 public:
     /**
      * Generate a oscillator sample.
@@ -232,6 +275,20 @@ public:
      * @return oscillator sample 
      */
     float processPM(float pm);
+    /**
+     * Generate a block of oscillator samples.
+     * @param buf buffer to write samples to
+     * @param num number of samples to generate
+     */
+    void process(float* buf, int num);
+    /**
+     * Generate a block of oscillator samples with phase modulation.
+     * @param buf buffer to write samples to
+     * @param pm phase modulation source samples
+     * @param amount scale factor applied to the phase modulation source
+     * @param num number of samples to generate
+     */
+    void processPM(float* buf, const float* pm, float amount, int num);
     /**
      * Set oscillator frequency.
      * @param f frequency in hz
@@ -251,8 +308,8 @@ public:
 
 /**
  * A single synthesizer voice.
- * All parameter modulations except the amplitude envelope are computed once per block
- * to save on processing time.
+ * All parameter modulations are computed once per SynthControlBlockSize samples to save on
+ * processing time. The amplitude envelope is linearly interpolated between those updates.
  */
 class Voice
 {
@@ -267,11 +324,13 @@ class Voice
     int8_t note_ = -1;      // -1 means inactive voice
     bool stopping_ = false; // set to true after we've received a note off
     const SynthPreset* preset_ = nullptr;
-    int32_t noise_;         // linear congruential noise state
+    uint32_t noise_ = 1;    // linear congruential noise state
     void apply_preset();
     void set_note(float note);
-    // per sample process
-    float process();
+    // control rate update, run once per control block
+    void update_controls();
+    // audio rate render of up to SynthControlBlockSize samples
+    void render(float* buf, int num);
 public:
     Voice();
     /** 
@@ -302,6 +361,15 @@ public:
     * @return true if not is in release phase, false if not
     */
     bool isStopping() const;
+    /**
+    * Get the current output amplitude of this voice, used to pick a voice to steal.
+    * @return amplitude, from 0 upwards
+    */
+    float getLevel() const;
+    /**
+    * Immediately silence this voice, making it available for reuse.
+    */
+    void kill();
 };
 
 /** 
@@ -310,16 +378,52 @@ public:
 class PolySynth
 {
     Voice* voice_;
+    uint32_t* started_;         // trigger order of each voice, used to find the oldest
     float mixbuf_[SynthBlockSize];
     int numVoices_;
+    int polyphony_;             // current voice limit, adapted to fit the cycle budget
+    uint32_t serial_ = 0;
+    uint32_t cycleBudget_;      // cycles allowed per SynthBlockSize samples, 0 for no limit
+    uint32_t voiceCycles_ = 0;  // smoothed cost of one voice per SynthBlockSize samples
+    uint32_t lastCycles_ = 0;
 
     int findVoice(int8_t note);
+    int countVoices() const;
+    int steal() const;
     Voice& alloc(int note);
+    void adapt(uint32_t cycles, int active, int num);
     void process_noclip(float* buf, int num);
 public:
     PolySynth(int num_voices);
     ~PolySynth();
     /**
+    * Set the CPU cycle budget for rendering, allowing polyphony to adapt to the load on the processor.
+    * When a block costs more than its budget, the quietest voices are stopped and fewer voices are
+    * allowed until rendering fits again.
+    * @param cycles Cycles allowed per SynthBlockSize samples, or zero to always allow all voices
+    */
+    void setCycleBudget(uint32_t cycles);
+    /**
+    * Get the CPU cycle budget for rendering.
+    * @return Cycles allowed per SynthBlockSize samples, or zero if unlimited
+    */
+    uint32_t getCycleBudget() const;
+    /**
+    * Get the number of voices that may currently play at once.
+    * @return Voice limit, from 1 to the number of voices given to the constructor
+    */
+    int getPolyphony() const;
+    /**
+    * Get the number of voices currently playing.
+    * @return Number of active voices
+    */
+    int getActiveVoices() const;
+    /**
+    * Get the number of CPU cycles taken to render the last block.
+    * @return cycle count, or zero if cycle counting is unavailable
+    */
+    uint32_t getLastCycles() const;
+    /**
     * Allocates a voice and starts playing a note with given parameters.
     * @param note MIDI Note number
     * @param velocity Note velocity, from 0 to 1
@@ -0,0 +1,126 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROPHONE_FILTER_H
+#define MICROPHONE_FILTER_H
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+
+// Default smoothing factor of the low pass filter, as used by LowPassFilter. Smaller values filter more heavily.
+#ifndef CONFIG_MICROPHONE_FILTER_BETA
+#define CONFIG_MICROPHONE_FILTER_BETA               0.1f
+#endif
+
+// Number of input samples filtered into each output sample. Values above 1 let the ADC oversample
+// the microphone, with the low pass filter doubling as the decimation filter.
+#ifndef CONFIG_MICROPHONE_FILTER_DECIMATION
+#define CONFIG_MICROPHONE_FILTER_DECIMATION         1
+#endif
+
+namespace codal
+{
+    /**
+     * Class definition for a MicrophoneFilter.
+     *
+     * Low pass filters and decimates a stream of microphone samples in a single pass, using integer
+     * arithmetic only. It replaces a LowPassFilter at the head of the microphone pipeline: the filter
+     * response is the same, but each sample costs a multiply-accumulate rather than a pair of indirect
+     * calls and a float conversion each way, and decimation needs no further stage.
+     *
+     * 8 and 16 bit samples, signed or unsigned, are supported. Buffers are passed on in the format received.
+     */
+    class MicrophoneFilter : public DataSource, public DataSink
+    {
+        private:
+        DataSource      &upstream;              // The stream of samples to filter.
+        DataSink        *downStream;            // Our downstream component.
+        int32_t         beta;                   // Smoothing factor, in 1/65536ths.
+        int             decimation;             // Input samples per output sample.
+        int             phase;                  // Input samples remaining until the next output sample.
+        int32_t         value;                  // Filter state, in 1/256ths of a 16 bit sample.
+        bool            primed;                 // true once the filter state has been set from the stream.
+
+        public:
+
+        /**
+         * Constructor.
+         * Connects to the given stream straight away.
+         *
+         * @param source The stream to filter.
+         * @param beta The smoothing factor, from 0 (no output) to 1 (no filtering).
+         * @param decimation The number of input samples filtered into each output sample.
+         */
+        MicrophoneFilter(DataSource &source, float beta = CONFIG_MICROPHONE_FILTER_BETA, int decimation = CONFIG_MICROPHONE_FILTER_DECIMATION);
+
+        /**
+         * Destructor.
+         */
+        ~MicrophoneFilter();
+
+        /**
+         * Define the smoothing factor of the filter.
+         *
+         * @param beta The smoothing factor, from 0 (no output) to 1 (no filtering).
+         */
+        void setBeta(float beta);
+
+        /**
+         * Define the number of input samples filtered into each output sample.
+         *
+         * @param decimation The decimation factor, from 1 upwards.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the factor is less than 1.
+         */
+        int setDecimation(int decimation);
+
+        /**
+         * Determine the number of input samples filtered into each output sample.
+         */
+        int getDecimation();
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest() override;
+
+        /**
+         * Define a downstream component for data stream.
+         *
+         * @sink The component that data will be delivered to, when it is availiable
+         */
+        virtual void connect(DataSink &sink) override;
+
+        /**
+         *  Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat() override;
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull() override;
+    };
+}
+
+#endif
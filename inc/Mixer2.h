@@ -27,6 +27,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include "DataStream.h"
 
+// Default size of each mixer output buffer, in bytes. Also the maximum number of samples per buffer
+// that may be requested via Mixer2::setBufferSize().
 #ifndef CONFIG_MIXER_BUFFER_SIZE
 #define CONFIG_MIXER_BUFFER_SIZE 512
 #endif
@@ -39,15 +41,103 @@ DEALINGS IN THE SOFTWARE.
 #define CONFIG_MIXER_DEFAULT_SAMPLERATE 44100
 #endif
 
+//
+// Arithmetic used by the mixer to accumulate and scale samples.
+// MIXER_MODE_FLOAT is the original floating point pipeline.
+// MIXER_MODE_FIXED accumulates saturating Q15 samples, two at a time where the CPU supports it.
+//
+#define MIXER_MODE_FLOAT                0
+#define MIXER_MODE_FIXED                1
+
+#ifndef CONFIG_MIXER_DEFAULT_MODE
+#define CONFIG_MIXER_DEFAULT_MODE       MIXER_MODE_FLOAT
+#endif
+
+// Default release time of the output limiter, in milliseconds.
+#ifndef CONFIG_MIXER_LIMITER_RELEASE
+#define CONFIG_MIXER_LIMITER_RELEASE    100
+#endif
+
+// Stride used when estimating the peak level of a block for the output limiter.
+#ifndef CONFIG_MIXER_LIMITER_PEAK_STRIDE
+#define CONFIG_MIXER_LIMITER_PEAK_STRIDE 2
+#endif
+
+// Enable collection of pull timing and underrun statistics.
+#ifndef CONFIG_MIXER_STATISTICS
+#define CONFIG_MIXER_STATISTICS         1
+#endif
+
+// Number of mixer buffers held by the downstream sink (e.g. NRF52PWM double buffering).
+#ifndef CONFIG_MIXER_SINK_BUFFERS
+#define CONFIG_MIXER_SINK_BUFFERS       2
+#endif
+
+// Number of fractional bits used in fixed point channel positions and gains.
+#define MIXER_FIXED_POINT_BITS          16
+
+//
+// Resampling used when a channel's sample rate differs from the mixer output rate.
+// MIXER_RESAMPLER_NEAREST steps through the input, taking the nearest preceding sample.
+// MIXER_RESAMPLER_POLYPHASE interpolates with a short, band-limited polyphase FIR filter.
+//
+#define MIXER_RESAMPLER_NEAREST         0
+#define MIXER_RESAMPLER_POLYPHASE       1
+
+#ifndef CONFIG_MIXER_DEFAULT_RESAMPLER
+#define CONFIG_MIXER_DEFAULT_RESAMPLER  MIXER_RESAMPLER_POLYPHASE
+#endif
+
+// Number of FIR taps per phase, and number of bits of fractional position used to select a phase.
+#define MIXER_RESAMPLER_TAPS            4
+#define MIXER_RESAMPLER_PHASE_BITS      5
+#define MIXER_RESAMPLER_PHASES          (1 << MIXER_RESAMPLER_PHASE_BITS)
+
+// Q15 value of a full scale input (+/- CONFIG_MIXER_INTERNAL_RANGE/2) in the fixed point accumulator.
+// Leaves two bits of headroom, so up to four full scale channels can be mixed before saturation.
+#define MIXER_FIXED_FULL_SCALE          8192
+
 #define DEVICE_ID_MIXER 3030
 
 #define DEVICE_MIXER_EVT_SILENCE 1
 #define DEVICE_MIXER_EVT_SOUND   2
+#define DEVICE_MIXER_EVT_SUSPEND 3
+#define DEVICE_MIXER_EVT_RESUME  4
+
+// Number of consecutive silent buffers after which the mixer stops requesting data from its downstream sink.
+// Set to zero to disable auto-suspend.
+#ifndef CONFIG_MIXER_AUTO_SUSPEND_BUFFERS
+#define CONFIG_MIXER_AUTO_SUSPEND_BUFFERS 0
+#endif
 
 
 namespace codal
 {
 
+class Mixer2;
+
+/**
+ * Counters describing the behaviour of a single MixerChannel.
+ */
+struct MixerChannelStatistics
+{
+    uint32_t        buffers;                    // Number of buffers pulled from the channel's DataSource.
+    uint32_t        underruns;                  // Number of times the channel ran out of data part way through a mixer buffer.
+    int             queueDepth;                 // Number of buffers the DataSource currently has ready for us.
+};
+
+/**
+ * Counters describing the behaviour of a Mixer2 instance.
+ */
+struct MixerStatistics
+{
+    uint32_t        pulls;                      // Number of output buffers generated.
+    uint32_t        underruns;                  // Number of times the sink requested a buffer later than the previous one finished playing.
+    uint32_t        maxCycles;                  // Worst case CPU cycles taken by a single pull(), including upstream components.
+    uint32_t        averageCycles;              // Mean CPU cycles taken by a pull(), including upstream components.
+    uint32_t        lastCycles;                 // CPU cycles taken by the most recent pull().
+};
+
 class MixerChannel : public DataSink
 {
 private:
@@ -69,7 +159,21 @@ private:
     int             format;                     // Format of the data recieved on this channel (e.g. DATASTREAM_FORMAT_16BIT_UNSIGNED...)
     int             bytesPerSample;             // The number of bytes used in the input stream for each sample (optimisation)
 
+    int             ioffset;                    // Integer equivalent of offset, used in fixed point mode.
+    int             ishift;                     // Right shift applied to each sample in fixed point mode, to keep products within 32 bits.
+    float           igain;                      // Fixed point scale factor from (shifted) input samples to the Q15 accumulator, excluding volume.
+
+    int             resampler;                  // The resampling algorithm used by this channel (e.g. MIXER_RESAMPLER_POLYPHASE)
+    int16_t         *resampleTable;             // Q15 polyphase FIR coefficients for this channel's rate pair, or NULL if not resampling.
+    int16_t         *resampleWork;              // Current input buffer, normalised to 16 bit and prefixed with history from the previous buffer.
+    int             resampleWorkSize;           // Capacity of resampleWork, in samples.
+    int             resampleLength;             // Number of input samples held in resampleWork (excluding history), or -1 if not yet loaded.
+
     MixerChannel    *next;                      // Internal Linkage - list of all mixer channels
+    Mixer2          *mixer;                     // The mixer this channel belongs to.
+
+    uint32_t        buffers;                    // Number of buffers pulled from the DataSource.
+    uint32_t        underruns;                  // Number of times the channel ran out of data part way through a mixer buffer.
 
     friend class    Mixer2;
 
@@ -79,25 +183,57 @@ public:
      * Deliver the next available ManagedBuffer to our downstream caller.
      */
     virtual int pullRequest();
-    virtual ~MixerChannel() {};
+    virtual ~MixerChannel();
 
     void setVolume( float volume ) { this->volume = volume; }
     float getVolume() { return this->volume; }
+
+    /**
+     * Determine the statistics gathered for this channel.
+     * @return A snapshot of this channel's counters.
+     */
+    MixerChannelStatistics getStatistics();
+
+    /**
+     * Determine the play time of the input data currently buffered by this channel.
+     * @return the time required to consume the unread samples in the current buffer, in microseconds.
+     */
+    int getLatency();
 };
 
 class Mixer2 : public DataSource
 {
     MixerChannel    *channels;
     DataSink        *downStream;
-    float           mix[CONFIG_MIXER_BUFFER_SIZE];
+    union {
+        float       mix[CONFIG_MIXER_BUFFER_SIZE];      // Accumulator used in MIXER_MODE_FLOAT.
+        int16_t     qmix[CONFIG_MIXER_BUFFER_SIZE];     // Q15 accumulator used in MIXER_MODE_FIXED.
+    };
     float           outputRange;
     float           outputRate;
     int             outputFormat;
     int             bytesPerSampleOut;
+    int             bufferSize;                 // Number of samples generated per pull().
+    int             requestedBufferSize;        // Buffer size requested via setBufferSize(), or zero for the default.
     float           volume;
     uint32_t        orMask;
     float           silenceLevel;
     bool            silent;
+    int             mode;
+    int             silentBuffers;              // Number of consecutive silent buffers generated.
+    int             autoSuspend;                // Number of silent buffers after which to suspend, or zero if disabled.
+    bool            suspended;                  // true if we have stopped requesting data from our downstream sink.
+    int             limiterThreshold;           // Output level above which the limiter reduces gain, in the range 1..1023, or zero if disabled.
+    int             limiterReleaseTime;         // Time taken for the limiter to recover, in milliseconds.
+    int32_t         limiterRelease;             // Per buffer release coefficient of the limiter (Q16).
+    int32_t         limiterGain;                // Current gain applied by the limiter (Q16).
+
+    uint32_t        pulls;                      // Number of output buffers generated.
+    uint32_t        underruns;                  // Number of late requests from the sink.
+    uint32_t        maxCycles;                  // Worst case CPU cycles taken by a pull().
+    uint32_t        lastCycles;                 // CPU cycles taken by the most recent pull().
+    uint64_t        totalCycles;                // Total CPU cycles taken by all pull() operations.
+    CODAL_TIMESTAMP lastPullTime;               // Time of the last pull(), in microseconds, or zero after a (re)start.
 
 public:
     /**
@@ -225,8 +361,122 @@ public:
      */
     bool isSilent();
 
+    /**
+     * Selects the arithmetic used to mix channels together.
+     *
+     * @param mode MIXER_MODE_FLOAT (default) or MIXER_MODE_FIXED. Fixed point mode accumulates saturating
+     * Q15 samples using the Cortex-M4 DSP extensions, and writes the output format directly.
+     * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+     */
+    int setMode(int mode);
+
+    /**
+     * Determines the arithmetic used to mix channels together.
+     * @return MIXER_MODE_FLOAT or MIXER_MODE_FIXED.
+     */
+    int getMode();
+
+    /**
+     * Selects the algorithm used to convert the given channel to the mixer's output sample rate.
+     * This has no effect on channels whose sample rate matches that of the mixer.
+     *
+     * @param channel The channel to configure.
+     * @param resampler MIXER_RESAMPLER_NEAREST or MIXER_RESAMPLER_POLYPHASE.
+     * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+     */
+    int setResampler(MixerChannel *channel, int resampler);
+
+    /**
+     * Configures the mixer to stop driving its output after a period of silence.
+     * Once the given number of consecutive silent buffers have been generated, the mixer stops issuing pull requests
+     * to its downstream sink and raises DEVICE_MIXER_EVT_SUSPEND, allowing the output hardware to be powered down.
+     * The mixer resumes, raising DEVICE_MIXER_EVT_RESUME, as soon as any channel has data available or resume() is called.
+     *
+     * @param silentBuffers The number of silent buffers to wait for before suspending, or zero to disable auto-suspend.
+     * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+     */
+    int setAutoSuspend(int silentBuffers);
+
+    /**
+     * Determines if the mixer has suspended its output.
+     * @return true if the mixer is suspended.
+     */
+    bool isSuspended();
+
+    /**
+     * Restarts a suspended mixer, by issuing a pull request to the downstream sink.
+     * Has no effect if the mixer is not suspended.
+     */
+    void resume();
+
+    /**
+     * Configures an optional peak limiter on the mixer output.
+     * When enabled, the combined output of all channels is measured once per buffer, and the output gain is reduced
+     * immediately whenever a buffer would exceed the threshold, then allowed to recover over the release time. This
+     * avoids the harsh distortion of clipping when several loud channels play at once.
+     *
+     * @param threshold The output level at which limiting begins, in the range 1..1023 (full scale), or zero to disable the limiter.
+     * @param releaseTime The time taken for the gain to recover after a peak, in milliseconds.
+     * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+     */
+    int setLimiter(int threshold, int releaseTime = CONFIG_MIXER_LIMITER_RELEASE);
+
+    /**
+     * Determines the gain currently applied by the output limiter.
+     * @return the gain in the range 0..1023, where 1023 indicates no gain reduction.
+     */
+    int getLimiterGain();
+
+    /**
+     * Determine the statistics gathered for this mixer.
+     * @return A snapshot of the mixer's counters.
+     */
+    MixerStatistics getStatistics();
+
+    /**
+     * Resets the statistics of this mixer and all of its channels.
+     */
+    void resetStatistics();
+
+    /**
+     * Determine the time taken for a sample generated now to reach the output, based on the buffers held by
+     * the mixer and its downstream sink. Add MixerChannel::getLatency() to obtain the latency from a given source.
+     *
+     * @return The output latency, in microseconds.
+     */
+    int getOutputLatency();
+
+    /**
+     * Defines the number of samples generated by each pull() operation.
+     * Smaller buffers reduce the time between a sound being requested and it reaching the output,
+     * at the cost of more frequent processing. The downstream sink continues to double buffer,
+     * requesting the next buffer as each one starts to play.
+     *
+     * @param samples The number of samples per buffer, in the range 1..CONFIG_MIXER_BUFFER_SIZE, or zero to
+     * restore the default of CONFIG_MIXER_BUFFER_SIZE bytes per buffer.
+     * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+     */
+    int setBufferSize(int samples);
+
+    /**
+     * Determines the number of samples generated by each pull() operation.
+     * @return The number of samples per buffer.
+     */
+    int getBufferSize();
+
     private:
+    ManagedBuffer generate();
+    void updateLimiter(int len);
+    void configureLimiter();
+    bool hasData(MixerChannel *ch);
     void configureChannel(MixerChannel *c);
+    void configureResampler(MixerChannel *c);
+    void loadResampler(MixerChannel *c);
+    bool mixChannelResampled(MixerChannel *ch);
+    bool mixChannel(MixerChannel *ch);
+    bool mixChannelFixed(MixerChannel *ch);
+    void renderOutput(uint8_t *w, int len, bool silence);
+    void renderOutputFixed(uint8_t *w, int len, bool silence);
 };
 
 } // namespace codal
@@ -27,6 +27,13 @@ DEALINGS IN THE SOFTWARE.
 
 #include "codal-core/inc/core/CodalComponent.h"
 #include "NVMController.h"
+#include "CodalFiber.h"
+
+// Set to 1 to let other fibers run while waiting for the SoftDevice to complete a FLASH operation, rather than spinning.
+// Disabled by default, as the storage APIs built on this driver are not safe to re-enter from another fiber.
+#ifndef NRF52_FLASH_YIELD_WHEN_BUSY
+#define NRF52_FLASH_YIELD_WHEN_BUSY         0
+#endif
 
 namespace codal
 {
@@ -41,6 +48,8 @@ class NRF52FlashManager : public NVMController
         uint32_t pageCount;
         uint32_t pageSize;
 
+        static FiberLock flashLock;         // Serialises FLASH operations scheduled through the SoftDevice.
+
     public:
         /**
          * Constructor.
@@ -112,6 +121,37 @@ class NRF52FlashManager : public NVMController
          */
         virtual uint32_t getFlashSize() override;
 
+        /**
+         * Determines the memory mapped address of the given logical address.
+         * Internal FLASH can be read in place, avoiding a copy into RAM.
+         *
+         * @param address The logical address in non-volatile memory.
+         * @return A pointer to the data at the given address, or NULL if the address is out of range.
+         */
+        const uint8_t *getMemoryAddress(uint32_t address);
+
+        /**
+         * Erases a page of internal FLASH memory.
+         * When the SoftDevice is enabled, the erase is scheduled through it, such that radio activity is not disturbed,
+         * and completes on NRF_EVT_FLASH_OPERATION_SUCCESS. The erase is retried if the SoftDevice reports that it
+         * could not be performed. Otherwise the NVMC is used directly.
+         *
+         * @param address The physical address of the start of the page.
+         */
+        static void erasePage(uint32_t address);
+
+        /**
+         * Programs words of internal FLASH memory, which must already be erased (or have only bits cleared).
+         * When the SoftDevice is enabled, the write is scheduled through it, such that radio activity is not disturbed,
+         * and completes on NRF_EVT_FLASH_OPERATION_SUCCESS. The write is retried if the SoftDevice reports that it
+         * could not be performed. Otherwise the NVMC is used directly.
+         *
+         * @param address The physical address to write to. Must be word aligned.
+         * @param data The data to write. Must be word aligned.
+         * @param length The number of 32-bit words to write.
+         */
+        static void program(uint32_t *address, uint32_t *data, uint32_t length);
+
         /**
          * Destructor.
          */
@@ -32,15 +32,52 @@ DEALINGS IN THE SOFTWARE.
 #define NRF52_LED_MATRIX_CLOCK_FREQUENCY        16000000            // Frequency of underlying hardware clock (must b 1MHz, 2Mhz 4Mhz, 8Mhz or 16MHz)
 #define NRF52_LED_MATRIX_FREQUENCY              60                  // Frequency of the frame update for the display
 #define NRF52_LED_MATRIX_MAXIMUM_COLUMNS        5                   // The maximum number of LEDMatrix columns supported by the hardware.
+#define NRF52_LED_MATRIX_MAXIMUM_ROWS           5                   // The maximum number of LEDMatrix rows supported by the driver's lookup tables.
 #define NRF52_LED_MATRIX_LIGHTSENSE_STROBES     4                   // Multiple of strobe period to use for light sense
 
+// Maximum age (in milliseconds) of a light level reading before readLightLevel() senses a new one.
+#ifndef NRF52_LED_MATRIX_LIGHTSENSE_PERIOD
+#define NRF52_LED_MATRIX_LIGHTSENSE_PERIOD      250
+#endif
+
 
 // TODO: Replace this with a resource allocated version
 #define NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE     1
 #define NRF52_LEDMATRIX_PPI_CHANNEL_BASE        3
+#define NRF52_LEDMATRIX_PPI_SYNC_CHANNEL        (NRF52_LEDMATRIX_PPI_CHANNEL_BASE + NRF52_LED_MATRIX_MAXIMUM_COLUMNS)
+
+// PWM instances used to drive the columns when hardware refresh is enabled (four columns per instance).
+// The micro:bit assigns PWM0 to the edge connector, PWM1 to audio and PWM2 to neopixel, leaving only PWM3 free.
+// Instance 1 drives just the last column, and shares PWM2 with neopixel: hardware refresh is refused while either
+// instance is enabled by another driver, and falls back to the per-row interrupt if one is taken over mid frame.
+#ifndef NRF52_LEDMATRIX_PWM_INSTANCE_0
+#define NRF52_LEDMATRIX_PWM_INSTANCE_0          NRF_PWM3
+#endif
+
+#ifndef NRF52_LEDMATRIX_PWM_INSTANCE_1
+#define NRF52_LEDMATRIX_PWM_INSTANCE_1          NRF_PWM2
+#endif
+
+#define NRF52_LEDMATRIX_PWM_INSTANCES           2
+#define NRF52_LEDMATRIX_PWM_CHANNELS            4
+
+// Determines if refresh is suspended while the display is blank, and resumed on the next non-blank image.
+#ifndef NRF52_LED_MATRIX_AUTO_SUSPEND
+#define NRF52_LED_MATRIX_AUTO_SUSPEND           1
+#endif
+
+// Determines if the display is refreshed by PWM, PPI and GPIOTE hardware by default, rather than a per-row interrupt.
+#ifndef NRF52_LED_MATRIX_HARDWARE_REFRESH
+#define NRF52_LED_MATRIX_HARDWARE_REFRESH       0
+#endif
 
 #define NRF52_LEDMATRIX_STATUS_RESET            0x01
 #define NRF52_LEDMATRIX_STATUS_LIGHTREADY       0x02
+#define NRF52_LEDMATRIX_STATUS_SEQUENCED        0x04
+#define NRF52_LEDMATRIX_STATUS_SUSPENDED        0x08
+
+// Event raised once the back buffer has been presented at the end of a frame.
+#define NRF52_LEDMATRIX_EVT_FRAME               16
 
 namespace codal
 {
@@ -50,10 +87,11 @@ namespace codal
     class NRF52LEDMatrix : public Display
     {
         uint8_t strobeRow;                      // The current row being displayed.
-        uint8_t timeslots;                      // The total number of timeslots used by the driver (includes light sensing).
+        uint8_t timeslots;                      // The total number of timeslots used by the driver (excludes on-demand light sensing).
         DisplayMode mode;                       // The currnet display mode being used.
         bool enabled;                           // Whether or not the display is enabled.
         uint8_t rotation;                       // DisplayRotation
+        uint8_t frequency;                      // Frequency of the frame update for the display (Hz).
 
         const MatrixMap     &matrixMap;         // Data structure that maps screen x/y pixels into GPIO pins.
         NRFLowLevelTimer    &timer;             // The timer module used to drive this LEDMatrix.
@@ -63,8 +101,69 @@ namespace codal
         
         int8_t              gpiote[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];            // GPIOTE channels used by output columns.
         int8_t              ppi[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];               // PPI channels used by output columns.
+        uint32_t            gpioteConfig[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];      // GPIOTE CONFIG words used to drive the output columns.
+        uint8_t             pixelIndex[NRF52_LED_MATRIX_MAXIMUM_ROWS][NRF52_LED_MATRIX_MAXIMUM_COLUMNS]; // Image offsets of each row/column, for the current rotation.
+        bool                hardwareRefresh;    // Whether or not the display should be refreshed by hardware when not light sensing.
+        uint8_t             pwmPrescaler;       // The PWM prescaler used when the display is refreshed by hardware.
+        volatile bool       presentPending;     // Whether or not the back buffer is due to be presented at the end of the current frame.
+        uint32_t            frameLit;           // Non-zero if any compare value in the frame being strobed lights an LED.
+        volatile bool       lightSenseRequested;// Whether or not a light sense slot is due at the end of the current frame.
+        uint32_t            lightSensePeriod;   // Maximum age of a light level reading, in milliseconds.
+        CODAL_TIMESTAMP     lightSenseTime;     // The time of the last light level reading.
+
+        // Compare values streamed by EasyDMA to the column PWM channels, one set of channels per row.
+        // Double buffered, so that each frame is rebuilt while the PWMs still stream the previous one.
+        uint16_t            pwmSequence[2][NRF52_LEDMATRIX_PWM_INSTANCES][NRF52_LED_MATRIX_MAXIMUM_ROWS * NRF52_LEDMATRIX_PWM_CHANNELS] __attribute__ ((aligned (4)));
+        uint8_t             pwmBuffer;          // The half of pwmSequence last built.
+
+        /**
+         * Rebuilds the table of image offsets strobed for each row and column, following a change of rotation.
+         */
+        void updatePixelIndex();
+
+        /**
+         * Hands the refresh of the display over to the PWM, PPI and GPIOTE hardware.
+         *
+         * @return true on success, or false if one of the PWM instances is in use by another driver.
+         */
+        bool startSequence();
+
+        /**
+         * Determines if a PWM instance is still configured to drive our columns.
+         *
+         * @param instance The index of the instance, in the range 0..NRF52_LEDMATRIX_PWM_INSTANCES-1.
+         *
+         * @return true if the instance drives our columns, false if another driver has taken it over.
+         */
+        bool ownsPwm(int instance);
+
+        /**
+         * Returns the refresh of the display to the per-row timer interrupt.
+         */
+        void stopSequence();
+
+        /**
+         * Rebuilds the PWM compare values streamed to the columns from the current image.
+         *
+         * @return Non-zero if any of the compare values lights an LED.
+         */
+        uint32_t updateSequence();
+
+        /**
+         * Presents the back buffer, if requested. Called at the end of each frame.
+         *
+         * @return true if the back buffer was presented, false otherwise.
+         */
+        bool endFrame();
+
+        /**
+         * Stops refreshing the display while it is blank. Called at the end of a frame that lit no LEDs.
+         */
+        void suspend();
 
         public:
+
+        Image               backBuffer;         // Image drawn by the application, and displayed at the end of a frame by present().
         /**
          * Configure the next frame to be drawn.
          */
@@ -147,6 +246,24 @@ namespace codal
          */
         void clear();
 
+        /**
+         * Requests that the back buffer is shown, once the frame currently being displayed is complete.
+         *
+         * The back buffer is copied into the displayed image between the last row of one frame and the first row of
+         * the next, so its changes never appear mid-frame. A NRF52_LEDMATRIX_EVT_FRAME event is raised once
+         * the copy is complete, so an animation can draw its next frame into the back buffer in a listener
+         * (or after fiber_wait_for_event()), and progress at the display's frame rate without tearing.
+         *
+         * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the back buffer is not the size of the display.
+         *
+         * @code
+         * display.backBuffer.setPixelValue(2, 2, 255);
+         * display.present();
+         * fiber_wait_for_event(DEVICE_ID_DISPLAY, NRF52_LEDMATRIX_EVT_FRAME);
+         * @endcode
+         */
+        int present();
+
         /**
          * Configures the brightness of the display.
          *
@@ -157,12 +274,78 @@ namespace codal
         int setBrightness(int b);
 
         /**
-         * Determines the last ambient light level sensed.
+         * Configures the frame update frequency of the display.
+         * Lower frequencies wake the CPU less often, at the risk of visible flicker.
+         *
+         * @param frequency The frame update frequency in Hz, in the range 1 - 255. Defaults to NRF52_LED_MATRIX_FREQUENCY.
+         *
+         * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER
+         */
+        int setFrequency(int frequency);
+
+        /**
+         * Determines the frame update frequency of the display.
+         *
+         * @return The frame update frequency in Hz.
+         */
+        int getFrequency();
+
+        /**
+         * Selects how the display is refreshed.
+         *
+         * When enabled, the row strobe sequence is driven by the TIMER, PPI and GPIOTE hardware, and the column
+         * brightness by a PWM EasyDMA sequence, so the CPU is interrupted only once per frame rather than once per row.
+         * Light sense modes always use the per-row interrupt, and return to hardware refresh when light sensing ends.
+         * The per-row interrupt is also used while another driver holds NRF52_LEDMATRIX_PWM_INSTANCE_0 or _1
+         * (PWM2 is shared with neopixel), so use isHardwareRefresh() to determine which is in effect.
+         *
+         * @param enable true to refresh the display in hardware, false to use the per-row interrupt.
+         *        Defaults to NRF52_LED_MATRIX_HARDWARE_REFRESH.
+         */
+        void setHardwareRefresh(bool enable);
+
+        /**
+         * Determines if the display is refreshed in hardware.
+         *
+         * @return true if the display is currently refreshed by the PWM, PPI and GPIOTE hardware, false otherwise.
+         */
+        bool isHardwareRefresh();
+
+        /**
+         * Determines the ambient light level.
+         *
+         * Light sense modes only add a light sense slot to the end of a frame when a reading is needed, so the
+         * display keeps its full refresh time otherwise. If the last reading is older than the light sense period,
+         * a new one is taken, blocking the calling fiber for up to a few frames. Before the scheduler is running,
+         * the caller instead busy waits for up to one and a half frames. A disabled display can't sense light,
+         * so the last reading is returned at once.
          *
          * @return The light level sensed, as an unsigned 8-bit value in the range 0..255
          */
         int readLightLevel();
 
+        /**
+         * Configures how often the ambient light level is sensed.
+         *
+         * @param period The maximum age of a light level reading in milliseconds, before a new one is sensed.
+         *        Zero senses on every call to readLightLevel(). Defaults to NRF52_LED_MATRIX_LIGHTSENSE_PERIOD.
+         *
+         * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER
+         */
+        int setLightSensePeriod(int period);
+
+        /**
+         * Determines how often the ambient light level is sensed.
+         *
+         * @return The maximum age of a light level reading in milliseconds.
+         */
+        int getLightSensePeriod();
+
+        /**
+         * Resumes refresh of a suspended display, when the image is no longer blank.
+         */
+        virtual void idleCallback() override;
+
         /**
          * Puts the component in (or out of) sleep (low power) mode.
          */
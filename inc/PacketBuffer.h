@@ -29,6 +29,15 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalConfig.h"
 #include "codal-core/inc/types/Event.h"
 #include "RefCounted.h"
+#include "MicroBitMemoryConsumer.h"
+
+// The number of released PacketData blocks kept for reuse in each size class, rather than returned to the heap.
+// Size classes hold payloads of up to 32, 64, 128 and 255 bytes.
+#ifndef MICROBIT_PACKET_POOL_DEPTH
+#define MICROBIT_PACKET_POOL_DEPTH              2
+#endif
+
+#define MICROBIT_PACKET_POOL_CLASSES            4
 
 namespace codal
 {
@@ -39,15 +48,70 @@ namespace codal
         uint8_t         payload[0];         // User / higher layer protocol data
     };
 
+    /**
+     * Class definition for PacketBufferPool.
+     *
+     * Keeps PacketData blocks released by the last PacketBuffer referencing them, sorted into size classes,
+     * so that a steady stream of radio packets reuses the same few blocks rather than churning the heap.
+     * Blocks are held until MICROBIT_PACKET_POOL_DEPTH are waiting in a class, or the memory is reclaimed.
+     */
+    class PacketBufferPool : public MicroBitMemoryConsumer
+    {
+        PacketData      *freeList[MICROBIT_PACKET_POOL_CLASSES];    // Blocks awaiting reuse in each size class, linked through their payload.
+        uint8_t         freeCount[MICROBIT_PACKET_POOL_CLASSES];    // The number of blocks in each list.
+
+        public:
+
+        /**
+         * Constructor. Creates an empty pool.
+         */
+        PacketBufferPool();
+
+        /**
+         * Provides a block able to hold a payload of the given length, reusing a released one if possible.
+         *
+         * @param length The length of the payload, in bytes.
+         *
+         * @return The block, which is uninitialised, or NULL if no memory is available.
+         */
+        PacketData *allocate(int length);
+
+        /**
+         * Releases a block no longer referenced by any PacketBuffer, keeping it for reuse if there is room in its size class.
+         *
+         * @param p The block to release.
+         */
+        void release(PacketData *p);
+
+        /**
+         * Determines the heap memory held by blocks awaiting reuse.
+         *
+         * @return The number of bytes currently allocated.
+         */
+        virtual uint32_t getMemoryUsage() override;
+
+        /**
+         * Returns all blocks awaiting reuse to the heap.
+         *
+         * @return The number of bytes returned to the heap.
+         */
+        virtual uint32_t releaseMemory() override;
+
+        static PacketBufferPool pool;
+    };
+
     /**
      * Class definition for a PacketBuffer.
      * A PacketBuffer holds a series of bytes that can be sent or received from the MicroBitRadio channel.
+     * It may also be a view of part of another PacketBuffer, created with slice(), in which case the two share their contents.
      *
      * @note This is a mutable, managed type.
      */
     class PacketBuffer
     {
         PacketData      *ptr;     // Pointer to payload data
+        uint8_t         offset;   // The index of our first byte within the payload.
+        uint8_t         size;     // The number of bytes in our view of the payload.
 
         public:
 
@@ -122,6 +186,11 @@ namespace codal
          */
         void init(uint8_t *data, int length, int rssi);
 
+        /**
+         * Internal destructor. Drops our reference to the payload, returning it to the PacketBufferPool if it was the last.
+         */
+        void release();
+
         /**
          * Destructor.
          *
@@ -266,8 +335,106 @@ namespace codal
          */
         void setRSSI(uint8_t rssi);
 
+        /**
+         * Creates a view of part of this packet, sharing its contents rather than copying them.
+         * Changes made through either PacketBuffer are seen by the other.
+         *
+         * @param start The index of the first byte of the view, relative to the start of this PacketBuffer.
+         *
+         * @param length The number of bytes in the view, or -1 for all those from start to the end of this PacketBuffer.
+         *        The view is truncated to fit within this PacketBuffer.
+         *
+         * @return The view, which has the same signal strength as this packet.
+         *
+         * @code
+         * PacketBuffer p = uBit.radio.datagram.recv();
+         * PacketBuffer body = p.slice(2);       // Everything after a two byte header.
+         * @endcode
+         */
+        PacketBuffer slice(int start, int length = -1);
+
         static PacketBuffer EmptyPacket;
     };
+
+    /**
+     * Class definition for a PacketBufferBuilder.
+     * Composes an outgoing packet in place, one field at a time, without allocating a buffer for each.
+     *
+     * @code
+     * PacketBufferBuilder b(8);
+     * b.add(MY_PROTOCOL_HEADER);
+     * b.add(payload);
+     * uBit.radio.datagram.send(b.build());
+     * @endcode
+     */
+    class PacketBufferBuilder
+    {
+        PacketBuffer    buffer;   // The packet being built.
+        int             used;     // The number of bytes added so far.
+
+        public:
+
+        /**
+         * Constructor.
+         * Creates a builder with a new PacketBuffer of the given capacity to fill.
+         *
+         * @param capacity The greatest number of bytes the packet may hold.
+         */
+        PacketBufferBuilder(int capacity);
+
+        /**
+         * Reserves space for the given number of bytes at the end of the packet, to be written in place.
+         *
+         * @param length The number of bytes to reserve.
+         *
+         * @return A pointer to the reserved bytes, or NULL if the packet does not have room for them.
+         */
+        uint8_t *reserve(int length);
+
+        /**
+         * Appends a byte to the packet.
+         *
+         * @param value The byte to append.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the packet is full.
+         */
+        int add(uint8_t value);
+
+        /**
+         * Appends a sequence of bytes to the packet.
+         *
+         * @param data The bytes to append.
+         *
+         * @param length The number of bytes to append.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if data is NULL, or DEVICE_NO_RESOURCES if the packet does not have room for them.
+         */
+        int add(const uint8_t *data, int length);
+
+        /**
+         * Appends the contents of a PacketBuffer to the packet.
+         *
+         * @param data The PacketBuffer, or view of one, to append.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the packet does not have room for it.
+         */
+        int add(PacketBuffer data);
+
+        /**
+         * Determines the number of bytes added to the packet so far.
+         *
+         * @return The number of bytes.
+         */
+        int length();
+
+        /**
+         * Provides the packet built so far, as a view of the builder's storage rather than a copy.
+         * Bytes added to the builder afterwards are not part of the view.
+         *
+         * @return A view of the bytes added to the packet.
+         */
+        PacketBuffer build();
+    };
 }
 
 #endif
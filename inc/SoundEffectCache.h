@@ -0,0 +1,191 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef SOUND_EFFECT_CACHE_H
+#define SOUND_EFFECT_CACHE_H
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+#include "ManagedString.h"
+#include "SoundEmojiSynthesizer.h"
+
+// Maximum number of bytes of rendered audio the cache may hold. Set to zero to disable the cache.
+#ifndef CONFIG_SOUND_EFFECT_CACHE_SIZE
+#define CONFIG_SOUND_EFFECT_CACHE_SIZE              0
+#endif
+
+// Maximum number of sounds held by the cache.
+#ifndef CONFIG_SOUND_EFFECT_CACHE_ENTRIES
+#define CONFIG_SOUND_EFFECT_CACHE_ENTRIES           8
+#endif
+
+// Sample rate at which sounds are rendered into the cache. Lower rates hold longer sounds in the same memory,
+// at the expense of high frequency content.
+#ifndef CONFIG_SOUND_EFFECT_CACHE_SAMPLE_RATE
+#define CONFIG_SOUND_EFFECT_CACHE_SAMPLE_RATE       11025
+#endif
+
+// Number of bytes delivered to the mixer by each pull().
+#define SOUND_EFFECT_CACHE_CHUNK_SIZE               256
+
+namespace codal
+{
+    class MixerChannel;
+
+    /**
+     * Class definition for a SoundEffectCache.
+     *
+     * Holds a bounded, least recently used set of sounds pre-rendered into 8 bit PCM, and streams them
+     * into its own Mixer2 channel. Playing a sound from the cache costs a memory copy per buffer, rather
+     * than parsing and synthesizing it again, and starts with a predictable latency.
+     *
+     * Only sounds of a finite duration can be cached. Sounds that are expected to vary between plays
+     * (e.g. those containing randomness) should not be added.
+     */
+    class SoundEffectCache : public DataSource
+    {
+        struct Entry
+        {
+            ManagedString       key;                    // The sound this entry holds.
+            ManagedBuffer       pcm;                    // Rendered samples, 8 bit unsigned.
+            uint32_t            lastUsed;               // Value of useCount when this entry was last played.
+        };
+
+        Entry                   entries[CONFIG_SOUND_EFFECT_CACHE_ENTRIES];
+        int                     maxBytes;               // Upper bound on the rendered bytes held.
+        int                     usedBytes;              // Rendered bytes currently held.
+        uint32_t                useCount;               // Monotonic counter, used to determine the least recently used entry.
+        uint32_t                hits;                   // Number of plays served from the cache.
+        uint32_t                misses;                 // Number of sounds rendered into the cache.
+
+        uint16_t                id;                     // Event ID raised when playback completes.
+        DataSink                *downStream;            // Our downstream component.
+        MixerChannel            *channel;               // Mixer channel used for playback, created on demand.
+        SoundEmojiSynthesizer   *renderer;              // Synthesizer used to render sounds, created on demand.
+        ManagedBuffer           playing;                // The sound currently being played out.
+        int                     playPosition;           // Offset of the next sample to play.
+        bool                    active;                 // True if we're awaiting a pull() from downstream.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param id The event ID to raise DEVICE_SOUND_EMOJI_SYNTHESIZER_EVT_DONE on when playback completes.
+         * Typically that of the SoundEmojiSynthesizer used for uncached sounds, so callers see the same events.
+         * @param maxBytes The maximum number of bytes of rendered audio to hold.
+         */
+        SoundEffectCache(uint16_t id, int maxBytes = CONFIG_SOUND_EFFECT_CACHE_SIZE);
+
+        /**
+         * Destructor.
+         */
+        ~SoundEffectCache();
+
+        /**
+         * Change the maximum amount of memory the cache may use. Sounds are discarded as needed.
+         *
+         * @param bytes The maximum number of bytes of rendered audio to hold, or zero to disable the cache.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int setSize(int bytes);
+
+        /**
+         * Determine if the cache is able to hold sounds.
+         * @return true if the cache has a non-zero size.
+         */
+        bool isEnabled();
+
+        /**
+         * Plays a sound from the cache, if present.
+         *
+         * @param key The sound to play.
+         * @return DEVICE_OK if playback has started, or DEVICE_NO_DATA if the sound is not held in the cache.
+         */
+        int play(ManagedString key);
+
+        /**
+         * Renders a sound into the cache, and starts playing it.
+         *
+         * @param key The sound being added.
+         * @param effects A buffer containing an array of one or more SoundEffects describing the sound.
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the sound has no finite duration,
+         * or DEVICE_NO_RESOURCES if it is too large to be held.
+         */
+        int add(ManagedString key, ManagedBuffer effects);
+
+        /**
+         * Stops any sound currently being played from the cache.
+         */
+        void stop();
+
+        /**
+         * Discards all sounds held in the cache.
+         */
+        void flush();
+
+        /**
+         * Determine the number of plays served from the cache.
+         */
+        uint32_t getHitCount();
+
+        /**
+         * Determine the number of sounds that have been rendered into the cache.
+         */
+        uint32_t getMissCount();
+
+        /**
+         * Define a downstream component for data stream.
+         *
+         * @sink The component that data will be delivered to, when it is availiable
+         */
+        virtual void connect(DataSink &sink) override;
+
+        /**
+         *  Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat() override;
+
+        /**
+         * Provide the next available ManagedBuffer to our downstream caller, if available.
+         */
+        virtual ManagedBuffer pull() override;
+
+        private:
+
+        /**
+         * Discard least recently used sounds until the given number of bytes can be held.
+         * @return true if enough space is available.
+         */
+        bool reserve(int bytes);
+
+        /**
+         * Start playout of the given buffer of samples.
+         */
+        void start(ManagedBuffer pcm);
+    };
+}
+
+#endif
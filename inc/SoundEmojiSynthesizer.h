@@ -32,6 +32,12 @@ DEALINGS IN THE SOFTWARE.
 #define EMOJI_SYNTHESIZER_TONE_WIDTH_F        1024.0f
 #define EMOJI_SYNTHESIZER_BUFFER_SIZE         512
 
+// Toneprint position is held as a 32 bit phase accumulator, where a full period spans 2^32.
+// The top bits index the internal tone tables, or are scaled to EMOJI_SYNTHESIZER_TONE_WIDTH for toneprint functions.
+#define EMOJI_SYNTHESIZER_TONE_TABLE_SIZE     256
+#define EMOJI_SYNTHESIZER_TONE_TABLE_SHIFT    24
+#define EMOJI_SYNTHESIZER_TONE_WIDTH_SHIFT    22
+
 #define EMOJI_SYNTHESIZER_TONE_EFFECT_PARAMETERS        2
 #define EMOJI_SYNTHESIZER_TONE_EFFECTS                  3
 
@@ -127,7 +133,8 @@ namespace codal
         float                   volume;                 // The instantaneous volume currently being generated within an effect.
         int                     samplesToWrite;         // The number of samples needed from the current sound effect block.
         int                     samplesWritten;         // The number of samples written from the current sound effect block.
-        float                   position;               // Position within the tonePrint.
+        uint32_t                position;               // Position within the tonePrint, as a 32 bit phase accumulator.
+        uint32_t                noise;                  // State of the generator used for NoiseTone.
         float                   samplesPerStep[EMOJI_SYNTHESIZER_TONE_EFFECTS];     // The number of samples to render per step for each effect.
         /**
           * Default Constructor.
@@ -241,6 +248,18 @@ namespace codal
          */
         int determineSampleCount(float playoutTime);
 
+        /**
+         * Synthesize samples from the current sound effect's toneprint at a fixed frequency and volume.
+         * The standard Synthesizer toneprints are rendered from tables, others via their TonePrintFunction.
+         *
+         * @param out The location to write samples to.
+         * @param count The number of samples to write.
+         * @param skip The phase increment per sample.
+         * @param gain Volume scaling, in 16.16 fixed point.
+         * @param offset DC offset added to each scaled sample.
+         */
+        void render(uint16_t *out, int count, uint32_t skip, int32_t gain, int32_t offset);
+
     };
 }
 
@@ -27,14 +27,55 @@ DEALINGS IN THE SOFTWARE.
 
 #include "ManagedString.h"
 #include "SoundEmojiSynthesizer.h"
+#include "SoundEffectCache.h"
+
+// Number of compiled user defined sound expressions to retain, so that replaying them needs no parsing.
+#ifndef CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE
+#define CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE     4
+#endif
+
+// Number of parameters of a sound expression that carry an encoded random range.
+#define SOUND_EXPRESSION_RANDOM_FIELDS                  7
 
 namespace codal
 {
+    /**
+     * The decoded fields of a single 72 character sound expression effect.
+     * Randomness is applied when a SoundEffect is built from it, so one compiled form serves every play.
+     */
+    typedef struct
+    {
+        int8_t              wave;
+        int8_t              shape;
+        int8_t              fxChoice;
+        int16_t             volume;
+        int16_t             frequency;
+        int16_t             duration;
+        int16_t             endFrequency;
+        int16_t             endVolume;
+        int16_t             steps;
+        int16_t             fxParam;
+        int16_t             fxnSteps;
+        int16_t             random[SOUND_EXPRESSION_RANDOM_FIELDS];     // frequency, end frequency, volume, end volume, duration, fxParam, fxnSteps
+    } CompiledSoundEffect;
+
+    /**
+     * A built-in sound, held in flash.
+     */
+    typedef struct
+    {
+        uint32_t                    hash;           // Hash of the name, as calculated by soundExpressionHash().
+        const char                  *name;
+        const CompiledSoundEffect   *effects;
+        int                         count;
+    } BuiltInSoundExpression;
 
     class SoundExpressions
     {
         public:
 
+        SoundEffectCache cache;     // Optional cache of pre-rendered sounds. Disabled unless given a size.
+
         /**
           * Default Constructor.
           */
@@ -63,13 +104,36 @@ namespace codal
          */
         void stop();
 
+        /**
+         * Define the amount of memory used to hold pre-rendered sounds.
+         * Sounds with a finite duration and no randomness are rendered on first play and replayed from memory thereafter.
+         *
+         * @param bytes The maximum number of bytes to hold, or zero to disable caching.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int setCacheSize(int bytes);
+
         private:
+        struct CompiledSoundExpression
+        {
+            uint32_t        hash;
+            ManagedString   key;
+            ManagedBuffer   effects;        // Array of CompiledSoundEffect.
+            uint32_t        lastUsed;
+        };
+
         SoundEmojiSynthesizer &synth;
+        CompiledSoundExpression compiled[CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE];
+        uint32_t useCount;
 
         static int parseDigits(const char *input, const int digits);
         static int applyRandom(int value, int rand);
-        static ManagedString lookupBuiltIn(ManagedString sound);
-        bool parseSoundExpression(const char *soundChars, SoundEffect *fx);
+        static uint32_t soundExpressionHash(ManagedString sound);
+        static bool lookupBuiltIn(ManagedString sound, uint32_t hash, const CompiledSoundEffect *&effects, int &count);
+        static bool isDeterministic(const CompiledSoundEffect *compiled);
+        static bool compileSoundExpression(const char *soundChars, CompiledSoundEffect *fx);
+        static bool buildSoundEffect(const CompiledSoundEffect *compiled, SoundEffect *fx);
+        ManagedBuffer compile(ManagedString sound, uint32_t hash);
 
     };
 }
@@ -0,0 +1,236 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SOUND_LEVEL_DETECTOR_H
+#define SOUND_LEVEL_DETECTOR_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "Event.h"
+
+// Default integration window, in milliseconds. Each window produces one new level reading.
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_WINDOW
+#define CONFIG_SOUND_LEVEL_DETECTOR_WINDOW          50
+#endif
+
+// Time after the last getValue() poll before the detector stops processing audio, in milliseconds.
+// Doesn't apply while the detector is held active by an event listener.
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_TIMEOUT
+#define CONFIG_SOUND_LEVEL_DETECTOR_TIMEOUT         1000
+#endif
+
+// Level in dB corresponding to an RMS amplitude of one unit of a 16 bit sample.
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_CALIBRATION
+#define CONFIG_SOUND_LEVEL_DETECTOR_CALIBRATION     26
+#endif
+
+// Levels (in dB) mapped to 0 and 255 by SOUND_LEVEL_DETECTOR_8BIT.
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MIN
+#define CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MIN        35
+#endif
+
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MAX
+#define CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MAX        100
+#endif
+
+// Sample rate of the microphone stream, in Hz.
+#ifndef CONFIG_SOUND_LEVEL_DETECTOR_SAMPLE_RATE
+#define CONFIG_SOUND_LEVEL_DETECTOR_SAMPLE_RATE     22000
+#endif
+
+#define DEVICE_ID_SOUND_LEVEL_DETECTOR              3043
+
+#define SOUND_LEVEL_DETECTOR_STATUS_ACTIVE          0x01        // Processing audio.
+#define SOUND_LEVEL_DETECTOR_STATUS_PERSISTENT      0x02        // Held active regardless of polling, for event listeners.
+#define SOUND_LEVEL_DETECTOR_STATUS_HIGH            0x04        // The level is above the high threshold.
+#define SOUND_LEVEL_DETECTOR_STATUS_VALID           0x08        // At least one window has been measured.
+#define SOUND_LEVEL_DETECTOR_STATUS_CONNECTED       0x10        // Connected to the audio stream.
+
+// Events
+#define SOUND_LEVEL_DETECTOR_EVT_LOW                1           // The level has fallen below the low threshold.
+#define SOUND_LEVEL_DETECTOR_EVT_HIGH               2           // The level has risen above the high threshold.
+#define SOUND_LEVEL_DETECTOR_EVT_IDLE               3           // Internal: no longer polled, so disconnect from the stream.
+
+// Scales for getValue()
+#define SOUND_LEVEL_DETECTOR_DB                     1
+#define SOUND_LEVEL_DETECTOR_8BIT                   2
+
+namespace codal
+{
+    /**
+     * Class definition for a SoundLevelDetector.
+     *
+     * Measures the loudness of an audio stream using integer arithmetic only. The sum of squares and peak
+     * of the samples are accumulated as each buffer arrives, and converted to an RMS level in dB once per
+     * integration window, so the per sample cost is a multiply-accumulate and a compare.
+     *
+     * Audio is only processed on demand: for a short while after each getValue(), or indefinitely while
+     * activated for an event listener. Otherwise the detector disconnects from its stream, allowing the
+     * microphone to be powered down.
+     */
+    class SoundLevelDetector : public DataSink, public CodalComponent
+    {
+        private:
+        DataSource          &upstream;              // The stream of audio to measure.
+        int                 sampleRate;             // The sample rate of the stream, in Hz.
+        int                 windowSamples;          // Number of samples in each integration window.
+
+        uint64_t            sumSquares;             // Sum of squared samples in the current window.
+        int                 peakSample;             // Largest absolute sample in the current window.
+        int                 count;                  // Samples accumulated in the current window.
+
+        int                 rms;                    // RMS amplitude of the last complete window.
+        int                 peak;                   // Peak amplitude of the last complete window.
+        int                 level;                  // Level of the last complete window, in tenths of a dB.
+        int                 calibration;            // Offset applied to levels, in dB.
+        int                 highThreshold;          // Level above which a HIGH event is raised, in dB.
+        int                 lowThreshold;           // Level below which a LOW event is raised, in dB.
+
+        CODAL_TIMESTAMP     lastPoll;               // Time of the last getValue(), in milliseconds.
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The stream of audio to measure. 8 and 16 bit signed formats are supported.
+         * @param highThreshold The level above which a SOUND_LEVEL_DETECTOR_EVT_HIGH event is raised, in dB.
+         * @param lowThreshold The level below which a SOUND_LEVEL_DETECTOR_EVT_LOW event is raised, in dB.
+         * @param sampleRate The sample rate of the stream, in Hz.
+         * @param id The event ID to raise threshold events on.
+         * @param connectImmediately If true, measurement starts immediately and persists. Otherwise it starts on first use.
+         */
+        SoundLevelDetector(DataSource &source, int highThreshold, int lowThreshold, int sampleRate = CONFIG_SOUND_LEVEL_DETECTOR_SAMPLE_RATE, uint16_t id = DEVICE_ID_SOUND_LEVEL_DETECTOR, bool connectImmediately = false);
+
+        /**
+         * Destructor.
+         */
+        ~SoundLevelDetector();
+
+        /**
+         * Start measuring the audio stream, if not already doing so.
+         *
+         * @param persistent If true, measurement continues until deactivate() is called, as needed to generate
+         * threshold events. Otherwise it stops CONFIG_SOUND_LEVEL_DETECTOR_TIMEOUT ms after the last getValue().
+         * @return DEVICE_OK.
+         */
+        int activate(bool persistent = false);
+
+        /**
+         * Stop measuring the audio stream, and disconnect from it.
+         * @return DEVICE_OK.
+         */
+        int deactivate();
+
+        /**
+         * Determine the level of the most recent integration window.
+         * If measurement was not running, it is started and this call waits for the first window to complete.
+         *
+         * @param scale SOUND_LEVEL_DETECTOR_DB for a value in dB, or SOUND_LEVEL_DETECTOR_8BIT for a value
+         * in the range 0..255.
+         * @return the level, or DEVICE_INVALID_PARAMETER if the scale is not recognised.
+         */
+        int getValue(int scale = SOUND_LEVEL_DETECTOR_DB);
+
+        /**
+         * Determine the RMS amplitude of the most recent integration window, in units of a 16 bit sample.
+         */
+        int getRms();
+
+        /**
+         * Determine the peak amplitude of the most recent integration window, in units of a 16 bit sample.
+         */
+        int getPeak();
+
+        /**
+         * Define the integration window.
+         * @param milliseconds The length of the window, in milliseconds.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the window is not positive.
+         */
+        int setWindow(int milliseconds);
+
+        /**
+         * Determine the integration window.
+         * @return The length of the window, in milliseconds.
+         */
+        int getWindow();
+
+        /**
+         * Define the level above which a SOUND_LEVEL_DETECTOR_EVT_HIGH event is raised.
+         * @param value The threshold, in dB.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if it is below the low threshold.
+         */
+        int setHighThreshold(int value);
+
+        /**
+         * Define the level below which a SOUND_LEVEL_DETECTOR_EVT_LOW event is raised.
+         * @param value The threshold, in dB.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if it is above the high threshold.
+         */
+        int setLowThreshold(int value);
+
+        /**
+         * Determine the high threshold, in dB.
+         */
+        int getHighThreshold();
+
+        /**
+         * Determine the low threshold, in dB.
+         */
+        int getLowThreshold();
+
+        /**
+         * Define the level (in dB) corresponding to an RMS amplitude of one unit of a 16 bit sample.
+         * @param offset The calibration offset, in dB.
+         */
+        void setCalibration(int offset);
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest();
+
+        private:
+
+        /**
+         * Complete the current integration window, updating the level and raising any threshold events.
+         */
+        void endWindow();
+
+        /**
+         * Handle internal events, on a fiber.
+         */
+        void onIdle(Event);
+    };
+
+    /**
+     * Compute 200 * log10(x), i.e. the level of amplitude x in tenths of a dB, using integer arithmetic.
+     * @param x The amplitude. Must be positive.
+     * @return The level, accurate to within 0.1 dB.
+     */
+    int sound_level_decibels(uint32_t x);
+}
+
+#endif
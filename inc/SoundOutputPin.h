@@ -30,17 +30,30 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "MicroBitCompat.h"
 #include "Mixer2.h"
-#include "SoundEmojiSynthesizer.h"
+#include "DataStream.h"
 
+// Length of each block of audio rendered, in milliseconds. Changes to the pin take effect on the next block.
 #ifndef CONFIG_SOUND_OUTPUT_PIN_PERIOD
 #define CONFIG_SOUND_OUTPUT_PIN_PERIOD  5
 #endif
 
+// Time the pin must remain silent (in milliseconds) before audio generation is suspended.
 #ifndef CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE
 #define CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE  100
 #endif
 
-#define SOUND_OUTPUT_PIN_STATUS_ACTIVE        0x0001        // Synthesizer is actively generating sound
+#ifndef CONFIG_SOUND_OUTPUT_PIN_SAMPLE_RATE
+#define CONFIG_SOUND_OUTPUT_PIN_SAMPLE_RATE  44100
+#endif
+
+#define SOUND_OUTPUT_PIN_SAMPLE_RANGE               1023
+#define SOUND_OUTPUT_PIN_BUFFER_SAMPLES             ((CONFIG_SOUND_OUTPUT_PIN_SAMPLE_RATE * CONFIG_SOUND_OUTPUT_PIN_PERIOD) / 1000)
+
+#define SOUND_OUTPUT_PIN_STATUS_ACTIVE              0x0001        // Square wave is actively being streamed into the mixer
+#define SOUND_OUTPUT_PIN_STATUS_GATE_PENDING        0x0002        // A silence gate timer event is scheduled
+#define SOUND_OUTPUT_PIN_STATUS_GATED               0x0004        // Silence gate has expired, stream will stop on the next pull()
+
+#define SOUND_OUTPUT_PIN_EVT_SILENCE_GATE           1
 
 /**
   * Class definition for a SoundPin.
@@ -49,17 +62,18 @@ DEALINGS IN THE SOFTWARE.
   */
 namespace codal
 {
-    class SoundOutputPin : public codal::Pin, public CodalComponent
+    class SoundOutputPin : public codal::Pin, public CodalComponent, public DataSource
     {
     private:
         Mixer2                  &mixer;
         MixerChannel            *channel;
-        SoundEmojiSynthesizer   synth;
-        ManagedBuffer           outputBuffer;
-        SoundEffect             *fx;
+        DataSink                *downStream;
         int                     periodUs;
         int                     value;
         uint32_t                timeOfLastUpdate;
+        volatile uint32_t       position;               // Phase accumulator of the square wave.
+        volatile uint32_t       skip;                   // Phase increment per sample.
+        volatile uint16_t       amplitude;              // Half the peak to peak level of the square wave, zero for silence.
 
     public:
 
@@ -135,10 +149,22 @@ namespace codal
         virtual int getAnalogPeriod() override;
 
         /**
-          * Callback when the device is idling. We use this to determine long periods of silence,
-          * and disable the synthesizer.
-          */
-        virtual void idleCallback() override;
+         * Define a downstream component for data stream.
+         *
+         * @sink The component that data will be delivered to, when it is availiable
+         */
+        virtual void connect(DataSink &sink) override;
+
+        /**
+         *  Determine the data format of the buffers streamed out of this component.
+         */
+        virtual int getFormat() override;
+
+        /**
+         * Provide the next block of square wave samples to our downstream caller.
+         * Once the pin has been silenced by the silence gate, an empty buffer is returned and the stream is left idle.
+         */
+        virtual ManagedBuffer pull() override;
 
         private:
 
@@ -146,6 +172,16 @@ namespace codal
          * Update the sound being played to match that requested.
          */
         void update();
+
+        /**
+         * Schedule a timer event to fire when the silence gate could next expire, unless one is already pending.
+         */
+        void scheduleGate(uint32_t delay);
+
+        /**
+         * Timer event handler. Suspends audio generation if the pin has been silent for longer than the silence gate.
+         */
+        void onSilenceGate(Event);
     };
 }
 
@@ -0,0 +1,260 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPECTRUM_ANALYSER_H
+#define SPECTRUM_ANALYSER_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "DataStream.h"
+#include "Event.h"
+
+// Number of samples in each analysis frame. Must be a power of four (64, 256 or 1024).
+#ifndef CONFIG_SPECTRUM_ANALYSER_SIZE
+#define CONFIG_SPECTRUM_ANALYSER_SIZE               256
+#endif
+
+// Number of new samples between successive frames. The default overlaps frames by half.
+#ifndef CONFIG_SPECTRUM_ANALYSER_HOP
+#define CONFIG_SPECTRUM_ANALYSER_HOP                (CONFIG_SPECTRUM_ANALYSER_SIZE / 2)
+#endif
+
+// Number of frequency bands that can be monitored for threshold crossings.
+#ifndef CONFIG_SPECTRUM_ANALYSER_BANDS
+#define CONFIG_SPECTRUM_ANALYSER_BANDS              4
+#endif
+
+// Sample rate of the microphone stream, in Hz.
+#ifndef CONFIG_SPECTRUM_ANALYSER_SAMPLE_RATE
+#define CONFIG_SPECTRUM_ANALYSER_SAMPLE_RATE        22000
+#endif
+
+#define DEVICE_ID_SPECTRUM_ANALYSER                 3042
+
+#if CONFIG_SPECTRUM_ANALYSER_HOP < 1 || CONFIG_SPECTRUM_ANALYSER_HOP > CONFIG_SPECTRUM_ANALYSER_SIZE
+#error "CONFIG_SPECTRUM_ANALYSER_HOP must be in the range 1..CONFIG_SPECTRUM_ANALYSER_SIZE"
+#endif
+
+#define SPECTRUM_ANALYSER_BINS                      (CONFIG_SPECTRUM_ANALYSER_SIZE / 2 + 1)
+
+// Number of overlapping frames that each sample belongs to, and so the number assembled at once.
+#define SPECTRUM_ANALYSER_FRAMES                    ((CONFIG_SPECTRUM_ANALYSER_SIZE + CONFIG_SPECTRUM_ANALYSER_HOP - 1) / CONFIG_SPECTRUM_ANALYSER_HOP)
+
+#define SPECTRUM_ANALYSER_STATUS_ACTIVE             0x01        // Connected to the audio stream.
+#define SPECTRUM_ANALYSER_STATUS_BUSY               0x02        // A frame is waiting to be (or being) analysed.
+#define SPECTRUM_ANALYSER_STATUS_VALID              0x04        // At least one frame has been analysed.
+
+// Events. Each band b raises SPECTRUM_ANALYSER_EVT_BAND_HIGH(b) when its energy rises above its high threshold,
+// and SPECTRUM_ANALYSER_EVT_BAND_LOW(b) when it falls back below its low threshold.
+#define SPECTRUM_ANALYSER_EVT_FRAME                 1           // Internal: a frame is ready to be analysed.
+#define SPECTRUM_ANALYSER_EVT_BAND_HIGH(b)          (2 + 2 * (b))
+#define SPECTRUM_ANALYSER_EVT_BAND_LOW(b)           (3 + 2 * (b))
+
+namespace codal
+{
+    /**
+     * A band of frequencies monitored by a SpectrumAnalyser.
+     */
+    struct SpectrumBand
+    {
+        uint16_t    lowBin;                     // First bin in the band.
+        uint16_t    highBin;                    // Last bin in the band (inclusive). Zero if the band is unused.
+        uint32_t    highThreshold;              // Energy above which a BAND_HIGH event is raised.
+        uint32_t    lowThreshold;               // Energy below which a BAND_LOW event is raised.
+        bool        high;                       // True if the band is currently above its threshold.
+    };
+
+    /**
+     * Class definition for a SpectrumAnalyser.
+     *
+     * Performs a fixed-point radix-4 FFT over Hann windowed, overlapping frames of an audio stream (typically
+     * the microphone), providing the magnitude spectrum, band energies and peak frequency. Bands can be
+     * monitored for threshold crossings, raising events, so that applications need not analyse audio themselves.
+     *
+     * Samples are windowed as they arrive, into each of the overlapping frames they belong to, so a completed
+     * frame only needs copying into the FFT buffer. The transform itself runs on a fiber, once per hop. If a
+     * frame is still being analysed when the next is due, the new frame is skipped.
+     *
+     * Magnitudes are scaled such that a full scale sine wave measures approximately 8192 in its bin.
+     */
+    class SpectrumAnalyser : public DataSink, public CodalComponent
+    {
+        private:
+        DataSource          &upstream;              // The stream of audio to analyse.
+        int                 sampleRate;             // The sample rate of the stream, in Hz.
+
+        int16_t             *window;                // SPECTRUM_ANALYSER_FRAMES overlapping frames of windowed samples, being assembled.
+        int16_t             *fft;                   // Interleaved complex FFT buffer.
+        uint16_t            *magnitude;             // Magnitude of each bin of the last analysed frame.
+        int                 frameSlot;              // Index into window of the frame completed at the end of this hop.
+        int                 hopCount;               // Samples received since the last frame.
+        uint32_t            frames;                 // Frames analysed.
+        uint32_t            skipped;                // Frames skipped because the previous frame was still being analysed.
+
+        int                 peakBin;                // Bin with the largest magnitude (excluding DC).
+        int                 peakFrequency;          // Interpolated frequency of peakBin, in Hz.
+
+        SpectrumBand        bands[CONFIG_SPECTRUM_ANALYSER_BANDS];
+
+        public:
+
+        /**
+         * Constructor.
+         *
+         * @param source The stream of audio to analyse. 8 and 16 bit signed formats are supported.
+         * @param sampleRate The sample rate of the stream, in Hz.
+         * @param id The event ID to raise band events on.
+         * @param connectImmediately If true, analysis starts immediately. Otherwise it starts on first use.
+         */
+        SpectrumAnalyser(DataSource &source, int sampleRate = CONFIG_SPECTRUM_ANALYSER_SAMPLE_RATE, uint16_t id = DEVICE_ID_SPECTRUM_ANALYSER, bool connectImmediately = false);
+
+        /**
+         * Destructor.
+         */
+        ~SpectrumAnalyser();
+
+        /**
+         * Start analysing the audio stream, if not already doing so.
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if memory could not be allocated.
+         */
+        int activate();
+
+        /**
+         * Stop analysing the audio stream, and release the memory used.
+         * @return DEVICE_OK on success.
+         */
+        int deactivate();
+
+        /**
+         * Determine the magnitude of the given bin, from the last analysed frame.
+         *
+         * @param bin The bin, in the range 0..SPECTRUM_ANALYSER_BINS-1.
+         * Bin k is centred on k * sampleRate / CONFIG_SPECTRUM_ANALYSER_SIZE Hz.
+         * @return the magnitude, or DEVICE_INVALID_PARAMETER if the bin is out of range.
+         */
+        int getMagnitude(int bin);
+
+        /**
+         * Determine the energy (sum of squared magnitudes) of the given range of frequencies, from the last analysed frame.
+         *
+         * @param lowFrequency The lowest frequency of interest, in Hz.
+         * @param highFrequency The highest frequency of interest, in Hz.
+         * @return the energy of the bins covering the given frequencies, or DEVICE_INVALID_PARAMETER.
+         */
+        int getBandEnergy(int lowFrequency, int highFrequency);
+
+        /**
+         * Determine the frequency of the loudest sound, from the last analysed frame.
+         * @return the frequency, in Hz.
+         */
+        int getPeakFrequency();
+
+        /**
+         * Determine the magnitude of the loudest frequency, from the last analysed frame.
+         * @return the magnitude.
+         */
+        int getPeakMagnitude();
+
+        /**
+         * Monitor a band of frequencies, raising SPECTRUM_ANALYSER_EVT_BAND_HIGH(band) and SPECTRUM_ANALYSER_EVT_BAND_LOW(band)
+         * events as its energy crosses the given thresholds. Analysis starts, if it hasn't already.
+         *
+         * @param band The band to configure, in the range 0..CONFIG_SPECTRUM_ANALYSER_BANDS-1.
+         * @param lowFrequency The lowest frequency of the band, in Hz.
+         * @param highFrequency The highest frequency of the band, in Hz.
+         * @param highThreshold The energy above which the band is considered active.
+         * @param lowThreshold The energy below which the band is considered inactive again. Defaults to half of highThreshold.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int setBand(int band, int lowFrequency, int highFrequency, uint32_t highThreshold, uint32_t lowThreshold = 0);
+
+        /**
+         * Stop monitoring the given band.
+         *
+         * @param band The band to clear.
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+         */
+        int clearBand(int band);
+
+        /**
+         * Determine the number of frames analysed since activation.
+         */
+        uint32_t getFrameCount();
+
+        /**
+         * Determine the number of frames skipped because analysis could not keep up.
+         */
+        uint32_t getSkippedFrames();
+
+        /**
+         * Determine the heap memory held by this analyser, including its frame buffers while active.
+         * @return The size in bytes.
+         */
+        int getHeapUsage();
+
+        /**
+         * Callback provided when data is ready.
+         */
+        virtual int pullRequest() override;
+
+        private:
+
+        /**
+         * Convert a frequency to the nearest bin, clamped to the valid range.
+         */
+        int frequencyToBin(int frequency);
+
+        /**
+         * Sum the squared magnitudes of the given bins, saturating.
+         */
+        uint32_t energy(int lowBin, int highBin);
+
+        /**
+         * Copy the completed frame in the given slot of window into the FFT buffer.
+         */
+        void loadFrame(int slot);
+
+        /**
+         * Analyse a frame, on a fiber.
+         */
+        void onFrame(Event);
+    };
+
+    /**
+     * In place, forward complex FFT of CONFIG_SPECTRUM_ANALYSER_SIZE points, radix-4, decimation in frequency.
+     * Each stage scales by 1/4, so the output is scaled by 1/size and cannot overflow.
+     * The output is left in base-4 digit reversed order.
+     *
+     * @param data Interleaved real and imaginary Q15 values.
+     * @param size The number of points, a power of four no greater than 1024.
+     */
+    void spectrum_fft_radix4(int16_t *data, int size);
+
+    /**
+     * Determine the position in the output of spectrum_fft_radix4() of the given bin.
+     */
+    int spectrum_digit_reverse(int index, int size);
+}
+
+#endif
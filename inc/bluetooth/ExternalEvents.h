@@ -32,9 +32,15 @@ DEALINGS IN THE SOFTWARE.
 
 #define MICROBIT_ID_BLE             1000
 #define MICROBIT_ID_BLE_UART        1200
+#define MICROBIT_ID_BLE_SENSOR_STREAM 1201
+#define MICROBIT_ID_BLE_LOG         1202
+#define MICROBIT_ID_BLE_BENCHMARK   1203
+#define MICROBIT_ID_BLE_IO_PIN      1204
 
 #define MICROBIT_BLE_EVT_CONNECTED      1
 #define MICROBIT_BLE_EVT_DISCONNECTED   2
+#define MICROBIT_BLE_EVT_CONNECTION_UPDATED 3
+#define MICROBIT_BLE_EVT_PHY_UPDATED    4
 
 #include "MESEvents.h"
 
@@ -34,6 +34,12 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEService.h"
 #include "MicroBitAccelerometer.h"
 #include "EventModel.h"
+#include "nrf_sdh_ble.h"
+
+// Largest batch notification: a 4 byte timestamp, followed by 8 byte samples.
+#define MICROBIT_ACCELEROMETER_S_BATCHSIZE      (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+#define MICROBIT_ACCELEROMETER_S_HEADERSIZE     4
+#define MICROBIT_ACCELEROMETER_S_SAMPLESIZE     8
 
 
 /**
@@ -51,6 +57,18 @@ class MicroBitAccelerometerService : public MicroBitBLEService
       */
     MicroBitAccelerometerService( BLEDevice &_ble, codal::Accelerometer &_accelerometer);
 
+    /**
+      * Configure the batch characteristic.
+      * While the connected device has enabled its notifications, samples are collected and sent together,
+      * up to as many as fit into the negotiated MTU, instead of being notified one at a time.
+      *
+      * @param samples the number of samples to send in each notification, or 0 to fill the MTU.
+      * @param latency the longest time in milliseconds to hold a sample before sending the batch, from 1 to 60000.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the values are out of range.
+      */
+    int setBatch( int samples, int latency = MICROBIT_ACCELEROMETER_SERVICE_BATCH_LATENCY);
+
     private:
 
     /**
@@ -68,6 +86,22 @@ class MicroBitAccelerometerService : public MicroBitBLEService
       */
     void onDataWritten( const microbit_ble_evt_write_t *params);
 
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Add the latest sample to the batch, and send the batch if it is full or old enough.
+      */
+    void batchSample();
+
+    /**
+      * Send the batch, if there is one.
+      * @return true if the batch was sent or is empty, false if the SoftDevice's queue is full.
+      */
+    bool batchSend();
+
     /**
       * Helper function to read the values
       */
@@ -88,12 +122,20 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     // memory for our 8 bit control characteristics.
     uint16_t            accelerometerDataCharacteristicBuffer[3];
     uint16_t            accelerometerPeriodCharacteristicBuffer;
+    uint16_t            accelerometerBatchConfigCharacteristicBuffer[2];
+    uint8_t             accelerometerBatchCharacteristicBuffer[ MICROBIT_ACCELEROMETER_S_BATCHSIZE];
+
+    // Samples in the batch, and whether it is full and waiting for space in the SoftDevice's queue.
+    uint16_t            batchCount;
+    bool                batchPending;
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
     {
         mbbs_cIdxDATA,
         mbbs_cIdxPERIOD,
+        mbbs_cIdxBATCH,
+        mbbs_cIdxBATCHCONFIG,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
@@ -56,6 +56,19 @@ DEALINGS IN THE SOFTWARE.
 // CodalComponent status flags
 #define MICROBIT_BLE_STATUS_DISCONNECT          0x04
 #define MICROBIT_BLE_STATUS_SHUTDOWN            0x08
+#define MICROBIT_BLE_STATUS_SERVICES_CHANGED    0x10
+
+// Connection profiles, c.f. setConnectionProfile()
+#define MICROBIT_BLE_CONNECTION_PROFILE_DEFAULT     0   // 10-20ms interval, no slave latency. Used from startup.
+#define MICROBIT_BLE_CONNECTION_PROFILE_LOW_LATENCY 1   // 7.5-15ms interval, no slave latency, for interactive use.
+#define MICROBIT_BLE_CONNECTION_PROFILE_BULK        2   // 15-30ms interval on the 2M PHY, for streaming with long connection events.
+#define MICROBIT_BLE_CONNECTION_PROFILE_LOW_POWER   3   // 100-200ms interval, slave latency 4, for idle connections.
+
+// Physical layers, c.f. setPHY(). These may be combined to allow the central to choose between them.
+#define MICROBIT_BLE_PHY_AUTO                   0x00
+#define MICROBIT_BLE_PHY_1M                     0x01
+#define MICROBIT_BLE_PHY_2M                     0x02
+#define MICROBIT_BLE_PHY_CODED                  0x04
 
 // micro:bit Modes
 // The micro:bit may be in different states: running a user's application or into BLE pairing mode
@@ -63,6 +76,30 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_MODE_PAIRING                   0
 #define MICROBIT_MODE_APPLICATION               1
 
+/**
+  * Link statistics, c.f. MicroBitBLEManager::getStatistics().
+  * Counters run from startup, or the last call to resetStatistics(). The other values describe the current connection,
+  * and are zero while not connected.
+  */
+struct MicroBitBLEStatistics
+{
+    uint8_t     disconnectReason;       // The HCI status code of the last disconnection, e.g. 0x08 for a supervision timeout.
+    int8_t      rssi;                   // The received signal strength, in dBm.
+    uint8_t     phy;                    // The physical layer in use, as returned by getPHY().
+    uint8_t     reserved;
+    uint16_t    mtu;                    // The ATT MTU in use.
+    uint16_t    slaveLatency;           // The slave latency in use.
+    uint32_t    interval;               // The connection interval in use, in microseconds.
+    uint32_t    connections;            // Connections made.
+    uint32_t    disconnections;         // Connections closed or lost.
+    uint32_t    supervisionTimeouts;    // Connections lost because the central stopped being heard.
+    uint32_t    connectionUpdates;      // Changes of connection parameters.
+    uint32_t    phyUpdates;             // Changes of physical layer.
+    uint32_t    txEvents;               // Connection events in which notifications were sent.
+    uint32_t    txPackets;              // Notifications sent.
+    uint32_t    txRejected;             // Notifications refused because the queue, or the service's credits, were full.
+};
+
 class MicroBitBLEManager;
 typedef MicroBitBLEManager BLEDevice;
 
@@ -156,9 +193,17 @@ class MicroBitBLEManager : public CodalComponent
     /**
      * When called, the micro:bit will begin advertising for a predefined period,
      * MICROBIT_BLE_ADVERTISING_TIMEOUT seconds to bonded devices.
+     * Advertising backs off to MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL after MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT seconds.
      */
     void advertise();
 
+    /**
+     * Return to fast advertising, at the interval advertising was configured with, for another
+     * MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT seconds. Does nothing unless advertising has backed off
+     * to MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL.
+     */
+    void wakeAdvertising();
+
     /**
      * Determines the number of devices currently bonded with this micro:bit.
      * @return The number of active bonds.
@@ -182,7 +227,7 @@ class MicroBitBLEManager : public CodalComponent
     bool pairingComplete( int event);
 
     /**
-     * Periodic callback in thread context.
+     * Callback in thread context, made while a disconnect, services changed or shutdown request is outstanding.
      * We use this here purely to safely issue a disconnect operation after a pairing operation is complete.
 	 */
     void idleCallback();
@@ -203,6 +248,88 @@ class MicroBitBLEManager : public CodalComponent
      */
     bool getConnected();
 
+    /**
+     * Request the connection parameters to use, now and for future connections.
+     * The central decides the parameters used. MICROBIT_BLE_EVT_CONNECTION_UPDATED is raised when they change.
+     *
+     * @param minInterval the shortest acceptable connection interval, in microseconds, from 7500 to 4000000.
+     * @param maxInterval the longest acceptable connection interval, in microseconds, from minInterval to 4000000.
+     * @param slaveLatency the number of connection events we may skip when we have nothing to send, from 0 to 499.
+     * @param timeout the supervision timeout, in milliseconds, from 100 to 32000. This must exceed twice the
+     *        longest interval, multiplied by one more than the slave latency.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the parameters are out of range.
+     */
+    int setConnectionParameters(int minInterval, int maxInterval, int slaveLatency = 0, int timeout = 4000);
+
+    /**
+     * Request connection parameters, and a PHY, suited to a style of use.
+     *
+     * @param profile one of MICROBIT_BLE_CONNECTION_PROFILE_DEFAULT, MICROBIT_BLE_CONNECTION_PROFILE_LOW_LATENCY,
+     *        MICROBIT_BLE_CONNECTION_PROFILE_BULK or MICROBIT_BLE_CONNECTION_PROFILE_LOW_POWER.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the profile is unknown.
+     */
+    int setConnectionProfile(int profile);
+
+    /**
+     * Request the physical layer used for connections, now and in response to future requests from the central.
+     * MICROBIT_BLE_EVT_PHY_UPDATED is raised when it changes.
+     *
+     * @param phys MICROBIT_BLE_PHY_AUTO, or a combination of MICROBIT_BLE_PHY_1M, MICROBIT_BLE_PHY_2M and MICROBIT_BLE_PHY_CODED.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the value is out of range,
+     *         or DEVICE_NOT_SUPPORTED if the SoftDevice does not support the PHY requested.
+     */
+    int setPHY(int phys);
+
+    /**
+     * Determine the connection interval in use.
+     * @return the interval in microseconds, or 0 if not connected
+     */
+    int getConnectionInterval();
+
+    /**
+     * Determine the slave latency in use.
+     * @return the number of connection events we may skip, or 0 if not connected
+     */
+    int getSlaveLatency();
+
+    /**
+     * Determine the supervision timeout in use.
+     * @return the timeout in milliseconds, or 0 if not connected
+     */
+    int getSupervisionTimeout();
+
+    /**
+     * Determine the physical layer in use.
+     * @return MICROBIT_BLE_PHY_1M, MICROBIT_BLE_PHY_2M or MICROBIT_BLE_PHY_CODED, or MICROBIT_BLE_PHY_AUTO if not connected
+     */
+    int getPHY();
+
+    /**
+     * Determine the ATT MTU negotiated with the connected device.
+     * A notification or indication can carry up to getMTU() - 3 bytes.
+     * @return the effective MTU, or 23 (the minimum) if not connected
+     */
+    int getMTU();
+
+    /**
+     * Retrieve the link statistics, with the current connection's RSSI, MTU, PHY and parameters.
+     * @return the statistics.
+     */
+    MicroBitBLEStatistics getStatistics();
+
+    /**
+     * Restart the link statistics' counters from zero.
+     */
+    void resetStatistics();
+
+    /**
+     * Count a notification refused for lack of room, c.f. MicroBitBLEService::notifyChrValue().
+     */
+    void notificationRejected();
+
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL)
     /**
       * Set the content of Eddystone URL frames
@@ -287,12 +414,36 @@ class MicroBitBLEManager : public CodalComponent
       */
     virtual int setSleep(bool doSleep) override;
 
+    /**
+     * Record that a service has been added to the GATT table.
+     *
+     * Services created after init(), typically the first time a program uses one, change the
+     * attribute table a bonded client may have cached. Service Changed is then signalled from the
+     * idle callback, rather than from within the constructor of the service being added.
+     */
+    void serviceAdded();
+
     /**
     * Ensure service changed indication pending for all peers
     */
     void servicesChanged();
       
   private:
+    /**
+     * Wake advertising from its slow interval when a button is pressed.
+     *
+     * @param e The button event.
+     */
+    void onButton(MicroBitEvent e);
+
+    /**
+     * Determine whether the GATT table differs from the one built at the last boot, by comparing
+     * a hash of its handles and UUIDs with the one held in storage. The new hash is stored when it changes.
+     *
+     * @return true if the table has changed, or no previous hash is available.
+     */
+    bool gattTableChanged();
+
     /**
     * Displays the device's ID code as a histogram on the provided MicroBitDisplay instance.
     *
@@ -0,0 +1,201 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BENCHMARK_SERVICE_H
+#define MICROBIT_BENCHMARK_SERVICE_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEManager.h"
+#include "MicroBitBLEService.h"
+#include "EventModel.h"
+#include "nrf_sdh_ble.h"
+
+// Tests, written to the control characteristic and echoed in its notifications.
+#define MICROBIT_BENCHMARK_SERVICE_NOTIFY       0x01
+#define MICROBIT_BENCHMARK_SERVICE_WRITE        0x02
+#define MICROBIT_BENCHMARK_SERVICE_LATENCY      0x03
+#define MICROBIT_BENCHMARK_SERVICE_STOP         0x04
+
+// Status codes, following the test in control notifications.
+#define MICROBIT_BENCHMARK_SERVICE_OK           0xFF
+#define MICROBIT_BENCHMARK_SERVICE_ERROR        0xAA
+
+// Event codes, raised on MICROBIT_ID_BLE_BENCHMARK.
+#define MICROBIT_BENCHMARK_SERVICE_EVT_START    1
+#define MICROBIT_BENCHMARK_SERVICE_EVT_SEND     2
+#define MICROBIT_BENCHMARK_SERVICE_EVT_COMPLETE 3       // A test has finished, and getResult() holds its results.
+
+// Largest data notification.
+#define MICROBIT_BENCHMARK_S_ATTRSIZE           (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
+/**
+  * The results of a test, as held by the result characteristic. All values are little endian.
+  */
+struct MicroBitBenchmarkResult
+{
+    uint8_t     test;               // The test run, MICROBIT_BENCHMARK_SERVICE_NOTIFY, _WRITE or _LATENCY.
+    uint8_t     phy;                // The physical layer in use, as returned by MicroBitBLEManager::getPHY().
+    uint16_t    mtu;                // The ATT MTU in use.
+    uint32_t    interval;           // The connection interval in use, in microseconds.
+    uint16_t    slaveLatency;       // The slave latency in use.
+    uint16_t    maxPerEvent;        // The most notifications sent in one connection event.
+    uint32_t    packets;            // The number of packets sent, received or echoed.
+    uint32_t    bytes;              // The number of bytes of data they carried.
+    uint32_t    elapsed;            // The duration of the test, in microseconds.
+    uint32_t    latencyMin;         // The shortest, longest and mean round trip, in microseconds.
+    uint32_t    latencyMax;
+    uint32_t    latencyMean;
+};
+
+
+/**
+  * Class definition for the MicroBit BLE Benchmark Service.
+  * Measures throughput and latency with the current connection parameters, MTU and PHY.
+  *
+  * Each test is started by writing to the control characteristic:
+  *
+  * | NOTIFY | DURATION (2 bytes) | fills the data characteristic with notifications of the negotiated MTU,
+  * as fast as the SoftDevice will send them, for DURATION milliseconds.
+  *
+  * | WRITE | DURATION (2 bytes) | counts the writes without response made to the data characteristic,
+  * for DURATION milliseconds from the first.
+  *
+  * | LATENCY | COUNT (2 bytes) | notifies the data characteristic with | SEQUENCE |, COUNT times. Each must be written
+  * back to it, by write without response, before the next is sent.
+  *
+  * Writing | STOP | ends the test early. When a test ends, the result characteristic holds a MicroBitBenchmarkResult
+  * and the control characteristic notifies | TEST | OK |. A test that cannot be started notifies | TEST | ERROR |.
+  */
+class MicroBitBenchmarkService : public MicroBitBLEService
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create a representation of the BenchmarkService
+      * @param _ble The instance of a BLE device that we're running on.
+      */
+    MicroBitBenchmarkService( BLEDevice &_ble);
+
+    /**
+      * Retrieve the results of the last test.
+      *
+      * @return the results, valid once MICROBIT_BENCHMARK_SERVICE_EVT_COMPLETE has been raised.
+      */
+    const MicroBitBenchmarkResult &getResult()  { return result; }
+
+    /**
+      * Determine whether a test is running.
+      *
+      * @return true if a test is running.
+      */
+    bool isRunning()                            { return test != 0; }
+
+    private:
+
+    /**
+      * Invoked when BLE disconnects.
+      */
+    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Callback. Invoked when any of our attributes are written via BLE.
+      */
+    void onDataWritten( const microbit_ble_evt_write_t *params);
+
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Start tests and report their results outside of the BLE event handler.
+      */
+    void benchmarkServiceEvent( MicroBitEvent e);
+
+    /**
+      * Queue as many notifications as the SoftDevice will take, until the notify test's time is up.
+      */
+    void sendNext();
+
+    /**
+      * Send the next round trip of the latency test, or end it.
+      */
+    void sendPing();
+
+    /**
+      * End the test in progress, recording the connection it ran on.
+      */
+    void finish();
+
+    /**
+      * Notify the outcome of a test.
+      */
+    void notifyControl( uint8_t code, uint8_t status);
+
+    // memory for our characteristics.
+    uint8_t             controlCharacteristicBuffer[3];
+    uint8_t             dataCharacteristicBuffer[ MICROBIT_BENCHMARK_S_ATTRSIZE];
+    uint8_t             resultCharacteristicBuffer[ sizeof( MicroBitBenchmarkResult)];
+
+    // The test requested, and its progress.
+    volatile uint8_t    test;
+    uint8_t             requestTest;
+    uint16_t            requestParameter;
+    uint8_t             sequence;
+    uint32_t            queued;             // Notifications queued, or round trips still to make.
+    uint32_t            startTime;
+    uint32_t            sentTime;
+    uint32_t            latencyTotal;
+
+    MicroBitBenchmarkResult result;
+
+    // Index for each charactersitic in arrays of handles and UUIDs
+    typedef enum mbbs_cIdx
+    {
+        mbbs_cIdxCONTROL,
+        mbbs_cIdxDATA,
+        mbbs_cIdxRESULT,
+        mbbs_cIdxCOUNT
+    } mbbs_cIdx;
+
+    // UUIDs for our service and characteristics
+    static const uint16_t serviceUUID;
+    static const uint16_t charUUID[ mbbs_cIdxCOUNT];
+
+    // Data for each characteristic when they are held by Soft Device.
+    MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
+
+    public:
+
+    int              characteristicCount()          { return mbbs_cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+
+#endif
+#endif
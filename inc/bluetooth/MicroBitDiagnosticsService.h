@@ -0,0 +1,94 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_DIAGNOSTICS_SERVICE_H
+#define MICROBIT_DIAGNOSTICS_SERVICE_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEManager.h"
+#include "MicroBitBLEService.h"
+
+
+/**
+  * Class definition for the MicroBit BLE Diagnostics Service.
+  * Reports the link statistics kept by MicroBitBLEManager, so throughput problems can be investigated without a sniffer.
+  *
+  * Reading the statistics characteristic returns a MicroBitBLEStatistics, little endian, as at the start of the read.
+  * Writing any value to it restarts the counters from zero.
+  */
+class MicroBitDiagnosticsService : public MicroBitBLEService
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create a representation of the DiagnosticsService
+      * @param _ble The instance of a BLE device that we're running on.
+      */
+    MicroBitDiagnosticsService( BLEDevice &_ble);
+
+    private:
+
+    /**
+      * Callback. Invoked when any of our attributes are written via BLE.
+      */
+    void onDataWritten( const microbit_ble_evt_write_t *params);
+
+    /**
+      * Callback. Invoked when any of our attributes are read via BLE.
+      */
+    void onDataRead( microbit_onDataRead_t *params);
+
+    // The BLE manager that keeps the statistics.
+    BLEDevice           &ble;
+
+    // memory for our characteristics.
+    MicroBitBLEStatistics statisticsCharacteristicBuffer;
+
+    // Index for each charactersitic in arrays of handles and UUIDs
+    typedef enum mbbs_cIdx
+    {
+        mbbs_cIdxSTATISTICS,
+        mbbs_cIdxCOUNT
+    } mbbs_cIdx;
+
+    // UUIDs for our service and characteristics
+    static const uint16_t serviceUUID;
+    static const uint16_t charUUID[ mbbs_cIdxCOUNT];
+
+    // Data for each characteristic when they are held by Soft Device.
+    MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
+
+    public:
+
+    int              characteristicCount()          { return mbbs_cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+
+#endif
+#endif
@@ -34,6 +34,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEService.h"
 #include "MicroBitEvent.h"
 #include "EventModel.h"
+#include "nrf_sdh_ble.h"
 
 
 struct EventServiceEvent
@@ -42,6 +43,9 @@ struct EventServiceEvent
     uint16_t    reason;
 };
 
+// Most events that fit into a notification or read.
+#define MICROBIT_EVENT_SERVICE_S_EVENTS         ((NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3) / sizeof(EventServiceEvent))
+
 
 /**
   * Class definition for a MicroBit BLE Event Service.
@@ -60,7 +64,7 @@ class MicroBitEventService : public MicroBitBLEService, MicroBitComponent
     MicroBitEventService(BLEDevice &_ble, EventModel &_messageBus);
 
     /**
-     * Periodic callback from MicroBit scheduler.
+     * Periodic callback from MicroBit scheduler, made while a client has read our requirements.
      * If we're no longer connected, remove any registered Message Bus listeners.
      */
     virtual void idleCallback();
@@ -72,28 +76,51 @@ class MicroBitEventService : public MicroBitBLEService, MicroBitComponent
 
     /**
       * Callback. Invoked when any events are sent on the microBit message bus.
+      * Events are queued, and sent as soon as the SoftDevice has room for them.
       */
     void onMicroBitEvent(MicroBitEvent evt);
 
+    /**
+      * Callback. Invoked when BLE disconnects.
+      */
+    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
     /**
       * Read callback on microBitRequirements characteristic.
       * Set  params->data and params->length to update the value
       *
       * Used to iterate through the events that the code on this micro:bit is interested in.
+      * The microBitRequirementsBulk characteristic returns as many of them as fit into each read.
       */
     void onDataRead( microbit_onDataRead_t *params);
 
     private:
 
+    /**
+      * Send the queued events, as many to each notification as fit, until the SoftDevice's queue is full.
+      */
+    void sendNext();
+
     // messageBus we're using.
 	EventModel	        &messageBus;
 
     // memory for our event characteristics.
     EventServiceEvent   clientEventBuffer;
-    EventServiceEvent   microBitEventBuffer;
+    EventServiceEvent   microBitEventBuffer[ MICROBIT_EVENT_SERVICE_S_EVENTS];
     EventServiceEvent   microBitRequirementsBuffer;
+    EventServiceEvent   microBitRequirementsBulkBuffer[ MICROBIT_EVENT_SERVICE_S_EVENTS];
     EventServiceEvent   clientRequirementsBuffer;
 
+    // Events waiting to be sent.
+    EventServiceEvent   eventQueue[ MICROBIT_EVENT_SERVICE_QUEUE_SIZE];
+    uint16_t            eventQueueHead;
+    uint16_t            eventQueueTail;
+
     // Message bus offset last sent to the client...
     uint16_t messageBusListenerOffset;
     
@@ -104,6 +131,7 @@ class MicroBitEventService : public MicroBitBLEService, MicroBitComponent
         mbbs_cIdxMREQ,
         mbbs_cIdxCEVENT,
         mbbs_cIdxCREQ,
+        mbbs_cIdxMREQBULK,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
@@ -33,11 +33,15 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
 #include "MicroBitIO.h"
+#include "EventModel.h"
 
 #define MICROBIT_IO_PIN_SERVICE_PINCOUNT       19
 #define MICROBIT_IO_PIN_SERVICE_DATA_SIZE      10
 #define MICROBIT_PWM_PIN_SERVICE_DATA_SIZE     2
 
+// Event codes, raised on MICROBIT_ID_BLE_IO_PIN.
+#define MICROBIT_IO_PIN_SERVICE_EVT_SAMPLE     1
+
 /**
   * Name value pair definition, as used to read and write pin values over BLE.
   */
@@ -75,15 +79,43 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
     MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io);
 
     /**
-     * Periodic callback from MicroBit scheduler.
-     *
-     * Check if any of the pins we're watching need updating. Notify any connected
-     * device with any changes.
-     */
-    virtual void idleCallback();
+      * Set the time between samples of the pins being monitored.
+      * All the changes found by a sample are sent in one notification, so this also limits the notification rate.
+      *
+      * @param period the time between samples, in milliseconds, or 0 to stop monitoring.
+      *
+      * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the period is negative,
+      *         or MICROBIT_NO_RESOURCES if a timer event could not be allocated.
+      */
+    int setPeriod( int period);
+
+    /**
+      * Determine the time between samples of the pins being monitored.
+      *
+      * @return the period in milliseconds, or 0 if monitoring is stopped.
+      */
+    int getPeriod();
+
+    /**
+      * Set the change an analog input must make, from the value last sent, before a notification is sent for it.
+      *
+      * @param pin the enumeration of the pin.
+      * @param deadband the change required, from 1 to 255, in the 8 bit units reported.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the pin or deadband is out of range.
+      */
+    int setDeadband( int pin, int deadband);
 
     private:
 
+    /**
+      * Periodic sample handler.
+      *
+      * Check if any of the pins we're watching need updating. Notify any connected
+      * device with any changes.
+      */
+    void onSample( MicroBitEvent e);
+
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
       */
@@ -122,10 +154,11 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
 
     /**
      * Scans through all pins that our BLE client have registered an interest in. 
-     * For each pin that has changed value, update the BLE characteristic, and NOTIFY our client.
-     * @param updateAll if true, a notification will be sent for all registered inputs. Otherwise, 
-     * a notification will only be sent for inputs that have changed value.
-     * @return number of changed pins
+     * For each pin that has changed value by at least its deadband, update the BLE characteristic.
+     * Changes that don't fit are held, and sent by the next call.
+     * @param updateAll if true, the characteristic will hold all registered inputs. Otherwise, 
+     * it will only hold inputs that have changed value.
+     * @return number of pins in the characteristic, which are recorded in ioPinServiceSentPins.
      */
     int updateBLEInputs(bool updateAll = false);
 
@@ -148,6 +181,10 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
 
     // Historic information about our pin data data.
     uint8_t             ioPinServiceIOData[MICROBIT_IO_PIN_SERVICE_PINCOUNT];
+    uint8_t             ioPinServiceDeadband[MICROBIT_IO_PIN_SERVICE_PINCOUNT];
+    uint32_t            ioPinServiceChangedPins;        // Inputs that have changed since they were last sent.
+    uint32_t            ioPinServiceSentPins;           // Inputs held by the data characteristic.
+    int                 ioPinServicePeriod;
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
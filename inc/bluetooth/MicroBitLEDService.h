@@ -33,15 +33,37 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
 #include "MicroBitDisplay.h"
+#include "nrf_sdh_ble.h"
 
 // Defines the buffer size for scrolling text over BLE, hence also defines
 // the maximum string length that can be scrolled via the BLE service.
 #define MICROBIT_BLE_MAXIMUM_SCROLLTEXT         20
 
+// Defines the largest number of frames in an animation uploaded over BLE.
+#ifndef MICROBIT_BLE_MAXIMUM_ANIMATION_FRAMES
+#define MICROBIT_BLE_MAXIMUM_ANIMATION_FRAMES   32
+#endif
+
+// Commands, the first byte written to the animation characteristic.
+#define MICROBIT_LED_SERVICE_ANIMATION_BEGIN    0x01
+#define MICROBIT_LED_SERVICE_ANIMATION_DATA     0x02
+#define MICROBIT_LED_SERVICE_ANIMATION_PLAY     0x03
+
+// Largest write to the animation characteristic.
+#define MICROBIT_LED_S_ATTRSIZE                 (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
 
 /**
   * Class definition for the custom MicroBit LED Service.
   * Provides a BLE service to remotely read and write the state of the LED display.
+  *
+  * The frame characteristic holds the brightness of each LED, from 0 to 255, as 25 bytes in rows from the top left.
+  *
+  * The animation characteristic uploads frames in the same form, for the display to play at a steady rate:
+  * | BEGIN | FRAMES | INTERVAL (2 bytes) | starts an upload of FRAMES frames, shown for INTERVAL milliseconds each.
+  * | DATA | OFFSET (2 bytes) | BRIGHTNESS ... | sets the brightness of the LEDs from OFFSET, counted across all the frames.
+  * | PLAY | plays the animation uploaded, once. It can be played again without uploading it again.
+  * All values are little endian. Writes that are out of range are ignored.
   */
 class MicroBitLEDService : public MicroBitBLEService
 {
@@ -69,12 +91,23 @@ class MicroBitLEDService : public MicroBitBLEService
 
     private:
 
+    /**
+      * Upload or play an animation, as written to the animation characteristic.
+      */
+    void onAnimationWritten( const uint8_t *data, int length);
+
     MicroBitDisplay     &display;
 
     // memory for our characteristics.
     uint8_t             matrixValue[5];
     uint16_t            speedValue;
     uint8_t             textValue[MICROBIT_BLE_MAXIMUM_SCROLLTEXT];
+    uint8_t             frameValue[25];
+    uint8_t             animationValue[MICROBIT_LED_S_ATTRSIZE];
+
+    // The animation uploaded, as a strip of frames side by side.
+    MicroBitImage       animation;
+    uint16_t            animationInterval;
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -82,6 +115,8 @@ class MicroBitLEDService : public MicroBitBLEService
         mbbs_cIdxMATRIX,
         mbbs_cIdxTEXT,
         mbbs_cIdxSPEED,
+        mbbs_cIdxFRAME,
+        mbbs_cIdxANIMATION,
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
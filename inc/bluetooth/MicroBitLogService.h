@@ -0,0 +1,149 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_LOG_SERVICE_H
+#define MICROBIT_LOG_SERVICE_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEManager.h"
+#include "MicroBitBLEService.h"
+#include "MicroBitLog.h"
+#include "EventModel.h"
+#include "nrf_sdh_ble.h"
+
+// Control codes, written to the control characteristic and echoed in its notifications.
+#define MICROBIT_LOG_SERVICE_START          0x01
+#define MICROBIT_LOG_SERVICE_STOP           0x02
+
+// Status codes, following the control code in control notifications.
+#define MICROBIT_LOG_SERVICE_OK             0xFF
+#define MICROBIT_LOG_SERVICE_ERROR          0xAA
+
+// Event codes, raised on MICROBIT_ID_BLE_LOG to move work out of the BLE event handler.
+#define MICROBIT_LOG_SERVICE_EVT_START      1
+#define MICROBIT_LOG_SERVICE_EVT_STOP       2
+#define MICROBIT_LOG_SERVICE_EVT_SEND       3
+
+// Largest data notification, and its header: the offset of the data and its CRC32.
+#define MICROBIT_LOG_S_ATTRSIZE             (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+#define MICROBIT_LOG_S_HEADERSIZE           8
+
+
+/**
+  * Class definition for the MicroBit BLE Log Service.
+  * Exports the data recorded by MicroBitLog, in notifications that fill the negotiated MTU.
+  *
+  * Writing | START | FORMAT | OFFSET (4 bytes) | to the control characteristic exports the data in the DataFormat given,
+  * from the offset given, so that an interrupted transfer can be resumed. The control characteristic notifies
+  * | START | OK | LENGTH (4 bytes) | with the total length of the export, or | START | ERROR |.
+  *
+  * Each data notification holds | OFFSET (4 bytes) | CRC32 (4 bytes) | DATA |, with the CRC32 of the data alone.
+  * A notification with no data, at the end offset, completes the export. Writing | STOP | abandons it, and the
+  * control characteristic notifies | STOP | OK | OFFSET (4 bytes) | with the offset reached, or | STOP | ERROR |
+  * if the data could not be read. All values are little endian.
+  */
+class MicroBitLogService : public MicroBitBLEService
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create a representation of the LogService
+      * @param _ble The instance of a BLE device that we're running on.
+      * @param _log An instance of MicroBitLog to export.
+      */
+    MicroBitLogService( BLEDevice &_ble, codal::MicroBitLog &_log);
+
+    private:
+
+    /**
+      * Invoked when BLE disconnects.
+      */
+    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Callback. Invoked when any of our attributes are written via BLE.
+      */
+    void onDataWritten( const microbit_ble_evt_write_t *params);
+
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Start, stop and send the export outside of the BLE event handler, as MicroBitLog may need to wait.
+      */
+    void logServiceEvent( MicroBitEvent e);
+
+    /**
+      * Send as much of the export as the SoftDevice will queue.
+      */
+    void sendNext();
+
+    /**
+      * Notify the result of a control code.
+      */
+    void notifyControl( uint8_t code, uint8_t status, uint32_t length);
+
+    codal::MicroBitLog  &log;
+
+    // memory for our characteristics.
+    uint8_t             controlCharacteristicBuffer[6];
+    uint8_t             dataCharacteristicBuffer[ MICROBIT_LOG_S_ATTRSIZE];
+
+    // The export requested, and its progress.
+    codal::DataFormat   requestFormat;
+    uint32_t            requestOffset;
+    uint32_t            exportOffset;
+    int                 dataLength;         // Length of the notification waiting to be sent, or -1 if none.
+    bool                exporting;
+
+    // Index for each charactersitic in arrays of handles and UUIDs
+    typedef enum mbbs_cIdx
+    {
+        mbbs_cIdxCONTROL,
+        mbbs_cIdxDATA,
+        mbbs_cIdxCOUNT
+    } mbbs_cIdx;
+
+    // UUIDs for our service and characteristics
+    static const uint16_t serviceUUID;
+    static const uint16_t charUUID[ mbbs_cIdxCOUNT];
+
+    // Data for each characteristic when they are held by Soft Device.
+    MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
+
+    public:
+
+    int              characteristicCount()          { return mbbs_cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+
+#endif
+#endif
@@ -39,6 +39,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitComponent.h"
 #include "MicroBitEvent.h"
 #include "EventModel.h"
+#include "nrf_sdh_ble.h"
 
 #define PARTIAL_FLASHING_VERSION 0x01
 
@@ -46,11 +47,22 @@ DEALINGS IN THE SOFTWARE.
 #define REGION_INFO 0x00
 #define FLASH_DATA  0x01
 #define END_OF_TRANSMISSION 0x02
+#define FLASH_WINDOW_INFO   0x03
+#define FLASH_WINDOW_DATA   0x04
 
 // BLE Utilities
 #define MICROBIT_STATUS 0xEE
 #define MICROBIT_RESET  0xFF
 
+// Size of each of the two blocks that windowed transfers are received into. Must divide MICROBIT_CODEPAGESIZE.
+#ifndef MICROBIT_PF_BLOCK_SIZE
+#define MICROBIT_PF_BLOCK_SIZE              2048
+#endif
+
+// Largest control packet, and the header of each FLASH_WINDOW_DATA packet.
+#define MICROBIT_PF_ATTRSIZE                (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+#define MICROBIT_PF_WINDOW_HEADERSIZE       6
+
 
 /**
   * Class definition for the custom MicroBit Partial Flash Service.
@@ -98,6 +110,44 @@ class MicroBitPartialFlashingService : public MicroBitBLEService
       */
     void flashData(uint8_t *data);
 
+    /**
+      * Set the flashIncomplete flag, so that we restart in BLE mode if the transfer fails,
+      * and erase the MicroPython filesystem, the first time that data is written.
+      */
+    void markFlashIncomplete(MicroBitFlash &flash);
+
+    /**
+      * Erase the page starting at the address given, unless it is already blank.
+      */
+    void erasePageIfNeeded(MicroBitFlash &flash, uint32_t *page);
+
+    /**
+      * Process a windowed data packet, received while the previous block is being written.
+      * @param data the packet
+      * @param len the length of the packet
+      */
+    void windowData(uint8_t *data, int len);
+
+    /**
+      * Hand the block being filled to be written, and start filling the other.
+      */
+    void windowFlush();
+
+    /**
+      * Acknowledge the packets received, if there is room for a full window more.
+      */
+    void windowAcknowledge();
+
+    /**
+      * Write the blocks that have been filled. Called from the event handler, so that it can wait for the SoftDevice.
+      */
+    void windowProgram(MicroBitFlash &flash);
+
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
     // Ensure packets are in order
     uint8_t packetCount = 0;
     uint8_t blockPacketCount = 0;
@@ -106,8 +156,20 @@ class MicroBitPartialFlashingService : public MicroBitBLEService
     uint32_t block[16];
     uint8_t  blockNum = 0;
     uint32_t offset   = 0;
-    
-    uint8_t characteristicValue[ 20];
+
+    // Windowed transfers: two blocks, each filled from contiguous packets while the other is written.
+    uint32_t *windowBuffer = NULL;
+    uint32_t  windowAddress[2] = { 0, 0 };              // FLASH address of the first byte held in each block.
+    uint16_t  windowLength[2] = { 0, 0 };               // Bytes held in each block.
+    volatile bool windowBusy[2] = { false, false };     // true while each block is waiting to be written.
+    uint8_t   windowFill = 0;           // Block being filled.
+    uint8_t   windowWrite = 0;          // Block to write next.
+    uint8_t   windowSeq = 0;            // Sequence number of the next packet.
+    uint8_t   windowAcked = 0;          // Sequence number last acknowledged.
+    uint16_t  windowBytes = 0;          // Most data the client may send after each acknowledgement.
+    bool      windowActive = false;     // true once FLASH_WINDOW_INFO has started a windowed transfer.
+
+    uint8_t characteristicValue[ MICROBIT_PF_ATTRSIZE];
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
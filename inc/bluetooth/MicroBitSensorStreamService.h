@@ -0,0 +1,169 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_SENSOR_STREAM_SERVICE_H
+#define MICROBIT_SENSOR_STREAM_SERVICE_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEManager.h"
+#include "MicroBitBLEService.h"
+#include "MicroBitAccelerometer.h"
+#include "MicroBitCompass.h"
+#include "EventModel.h"
+#include "nrf_sdh_ble.h"
+
+#ifndef MICROBIT_SENSOR_STREAM_LATENCY
+#define MICROBIT_SENSOR_STREAM_LATENCY          100         // Longest time in ms to hold a sample before sending it
+#endif
+
+// Event codes, raised on MICROBIT_ID_BLE_SENSOR_STREAM.
+#define MICROBIT_SENSOR_STREAM_EVT_CONFIG_NEEDED    1
+
+// Largest notification, and its header: a 32 bit timestamp and the 16 bit sample period, both in milliseconds.
+#define MICROBIT_SENSOR_STREAM_S_ATTRSIZE       (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+#define MICROBIT_SENSOR_STREAM_S_HEADERSIZE     6
+
+// Values in each sample: accelerometer X, Y, Z then compass X, Y, Z.
+#define MICROBIT_SENSOR_STREAM_S_VALUES         6
+
+
+/**
+  * Class definition for the MicroBit BLE Sensor Stream Service.
+  * Samples the accelerometer and compass together, at the accelerometer's period, and streams them in MTU sized notifications.
+  *
+  * Each notification holds a header, followed by as many samples as fit. The first sample in a notification holds each value
+  * in full; later samples hold the difference from the previous sample. Each is zigzag encoded and written as a little endian
+  * base 128 varint, so that the small changes between consecutive samples mostly take a single byte.
+  */
+class MicroBitSensorStreamService : public MicroBitBLEService
+{
+    public:
+
+    /**
+      * Constructor.
+      * Create a representation of the SensorStreamService.
+      * @param _ble The instance of a BLE device that we're running on.
+      * @param _accelerometer An instance of MicroBitAccelerometer.
+      * @param _compass An instance of MicroBitCompass.
+      */
+    MicroBitSensorStreamService( BLEDevice &_ble, codal::Accelerometer &_accelerometer, codal::Compass &_compass);
+
+    /**
+      * Set the sample period of the stream.
+      * The accelerometer chooses the nearest period it can support, and the compass is reconfigured in the background to match.
+      *
+      * @param period the requested time between samples, in milliseconds.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the period is out of range.
+      */
+    int setPeriod( int period);
+
+    /**
+      * Determine the sample period of the stream.
+      * @return the time between samples, in milliseconds.
+      */
+    int getPeriod();
+
+    private:
+
+    /**
+      * Invoked when BLE connects.
+      */
+    void onConnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Invoked when BLE disconnects.
+      */
+    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Callback. Invoked when any of our attributes are written via BLE.
+      */
+    void onDataWritten( const microbit_ble_evt_write_t *params);
+
+    /**
+      * Callback. Invoked when queued notifications have been sent.
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Set up or tear down event listers
+      */
+    void listen( bool yes);
+
+    /**
+      * Accelerometer update callback. Takes a sample from both sensors.
+      */
+    void sensorUpdate( MicroBitEvent e);
+
+    /**
+      * Configuration callback. Reconfiguring the compass can take a long time, so it is done in the background.
+      */
+    void configUpdate( MicroBitEvent e);
+
+    /**
+      * Send the notification being built, if there is one.
+      * @return true if it was sent or is empty, false if the SoftDevice's queue is full.
+      */
+    bool send();
+
+    codal::Accelerometer    &accelerometer;
+    codal::Compass          &compass;
+
+    // memory for our characteristics.
+    uint8_t             sensorStreamDataCharacteristicBuffer[ MICROBIT_SENSOR_STREAM_S_ATTRSIZE];
+    uint16_t            sensorStreamPeriodCharacteristicBuffer;
+
+    // The previous sample, the length of the notification being built, and whether it is waiting for space in the SoftDevice's queue.
+    int32_t             previous[ MICROBIT_SENSOR_STREAM_S_VALUES];
+    uint16_t            length;
+    bool                pending;
+
+    // Index for each charactersitic in arrays of handles and UUIDs
+    typedef enum mbbs_cIdx
+    {
+        mbbs_cIdxDATA,
+        mbbs_cIdxPERIOD,
+        mbbs_cIdxCOUNT
+    } mbbs_cIdx;
+
+    // UUIDs for our service and characteristics
+    static const uint16_t serviceUUID;
+    static const uint16_t charUUID[ mbbs_cIdxCOUNT];
+
+    // Data for each characteristic when they are held by Soft Device.
+    MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
+
+    public:
+
+    int              characteristicCount()          { return mbbs_cIdxCOUNT; };
+    MicroBitBLEChar *characteristicPtr( int idx)    { return &chars[ idx]; };
+};
+
+
+#endif
+#endif
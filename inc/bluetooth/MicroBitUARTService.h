@@ -44,6 +44,10 @@ DEALINGS IN THE SOFTWARE.
   * Class definition for the custom MicroBit UART Service.
   * Provides a BLE service that acts as a UART port, enabling the reception and transmission
   * of an arbitrary number of bytes.
+  *
+  * Each indication or notification carries up to the negotiated ATT MTU less 3 bytes. If the connected
+  * device enables notifications rather than indications, several are queued for each connection event,
+  * without waiting for each to be confirmed.
   */
 class MicroBitUARTService : public MicroBitBLEService
 {
@@ -51,11 +55,11 @@ class MicroBitUARTService : public MicroBitBLEService
 
     uint8_t* txBuffer;
 
-    uint8_t rxBufferHead;
-    uint8_t rxBufferTail;
-    uint8_t rxBufferSize;
+    uint16_t rxBufferHead;
+    uint16_t rxBufferTail;
+    uint16_t rxBufferSize;
 
-    uint8_t txBufferSize;
+    uint16_t txBufferSize;
 
     uint32_t rxCharacteristicHandle;
 
@@ -65,11 +69,11 @@ class MicroBitUARTService : public MicroBitBLEService
     //a variable used when a user calls the eventAfter() method.
     int rxBuffHeadMatch;
     
-    uint8_t txBufferHead;
-    uint8_t txBufferTail;
+    uint16_t txBufferHead;
+    uint16_t txBufferTail;
 
     // the number of bytes from the tx buffer that have been sent, pending confirmation
-    uint8_t txValueSize;
+    uint16_t txValueSize;
 
     bool waitingForEmpty;
 
@@ -82,6 +86,11 @@ class MicroBitUARTService : public MicroBitBLEService
       * A callback function for whenever a Bluetooth device consumes our TX Buffer
       */
     void onConfirmation( const microbit_ble_evt_hvc_t *params);
+
+    /**
+      * A callback function for whenever notifications queued with the SoftDevice have been sent
+      */
+    void onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt);
     
     
     /**
@@ -101,10 +110,11 @@ class MicroBitUARTService : public MicroBitBLEService
       * @note this method assumes that the linear buffer has the appropriate amount of
       *       memory to contain the copy operation
       */
-    void circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition);
+    void circularCopy(uint8_t *circularBuff, uint16_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition);
 
     /**
-      * An internal method that sends the next block from the tx buffer.
+      * An internal method that sends the next block from the tx buffer, or if the connected device
+      * has enabled notifications, as many blocks as the SoftDevice will queue.
       * @return true if a block is sent
       */
     bool sendNext();
@@ -117,9 +127,10 @@ class MicroBitUARTService : public MicroBitBLEService
      * @param rxBufferSize the size of the rxBuffer
      * @param txBufferSize the size of the txBuffer
      *
-     * @note The default size is MICROBIT_UART_S_DEFAULT_BUF_SIZE (20 bytes).
+     * @note The default size is MICROBIT_UART_S_DEFAULT_BUF_SIZE (20 bytes). Buffers of up to 65534 bytes may be used,
+     *       and a tx buffer of several times the negotiated MTU is needed to keep a fast link busy.
      */
-    MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE, uint8_t txBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE);
+    MicroBitUARTService(BLEDevice &_ble, uint16_t rxBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE, uint16_t txBufferSize = MICROBIT_UART_S_DEFAULT_BUF_SIZE);
 
     /**
       * Retreives a single character from our RxBuffer.
@@ -156,7 +167,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int putc(char c, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -178,7 +189,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(const uint8_t *buf, int length, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -199,7 +210,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(ManagedString s, MicroBitSerialMode mode = SYNC_SLEEP);
 
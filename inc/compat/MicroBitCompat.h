@@ -306,6 +306,7 @@ typedef codal::BitmapFont MicroBitFont;
 #define MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE                 DISPLAY_EVT_ANIMATION_COMPLETE
 #define MICROBIT_DISPLAY_EVT_FREE                               DISPLAY_EVT_FREE
 #define MICROBIT_DISPLAY_EVT_LIGHT_SENSE                        DISPLAY_EVT_LIGHT_SENSE
+#define MICROBIT_DISPLAY_EVT_FRAME                              NRF52_LEDMATRIX_EVT_FRAME
 
 #define MICROBIT_SERIAL_EVT_DELIM_MATCH                         CODAL_SERIAL_EVT_DELIM_MATCH
 #define MICROBIT_SERIAL_EVT_HEAD_MATCH                          CODAL_SERIAL_EVT_HEAD_MATCH
@@ -390,6 +391,52 @@ typedef codal::BitmapFont MicroBitFont;
 namespace codal
 {
     void fiber_add_idle_component(CodalComponent *c);
+
+    /**
+      * Marks a component as having work pending, so that its idleCallback() is invoked on the next idle pass.
+      * May be called from interrupt context, or from a fiber.
+      *
+      * @param c The component to wake.
+      */
+    void fiber_wake_idle_component(CodalComponent *c);
+
+    /**
+      * Marks a component as having no further work pending, so that the idle thread stops invoking its idleCallback().
+      * Typically called from within idleCallback() before the pending work is processed, so that work
+      * which arrives while processing wakes the component again.
+      *
+      * @param c The component to put back to sleep.
+      *
+      * @param pending Status bits that indicate work is still outstanding. If any of these are set, the component
+      *        is left runnable. The test is made with interrupts disabled, so cannot race with an interrupt that
+      *        sets one of these bits and then calls fiber_wake_idle_component().
+      */
+    void fiber_idle_component_done(CodalComponent *c, uint16_t pending = 0);
+
+    /**
+      * Sets status bits on a component as a single atomic read-modify-write.
+      *
+      * Use this (rather than status |= ...) on any component whose status is also written from interrupt context,
+      * such as through fiber_wake_idle_component(), or the interrupt's update may be lost.
+      *
+      * @param c The component to update.
+      *
+      * @param bits The status bits to set.
+      */
+    void component_status_set(CodalComponent *c, uint16_t bits);
+
+    /**
+      * Clears status bits on a component as a single atomic read-modify-write.
+      *
+      * Use this (rather than status &= ~...) on any component whose status is also written from interrupt context,
+      * such as through fiber_wake_idle_component(), or the interrupt's update may be lost.
+      *
+      * @param c The component to update.
+      *
+      * @param bits The status bits to clear.
+      */
+    void component_status_clear(CodalComponent *c, uint16_t bits);
+
     uint32_t htonl(uint32_t v);
     uint16_t htons(uint16_t v);
 };
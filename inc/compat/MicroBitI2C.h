@@ -27,9 +27,36 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitCompat.h"
 
+//
+// Priorities of the clients sharing an I2C bus. Higher values are serviced first.
+//
+#define MICROBIT_I2C_PRIORITY_STORAGE               0
+#define MICROBIT_I2C_PRIORITY_DEFAULT               1
+#define MICROBIT_I2C_PRIORITY_SENSOR                2
+
+// The maximum number of clients that can be serviced while a lower priority transaction waits on the bus.
+#ifndef MICROBIT_I2C_MAX_CLIENTS
+#define MICROBIT_I2C_MAX_CLIENTS                    4
+#endif
+
+// The minimum interval between services of waiting clients (microseconds). This bounds the sampling jitter of
+// higher priority clients, while guaranteeing the waiting transaction the rest of the bus time.
+#ifndef MICROBIT_I2C_SERVICE_PERIOD
+#define MICROBIT_I2C_SERVICE_PERIOD                 1000
+#endif
+
 namespace codal
 {
 
+/**
+  * A component sharing an I2C bus, and the priority with which it is serviced.
+  */
+struct MicroBitI2CClient
+{
+    CodalComponent  *component;
+    int             priority;
+};
+
 /**
   * Class definition for MicroBit I2C
   *
@@ -70,6 +97,65 @@ class MicroBitI2C : public NRF52I2C
       */
      MicroBitI2C(PinNumber sda, PinNumber scl);
 
+    /**
+      * Registers a component that shares this bus, so that it can be serviced while lower priority
+      * transactions wait for a peripheral to respond.
+      *
+      * A waiting transaction calls the idleCallback() of each client with a higher priority that
+      * is currently receiving idle ticks, so the client should only access the bus when it has work to do
+      * (e.g. when its interrupt line is active).
+      *
+      * @param component The component to service.
+      *
+      * @param priority The priority of the component, e.g. MICROBIT_I2C_PRIORITY_SENSOR.
+      *
+      * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the component is already registered,
+      * or MICROBIT_NO_RESOURCES if MICROBIT_I2C_MAX_CLIENTS clients are already registered.
+      */
+     int addClient(CodalComponent &component, int priority);
+
+    /**
+      * Removes a component previously registered with addClient().
+      *
+      * @param component The component to remove.
+      *
+      * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the component was not registered.
+      */
+     int removeClient(CodalComponent &component);
+
+    /**
+      * Services any clients with a priority higher than that given, at most once every MICROBIT_I2C_SERVICE_PERIOD
+      * microseconds. Clients are serviced highest priority first.
+      *
+      * Does nothing in interrupt context, or while clients are already being serviced (e.g. when a client's
+      * idleCallback() itself waits on the bus), so that no idleCallback() is ever reentered.
+      *
+      * @param priority The priority of the caller.
+      */
+     void service(int priority);
+
+    /**
+      * Waits for the given time without yielding, as a transaction awaiting a response does,
+      * servicing any clients with a higher priority than the caller in the meantime.
+      *
+      * Intended to be called from a fiber (or before the scheduler starts), holding no lock that a client's
+      * idleCallback() may need. Nested calls, and calls in interrupt context, wait without servicing any clients.
+      *
+      * @param us The time to wait, in microseconds.
+      *
+      * @param priority The priority of the caller, e.g. MICROBIT_I2C_PRIORITY_STORAGE.
+      */
+     void wait(uint32_t us, int priority);
+
+    private:
+     MicroBitI2CClient  clients[MICROBIT_I2C_MAX_CLIENTS];     // Clients serviced while lower priority transactions wait.
+     CODAL_TIMESTAMP    lastService;                            // When clients were last serviced (microseconds).
+     volatile bool      servicing;                              // Set while clients are being serviced, so they cannot recurse.
+
+    /**
+      * Initialises the client registry.
+      */
+     void init();
 };
 
 }
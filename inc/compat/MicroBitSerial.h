@@ -27,6 +27,10 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitCompat.h"
 
+// Events raised by MicroBitSerial, in addition to those of the underlying Serial driver.
+#define MICROBIT_SERIAL_EVT_TX_COMPLETE         16
+#define MICROBIT_SERIAL_EVT_RX_IDLE             17
+
 namespace codal
 {
 
@@ -36,6 +40,17 @@ namespace codal
   */
 class MicroBitSerial : public NRF52Serial
 {
+    bool                txAsync;            // true while data queued by sendAsync() is still being transmitted.
+    uint16_t            rxIdleTime;         // The quiet time after which MICROBIT_SERIAL_EVT_RX_IDLE is raised, in milliseconds, or zero.
+    bool                rxIdleReported;     // true once the current period of quiet has been reported.
+    int                 rxLastSize;         // The number of received bytes buffered when last checked.
+    CODAL_TIMESTAMP     rxLastTime;         // When the number of received bytes buffered last changed.
+
+    /**
+      * Applies the buffer sizes requested by a constructor. Buffers of the default size are left to be allocated on first use.
+      */
+    void init(uint8_t rxBufferSize, uint8_t txBufferSize);
+
     public:
 
     /**
@@ -125,6 +140,34 @@ class MicroBitSerial : public NRF52Serial
       */
     int redirect(PinNumber tx, PinNumber rx);
 
+    /**
+      * Queues data for transmission, and returns without waiting for it to be sent.
+      * MICROBIT_SERIAL_EVT_TX_COMPLETE is raised on this component's id once everything queued has been transmitted.
+      *
+      * @param buffer The data to transmit. This is copied, so need not remain valid.
+      *
+      * @param length The number of bytes to transmit.
+      *
+      * @return The number of bytes queued, which may be fewer than requested if the transmit buffer is full,
+      *         CODAL_SERIAL_IN_USE if another fiber is transmitting, or DEVICE_INVALID_PARAMETER.
+      */
+    int sendAsync(const uint8_t *buffer, int length);
+
+    /**
+      * Enables detection of an idle receive line. Once received data stops arriving for the given time,
+      * MICROBIT_SERIAL_EVT_RX_IDLE is raised on this component's id, so that a complete message can be read in one go.
+      *
+      * @param ms The quiet time in milliseconds, or zero to disable detection.
+      *
+      * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the time is out of range.
+      */
+    int setRxIdleTime(int ms);
+
+    /**
+      * Periodic callback in thread context, made while an asynchronous transmission is in progress or idle line detection is enabled.
+      */
+    virtual void idleCallback() override;
+
 };
 
 }
@@ -87,6 +87,7 @@ MicroBit::MicroBit() :
     compass(MicroBitCompass::autoDetect(_i2c)),
     compassCalibrator(compass, accelerometer, display, storage),
     audio(io.P0, io.speaker, adc, io.microphone, io.runmic),
+    governor(power, display, radio, accelerometer, compass, audio),
     log(flash, power, serial)
 {
     // Clear our status
@@ -113,6 +114,11 @@ MicroBit::MicroBit() :
     }
     */
 
+#if CONFIG_ENABLED(CONFIG_MICROBIT_ICACHE)
+    // Cache instructions fetched from FLASH. The setting remains until the next reset.
+    NRF_NVMC->ICACHECNF |= NVMC_ICACHECNF_CACHEEN_Msk;
+#endif
+
     // Configure serial port for debugging
 
     //SERIAL_TODO:
@@ -131,6 +137,10 @@ MicroBit::MicroBit() :
 
     _i2c.setFrequency(400000);
 
+    // Keep the motion sensors sampling while the USB interface chip is slow to respond on the shared bus.
+    _i2c.addClient(accelerometer, MICROBIT_I2C_PRIORITY_SENSOR);
+    _i2c.addClient(compass, MICROBIT_I2C_PRIORITY_SENSOR);
+
     // Bring up our display pins as high drive.
     for (NRF52Pin *p : ledRowPins)
         p->setHighDrive(true);
@@ -140,6 +150,8 @@ MicroBit::MicroBit() :
 
     // Bring up internal speaker as high drive.
     io.speaker.setHighDrive(true);
+
+    bootTrace.record("construct");
 }
 
 /**
@@ -164,18 +176,30 @@ int MicroBit::init()
 
     status |= DEVICE_INITIALIZED;
 
-    // On a hard reset, wait for the USB interface chip to come online.
-    if(NRF_POWER->RESETREAS == 0)
-        target_wait(KL27_POWER_ON_DELAY);
+    CODAL_TIMESTAMP start = system_timer_current_time();
 
 #if CONFIG_ENABLED(DEVICE_BLE)
     // Ensure BLE bootloader settings are up to date.
     // n.b. this only performs a write operation if the settings stored in FLASH are out of date.
+    // This only uses internal FLASH, so is done while the USB interface chip starts up.
     MicroBitPartialFlashingService::validateBootloaderSettings();
+    bootTrace.record("bootloader");
 #endif
 
+    // On a hard reset, wait for the USB interface chip to come online, for no longer than it could take.
+    if(NRF_POWER->RESETREAS == 0)
+    {
+        CODAL_TIMESTAMP elapsed = system_timer_current_time() - start;
+
+        if (elapsed < KL27_POWER_ON_DELAY)
+            power.awaitInterface(KL27_POWER_ON_DELAY - elapsed);
+
+        bootTrace.record("interface");
+    }
+
     // Determine if we have been reprogrammed. If so, follow configured policy on erasing any persistent user data.
     eraseUserStorage();
+    bootTrace.record("storage");
 
     // Bring up fiber scheduler.
     scheduler_init(messageBus);
@@ -186,6 +210,8 @@ int MicroBit::init()
             CodalComponent::components[i]->init();
     }
 
+    bootTrace.record("components");
+
     // Seed our random number generator
     seedRandom();
 
@@ -223,6 +249,7 @@ int MicroBit::init()
 
 #if CONFIG_ENABLED(DEVICE_BLE) && ( CONFIG_ENABLED(MICROBIT_BLE_PAIRING_MODE) || CONFIG_ENABLED(MICROBIT_BLE_ENABLED))
     MicroBitVersion version = power.getVersion();
+    bootTrace.record("version");
 #endif
 
 #if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_PAIRING_MODE)
@@ -261,11 +288,14 @@ int MicroBit::init()
             bleManager.pairingMode(display, buttonA);
         }
     }
+
+    bootTrace.record("pairing");
 #endif
 
 #if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_ENABLED)
     // Start the BLE stack, if it isn't already running.
     bleManager.init( ManagedString( microbit_friendly_name()), getSerial(), messageBus, storage, false, version.board);
+    bootTrace.record("bluetooth");
 #endif
 
     // Deschedule for a little while, just to allow for any components that finialise initialisation
@@ -273,6 +303,7 @@ int MicroBit::init()
     // before any user code begins running.
     
     sleep(10);
+    bootTrace.record("ready");
 
     return DEVICE_OK;
 }
@@ -335,13 +366,19 @@ void MicroBit::onListenerRegisteredEvent(Event evt)
         case DEVICE_ID_SYSTEM_LEVEL_DETECTOR:
             // A listener has been registered for the level detector.
             // The level detector uses lazy instantiation, we just need to read the data once to start it running.
-            audio.level->getValue();
+            audio.getLevelDetector()->getValue();
             break;
 
         case DEVICE_ID_MICROPHONE:
             // A listener has been registered for the level detector SPL.
             // The level detector SPL uses lazy instantiation, we just need to read the data once to start it running.
-            audio.levelSPL->getValue();
+            audio.getLevelDetectorSPL()->getValue();
+            break;
+
+        case DEVICE_ID_SOUND_LEVEL_DETECTOR:
+            // A listener has been registered for the fixed point sound level detector.
+            // Keep it measuring, so that it can raise threshold events.
+            audio.getSoundLevelDetector()->activate(true);
             break;
     }
 }
@@ -369,6 +406,10 @@ void MicroBit::schedulerIdle()
         }
     }
 
+    // If enabled, sleep through the scheduler tick until there is something to do.
+    if ( power.ticklessIdle() == DEVICE_OK)
+        return;
+
     target_wait_for_event();
 }
 
@@ -409,8 +450,9 @@ void MicroBit::eraseUserStorage(bool forceErase)
         f.write((uint32_t) &reflash_status, &zero, 1);
 
     // Determine if our flash contains a recognised file system. If so, invalidate it.
+    // After a reflash this happens in the background, so as not to delay startup. The log completes it before any other use.
 #if (CONFIG_MICROBIT_ERASE_USER_DATA_ON_REFLASH == 1)
-    log.invalidate();
+    log.invalidate(!forceErase);
 #endif
 }
 
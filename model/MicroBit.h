@@ -66,6 +66,10 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitUSBFlashManager.h"
 #include "MicroBitLog.h"
 #include "MicroBitAudio.h"
+#include "MicroBitPowerGovernor.h"
+#include "MicroBitBootTrace.h"
+#include "MicroBitTrace.h"
+#include "MicroBitEntropy.h"
 #include "StreamNormalizer.h"
 #include "LevelDetector.h"
 #include "LevelDetectorSPL.h"
@@ -79,11 +83,15 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitLEDService.h"
 #include "MicroBitAccelerometerService.h"
 #include "MicroBitMagnetometerService.h"
+#include "MicroBitSensorStreamService.h"
 #include "MicroBitButtonService.h"
 #include "MicroBitIOPinService.h"
 #include "MicroBitTemperatureService.h"
 #include "MicroBitUARTService.h"
 #include "MicroBitPartialFlashingService.h"
+#include "MicroBitLogService.h"
+#include "MicroBitBenchmarkService.h"
+#include "MicroBitDiagnosticsService.h"
 #endif
 
 #include "MicroBitStorage.h"
@@ -98,7 +106,7 @@ DEALINGS IN THE SOFTWARE.
 // Flag that we have integrate face-touch as a feature
 #define MICROBIT_UBIT_FACE_TOUCH_BUTTON       1
 
-// Power on delay time (in milliseconds) applied after a hard power-on reset only.
+// The longest time (in milliseconds) to wait for the USB interface chip to come online after a hard power-on reset.
 #define KL27_POWER_ON_DELAY                    1000
 
 // Defines default behaviour of any stored user data when the micro:bit is reflashed.
@@ -174,7 +182,9 @@ namespace codal
             Compass&                    compass;
             MicroBitCompassCalibrator   compassCalibrator;
             MicroBitAudio               audio;
+            MicroBitPowerGovernor       governor;
             MicroBitLog                 log;
+            MicroBitBootTrace           bootTrace;
 
 
             /**
@@ -322,7 +332,7 @@ using namespace codal;
 #define MIC_DEVICE NRF52ADCChannel*
 #define MIC_INIT \
     : microphone(uBit.audio.mic) \
-    , level(* uBit.audio.levelSPL)
+    , level(* uBit.audio.getLevelDetectorSPL())
 
 #define MIC_ENABLE //uBit.audio.deactivateLevelSPL(); //uBit.io.runmic.setDigitalValue(1); uBit.io.runmic.setHighDrive(true); microphone->setGain(7,0)
 
@@ -109,8 +109,7 @@ MicroBitIO::MicroBitIO(NRF52ADC &a, TouchSensor &s) :
     buttonA.setPull(PullMode::None);
     buttonB.setPull(PullMode::None);
 
-    savedStatus = ManagedBuffer(pins + 1);
-    savedStatus[pins] = 0;
+    // The saved pin state is only needed once the device first enters deep sleep, so is allocated then.
 }
 
 #ifdef NRF_P1
@@ -128,6 +127,12 @@ MicroBitIO::MicroBitIO(NRF52ADC &a, TouchSensor &s) :
  */
 int MicroBitIO::deepSleepCallback( deepSleepCallbackReason reason, deepSleepCallbackData *data)
 {
+    if (savedStatus.length() == 0)
+    {
+        savedStatus = ManagedBuffer(pins + 1);
+        savedStatus[pins] = 0;
+    }
+
     switch (reason)
     {
         case deepSleepCallbackPrepare:
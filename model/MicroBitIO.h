@@ -432,7 +432,7 @@ namespace codal
             virtual int deepSleepCallback( deepSleepCallbackReason reason, deepSleepCallbackData *data) override;
 
         private:
-            ManagedBuffer     savedStatus;
+            ManagedBuffer     savedStatus;  // The state of each pin across deep sleep, allocated on first use.
 
             /**
              * Record current state of pins, so we can return the configuration to the same state later.
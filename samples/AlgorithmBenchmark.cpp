@@ -0,0 +1,378 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Algorithm benchmark.
+  *
+  * Measures the throughput of the CPU bound parts of the runtime: the Mixer2 resamplers, FSCache, MicroBitLog
+  * and the compass calibration fit. Results are reported over serial. To run it, copy this file into the source
+  * folder of a CODAL project in place of main.cpp, along with BenchmarkHarness.h.
+  *
+  * The cost of mixing and synthesis, across channel counts, sample rates and output formats, is measured by
+  * AudioBenchmark.cpp instead.
+  *
+  * WARNING: this erases the data log.
+  *
+  * Components are driven in isolation wherever possible, so that changes to their algorithms can be measured
+  * without the noise of the rest of the system:
+  * - Mixer2 is pulled directly by the benchmark, with a NullSink downstream and a ToneSource upstream,
+  *   rather than by NRF52PWM.
+  * - FSCache runs on a RamNVM, a memory controller held in RAM, so that only the cost of the cache is measured.
+  * - MicroBitLog has no such seam, so its cases include the cost of writing to the USB FLASH.
+  *
+  * Time is measured with the DWT cycle counter, and only while the operation measured is running. Each case
+  * is repeated until it has run for at least BENCHMARK_MIN_CYCLES, as a google-benchmark case would be.
+  * Interrupts are left enabled, so leave the device idle while it runs.
+  *
+  * Each result is reported as one line of comma separated values, prefixed by BENCH so that it can be
+  * picked out of other serial output. The first line names the columns:
+  *
+  * BENCH,case,param,iterations,items,cycles,cycles_per_iteration,cycles_per_item,items_per_s
+  *
+  * - case: the operation measured, such as fscache.read.seq.
+  * - param: a parameter of the case, such as the size of each read. Each case describes its own.
+  * - items: the units processed by all iterations, such as samples generated or bytes read.
+  * - items_per_s: throughput at BENCHMARK_CLOCK_MHZ, were the CPU to do nothing else.
+  *
+  * A line BENCH,end follows the last result. Compare items_per_s between builds to measure a change.
+  */
+
+#include "MicroBit.h"
+#include "Mixer2.h"
+#include "MicroBitCompassFit.h"
+#include "BenchmarkHarness.h"
+#include <math.h>
+
+// Minimum number of CPU cycles measured in each case.
+#define BENCHMARK_MIN_CYCLES        (32 * 1000000)
+
+// Maximum number of iterations of each case.
+#define BENCHMARK_MAX_ITERATIONS    100000
+
+// Size of the RamNVM used by the FSCache cases, in pages.
+#define BENCHMARK_NVM_PAGES         4
+
+// Maximum number of rows appended to the log by each log case.
+#define BENCHMARK_LOG_ROWS          500
+
+// Number of samples added to each compass fit.
+#define BENCHMARK_COMPASS_SAMPLES   200
+
+MicroBit uBit;
+
+//
+// A memory controller held in RAM.
+//
+class RamNVM : public NVMController
+{
+    uint32_t *memory;
+    uint32_t pageSize;
+    uint32_t pages;
+
+    public:
+
+    RamNVM(uint32_t pageSize, uint32_t pages) : pageSize(pageSize), pages(pages)
+    {
+        memory = (uint32_t *) malloc(pageSize * pages);
+        memset(memory, 0xFF, pageSize * pages);
+    }
+
+    ~RamNVM()
+    {
+        free(memory);
+    }
+
+    virtual int read(uint32_t* dest, uint32_t address, uint32_t length) override
+    {
+        memcpy(dest, (uint8_t *) memory + address, length * 4);
+        return DEVICE_OK;
+    }
+
+    virtual int write(uint32_t address, uint32_t *data, uint32_t length) override
+    {
+        memcpy((uint8_t *) memory + address, data, length * 4);
+        return DEVICE_OK;
+    }
+
+    virtual int erase(uint32_t page) override
+    {
+        memset((uint8_t *) memory + page, 0xFF, pageSize);
+        return DEVICE_OK;
+    }
+
+    virtual uint32_t getFlashStart() override { return 0; }
+    virtual uint32_t getFlashEnd() override { return pageSize * pages; }
+    virtual uint32_t getPageSize() override { return pageSize; }
+    virtual uint32_t getFlashSize() override { return pageSize * pages; }
+};
+
+static BenchmarkCase bench;
+
+static uint8_t buffer[1024];
+
+/**
+  * Determine if the current case needs more iterations.
+  * @param limit the maximum number of iterations of the case.
+  * @return true until BENCHMARK_MIN_CYCLES have been measured, or limit iterations run.
+  */
+static bool running(uint32_t limit = BENCHMARK_MAX_ITERATIONS)
+{
+    return bench.cycles < BENCHMARK_MIN_CYCLES && bench.iterations < limit;
+}
+
+/**
+  * Report the results of the current case.
+  */
+static void report()
+{
+    char line[160];
+
+    uint32_t perIteration = bench.iterations ? (uint32_t) (bench.cycles / bench.iterations) : 0;
+    uint32_t perItem = bench.items ? (uint32_t) (bench.cycles / bench.items) : 0;
+    uint32_t rate = bench.cycles ? (uint32_t) ((uint64_t) bench.items * BENCHMARK_CLOCK_MHZ * 1000000 / bench.cycles) : 0;
+
+    snprintf(line, sizeof(line), "BENCH,%s,%d,%d,%d,%lu,%d,%d,%d\r\n",
+        bench.name, bench.param, (int) bench.iterations, (int) bench.items, (unsigned long) bench.cycles,
+        (int) perIteration, (int) perItem, (int) rate);
+
+    benchmarkPrint(line);
+}
+
+/**
+  * Measure Mixer2 resampling a single channel, with each resampler.
+  * param is the sample rate of the channel. Items are output samples.
+  */
+static void benchmarkResampler()
+{
+    static const int rates[] = { 11025, 22050 };
+
+    ToneSource source;
+    NullSink sink;
+
+    for (int resampler = MIXER_RESAMPLER_NEAREST; resampler <= MIXER_RESAMPLER_POLYPHASE; resampler++)
+    {
+        for (int rate : rates)
+        {
+            Mixer2 *mixer = new Mixer2();
+            mixer->connect(sink);
+            mixer->setResampler(mixer->addChannel(source, rate), resampler);
+
+            bench.begin("mixer2.resample", resampler == MIXER_RESAMPLER_POLYPHASE ? "polyphase" : "nearest", rate);
+            while (running())
+            {
+                uint32_t t = bench.start();
+                mixer->pull();
+                bench.stop(t, mixer->getBufferSize());
+            }
+            report();
+
+            delete mixer;
+        }
+    }
+}
+
+/**
+  * Measure reads and writes through an FSCache over a RamNVM.
+  * param is the size of each operation, in bytes. Items are bytes. Each iteration of the sequential
+  * cases covers the whole memory controller, and the write case includes flushing the cache.
+  */
+static void benchmarkCache()
+{
+    static const int sizes[] = { 16, 256 };
+
+    RamNVM nvm(4096, BENCHMARK_NVM_PAGES);
+    FSCache cache(nvm, MBFS_BLOCK_SIZE, MBFS_NVM_CACHE_SIZE);
+    uint32_t length = nvm.getFlashSize();
+
+    for (int size : sizes)
+    {
+        bench.begin("fscache", "write.seq", size);
+        while (running())
+        {
+            uint32_t t = bench.start();
+            for (uint32_t address = 0; address < length; address += size)
+                cache.write(address, buffer, size);
+            cache.flush();
+            bench.stop(t, length);
+        }
+        report();
+
+        cache.clear();
+
+        bench.begin("fscache", "read.seq", size);
+        while (running())
+        {
+            uint32_t t = bench.start();
+            for (uint32_t address = 0; address < length; address += size)
+                cache.read(address, buffer, size);
+            bench.stop(t, length);
+        }
+        report();
+
+        cache.clear();
+
+        bench.begin("fscache", "read.rand", size);
+        while (running())
+        {
+            uint32_t address = microbit_random(length / size) * size;
+
+            uint32_t t = bench.start();
+            cache.read(address, buffer, size);
+            bench.stop(t, size);
+        }
+        report();
+    }
+}
+
+/**
+  * Measure appending rows of formatted numbers to the log in each storage format, and exporting them as CSV.
+  * param is the number of columns in each row, or the size of each export read in bytes.
+  * Items are rows, or bytes exported.
+  */
+static void benchmarkLog()
+{
+    static const char * const columns[] = { "x", "y", "z", "heading" };
+
+    for (int binary = 0; binary <= 1; binary++)
+    {
+        uBit.log.clear(false);
+        uBit.log.setStorageFormat(binary ? StorageFormat::Binary : StorageFormat::Text);
+
+        bench.begin("log.row", binary ? "binary" : "text", 4);
+        while (running(BENCHMARK_LOG_ROWS))
+        {
+            int row = bench.iterations;
+
+            uint32_t t = bench.start();
+            uBit.log.beginRow();
+            uBit.log.logData(columns[0], row);
+            uBit.log.logData(columns[1], -row * 3);
+            uBit.log.logData(columns[2], row * 1000);
+            uBit.log.logData(columns[3], row * 0.1f);
+            uBit.log.endRow();
+            bench.stop(t, 1);
+        }
+
+        // Include the time taken to write out any rows still queued.
+        uint32_t t = bench.start();
+        uBit.log.flush();
+        bench.cycles += DWT->CYCCNT - t;
+        report();
+
+        bench.begin("log.export", binary ? "binary" : "text", 256);
+        while (running())
+        {
+            uint32_t t = bench.start();
+            uint32_t bytes = 0;
+            int r;
+
+            uBit.log.beginExport(DataFormat::CSV);
+            while ((r = uBit.log.readExport(buffer, 256)) > 0)
+                bytes += r;
+            uBit.log.endExport();
+
+            bench.stop(t, bytes);
+        }
+        report();
+    }
+
+    uBit.log.clear(false);
+    uBit.log.setStorageFormat(StorageFormat::Text);
+}
+
+/**
+  * Measure the compass calibration fit.
+  * param is the number of samples fitted, or whether an ellipsoid is fitted. Items are samples.
+  */
+static void benchmarkCompass()
+{
+    Sample3D *samples = new Sample3D[BENCHMARK_COMPASS_SAMPLES];
+    MicroBitCompassFit fit;
+    CompassCalibration calibration;
+
+    // Points spread over an ellipsoid, offset from the origin as a hard iron field would be.
+    for (int i = 0; i < BENCHMARK_COMPASS_SAMPLES; i++)
+    {
+        float a = i * 2.39996f;
+        float z = 1.0f - 2.0f * (i + 0.5f) / BENCHMARK_COMPASS_SAMPLES;
+        float r = sqrtf(1.0f - z * z);
+
+        samples[i].x = 1200 + (int) (45000 * r * cosf(a));
+        samples[i].y = -3400 + (int) (40000 * r * sinf(a));
+        samples[i].z = 800 + (int) (43000 * z);
+    }
+
+    bench.begin("compass", "fit.add", BENCHMARK_COMPASS_SAMPLES);
+    while (running())
+    {
+        fit.reset();
+
+        uint32_t t = bench.start();
+        for (int i = 0; i < BENCHMARK_COMPASS_SAMPLES; i++)
+            fit.add(samples[i]);
+        bench.stop(t, BENCHMARK_COMPASS_SAMPLES);
+    }
+    report();
+
+    for (int ellipsoid = 0; ellipsoid <= 1; ellipsoid++)
+    {
+        bench.begin("compass", "fit.solve", ellipsoid);
+        while (running())
+        {
+            uint32_t t = bench.start();
+            fit.fit(calibration, ellipsoid);
+            bench.stop(t, BENCHMARK_COMPASS_SAMPLES);
+        }
+        report();
+    }
+
+    bench.begin("compass", "calibrate", BENCHMARK_COMPASS_SAMPLES);
+    while (running())
+    {
+        uint32_t t = bench.start();
+        MicroBitCompassCalibrator::calibrate(samples, BENCHMARK_COMPASS_SAMPLES);
+        bench.stop(t, BENCHMARK_COMPASS_SAMPLES);
+    }
+    report();
+
+    delete[] samples;
+}
+
+int
+main()
+{
+    uBit.init();
+
+    for (uint32_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = microbit_random(256);
+
+    benchmarkBegin("case,param,iterations,items,cycles,cycles_per_iteration,cycles_per_item,items_per_s");
+
+    benchmarkResampler();
+    benchmarkCache();
+    benchmarkLog();
+    benchmarkCompass();
+
+    benchmarkEnd();
+}
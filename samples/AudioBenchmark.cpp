@@ -0,0 +1,358 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Audio DSP benchmark.
+  *
+  * Measures the CPU cost of each stage of the audio pipeline, across channel counts, sample rates and output
+  * formats, and reports it over serial as cycles per sample and as a share of the real time budget. To run it,
+  * copy this file into the source folder of a CODAL project in place of main.cpp, along with BenchmarkHarness.h.
+  *
+  * The stages measured are:
+  * - mixer2.float, mixer2.fixed: Mixer2::pull() in each mixing mode. param is the number of channels mixed.
+  * - polysynth.process: PolySynth::process(). param is the number of voices playing.
+  * - emoji.sine, emoji.sawtooth, emoji.square, emoji.noise: SoundEmojiSynthesizer::pull(), rendering each
+  *   tone print. param is the number of effects applied.
+  * - mic.level, mic.spectrum: the SoundLevelDetector and SpectrumAnalyser stages of the microphone pipeline,
+  *   fed with 16 bit signed samples. param is unused.
+  *
+  * Each stage is pulled directly by the benchmark, BENCHMARK_BLOCKS times for each configuration, rather than
+  * by NRF52PWM or the microphone, so that only the CPU time of the stage itself is measured. Time is taken from
+  * the DWT cycle counter, which also counts any interrupts taken while a block is rendered.
+  *
+  * The whole suite runs once with BLE idle. When built with "MICROBIT_BLE_ENABLED": 1 in codal.json, it then
+  * advertises, waits BENCHMARK_BLE_WAIT milliseconds for a central to connect, and runs again, so that the
+  * headroom left with BLE active can be compared.
+  *
+  * Each result is reported as one line of comma separated values, prefixed by BENCH so that it can be
+  * picked out of other serial output. The first line names the columns:
+  *
+  * BENCH,case,param,rate,format,ble,blocks,samples,cycles_per_sample,budget_pct
+  *
+  * - rate: the sample rate the stage runs at, in samples per second.
+  * - format: the output format of the stage: 8u, 8s, 16u or 16s.
+  * - ble: 0 if BLE was idle, 1 if it was advertising, or 2 if a central was connected.
+  * - budget_pct: the share of the CPU, at BENCHMARK_CLOCK_MHZ, needed to run the stage in real time at rate.
+  *
+  * A line BENCH,end follows the last result.
+  */
+
+#include "MicroBit.h"
+#include "Mixer2.h"
+#include "MicroSynth.h"
+#include "SoundEmojiSynthesizer.h"
+#include "SoundSynthesizerEffects.h"
+#include "SoundLevelDetector.h"
+#include "SpectrumAnalyser.h"
+#include "Synthesizer.h"
+#include "BenchmarkHarness.h"
+
+// Number of blocks rendered for each configuration.
+#define BENCHMARK_BLOCKS            200
+
+// Time to wait for a central to connect before running the suite with BLE active, in milliseconds.
+#define BENCHMARK_BLE_WAIT          10000
+
+MicroBit uBit;
+
+// The case currently running, and the sample rate and output format it runs at.
+static BenchmarkCase bench;
+static int benchRate;
+static int benchFormat;
+
+// The state of BLE during the current pass, as reported in the ble column.
+static int ble = 0;
+
+static uint16_t block[SynthBlockSize];
+
+/**
+  * Start a new configuration.
+  * @param prefix the name of the component measured, such as mixer2.
+  * @param operation the name of the stage measured, such as fixed.
+  * @param param a parameter of the configuration, such as the number of channels.
+  * @param sampleRate the sample rate of the configuration.
+  * @param outputFormat the output format of the stage.
+  */
+static void begin(const char *prefix, const char *operation, int param, int sampleRate, int outputFormat)
+{
+    bench.begin(prefix, operation, param);
+    benchRate = sampleRate;
+    benchFormat = outputFormat;
+}
+
+/**
+  * Report the results of the current configuration.
+  */
+static void report()
+{
+    static const char * const formats[] = { "-", "8u", "8s", "16u", "16s" };
+
+    char line[160];
+
+    // Real time allows BENCHMARK_CLOCK_MHZ * 1000000 / rate cycles per sample. Calculated in tenths of a percent.
+    uint32_t perSample = bench.items ? (uint32_t) (bench.cycles / bench.items) : 0;
+    uint32_t budget = bench.items ? (uint32_t) (bench.cycles * benchRate / ((uint64_t) bench.items * BENCHMARK_CLOCK_MHZ * 1000)) : 0;
+
+    snprintf(line, sizeof(line), "BENCH,%s,%d,%d,%s,%d,%d,%d,%d,%d.%d\r\n",
+        bench.name, bench.param, benchRate, formats[benchFormat < 5 ? benchFormat : 0], ble,
+        (int) bench.iterations, (int) bench.items, (int) perSample, (int) (budget / 10), (int) (budget % 10));
+
+    benchmarkPrint(line);
+}
+
+/**
+  * Measure Mixer2 in each mode, for several numbers of channels, output rates and output formats.
+  * Channels run at the output rate, so are not resampled.
+  */
+static void benchmarkMixer()
+{
+    static const int counts[] = { 1, 2, 4, 8 };
+    static const int rates[] = { 22050, 44100 };
+    static const int formats[] = { DATASTREAM_FORMAT_8BIT_UNSIGNED, DATASTREAM_FORMAT_16BIT_UNSIGNED, DATASTREAM_FORMAT_16BIT_SIGNED };
+
+    ToneSource sources[8];
+    NullSink sink;
+
+    for (int mode = MIXER_MODE_FLOAT; mode <= MIXER_MODE_FIXED; mode++)
+    {
+        for (int rate : rates)
+        {
+            for (int format : formats)
+            {
+                for (int count : counts)
+                {
+                    Mixer2 *mixer = new Mixer2(rate, CONFIG_MIXER_INTERNAL_RANGE, format);
+                    mixer->setMode(mode);
+                    mixer->connect(sink);
+
+                    for (int i = 0; i < count; i++)
+                        mixer->addChannel(sources[i]);
+
+                    begin("mixer2", mode == MIXER_MODE_FIXED ? "fixed" : "float", count, rate, format);
+                    while (bench.iterations < BENCHMARK_BLOCKS)
+                    {
+                        uint32_t t = bench.start();
+                        mixer->pull();
+                        bench.stop(t, mixer->getBufferSize());
+                    }
+                    report();
+
+                    delete mixer;
+                }
+            }
+        }
+    }
+}
+
+/**
+  * Measure PolySynth, for several numbers of voices.
+  */
+static void benchmarkPolySynth()
+{
+    static const int counts[] = { 1, 2, 4, 8 };
+
+    SynthPreset preset;
+    memset(&preset, 0, sizeof(preset));
+
+    preset.osc1Shape = OscType::Saw;
+    preset.osc2Shape = OscType::Pulse;
+    preset.osc2Transpose = 7;
+    preset.osc1Vol = 0.5f;
+    preset.osc2Vol = 0.5f;
+    preset.osc1Pwm = 0.2f;
+    preset.osc2Pwm = 0.2f;
+    preset.fmAmount = 0.1f;
+    preset.filterType = FilterType::LPF;
+    preset.filterCutoff = 0.5f;
+    preset.filterReso = 0.3f;
+    preset.filterEnv = 0.2f;
+    preset.filterLfo = 0.1f;
+    preset.envA = 0.01f;
+    preset.envD = 0.2f;
+    preset.envS = 0.7f;
+    preset.envR = 0.3f;
+    preset.lfoShape = OscType::Triangle;
+    preset.lfoFreq = 2.0f;
+    preset.vibFreq = 5.0f;
+    preset.vibAmount = 0.1f;
+    preset.gain = 0.5f;
+    preset.noise = 0.05f;
+
+    for (int count : counts)
+    {
+        PolySynth *synth = new PolySynth(count);
+
+        // Always render every voice, rather than adapting the polyphony to the load.
+        synth->setCycleBudget(0);
+
+        for (int i = 0; i < count; i++)
+            synth->noteOn(48 + i * 5, 0.8f, 3600.0f, &preset);
+
+        begin("polysynth", "process", count, SynthSampleRate, DATASTREAM_FORMAT_16BIT_UNSIGNED);
+        while (bench.iterations < BENCHMARK_BLOCKS)
+        {
+            uint32_t t = bench.start();
+            synth->process(block, SynthBlockSize);
+            bench.stop(t, SynthBlockSize);
+        }
+        report();
+
+        delete synth;
+    }
+}
+
+/**
+  * Measure SoundEmojiSynthesizer, at several sample rates, with each tone print and with and without an effect.
+  */
+static void benchmarkSoundEmoji()
+{
+    static const int rates[] = { 11025, 22050, 44100 };
+    static const struct { const char *name; TonePrintFunction tone; } tones[] = {
+        { "sine", Synthesizer::SineTone },
+        { "sawtooth", Synthesizer::SawtoothTone },
+        { "square", Synthesizer::SquareWaveTone },
+        { "noise", Synthesizer::NoiseTone }
+    };
+
+    for (int rate : rates)
+    {
+        SoundEmojiSynthesizer synth(DEVICE_ID_SOUND_EMOJI_SYNTHESIZER_8, rate);
+        NullSink sink;
+        synth.connect(sink);
+
+        for (int effects = 0; effects <= 1; effects++)
+        {
+            for (auto &tone : tones)
+            {
+                ManagedBuffer sound(sizeof(SoundEffect));
+                SoundEffect *fx = (SoundEffect *) &sound[0];
+
+                // A repeating effect, so that every block is rendered in full until it is stopped.
+                fx->frequency = 440;
+                fx->volume = 1.0f;
+                fx->duration = -1000;
+                fx->tone.tonePrint = tone.tone;
+                fx->tone.parameter = NULL;
+
+                for (int i = 0; i < EMOJI_SYNTHESIZER_TONE_EFFECTS; i++)
+                {
+                    fx->effects[i].effect = NULL;
+                    fx->effects[i].steps = 1;
+                }
+
+                if (effects)
+                {
+                    fx->effects[0].effect = SoundSynthesizerEffects::linearInterpolation;
+                    fx->effects[0].steps = 100;
+                    fx->effects[0].parameter[0] = 880;
+                }
+
+                synth.play(sound);
+
+                begin("emoji", tone.name, effects, rate, DATASTREAM_FORMAT_16BIT_UNSIGNED);
+                while (bench.iterations < BENCHMARK_BLOCKS)
+                {
+                    uint32_t t = bench.start();
+                    ManagedBuffer b = synth.pull();
+                    bench.stop(t, b.length() / 2);
+                }
+                report();
+
+                // Let the synthesizer finish, so that it is ready to play the next effect.
+                synth.stop();
+                synth.pull();
+            }
+        }
+    }
+}
+
+/**
+  * Measure the analysis stages of the microphone pipeline, at their default sample rates.
+  */
+static void benchmarkMicrophone()
+{
+    ToneSource source(DATASTREAM_FORMAT_16BIT_SIGNED, false);
+
+    {
+        SoundLevelDetector level(source, 10000, 0, CONFIG_SOUND_LEVEL_DETECTOR_SAMPLE_RATE, DEVICE_ID_SOUND_LEVEL_DETECTOR, true);
+
+        begin("mic", "level", 0, CONFIG_SOUND_LEVEL_DETECTOR_SAMPLE_RATE, DATASTREAM_FORMAT_16BIT_SIGNED);
+        while (bench.iterations < BENCHMARK_BLOCKS)
+        {
+            uint32_t t = bench.start();
+            level.pullRequest();
+            bench.stop(t, BENCHMARK_TONE_SAMPLES);
+        }
+        report();
+    }
+
+    {
+        SpectrumAnalyser spectrum(source, CONFIG_SPECTRUM_ANALYSER_SAMPLE_RATE, DEVICE_ID_SPECTRUM_ANALYSER, true);
+
+        begin("mic", "spectrum", 0, CONFIG_SPECTRUM_ANALYSER_SAMPLE_RATE, DATASTREAM_FORMAT_16BIT_SIGNED);
+        while (bench.iterations < BENCHMARK_BLOCKS)
+        {
+            uint32_t t = bench.start();
+            spectrum.pullRequest();
+            bench.stop(t, BENCHMARK_TONE_SAMPLES);
+        }
+        report();
+    }
+}
+
+/**
+  * Run every stage of the benchmark.
+  */
+static void benchmarkAll()
+{
+    benchmarkMixer();
+    benchmarkPolySynth();
+    benchmarkSoundEmoji();
+    benchmarkMicrophone();
+}
+
+int
+main()
+{
+    uBit.init();
+
+    benchmarkBegin("case,param,rate,format,ble,blocks,samples,cycles_per_sample,budget_pct");
+
+#if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_ENABLED)
+    uBit.bleManager.stopAdvertising();
+#endif
+
+    ble = 0;
+    benchmarkAll();
+
+#if CONFIG_ENABLED(DEVICE_BLE) && CONFIG_ENABLED(MICROBIT_BLE_ENABLED)
+    uBit.bleManager.advertise();
+    uBit.sleep(BENCHMARK_BLE_WAIT);
+
+    ble = uBit.bleManager.getConnected() ? 2 : 1;
+    benchmarkAll();
+#endif
+
+    benchmarkEnd();
+}
@@ -0,0 +1,116 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * BLE benchmark.
+  *
+  * Runs MicroBitBenchmarkService, so that a BLE client can measure notification and write without response
+  * throughput, and round trip latency, and reports the result of each test over serial. To run it, copy this
+  * file into the source folder of a CODAL project in place of main.cpp, and build with "MICROBIT_BLE_ENABLED": 1
+  * (and "MICROBIT_BLE_OPEN": 1 to skip pairing) in codal.json.
+  *
+  * Tests are started by the client, as described in MicroBitBenchmarkService.h. Between tests:
+  * - button A cycles through the connection profiles of MicroBitBLEManager::setConnectionProfile(),
+  *   and the display shows the profile requested.
+  * - button B cycles the PHY requested through 1M, 2M and automatic.
+  * The central may refuse either request; the parameters each test actually ran with are reported with it.
+  *
+  * Each result is reported as one line of comma separated values, prefixed by BENCH so that it can be
+  * picked out of other serial output. The first line names the columns:
+  *
+  * BENCH,case,profile,phy,mtu,interval_us,slave_latency,packets,bytes,elapsed_us,bytes_per_s,max_per_event,rtt_min_us,rtt_mean_us,rtt_max_us
+  *
+  * - case: notify, write or latency.
+  * - phy: the PHY in use, 1 (1M), 2 (2M) or 4 (coded).
+  * - max_per_event: the most notifications sent in one connection event, for the notify case.
+  * - rtt_*: the round trip times measured by the latency case.
+  */
+
+#include "MicroBit.h"
+#include <stdio.h>
+
+MicroBit uBit;
+
+static MicroBitBenchmarkService *benchmark;
+static int profile = MICROBIT_BLE_CONNECTION_PROFILE_DEFAULT;
+static int phy = MICROBIT_BLE_PHY_AUTO;
+
+static void print(const char *line)
+{
+    uBit.serial.send((uint8_t *) line, strlen(line));
+}
+
+static void onComplete(MicroBitEvent)
+{
+    static const char * const names[] = { "none", "notify", "write", "latency" };
+
+    const MicroBitBenchmarkResult &r = benchmark->getResult();
+    uint32_t rate = r.elapsed ? (uint32_t) ((uint64_t) r.bytes * 1000000 / r.elapsed) : 0;
+
+    char line[160];
+    snprintf(line, sizeof(line), "BENCH,%s,%d,%d,%d,%lu,%d,%lu,%lu,%lu,%lu,%d,%lu,%lu,%lu\r\n",
+             names[r.test <= MICROBIT_BENCHMARK_SERVICE_LATENCY ? r.test : 0], profile, r.phy, r.mtu,
+             (unsigned long) r.interval, r.slaveLatency, (unsigned long) r.packets, (unsigned long) r.bytes,
+             (unsigned long) r.elapsed, (unsigned long) rate, r.maxPerEvent,
+             (unsigned long) r.latencyMin, (unsigned long) r.latencyMean, (unsigned long) r.latencyMax);
+    print(line);
+}
+
+static void onButtonA(MicroBitEvent)
+{
+    if (benchmark->isRunning())
+        return;
+
+    profile = (profile + 1) % (MICROBIT_BLE_CONNECTION_PROFILE_LOW_POWER + 1);
+    uBit.bleManager.setConnectionProfile(profile);
+    uBit.display.printChar('0' + profile);
+}
+
+static void onButtonB(MicroBitEvent)
+{
+    if (benchmark->isRunning())
+        return;
+
+    phy = phy == MICROBIT_BLE_PHY_1M ? MICROBIT_BLE_PHY_2M : phy == MICROBIT_BLE_PHY_2M ? MICROBIT_BLE_PHY_AUTO : MICROBIT_BLE_PHY_1M;
+    uBit.bleManager.setPHY(phy);
+    uBit.display.printChar(phy == MICROBIT_BLE_PHY_AUTO ? 'A' : '0' + phy);
+}
+
+int
+main()
+{
+    uBit.init();
+
+    benchmark = new MicroBitBenchmarkService(*uBit.ble);
+
+    uBit.messageBus.listen(MICROBIT_ID_BLE_BENCHMARK, MICROBIT_BENCHMARK_SERVICE_EVT_COMPLETE, onComplete);
+    uBit.messageBus.listen(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_CLICK, onButtonA);
+    uBit.messageBus.listen(MICROBIT_ID_BUTTON_B, MICROBIT_BUTTON_EVT_CLICK, onButtonB);
+
+    print("BENCH,case,profile,phy,mtu,interval_us,slave_latency,packets,bytes,elapsed_us,bytes_per_s,max_per_event,rtt_min_us,rtt_mean_us,rtt_max_us\r\n");
+    uBit.display.printChar('0' + profile);
+
+    while(1)
+        uBit.sleep(1000);
+}
@@ -0,0 +1,209 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * The harness shared by the benchmark samples.
+  *
+  * Copy this file into the source folder of a CODAL project alongside the benchmark being run. Each benchmark
+  * defines the MicroBit uBit used here, and reports its results as lines of comma separated values prefixed
+  * by BENCH, so that they can be picked out of other serial output:
+  * - benchmarkBegin() starts the DWT cycle counter and sends the line naming the columns.
+  * - benchmarkPrint() sends each line of results.
+  * - benchmarkEnd() sends the line BENCH,end, and never returns.
+  *
+  * Benchmarks that measure CPU time use BenchmarkCase: begin() starts a case, each iteration is timed
+  * between start() and stop(), and the benchmark reports the totals in its own columns.
+  *
+  * Audio components are driven by pulling them directly, with a ToneSource upstream and a NullSink downstream,
+  * so that only the CPU time of the component itself is measured.
+  */
+
+#ifndef BENCHMARK_HARNESS_H
+#define BENCHMARK_HARNESS_H
+
+#include "MicroBit.h"
+#include <stdio.h>
+
+// Number of samples in each buffer generated by a ToneSource.
+#ifndef BENCHMARK_TONE_SAMPLES
+#define BENCHMARK_TONE_SAMPLES      256
+#endif
+
+// CPU clock frequency, used to convert cycles to time.
+#ifndef BENCHMARK_CLOCK_MHZ
+#define BENCHMARK_CLOCK_MHZ         64
+#endif
+
+extern MicroBit uBit;
+
+//
+// A DataSource that supplies the same buffer of a triangle wave for as long as it is pulled.
+// When continuous, each pull() requests the next, as a channel of a Mixer2 expects.
+//
+class ToneSource : public DataSource
+{
+    DataSink *sink;
+    ManagedBuffer buffer;
+    int format;
+    bool continuous;
+
+    public:
+
+    ToneSource(int format = DATASTREAM_FORMAT_16BIT_UNSIGNED, bool continuous = true) : sink(NULL), buffer(BENCHMARK_TONE_SAMPLES * 2), format(format), continuous(continuous)
+    {
+        uint16_t *s = (uint16_t *) &buffer[0];
+
+        for (int i = 0; i < BENCHMARK_TONE_SAMPLES; i++)
+        {
+            int v = (i & 63) < 32 ? (i & 31) * 16 : 512 - (i & 31) * 16;
+            s[i] = format == DATASTREAM_FORMAT_16BIT_SIGNED ? (uint16_t) ((v - 256) * 64) : (uint16_t) v;
+        }
+    }
+
+    virtual ManagedBuffer pull() override
+    {
+        if (sink && continuous)
+            sink->pullRequest();
+
+        return buffer;
+    }
+
+    virtual void connect(DataSink &sink) override
+    {
+        this->sink = &sink;
+
+        if (continuous)
+            this->sink->pullRequest();
+    }
+
+    virtual void disconnect() override
+    {
+        sink = NULL;
+    }
+
+    virtual int getFormat() override
+    {
+        return format;
+    }
+};
+
+//
+// A DataSink that discards the data it is offered. Its source is pulled by the benchmark itself.
+//
+class NullSink : public DataSink
+{
+    public:
+
+    virtual int pullRequest() override
+    {
+        return DEVICE_OK;
+    }
+};
+
+//
+// The CPU time measured for the case currently running.
+//
+struct BenchmarkCase
+{
+    char name[32];
+    int param;
+    uint32_t iterations;
+    uint32_t items;
+    uint64_t cycles;
+
+    /**
+      * Start a new case.
+      * @param prefix the name of the component measured, such as mixer2.
+      * @param operation the name of the operation measured, such as fixed.
+      * @param param a parameter of the case, such as the number of channels.
+      */
+    void begin(const char *prefix, const char *operation, int param)
+    {
+        snprintf(name, sizeof(name), "%s.%s", prefix, operation);
+        this->param = param;
+        iterations = 0;
+        items = 0;
+        cycles = 0;
+    }
+
+    /**
+      * Start timing an iteration.
+      * @return the value of the cycle counter, to pass to stop().
+      */
+    uint32_t start()
+    {
+        return DWT->CYCCNT;
+    }
+
+    /**
+      * Stop timing an iteration.
+      * @param t the value returned by start().
+      * @param items the number of items, such as samples, processed by the iteration.
+      */
+    void stop(uint32_t t, uint32_t items)
+    {
+        cycles += DWT->CYCCNT - t;
+        iterations++;
+        this->items += items;
+    }
+};
+
+/**
+  * Send a line of results over serial.
+  * @param line the line to send, including its line ending.
+  * @param mode the SerialMode to send with. Use SYNC_SPINWAIT if the UART may be powered down straight after.
+  */
+static void benchmarkPrint(const char *line, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE)
+{
+    uBit.serial.send((uint8_t *) line, strlen(line), mode);
+}
+
+/**
+  * Start the DWT cycle counter, and send the line naming the columns of the results.
+  * @param columns the names of the columns, comma separated, following the BENCH prefix.
+  * @param mode the SerialMode to send with.
+  */
+static void benchmarkBegin(const char *columns, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    benchmarkPrint("BENCH,", mode);
+    benchmarkPrint(columns, mode);
+    benchmarkPrint("\r\n", mode);
+}
+
+/**
+  * Send the line BENCH,end, which follows the last result, and idle forever.
+  * @param mode the SerialMode to send with.
+  */
+static void benchmarkEnd(SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE)
+{
+    benchmarkPrint("BENCH,end\r\n", mode);
+
+    while(1)
+        uBit.sleep(1000);
+}
+
+#endif
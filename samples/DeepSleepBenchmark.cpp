@@ -0,0 +1,277 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Deep sleep benchmark.
+  *
+  * Measures how long MicroBitPowerManager takes to enter and leave deep sleep, and how far the actual
+  * wake up time drifts from the time requested, for each wake up source. Results are reported over serial.
+  * To run it, copy this file into the source folder of a CODAL project in place of main.cpp, along with BenchmarkHarness.h.
+  *
+  * The cases are:
+  * - timer: uBit.power.deepSleep(ms), for several periods.
+  * - wakeup.event: uBit.power.deepSleep(), woken by a Timer event created with CODAL_TIMER_EVENT_FLAGS_WAKEUP.
+  * - pin: uBit.power.deepSleep(), woken by button A. Press button A when BENCH,press is reported.
+  *   A wake up timer of BENCHMARK_PIN_TIMEOUT ends any cycle in which the button is not pressed.
+  *
+  * Each result is reported as one line of comma separated values, prefixed by BENCH so that it can be
+  * picked out of other serial output. The first line names the columns:
+  *
+  * BENCH,case,param,cycles,elapsed_us,drift_us,max_drift_us,entry_us,wake_us,max_wake_us,active_us,sleep_us,battery_mv,vin_mv,power
+  *
+  * - param: the period requested, in milliseconds, or 0 if there was none.
+  * - elapsed_us: mean time from the call to the power manager until it returned, measured by the system timer.
+  * - drift_us: mean difference between elapsed_us and the period requested.
+  * - entry_us, wake_us: mean latency of entering deep sleep, and of bringing the peripherals back up after waking,
+  *   as recorded by MicroBitPowerManager::getDeepSleepTiming().
+  * - active_us: mean time the CPU was running during each cycle, from the DWT cycle counter, which stops while the CPU sleeps.
+  * - sleep_us: mean time the CPU spent in deep sleep during each cycle.
+  * - battery_mv, vin_mv, power: the interface chip's power readings taken just after the last cycle.
+  *   The interface chip is itself asleep during deep sleep, so these readings bracket the case rather than measure it.
+  *   Compare active_us and sleep_us between builds to estimate changes in energy per cycle.
+  *
+  * A line BENCH,end follows the last result.
+  */
+
+#include "MicroBit.h"
+#include "BenchmarkHarness.h"
+
+// Number of deep sleep cycles measured in each case.
+#define BENCHMARK_CYCLES            5
+
+// Number of deep sleep cycles measured in the pin case.
+#define BENCHMARK_PIN_CYCLES        3
+
+// Time allowed for button A to be pressed in each cycle of the pin case, in milliseconds.
+#define BENCHMARK_PIN_TIMEOUT       30000
+
+// Event used to wake up in the wakeup.event case.
+#define BENCHMARK_EVT_ID            DEVICE_ID_NOTIFY
+#define BENCHMARK_EVT_VALUE         0x7F00
+
+MicroBit uBit;
+
+//
+// The measurements of the case currently running.
+//
+struct Benchmark
+{
+    char name[32];
+    int param;
+    uint32_t cycles;
+    int64_t elapsed;
+    int64_t drift;
+    int32_t maxDrift;
+    uint64_t entry;
+    uint64_t wake;
+    uint32_t maxWake;
+    uint64_t active;
+    uint64_t sleep;
+};
+
+static Benchmark bench;
+static CODAL_TIMESTAMP cycleStart;
+static MicroBitDeepSleepTiming cycleTiming;
+
+// Wait for each line to be sent, so that it is not lost when the UART is powered down for deep sleep.
+static void print(const char *line)
+{
+    benchmarkPrint(line, SYNC_SPINWAIT);
+}
+
+/**
+  * Start a new case.
+  * @param name the name of the case.
+  * @param param the period requested in milliseconds, or 0 if there was none.
+  */
+static void begin(const char *name, int param)
+{
+    memset(&bench, 0, sizeof(bench));
+    snprintf(bench.name, sizeof(bench.name), "%s", name);
+    bench.param = param;
+    bench.maxDrift = INT32_MIN;
+}
+
+/**
+  * Start timing one deep sleep cycle.
+  */
+static void startCycle()
+{
+    cycleTiming = uBit.power.getDeepSleepTiming();
+
+    DWT->CYCCNT = 0;
+    cycleStart = system_timer_current_time_us();
+}
+
+/**
+  * Record the completion of one deep sleep cycle.
+  * @param requested the time the sleep was requested for, in microseconds, or 0 if there was none.
+  */
+static void endCycle(uint32_t requested)
+{
+    uint32_t cycles = DWT->CYCCNT;
+    uint32_t elapsed = system_timer_current_time_us() - cycleStart;
+    const MicroBitDeepSleepTiming &timing = uBit.power.getDeepSleepTiming();
+
+    bench.cycles++;
+    bench.elapsed += elapsed;
+    bench.active += cycles / (SystemCoreClock / 1000000);
+
+    if (requested)
+    {
+        int32_t drift = (int32_t) (elapsed - requested);
+
+        bench.drift += drift;
+        bench.maxDrift = max(bench.maxDrift, drift);
+    }
+
+    // Only count the latency of cycles that actually entered deep sleep.
+    if (timing.cycles != cycleTiming.cycles)
+    {
+        bench.entry += timing.entryLatency;
+        bench.wake += timing.wakeLatency;
+        bench.maxWake = max(bench.maxWake, timing.wakeLatency);
+        bench.sleep += timing.sleepTime - cycleTiming.sleepTime;
+    }
+}
+
+/**
+  * Report the results of the current case.
+  */
+static void report()
+{
+    char line[192];
+    uint32_t n = bench.cycles ? bench.cycles : 1;
+
+    uBit.power.refreshTelemetry();
+    MicroBitPowerData power = uBit.power.getPowerData();
+
+    snprintf(line, sizeof(line), "BENCH,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\r\n",
+        bench.name, bench.param, (int) bench.cycles, (int) (bench.elapsed / n),
+        bench.param ? (int) (bench.drift / n) : 0, bench.param && bench.cycles ? (int) bench.maxDrift : 0,
+        (int) (bench.entry / n), (int) (bench.wake / n), (int) bench.maxWake,
+        (int) (bench.active / n), (int) (bench.sleep / n),
+        (int) (power.batteryMicroVolts / 1000), (int) (power.vinMicroVolts / 1000), (int) power.estimatedPowerConsumption);
+
+    print(line);
+}
+
+/**
+  * Measure deepSleep(ms) for the given period.
+  */
+static void benchmarkTimer(int period)
+{
+    begin("timer", period);
+
+    for (int i = 0; i < BENCHMARK_CYCLES; i++)
+    {
+        startCycle();
+        uBit.power.deepSleep(period);
+        endCycle(period * 1000);
+    }
+
+    report();
+}
+
+/**
+  * Measure deepSleep(), woken up by a timer event with the CODAL_TIMER_EVENT_FLAGS_WAKEUP flag.
+  */
+static void benchmarkWakeUpEvent(int period)
+{
+    begin("wakeup.event", period);
+
+    for (int i = 0; i < BENCHMARK_CYCLES; i++)
+    {
+        startCycle();
+        system_timer_event_after(period, BENCHMARK_EVT_ID, BENCHMARK_EVT_VALUE, CODAL_TIMER_EVENT_FLAGS_WAKEUP);
+        uBit.power.deepSleep();
+        endCycle(period * 1000);
+    }
+
+    report();
+}
+
+/**
+  * Measure deepSleep(), woken up by button A.
+  */
+static void benchmarkPin()
+{
+    int timeouts = 0;
+
+    begin("pin", 0);
+    uBit.io.buttonA.wakeOnActive(true);
+
+    for (int i = 0; i < BENCHMARK_PIN_CYCLES; i++)
+    {
+        // Wait for any earlier press to be released first, so it doesn't wake us immediately.
+        while (uBit.buttonA.isPressed())
+            uBit.sleep(10);
+
+        print("BENCH,press\r\n");
+
+        startCycle();
+        system_timer_event_after(BENCHMARK_PIN_TIMEOUT, BENCHMARK_EVT_ID, BENCHMARK_EVT_VALUE, CODAL_TIMER_EVENT_FLAGS_WAKEUP);
+        uBit.power.deepSleep();
+        system_timer_cancel_event(BENCHMARK_EVT_ID, BENCHMARK_EVT_VALUE);
+
+        if (system_timer_current_time_us() - cycleStart >= (CODAL_TIMESTAMP) BENCHMARK_PIN_TIMEOUT * 1000)
+        {
+            timeouts++;
+            continue;
+        }
+
+        endCycle(0);
+    }
+
+    uBit.io.buttonA.wakeOnActive(false);
+    report();
+
+    if (timeouts)
+    {
+        char line[48];
+        snprintf(line, sizeof(line), "BENCH,pin.timeouts,%d\r\n", timeouts);
+        print(line);
+    }
+}
+
+int
+main()
+{
+    static const int periods[] = { 100, 250, 1000, 5000 };
+
+    uBit.init();
+
+    // This also starts the cycle counter, used to measure the time the CPU spends awake.
+    benchmarkBegin("case,param,cycles,elapsed_us,drift_us,max_drift_us,entry_us,wake_us,max_wake_us,active_us,sleep_us,battery_mv,vin_mv,power", SYNC_SPINWAIT);
+
+    for (int period : periods)
+        benchmarkTimer(period);
+
+    for (int period : periods)
+        benchmarkWakeUpEvent(period);
+
+    benchmarkPin();
+
+    benchmarkEnd(SYNC_SPINWAIT);
+}
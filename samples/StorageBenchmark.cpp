@@ -0,0 +1,493 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Storage benchmark.
+  *
+  * Measures the performance of MicroBitFileSystem, MicroBitLog, FSCache and the raw FLASH memory
+  * controllers, and reports the results over serial. To run it, copy this file into the source
+  * folder of a CODAL project in place of main.cpp, along with BenchmarkHarness.h.
+  *
+  * WARNING: this erases the data log, the USB FLASH storage, the internal FLASH scratch page
+  * and any MicroBitFileSystem held in internal FLASH.
+  *
+  * Each result is reported as one line of comma separated values, prefixed by BENCH so that it can be
+  * picked out of other serial output. The first line names the columns:
+  *
+  * BENCH,case,param,ops,bytes,elapsed_us,bytes_per_s,p50_us,p90_us,p99_us,max_us,nvm_reads,nvm_writes,nvm_erases,cache_hits,cache_misses
+  *
+  * - case: the operation measured, such as mbfs.write.seq.
+  * - param: the size of each operation in bytes, or the number of columns in each row of the log.
+  * - elapsed_us: the time taken by the whole case, including any setup such as closing a file.
+  * - pNN_us, max_us: latency of individual operations, sampled when there are more than BENCHMARK_SAMPLES.
+  * - nvm_*: operations issued to the memory controller. cache_*: blocks found in, or loaded into, an FSCache.
+  *   These are -1 where they do not apply.
+  *
+  * A line BENCH,end follows the last result.
+  */
+
+#include "MicroBit.h"
+#include "MicroBitFileSystem.h"
+#include "BenchmarkHarness.h"
+#include <stdlib.h>
+
+// Maximum number of latency samples kept for each case.
+#define BENCHMARK_SAMPLES           128
+
+// Size of the file written and read by each file system case, in bytes.
+#define BENCHMARK_FILE_SIZE         16384
+
+// Number of seek/write operations in each random write case, as these trigger page rewrites.
+#define BENCHMARK_RANDOM_WRITES     16
+
+// Number of pages of USB FLASH used by the raw FLASH and file system cases.
+#define BENCHMARK_USB_PAGES         16
+
+// Number of rows appended to the log by each log case.
+#define BENCHMARK_LOG_ROWS          200
+
+MicroBit uBit;
+
+//
+// A memory controller that counts the operations passed through it to another.
+//
+class CountingNVM : public NVMController
+{
+    NVMController &nvm;
+
+    public:
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+
+    CountingNVM(NVMController &nvm) : nvm(nvm)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        reads = writes = erases = 0;
+    }
+
+    virtual int read(uint32_t* dest, uint32_t address, uint32_t length) override
+    {
+        reads++;
+        return nvm.read(dest, address, length);
+    }
+
+    virtual int write(uint32_t address, uint32_t *data, uint32_t length) override
+    {
+        writes++;
+        return nvm.write(address, data, length);
+    }
+
+    virtual int erase(uint32_t page) override
+    {
+        erases++;
+        return nvm.erase(page);
+    }
+
+    virtual uint32_t getFlashStart() override { return nvm.getFlashStart(); }
+    virtual uint32_t getFlashEnd() override { return nvm.getFlashEnd(); }
+    virtual uint32_t getPageSize() override { return nvm.getPageSize(); }
+    virtual uint32_t getFlashSize() override { return nvm.getFlashSize(); }
+};
+
+//
+// The measurements of the case currently running.
+//
+struct Benchmark
+{
+    char name[32];
+    int param;
+    CountingNVM *nvm;
+    uint32_t ops;
+    uint32_t bytes;
+    CODAL_TIMESTAMP start;
+    CODAL_TIMESTAMP end;
+    int samples;
+    uint32_t latency[BENCHMARK_SAMPLES];
+};
+
+static Benchmark bench;
+
+// Data written by each case. Held as words, as the memory controllers transfer 32-bit words.
+static uint32_t data[1024 / 4];
+static uint32_t readBuffer[1024 / 4];
+
+static const char * const columns[] = { "c0", "c1", "c2", "c3", "c4", "c5", "c6", "c7" };
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+  * Start a new case.
+  * @param prefix the name of the component measured, such as mbfs.
+  * @param operation the name of the operation measured, such as write.seq.
+  * @param param the size of each operation, in bytes, or another parameter of the case.
+  * @param nvm the memory controller to count operations of, or NULL.
+  */
+static void begin(const char *prefix, const char *operation, int param, CountingNVM *nvm = NULL)
+{
+    snprintf(bench.name, sizeof(bench.name), "%s.%s", prefix, operation);
+    bench.param = param;
+    bench.nvm = nvm;
+    bench.ops = 0;
+    bench.bytes = 0;
+    bench.samples = 0;
+    bench.end = 0;
+
+    if (nvm)
+        nvm->reset();
+
+    bench.start = system_timer_current_time_us();
+}
+
+/**
+  * Record the completion of one operation.
+  * Once BENCHMARK_SAMPLES latencies are held, each new one replaces a random sample, so that
+  * the samples remain representative of every operation.
+  * @param t the time at which the operation started.
+  * @param bytes the number of bytes transferred by the operation.
+  */
+static void record(CODAL_TIMESTAMP t, uint32_t bytes)
+{
+    uint32_t l = system_timer_current_time_us() - t;
+
+    bench.ops++;
+    bench.bytes += bytes;
+
+    if (bench.samples < BENCHMARK_SAMPLES)
+    {
+        bench.latency[bench.samples++] = l;
+    }
+    else
+    {
+        uint32_t i = microbit_random(bench.ops);
+        if (i < BENCHMARK_SAMPLES)
+            bench.latency[i] = l;
+    }
+}
+
+/**
+  * Stop timing the current case.
+  */
+static void finish()
+{
+    if (bench.end == 0)
+        bench.end = system_timer_current_time_us();
+}
+
+/**
+  * Report the results of the current case.
+  * @param stats the usage counters of the FSCache used by the case, or NULL.
+  */
+static void report(FSCacheStatistics *stats = NULL)
+{
+    char line[160];
+
+    finish();
+
+    uint32_t elapsed = bench.end - bench.start;
+    uint32_t rate = elapsed ? (uint32_t) ((uint64_t) bench.bytes * 1000000 / elapsed) : 0;
+    uint32_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+    if (bench.samples)
+    {
+        qsort(bench.latency, bench.samples, sizeof(uint32_t), compareLatency);
+        p50 = bench.latency[(bench.samples - 1) * 50 / 100];
+        p90 = bench.latency[(bench.samples - 1) * 90 / 100];
+        p99 = bench.latency[(bench.samples - 1) * 99 / 100];
+        max = bench.latency[bench.samples - 1];
+    }
+
+    // Operations of a cache are only counted as memory controller operations if its controller isn't counted directly.
+    int nvmReads = bench.nvm ? (int) bench.nvm->reads : stats ? (int) stats->nvmReads : -1;
+    int nvmWrites = bench.nvm ? (int) bench.nvm->writes : stats ? (int) stats->nvmWrites : -1;
+    int nvmErases = bench.nvm ? (int) bench.nvm->erases : -1;
+
+    snprintf(line, sizeof(line), "BENCH,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\r\n",
+        bench.name, bench.param, (int) bench.ops, (int) bench.bytes, (int) elapsed, (int) rate,
+        (int) p50, (int) p90, (int) p99, (int) max, nvmReads, nvmWrites, nvmErases,
+        stats ? (int) stats->hits : -1, stats ? (int) stats->misses : -1);
+
+    benchmarkPrint(line);
+}
+
+/**
+  * Measure erase, write and read operations on the given memory controller.
+  * @param prefix the name to report the cases under.
+  * @param flash the memory controller to measure.
+  * @param pages the number of pages to use, from the start of the memory controller.
+  */
+static void benchmarkFlash(const char *prefix, NVMController &flash, int pages)
+{
+    static const int writeSizes[] = { 32, 256 };
+    static const int readSizes[] = { 32, 256, 1024 };
+
+    CountingNVM nvm(flash);
+    uint32_t pageSize = nvm.getPageSize();
+    uint32_t start = nvm.getFlashStart();
+    uint32_t end = start + pages * pageSize;
+    CODAL_TIMESTAMP t;
+
+    begin(prefix, "erase", pageSize, &nvm);
+    for (uint32_t page = start; page < end; page += pageSize)
+    {
+        t = system_timer_current_time_us();
+        nvm.erase(page);
+        record(t, pageSize);
+    }
+    report();
+
+    for (int size : writeSizes)
+    {
+        for (uint32_t page = start; page < end; page += pageSize)
+            nvm.erase(page);
+
+        begin(prefix, "write", size, &nvm);
+        for (uint32_t address = start; address < end; address += size)
+        {
+            t = system_timer_current_time_us();
+            nvm.write(address, data, size / 4);
+            record(t, size);
+        }
+        report();
+    }
+
+    for (int size : readSizes)
+    {
+        begin(prefix, "read", size, &nvm);
+        for (uint32_t address = start; address < end; address += size)
+        {
+            t = system_timer_current_time_us();
+            nvm.read(readBuffer, address, size / 4);
+            record(t, size);
+        }
+        report();
+    }
+}
+
+/**
+  * Measure the hit rate of an FSCache of MBFS_NVM_CACHE_SIZE blocks on the USB FLASH, reading with
+  * sequential, local and widely scattered access patterns.
+  * Uses the data written by benchmarkFlash().
+  */
+static void benchmarkCache()
+{
+    CountingNVM nvm(uBit.flash);
+    FSCache cache(nvm, MBFS_BLOCK_SIZE, MBFS_NVM_CACHE_SIZE);
+    FSCacheStatistics stats;
+    uint32_t length = BENCHMARK_USB_PAGES * nvm.getPageSize();
+    uint8_t *buffer = (uint8_t *) readBuffer;
+    CODAL_TIMESTAMP t;
+
+    for (int readAhead = 0; readAhead <= 2; readAhead += 2)
+    {
+        cache.clear();
+        cache.setReadAhead(readAhead);
+        cache.resetStatistics();
+
+        begin("fscache", readAhead ? "read.seq.ahead" : "read.seq", 16, &nvm);
+        for (uint32_t address = 0; address < length; address += 16)
+        {
+            t = system_timer_current_time_us();
+            cache.read(address, buffer, 16);
+            record(t, 16);
+        }
+        stats = cache.getStatistics();
+        report(&stats);
+    }
+
+    cache.setReadAhead(0);
+
+    // Random reads confined to blocks that fit in the cache, and then spread over the whole region.
+    for (int wide = 0; wide < 2; wide++)
+    {
+        uint32_t span = wide ? length : MBFS_NVM_CACHE_SIZE * MBFS_BLOCK_SIZE;
+
+        cache.clear();
+        cache.resetStatistics();
+
+        begin("fscache", wide ? "read.rand.wide" : "read.rand.local", 16, &nvm);
+        for (int i = 0; i < 512; i++)
+        {
+            uint32_t address = microbit_random(span / 16) * 16;
+
+            t = system_timer_current_time_us();
+            cache.read(address, buffer, 16);
+            record(t, 16);
+        }
+        stats = cache.getStatistics();
+        report(&stats);
+    }
+}
+
+/**
+  * Measure sequential and random reads and writes of a file, at several operation sizes.
+  * @param prefix the name to report the cases under.
+  * @param fs the file system to measure.
+  * @param nvm the memory controller holding the file system, or NULL if it is in internal FLASH.
+  */
+static void benchmarkFileSystem(const char *prefix, MicroBitFileSystem &fs, CountingNVM *nvm)
+{
+    static const int sizes[] = { 32, 256, 1024 };
+
+    uint8_t *buffer = (uint8_t *) data;
+    CODAL_TIMESTAMP t;
+    int fd;
+
+    for (int size : sizes)
+    {
+        int count = BENCHMARK_FILE_SIZE / size;
+
+        fs.remove("bench");
+
+        begin(prefix, "write.seq", size, nvm);
+        fd = fs.open("bench", MB_WRITE | MB_CREAT);
+        for (int i = 0; i < count; i++)
+        {
+            t = system_timer_current_time_us();
+            fs.write(fd, buffer, size);
+            record(t, size);
+        }
+        fs.close(fd);
+        report();
+
+        begin(prefix, "read.seq", size, nvm);
+        fd = fs.open("bench", MB_READ);
+        for (int i = 0; i < count; i++)
+        {
+            t = system_timer_current_time_us();
+            fs.read(fd, (uint8_t *) readBuffer, size);
+            record(t, size);
+        }
+        fs.close(fd);
+        report();
+
+        begin(prefix, "read.rand", size, nvm);
+        fd = fs.open("bench", MB_READ);
+        for (int i = 0; i < count; i++)
+        {
+            t = system_timer_current_time_us();
+            fs.seek(fd, microbit_random(count) * size, MB_SEEK_SET);
+            fs.read(fd, (uint8_t *) readBuffer, size);
+            record(t, size);
+        }
+        fs.close(fd);
+        report();
+
+        begin(prefix, "write.rand", size, nvm);
+        fd = fs.open("bench", MB_WRITE);
+        for (int i = 0; i < min(count, BENCHMARK_RANDOM_WRITES); i++)
+        {
+            t = system_timer_current_time_us();
+            fs.seek(fd, microbit_random(count) * size, MB_SEEK_SET);
+            fs.write(fd, buffer, size);
+            record(t, size);
+        }
+        fs.close(fd);
+        report();
+    }
+
+    fs.remove("bench");
+}
+
+/**
+  * Measure the time taken to append rows to the data log, with several numbers of columns.
+  * The bytes reported are the length of the log when exported as CSV.
+  */
+static void benchmarkLog()
+{
+    static const int counts[] = { 1, 4, 8 };
+
+    FSCacheStatistics stats;
+    CODAL_TIMESTAMP t;
+
+    // Erase everything, as the file system cases may have overwritten the log.
+    uBit.log.clear(true);
+
+    for (int count : counts)
+    {
+        uBit.log.clear(false);
+        uBit.log.resetCacheStatistics();
+
+        begin("log", "row", count);
+        for (int row = 0; row < BENCHMARK_LOG_ROWS; row++)
+        {
+            t = system_timer_current_time_us();
+            uBit.log.beginRow();
+
+            for (int column = 0; column < count; column++)
+                uBit.log.logData(columns[column], row * 10 + column);
+
+            uBit.log.endRow();
+            record(t, 0);
+        }
+
+        // Include the time taken to write out any rows still queued.
+        uBit.log.flush();
+        finish();
+
+        bench.bytes = uBit.log.getDataLength(DataFormat::CSV);
+        stats = uBit.log.getCacheStatistics();
+        report(&stats);
+    }
+}
+
+int
+main()
+{
+    uBit.init();
+
+    for (uint32_t i = 0; i < sizeof(data) / 4; i++)
+        data[i] = microbit_random(0x7FFFFFFF);
+
+    benchmarkBegin("case,param,ops,bytes,elapsed_us,bytes_per_s,p50_us,p90_us,p99_us,max_us,nvm_reads,nvm_writes,nvm_erases,cache_hits,cache_misses");
+
+    // Raw FLASH. Internal FLASH is measured using the scratch page, which holds no persistent data.
+    NRF52FlashManager scratch(MICROBIT_DEFAULT_SCRATCH_PAGE, 1, MICROBIT_CODEPAGESIZE);
+    benchmarkFlash("nrf52", scratch, 1);
+    benchmarkFlash("usb", uBit.flash, BENCHMARK_USB_PAGES);
+
+    benchmarkCache();
+
+    // The file systems are kept for the life of the program, as they can not be unmounted.
+    MicroBitFileSystem *fs = new MicroBitFileSystem();
+    benchmarkFileSystem("mbfs", *fs, NULL);
+
+    CountingNVM *nvm = new CountingNVM(uBit.flash);
+    MicroBitFileSystem *usbfs = new MicroBitFileSystem(*nvm, 0, BENCHMARK_USB_PAGES);
+    benchmarkFileSystem("mbfs.usb", *usbfs, nvm);
+
+    benchmarkLog();
+
+    benchmarkEnd();
+}
@@ -0,0 +1,158 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AudioBufferPool.h"
+#include "ErrorNo.h"
+#include <stdlib.h>
+
+using namespace codal;
+
+AudioBufferPool* AudioBufferPool::defaultPool = NULL;
+
+/**
+ * Constructor.
+ * Creates an empty pool. No memory is allocated until the first buffer is requested.
+ *
+ * @param blockSize The size of each block, in bytes.
+ * @param maxBlocks The maximum number of blocks to hold.
+ */
+AudioBufferPool::AudioBufferPool(int blockSize, int maxBlocks)
+{
+    this->blocks = NULL;
+    this->blockSize = blockSize;
+    this->maxBlocks = maxBlocks > 0 ? maxBlocks : 0;
+    this->blockCount = 0;
+    this->nextBlock = 0;
+    this->idleRefCount = 0;
+    this->misses = 0;
+}
+
+/**
+ * Destructor.
+ * Releases the pool's reference to each block. Blocks still in use are freed when their last user releases them.
+ */
+AudioBufferPool::~AudioBufferPool()
+{
+    for (int i = 0; i < blockCount; i++)
+        blocks[i]->decr();
+
+    free(blocks);
+}
+
+/**
+ * Determine the pool shared by the audio pipeline, creating it if necessary.
+ * @return the default AudioBufferPool.
+ */
+AudioBufferPool& AudioBufferPool::getDefault()
+{
+    if (defaultPool == NULL)
+        defaultPool = new AudioBufferPool();
+
+    return *defaultPool;
+}
+
+/**
+ * Provide a ManagedBuffer of the given length, taken from the pool where possible.
+ *
+ * @param length The length of the buffer required, in bytes.
+ * @return A ManagedBuffer of the requested length.
+ */
+ManagedBuffer AudioBufferPool::allocate(int length)
+{
+    if (length <= 0 || length > blockSize || maxBlocks == 0)
+    {
+        misses++;
+        return ManagedBuffer(length);
+    }
+
+    // Look for a block that nobody but the pool holds a reference to.
+    for (int i = 0; i < blockCount; i++)
+    {
+        BufferData *b = blocks[nextBlock];
+        nextBlock = (nextBlock + 1) % blockCount;
+
+        if (b->refCount == idleRefCount)
+        {
+            b->length = length;
+            return ManagedBuffer(b);
+        }
+    }
+
+    // Grow the pool if we are permitted to.
+    if (blockCount < maxBlocks)
+    {
+        if (blocks == NULL)
+            blocks = (BufferData **) malloc(sizeof(BufferData *) * maxBlocks);
+
+        BufferData *b = (BufferData *) malloc(sizeof(BufferData) + blockSize);
+
+        if (blocks && b)
+        {
+            b->init();
+            b->length = length;
+            idleRefCount = b->refCount;
+
+            blocks[blockCount++] = b;
+            return ManagedBuffer(b);
+        }
+
+        free(b);
+    }
+
+    misses++;
+    return ManagedBuffer(length);
+}
+
+/**
+ * Determine the number of blocks currently allocated by this pool.
+ * @return the number of blocks.
+ */
+int AudioBufferPool::getBlockCount()
+{
+    return blockCount;
+}
+
+/**
+ * Determine the number of allocated blocks not currently in use.
+ * @return the number of free blocks.
+ */
+int AudioBufferPool::getFreeCount()
+{
+    int count = 0;
+
+    for (int i = 0; i < blockCount; i++)
+        if (blocks[i]->refCount == idleRefCount)
+            count++;
+
+    return count;
+}
+
+/**
+ * Determine the number of requests that could not be served from the pool.
+ * @return the number of heap allocations performed on behalf of callers.
+ */
+uint32_t AudioBufferPool::getMissCount()
+{
+    return misses;
+}
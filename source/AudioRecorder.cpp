@@ -0,0 +1,384 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AudioRecorder.h"
+#include "FSCache.h"
+#include "NVMController.h"
+#include "MicroBitFileSystem.h"
+#include "EventModel.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param source The stream of audio to record. 8 and 16 bit signed and unsigned formats are supported.
+ * @param id The event ID to raise AUDIO_RECORDER_EVT_DONE on when recording stops.
+ */
+AudioRecorder::AudioRecorder(DataSource &source, uint16_t id) : upstream(source)
+{
+    this->id = id;
+    this->fs = NULL;
+    this->fd = -1;
+    this->cache = NULL;
+    this->address = 0;
+    this->limit = 0;
+    this->blocks = NULL;
+    this->full = 0;
+    this->head = 0;
+    this->tail = 0;
+    this->position = 0;
+    this->length = 0;
+    this->dropped = 0;
+    this->result = DEVICE_OK;
+
+    // Blocks are written out on a fiber, one at a time.
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, AUDIO_RECORDER_EVT_BLOCK_READY, this, &AudioRecorder::onBlockReady);
+}
+
+/**
+ * Destructor. Stops any recording in progress.
+ */
+AudioRecorder::~AudioRecorder()
+{
+    stop();
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, AUDIO_RECORDER_EVT_BLOCK_READY, this, &AudioRecorder::onBlockReady);
+}
+
+/**
+ * Start recording into a file, from its current seek position.
+ * The file must remain open until recording stops.
+ *
+ * @param fs The file system holding the file.
+ * @param fd A file handle, opened with MB_WRITE.
+ * @return DEVICE_OK on success, DEVICE_BUSY if already recording, DEVICE_NOT_SUPPORTED if the
+ * source format is not supported, or DEVICE_NO_RESOURCES if buffers could not be allocated.
+ */
+int AudioRecorder::record(MicroBitFileSystem &fs, int fd)
+{
+    if (status & AUDIO_RECORDER_STATUS_RECORDING)
+        return DEVICE_BUSY;
+
+    this->fs = &fs;
+    this->fd = fd;
+    this->cache = NULL;
+
+    return start();
+}
+
+/**
+ * Start recording into a region of non-volatile memory, through the given cache.
+ * The whole region is erased before capture begins, so that no erase cycles are needed while
+ * recording (erasing pages of MicroBitUSBFlashManager can stall for longer than our buffers last).
+ * Recording stops automatically when the region is full.
+ *
+ * @param cache The cache used to write to memory.
+ * @param flash The memory controller behind the cache.
+ * @param address The logical address of the region. Must be aligned to a page boundary.
+ * @param length The length of the region, in bytes.
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the region is invalid, or as for record().
+ */
+int AudioRecorder::record(FSCache &cache, NVMController &flash, uint32_t address, uint32_t length)
+{
+    uint32_t pageSize = flash.getPageSize();
+
+    if (status & AUDIO_RECORDER_STATUS_RECORDING)
+        return DEVICE_BUSY;
+
+    if (length == 0 || address < flash.getFlashStart() || address + length > flash.getFlashEnd() || (address - flash.getFlashStart()) % pageSize)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (uint32_t page = address; page < address + length; page += pageSize)
+        flash.erase(page);
+
+    // Any cached copies of the region are now stale.
+    cache.clear();
+
+    this->fs = NULL;
+    this->cache = &cache;
+    this->address = address;
+    this->limit = address + length;
+
+    return start();
+}
+
+/**
+ * Allocate buffers and begin capture.
+ */
+int AudioRecorder::start()
+{
+    int format = upstream.getFormat();
+
+    if (format < DATASTREAM_FORMAT_8BIT_UNSIGNED || format > DATASTREAM_FORMAT_16BIT_SIGNED)
+        return DEVICE_NOT_SUPPORTED;
+
+    writeLock.wait();
+
+    if (blocks == NULL)
+        blocks = (uint8_t *) malloc(CONFIG_AUDIO_RECORDER_BUFFERS * CONFIG_IMA_ADPCM_BLOCK_SIZE);
+
+    if (blocks == NULL)
+    {
+        writeLock.notify();
+        return DEVICE_NO_RESOURCES;
+    }
+
+    full = 0;
+    head = 0;
+    tail = 0;
+    position = 0;
+    adpcm.predictor = 0;
+    adpcm.index = 0;
+    length = 0;
+    dropped = 0;
+    result = DEVICE_OK;
+
+    status &= ~AUDIO_RECORDER_STATUS_HIGH_NIBBLE;
+    status |= AUDIO_RECORDER_STATUS_RECORDING;
+    writeLock.notify();
+
+    upstream.connect(*this);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop recording, and write any remaining audio to storage.
+ * @return DEVICE_OK on success, or the error code of the first failed write to storage.
+ */
+int AudioRecorder::stop()
+{
+    writeLock.wait();
+
+    if (blocks == NULL)
+    {
+        writeLock.notify();
+        return result;
+    }
+
+    halt();
+    drain();
+
+    // Write out the partially filled block. FlashAudioSource treats the end of the data as the end of the block.
+    if (position > 0 && result == DEVICE_OK)
+    {
+        int n = position + ((status & AUDIO_RECORDER_STATUS_HIGH_NIBBLE) ? 1 : 0);
+        result = store(blocks + head * CONFIG_IMA_ADPCM_BLOCK_SIZE, n);
+    }
+
+    // Ensure everything recorded has reached storage, if the cache is holding it back.
+    if (cache && result == DEVICE_OK)
+        result = cache->flush();
+
+    position = 0;
+    free(blocks);
+    blocks = NULL;
+
+    writeLock.notify();
+
+    return result;
+}
+
+/**
+ * Determine if a recording is in progress.
+ * @return true if recording, false otherwise.
+ */
+bool AudioRecorder::isRecording()
+{
+    return status & AUDIO_RECORDER_STATUS_RECORDING;
+}
+
+/**
+ * Determine the amount of compressed audio written to storage by the current (or last) recording.
+ * @return the length, in bytes.
+ */
+uint32_t AudioRecorder::getLength()
+{
+    return length;
+}
+
+/**
+ * Determine the number of samples lost because storage could not keep up with the audio stream.
+ * @return the number of samples dropped during the current (or last) recording.
+ */
+uint32_t AudioRecorder::getDroppedSamples()
+{
+    return dropped;
+}
+
+/**
+ * Stop capture, if in progress, and notify listeners.
+ */
+void AudioRecorder::halt()
+{
+    if (!(status & AUDIO_RECORDER_STATUS_RECORDING))
+        return;
+
+    target_disable_irq();
+    status &= ~AUDIO_RECORDER_STATUS_RECORDING;
+    target_enable_irq();
+
+    upstream.disconnect();
+    Event(id, AUDIO_RECORDER_EVT_DONE);
+}
+
+/**
+ * Write the given compressed audio to storage.
+ */
+int AudioRecorder::store(uint8_t *data, int len)
+{
+    if (fs)
+    {
+        if (fs->write(fd, data, len) != len)
+            return DEVICE_NO_RESOURCES;
+    }
+    else
+    {
+        if (address + len > limit)
+            return DEVICE_NO_RESOURCES;
+
+        int r = cache->write(address, data, len);
+        if (r != DEVICE_OK)
+            return r;
+
+        address += len;
+    }
+
+    length += len;
+    return DEVICE_OK;
+}
+
+/**
+ * Write completed blocks to storage.
+ * Called with writeLock held.
+ */
+void AudioRecorder::drain()
+{
+    while (full > 0 && result == DEVICE_OK)
+    {
+        result = store(blocks + tail * CONFIG_IMA_ADPCM_BLOCK_SIZE, CONFIG_IMA_ADPCM_BLOCK_SIZE);
+        tail = (tail + 1) % CONFIG_AUDIO_RECORDER_BUFFERS;
+
+        // Only now can the block be refilled.
+        target_disable_irq();
+        full--;
+        target_enable_irq();
+    }
+
+    // If storage is full (or failing), there's no point in capturing any more audio.
+    if (result != DEVICE_OK)
+        halt();
+}
+
+/**
+ * Event handler, run on a fiber whenever a block is ready to be written.
+ */
+void AudioRecorder::onBlockReady(Event)
+{
+    writeLock.wait();
+
+    if (blocks)
+        drain();
+
+    writeLock.notify();
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int AudioRecorder::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    if (!(status & AUDIO_RECORDER_STATUS_RECORDING))
+        return DEVICE_OK;
+
+    int format = upstream.getFormat();
+    int bytesPerSample = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+    uint8_t *in = &b[0];
+    uint8_t *end = in + b.length();
+    uint8_t *block = blocks + head * CONFIG_IMA_ADPCM_BLOCK_SIZE;
+    bool highNibble = status & AUDIO_RECORDER_STATUS_HIGH_NIBBLE;
+
+    while (in < end)
+    {
+        int sample;
+
+        if (format == DATASTREAM_FORMAT_8BIT_UNSIGNED)
+            sample = (*in - 128) << 8;
+        else if (format == DATASTREAM_FORMAT_8BIT_SIGNED)
+            sample = *((int8_t *)in) << 8;
+        else if (format == DATASTREAM_FORMAT_16BIT_UNSIGNED)
+            sample = *((uint16_t *)in) - 32768;
+        else
+            sample = *((int16_t *)in);
+
+        in += bytesPerSample;
+
+        // If every block is waiting to be written, we have nowhere to put this sample.
+        if (full == CONFIG_AUDIO_RECORDER_BUFFERS)
+        {
+            dropped++;
+            continue;
+        }
+
+        if (position == 0)
+        {
+            ima_adpcm_write_header(adpcm, block, sample);
+            position = IMA_ADPCM_HEADER_SIZE;
+            continue;
+        }
+
+        int code = ima_adpcm_encode(adpcm, sample);
+
+        if (highNibble)
+            block[position++] |= code << 4;
+        else
+            block[position] = code;
+
+        highNibble = !highNibble;
+
+        if (position == CONFIG_IMA_ADPCM_BLOCK_SIZE)
+        {
+            // Hand this block over to be written, and move on to the next.
+            position = 0;
+            head = (head + 1) % CONFIG_AUDIO_RECORDER_BUFFERS;
+            block = blocks + head * CONFIG_IMA_ADPCM_BLOCK_SIZE;
+            full++;
+
+            Event(id, AUDIO_RECORDER_EVT_BLOCK_READY);
+        }
+    }
+
+    if (highNibble)
+        status |= AUDIO_RECORDER_STATUS_HIGH_NIBBLE;
+    else
+        status &= ~AUDIO_RECORDER_STATUS_HIGH_NIBBLE;
+
+    return DEVICE_OK;
+}
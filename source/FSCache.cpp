@@ -19,9 +19,53 @@ DEALINGS IN THE SOFTWARE.
 */
 #include "FSCache.h"
 #include "CodalDmesg.h"
+#include "MicroBitTrace.h"
 
 using namespace codal;
 
+FSCache* FSCache::instances = NULL;
+uint8_t* FSCache::pool = NULL;
+int FSCache::poolCount = 0;
+
+/**
+ * Determine if the given data can be written over the given contents of FLASH without an erase cycle,
+ * i.e. if the write only clears bits. Aligned words are checked a word at a time.
+ */
+static bool isWritable(const uint8_t *current, const uint8_t *data, uint32_t len)
+{
+	uint32_t i = 0;
+
+	// Scalar head, up to a word boundary in the cached block.
+	while (i < len && ((uintptr_t)(current + i) & 0x03))
+	{
+		if (~current[i] & data[i])
+			return false;
+		i++;
+	}
+
+	// Whole words. The data need not be aligned.
+	while (i + 4 <= len)
+	{
+		uint32_t c = *(const uint32_t *)(current + i);
+		uint32_t d;
+
+		memcpy(&d, data + i, 4);
+		if (~c & d)
+			return false;
+		i += 4;
+	}
+
+	// Scalar tail.
+	while (i < len)
+	{
+		if (~current[i] & data[i])
+			return false;
+		i++;
+	}
+
+	return true;
+}
+
 /**
  * Create a new instanece of a FileSystem Write Through Cache
  *
@@ -35,8 +79,183 @@ FSCache::FSCache(NVMController &nvm, int blockSize, int size) : flash(nvm), bloc
 	cache = (CacheEntry *) malloc(sizeof(CacheEntry)*size);
 	memset(cache, 0, sizeof(CacheEntry)*size);
 
-	// Reset operation counter (used for least-recently-used cache replacement policy)
-	operationCount = 0;
+	// Initialise the index of cached blocks. Keep it at most half full, so searches stay short.
+	uint32_t slots = 1;
+	while (slots < (uint32_t) size * 2)
+		slots <<= 1;
+
+	index = (uint16_t *) malloc(sizeof(uint16_t)*slots);
+	memset(index, 0, sizeof(uint16_t)*slots);
+	indexMask = slots - 1;
+
+	// Reset replacement policy state.
+	cacheUsed = 0;
+	clockHand = 0;
+
+	// We are a write through cache unless requested otherwise.
+	writeBack = false;
+
+	// Check writes are valid, if supported.
+	validate = true;
+
+	// Read one block at a time, unless requested otherwise.
+	readAhead = 0;
+	lastMiss = 0xFFFFFFFF;
+
+	resetStatistics();
+
+	// Join the list of caches that share memory.
+	nextInstance = instances;
+	instances = this;
+}
+
+/**
+ * Destructor. Writes back any modified data, and releases all memory.
+ */
+FSCache::~FSCache()
+{
+	flush();
+	clear();
+
+	free(cache);
+	free(index);
+
+	for (FSCache **p = &instances; *p; p = &(*p)->nextInstance)
+	{
+		if (*p == this)
+		{
+			*p = nextInstance;
+			break;
+		}
+	}
+}
+
+/**
+ * Release the memory held by unmodified, unpinned blocks in every cache, and by the shared pool.
+ * Caches with I/O in progress are left untouched. The caches continue to work with fewer blocks, and grow
+ * again as memory allows, up to their size. It may be called by an application that is short of memory.
+ * If DEVICE_PANIC_HEAP_FULL is not set, it is also called when a cache cannot allocate a page.
+ *
+ * @param except a cache to leave untouched, or NULL.
+ * @return the number of bytes returned to the heap.
+ */
+uint32_t FSCache::releaseMemory(FSCache *except)
+{
+	uint32_t released = 0;
+
+	for (FSCache *f = instances; f; f = f->nextInstance)
+	{
+		if (f == except || f->isBusy())
+			continue;
+
+		// Work down from the last entry, as releasing an entry moves the last entry into its place.
+		for (int i = f->cacheUsed - 1; i >= 0; i--)
+		{
+			if (!(f->cache[i].flags & (FSCACHE_FLAG_PINNED | FSCACHE_FLAG_DIRTY)))
+			{
+				// Pages are pooled as they are released, and the pool is emptied below.
+				if (f->blockSize != CODAL_FS_CACHE_POOL_BLOCK_SIZE)
+					released += f->blockSize;
+
+				f->releaseEntry(&f->cache[i]);
+			}
+		}
+	}
+
+	while (pool)
+	{
+		uint8_t *p = pool;
+		pool = *(uint8_t **)p;
+		free(p);
+		released += CODAL_FS_CACHE_POOL_BLOCK_SIZE;
+	}
+	poolCount = 0;
+
+	return released;
+}
+
+/**
+ * Determine if any block of this cache is being read or written by the memory controller.
+ * The memory controller may yield during I/O, so the entries of a busy cache must not be moved or freed.
+ */
+bool FSCache::isBusy()
+{
+	for (int i = 0; i < cacheUsed; i++)
+		if (cache[i].flags & FSCACHE_FLAG_BUSY)
+			return true;
+
+	return false;
+}
+
+/**
+ * Allocate a page of blockSize bytes, from the shared pool if possible. Unless DEVICE_PANIC_HEAP_FULL is set
+ * (in which case the heap panics rather than failing), memory is reclaimed from other caches and the
+ * allocation retried if the heap is exhausted.
+ * @return the page, or NULL if no memory is available.
+ */
+uint8_t *FSCache::allocatePage()
+{
+	uint8_t *p;
+
+	if (blockSize == CODAL_FS_CACHE_POOL_BLOCK_SIZE && pool)
+	{
+		p = pool;
+		pool = *(uint8_t **)p;
+		poolCount--;
+		return p;
+	}
+
+	p = (uint8_t *) malloc(blockSize);
+
+#if !CONFIG_ENABLED(DEVICE_PANIC_HEAP_FULL)
+	// Only reachable if the heap returns NULL when it is exhausted, rather than panicking.
+	if (p == NULL && releaseMemory(this))
+		p = (uint8_t *) malloc(blockSize);
+#endif
+
+	return p;
+}
+
+/**
+ * Return a page allocated by allocatePage() to the shared pool, or to the heap if the pool is full.
+ */
+void FSCache::releasePage(uint8_t *page)
+{
+	if (blockSize == CODAL_FS_CACHE_POOL_BLOCK_SIZE && poolCount < CODAL_FS_CACHE_POOL_SIZE)
+	{
+		*(uint8_t **)page = pool;
+		pool = page;
+		poolCount++;
+	}
+	else
+	{
+		free(page);
+	}
+}
+
+/**
+ * Remove the given entry from the cache, and return its page. Its block must not be dirty.
+ */
+void FSCache::releaseEntry(CacheEntry *c)
+{
+	CacheEntry *last = &cache[cacheUsed - 1];
+
+	indexRemove(c);
+	releasePage(c->page);
+
+	// Keep the entries in use contiguous, by moving the last one into the gap.
+	if (c != last)
+	{
+		indexRemove(last);
+		*c = *last;
+		indexInsert(c);
+	}
+
+	memset(last, 0, sizeof(CacheEntry));
+	cacheUsed--;
+
+	if (clockHand >= cacheUsed)
+		clockHand = 0;
 }
 
 /**
@@ -44,18 +263,142 @@ FSCache::FSCache(NVMController &nvm, int blockSize, int size) : flash(nvm), bloc
 */
 void FSCache::clear()
 {
+	for (int i = 0; i < cacheUsed; i++)
+		releasePage(cache[i].page);
+
+	// reset all state.
+	memset(cache, 0, sizeof(CacheEntry)*cacheSize);
+	memset(index, 0, sizeof(uint16_t)*(indexMask + 1));
+
+	// Reset replacement policy state.
+	cacheUsed = 0;
+	clockHand = 0;
+	lastMiss = 0xFFFFFFFF;
+}
+
+/**
+ * Enable or disable write back mode.
+ * By default the cache is write through: every write() is passed straight to the memory controller.
+ * In write back mode, writes update the cache only, and the modified range of each block is written
+ * back in a single operation when the block is evicted, or when flush() is called.
+ * Disabling write back mode writes back any modified data.
+ *
+ * @param enable true to enable write back mode, false to return to write through mode.
+ * @return DEVICE_OK on success.
+ */
+int FSCache::setWriteBack(bool enable)
+{
+	int r = DEVICE_OK;
+
+	if (!enable)
+		r = flush();
+
+	writeBack = enable;
+
+	return r;
+}
+
+/**
+ * Enable or disable validation of writes. Validation is only available if CODAL_FS_CACHE_VALIDATE is defined,
+ * and is enabled by default. When enabled, a write that would need an erase cycle is rejected.
+ *
+ * @param enable true to validate writes, false otherwise.
+ */
+void FSCache::setValidation(bool enable)
+{
+	validate = enable;
+}
+
+/**
+ * Retrieve the usage counters of this cache, since it was created or resetStatistics() was last called.
+ * Operations issued to the memory controller are counted as calls to the NVMController, which may
+ * divide them into smaller transfers.
+ *
+ * @return a copy of the counters.
+ */
+FSCacheStatistics FSCache::getStatistics()
+{
+	return stats;
+}
+
+/**
+ * Determine the heap memory held by this cache: its tables, and the blocks it currently holds.
+ * Free pages in the shared pool are not included.
+ *
+ * @return the number of bytes allocated.
+ */
+uint32_t FSCache::getMemoryUsage()
+{
+	return sizeof(CacheEntry) * cacheSize + sizeof(uint16_t) * (indexMask + 1) + blockSize * cacheUsed;
+}
+
+/**
+ * Reset all usage counters to zero.
+ */
+void FSCache::resetStatistics()
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Set the number of blocks to read in advance when sequential access is detected.
+ * When a block is missed just after the last block read from the memory controller, it is read along
+ * with the following blocks in a single read operation.
+ *
+ * @param blocks the number of blocks to read in advance, or zero to disable. This is limited to half
+ * the size of the cache, and by CODAL_FS_CACHE_MAX_READ_LENGTH.
+ * @return DEVICE_OK on success.
+ */
+int FSCache::setReadAhead(int blocks)
+{
+	blocks = min(blocks, cacheSize / 2);
+	blocks = min(blocks, CODAL_FS_CACHE_MAX_READ_LENGTH / blockSize - 1);
+
+	readAhead = max(blocks, 0);
+
+	return DEVICE_OK;
+}
+
+/**
+ * Write back all modified data to the memory controller. Has no effect in write through mode.
+ * @return DEVICE_OK on success.
+ */
+int FSCache::flush()
+{
+	MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_FSCACHE_FLUSH);
+
+	int r = DEVICE_OK;
+
 	for (int i = 0; i < cacheSize; i++)
 	{
-		if (cache[i].page != NULL)
-			free(cache[i].page);
+		int e = flush(&cache[i]);
+		if (e != DEVICE_OK)
+			r = e;
 	}
 
-	// reset all state.
-	memset(cache, 0, sizeof(CacheEntry)*cacheSize);
+	return r;
+}
+
+/**
+ * Write back the modified data in the given cache entry, if any.
+ * @param c the cache entry to write back.
+ * @return DEVICE_OK on success.
+ */
+int FSCache::flush(CacheEntry *c)
+{
+	if (!(c->flags & FSCACHE_FLAG_DIRTY))
+		return DEVICE_OK;
+
+	c->flags &= ~FSCACHE_FLAG_DIRTY;
+	c->flags |= FSCACHE_FLAG_BUSY;
+
+	stats.nvmWrites++;
+	stats.nvmBytesWritten += c->dirtyEnd - c->dirtyStart;
 
-	// Reset operation counter (used for least-recently-used cache replacement policy)
-	operationCount = 0;
+	int r = flash.write(c->address + c->dirtyStart, (uint32_t *)(c->page + c->dirtyStart), (c->dirtyEnd - c->dirtyStart)/4);
 
+	c->flags &= ~FSCACHE_FLAG_BUSY;
+	return r;
 }
 
 /**
@@ -69,7 +412,9 @@ int FSCache::erase(uint32_t address)
 	if (c != NULL)
 	{
 		memset(c->page, 0xFF, blockSize);
-		c->lastUsed = ++operationCount;
+
+		// Anything waiting to be written back is lost with the erase.
+		c->flags &= ~FSCACHE_FLAG_DIRTY;
 	}
 
 	return DEVICE_OK;
@@ -81,12 +426,16 @@ int FSCache::erase(uint32_t address)
 */
 int FSCache::read(uint32_t address, const void *data, int len)
 {
+	MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_FSCACHE_READ);
+
 	int bytesCopied = 0;
 
 	// Ensure that the operation is within the limits of the device
-	if (address < flash.getFlashStart() || address + len >= flash.getFlashEnd())
+	if (address < flash.getFlashStart() || address + len > flash.getFlashEnd())
 		return DEVICE_INVALID_PARAMETER;
 
+	stats.reads++;
+
 	// Read operation may span multiple cache boundaries... so we iterate over blocks as necessary.
 	while (bytesCopied < len)
 	{
@@ -96,6 +445,9 @@ int FSCache::read(uint32_t address, const void *data, int len)
 		uint32_t l = min(len - bytesCopied, blockSize - offset);
 		CacheEntry *c = cachePage(block);
 
+		if (c == NULL)
+			return DEVICE_NO_RESOURCES;
+
 		memcpy((uint8_t *)data + bytesCopied, c->page + offset, l);
 		bytesCopied += l;
 	}
@@ -109,19 +461,28 @@ int FSCache::read(uint32_t address, const void *data, int len)
 * @param address The logical address of the non-volatile storage to write to. DOES NOT need to be word aligned.
 * @param data the data to write.
 * @param len amount of data to write, in bytes.
-* @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the attempted operation is not possible without an ERASE operation.
+* @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the attempted operation is not possible without an ERASE operation,
+* or DEVICE_NO_RESOURCES if no memory is available to cache the data.
 */
 int FSCache::write(uint32_t address, const void *data, int len)
 {
+	MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_FSCACHE_WRITE);
+
 	int bytesCopied = 0;
 
 	// Ensure that the operation is within the limits of the device
-	if (address < flash.getFlashStart() || address + len >= flash.getFlashEnd())
+	if (address < flash.getFlashStart() || address + len > flash.getFlashEnd())
 		return DEVICE_INVALID_PARAMETER;
 
+	stats.writes++;
+
 #ifdef CODAL_FS_CACHE_VALIDATE
-	// Read operation may span multiple cache boundaries... so we iterate over blocks as necessary.
-	while (bytesCopied < len)
+	// Validate that the write can be performed without needing an erase cycle.
+	// A write spanning several blocks is checked in full before any block is updated, so a rejected write changes
+	// nothing. A write within a single block is checked as it is made.
+	bool spansBlocks = (address % blockSize) + len > (uint32_t) blockSize;
+
+	while (validate && spansBlocks && bytesCopied < len)
 	{
 		uint32_t a = address + bytesCopied;
 		uint32_t block = (a / blockSize) *blockSize;
@@ -129,25 +490,20 @@ int FSCache::write(uint32_t address, const void *data, int len)
 		uint32_t l = min(len - bytesCopied, blockSize - offset);
 		CacheEntry *c = cachePage(block);
 
-		// Validate that a write operation can be performed without needing an erase cycle.
-		for (uint32_t i = 0; i < l; i++)
-		{
-			uint8_t b1 = c->page[offset + i];
-			uint8_t b2 = ((uint8_t *)data)[bytesCopied + i];
+		if (c == NULL)
+			return DEVICE_NO_RESOURCES;
 
-			if ((b1 ^ b2) & b2)
-			{
-				DMESG("FS_CACHE: ILLEGAL WRITE OPERAITON ATTEMPTED [ADDRESS: %p] [LENGTH: %d]\n", address, len);
-				return DEVICE_NOT_SUPPORTED;
-			}
+		if (!isWritable(c->page + offset, (uint8_t *)data + bytesCopied, l))
+		{
+			DMESG("FS_CACHE: ILLEGAL WRITE OPERAITON ATTEMPTED [ADDRESS: %p] [LENGTH: %d]\n", address, len);
+			return DEVICE_NOT_SUPPORTED;
 		}
 
 		bytesCopied += l;
 	}
-
 #endif
 
-	// Write operation is valid. Update cache and perform a write-through operation to FLASH.
+	// Update cache and perform a write-through operation to FLASH.
 	bytesCopied = 0;
 	while (bytesCopied < len)
 	{
@@ -157,6 +513,17 @@ int FSCache::write(uint32_t address, const void *data, int len)
 		uint32_t l = min(len - bytesCopied, blockSize - offset);
 		CacheEntry *c = cachePage(block);
 
+		if (c == NULL)
+			return DEVICE_NO_RESOURCES;
+
+#ifdef CODAL_FS_CACHE_VALIDATE
+		if (validate && !spansBlocks && !isWritable(c->page + offset, (uint8_t *)data + bytesCopied, l))
+		{
+			DMESG("FS_CACHE: ILLEGAL WRITE OPERAITON ATTEMPTED [ADDRESS: %p] [LENGTH: %d]\n", address, len);
+			return DEVICE_NOT_SUPPORTED;
+		}
+#endif
+
 		uint32_t alignedStart = a & 0xFFFFFFFC;
 		uint32_t alignedEnd = (a + l) & 0xFFFFFFFC;
 		if ((a + l) & 0x03)
@@ -165,8 +532,34 @@ int FSCache::write(uint32_t address, const void *data, int len)
 		// update cache.
 		memcpy(c->page + offset, (uint8_t *)data + bytesCopied, l);
 
-		// Write through (maintaining 32-bit aligned operations)
-		flash.write(alignedStart, (uint32_t *)(c->page + (alignedStart % blockSize)), (alignedEnd - alignedStart)/4);
+		if (writeBack)
+		{
+			// Record the modified range, to be written back later.
+			uint16_t start = alignedStart - block;
+			uint16_t end = alignedEnd - block;
+
+			if (c->flags & FSCACHE_FLAG_DIRTY)
+			{
+				c->dirtyStart = min(c->dirtyStart, start);
+				c->dirtyEnd = max(c->dirtyEnd, end);
+			}
+			else
+			{
+				c->dirtyStart = start;
+				c->dirtyEnd = end;
+				c->flags |= FSCACHE_FLAG_DIRTY;
+			}
+		}
+		else
+		{
+			// Write through (maintaining 32-bit aligned operations)
+			stats.nvmWrites++;
+			stats.nvmBytesWritten += alignedEnd - alignedStart;
+
+			c->flags |= FSCACHE_FLAG_BUSY;
+			flash.write(alignedStart, (uint32_t *)(c->page + (alignedStart % blockSize)), (alignedEnd - alignedStart)/4);
+			c->flags &= ~FSCACHE_FLAG_BUSY;
+		}
 
 		// Move to next page
 		bytesCopied += l;
@@ -205,45 +598,153 @@ int FSCache::unpin(uint32_t address)
 }
 
 /**
-* Page a given block into the cache, replacing the LRU block if necessary.
+* Page a given block into the cache, replacing an unpinned block if necessary.
+* Blocks are replaced using the CLOCK (second chance) policy: a block is only replaced if it has not
+* been used since the clock hand last passed it.
 * @param address the logical address of the block to cache.
 */
 CacheEntry* FSCache::cachePage(uint32_t address)
 {
-	CacheEntry *lru = NULL;
+	CacheEntry *c = NULL;
 
 	// Ensure the page is not already in the cache. If so, then nothing to do...
-	lru = getCacheEntry(address);
-	if (lru)
-		return lru;
+	c = getCacheEntry(address);
+	if (c)
+	{
+		stats.hits++;
+		return c;
+	}
 
-	// Determine the LRU block to replace, or prefereably unused block.
-	lru = &cache[0];
-	for (int i = 0; i < cacheSize; i++)
+	stats.misses++;
+
+	// If this block follows the last one we read, expect the next ones to be wanted too.
+	// Read as many of them as are not already cached, in one operation.
+	int blocks = 1;
+
+	if (readAhead && address == lastMiss + blockSize)
+	{
+		while (blocks <= readAhead && address + blocks * blockSize < flash.getFlashEnd() && getCacheEntry(address + blocks * blockSize) == NULL)
+			blocks++;
+	}
+
+	uint8_t *buffer = NULL;
+
+	if (blocks > 1)
+	{
+		buffer = (uint8_t *) malloc(blocks * blockSize);
+
+		if (buffer)
+		{
+			stats.nvmReads++;
+			stats.nvmBytesRead += blocks * blockSize;
+		}
+
+		if (buffer == NULL || flash.read((uint32_t *)buffer, address, blocks * blockSize / 4) != DEVICE_OK)
+		{
+			free(buffer);
+			buffer = NULL;
+			blocks = 1;
+		}
+	}
+
+	// Load the requested block last, so it cannot be displaced by the blocks read in advance.
+	for (int n = 1; n <= blocks; n++)
+	{
+		int i = n % blocks;
+		c = allocateEntry();
+
+		if (c == NULL)
+			break;
+
+		// Update metadata and load in the block from storage.
+		c->address = address + i * blockSize;
+		c->flags = FSCACHE_FLAG_REFERENCED;
+
+		if (buffer)
+		{
+			memcpy(c->page, buffer + i * blockSize, blockSize);
+		}
+		else
+		{
+			stats.nvmReads++;
+			stats.nvmBytesRead += blockSize;
+
+			c->flags |= FSCACHE_FLAG_BUSY;
+			flash.read((uint32_t *)c->page, c->address, blockSize / 4);
+			c->flags &= ~FSCACHE_FLAG_BUSY;
+		}
+
+		indexInsert(c);
+	}
+
+	free(buffer);
+	lastMiss = address + (blocks - 1) * blockSize;
+
+	// Only the requested block, loaded last, is of interest.
+	return c && c->address == address ? c : NULL;
+}
+
+/**
+ * Choose a cache entry to hold a new block, writing back and unindexing its previous block if necessary.
+ * Blocks are replaced using the CLOCK (second chance) policy.
+ */
+CacheEntry *FSCache::allocateEntry()
+{
+	CacheEntry *victim = NULL;
+
+	// Simply use the next empty block, if there is one and memory can be found for it.
+	if (cacheUsed < cacheSize)
 	{
-		// Simply return the first empty block we find
-		if (cache[i].page == NULL)
+		CacheEntry *c = &cache[cacheUsed];
+		c->page = allocatePage();
+
+		if (c->page)
 		{
-			lru = &cache[i];
+			cacheUsed++;
+			return c;
+		}
+
+		if (cacheUsed == 0)
+			return NULL;
+	}
+
+	// Otherwise, advance the clock hand to the first unpinned block not used since its last pass.
+	// Each block is given a second chance, so two revolutions always suffice. If every block is pinned,
+	// the first block at or after the hand that is not busy is replaced regardless.
+	// A busy block is never replaced, as its page is in use by the memory controller.
+	for (int i = 0; i < 2 * cacheUsed; i++)
+	{
+		CacheEntry *c = &cache[clockHand];
+
+		if (!(c->flags & (FSCACHE_FLAG_PINNED | FSCACHE_FLAG_REFERENCED | FSCACHE_FLAG_BUSY)))
+		{
+			victim = c;
 			break;
 		}
 
-		// Alternatively, record the least recently used block
-		if (!(cache[i].flags & FSCACHE_FLAG_PINNED) && (operationCount - cache[i].lastUsed > operationCount - lru->lastUsed))
-			lru = &cache[i];
+		c->flags &= ~FSCACHE_FLAG_REFERENCED;
+		clockHand = (clockHand + 1) % cacheUsed;
 	}
 
-	// We now have the best block to replace. Update metadata and load in the block from storage.
-	// We are a write through cache, so all old values are soft state.
-	lru->address = address;
-	lru->flags = 0;
-	lru->lastUsed = ++operationCount;
-	if (lru->page == NULL)
-		lru->page = (uint8_t *) malloc(blockSize);
+	for (int i = 0; victim == NULL && i < cacheUsed; i++)
+	{
+		if (!(cache[clockHand].flags & FSCACHE_FLAG_BUSY))
+			victim = &cache[clockHand];
+		else
+			clockHand = (clockHand + 1) % cacheUsed;
+	}
+
+	if (victim == NULL)
+		return NULL;
+
+	clockHand = (clockHand + 1) % cacheUsed;
+	stats.evictions++;
 
-	flash.read((uint32_t *)lru->page, address, blockSize / 4);
+	// In write through mode, all old values are soft state. Otherwise, write back the old block first.
+	flush(victim);
+	indexRemove(victim);
 
-	return lru;
+	return victim;
 }
 
 /**
@@ -253,18 +754,82 @@ CacheEntry* FSCache::cachePage(uint32_t address)
 */
 CacheEntry *FSCache::getCacheEntry(uint32_t address)
 {
-	for (int i = 0; i < cacheSize; i++)
+	uint32_t slot = indexSlot(address);
+
+	while (index[slot])
 	{
-		if (cache[i].address == address && cache[i].page)
+		CacheEntry *c = &cache[index[slot] - 1];
+
+		if (c->address == address)
 		{
-			cache[i].lastUsed = ++operationCount;
-			return &cache[i];
+			c->flags |= FSCACHE_FLAG_REFERENCED;
+			return c;
 		}
+
+		slot = (slot + 1) & indexMask;
 	}
 
 	return NULL;
 }
 
+/**
+ * Determine the home slot in the index of the given block address.
+ */
+uint32_t FSCache::indexSlot(uint32_t address)
+{
+	// Fibonacci hashing of the block number. Consecutive blocks map to distinct slots.
+	return ((address / blockSize) * 2654435761u) & indexMask;
+}
+
+/**
+ * Add the given cache entry to the index.
+ */
+void FSCache::indexInsert(CacheEntry *c)
+{
+	uint32_t slot = indexSlot(c->address);
+
+	while (index[slot])
+		slot = (slot + 1) & indexMask;
+
+	index[slot] = (c - cache) + 1;
+}
+
+/**
+ * Remove the given cache entry from the index.
+ */
+void FSCache::indexRemove(CacheEntry *c)
+{
+	uint16_t entry = (c - cache) + 1;
+	uint32_t slot = indexSlot(c->address);
+
+	while (index[slot] && index[slot] != entry)
+		slot = (slot + 1) & indexMask;
+
+	if (index[slot] == 0)
+		return;
+
+	// Close the gap, by moving back any later entry in the same run that could not be found otherwise.
+	uint32_t next = slot;
+	while (true)
+	{
+		next = (next + 1) & indexMask;
+
+		if (index[next] == 0)
+			break;
+
+		uint32_t home = indexSlot(cache[index[next] - 1].address);
+
+		// Move the entry unless its home lies cyclically in (slot, next].
+		if (((next - home) & indexMask) >= ((next - slot) & indexMask))
+		{
+			index[slot] = index[next];
+			slot = next;
+		}
+	}
+
+	index[slot] = 0;
+}
+
 void FSCache::debug(bool verbose)
 {
 	for (int i = 0; i < cacheSize; i++)
@@ -273,7 +838,7 @@ void FSCache::debug(bool verbose)
 
 void FSCache::debug(CacheEntry *c, bool verbose)
 {
-	DMESG("CacheEntry: [address: %p] [lastUsed: %d] [flags: %X]\n", c->address, c->lastUsed, c->flags);
+	DMESG("CacheEntry: [address: %p] [flags: %X]\n", c->address, c->flags);
 
 	if (verbose)
 	{
@@ -0,0 +1,368 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "FlashAudioSource.h"
+#include "NRF52FlashManager.h"
+#include "MicroBitFileSystem.h"
+#include "AudioBufferPool.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor.
+ *
+ * @param sampleRate The sample rate of the stored audio, in Hz.
+ * @param id The event ID to raise FLASH_AUDIO_SOURCE_EVT_DONE on when playback completes.
+ */
+FlashAudioSource::FlashAudioSource(int sampleRate, uint16_t id)
+{
+    this->id = id;
+    this->sampleRate = sampleRate;
+    this->encoding = FLASH_AUDIO_FORMAT_PCM8;
+    this->downStream = NULL;
+    this->in = NULL;
+    this->end = NULL;
+    this->fs = NULL;
+    this->fd = -1;
+    this->blockRemaining = 0;
+    this->pendingSample = 0;
+    this->adpcm.predictor = 0;
+    this->adpcm.index = 0;
+}
+
+/**
+ * Play audio held in memory mapped FLASH (or RAM).
+ * The data must remain valid until playback completes.
+ *
+ * @param data The address of the audio.
+ * @param length The length of the audio, in bytes.
+ * @param encoding The encoding of the audio, one of FLASH_AUDIO_FORMAT_PCM8, FLASH_AUDIO_FORMAT_PCM16 or FLASH_AUDIO_FORMAT_IMA_ADPCM.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+ */
+int FlashAudioSource::play(const uint8_t *data, uint32_t length, int encoding)
+{
+    if (data == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    return start(data, length, encoding, NULL, -1);
+}
+
+/**
+ * Play audio held in a region of internal FLASH.
+ *
+ * @param flash The flash manager holding the audio.
+ * @param address The logical address of the audio within the flash manager.
+ * @param length The length of the audio, in bytes.
+ * @param encoding The encoding of the audio.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the region is out of range.
+ */
+int FlashAudioSource::play(NRF52FlashManager &flash, uint32_t address, uint32_t length, int encoding)
+{
+    const uint8_t *data = flash.getMemoryAddress(address);
+
+    if (data == NULL || length > flash.getFlashSize() - address)
+        return DEVICE_INVALID_PARAMETER;
+
+    return start(data, length, encoding, NULL, -1);
+}
+
+/**
+ * Play audio held in a file, from its current seek position to the end of the file.
+ * The file must remain open until playback completes.
+ *
+ * @param fs The file system holding the file.
+ * @param fd A file handle, opened with MB_READ.
+ * @param encoding The encoding of the audio.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+ */
+int FlashAudioSource::play(MicroBitFileSystem &fs, int fd, int encoding)
+{
+    const uint8_t *data;
+    int length = fs.readInPlace(fd, &data, INT32_MAX);
+
+    if (length < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    return start(data, length, encoding, &fs, fd);
+}
+
+/**
+ * Begin playout of the given region, optionally followed by further regions of the given file.
+ */
+int FlashAudioSource::start(const uint8_t *data, uint32_t length, int encoding, MicroBitFileSystem *fs, int fd)
+{
+    bool idle;
+
+    if (encoding < FLASH_AUDIO_FORMAT_PCM8 || encoding > FLASH_AUDIO_FORMAT_IMA_ADPCM)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    this->in = data;
+    this->end = data + length;
+    this->fs = fs;
+    this->fd = fd;
+    this->encoding = encoding;
+    this->blockRemaining = 0;
+    idle = !(status & FLASH_AUDIO_SOURCE_STATUS_PLAYING);
+    status &= ~FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING;
+    status |= FLASH_AUDIO_SOURCE_STATUS_PLAYING;
+    target_enable_irq();
+
+    // Restart the stream if it had run dry.
+    if (idle && downStream)
+        downStream->pullRequest();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop any audio currently playing.
+ * @return DEVICE_OK on success.
+ */
+int FlashAudioSource::stop()
+{
+    target_disable_irq();
+    in = end;
+    fs = NULL;
+    status &= ~FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine if audio is currently being played.
+ * @return true if audio is playing, false otherwise.
+ */
+bool FlashAudioSource::isPlaying()
+{
+    return status & FLASH_AUDIO_SOURCE_STATUS_PLAYING;
+}
+
+/**
+ * Determine the sample rate of the stored audio.
+ * @return the sample rate, in Hz.
+ */
+int FlashAudioSource::getSampleRate()
+{
+    return sampleRate;
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @sink The component that data will be delivered to, when it is availiable
+ */
+void FlashAudioSource::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+}
+
+/**
+ *  Determine the data format of the buffers streamed out of this component.
+ */
+int FlashAudioSource::getFormat()
+{
+    return DATASTREAM_FORMAT_16BIT_SIGNED;
+}
+
+/**
+ * Move on to the next contiguous region of stored audio.
+ * @return true if more data is available, false at the end of the audio.
+ */
+bool FlashAudioSource::refill()
+{
+    if (fs == NULL)
+        return false;
+
+    const uint8_t *data;
+    int length = fs->readInPlace(fd, &data, INT32_MAX);
+
+    if (length <= 0)
+    {
+        fs = NULL;
+        return false;
+    }
+
+    in = data;
+    end = data + length;
+
+    return true;
+}
+
+/**
+ * Read bytes of stored audio that may span regions.
+ * @return true on success, false if the end of the audio was reached first.
+ */
+bool FlashAudioSource::readBytes(uint8_t *buffer, int length)
+{
+    while (length--)
+    {
+        if (in == end && !refill())
+            return false;
+
+        *buffer++ = *in++;
+    }
+
+    return true;
+}
+
+/**
+ * Decode 8 bit unsigned PCM into the given buffer.
+ * @return a pointer one beyond the last sample written.
+ */
+int16_t *FlashAudioSource::decodePCM8(int16_t *out, int16_t *outEnd)
+{
+    while (out < outEnd && (in < end || refill()))
+    {
+        const uint8_t *e = min(end, in + (outEnd - out));
+
+        while (in < e)
+            *out++ = (int16_t) ((*in++ - 128) << 8);
+    }
+
+    return out;
+}
+
+/**
+ * Decode 16 bit signed PCM into the given buffer.
+ * @return a pointer one beyond the last sample written.
+ */
+int16_t *FlashAudioSource::decodePCM16(int16_t *out, int16_t *outEnd)
+{
+    uint8_t sample[2];
+
+    while (out < outEnd)
+    {
+        const uint8_t *e = min(end - 1, in + 2 * (outEnd - out));
+
+        while (in < e)
+        {
+            *out++ = (int16_t) (in[0] | (in[1] << 8));
+            in += 2;
+        }
+
+        // Handle a sample that straddles two regions, or the end of the audio.
+        if (out < outEnd)
+        {
+            if (!readBytes(sample, 2))
+                break;
+
+            *out++ = (int16_t) (sample[0] | (sample[1] << 8));
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Decode IMA ADPCM into the given buffer.
+ * @return a pointer one beyond the last sample written.
+ */
+int16_t *FlashAudioSource::decodeADPCM(int16_t *out, int16_t *outEnd)
+{
+    uint8_t header[IMA_ADPCM_HEADER_SIZE];
+
+    if (out < outEnd && (status & FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING))
+    {
+        *out++ = pendingSample;
+        status &= ~FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING;
+    }
+
+    while (out < outEnd)
+    {
+        // Each block starts afresh from the predictor and step index in its header.
+        if (blockRemaining == 0)
+        {
+            if (!readBytes(header, IMA_ADPCM_HEADER_SIZE))
+                break;
+
+            *out++ = ima_adpcm_read_header(adpcm, header);
+            blockRemaining = CONFIG_IMA_ADPCM_BLOCK_SIZE - IMA_ADPCM_HEADER_SIZE;
+            continue;
+        }
+
+        if (in == end && !refill())
+            break;
+
+        int n = min(min((int) (end - in), blockRemaining), (int) (outEnd - out) / 2);
+
+        blockRemaining -= n;
+        while (n--)
+        {
+            uint8_t b = *in++;
+            *out++ = ima_adpcm_decode(adpcm, b & 0x0F);
+            *out++ = ima_adpcm_decode(adpcm, b >> 4);
+        }
+
+        // If there's room for only one more sample, hold the second sample of the next byte over to the next buffer.
+        if (outEnd - out == 1 && blockRemaining && in < end)
+        {
+            uint8_t b = *in++;
+            blockRemaining--;
+            *out++ = ima_adpcm_decode(adpcm, b & 0x0F);
+            pendingSample = ima_adpcm_decode(adpcm, b >> 4);
+            status |= FLASH_AUDIO_SOURCE_STATUS_SAMPLE_PENDING;
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer FlashAudioSource::pull()
+{
+    if (!(status & FLASH_AUDIO_SOURCE_STATUS_PLAYING))
+        return ManagedBuffer();
+
+    ManagedBuffer buffer = AudioBufferPool::getDefault().allocate(CONFIG_FLASH_AUDIO_BUFFER_SIZE);
+    int16_t *out = (int16_t *) &buffer[0];
+    int16_t *outEnd = out + CONFIG_FLASH_AUDIO_BUFFER_SIZE / 2;
+
+    if (encoding == FLASH_AUDIO_FORMAT_IMA_ADPCM)
+        out = decodeADPCM(out, outEnd);
+    else if (encoding == FLASH_AUDIO_FORMAT_PCM16)
+        out = decodePCM16(out, outEnd);
+    else
+        out = decodePCM8(out, outEnd);
+
+    if (out < outEnd)
+    {
+        // That's the end of the audio. Pad with silence, and leave the stream idle until the next play().
+        while (out < outEnd)
+            *out++ = 0;
+
+        status &= ~FLASH_AUDIO_SOURCE_STATUS_PLAYING;
+        Event(id, FLASH_AUDIO_SOURCE_EVT_DONE);
+    }
+    else
+    {
+        downStream->pullRequest();
+    }
+
+    return buffer;
+}
@@ -0,0 +1,578 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitAHRS.h"
+#include "MicroBitOrientation.h"
+#include "CoordinateSystem.h"
+#include "ErrorNo.h"
+#include "Event.h"
+#include <math.h>
+
+using namespace codal;
+
+#define MICROBIT_AHRS_READ_BATCH       8           // The number of samples read from a sample buffer at a time.
+
+/**
+ * Maps a sample from the sensors' default coordinate system to North-East-Down.
+ */
+static void toNED(int8_t transform[3][3], Sample3D s, float *v)
+{
+    for (int r = 0; r < 3; r++)
+        v[r] = transform[r][0] * s.x + transform[r][1] * s.y + transform[r][2] * s.z;
+}
+
+/**
+ * Scales a vector to unit length.
+ *
+ * @return false if the vector is zero, and so cannot be normalised.
+ */
+static bool normalise(float *v)
+{
+    float d = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+
+    if (d <= 0.0f)
+        return false;
+
+    d = microbit_inv_sqrt(d, ORIENTATION_ACCURACY_FAST);
+    v[0] *= d;
+    v[1] *= d;
+    v[2] *= d;
+
+    return true;
+}
+
+/**
+ * Constructor.
+ *
+ * Create an attitude and heading reference system. It does nothing until enabled.
+ *
+ * @param accelerometer The accelerometer to read samples from.
+ * @param compass The compass to read samples from.
+ * @param id The id the AHRS should use when sending events on the MessageBus. Defaults to DEVICE_ID_AHRS.
+ */
+MicroBitAHRS::MicroBitAHRS(MicroBitAccelerometer &accelerometer, MicroBitCompass &compass, uint16_t id) :
+    accelerometer(accelerometer),
+    compass(compass),
+    gain(CONFIG_MICROBIT_AHRS_GAIN),
+    period(CONFIG_MICROBIT_AHRS_PERIOD),
+    lastUpdate(0),
+    accelerationCount(0),
+    magneticValid(false)
+{
+    this->id = id;
+
+    q.w = 1.0f;
+    q.x = q.y = q.z = 0.0f;
+
+    for (int i = 0; i < 3; i++)
+        acceleration[i] = magnetic[i] = linear[i] = 0.0f;
+
+    // Both sensors share the accelerometer's coordinate space. Rather than assume how its systems are defined,
+    // derive the mapping between them from the transforms of each axis: sample = S.enu and ned = N.enu, so ned = N.S'.sample.
+    CoordinateSpace space(SIMPLE_CARTESIAN, true, COORDINATE_SPACE_ROTATED_0);
+    int s[3][3];
+    int n[3][3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        Sample3D axis;
+        axis.x = i == 0;
+        axis.y = i == 1;
+        axis.z = i == 2;
+
+        Sample3D a = space.transform(axis, SIMPLE_CARTESIAN);
+        Sample3D b = space.transform(axis, NORTH_EAST_DOWN);
+
+        s[0][i] = a.x; s[1][i] = a.y; s[2][i] = a.z;
+        n[0][i] = b.x; n[1][i] = b.y; n[2][i] = b.z;
+    }
+
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            transform[r][c] = n[r][0] * s[c][0] + n[r][1] * s[c][1] + n[r][2] * s[c][2];
+}
+
+/**
+ * Starts estimating orientation. The estimate is initialised directly from the next samples received.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitAHRS::enable()
+{
+    if (status & MICROBIT_AHRS_STATUS_ENABLED)
+        return DEVICE_OK;
+
+    accelerometer.getSampleBuffer().open(accelerometerCursor);
+    compass.getSampleBuffer().open(compassCursor);
+
+    for (int i = 0; i < 3; i++)
+        acceleration[i] = 0.0f;
+
+    accelerationCount = 0;
+    magneticValid = false;
+
+    status &= ~MICROBIT_AHRS_STATUS_INITIALISED;
+    status |= MICROBIT_AHRS_STATUS_ENABLED | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    // Ask for at least one sample of each sensor per update.
+    accelerometer.requestPeriod(id, period);
+    compass.requestPeriod(id, period);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops estimating orientation.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitAHRS::disable()
+{
+    if (!(status & MICROBIT_AHRS_STATUS_ENABLED))
+        return DEVICE_OK;
+
+    status &= ~(MICROBIT_AHRS_STATUS_ENABLED | DEVICE_COMPONENT_STATUS_IDLE_TICK);
+
+    accelerometer.releasePeriod(id);
+    compass.releasePeriod(id);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if orientation is being estimated.
+ *
+ * @return true if enabled, false otherwise.
+ */
+bool MicroBitAHRS::isEnabled()
+{
+    return status & MICROBIT_AHRS_STATUS_ENABLED;
+}
+
+/**
+ * Sets the time between updates of the orientation estimate. Samples received in between are averaged.
+ *
+ * @param period The time between updates, in milliseconds.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the period is not positive.
+ */
+int MicroBitAHRS::setPeriod(int period)
+{
+    if (period <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->period = period;
+
+    if (status & MICROBIT_AHRS_STATUS_ENABLED)
+    {
+        accelerometer.requestPeriod(id, period);
+        compass.requestPeriod(id, period);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Reads the time between updates of the orientation estimate.
+ *
+ * @return The time between updates, in milliseconds.
+ */
+int MicroBitAHRS::getPeriod()
+{
+    return period;
+}
+
+/**
+ * Sets the gain of the feedback that corrects the orientation estimate towards the sensors.
+ *
+ * The estimate settles with a time constant of roughly 1/gain seconds.
+ *
+ * @param gain The gain, per second.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the gain is not positive.
+ */
+int MicroBitAHRS::setGain(float gain)
+{
+    if (gain <= 0.0f)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->gain = gain;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Reads the gain of the feedback that corrects the orientation estimate towards the sensors.
+ *
+ * @return The gain, per second.
+ */
+float MicroBitAHRS::getGain()
+{
+    return gain;
+}
+
+/**
+ * Reads the orientation estimate.
+ *
+ * @return A unit quaternion, rotating vectors from the device's North-East-Down frame to the earth's.
+ */
+MicroBitQuaternion MicroBitAHRS::getQuaternion()
+{
+    return q;
+}
+
+/**
+ * Reads the roll of the device (rotation about its North axis), using the aerospace convention.
+ *
+ * @return The roll, in the range -PI..PI radians.
+ */
+float MicroBitAHRS::getRollRadians()
+{
+    return atan2f(2.0f * (q.w*q.x + q.y*q.z), 1.0f - 2.0f * (q.x*q.x + q.y*q.y));
+}
+
+/**
+ * Reads the pitch of the device (rotation about its East axis), using the aerospace convention.
+ *
+ * @return The pitch, in the range -PI/2..PI/2 radians.
+ */
+float MicroBitAHRS::getPitchRadians()
+{
+    float s = 2.0f * (q.w*q.y - q.z*q.x);
+
+    if (s > 1.0f)
+        s = 1.0f;
+
+    if (s < -1.0f)
+        s = -1.0f;
+
+    return asinf(s);
+}
+
+/**
+ * Reads the yaw of the device (rotation about the Down axis, from magnetic north), using the aerospace convention.
+ *
+ * @return The yaw, in the range -PI..PI radians.
+ */
+float MicroBitAHRS::getYawRadians()
+{
+    return atan2f(2.0f * (q.w*q.z + q.x*q.y), 1.0f - 2.0f * (q.y*q.y + q.z*q.z));
+}
+
+/**
+ * Reads the roll of the device (rotation about its North axis), using the aerospace convention.
+ *
+ * @return The roll, in the range -180..180 degrees.
+ */
+int MicroBitAHRS::getRoll()
+{
+    return (int) ((180 * getRollRadians()) / MICROBIT_ORIENTATION_PI);
+}
+
+/**
+ * Reads the pitch of the device (rotation about its East axis), using the aerospace convention.
+ *
+ * @return The pitch, in the range -90..90 degrees.
+ */
+int MicroBitAHRS::getPitch()
+{
+    return (int) ((180 * getPitchRadians()) / MICROBIT_ORIENTATION_PI);
+}
+
+/**
+ * Reads the yaw of the device, as a heading from magnetic north.
+ *
+ * @return The yaw, in the range 0..359 degrees.
+ */
+int MicroBitAHRS::getYaw()
+{
+    int yaw = (int) ((180 * getYawRadians()) / MICROBIT_ORIENTATION_PI);
+
+    if (yaw < 0)
+        yaw += 360;
+
+    return yaw % 360;
+}
+
+/**
+ * Reads the acceleration of the device with gravity removed, at the last update.
+ *
+ * @return The acceleration in milli-g, in the accelerometer's default coordinate system.
+ */
+Sample3D MicroBitAHRS::getLinearAcceleration()
+{
+    // The transform is a signed permutation, so its inverse is its transpose.
+    float v[3];
+
+    for (int c = 0; c < 3; c++)
+        v[c] = transform[0][c] * linear[0] + transform[1][c] * linear[1] + transform[2][c] * linear[2];
+
+    Sample3D s;
+    s.x = (int) v[0];
+    s.y = (int) v[1];
+    s.z = (int) v[2];
+
+    return s;
+}
+
+/**
+ * Reads any new samples from the sensors' sample buffers, and updates the orientation estimate
+ * when the update period has elapsed.
+ */
+void MicroBitAHRS::idleCallback()
+{
+    MicroBitSample samples[MICROBIT_AHRS_READ_BATCH];
+    int n;
+
+    if (!(status & MICROBIT_AHRS_STATUS_ENABLED))
+        return;
+
+    // Only the latest compass sample is needed, as the field changes far more slowly than acceleration.
+    while ((n = compass.getSampleBuffer().read(compassCursor, samples, MICROBIT_AHRS_READ_BATCH)) > 0)
+    {
+        toNED(transform, samples[n-1].sample, magnetic);
+        magneticValid = true;
+    }
+
+    while ((n = accelerometer.getSampleBuffer().read(accelerometerCursor, samples, MICROBIT_AHRS_READ_BATCH)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float a[3];
+            toNED(transform, samples[i].sample, a);
+
+            acceleration[0] += a[0];
+            acceleration[1] += a[1];
+            acceleration[2] += a[2];
+            accelerationCount++;
+
+            CODAL_TIMESTAMP elapsed = samples[i].timestamp - lastUpdate;
+
+            if ((status & MICROBIT_AHRS_STATUS_INITIALISED) && elapsed < (CODAL_TIMESTAMP) period)
+                continue;
+
+            acceleration[0] /= accelerationCount;
+            acceleration[1] /= accelerationCount;
+            acceleration[2] /= accelerationCount;
+
+            float dt = elapsed / 1000.0f;
+
+            // The feedback is only stable while gain * dt is small. After a long gap the estimate is stale anyway,
+            // so start afresh from the sensors.
+            if (!(status & MICROBIT_AHRS_STATUS_INITIALISED) || gain * dt >= 1.0f)
+                initialise();
+            else
+                update(dt);
+
+            updateLinearAcceleration();
+
+            acceleration[0] = acceleration[1] = acceleration[2] = 0.0f;
+            accelerationCount = 0;
+            lastUpdate = samples[i].timestamp;
+
+            Event(id, MICROBIT_AHRS_EVT_UPDATE);
+        }
+    }
+}
+
+/**
+ * Initialises the orientation estimate directly from the mean acceleration and latest compass sample.
+ */
+void MicroBitAHRS::initialise()
+{
+    // Find the earth's axes in the device frame: down opposes the measured acceleration, east is perpendicular to
+    // both down and the magnetic field (or the device's North axis, without a calibrated compass), and north completes the set.
+    float down[3] = { -acceleration[0], -acceleration[1], -acceleration[2] };
+    float north[3];
+    float east[3] = { 0.0f, 1.0f, 0.0f };
+
+    if (!normalise(down))
+        return;
+
+    float m[3] = { 1.0f, 0.0f, 0.0f };
+
+    if (magneticValid && compass.isCalibrated())
+    {
+        m[0] = magnetic[0];
+        m[1] = magnetic[1];
+        m[2] = magnetic[2];
+    }
+
+    // If the reference is (nearly) parallel to gravity, fall back to the device's North axis, then its East axis.
+    // Gravity cannot be parallel to both.
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        if (attempt > 0)
+        {
+            m[0] = attempt == 1 ? 1.0f : 0.0f;
+            m[1] = attempt == 2 ? 1.0f : 0.0f;
+            m[2] = 0.0f;
+        }
+
+        if (normalise(m))
+        {
+            east[0] = down[1]*m[2] - down[2]*m[1];
+            east[1] = down[2]*m[0] - down[0]*m[2];
+            east[2] = down[0]*m[1] - down[1]*m[0];
+
+            if (east[0]*east[0] + east[1]*east[1] + east[2]*east[2] > 0.01f && normalise(east))
+                break;
+        }
+    }
+
+    north[0] = east[1]*down[2] - east[2]*down[1];
+    north[1] = east[2]*down[0] - east[0]*down[2];
+    north[2] = east[0]*down[1] - east[1]*down[0];
+
+    // The rows of the rotation from the device frame to the earth frame are the earth's axes in the device frame.
+    float *r[3] = { north, east, down };
+    float trace = r[0][0] + r[1][1] + r[2][2];
+
+    if (trace > 0.0f)
+    {
+        float s = 0.5f * microbit_inv_sqrt(trace + 1.0f, ORIENTATION_ACCURACY_FAST);
+        q.w = 0.25f / s;
+        q.x = (r[2][1] - r[1][2]) * s;
+        q.y = (r[0][2] - r[2][0]) * s;
+        q.z = (r[1][0] - r[0][1]) * s;
+    }
+    else if (r[0][0] > r[1][1] && r[0][0] > r[2][2])
+    {
+        float s = 2.0f * sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+        q.w = (r[2][1] - r[1][2]) / s;
+        q.x = 0.25f * s;
+        q.y = (r[0][1] + r[1][0]) / s;
+        q.z = (r[0][2] + r[2][0]) / s;
+    }
+    else if (r[1][1] > r[2][2])
+    {
+        float s = 2.0f * sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+        q.w = (r[0][2] - r[2][0]) / s;
+        q.x = (r[0][1] + r[1][0]) / s;
+        q.y = 0.25f * s;
+        q.z = (r[1][2] + r[2][1]) / s;
+    }
+    else
+    {
+        float s = 2.0f * sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+        q.w = (r[1][0] - r[0][1]) / s;
+        q.x = (r[0][2] + r[2][0]) / s;
+        q.y = (r[1][2] + r[2][1]) / s;
+        q.z = 0.25f * s;
+    }
+
+    status |= MICROBIT_AHRS_STATUS_INITIALISED;
+}
+
+/**
+ * Corrects the orientation estimate towards the mean acceleration and latest compass sample.
+ *
+ * @param dt The time since the last update, in seconds.
+ */
+void MicroBitAHRS::update(float dt)
+{
+    float w = q.w, x = q.x, y = q.y, z = q.z;
+    float e[3] = { 0.0f, 0.0f, 0.0f };
+    float a[3] = { acceleration[0], acceleration[1], acceleration[2] };
+    float g2 = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+
+    // The estimated direction of up in the device frame, which is what the accelerometer measures at rest.
+    float vx = -2.0f * (x*z - w*y);
+    float vy = -2.0f * (y*z + w*x);
+    float vz = -(w*w - x*x - y*y + z*z);
+
+    // Only trust the direction of the acceleration as "up" while its magnitude is close to that of gravity.
+    if (g2 > 0.25f * MICROBIT_AHRS_GRAVITY * MICROBIT_AHRS_GRAVITY && g2 < 2.25f * MICROBIT_AHRS_GRAVITY * MICROBIT_AHRS_GRAVITY && normalise(a))
+    {
+        e[0] += a[1]*vz - a[2]*vy;
+        e[1] += a[2]*vx - a[0]*vz;
+        e[2] += a[0]*vy - a[1]*vx;
+    }
+
+    float m[3] = { magnetic[0], magnetic[1], magnetic[2] };
+
+    if (magneticValid && compass.isCalibrated() && normalise(m))
+    {
+        // Rotate the field into the earth frame, and discard its east component (which is the heading error),
+        // to find the reference direction of the field.
+        float hx = 2.0f * (m[0]*(0.5f - y*y - z*z) + m[1]*(x*y - w*z) + m[2]*(x*z + w*y));
+        float hy = 2.0f * (m[0]*(x*y + w*z) + m[1]*(0.5f - x*x - z*z) + m[2]*(y*z - w*x));
+        float hz = 2.0f * (m[0]*(x*z - w*y) + m[1]*(y*z + w*x) + m[2]*(0.5f - x*x - y*y));
+        float h2 = hx*hx + hy*hy;
+        float bx = h2 > 0.0f ? h2 * microbit_inv_sqrt(h2, ORIENTATION_ACCURACY_FAST) : 0.0f;
+        float bz = hz;
+
+        // The estimated direction of that reference in the device frame.
+        float wx = 2.0f * (bx*(0.5f - y*y - z*z) + bz*(x*z - w*y));
+        float wy = 2.0f * (bx*(x*y - w*z) + bz*(y*z + w*x));
+        float wz = 2.0f * (bx*(x*z + w*y) + bz*(0.5f - x*x - y*y));
+
+        // Apply only the component of the error about the vertical, so that magnetic disturbances cannot tilt the
+        // estimate. It is proportional to the square of the field's horizontal fraction, so divide that out to give
+        // heading the same time constant as tilt. Close to the magnetic poles, the heading is left alone.
+        if (h2 > 0.01f)
+        {
+            float c = ((m[1]*wz - m[2]*wy) * vx + (m[2]*wx - m[0]*wz) * vy + (m[0]*wy - m[1]*wx) * vz) / h2;
+
+            e[0] += c * vx;
+            e[1] += c * vy;
+            e[2] += c * vz;
+        }
+    }
+
+    // Without a gyroscope, the angular rate applied is the feedback alone. Integrate q' = q * (0, rate) / 2.
+    float gx = gain * e[0] * 0.5f * dt;
+    float gy = gain * e[1] * 0.5f * dt;
+    float gz = gain * e[2] * 0.5f * dt;
+
+    q.w = w - x*gx - y*gy - z*gz;
+    q.x = x + w*gx + y*gz - z*gy;
+    q.y = y + w*gy - x*gz + z*gx;
+    q.z = z + w*gz + x*gy - y*gx;
+
+    float n = q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z;
+
+    if (n > 0.0f)
+    {
+        n = microbit_inv_sqrt(n, ORIENTATION_ACCURACY_FAST);
+        q.w *= n;
+        q.x *= n;
+        q.y *= n;
+        q.z *= n;
+    }
+}
+
+/**
+ * Calculates the acceleration, less gravity, from the mean acceleration and the orientation estimate.
+ */
+void MicroBitAHRS::updateLinearAcceleration()
+{
+    float w = q.w, x = q.x, y = q.y, z = q.z;
+
+    // At rest, the accelerometer measures gravity's magnitude in the direction of up.
+    linear[0] = acceleration[0] + MICROBIT_AHRS_GRAVITY * 2.0f * (x*z - w*y);
+    linear[1] = acceleration[1] + MICROBIT_AHRS_GRAVITY * 2.0f * (y*z + w*x);
+    linear[2] = acceleration[2] + MICROBIT_AHRS_GRAVITY * (w*w - x*x - y*y + z*z);
+}
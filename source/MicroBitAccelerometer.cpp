@@ -33,13 +33,36 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitError.h"
 #include "LSM303Accelerometer.h"
 #include "LSM303Magnetometer.h"
+#include "Timer.h"
 
 
 Accelerometer* MicroBitAccelerometer::driver;
 
-MicroBitAccelerometer::MicroBitAccelerometer(MicroBitI2C &i2c, uint16_t id) : Accelerometer(coordinateSpace)
+static NRF52Pin *interruptPin = NULL;               // The IRQ line shared by the motion sensors.
+static bool fifoDetected = false;                   // Whether or not the detected accelerometer has a FIFO we can stream from.
+static MicroBitSensorDemand accelerometerDemand;    // The sample periods required by consumers of the accelerometer.
+static bool accelerometerAsleep = false;            // Whether or not the accelerometer was stopped for lack of consumers.
+
+MicroBitAccelerometer::MicroBitAccelerometer(MicroBitI2C &i2c, uint16_t id) : Accelerometer(coordinateSpace), i2cBus(i2c)
 {
+    samples = NULL;
+    streaming = false;
+    streamWatermark = MICROBIT_ACCELEROMETER_FIFO_WATERMARK;
+    streamInterrupts = 0;
+    motionWake = false;
+    motionStream = false;
+    dozing = false;
+    motionThreshold = MICROBIT_ACCELEROMETER_MOTION_THRESHOLD;
+    lastMotion = 0;
+    orientationAccuracy = MICROBIT_ORIENTATION_ACCURACY;
+    orientationValid = false;
+    pitchRadians = 0.0f;
+    rollRadians = 0.0f;
+
     autoDetect(i2c);
+
+    // Stream samples from the FIFO while lower priority transactions wait on the bus.
+    i2c.addClient(*this, MICROBIT_I2C_PRIORITY_SENSOR);
 }
 
 /**
@@ -66,6 +89,7 @@ Accelerometer& MicroBitAccelerometer::autoDetect(MicroBitI2C &i2c)
     irq1.getDigitalValue();
     irq1.setPull(PullMode::Up);
     irq1.setActiveLo();
+    interruptPin = &irq1;
     
     if (!autoDetectCompleted)
     {
@@ -78,6 +102,7 @@ Accelerometer& MicroBitAccelerometer::autoDetect(MicroBitI2C &i2c)
             MicroBitAccelerometer::driver = new LSM303Accelerometer( i2c, irq1, coordinateSpace, 0x32 );
             MicroBitCompass::driver = new LSM303Magnetometer( i2c, irq1, coordinateSpace, 0x3C );
             MicroBitCompass::driver->setAccelerometer( *MicroBitAccelerometer::driver );
+            fifoDetected = true;
         }
 
         autoDetectCompleted = true;
@@ -106,7 +131,13 @@ int MicroBitAccelerometer::setPeriod(int period)
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
-    return driver->setPeriod(period);
+    int result = driver->setPeriod(period);
+
+    // The driver reconfigures the hardware, so restore our FIFO configuration if we are streaming.
+    if (result == MICROBIT_OK && streaming)
+        result = configureStream();
+
+    return result;
 }
 
 /**
@@ -122,6 +153,88 @@ int MicroBitAccelerometer::getPeriod()
     return driver->getPeriod();
 }
 
+/**
+ * Records the sample period a consumer of the accelerometer requires, and runs the accelerometer at the shortest
+ * period any consumer has requested. Consumers should release their request once they no longer need samples.
+ *
+ * @param consumer The id of the consuming component, e.g. MICROBIT_ID_GESTURE.
+ * @param period The longest time between samples the consumer can accept, in milliseconds.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer id is zero or the period is not positive,
+ * MICROBIT_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::requestPeriod(uint16_t consumer, int period)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
+
+    int result = accelerometerDemand.request(consumer, period);
+
+    return result == MICROBIT_OK ? applyDemand() : result;
+}
+
+/**
+ * Removes the sample period a consumer requested with requestPeriod(). Once no consumers remain, background
+ * sampling stops and the accelerometer is put to sleep, until a new request is made, or it is read through this object.
+ *
+ * @param consumer The id of the consuming component.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer has no request recorded, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::releasePeriod(uint16_t consumer)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
+
+    int result = accelerometerDemand.release(consumer);
+
+    return result == MICROBIT_OK ? applyDemand() : result;
+}
+
+/**
+ * Runs the accelerometer at the sample period required by its consumers, or stops it if there are none.
+ *
+ * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::applyDemand()
+{
+    int period = accelerometerDemand.getPeriod();
+
+    if (period == 0)
+    {
+        // A stream is a consumer in its own right.
+        if (streaming)
+            return MICROBIT_OK;
+
+        if (accelerometerAsleep)
+            return MICROBIT_OK;
+
+        // Nobody needs samples, so stop reading them in the background. If the driver can't put the sensor to sleep,
+        // at least slow it down.
+        driver->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+        if (driver->setSleep(true) != MICROBIT_OK)
+            driver->setPeriod(MICROBIT_SENSOR_DEMAND_IDLE_PERIOD);
+
+        accelerometerAsleep = true;
+        return MICROBIT_OK;
+    }
+
+    if (accelerometerAsleep)
+    {
+        driver->setSleep(false);
+        accelerometerAsleep = false;
+    }
+
+    int result = setPeriod(period);
+
+    // Reading the sensor (re)starts background sampling.
+    if (result == MICROBIT_OK)
+        result = requestUpdate();
+
+    return result;
+}
+
 /**
   * Attempts to set the sample range of the accelerometer to the specified value (in g).
   *
@@ -142,7 +255,13 @@ int MicroBitAccelerometer::setRange(int range)
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
-    return driver->setRange( range );
+    int result = driver->setRange( range );
+
+    // The driver reconfigures the hardware, so restore our FIFO configuration if we are streaming.
+    if (result == MICROBIT_OK && streaming)
+        result = configureStream();
+
+    return result;
 }
 
 /**
@@ -174,7 +293,13 @@ int MicroBitAccelerometer::configure()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
-    return driver->configure();
+    int result = driver->configure();
+
+    // The driver reconfigures the hardware, so restore our FIFO configuration if we are streaming.
+    if (result == MICROBIT_OK && streaming)
+        result = configureStream();
+
+    return result;
 }
 
 /**
@@ -193,6 +318,17 @@ int MicroBitAccelerometer::requestUpdate()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    // Wake the sensor if it was stopped for lack of consumers.
+    if (accelerometerAsleep)
+    {
+        driver->setSleep(false);
+        accelerometerAsleep = false;
+    }
+
+    // When streaming, only read the FIFO once irq1 indicates the watermark may have been reached.
+    if (streaming)
+        return (interruptPin && interruptPin->isActive()) ? readStream() : MICROBIT_OK;
+
     return driver->requestUpdate();
 }
 
@@ -207,6 +343,9 @@ Sample3D MicroBitAccelerometer::getSample(CoordinateSystem coordinateSystem)
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getSample( coordinateSystem );
+
     return driver->getSample( coordinateSystem );
 }
 
@@ -219,6 +358,9 @@ Sample3D MicroBitAccelerometer::getSample()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getSample();
+
     return driver->getSample();
 }
 
@@ -233,6 +375,9 @@ int MicroBitAccelerometer::getX()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getX();
+
     return driver->getX();
 }
 
@@ -247,6 +392,9 @@ int MicroBitAccelerometer::getY()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getY();
+
     return driver->getY();
 }
 
@@ -261,6 +409,9 @@ int MicroBitAccelerometer::getZ()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getZ();
+
     return driver->getZ();
 }
 
@@ -278,6 +429,15 @@ int MicroBitAccelerometer::getPitch()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (orientationAccuracy != ORIENTATION_ACCURACY_PRECISE)
+    {
+        updateOrientation();
+        return (int) ((360 * pitchRadians) / (2 * MICROBIT_ORIENTATION_PI));
+    }
+
+    if (streaming)
+        return Accelerometer::getPitch();
+
     return driver->getPitch();
 }
 
@@ -295,6 +455,15 @@ float MicroBitAccelerometer::getPitchRadians()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (orientationAccuracy != ORIENTATION_ACCURACY_PRECISE)
+    {
+        updateOrientation();
+        return pitchRadians;
+    }
+
+    if (streaming)
+        return Accelerometer::getPitchRadians();
+
     return driver->getPitchRadians();
 }
 
@@ -312,6 +481,15 @@ int MicroBitAccelerometer::getRoll()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (orientationAccuracy != ORIENTATION_ACCURACY_PRECISE)
+    {
+        updateOrientation();
+        return (int) ((360 * rollRadians) / (2 * MICROBIT_ORIENTATION_PI));
+    }
+
+    if (streaming)
+        return Accelerometer::getRoll();
+
     return driver->getRoll();
 }
 
@@ -329,9 +507,84 @@ float MicroBitAccelerometer::getRollRadians()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (orientationAccuracy != ORIENTATION_ACCURACY_PRECISE)
+    {
+        updateOrientation();
+        return rollRadians;
+    }
+
+    if (streaming)
+        return Accelerometer::getRollRadians();
+
     return driver->getRollRadians();
 }
 
+/**
+ * Recalculates the pitch and roll with the approximations selected by setOrientationAccuracy(),
+ * unless they have already been calculated from the latest sample.
+ */
+void MicroBitAccelerometer::updateOrientation()
+{
+    Sample3D s = getSample(SIMPLE_CARTESIAN);
+
+    if (orientationValid && s == orientationSample)
+        return;
+
+    float x = (float) s.x;
+    float y = (float) s.y;
+    float z = (float) s.z;
+
+    // This follows the driver's calculation: roll = atan2(x, -z), pitch = atan2(y, x*sin(roll) - z*cos(roll)).
+    // As sin(roll) = x/r and cos(roll) = -z/r, where r = sqrt(x*x + z*z), the pitch denominator is simply r.
+    float r2 = x*x + z*z;
+    float r = r2 > 0.0f ? r2 * microbit_inv_sqrt(r2, orientationAccuracy) : 0.0f;
+
+    rollRadians = microbit_atan2(x, -z, orientationAccuracy);
+    pitchRadians = microbit_atan2(y, r, orientationAccuracy);
+
+    // Handle the two "negative quadrants", such that we get an output in the +/- 180 degree range.
+    if (z > 0.0f)
+    {
+        float reference = pitchRadians > 0.0f ? (MICROBIT_ORIENTATION_PI / 2.0f) : (-MICROBIT_ORIENTATION_PI / 2.0f);
+        pitchRadians = reference + (reference - pitchRadians);
+    }
+
+    orientationSample = s;
+    orientationValid = true;
+}
+
+/**
+ * Selects the accuracy with which pitch and roll are calculated.
+ *
+ * The approximations are considerably quicker than the precise maths library functions, and suit applications
+ * that read the orientation every frame. However accurate, the pitch and roll are only calculated once for each
+ * sample, so repeated calls between updates are free.
+ *
+ * @param accuracy ORIENTATION_ACCURACY_PRECISE, ORIENTATION_ACCURACY_FAST or ORIENTATION_ACCURACY_FASTEST.
+ *
+ * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+ */
+int MicroBitAccelerometer::setOrientationAccuracy(MicroBitOrientationAccuracy accuracy)
+{
+    if (accuracy > ORIENTATION_ACCURACY_FASTEST)
+        return MICROBIT_INVALID_PARAMETER;
+
+    orientationAccuracy = accuracy;
+    orientationValid = false;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Determines the accuracy with which pitch and roll are calculated.
+ *
+ * @return The accuracy, which defaults to MICROBIT_ORIENTATION_ACCURACY.
+ */
+MicroBitOrientationAccuracy MicroBitAccelerometer::getOrientationAccuracy()
+{
+    return orientationAccuracy;
+}
+
 /**
   * Retrieves the last recorded gesture.
   *
@@ -349,9 +602,427 @@ uint16_t MicroBitAccelerometer::getGesture()
     if( driver == NULL )
         target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
     
+    if (streaming)
+        return Accelerometer::getGesture();
+
     return driver->getGesture();
 }
 
+/**
+ * Configures the hardware FIFO in stream mode, raising the watermark interrupt on irq1.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the accelerometer could not be configured.
+ */
+int MicroBitAccelerometer::configureStream()
+{
+    uint8_t ctrl5;
+
+    if (motionWake && configureMotion(true) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, &ctrl5, 1) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // Route the watermark interrupt (I1_WTM) to INT1, along with the motion interrupt (I1_AOI1) for motion wake.
+    // While dozing, only motion is routed, so the FIFO fills silently.
+    uint8_t interrupts = motionWake ? (dozing ? 0x40 : 0x44) : 0x04;
+
+    // Enable the FIFO in stream mode (discarding the oldest samples if it fills), with watermark interrupts on INT1.
+    if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, ctrl5 | 0x40) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_FIFO_CTRL, 0x80 | streamWatermark) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3, interrupts) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Reads all samples held in the hardware FIFO in a single burst, and adds them to the stream.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the FIFO could not be read.
+ */
+int MicroBitAccelerometer::readStream()
+{
+    uint8_t src;
+    int16_t data[MICROBIT_ACCELEROMETER_LSM303_FIFO_SIZE * 3];
+    CODAL_TIMESTAMP now = system_timer_current_time();
+
+    if (motionWake)
+    {
+        // Reading INT1_SRC also releases the latched motion interrupt.
+        if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_SRC, &src, 1) != MICROBIT_OK)
+            return MICROBIT_I2C_ERROR;
+
+        if (src & 0x40)
+            lastMotion = now;
+
+        if (dozing)
+        {
+            // irq1 is shared with the magnetometer, so it may not have been us.
+            if (!(src & 0x40))
+                return MICROBIT_OK;
+
+            // Wake up, and process the samples that led up to the motion.
+            if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3, 0x44) != MICROBIT_OK)
+                return MICROBIT_I2C_ERROR;
+
+            dozing = false;
+        }
+        else if (now - lastMotion > MICROBIT_ACCELEROMETER_MOTION_TIMEOUT)
+        {
+            // Still for long enough: mask the watermark interrupt, and collect what remains in the FIFO.
+            if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3, 0x40) != MICROBIT_OK)
+                return MICROBIT_I2C_ERROR;
+
+            dozing = true;
+        }
+    }
+
+    if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_FIFO_SRC, &src, 1) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // FSS holds the number of unread samples. If the FIFO has overrun, it is full.
+    int count = (src & 0x40) ? MICROBIT_ACCELEROMETER_LSM303_FIFO_SIZE : (src & 0x1F);
+
+    if (count == 0)
+        return MICROBIT_OK;
+
+    // With the FIFO enabled, auto-increment wraps from OUT_Z_H back to OUT_X_L, so the whole FIFO can be read in one burst.
+    if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_OUT_X_L | 0x80, (uint8_t *) data, count * 6) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // The newest sample was taken about now, and the rest one sample period apart before it.
+    int period = driver->getPeriod();
+    int range = driver->getRange();
+
+    for (int i = 0; i < count; i++)
+    {
+        // Scale each 16 bit little endian reading into milli-g (approx!), as the driver does.
+        sampleENU.x = (data[i*3] / 32) * range;
+        sampleENU.y = (data[i*3 + 1] / 32) * range;
+        sampleENU.z = (data[i*3 + 2] / 32) * range;
+
+        // Invoke new sample processing (coordinate transform, gestures and events) in the superclass.
+        update();
+
+        if (samples)
+            samples->push(sample, now - (count - 1 - i) * period);
+    }
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Starts streaming samples through the accelerometer's hardware FIFO.
+ *
+ * Samples collect in the FIFO until the watermark level is reached, and irq1 is raised. The whole FIFO is then
+ * read in a single burst I2C transaction, and each sample is timestamped and added to a ring buffer that is
+ * read with readSamples(). This takes far fewer bus transactions than reading each sample individually.
+ * While streaming, getSample(), gestures and tilt compensation are all driven from the streamed samples.
+ *
+ * @param watermark The number of samples to collect before they are read, in the range 1..31.
+ *        Defaults to MICROBIT_ACCELEROMETER_FIFO_WATERMARK.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the watermark is out of range,
+ *         MICROBIT_NOT_SUPPORTED if the accelerometer has no FIFO, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::startStream(int watermark)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
+
+    if (watermark < 1 || watermark >= MICROBIT_ACCELEROMETER_LSM303_FIFO_SIZE)
+        return MICROBIT_INVALID_PARAMETER;
+
+    if (!fifoDetected)
+        return MICROBIT_NOT_SUPPORTED;
+
+    getSampleBuffer();
+
+    // Ensure the driver has configured the hardware, and remember its interrupt configuration.
+    if (!streaming)
+    {
+        if (accelerometerAsleep)
+        {
+            driver->setSleep(false);
+            accelerometerAsleep = false;
+        }
+
+        driver->requestUpdate();
+
+        if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3, &streamInterrupts, 1) != MICROBIT_OK)
+            return MICROBIT_I2C_ERROR;
+    }
+
+    streamWatermark = watermark;
+
+    if (configureStream() != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // Take over from the driver, which would otherwise read samples out of the FIFO one at a time.
+    driver->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    if (MicroBitCompass::driver)
+        MicroBitCompass::driver->setAccelerometer(*this);
+
+    streaming = true;
+    status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Stops streaming samples, returning the accelerometer to reading one sample at a time.
+ *
+ * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::stopStream()
+{
+    if (!streaming)
+        return MICROBIT_OK;
+
+    // Motion wake depends upon streaming, so stops with it.
+    if (motionWake)
+    {
+        motionWake = false;
+        motionStream = false;
+        dozing = false;
+
+        if (configureMotion(false) != MICROBIT_OK)
+            return MICROBIT_I2C_ERROR;
+    }
+
+    // Collect anything still waiting in the FIFO, then return it to bypass mode.
+    readStream();
+
+    streaming = false;
+    status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    if (MicroBitCompass::driver)
+        MicroBitCompass::driver->setAccelerometer(*driver);
+
+    uint8_t ctrl5;
+
+    if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_FIFO_CTRL, 0x00) != MICROBIT_OK ||
+        i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, &ctrl5, 1) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, ctrl5 & ~0x40) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG3, streamInterrupts) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // Let the driver resume its own background updates.
+    driver->requestUpdate();
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Determines if samples are being streamed through the hardware FIFO.
+ *
+ * @return true if streaming, false otherwise.
+ */
+bool MicroBitAccelerometer::isStreaming()
+{
+    return streaming;
+}
+
+/**
+ * Configures (or removes) the high-pass filtered motion interrupt on INT1, used by motion wake.
+ *
+ * @param enable true to detect motion, false to stop.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_I2C_ERROR if the accelerometer could not be configured.
+ */
+int MicroBitAccelerometer::configureMotion(bool enable)
+{
+    uint8_t ctrl2;
+    uint8_t ctrl5;
+    uint8_t unused;
+
+    if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG2, &ctrl2, 1) != MICROBIT_OK ||
+        i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, &ctrl5, 1) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    if (!enable)
+    {
+        if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_CFG, 0x00) != MICROBIT_OK ||
+            i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG2, ctrl2 & ~0x01) != MICROBIT_OK ||
+            i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, ctrl5 & ~0x08) != MICROBIT_OK)
+            return MICROBIT_I2C_ERROR;
+
+        return MICROBIT_OK;
+    }
+
+    // INT1_THS has one LSB per 16, 32, 62 or 186 milli-g in the 2, 4, 8 and 16g ranges.
+    int range = driver->getRange();
+    int lsb = range <= 2 ? 16 : range <= 4 ? 32 : range <= 8 ? 62 : 186;
+    int threshold = min(max(motionThreshold / lsb, 1), 127);
+
+    // Filter gravity out of the motion interrupt (HPIS1), so it fires on any change above the threshold on any axis
+    // (an OR of XHIE, YHIE and ZHIE), and latch it (LIR_INT1) until INT1_SRC is read.
+    if (i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG2, ctrl2 | 0x01) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_THS, threshold) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_DURATION, 0x00) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_CFG, 0x2A) != MICROBIT_OK ||
+        i2cBus.writeRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_CTRL_REG5, ctrl5 | 0x08) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    // Reading REFERENCE settles the high-pass filter on the current acceleration, and reading INT1_SRC clears any stale event.
+    if (i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_REFERENCE, &unused, 1) != MICROBIT_OK ||
+        i2cBus.readRegister(MICROBIT_ACCELEROMETER_LSM303_ADDRESS, MICROBIT_ACCELEROMETER_LSM303_INT1_SRC, &unused, 1) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Enables or disables motion wake, which lets gesture processing sleep while the device is still.
+ *
+ * Samples are streamed through the hardware FIFO, and the accelerometer's motion interrupt (a high-pass
+ * filtered threshold on every axis) is also routed to irq1. Once no motion has been detected for
+ * MICROBIT_ACCELEROMETER_MOTION_TIMEOUT milliseconds, the watermark interrupt is masked, so no samples are
+ * read over I2C, and no gestures processed, until the motion interrupt fires. The FIFO is then read in one burst,
+ * and the samples leading up to the motion classified as usual. While asleep, the last sample and gesture are
+ * reported unchanged.
+ *
+ * @param enable true to enable motion wake, false to disable it.
+ * @param threshold The change in acceleration on any axis that counts as motion, in milli-g.
+ *        Defaults to MICROBIT_ACCELEROMETER_MOTION_THRESHOLD.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the accelerometer has no FIFO, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitAccelerometer::setMotionWake(bool enable, int threshold)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
+
+    if (!fifoDetected)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (enable)
+    {
+        if (threshold <= 0)
+            return MICROBIT_INVALID_PARAMETER;
+
+        motionThreshold = threshold;
+        motionWake = true;
+        dozing = false;
+        lastMotion = system_timer_current_time();
+
+        if (streaming)
+            return configureStream();
+
+        // Stream with the default watermark, and stop streaming again when motion wake is disabled.
+        int result = startStream();
+
+        if (result == MICROBIT_OK)
+            motionStream = true;
+        else
+            motionWake = false;
+
+        return result;
+    }
+
+    if (!motionWake)
+        return MICROBIT_OK;
+
+    motionWake = false;
+    dozing = false;
+
+    if (configureMotion(false) != MICROBIT_OK)
+        return MICROBIT_I2C_ERROR;
+
+    if (motionStream)
+    {
+        motionStream = false;
+        return stopStream();
+    }
+
+    return configureStream();
+}
+
+/**
+ * Determines if motion wake is enabled.
+ *
+ * @return true if enabled, false otherwise.
+ */
+bool MicroBitAccelerometer::isMotionWake()
+{
+    return motionWake;
+}
+
+/**
+ * Determines if gesture processing is asleep, waiting for motion.
+ *
+ * @return true if asleep, false otherwise.
+ */
+bool MicroBitAccelerometer::isDozing()
+{
+    return dozing;
+}
+
+/**
+ * Adds each new sample read by the driver to the sample buffer.
+ */
+void MicroBitAccelerometer::onSampleUpdate(MicroBitEvent)
+{
+    // Streamed samples are added as they are read from the FIFO, with their own timestamps.
+    if (streaming)
+        return;
+
+    samples->push(driver->getSample(), system_timer_current_time());
+}
+
+/**
+ * Provides the buffer of recent timestamped samples, starting to record them if this is the first request.
+ *
+ * Every sample is recorded, whether read one at a time by the driver or in bursts while streaming.
+ * Each consumer opens its own MicroBitSampleCursor on the buffer, and so reads every sample at its own pace,
+ * with any it falls too far behind to read counted as overruns.
+ *
+ * @return The sample buffer.
+ */
+MicroBitSampleBuffer& MicroBitAccelerometer::getSampleBuffer()
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::ACCELEROMETER_ERROR );
+
+    if (samples == NULL)
+    {
+        samples = new MicroBitSampleBuffer(MICROBIT_ACCELEROMETER_SAMPLE_BUFFER_SIZE);
+
+        // Record each sample as the driver reads it, and ensure the driver is sampling in the background.
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->listen(MICROBIT_ID_ACCELEROMETER, MICROBIT_ACCELEROMETER_EVT_DATA_UPDATE, this, &MicroBitAccelerometer::onSampleUpdate, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        driver->requestUpdate();
+    }
+
+    return *samples;
+}
+
+/**
+ * Reads recorded samples, oldest first, using the sample buffer's own cursor.
+ *
+ * @param buffer The memory to read the samples into.
+ * @param count The maximum number of samples to read.
+ *
+ * @return The number of samples read.
+ */
+int MicroBitAccelerometer::readSamples(MicroBitSample *buffer, int count)
+{
+    return getSampleBuffer().read(buffer, count);
+}
+
+/**
+ * Checks for streamed samples waiting in the hardware FIFO, when the scheduler is idle.
+ */
+void MicroBitAccelerometer::idleCallback()
+{
+    // irq1 is shared with the magnetometer, so readStream() checks the FIFO level before reading.
+    if (streaming)
+        requestUpdate();
+}
+
 MicroBitAccelerometer::~MicroBitAccelerometer()
 {
+    i2cBus.removeClient(*this);
 }
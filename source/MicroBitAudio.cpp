@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitAudio.h"
 #include "MicroBit.h"
 #include "CodalDmesg.h"
+#include "MicroBitPowerProfiler.h"
 #include "NRF52PWM.h"
 #include "Synthesizer.h"
 #include "SoundExpressions.h"
@@ -40,6 +41,7 @@ MicroBitAudio* MicroBitAudio::instance = NULL;
   * Default Constructor.
   */
 MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NRF52Pin &microphone, NRF52Pin &runmic):
+    MicroBitMemoryConsumer("audio"),
     speakerEnabled(true),
     pinEnabled(true),
     pin(&pin), 
@@ -47,6 +49,7 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
     synth(DEVICE_ID_SOUND_EMOJI_SYNTHESIZER_0),
     soundExpressionChannel(NULL),
     pwm(NULL),
+    sampleRate(CONFIG_MIXER_DEFAULT_SAMPLERATE),
     adc(adc),
     microphone(microphone),
     runmic(runmic),
@@ -60,30 +63,50 @@ MicroBitAudio::MicroBitAudio(NRF52Pin &pin, NRF52Pin &speaker, NRF52ADC &adc, NR
     synth.allowEmptyBuffers(true);
 
     mic = adc.getChannel(microphone, false);
-    adc.setSamplePeriod( 1e6 / 22000 );
+    // Oversample by the decimation factor of the microphone filter, so that the pipeline still sees 22kHz.
+    adc.setSamplePeriod( 1e6 / (22000 * CONFIG_MICROPHONE_FILTER_DECIMATION) );
     mic->setGain(7,0);
 
-    //Initialialise the microphone filter
-    micFilter = new LowPassFilter(mic->output, 0.1f, true);
-
-    //Initilise input splitter
-    rawSplitter = new StreamSplitter(*micFilter);
-
-    //Initilise stream normalizer
-    processor = new StreamNormalizer(*rawSplitter, 0.08f, true, DATASTREAM_FORMAT_8BIT_SIGNED, 10);
-
-    //Initilise stream splitter
-    splitter = new StreamSplitter(processor->output);
-
-    //Initilise level detector and attach to splitter
-    level = new LevelDetector(*splitter, 150, 75, DEVICE_ID_SYSTEM_LEVEL_DETECTOR, false);
-
-    //Initilise level detector SPL and attach to splitter
-    levelSPL = new LevelDetectorSPL(*rawSplitter, 85.0, 65.0, 16.0, 0, DEVICE_ID_MICROPHONE, false);
+    // The rest of the microphone pipeline is built here, or on demand as it is first used if CONFIG_MICROBIT_AUDIO_LAZY_MIC is set.
+    micFilter = NULL;
+    rawSplitter = NULL;
+    processor = NULL;
+    splitter = NULL;
+    level = NULL;
+    levelSPL = NULL;
+    spectrum = NULL;
+    soundLevel = NULL;
+
+#if !CONFIG_ENABLED(CONFIG_MICROBIT_AUDIO_LAZY_MIC)
+    getLevelDetector();
+    getLevelDetectorSPL();
+#endif
 
     // Register listener for splitter events
     if(EventModel::defaultEventBus){
         EventModel::defaultEventBus->listen(DEVICE_ID_SPLITTER, DEVICE_EVT_ANY, this, &MicroBitAudio::onSplitterEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        EventModel::defaultEventBus->listen(DEVICE_ID_MIXER, DEVICE_EVT_ANY, this, &MicroBitAudio::onMixerEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    }
+}
+
+/**
+ * Handle events from the mixer. While the mixer is suspended there is nothing to play,
+ * so we power down the PWM until it resumes.
+ */
+void MicroBitAudio::onMixerEvent(MicroBitEvent e)
+{
+    if (pwm == NULL)
+        return;
+
+    if (e.value == DEVICE_MIXER_EVT_SUSPEND)
+    {
+        pwm->disable();
+        MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_SPEAKER, false);
+    }
+    else if (e.value == DEVICE_MIXER_EVT_RESUME)
+    {
+        pwm->enable();
+        MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_SPEAKER, true);
     }
 }
 
@@ -104,6 +127,7 @@ void MicroBitAudio::activateMic(){
     runmic.setDigitalValue(1);
     runmic.setHighDrive(true);
     adc.activateChannel(mic);
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_MICROPHONE, true);
 }
 
 /**
@@ -114,6 +138,7 @@ void MicroBitAudio::deactivateMic(){
     runmic.setHighDrive(false);
     mic->disable(); // Just disable the mic channel, releasing it makes it gone forever!
     //adc.releaseChannel(microphone);
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_MICROPHONE, false);
 }
 
 /**
@@ -123,11 +148,196 @@ void MicroBitAudio::deactivateLevelSPL(){
     //levelSPL->disable();
 }
 
+/**
+  * Obtain the low pass filtered (and decimated, if CONFIG_MICROPHONE_FILTER_DECIMATION is above 1)
+  * microphone stream, creating it if necessary.
+  * @return the microphone filter.
+  */
+MicroBitAudio::MicFilter *MicroBitAudio::getMicFilter()
+{
+    if (micFilter == NULL)
+#if CONFIG_ENABLED(CONFIG_MICROBIT_AUDIO_LEGACY_MIC_FILTER)
+        micFilter = new LowPassFilter(mic->output, CONFIG_MICROPHONE_FILTER_BETA, true);
+#else
+        micFilter = new MicrophoneFilter(mic->output);
+#endif
+
+    return micFilter;
+}
+
+/**
+  * Obtain the splitter carrying the raw (filtered, but not normalised) microphone stream, creating it if necessary.
+  * @return the raw splitter.
+  */
+StreamSplitter *MicroBitAudio::getRawSplitter()
+{
+    if (rawSplitter == NULL)
+        rawSplitter = new StreamSplitter(*getMicFilter());
+
+    return rawSplitter;
+}
+
+/**
+  * Obtain the normaliser for the microphone stream, creating it (and its upstream stages) if necessary.
+  * @return the stream normaliser.
+  */
+StreamNormalizer *MicroBitAudio::getProcessor()
+{
+    if (processor == NULL)
+        processor = new StreamNormalizer(*getRawSplitter(), 0.08f, true, DATASTREAM_FORMAT_8BIT_SIGNED, 10);
+
+    return processor;
+}
+
+/**
+  * Obtain the splitter carrying the normalised 8 bit microphone stream, creating it if necessary.
+  * @return the normalised splitter.
+  */
+StreamSplitter *MicroBitAudio::getSplitter()
+{
+    if (splitter == NULL)
+        splitter = new StreamSplitter(getProcessor()->output);
+
+    return splitter;
+}
+
+/**
+  * Obtain the level detector on the normalised microphone stream, creating it if necessary.
+  * @return the level detector.
+  */
+LevelDetector *MicroBitAudio::getLevelDetector()
+{
+    if (level == NULL)
+        level = new LevelDetector(*getSplitter(), 150, 75, DEVICE_ID_SYSTEM_LEVEL_DETECTOR, false);
+
+    return level;
+}
+
+/**
+  * Obtain the sound pressure level detector on the raw microphone stream, creating it if necessary.
+  * @return the SPL level detector.
+  */
+LevelDetectorSPL *MicroBitAudio::getLevelDetectorSPL()
+{
+    if (levelSPL == NULL)
+        levelSPL = new LevelDetectorSPL(*getRawSplitter(), 85.0, 65.0, 16.0, 0, DEVICE_ID_MICROPHONE, false);
+
+    return levelSPL;
+}
+
+/**
+  * Obtain the fixed point sound level detector on the raw microphone stream, creating it if necessary.
+  * It processes audio only while polled, or while activated for event listeners.
+  * @return the sound level detector.
+  */
+SoundLevelDetector *MicroBitAudio::getSoundLevelDetector()
+{
+    if (soundLevel == NULL)
+        soundLevel = new SoundLevelDetector(*getRawSplitter(), 85, 65);
+
+    return soundLevel;
+}
+
+/**
+  * Obtain the spectrum analyser shared by all users of the microphone, creating it if necessary.
+  * Analysis starts when the analyser is first queried, or a band is monitored.
+  * @return the shared SpectrumAnalyser.
+  */
+SpectrumAnalyser *MicroBitAudio::getSpectrumAnalyser()
+{
+    if (spectrum == NULL)
+        spectrum = new SpectrumAnalyser(*getSplitter());
+
+    return spectrum;
+}
+
+/**
+  * Stop the microphone and free every stage of its pipeline, returning the memory to the heap.
+  * Stages are rebuilt on demand the next time they are requested.
+  *
+  * @note Any pointer previously obtained to a stage (or a component connected to one) is invalid afterwards.
+  * @return DEVICE_OK.
+  */
+int MicroBitAudio::releaseMicrophone()
+{
+    // Stop the flow of samples before dismantling the pipeline, consumers first.
+    deactivateMic();
+    mic->output.disconnect();
+
+    delete spectrum;
+    delete soundLevel;
+    delete level;
+    delete levelSPL;
+    delete splitter;
+    delete processor;
+    delete rawSplitter;
+    delete micFilter;
+
+    spectrum = NULL;
+    soundLevel = NULL;
+    level = NULL;
+    levelSPL = NULL;
+    splitter = NULL;
+    processor = NULL;
+    rawSplitter = NULL;
+    micFilter = NULL;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determine how much heap memory the microphone pipeline currently holds.
+  * @return The number of bytes allocated to pipeline stages, or zero if none have been created.
+  */
+int MicroBitAudio::getMicrophoneHeapUsage()
+{
+    int bytes = 0;
+
+    if (micFilter)
+        bytes += sizeof(MicFilter);
+
+    if (rawSplitter)
+        bytes += sizeof(StreamSplitter);
+
+    if (processor)
+        bytes += sizeof(StreamNormalizer);
+
+    if (splitter)
+        bytes += sizeof(StreamSplitter);
+
+    if (level)
+        bytes += sizeof(LevelDetector);
+
+    if (levelSPL)
+        bytes += sizeof(LevelDetectorSPL);
+
+    if (soundLevel)
+        bytes += sizeof(SoundLevelDetector);
+
+    if (spectrum)
+        bytes += spectrum->getHeapUsage();
+
+    return bytes;
+}
+
+/**
+  * Determine how much heap memory audio currently holds: the microphone pipeline, and the PWM driver
+  * created when sound is first played.
+  *
+  * @note The pipeline is not freed by releaseMemory(), as that would invalidate pointers to its stages.
+  * Use releaseMicrophone() once they are no longer needed.
+  * @return The number of bytes allocated.
+  */
+uint32_t MicroBitAudio::getMemoryUsage()
+{
+    return getMicrophoneHeapUsage() + (pwm ? sizeof(NRF52PWM) : 0);
+}
+
 /**
   * Set normaliser gain
   */
 void MicroBitAudio::setMicrophoneGain(int gain){
-    processor->setGain(gain/100);
+    getProcessor()->setGain(gain/100);
 
 }
 
@@ -138,7 +348,7 @@ int MicroBitAudio::enable()
 { 
     if (pwm == NULL)
     {
-        pwm = new NRF52PWM( NRF_PWM1, mixer, 44100 );
+        pwm = new NRF52PWM( NRF_PWM1, mixer, sampleRate );
         pwm->setDecoderMode( PWM_DECODER_LOAD_Common );
 
         mixer.setSampleRange( pwm->getSampleRange() );
@@ -150,6 +360,11 @@ int MicroBitAudio::enable()
         if ( soundExpressionChannel == NULL )
             soundExpressionChannel = mixer.addChannel(synth);
     }
+
+    // Restart the output quickly if it was suspended due to silence.
+    mixer.resume();
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_SPEAKER, true);
+
     return DEVICE_OK;
 }
 
@@ -159,6 +374,7 @@ int MicroBitAudio::disable()
     setPinEnabled( false );
 
     pwm->disable();
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_SPEAKER, false);
 
     return DEVICE_OK;
 }
@@ -195,6 +411,38 @@ int MicroBitAudio::getVolume() {
     return mixer.getVolume() / 4;
 }
 
+/**
+ * Define the output sample rate of the audio pipeline.
+ * Lower rates reduce the CPU time spent mixing, at the expense of audio quality.
+ * @param sampleRate The new sample rate in samples per second. Defaults to 44100.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER
+ */
+int MicroBitAudio::setSampleRate(int sampleRate)
+{
+    if (sampleRate <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->sampleRate = sampleRate;
+
+    if (pwm)
+    {
+        pwm->setSampleRate( sampleRate );
+        mixer.setSampleRange( pwm->getSampleRange() );
+    }
+
+    mixer.setSampleRate( sampleRate );
+
+    return DEVICE_OK;
+}
+
+/**
+ * Get the current output sample rate.
+ * @return The output sample rate in samples per second.
+ */
+int MicroBitAudio::getSampleRate() {
+    return sampleRate;
+}
+
 /**
  * Enable or disable use of the on-board speaker.
  * @param on New value.
@@ -282,13 +530,13 @@ int MicroBitAudio::setSleep(bool doSleep)
     {
       if (pwm)
       {
+          // Keep the PWM driver and its configuration, so that waking up only needs to reconnect and restart it.
           status |= MICROBIT_AUDIO_STATUS_DEEPSLEEP;
           NVIC_DisableIRQ(PWM1_IRQn);
           pwm->disable();
           pwm->disconnectPin(speaker);
           pwm->disconnectPin(*pin);
-          delete pwm;
-          pwm = NULL;
+          MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_SPEAKER, false);
       }
     }
     else
@@ -296,6 +544,10 @@ int MicroBitAudio::setSleep(bool doSleep)
       if ( status & MICROBIT_AUDIO_STATUS_DEEPSLEEP)
       { 
           status &= ~MICROBIT_AUDIO_STATUS_DEEPSLEEP;
+          setSpeakerEnabled( speakerEnabled );
+          setPinEnabled( pinEnabled );
+          NVIC_EnableIRQ(PWM1_IRQn);
+          pwm->enable();
           enable();
       }
     }
@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitBootTrace.h"
+#include "ErrorNo.h"
+#include "CodalDmesg.h"
+#include "Timer.h"
+
+using namespace codal;
+
+/**
+ * Constructor. Creates an empty trace.
+ */
+MicroBitBootTrace::MicroBitBootTrace()
+{
+    count = 0;
+}
+
+/**
+ * Records that a phase of startup has just completed.
+ *
+ * @param name The name of the phase. This is not copied, so should be a string literal.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if MICROBIT_BOOT_TRACE_MAX_PHASES phases have already been recorded.
+ */
+int MicroBitBootTrace::record(const char *name)
+{
+    if (count >= MICROBIT_BOOT_TRACE_MAX_PHASES)
+        return DEVICE_NO_RESOURCES;
+
+    phases[count].name = name;
+    phases[count].time = (uint32_t) system_timer_current_time_us();
+    count++;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Reads the number of phases recorded.
+ *
+ * @return The number of phases.
+ */
+int MicroBitBootTrace::getCount()
+{
+    return count;
+}
+
+/**
+ * Reads a recorded phase.
+ *
+ * @param index The index of the phase, in the order recorded.
+ *
+ * @return The phase, or one with a NULL name if the index is out of range.
+ */
+MicroBitBootPhase MicroBitBootTrace::getPhase(int index)
+{
+    MicroBitBootPhase p;
+
+    if (index < 0 || index >= count)
+    {
+        p.name = NULL;
+        p.time = 0;
+        return p;
+    }
+
+    return phases[index];
+}
+
+/**
+ * Reads the time between two recorded phases.
+ *
+ * @param from The index of the earlier phase, or -1 to measure from the start of the system timer.
+ * @param to The index of the later phase.
+ *
+ * @return The time between the phases, in microseconds, or DEVICE_INVALID_PARAMETER if either index is out of range.
+ */
+int MicroBitBootTrace::getDuration(int from, int to)
+{
+    if (from < -1 || from >= count || to < 0 || to >= count)
+        return DEVICE_INVALID_PARAMETER;
+
+    return phases[to].time - (from < 0 ? 0 : phases[from].time);
+}
+
+/**
+ * Writes the trace to the debug log, with the duration of each phase.
+ */
+void MicroBitBootTrace::print()
+{
+    for (int i = 0; i < count; i++)
+        DMESG("BOOT: %s at %d us (+%d us)", phases[i].name, (int) phases[i].time, getDuration(i - 1, i));
+}
@@ -30,9 +30,13 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDevice.h"
 #include "MicroBitError.h"
 #include "LSM303Magnetometer.h"
+#include "Timer.h"
 
 Compass* MicroBitCompass::driver;
 
+static MicroBitSensorDemand compassDemand;          // The sample periods required by consumers of the compass.
+static bool compassAsleep = false;                  // Whether or not the compass was stopped for lack of consumers.
+
 /**
  * Constructor.
  * Create a software abstraction of an e-compass.
@@ -43,6 +47,12 @@ Compass* MicroBitCompass::driver;
  */
 MicroBitCompass::MicroBitCompass(MicroBitI2C &i2c, uint16_t id) : Compass(MicroBitAccelerometer::coordinateSpace)
 {
+    samples = NULL;
+    accelerometer = NULL;
+    orientationAccuracy = MICROBIT_ORIENTATION_ACCURACY;
+    headingValid = false;
+    headingDegrees = 0;
+
     autoDetect(i2c);
 }
 
@@ -88,7 +98,107 @@ int MicroBitCompass::heading()
     if( driver == NULL )
         target_panic( MicroBitPanic::COMPASS_ERROR );
 
-    return driver->heading();
+    // Calibration is left to the driver, which calibrates on demand.
+    if (orientationAccuracy == ORIENTATION_ACCURACY_PRECISE || driver->isCalibrating() || !driver->isCalibrated())
+        return driver->heading();
+
+    updateHeading();
+
+    return headingDegrees;
+}
+
+/**
+ * Recalculates the tilt compensated heading with the approximations selected by setOrientationAccuracy(),
+ * unless it has already been calculated from the latest magnetometer and accelerometer samples.
+ */
+void MicroBitCompass::updateHeading()
+{
+    Sample3D m = driver->getSample(NORTH_EAST_DOWN);
+    Sample3D a = accelerometer ? accelerometer->getSample(SIMPLE_CARTESIAN) : MicroBitAccelerometer::driver->getSample(SIMPLE_CARTESIAN);
+
+    if (headingValid && m == headingSample && a == headingGravity)
+        return;
+
+    float ax = (float) a.x;
+    float ay = (float) a.y;
+    float az = (float) a.z;
+
+    // The sines and cosines of the accelerometer's roll (phi) and pitch (theta) follow directly from the sample,
+    // as roll = atan2(ax, -az) and pitch = atan2(ay, r), where r = sqrt(ax*ax + az*az), so no trigonometry is needed.
+    // When ax and az are both zero, the roll is atan2(0, -0), which is PI.
+    float r2 = ax*ax + az*az;
+    float g2 = r2 + ay*ay;
+    float sinPhi = 0.0f;
+    float cosPhi = -1.0f;
+    float sinTheta = 0.0f;
+    float cosTheta = 1.0f;
+
+    if (r2 > 0.0f)
+    {
+        float r = microbit_inv_sqrt(r2, orientationAccuracy);
+        sinPhi = ax * r;
+        cosPhi = -az * r;
+    }
+
+    if (g2 > 0.0f)
+    {
+        float g = microbit_inv_sqrt(g2, orientationAccuracy);
+        sinTheta = ay * g;
+        cosTheta = r2 > 0.0f ? r2 * microbit_inv_sqrt(r2, orientationAccuracy) * g : 0.0f;
+
+        // The pitch is reflected into the +/- 180 degree range when the device is upside down.
+        if (az > 0.0f)
+            cosTheta = -cosTheta;
+    }
+
+    float x = (float) m.x;
+    float y = (float) m.y;
+    float z = (float) m.z;
+
+    float bearing = (360 * microbit_atan2(x*cosTheta + y*sinTheta*sinPhi + z*sinTheta*cosPhi, z*sinPhi - y*cosPhi, orientationAccuracy)) / (2 * MICROBIT_ORIENTATION_PI);
+
+    // Handle the 90 degree offset caused by the NORTH_EAST_DOWN based calculation.
+    bearing = 90 - bearing;
+
+    if (bearing < 0)
+        bearing += 360.0f;
+
+    headingDegrees = (int) bearing;
+    headingSample = m;
+    headingGravity = a;
+    headingValid = true;
+}
+
+/**
+ * Selects the accuracy with which the tilt compensated heading is calculated.
+ *
+ * The approximations are considerably quicker than the precise maths library functions, and suit applications
+ * that read the heading every frame. Approximated headings are only calculated once for each pair of
+ * magnetometer and accelerometer samples, so repeated calls between updates are free.
+ *
+ * @param accuracy ORIENTATION_ACCURACY_PRECISE, ORIENTATION_ACCURACY_FAST or ORIENTATION_ACCURACY_FASTEST.
+ *
+ * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+ */
+int MicroBitCompass::setOrientationAccuracy(MicroBitOrientationAccuracy accuracy)
+{
+    if (accuracy > ORIENTATION_ACCURACY_FASTEST)
+        return MICROBIT_INVALID_PARAMETER;
+
+    orientationAccuracy = accuracy;
+    headingValid = false;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Determines the accuracy with which the tilt compensated heading is calculated.
+ *
+ * @return The accuracy, which defaults to MICROBIT_ORIENTATION_ACCURACY.
+ */
+MicroBitOrientationAccuracy MicroBitCompass::getOrientationAccuracy()
+{
+    return orientationAccuracy;
 }
 
 /**
@@ -222,6 +332,9 @@ void MicroBitCompass::setAccelerometer(MicroBitAccelerometer &accelerometer)
     if( driver == NULL )
         target_panic( MicroBitPanic::COMPASS_ERROR );
     
+    this->accelerometer = &accelerometer;
+    headingValid = false;
+
     return driver->setAccelerometer( accelerometer );
 }
 
@@ -254,6 +367,84 @@ int MicroBitCompass::getPeriod()
     return driver->getPeriod();
 }
 
+/**
+ * Records the sample period a consumer of the compass requires, and runs the compass at the shortest
+ * period any consumer has requested. Consumers should release their request once they no longer need samples.
+ *
+ * @param consumer The id of the consuming component, e.g. DEVICE_ID_AHRS.
+ * @param period The longest time between samples the consumer can accept, in milliseconds.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer id is zero or the period is not positive,
+ * MICROBIT_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitCompass::requestPeriod(uint16_t consumer, int period)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::COMPASS_ERROR );
+
+    int result = compassDemand.request(consumer, period);
+
+    return result == MICROBIT_OK ? applyDemand() : result;
+}
+
+/**
+ * Removes the sample period a consumer requested with requestPeriod(). Once no consumers remain, background
+ * sampling stops and the compass is put to sleep, until a new request is made, or it is read through this object.
+ *
+ * @param consumer The id of the consuming component.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the consumer has no request recorded, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitCompass::releasePeriod(uint16_t consumer)
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::COMPASS_ERROR );
+
+    int result = compassDemand.release(consumer);
+
+    return result == MICROBIT_OK ? applyDemand() : result;
+}
+
+/**
+ * Runs the compass at the sample period required by its consumers, or stops it if there are none.
+ *
+ * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR.
+ */
+int MicroBitCompass::applyDemand()
+{
+    int period = compassDemand.getPeriod();
+
+    if (period == 0)
+    {
+        if (compassAsleep)
+            return MICROBIT_OK;
+
+        // Nobody needs samples, so stop reading them in the background. If the driver can't put the sensor to sleep,
+        // at least slow it down.
+        driver->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+        if (driver->setSleep(true) != MICROBIT_OK)
+            driver->setPeriod(MICROBIT_SENSOR_DEMAND_IDLE_PERIOD);
+
+        compassAsleep = true;
+        return MICROBIT_OK;
+    }
+
+    if (compassAsleep)
+    {
+        driver->setSleep(false);
+        compassAsleep = false;
+    }
+
+    int result = setPeriod(period);
+
+    // Reading the sensor (re)starts background sampling.
+    if (result == MICROBIT_OK)
+        result = requestUpdate();
+
+    return result;
+}
+
 /**
  * Poll to see if new data is available from the hardware. If so, update it.
  * n.b. it is not necessary to explicitly call this funciton to update data
@@ -270,6 +461,13 @@ int MicroBitCompass::requestUpdate()
     if( driver == NULL )
         target_panic( MicroBitPanic::COMPASS_ERROR );
     
+    // Wake the sensor if it was stopped for lack of consumers.
+    if (compassAsleep)
+    {
+        driver->setSleep(false);
+        compassAsleep = false;
+    }
+
     return driver->requestUpdate();
 }
 
@@ -341,6 +539,41 @@ int MicroBitCompass::getZ()
     return driver->getZ();
 }
 
+/**
+ * Adds each new sample read by the driver to the sample buffer.
+ */
+void MicroBitCompass::onSampleUpdate(MicroBitEvent)
+{
+    samples->push(driver->getSample(), system_timer_current_time());
+}
+
+/**
+ * Provides the buffer of recent timestamped samples, starting to record them if this is the first request.
+ *
+ * Each consumer opens its own MicroBitSampleCursor on the buffer, and so reads every sample at its own pace,
+ * with any it falls too far behind to read counted as overruns.
+ *
+ * @return The sample buffer.
+ */
+MicroBitSampleBuffer& MicroBitCompass::getSampleBuffer()
+{
+    if( driver == NULL )
+        target_panic( MicroBitPanic::COMPASS_ERROR );
+
+    if (samples == NULL)
+    {
+        samples = new MicroBitSampleBuffer(MICROBIT_COMPASS_SAMPLE_BUFFER_SIZE);
+
+        // Record each sample as the driver reads it, and ensure the driver is sampling in the background.
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE, this, &MicroBitCompass::onSampleUpdate, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        driver->requestUpdate();
+    }
+
+    return *samples;
+}
+
 /**
   * Destructor.
   */
@@ -29,8 +29,6 @@ DEALINGS IN THE SOFTWARE.
 
 using namespace codal;
 
-#define CALIBRATION_INCREMENT     200
-
 /**
   * Constructor.
   *
@@ -51,6 +49,7 @@ using namespace codal;
 MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelerometer& _accelerometer, MicroBitDisplay& _display) : compass(_compass), accelerometer(_accelerometer), display(_display)
 {
     this->storage = NULL;
+    this->background = NULL;
 
     if (EventModel::defaultEventBus)
         EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_CALIBRATE, this, &MicroBitCompassCalibrator::calibrateUX, MESSAGE_BUS_LISTENER_IMMEDIATE);
@@ -75,6 +74,7 @@ MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelero
 MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelerometer& _accelerometer, MicroBitDisplay& _display, MicroBitStorage &storage) : compass(_compass), accelerometer(_accelerometer), display(_display)
 {
     this->storage = &storage;
+    this->background = NULL;
 
     //Attempt to load any stored calibration datafor the compass.
     KeyValuePair *calibrationData =  this->storage->get("compassCal");
@@ -90,34 +90,6 @@ MicroBitCompassCalibrator::MicroBitCompassCalibrator(Compass& _compass, Accelero
     if (EventModel::defaultEventBus)
         EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_CALIBRATE, this, &MicroBitCompassCalibrator::calibrateUX, MESSAGE_BUS_LISTENER_IMMEDIATE);
 }
-/**
- * Scoring function for a hill climb algorithm.
- *
- * @param c An approximated centre point
- * @param data a collection of data points
- * @param samples the number of samples in the 'data' array
- *
- * @return The deviation between the closest and further point in the data array from the point given. 
- */
-float MicroBitCompassCalibrator::measureScore(Sample3D &c, Sample3D *data, int samples)
-{
-    float minD;
-    float maxD;
-
-    minD = maxD = c.dSquared(data[0]);
-    for (int i = 1; i < samples; i++)
-    {
-        float d = c.dSquared(data[i]);
-
-        if (d < minD)
-            minD = d;
-
-        if (d > maxD)
-            maxD = d;
-    }
-
-    return (maxD - minD);
-}
 
 /**
  * Calculates an independent X, Y, Z scale factor and centre for a given set of data points, assumed to be on
@@ -129,159 +101,43 @@ float MicroBitCompassCalibrator::measureScore(Sample3D &c, Sample3D *data, int s
  * This algorithm should be called with no fewer than 12 points, but testing has indicated >21 points provides
  * a more robust calculation.
  *
- * @return A calibration structure containing the a calculated centre point, the radius of the minimum
- * enclosing spere of points and a scaling factor for each axis that places those points as close as possible
- * to the surface of the containing sphere.
+ * @return A calibration structure containing the a calculated centre point, the radius of the
+ * sphere the points are scaled onto, and a scaling factor for each axis that places those
+ * points as close as possible to the surface of that sphere.
  */
 CompassCalibration MicroBitCompassCalibrator::calibrate(Sample3D *data, int samples)
 {
-    Sample3D centre = approximateCentre(data, samples);
-    return spherify(centre, data, samples);
-}
-/**
- * Calculates an independent scale factor for X,Y and Z axes that places the given data points on a bounding sphere
- *
- * @param centre A proviously calculated centre point of all data.
- * @param data An array of all data points
- * @param samples The number of samples in the 'data' array.
- *
- * @return A calibration structure containing the centre point provided, the radius of the minimum
- * enclosing spere of points and a scaling factor for each axis that places those points as close as possible
- * to the surface of the containing sphere.
- */
-CompassCalibration MicroBitCompassCalibrator::spherify(Sample3D centre, Sample3D *data, int samples)
-{
-    // First, determine the radius of the enclosing sphere from the given centre.
-    // n.b. this will likely be different to the radius from the centre of mass previously calculated.
-    // We use the same algorithm though.
-    CompassCalibration result;
-
-    float radius = 0;
-    float scaleX = 0.0;
-    float scaleY = 0.0;
-    float scaleZ = 0.0;
-
-    float scale = 0.0;
-    float weightX = 0.0;
-    float weightY = 0.0;
-    float weightZ = 0.0;
-
-    for (int i = 0; i < samples; i++)
-    {
-        int d = sqrt((float)centre.dSquared(data[i]));
-
-        if (d > radius)
-            radius = d;
-    }
+    MicroBitCompassFit fit;
 
-    // Now, for each data point, determine a scalar multiplier for the vector between the centre and that point that
-    // takes the point onto the surface of the enclosing sphere.
     for (int i = 0; i < samples; i++)
-    {
-        // Calculate the distance from this point to the centre of the sphere
-        float d = sqrt(centre.dSquared(data[i]));
-
-        // Now determine a scalar multiplier that, when applied to the vector to the centre,
-        // will place this point on the surface of the sphere.
-        float s = (radius / d) - 1;
-
-        scale = max(scale, s);
-
-        // next, determine the scale effect this has on each of our components.
-        float dx = (data[i].x - centre.x); 
-        float dy = (data[i].y - centre.y);
-        float dz = (data[i].z - centre.z);
-
-        weightX += s * fabsf(dx / d);
-        weightY += s * fabsf(dy / d);
-        weightZ += s * fabsf(dz / d);
-    }
+        fit.add(data[i]);
 
-    float wmag = sqrt((weightX * weightX) + (weightY * weightY) + (weightZ * weightZ));
-
-    scaleX = 1.0 + scale * (weightX / wmag);
-    scaleY = 1.0 + scale * (weightY / wmag);
-    scaleZ = 1.0 + scale * (weightZ / wmag);
-
-    result.scale.x = (int)(1024 * scaleX);
-    result.scale.y = (int)(1024 * scaleY);
-    result.scale.z = (int)(1024 * scaleZ);
-
-    result.centre.x = centre.x;
-    result.centre.y = centre.y;
-    result.centre.z = centre.z;
-
-    result.radius = radius;
-
-    return result;
+    return calibrate(fit);
 }
 
-/*
- * Performs an interative approximation (hill descent) algorithm to determine an
- * estimated centre point of a sphere upon which the given data points reside.
+/**
+ * Calculates the calibration from a least squares fit of samples to a sphere or ellipsoid.
+ *
+ * If the samples do not determine a fit, the centre of mass of the samples is used, unscaled, with a radius of zero.
  *
- * @param data an array containing sample points
- * @param samples the number of sample points in the 'data' array.
+ * @param fit The fit, with all samples added.
  *
- * @return the approximated centre point of the points in the 'data' array.
+ * @return A calibration structure containing the calculated centre point, the radius of the
+ * sphere the points are scaled onto, and a scaling factor for each axis that places those
+ * points as close as possible to the surface of that sphere.
  */
-Sample3D MicroBitCompassCalibrator::approximateCentre(Sample3D *data, int samples)
+CompassCalibration MicroBitCompassCalibrator::calibrate(MicroBitCompassFit &fit)
 {
-    Sample3D c,t;
-    Sample3D centre = { 0,0,0 };
-    Sample3D best = { 0,0,0 };
-
-    float score;
-
-    for (int i = 0; i < samples; i++)
-    {
-        centre.x += data[i].x;
-        centre.y += data[i].y;
-        centre.z += data[i].z;
-    }
-
-    // Calclulate a centre of mass for our input samples. We only use this for validation purposes.
-    centre.x = centre.x / samples;
-    centre.y = centre.y / samples;
-    centre.z = centre.z / samples;
-
-    // Start hill climb in the centre of mass.
-    c = centre;
-
-    // calculate the nearest and furthest point to us.
-    score = measureScore(c, data, samples);
+    CompassCalibration result;
 
-    // iteratively attempt to improve position...
-    while (1)
+    if (fit.fit(result, MICROBIT_COMPASS_CALIBRATION_SOFT_IRON) != DEVICE_OK)
     {
-        for (int x = -CALIBRATION_INCREMENT; x <= CALIBRATION_INCREMENT; x=x+CALIBRATION_INCREMENT)
-        {
-            for (int y = -CALIBRATION_INCREMENT; y <= CALIBRATION_INCREMENT; y=y+CALIBRATION_INCREMENT)
-            {
-                for (int z = -CALIBRATION_INCREMENT; z <= CALIBRATION_INCREMENT; z=z+CALIBRATION_INCREMENT)
-                {
-                    t = c;
-                    t.x += x;
-                    t.y += y;
-                    t.z += z;
-
-                    float s = measureScore(t, data, samples);
-                    if (s < score)
-                    {
-                        score = s;
-                        best = t;
-                    }
-                }
-            }
-        }
-
-        if (best.x == c.x && best.y == c.y && best.z == c.z)
-            break;
-
-        c = best;
+        result.centre = fit.getMean();
+        result.scale.x = result.scale.y = result.scale.z = 1024;
+        result.radius = 0;
     }
 
-    return c;
+    return result;
 }
 
 /**
@@ -316,7 +172,7 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
     MicroBitImage img(5,5);
     MicroBitImage smiley("0,255,0,255,0\n0,255,0,255,0\n0,0,0,0,0\n255,0,0,0,255\n0,255,255,255,0\n");
 
-    Sample3D data[PERIMETER_POINTS];
+    MicroBitCompassFit fit;
     uint8_t visited[PERIMETER_POINTS] = { 0 };
     uint8_t cursor_on = 0;
     uint8_t samples = 0;
@@ -396,8 +252,8 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
         {
             if (cursor.x == perimeter[i].x && cursor.y == perimeter[i].y && !(visited[i] == 1))
             {
-                // Record the sample data for later processing...
-                data[samples] = compass.getSample(RAW);
+                // Add the sample to the fit, so the calibration is ready as soon as the last pixel is visited.
+                fit.add(compass.getSample(RAW));
 
                 // Record that this pixel has been visited.
                 visited[i] = 1;
@@ -409,7 +265,7 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
         remaining_scroll_time-=TIME_STEP;
     }
 
-    CompassCalibration cal = calibrate(data, samples); 
+    CompassCalibration cal = calibrate(fit);
     compass.setCalibration(cal);
 
     if(this->storage)
@@ -424,3 +280,120 @@ void MicroBitCompassCalibrator::calibrateUX(MicroBitEvent)
     // Retore the display brightness to the level it was at before this function was called.
     display.setBrightness(displayBrightness);
 }
+
+/**
+ * Starts refining the hard iron calibration of the compass in the background.
+ *
+ * Samples are collected from the compass as it is used, and fitted to a sphere once MICROBIT_COMPASS_BACKGROUND_SAMPLES
+ * are collected. The centre of the fit replaces that of the compass calibration (keeping any soft iron scale) if the
+ * samples cover at least a radius on each axis, and their residual error is within MICROBIT_COMPASS_BACKGROUND_MAXIMUM_ERROR.
+ * Otherwise they are discarded, and collection starts again. Background updates are not written to storage.
+ *
+ * Each sample costs a few dozen multiplications, and each fit a small linear solve, so there are no CPU spikes.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the fit could not be allocated.
+ */
+int MicroBitCompassCalibrator::startBackgroundCalibration()
+{
+    if (background)
+        return DEVICE_OK;
+
+    background = new MicroBitCompassFit();
+
+    if (background == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE, this, &MicroBitCompassCalibrator::onBackgroundSample, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops refining the calibration of the compass in the background, discarding any samples collected.
+ *
+ * @return DEVICE_OK.
+ */
+int MicroBitCompassCalibrator::stopBackgroundCalibration()
+{
+    if (background == NULL)
+        return DEVICE_OK;
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(MICROBIT_ID_COMPASS, MICROBIT_COMPASS_EVT_DATA_UPDATE, this, &MicroBitCompassCalibrator::onBackgroundSample);
+
+    delete background;
+    background = NULL;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if the calibration of the compass is being refined in the background.
+ *
+ * @return true if background calibration is running, false otherwise.
+ */
+bool MicroBitCompassCalibrator::isBackgroundCalibrating()
+{
+    return background != NULL;
+}
+
+/**
+ * Adds each sufficiently distinct compass sample to the background fit, and applies the fit
+ * to the compass once enough samples are collected, if it is good enough.
+ */
+void MicroBitCompassCalibrator::onBackgroundSample(MicroBitEvent)
+{
+    // Leave the compass alone while it is being calibrated interactively.
+    if (background == NULL || compass.isCalibrating())
+        return;
+
+    Sample3D s = compass.getSample(RAW);
+
+    if (background->getSampleCount() == 0)
+    {
+        backgroundMin = s;
+        backgroundMax = s;
+    }
+    else
+    {
+        if (backgroundLast.dSquared(s) < (float) MICROBIT_COMPASS_BACKGROUND_SPACING * MICROBIT_COMPASS_BACKGROUND_SPACING)
+            return;
+
+        backgroundMin.x = min(backgroundMin.x, s.x);
+        backgroundMin.y = min(backgroundMin.y, s.y);
+        backgroundMin.z = min(backgroundMin.z, s.z);
+        backgroundMax.x = max(backgroundMax.x, s.x);
+        backgroundMax.y = max(backgroundMax.y, s.y);
+        backgroundMax.z = max(backgroundMax.z, s.z);
+    }
+
+    background->add(s);
+    backgroundLast = s;
+
+    if (background->getSampleCount() < MICROBIT_COMPASS_BACKGROUND_SAMPLES)
+        return;
+
+    // Only the hard iron offset is refined, as a sphere is far better determined by a partial set of orientations
+    // than an ellipsoid. The fit is trusted if it is tight, and the samples span at least a radius on every axis.
+    CompassCalibration fit;
+
+    if (background->fit(fit, false) == DEVICE_OK && background->getError() <= MICROBIT_COMPASS_BACKGROUND_MAXIMUM_ERROR &&
+        backgroundMax.x - backgroundMin.x >= fit.radius &&
+        backgroundMax.y - backgroundMin.y >= fit.radius &&
+        backgroundMax.z - backgroundMin.z >= fit.radius)
+    {
+        if (compass.isCalibrated())
+        {
+            CompassCalibration cal = compass.getCalibration();
+            cal.centre = fit.centre;
+            compass.setCalibration(cal);
+        }
+        else
+        {
+            compass.setCalibration(fit);
+        }
+    }
+
+    background->reset();
+}
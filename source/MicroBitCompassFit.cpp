@@ -0,0 +1,336 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitConfig.h"
+#include "MicroBitCompassFit.h"
+#include "ErrorNo.h"
+#include <math.h>
+#include <string.h>
+
+using namespace codal;
+
+#define COMPASS_FIT_MAXIMUM_TERMS       6           // The largest number of terms fitted with (the ellipsoid).
+#define COMPASS_FIT_PIVOT_THRESHOLD     1.0e-9      // The smallest pivot of the normalised normal equations that is considered non-singular.
+
+/**
+ * Constructor.
+ *
+ * Create an empty fit.
+ */
+MicroBitCompassFit::MicroBitCompassFit()
+{
+    reset();
+}
+
+/**
+ * Discards all accumulated samples.
+ */
+void MicroBitCompassFit::reset()
+{
+    count = 0;
+    error = 0.0f;
+    origin.x = origin.y = origin.z = 0;
+
+    memset(sums, 0, sizeof(sums));
+}
+
+/**
+ * Adds a raw (uncalibrated) compass sample to the fit.
+ *
+ * @param sample The sample to add.
+ */
+void MicroBitCompassFit::add(Sample3D sample)
+{
+    // The offset of the compass is usually large compared to the variation between samples, so measuring all samples
+    // relative to the first keeps the sums of higher powers well conditioned.
+    if (count == 0)
+        origin = sample;
+
+    double x = sample.x - origin.x;
+    double y = sample.y - origin.y;
+    double z = sample.z - origin.z;
+
+    double t[MICROBIT_COMPASS_FIT_TERMS] = { x*x, y*y, z*z, x, y, z, 1.0 };
+
+    for (int i = 0; i < MICROBIT_COMPASS_FIT_TERMS; i++)
+        for (int j = i; j < MICROBIT_COMPASS_FIT_TERMS; j++)
+            sums[i][j] += t[i] * t[j];
+
+    count++;
+}
+
+/**
+ * Determines how many samples have been added since the fit was last reset.
+ *
+ * @return The number of samples.
+ */
+int MicroBitCompassFit::getSampleCount()
+{
+    return count;
+}
+
+/**
+ * Determines the centre of mass of the samples added since the fit was last reset.
+ *
+ * @return The mean of the samples.
+ */
+Sample3D MicroBitCompassFit::getMean()
+{
+    Sample3D mean = origin;
+
+    if (count > 0)
+    {
+        mean.x += (int) lround(sums[3][6] / count);
+        mean.y += (int) lround(sums[4][6] / count);
+        mean.z += (int) lround(sums[5][6] / count);
+    }
+
+    return mean;
+}
+
+/**
+ * Reads the sum of the products of two terms over all samples.
+ */
+double MicroBitCompassFit::sum(int i, int j)
+{
+    return i <= j ? sums[i][j] : sums[j][i];
+}
+
+/**
+ * Solves the normal equations for a linear least squares fit of one combination of terms to others.
+ *
+ * @param terms The indexes of the terms to fit with.
+ * @param n The number of terms in 'terms'.
+ * @param weights The weight of each term in the combination being fitted.
+ * @param coefficients The fitted coefficient of each of the n terms.
+ *
+ * @return The residual sum of squares of the fit, or a negative value if the samples do not determine a fit.
+ */
+double MicroBitCompassFit::solve(const int *terms, int n, const double *weights, double *coefficients)
+{
+    double a[COMPASS_FIT_MAXIMUM_TERMS][COMPASS_FIT_MAXIMUM_TERMS + 1];
+    double norm[COMPASS_FIT_MAXIMUM_TERMS];
+    double target = 0.0;
+
+    if (count <= n)
+        return -1.0;
+
+    // Build the normal equations, scaled so that the diagonal is all ones, as the terms differ widely in magnitude.
+    for (int i = 0; i < n; i++)
+    {
+        double d = sum(terms[i], terms[i]);
+
+        if (d <= 0.0)
+            return -1.0;
+
+        norm[i] = 1.0 / sqrt(d);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        double b = 0.0;
+
+        for (int j = 0; j < n; j++)
+            a[i][j] = sum(terms[i], terms[j]) * norm[i] * norm[j];
+
+        for (int k = 0; k < MICROBIT_COMPASS_FIT_TERMS; k++)
+            if (weights[k] != 0.0)
+                b += weights[k] * sum(terms[i], k);
+
+        a[i][n] = b * norm[i];
+    }
+
+    for (int k = 0; k < MICROBIT_COMPASS_FIT_TERMS; k++)
+        for (int l = 0; l < MICROBIT_COMPASS_FIT_TERMS; l++)
+            if (weights[k] != 0.0 && weights[l] != 0.0)
+                target += weights[k] * weights[l] * sum(k, l);
+
+    // Gaussian elimination, with partial pivoting.
+    for (int i = 0; i < n; i++)
+    {
+        int pivot = i;
+
+        for (int r = i + 1; r < n; r++)
+            if (fabs(a[r][i]) > fabs(a[pivot][i]))
+                pivot = r;
+
+        if (fabs(a[pivot][i]) < COMPASS_FIT_PIVOT_THRESHOLD)
+            return -1.0;
+
+        if (pivot != i)
+        {
+            for (int c = i; c <= n; c++)
+            {
+                double t = a[i][c];
+                a[i][c] = a[pivot][c];
+                a[pivot][c] = t;
+            }
+        }
+
+        for (int r = i + 1; r < n; r++)
+        {
+            double f = a[r][i] / a[i][i];
+
+            for (int c = i; c <= n; c++)
+                a[r][c] -= f * a[i][c];
+        }
+    }
+
+    // Back substitution, undoing the scaling. The residual follows from the normal equations as target - coefficients.b
+    double explained = 0.0;
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        double v = a[i][n];
+
+        for (int c = i + 1; c < n; c++)
+            v -= a[i][c] * a[c][n];
+
+        a[i][n] = v / a[i][i];
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        double b = 0.0;
+
+        for (int k = 0; k < MICROBIT_COMPASS_FIT_TERMS; k++)
+            if (weights[k] != 0.0)
+                b += weights[k] * sum(terms[i], k);
+
+        coefficients[i] = a[i][n] * norm[i];
+        explained += coefficients[i] * b;
+    }
+
+    double residual = target - explained;
+
+    return residual > 0.0 ? residual : 0.0;
+}
+
+/**
+ * Fits the samples added so far to a sphere or an axis aligned ellipsoid.
+ *
+ * If an ellipsoid is requested but the samples do not determine one (for example if they all lie in a plane,
+ * or do not describe a closed surface), a sphere is fitted instead.
+ *
+ * @param calibration The calibration to store the result in: the centre of the fit, the radius of the sphere
+ *        the samples are scaled onto, and the scale factor for each axis (in 1/1024ths), which is 1024 for a sphere.
+ * @param ellipsoid true to fit an ellipsoid, correcting for soft iron distortion, or false to fit a sphere.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the samples do not determine a sphere.
+ */
+int MicroBitCompassFit::fit(CompassCalibration &calibration, bool ellipsoid)
+{
+    double c[COMPASS_FIT_MAXIMUM_TERMS];
+    double cx, cy, cz, rx, ry, rz, h;
+    double rss = -1.0;
+
+    if (ellipsoid)
+    {
+        // Fit x^2 = b0.y^2 + b1.z^2 + b2.x + b3.y + b4.z + b5, which is the axis aligned ellipsoid
+        // (x - cx)^2 + B(y - cy)^2 + C(z - cz)^2 = h, where B = -b0 and C = -b1.
+        static const int terms[] = { 1, 2, 3, 4, 5, 6 };
+        static const double weights[] = { 1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+        rss = solve(terms, 6, weights, c);
+
+        if (rss >= 0.0 && c[0] < 0.0 && c[1] < 0.0)
+        {
+            double b = -c[0];
+            double cc = -c[1];
+
+            cx = c[2] / 2.0;
+            cy = c[3] / (2.0 * b);
+            cz = c[4] / (2.0 * cc);
+            h = c[5] + cx*cx + b*cy*cy + cc*cz*cz;
+
+            if (h > 0.0)
+            {
+                rx = sqrt(h);
+                ry = sqrt(h / b);
+                rz = sqrt(h / cc);
+            }
+            else
+            {
+                rss = -1.0;
+            }
+        }
+        else
+        {
+            rss = -1.0;
+        }
+    }
+
+    if (rss < 0.0)
+    {
+        // Fit x^2 + y^2 + z^2 = b0.x + b1.y + b2.z + b3, which is the sphere |p - c|^2 = h.
+        static const int terms[] = { 3, 4, 5, 6 };
+        static const double weights[] = { 1.0, 1.0, 1.0, 0.0, 0.0, 0.0, 0.0 };
+
+        rss = solve(terms, 4, weights, c);
+
+        if (rss < 0.0)
+            return DEVICE_INVALID_PARAMETER;
+
+        cx = c[0] / 2.0;
+        cy = c[1] / 2.0;
+        cz = c[2] / 2.0;
+        h = c[3] + cx*cx + cy*cy + cz*cz;
+
+        if (h <= 0.0)
+            return DEVICE_INVALID_PARAMETER;
+
+        rx = ry = rz = sqrt(h);
+    }
+
+    // Scale each axis onto a sphere of the longest radius, so that no axis loses resolution.
+    double radius = rx > ry ? rx : ry;
+
+    if (rz > radius)
+        radius = rz;
+
+    calibration.centre.x = origin.x + (int) lround(cx);
+    calibration.centre.y = origin.y + (int) lround(cy);
+    calibration.centre.z = origin.z + (int) lround(cz);
+
+    calibration.scale.x = (int) lround(1024.0 * radius / rx);
+    calibration.scale.y = (int) lround(1024.0 * radius / ry);
+    calibration.scale.z = (int) lround(1024.0 * radius / rz);
+
+    calibration.radius = (int) radius;
+
+    // Each residual is approximately 2h times the radial deviation of the sample, as a fraction of the radius.
+    error = (float) (sqrt(rss / count) / (2.0 * h));
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the residual error of the last successful fit.
+ *
+ * @return The root mean square distance of the samples from the fitted surface, as a fraction of its radius.
+ */
+float MicroBitCompassFit::getError()
+{
+    return error;
+}
@@ -28,7 +28,76 @@ DEALINGS IN THE SOFTWARE.
 void 
 codal::fiber_add_idle_component(codal::CodalComponent *c)
 {
-    c->status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    codal::component_status_set(c, DEVICE_COMPONENT_STATUS_IDLE_TICK);
+}
+
+/**
+  * Marks a component as having work pending, so that its idleCallback() is invoked on the next idle pass.
+  * May be called from interrupt context, or from a fiber.
+  *
+  * @param c The component to wake.
+  */
+void
+codal::fiber_wake_idle_component(codal::CodalComponent *c)
+{
+    codal::component_status_set(c, DEVICE_COMPONENT_STATUS_IDLE_TICK);
+}
+
+/**
+  * Marks a component as having no further work pending, so that the idle thread stops invoking its idleCallback().
+  * Typically called from within idleCallback() before the pending work is processed, so that work
+  * which arrives while processing wakes the component again.
+  *
+  * @param c The component to put back to sleep.
+  *
+  * @param pending Status bits that indicate work is still outstanding. If any of these are set, the component
+  *        is left runnable.
+  */
+void
+codal::fiber_idle_component_done(codal::CodalComponent *c, uint16_t pending)
+{
+    target_disable_irq();
+
+    if (!(c->status & pending))
+        c->status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    target_enable_irq();
+}
+
+/**
+  * Sets status bits on a component as a single atomic read-modify-write.
+  *
+  * Use this (rather than status |= ...) on any component whose status is also written from interrupt context,
+  * such as through fiber_wake_idle_component(), or the interrupt's update may be lost.
+  *
+  * @param c The component to update.
+  *
+  * @param bits The status bits to set.
+  */
+void
+codal::component_status_set(codal::CodalComponent *c, uint16_t bits)
+{
+    target_disable_irq();
+    c->status |= bits;
+    target_enable_irq();
+}
+
+/**
+  * Clears status bits on a component as a single atomic read-modify-write.
+  *
+  * Use this (rather than status &= ~...) on any component whose status is also written from interrupt context,
+  * such as through fiber_wake_idle_component(), or the interrupt's update may be lost.
+  *
+  * @param c The component to update.
+  *
+  * @param bits The status bits to clear.
+  */
+void
+codal::component_status_clear(codal::CodalComponent *c, uint16_t bits)
+{
+    target_disable_irq();
+    c->status &= ~bits;
+    target_enable_irq();
 }
 
 uint32_t codal::htonl(uint32_t v)
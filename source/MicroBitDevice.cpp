@@ -24,6 +24,10 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitConfig.h"
 #include "MicroBitDevice.h"
+#include "MicroBitMemoryConsumer.h"
+#include "MicroBitEntropy.h"
+#include "CodalDmesg.h"
+#include "Timer.h"
 #include "nrf.h"
 #include "hal/nrf_gpio.h"
 
@@ -38,6 +42,16 @@ static char friendly_name[MICROBIT_NAME_LENGTH+1];
 // internal reference to any created instance of the class - used purely for convenience functions.
 MicroBitDevice *microbit_device_instance = NULL;
 
+/**
+  * Reseeds the pseudo random number generator with fresh hardware entropy, requested by MicroBitDevice::seedRandom().
+  * Called from interrupt context. The seed is a single word, so is replaced atomically.
+  */
+static void onEntropy(uint32_t seed)
+{
+    if (microbit_device_instance)
+        microbit_device_instance->seedRandom(seed);
+}
+
 /**
   * Constructor.
   */
@@ -59,39 +73,33 @@ void MicroBitDevice::schedulerIdle()
 /**
   * Seed the pseudo random number generator using the hardware random number generator.
   *
+  * Never waits on the generator. If MicroBitEntropy has not yet gathered enough entropy, a provisional seed
+  * derived from the serial number and the system timer is used, and replaced by a hardware seed within
+  * a millisecond or so. While BLE is running, the seed is drawn from the SoftDevice.
+  *
   * @code
   * uBit.seedRandom();
   * @endcode
   */
 void MicroBitDevice::seedRandom()
 {
-    uint32_t r = 0xBBC5EED;
+    uint32_t r;
 
-    if(!ble_running())
+    // Use any entropy already gathered. Otherwise, seed provisionally so that we don't wait on the RNG, and reseed
+    // from its interrupt as soon as fresh entropy arrives. The serial number keeps provisional seeds distinct between devices.
+    if (MicroBitEntropy::available() >= (int) sizeof(r) && MicroBitEntropy::read((uint8_t *) &r, sizeof(r)) == sizeof(r))
     {
-        // Start the Random number generator. No need to leave it running... I hope. :-)
-        NRF_RNG->TASKS_START = 1;
-
-        for(int i = 0; i < 4; i++)
-        {
-            // Clear the VALRDY EVENT
-            NRF_RNG->EVENTS_VALRDY = 0;
-
-            // Wait for a number ot be generated.
-            while(NRF_RNG->EVENTS_VALRDY == 0);
-
-            r = (r << 8) | ((int) NRF_RNG->VALUE);
-        }
-
-        // Disable the generator to save power.
-        NRF_RNG->TASKS_STOP = 1;
+        seedRandom(r);
+        return;
     }
 
-    seedRandom(r);
+    seedRandom(0xBBC5EED ^ microbit_serial_number() ^ (uint32_t) system_timer_current_time_us());
+    MicroBitEntropy::requestSeed(onEntropy);
 }
 
 /**
   * Seed the pseudo random number generator using the given value.
+  * Cancels any hardware reseed still outstanding from seedRandom(), so the sequence is reproducible.
   *
   * @param seed The 32-bit value to seed the generator with.
   *
@@ -101,10 +109,60 @@ void MicroBitDevice::seedRandom()
   */
 int MicroBitDevice::seedRandom(uint32_t seed)
 {
+    // An explicit seed must not be replaced by a hardware reseed that was still outstanding.
+    MicroBitEntropy::cancelSeed(onEntropy);
+
     CodalDevice::seedRandom(seed);
     return DEVICE_OK;
 }
 
+/**
+  * Reads the CPU time spent within a trace point, since the running totals were last reset.
+  * Trace points cover interrupt handlers and other hot paths, and are only recorded if CONFIG_MICROBIT_TRACE is enabled.
+  *
+  * @param point The trace point, such as MICROBIT_TRACE_RADIO_IRQ.
+  *
+  * @return The number of times the trace point was entered, and the total and greatest number of CPU cycles spent within it.
+  */
+MicroBitTraceSummary MicroBitDevice::getCpuUsage(uint16_t point)
+{
+    return MicroBitTrace::getTotal(point);
+}
+
+/**
+  * Reads the heap memory committed by a component.
+  *
+  * @param name The name of the component, as reported by MicroBitMemoryConsumer::getMemoryName(),
+  *        or NULL for the total committed by all components.
+  *
+  * @return The number of bytes currently allocated, or zero if there is no such component.
+  */
+uint32_t MicroBitDevice::getHeapUsage(const char *name)
+{
+    if (name == NULL)
+        return MicroBitMemoryConsumer::getTotalUsage();
+
+    MicroBitMemoryConsumer *c = MicroBitMemoryConsumer::find(name);
+
+    return c ? c->getMemoryUsage() : 0;
+}
+
+/**
+  * Writes the CPU time spent within each trace point, and the heap memory committed by each component, to the debug log.
+  */
+void MicroBitDevice::printUsage()
+{
+    for (int point = 0; point < MICROBIT_TRACE_MAX_POINTS; point++)
+    {
+        MicroBitTraceSummary s = MicroBitTrace::getTotal(point);
+
+        if (s.count)
+            DMESG("CPU: point %d, %d calls, %d cycles (max %d)", point, (int) s.count, (int) s.total, (int) s.max);
+    }
+
+    MicroBitMemoryConsumer::printMemoryUsage();
+}
+
 
 int microbit_random(int max)
 {
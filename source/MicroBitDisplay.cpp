@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
  */
 #include "MicroBitDisplay.h"
 #include "NRFLowLevelTimer.h"
+#include "BitmapFont.h"
 
 using namespace codal;
 
@@ -44,6 +45,107 @@ MicroBitDisplay::MicroBitDisplay(const MatrixMap &map, uint16_t id) : NRF52LEDMa
 {
 }
 
+/**
+ * Renders the given text into the scroll cache, unless it is already held there.
+ *
+ * @param s The text to render.
+ *
+ * @return true if the scroll cache holds the text, false if it is too long to be cached.
+ */
+bool MicroBitDisplay::cacheScrollText(ManagedString s)
+{
+    if (s.length() > MICROBIT_DISPLAY_SCROLL_CACHE_LENGTH)
+        return false;
+
+    if (scrollStrip.getWidth() > 0 && s == scrollText)
+        return true;
+
+    // Lay out each character with a blank column between them, followed by a blank display width,
+    // so that the last character scrolls completely off the display before the animation completes.
+    int pitch = BITMAP_FONT_WIDTH + 1;
+    Image strip(s.length() * pitch + NRF52LEDMatrix::width, BITMAP_FONT_HEIGHT);
+
+    for (int i = 0; i < s.length(); i++)
+        strip.print(s.charAt(i), i * pitch, 0);
+
+    scrollStrip = strip;
+    scrollText = s;
+
+    return true;
+}
+
+/**
+ * Scrolls the given string across the display, from right to left, without blocking.
+ *
+ * The whole string is rendered once into a cached strip, so each step of the scroll is a copy of the
+ * visible window, and scrolling the same string again needs no rendering at all.
+ *
+ * @param s The string to display.
+ * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+ *
+ * @return DEVICE_OK, DEVICE_BUSY if the display is already in use, or DEVICE_INVALID_PARAMETER if delay is not positive.
+ */
+int MicroBitDisplay::scrollAsync(ManagedString s, int delay)
+{
+    if (delay <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (s.length() == 0 || !cacheScrollText(s))
+        return AnimatedDisplay::scrollAsync(s, delay);
+
+    return animateAsync(scrollStrip, delay, -1);
+}
+
+/**
+ * Scrolls the given number across the display, from right to left, without blocking.
+ *
+ * @param number The number to display.
+ * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+ *
+ * @return DEVICE_OK, DEVICE_BUSY if the display is already in use, or DEVICE_INVALID_PARAMETER if delay is not positive.
+ */
+int MicroBitDisplay::scrollAsync(int number, int delay)
+{
+    return scrollAsync(ManagedString(number), delay);
+}
+
+/**
+ * Scrolls the given string across the display, from right to left.
+ * Blocks the calling thread until all text has been displayed.
+ *
+ * The whole string is rendered once into a cached strip, so each step of the scroll is a copy of the
+ * visible window, and scrolling the same string again needs no rendering at all.
+ *
+ * @param s The string to display.
+ * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+ *
+ * @return DEVICE_OK, DEVICE_CANCELLED or DEVICE_INVALID_PARAMETER.
+ */
+int MicroBitDisplay::scroll(ManagedString s, int delay)
+{
+    if (delay <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (s.length() == 0 || !cacheScrollText(s))
+        return AnimatedDisplay::scroll(s, delay);
+
+    return animate(scrollStrip, delay, -1);
+}
+
+/**
+ * Scrolls the given number across the display, from right to left.
+ * Blocks the calling thread until all text has been displayed.
+ *
+ * @param number The number to display.
+ * @param delay The time to delay between each update of the display, in milliseconds. Defaults to DISPLAY_DEFAULT_SCROLL_SPEED.
+ *
+ * @return DEVICE_OK, DEVICE_CANCELLED or DEVICE_INVALID_PARAMETER.
+ */
+int MicroBitDisplay::scroll(int number, int delay)
+{
+    return scroll(ManagedString(number), delay);
+}
+
 /**
  * Destructor.
  */
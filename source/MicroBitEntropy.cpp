@@ -0,0 +1,266 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitEntropy.h"
+#include "MicroBitDevice.h"
+#include "codal_target_hal.h"
+#include "nrf.h"
+
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_soc.h"
+#endif
+
+using namespace codal;
+
+static uint8_t entropyPool[MICROBIT_ENTROPY_POOL_SIZE];
+static volatile uint8_t entropyHead = 0;                    // Index of the oldest byte in the pool.
+static volatile uint8_t entropyCount = 0;                   // Number of bytes held in the pool.
+
+static void (*volatile seedHandler)(uint32_t) = NULL;       // Function waiting on a seed, if any.
+static uint32_t seedValue = 0;                              // The seed gathered so far.
+static uint8_t seedBytes = 0;                               // The number of bytes of seedValue gathered.
+
+/**
+ * Completes a seed request from the SoftDevice's entropy pool, if it holds enough entropy.
+ */
+static void seedFromSoftDevice()
+{
+#ifdef SOFTDEVICE_PRESENT
+    uint8_t available = 0;
+    uint32_t seed;
+
+    sd_rand_application_bytes_available_get(&available);
+
+    if (seedHandler && available >= sizeof(seed) && sd_rand_application_vector_get((uint8_t *) &seed, sizeof(seed)) == NRF_SUCCESS)
+    {
+        void (*handler)(uint32_t) = seedHandler;
+
+        seedHandler = NULL;
+        handler(seed);
+    }
+#endif
+}
+
+/**
+ * Starts filling the pool in the background, if it is not already full.
+ * Also completes any seed requested with requestSeed() that is waiting on the SoftDevice.
+ */
+void MicroBitEntropy::start()
+{
+    if (ble_running())
+    {
+        seedFromSoftDevice();
+        return;
+    }
+
+    if (entropyCount == MICROBIT_ENTROPY_POOL_SIZE && seedHandler == NULL)
+        return;
+
+    // Enable bias correction, which removes any skew towards ones or zeros at the cost of a slower rate.
+    NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;
+    NRF_RNG->EVENTS_VALRDY = 0;
+    NRF_RNG->INTENSET = RNG_INTENSET_VALRDY_Msk;
+
+    NVIC_SetPriority(RNG_IRQn, MICROBIT_ENTROPY_IRQ_PRIORITY);
+    NVIC_ClearPendingIRQ(RNG_IRQn);
+    NVIC_EnableIRQ(RNG_IRQn);
+
+    NRF_RNG->TASKS_START = 1;
+}
+
+/**
+ * Stops the RNG and disables its interrupt, keeping any entropy already gathered.
+ * This must be called before the SoftDevice is enabled, as the RNG is then reserved for its use.
+ */
+void MicroBitEntropy::stop()
+{
+    if (ble_running())
+        return;
+
+    NRF_RNG->TASKS_STOP = 1;
+    NRF_RNG->INTENCLR = RNG_INTENCLR_VALRDY_Msk;
+    NRF_RNG->EVENTS_VALRDY = 0;
+
+    NVIC_DisableIRQ(RNG_IRQn);
+    NVIC_ClearPendingIRQ(RNG_IRQn);
+
+    // Any part of a seed gathered so far is discarded, as the rest may come from a different source.
+    seedValue = 0;
+    seedBytes = 0;
+}
+
+/**
+ * Determines the number of bytes of entropy that can be read without waiting.
+ *
+ * @return The number of bytes available.
+ */
+int MicroBitEntropy::available()
+{
+#ifdef SOFTDEVICE_PRESENT
+    if (ble_running())
+    {
+        uint8_t available = 0;
+        sd_rand_application_bytes_available_get(&available);
+        return available;
+    }
+#endif
+
+    return entropyCount;
+}
+
+/**
+ * Removes entropy from the pool. Never waits for more to be generated.
+ *
+ * @param buffer The memory to copy the entropy into.
+ *
+ * @param length The number of bytes wanted.
+ *
+ * @return The number of bytes copied into buffer, which may be less than length, or zero if no entropy
+ * is available at present. The pool then starts to refill.
+ */
+int MicroBitEntropy::read(uint8_t *buffer, int length)
+{
+    int count = 0;
+
+    if (buffer == NULL || length <= 0)
+        return 0;
+
+#ifdef SOFTDEVICE_PRESENT
+    if (ble_running())
+    {
+        uint8_t available = 0;
+        sd_rand_application_bytes_available_get(&available);
+
+        count = length < available ? length : available;
+
+        if (count && sd_rand_application_vector_get(buffer, count) != NRF_SUCCESS)
+            count = 0;
+
+        return count;
+    }
+#endif
+
+    target_disable_irq();
+
+    while (count < length && entropyCount)
+    {
+        buffer[count++] = entropyPool[entropyHead];
+        entropyHead = (entropyHead + 1) % MICROBIT_ENTROPY_POOL_SIZE;
+        entropyCount--;
+    }
+
+    target_enable_irq();
+
+    start();
+
+    return count;
+}
+
+/**
+ * Requests 32 bits of fresh entropy, to be passed to the given function as soon as they are generated.
+ * This takes around half a millisecond after the RNG starts, and the function is called from interrupt
+ * context. Any previous request that is still waiting is replaced.
+ *
+ * @param handler The function to call with the entropy.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if handler is NULL.
+ */
+int MicroBitEntropy::requestSeed(void (*handler)(uint32_t seed))
+{
+    if (handler == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    target_disable_irq();
+    seedHandler = handler;
+    seedValue = 0;
+    seedBytes = 0;
+    target_enable_irq();
+
+    start();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Cancels a seed requested with requestSeed(), if it is still waiting and was made with the given function.
+ *
+ * @param handler The function passed to requestSeed().
+ */
+void MicroBitEntropy::cancelSeed(void (*handler)(uint32_t seed))
+{
+    target_disable_irq();
+
+    if (seedHandler == handler)
+    {
+        seedHandler = NULL;
+        seedValue = 0;
+        seedBytes = 0;
+    }
+
+    target_enable_irq();
+}
+
+/**
+ * Handles the RNG interrupt, moving the value generated into the pool or a pending seed request.
+ *
+ * @note for internal use only.
+ */
+void MicroBitEntropy::onValue(uint8_t value)
+{
+    // A waiting seed request takes priority over the pool. Its bytes are only ever used once.
+    if (seedHandler)
+    {
+        seedValue = (seedValue << 8) | value;
+
+        if (++seedBytes == sizeof(seedValue))
+        {
+            void (*handler)(uint32_t) = seedHandler;
+
+            seedHandler = NULL;
+            seedBytes = 0;
+            handler(seedValue);
+        }
+
+        return;
+    }
+
+    if (entropyCount < MICROBIT_ENTROPY_POOL_SIZE)
+    {
+        entropyPool[(entropyHead + entropyCount) % MICROBIT_ENTROPY_POOL_SIZE] = value;
+        entropyCount++;
+    }
+
+    // Stop generating once the pool is full, as the RNG draws current while it runs.
+    if (entropyCount == MICROBIT_ENTROPY_POOL_SIZE)
+        NRF_RNG->TASKS_STOP = 1;
+}
+
+extern "C" void RNG_IRQHandler(void)
+{
+    if (NRF_RNG->EVENTS_VALRDY)
+    {
+        NRF_RNG->EVENTS_VALRDY = 0;
+        MicroBitEntropy::onValue((uint8_t) NRF_RNG->VALUE);
+    }
+}
@@ -24,59 +24,121 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFlash.h"
 #include "MicroBitStorage.h"        
 #include "MicroBitCompat.h"
+#include "MicroBitDevice.h"
 #include "ErrorNo.h"
-
-static uint32_t *defaultScratchPage = (uint32_t *)MICROBIT_DEFAULT_SCRATCH_PAGE;
+#include "CodalFiber.h"
+#include <stddef.h>
 
 MicroBitFileSystem* MicroBitFileSystem::defaultFileSystem = NULL;
 
 /**
   * Allocate a free logical block.
-  * This is chosen at random from the blocks available, to even out the wear on the physical device.
+  * A round robin algorithm is used to even out the wear on the physical device.
+  * Free blocks are found using the free block map, rather than by walking the file table.
   * @return a valid, unused block address on success, or zero if no space is available.
   */
 uint16_t MicroBitFileSystem::getFreeBlock()
 {
-    // Walk the File Table and allocate the first free block - starting immediately after the last block allocated,
-    // and wrapping around the filesystem space if we reach the end.
-    uint16_t block;
-    uint16_t deletedBlock = 0;
+    if (freeBlockMap == NULL && buildFreeBlockMap() != MICROBIT_OK)
+        return 0;
+
+    // If no UNUSED blocks are available, try to recycle those marked as DELETED.
+    // Better to do this in bulk, rather than on a block by block basis to improve efficiency.
+    if (freeBlockCount == 0)
+    {
+        // If no blocks are available - either UNUSED or marked as DELETED, then we're out of space and there's nothing we can do.
+        if (deletedBlockCount == 0)
+            return 0;
+
+        // n.b. this also rebuilds the free block map.
+        recycleFileTable();
+    }
+
+    // Search the map for the first free block, starting immediately after the last block allocated,
+    // and wrapping around the filesystem space if we reach the end. The first word is revisited at the end,
+    // to pick up any free blocks before our starting point.
+    int words = (fileSystemSize + 31) / 32;
+    uint16_t block = (lastBlockAllocated + 1) % fileSystemSize;
+    int word = block / 32;
+    uint32_t bits = freeBlockMap[word] & (0xFFFFFFFF << (block % 32));
 
-    for (block = (lastBlockAllocated + 1) % fileSystemSize; block != lastBlockAllocated; block++)
+    for (int i = 0; i <= words; i++)
     {
-        if (fileSystemTable[block] == MBFS_UNUSED)
+        if (bits)
         {
+            // Record the block we just allocated, so we can round-robin around blocks for load balancing.
+            block = word * 32 + __builtin_ctz(bits);
             lastBlockAllocated = block;
             return block;
         }
 
-        if (fileSystemTable[block] == MBFS_DELETED)
-            deletedBlock = block;
+        word = (word + 1) % words;
+        bits = freeBlockMap[word];
     }
 
-    // if no UNUSED blocks are available, try to recycle one marked as DELETED.
-    block = deletedBlock;
+    return 0;
+}
 
-    // If no blocks are available - either UNUSED or marked as DELETED, then we're out of space and there's nothing we can do.
-    if (block)
+/**
+  * Build the free block map and counts from the file table, allocating the map if necessary.
+  * Used when the map is first needed, and when the file table is recycled in bulk.
+  *
+  * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the map could not be allocated.
+  */
+int MicroBitFileSystem::buildFreeBlockMap()
+{
+    if (freeBlockMap == NULL)
     {
-        // recycle the FileTable, such that we can mark all previously deleted blocks as re-usable.
-        // Better to do this in bulk, rather than on a block by block basis to improve efficiency. 
-        recycleFileTable();
+        freeBlockMap = (uint32_t *) malloc(((fileSystemSize + 31) / 32) * 4);
+        if (freeBlockMap == NULL)
+            return MICROBIT_NO_RESOURCES;
+    }
+
+    memset(freeBlockMap, 0, ((fileSystemSize + 31) / 32) * 4);
+    freeBlockCount = 0;
+    deletedBlockCount = 0;
+
+    // Read the file table a few entries at a time, and check two entries at once. Runs of UNUSED entries are the common case.
+    uint32_t table[16];
+
+    for (uint16_t block = 0; block < fileSystemSize; block += 2)
+    {
+        if (block % 32 == 0)
+            readFlash(fileSystemStart + block * 2, table, min(sizeof(table), (uint32_t)(fileSystemSize - block) * 2));
+
+        uint32_t entries = table[(block % 32) / 2];
+
+        if (entries == 0xFFFFFFFF && block + 1 < fileSystemSize)
+        {
+            freeBlockMap[block / 32] |= (3UL << (block % 32));
+            freeBlockCount += 2;
+            continue;
+        }
+
+        for (uint16_t b = block; b < block + 2 && b < fileSystemSize; b++)
+        {
+            uint16_t entry = ((uint16_t *)table)[b % 32];
 
-        // Record the block we just allocated, so we can round-robin around blocks for load balancing.
-        lastBlockAllocated = block;
+            if (entry == MBFS_UNUSED)
+            {
+                freeBlockMap[b / 32] |= (1UL << (b % 32));
+                freeBlockCount++;
+            }
+
+            if (entry == MBFS_DELETED)
+                deletedBlockCount++;
+        }
     }
 
-    return block;
+    return MICROBIT_OK;
 }
 
 /**
   * Allocates a free physical page of memory.
-  * This is chosen using a round robin algorithm, to even out the wear on the physical device.
-  * @return NULL on error, page address on success
+  * The least worn empty page is chosen, with ties broken in round robin order, to even out the wear on the physical device.
+  * @return page address on success
   */
-uint32_t* MicroBitFileSystem::getFreePage()
+uint32_t MicroBitFileSystem::getFreePage()
 {
     // Walk the file table, starting at the last allocated block, looking for an unused page.
     int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
@@ -84,6 +146,7 @@ uint32_t* MicroBitFileSystem::getFreePage()
     // get a handle on the next physical page.
     uint16_t currentPage = getBlockNumber(getPage(lastBlockAllocated));
     uint16_t page = (currentPage + blocksPerPage) % fileSystemSize;
+    uint16_t emptyPage = 0;
     uint16_t recyclablePage = 0;
 
     // Walk around the file table, looking for a free page.
@@ -107,45 +170,237 @@ uint32_t* MicroBitFileSystem::getFreePage()
             }
         }
 
-        // See if we found one...
-        if (empty)
+        // Without erase counts, take the first page we find... n.b. pages holding DELETED blocks may not be erased, so are only recycled below.
+        if (empty && !deleted && pageEraseCount == NULL)
         {
             lastBlockAllocated = page;
             return getBlock(page);
         }
 
-        // make note of the first unused but un-erased page we find (if any).
-        if (deleted && !recyclablePage)
+        // Otherwise, make note of the least worn empty page and the least worn unused but un-erased page we find (if any).
+        if (empty && !deleted && (!emptyPage || pageEraseCount[page / blocksPerPage] < pageEraseCount[emptyPage / blocksPerPage]))
+            emptyPage = page;
+
+        if (empty && deleted && (!recyclablePage || (pageEraseCount && pageEraseCount[page / blocksPerPage] < pageEraseCount[recyclablePage / blocksPerPage])))
             recyclablePage = page;
 
         page = (page + blocksPerPage) % fileSystemSize;
     }
 
+    if (emptyPage)
+    {
+        lastBlockAllocated = emptyPage;
+        return getBlock(emptyPage);
+    }
+
     // No empty pages are available, but we may be able to recycle one.
     if (recyclablePage)
     {
-        uint32_t *address = getBlock(recyclablePage);
-        flash.erase_page(address);
+        uint32_t address = getBlock(recyclablePage);
+        erasePage(address);
         return address;
     }
 
     // Nothing available at all. Use the default.
-    flash.erase_page(defaultScratchPage);
-    return defaultScratchPage;
+    erasePage(scratchPage);
+    return scratchPage;
+}
+
+/**
+  * Erase the given physical page, updating its erase count if it lies within the file system.
+  *
+  * @param page The address of the page to erase.
+  */
+void MicroBitFileSystem::erasePage(uint32_t page)
+{
+    if (cache)
+    {
+        // Discard any cached copy of the page, then erase the memory itself.
+        for (uint32_t b = 0; b < MICROBIT_CODEPAGESIZE; b += MBFS_BLOCK_SIZE)
+            cache->erase(page + b);
+
+        nvm->erase(page);
+    }
+    else
+        flash.erase_page((uint32_t *)page);
+
+    if (pageEraseCount && page >= fileSystemStart && page < getBlock(fileSystemSize))
+    {
+        uint16_t *count = &pageEraseCount[getBlockNumber(page) / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)];
+
+        if (*count < 0xFFFF)
+            (*count)++;
+    }
+}
+
+/**
+  * Read data from the memory holding the file system.
+  *
+  * @param address The address to read from.
+  * @param data The buffer to read into.
+  * @param length The number of bytes to read.
+  * @return MICROBIT_OK on success.
+  */
+int MicroBitFileSystem::readFlash(uint32_t address, void *data, int length)
+{
+    if (cache)
+        return cache->read(address, data, length);
+
+    memcpy(data, (void *)address, length);
+    return MICROBIT_OK;
+}
+
+/**
+  * Write data to the memory holding the file system.
+  * If the data can not be written without an erase, the page holding it is rewritten via the given scratch page.
+  *
+  * @param address The address to write to. The data written must not cross a page boundary.
+  * @param data The data to write.
+  * @param length The number of bytes to write.
+  * @param scratch The address of an erased page to use if the page must be rewritten, or zero to use the default scratch page.
+  * @return MICROBIT_OK on success.
+  */
+int MicroBitFileSystem::writeFlash(uint32_t address, const void *data, int length, uint32_t scratch)
+{
+    if (cache == NULL)
+    {
+        flash.flash_write((void *)address, (void *)data, length, (void *)scratch);
+
+        // A scratch page provided by the caller may be a page of unused blocks, which must be left erased.
+        if (scratch && scratch != scratchPage && !isErased(getBlockNumber(scratch), MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE))
+            erasePage(scratch);
+
+        return MICROBIT_OK;
+    }
+
+    // Determine if any bit needs to be changed from zero to one, which would need an erase.
+    uint8_t buffer[64];
+    bool erase = false;
+
+    for (int i = 0; i < length && !erase; i += sizeof(buffer))
+    {
+        int l = min(length - i, (int)sizeof(buffer));
+        readFlash(address + i, buffer, l);
+
+        for (int j = 0; j < l; j++)
+        {
+            if (((const uint8_t *)data)[i + j] & ~buffer[j])
+            {
+                erase = true;
+                break;
+            }
+        }
+    }
+
+    if (!erase)
+        return cache->write(address, data, length);
+
+    // Preserve the rest of the page in the scratch page, then rewrite it around the new data.
+    // The default scratch page may hold the remains of an earlier operation, but a page provided by the caller is erased,
+    // and may be a page of unused blocks, so it is erased again afterwards.
+    uint32_t page = address - address % MICROBIT_CODEPAGESIZE;
+    uint32_t offset = address - page;
+    bool defaultScratch = (scratch == 0);
+
+    if (defaultScratch)
+    {
+        scratch = scratchPage;
+        erasePage(scratch);
+    }
+
+    copyFlash(scratch, page, MICROBIT_CODEPAGESIZE);
+    erasePage(page);
+
+    copyFlash(page, scratch, offset);
+    cache->write(address, data, length);
+    copyFlash(address + length, scratch + offset + length, MICROBIT_CODEPAGESIZE - offset - length);
+
+    if (!defaultScratch)
+        erasePage(scratch);
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Copy data from one location in the memory holding the file system to another.
+  *
+  * @param to The address to write to. The region written must be erased, and must not cross a page boundary.
+  * @param from The address to read from.
+  * @param length The number of bytes to copy.
+  * @return MICROBIT_OK on success.
+  */
+int MicroBitFileSystem::copyFlash(uint32_t to, uint32_t from, int length)
+{
+    if (cache == NULL)
+    {
+        flash.flash_write((void *)to, (void *)from, length);
+        return MICROBIT_OK;
+    }
+
+    // Copy a block at a time, skipping any data that is already erased.
+    uint32_t buffer[MBFS_BLOCK_SIZE / 4];
+
+    for (int i = 0; i < length; i += sizeof(buffer))
+    {
+        int l = min(length - i, (int)sizeof(buffer));
+        bool erased = true;
+
+        readFlash(from + i, buffer, l);
+
+        for (int j = 0; j < l && erased; j++)
+            erased = ((uint8_t *)buffer)[j] == 0xFF;
+
+        if (!erased)
+            cache->write(to + i, buffer, l);
+    }
+
+    return MICROBIT_OK;
 }
 
 
 /**
-  * Constructor. Creates an instance of a MicroBitFileSystem.
+  * Constructor. Creates an instance of a MicroBitFileSystem in internal FLASH.
+  */
+MicroBitFileSystem::MicroBitFileSystem(uint32_t flashStart, int flashPages) : CodalComponent(DEVICE_ID_FILE_SYSTEM, 0)
+{
+    nvm = NULL;
+    cache = NULL;
+
+    // Attempt tp load an existing filesystem, if it exisits
+    init(flashStart, flashPages);
+
+    // Compact deleted blocks in the background by default.
+    setCompactionBudget(MBFS_COMPACTION_BUDGET);
+
+    // If this is the first FileSystem created, so it as the default.
+    if(MicroBitFileSystem::defaultFileSystem == NULL)
+        MicroBitFileSystem::defaultFileSystem = this;
+}
+
+/**
+  * Constructor. Creates an instance of a MicroBitFileSystem on the given memory controller.
+  *
+  * The last page of the region is reserved as scratch space. The memory must not be shared with
+  * other users, such as MicroBitLog. Any existing data is erased if no file system is found.
+  * map() and readInPlace() are not supported, as the memory is not mapped into the address space of the processor.
+  * Deleted blocks are not compacted from the idle thread, as the memory controller may block. Use compact() instead.
+  *
+  * @param nvm The memory controller to use, such as MicroBitUSBFlashManager.
+  * @param flashStart The address of the start of the file system, or zero to use the start of the memory controller.
+  * The address must be aligned to a page, and pages must be MICROBIT_CODEPAGESIZE bytes in size.
+  * @param flashPages The number of pages to use, including the scratch page, or zero to use the rest of the memory controller.
   */
-MicroBitFileSystem::MicroBitFileSystem(uint32_t flashStart, int flashPages)
+MicroBitFileSystem::MicroBitFileSystem(NVMController &nvm, uint32_t flashStart, int flashPages) : CodalComponent(DEVICE_ID_FILE_SYSTEM, 0)
 {
-    // Initialise status flags to default value
-    this->status = 0;
+    this->nvm = &nvm;
+    cache = new FSCache(nvm, MBFS_BLOCK_SIZE, MBFS_NVM_CACHE_SIZE);
 
     // Attempt tp load an existing filesystem, if it exisits
     init(flashStart, flashPages);
 
+    // Deleted blocks are compacted only on request, as I/O to the memory controller may block.
+    setCompactionBudget(0);
+
     // If this is the first FileSystem created, so it as the default.
     if(MicroBitFileSystem::defaultFileSystem == NULL)
         MicroBitFileSystem::defaultFileSystem = this;
@@ -174,13 +429,41 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
         return MICROBIT_INVALID_PARAMETER;
 
     // Zero initialise default parameters (mbed/ARMCC does not permit this is the class definition).
-    fileSystemTable = NULL;
+    fileSystemStart = 0;
     lastBlockAllocated = 0;
-    rootDirectory = NULL;
+    freeBlockMap = NULL;
+    compactionBudget = 0;
+    compactionBlock = 0;
+    pageEraseCount = NULL;
+    asyncQueue = NULL;
+    asyncQueueLength = 0;
+    rootDirectory = 0;
     openFiles = NULL;
+    invalidateDirectoryCache();
+
+    // On a memory controller, use the whole region by default, and reserve its last page as our scratch page.
+    if (nvm)
+    {
+        if (cache == NULL || nvm->getPageSize() != MICROBIT_CODEPAGESIZE || flashStart % MICROBIT_CODEPAGESIZE != 0)
+            return MICROBIT_NOT_SUPPORTED;
+
+        if (flashStart == 0)
+            flashStart = nvm->getFlashStart();
+
+        if (flashPages == 0)
+            flashPages = (nvm->getFlashEnd() - flashStart) / MICROBIT_CODEPAGESIZE;
+
+        if (flashPages < 2 || flashStart + flashPages * MICROBIT_CODEPAGESIZE > nvm->getFlashEnd())
+            return MICROBIT_INVALID_PARAMETER;
+
+        flashPages--;
+        scratchPage = flashStart + flashPages * MICROBIT_CODEPAGESIZE;
+    }
+    else
+        scratchPage = MICROBIT_DEFAULT_SCRATCH_PAGE;
 
     // If we have a zero length, then dynamically determine our geometry.
-    if (flashStart == 0)
+    if (flashStart == 0 && nvm == NULL)
     {
         // Flash start is on the first page after the programmed ROM contents.
         // This is: __etext (program code) for GCC and Image$$RO$$Limit for ARMCC.
@@ -195,7 +478,7 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
         flashPages = (MICROBIT_APP_REGION_END - flashStart) / MICROBIT_CODEPAGESIZE;
 
     // The FileTable alays resides at the start of the file system.
-    fileSystemTable = (uint16_t *)flashStart;
+    fileSystemStart = flashStart;
 
     // First, try to load an existing file system at this location.
     if (load() != MICROBIT_OK)
@@ -205,11 +488,26 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
         fileSystemSize = flashPages * (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
         fileSystemTableSize = calculateFileTableSize();
 
+        // Unlike the FLASH after our program, a memory controller may hold data left by other users.
+        if (nvm)
+        {
+            for (int page = 0; page <= flashPages; page++)
+                erasePage(flashStart + page * MICROBIT_CODEPAGESIZE);
+        }
+
         format();
     }
 
+    // Track how often each page is erased, so that scratch pages can be chosen to even out wear.
+    pageEraseCount = (uint16_t *) malloc((fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)) * 2);
+    if (pageEraseCount)
+        memset(pageEraseCount, 0, (fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)) * 2);
+
+    // Erase counts are lost on reset, so start allocating from a random location rather than always from the first block.
+    lastBlockAllocated = microbit_random(fileSystemSize);
+
     // indicate that we have a valid FileSystem
-    status = MBFS_STATUS_INITIALISED;
+    status |= MBFS_STATUS_INITIALISED;
     return MICROBIT_OK;
 }
 
@@ -220,22 +518,25 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
   */
 int MicroBitFileSystem::load()
 {
-    uint16_t rootOffset = fileSystemTable[0];
+    uint16_t rootOffset = getNextFileBlock(0);
 
     // A valid MBFS has the first 'N' blocks set to the value 'N' followed by a valid root directory block with magic signature.
     for (int i = 0; i < rootOffset; i++)
     {
-        if (fileSystemTable[i] >= MBFS_EOF || fileSystemTable[i] != rootOffset)
+        uint16_t entry = getNextFileBlock(i);
+
+        if (entry >= MBFS_EOF || entry != rootOffset)
             return MICROBIT_NO_DATA;
     }
 
     // Check for a valid signature at the start of the root directory
-    DirectoryEntry *root = (DirectoryEntry *) getBlock(rootOffset);
-    if (strcmp(root->file_name, MBFS_MAGIC) != 0)
+    DirectoryEntry root;
+    readFlash(getBlock(rootOffset), &root, sizeof(DirectoryEntry));
+    if (strncmp(root.file_name, MBFS_MAGIC, MBFS_FILENAME_LENGTH) != 0)
         return MICROBIT_NO_DATA;
 
-    rootDirectory = root;
-    fileSystemSize = root->length;
+    rootDirectory = getBlock(rootOffset);
+    fileSystemSize = root.length;
     fileSystemTableSize = calculateFileTableSize();
 
     return MICROBIT_OK;
@@ -253,11 +554,11 @@ int MicroBitFileSystem::format()
 
     // Mark the FileTable blocks themselves as used.
     for (uint16_t block = 0; block < fileSystemTableSize; block++)
-        flash.flash_write(&fileSystemTable[block], &value, 2);
+        writeFlash(fileSystemStart + block * 2, &value, 2);
 
     // Create a root directory
     value = MBFS_EOF;
-    flash.flash_write(&fileSystemTable[fileSystemTableSize], &value, 2);
+    writeFlash(fileSystemStart + fileSystemTableSize * 2, &value, 2);
     
     // Store a MAGIC value in the first root directory entry. 
     // This will let us identify a valid File System later.
@@ -269,26 +570,28 @@ int MicroBitFileSystem::format()
     magic.length = fileSystemSize;
 
     // Cache the root directory entry for later use.
-    rootDirectory = (DirectoryEntry *)getBlock(fileSystemTableSize);
-    flash.flash_write(rootDirectory, &magic, sizeof(DirectoryEntry));
+    rootDirectory = getBlock(fileSystemTableSize);
+    writeFlash(rootDirectory, &magic, sizeof(DirectoryEntry));
 
     return MICROBIT_OK;
 }
 
 /**
   * Retrieve the DirectoryEntry for the given filename.
+  * Recently used entries are found in the directory cache, without scanning the directory.
   *
   * @param filename A fully or partially qualified filename.
-  * @param directory The directory to search. If ommitted, the root directory will be used.
+  * @param directory The address of the directory to search. If ommitted, the root directory will be used.
   *
-  * @return A pointer to the DirectoryEntry for the given file, or NULL if no entry is found.
+  * @return The address of the DirectoryEntry for the given file, or zero if no entry is found.
   */
-DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, const DirectoryEntry *directory)
+uint32_t MicroBitFileSystem::getDirectoryEntry(char const * filename, uint32_t directory)
 {
-    Directory *dir;
+    uint32_t dir;
     char const *file;
     uint16_t block;
-    DirectoryEntry *dirent;
+    uint32_t dirent;
+    DirectoryEntry d;
 
     // Determine the filename from the (potentially) fully qualified filename.
     file = filename + strlen(filename);
@@ -297,35 +600,97 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
     file++;
 
     // Obtain a handle on the directory to search.
-    if (directory == NULL)
+    if (directory == 0)
         directory = rootDirectory;
 
-    block = directory->first_block;
-    dir = (Directory *) getBlock(block);
-    dirent = &dir->entry[0];
+    // Check the directory cache first. Entries are validated before use, as their name and flags are held in FLASH.
+    uint32_t hash = hashFilename(file);
+
+    for (int i = 0; i < MBFS_DIRECTORY_CACHE_SIZE; i++)
+    {
+        DirectoryCacheEntry *c = &directoryCache[i];
+
+        if (c->dirent && c->directory == directory && c->hash == hash)
+        {
+            readFlash(c->dirent, &d, sizeof(DirectoryEntry));
+
+            if (d.flags & MBFS_DIRECTORY_ENTRY_VALID && strncmp(d.file_name, file, MBFS_FILENAME_LENGTH) == 0)
+                return c->dirent;
+        }
+    }
+
+    readFlash(directory, &d, sizeof(DirectoryEntry));
+    block = d.first_block;
+    dir = getBlock(block);
+    dirent = dir;
 
     // Iterate through the directory entries until we find our file, or run out of space.
     while (1)
     {
-        if ((uint32_t)(dirent + 1) > (uint32_t)dir + MBFS_BLOCK_SIZE)
+        if (dirent + sizeof(DirectoryEntry) > dir + MBFS_BLOCK_SIZE)
         {
             block = getNextFileBlock(block);
             if (block == MBFS_EOF)
-                return NULL;
+                return 0;
 
-            dir = (Directory *)getBlock(block);
-            dirent = &dir->entry[0];
+            dir = getBlock(block);
+            dirent = dir;
         }
 
-        // Check for a valid match
-        if (dirent->flags & MBFS_DIRECTORY_ENTRY_VALID && strcmp(dirent->file_name, file) == 0)
+        // Check for a valid match, and remember where we found it.
+        readFlash(dirent, &d, sizeof(DirectoryEntry));
+
+        if (d.flags & MBFS_DIRECTORY_ENTRY_VALID && strncmp(d.file_name, file, MBFS_FILENAME_LENGTH) == 0)
+        {
+            if (MBFS_DIRECTORY_CACHE_SIZE)
+            {
+                DirectoryCacheEntry *c = &directoryCache[directoryCacheNext];
+
+                c->directory = directory;
+                c->dirent = dirent;
+                c->hash = hash;
+
+                directoryCacheNext = (directoryCacheNext + 1) % MBFS_DIRECTORY_CACHE_SIZE;
+            }
+
             return dirent;
+        }
 
         // Move onto the next entry.
-        dirent++;
+        dirent += sizeof(DirectoryEntry);
     }
 
-    return NULL;
+    return 0;
+}
+
+/**
+  * Calculate the hash of a file name, as used by the directory cache.
+  *
+  * @param name The file name, excluding any path.
+  * @return The hash of the given name.
+  */
+uint32_t MicroBitFileSystem::hashFilename(char const * name)
+{
+    // 32 bit FNV-1a.
+    uint32_t hash = 2166136261;
+
+    while (*name)
+    {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+/**
+  * Forget all entries in the directory cache.
+  * Called whenever a directory is changed such that a cached entry may no longer be valid.
+  */
+void MicroBitFileSystem::invalidateDirectoryCache()
+{
+    memset(directoryCache, 0, sizeof(directoryCache));
+    directoryCacheNext = 0;
 }
 
 /**
@@ -343,28 +708,28 @@ uint16_t MicroBitFileSystem::calculateFileTableSize()
 }
 
 /**
-  * Retrieve a memory pointer for the start of the physical memory page containing the given block.
+  * Retrieve the address of the start of the physical memory page containing the given block.
   *
   * @param block A valid block number.
   *
-  * @return A pointer to the physical page in FLASH memory holding the given block.
+  * @return The address of the physical page in FLASH memory holding the given block.
   */
-uint32_t *MicroBitFileSystem::getPage(uint16_t block)
+uint32_t MicroBitFileSystem::getPage(uint16_t block)
 {
-    uint32_t address = (uint32_t) getBlock(block);
-    return (uint32_t *) (address - address % MICROBIT_CODEPAGESIZE);
+    uint32_t address = getBlock(block);
+    return address - address % MICROBIT_CODEPAGESIZE;
 }
 
 /**
-  * Retrieve a memory pointer for the start of the given block.
+  * Retrieve the address of the start of the given block.
   *
   * @param block A valid block number.
   *
-  * @return A pointer to the FLASH memory associated with the given block.
+  * @return The address of the FLASH memory associated with the given block.
   */
-uint32_t *MicroBitFileSystem::getBlock(uint16_t block)
+uint32_t MicroBitFileSystem::getBlock(uint16_t block)
 {
-    return (uint32_t *)((uint32_t)fileSystemTable + block * MBFS_BLOCK_SIZE);
+    return fileSystemStart + block * MBFS_BLOCK_SIZE;
 }
 
 /**
@@ -376,7 +741,10 @@ uint32_t *MicroBitFileSystem::getBlock(uint16_t block)
   */
 uint16_t MicroBitFileSystem::getNextFileBlock(uint16_t block)
 {
-    return fileSystemTable[block];
+    uint16_t next;
+
+    readFlash(fileSystemStart + block * 2, &next, 2);
+    return next;
 }
 
 /**
@@ -386,9 +754,9 @@ uint16_t MicroBitFileSystem::getNextFileBlock(uint16_t block)
   *
   * @return The block number containing the given address.
   */
-uint16_t MicroBitFileSystem::getBlockNumber(void *address)
+uint16_t MicroBitFileSystem::getBlockNumber(uint32_t address)
 {
-    return (((uint32_t) address - (uint32_t) fileSystemTable) / MBFS_BLOCK_SIZE);
+    return (address - fileSystemStart) / MBFS_BLOCK_SIZE;
 }
 
 /**
@@ -400,7 +768,32 @@ uint16_t MicroBitFileSystem::getBlockNumber(void *address)
   */
 int MicroBitFileSystem::fileTableWrite(uint16_t block, uint16_t value)
 {
-    flash.flash_write(&fileSystemTable[block], &value, 2);
+    uint16_t previous = getNextFileBlock(block);
+
+    writeFlash(fileSystemStart + block * 2, &value, 2);
+
+    // Keep the free block map and counts in step with the file table, if we have built them yet.
+    if (freeBlockMap == NULL)
+        return MICROBIT_OK;
+
+    if (previous == MBFS_UNUSED && value != MBFS_UNUSED)
+    {
+        freeBlockMap[block / 32] &= ~(1UL << (block % 32));
+        freeBlockCount--;
+    }
+
+    if (previous != MBFS_UNUSED && value == MBFS_UNUSED)
+    {
+        freeBlockMap[block / 32] |= (1UL << (block % 32));
+        freeBlockCount++;
+    }
+
+    if (previous != MBFS_DELETED && value == MBFS_DELETED)
+        deletedBlockCount++;
+
+    if (previous == MBFS_DELETED && value != MBFS_DELETED)
+        deletedBlockCount--;
+
     return MICROBIT_OK;
 }
 
@@ -411,11 +804,11 @@ int MicroBitFileSystem::fileTableWrite(uint16_t block, uint16_t value)
   *
   * @param filename A fully qualified filename, from the root. Should be end with a "/" if no filename is provided.
   *
-  * @return A pointer to the DirectoryEntry for the given file, or NULL if no entry is found.
+  * @return The address of the DirectoryEntry for the given file, or zero if no entry is found.
   */
-DirectoryEntry* MicroBitFileSystem::getDirectoryOf(char const * filename)
+uint32_t MicroBitFileSystem::getDirectoryOf(char const * filename)
 {
-    DirectoryEntry* directory;
+    uint32_t directory;
 
     // If not path is provided, return the root diretory.
     if (filename == NULL || filename[0] == 0)
@@ -433,14 +826,14 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryOf(char const * filename)
 
             // Ensure each level of the filename is valid
             if (i == 0 || i > MBFS_FILENAME_LENGTH + 1)
-                return NULL;
+                return 0;
 
             // Extract the relevant entry from the directory.
             directory = getDirectoryEntry(s, directory);
 
             // If file / directory does not exist, then there's nothing more we can do.
             if (!directory)
-                return NULL;
+                return 0;
 
             i = 0;
         }
@@ -464,53 +857,55 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryOf(char const * filename)
   */
 int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
 {
-    uint32_t *page = getPage(block);
-    uint32_t* scratch = getFreePage();
-    uint8_t *write = (uint8_t *)scratch;
+    uint32_t page = getPage(block);
+    uint32_t scratch = getFreePage();
+    uint32_t write = scratch;
     uint16_t b = getBlockNumber(page);
 
     for (int i = 0; i < (int)( MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE); i++)
     {
+        uint16_t next = getNextFileBlock(b);
+
         // If we have an unused or deleted block, there's nothing to do - allow the block to be recycled.
-        if (fileSystemTable[b] == MBFS_DELETED || fileSystemTable[b] == MBFS_UNUSED) 
+        if (next == MBFS_DELETED || next == MBFS_UNUSED) 
         {}
 
         // If we have been asked to recycle a valid directory block, recycle individual entries where possible.
         else if (b == block && type == MBFS_BLOCK_TYPE_DIRECTORY)
         {
-            DirectoryEntry *direntIn = (DirectoryEntry *)getBlock(b);
-            DirectoryEntry *direntOut = (DirectoryEntry *)write;
+            DirectoryEntry d;
 
             for (uint16_t entry = 0; entry < MBFS_BLOCK_SIZE / sizeof(DirectoryEntry); entry++)
             {
-                if (direntIn->flags & MBFS_DIRECTORY_ENTRY_VALID)
-                    flash.flash_write((uint32_t *)direntOut, (uint32_t *)direntIn, sizeof(DirectoryEntry));
+                readFlash(getBlock(b) + entry * sizeof(DirectoryEntry), &d, sizeof(DirectoryEntry));
 
-                direntIn++;
-                direntOut++;
+                if (d.flags & MBFS_DIRECTORY_ENTRY_VALID)
+                    writeFlash(write + entry * sizeof(DirectoryEntry), &d, sizeof(DirectoryEntry));
             }
         }
 
         // All blocks before the root directory are the FileTable. 
-        // Recycle any entries marked as DELETED to UNUSED.
-        else if (getBlock(b) < (uint32_t *)rootDirectory)
+        // If we have been asked to recycle the FileTable, recycle any entries marked as DELETED to UNUSED.
+        // Otherwise they are copied as is, as the data blocks they refer to may not have been erased yet.
+        else if (getBlock(b) < rootDirectory && type == MBFS_BLOCK_TYPE_FILETABLE)
         {
-            uint16_t *tableIn = (uint16_t *)getBlock(b);
-            uint16_t *tableOut = (uint16_t *)write;
-            
-            for (int entry = 0; entry < MBFS_BLOCK_SIZE / 2; entry++)
+            uint16_t table[32];
+
+            for (int entry = 0; entry < MBFS_BLOCK_SIZE / 2; entry += 32)
             {
-                if (*tableIn != MBFS_DELETED)
-                    flash.flash_write(tableOut, tableIn, 2);
+                readFlash(getBlock(b) + entry * 2, table, sizeof(table));
 
-                tableIn++;
-                tableOut++;
+                for (int j = 0; j < 32; j++)
+                    if (table[j] == MBFS_DELETED)
+                        table[j] = MBFS_UNUSED;
+
+                writeFlash(write + entry * 2, table, sizeof(table));
             }
         }
 
         // Copy all other VALID blocks directly into the scratch page.
         else
-            flash.flash_write(write, getBlock(b), MBFS_BLOCK_SIZE);
+            copyFlash(write, getBlock(b), MBFS_BLOCK_SIZE);
         
         // move on to next block.
         write += MBFS_BLOCK_SIZE;
@@ -518,9 +913,13 @@ int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
     }
 
     // Now refresh the page originally holding the block.
-    flash.erase_page(page);
-    flash.flash_write(page, scratch, MICROBIT_CODEPAGESIZE);
-    flash.erase_page(scratch);
+    erasePage(page);
+    copyFlash(page, scratch, MICROBIT_CODEPAGESIZE);
+    erasePage(scratch);
+
+    // If we just recycled part of the file table, DELETED entries may now be UNUSED.
+    if (type == MBFS_BLOCK_TYPE_FILETABLE && freeBlockMap)
+        buildFreeBlockMap();
 
     return MICROBIT_OK;
 }
@@ -541,7 +940,8 @@ int MicroBitFileSystem::recycleFileTable()
         if (block % (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE) == 0)
             pageRecycled = false;
 
-        if (fileSystemTable[block] == MBFS_DELETED && !pageRecycled)
+        // n.b. DELETED blocks already erased by the compactor need no further work.
+        if (getNextFileBlock(block) == MBFS_DELETED && !pageRecycled && !isErased(block))
         {
             recycleBlock(block);
             pageRecycled = true;
@@ -549,64 +949,92 @@ int MicroBitFileSystem::recycleFileTable()
     }
 
     // now, recycle the FileSystemTable itself, upcycling entries marked as DELETED to UNUSED as we go.
-    for (uint16_t block = 0; getPage(block) < (uint32_t *)rootDirectory; block += MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)
-        recycleBlock(block);
+    for (uint16_t block = 0; getPage(block) < rootDirectory; block += MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)
+        recycleBlock(block, MBFS_BLOCK_TYPE_FILETABLE);
 
     return MICROBIT_OK;
 }
 
 
+/**
+  * Determine if the FLASH memory of the given blocks is erased.
+  *
+  * @param block A valid block number.
+  * @param blocks The number of consecutive blocks to check.
+  * @return true if every byte of the blocks is erased, false otherwise.
+  */
+bool MicroBitFileSystem::isErased(uint16_t block, int blocks)
+{
+    uint32_t words[16];
+
+    for (uint32_t address = getBlock(block); address < getBlock(block + blocks); address += sizeof(words))
+    {
+        readFlash(address, words, sizeof(words));
+
+        for (int i = 0; i < 16; i++)
+            if (words[i] != 0xFFFFFFFF)
+                return false;
+    }
+
+    return true;
+}
+
 /**
   * Allocate a free DiretoryEntry in the given directory, extending and refreshing the directory block if necessary.
   *
   * @param directory The directory to add a DirectoryEntry to
-  * @return A pointer to the new DirectoryEntry for the given file, or NULL if it was not possible to allocated resources.
+  * @return The address of the new DirectoryEntry for the given file, or zero if it was not possible to allocated resources.
   */
-DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directory)
+uint32_t MicroBitFileSystem::createDirectoryEntry(uint32_t directory)
 {
-    Directory *dir;
+    uint32_t dir;
     uint16_t block;
-    DirectoryEntry *dirent;
-    DirectoryEntry *empty = NULL;
-    DirectoryEntry *invalid = NULL;
+    uint32_t dirent;
+    uint32_t empty = 0;
+    uint32_t invalid = 0;
+    DirectoryEntry d;
 
     // Try to find an unused entry in the directory.
-    block = directory->first_block;
-    dir = (Directory *)getBlock(block);
-    dirent = &dir->entry[0];
+    readFlash(directory, &d, sizeof(DirectoryEntry));
+    block = d.first_block;
+    dir = getBlock(block);
+    dirent = dir;
 
     // Iterate through the directory entries until we find and unused entry, or run out of space.
     while (1)
     {
         // Scan through each of the blocks in the directory
-        if ((uint32_t)(dirent+1) > (uint32_t)dir + MBFS_BLOCK_SIZE)
+        if (dirent + sizeof(DirectoryEntry) > dir + MBFS_BLOCK_SIZE)
         {
             block = getNextFileBlock(block);
             if (block == MBFS_EOF)
                 break;
 
-            dir = (Directory *)getBlock(block);
-            dirent = &dir->entry[0];
+            dir = getBlock(block);
+            dirent = dir;
         }
 
+        readFlash(dirent, &d, sizeof(DirectoryEntry));
+
         // If we find an empty slot, use that.
-        if (dirent->flags & MBFS_DIRECTORY_ENTRY_FREE)
+        // n.b. the entry of a new file that has not yet been written shares the flags of a free entry, but has a first block.
+        if ((d.flags & MBFS_DIRECTORY_ENTRY_FREE) && d.first_block == MBFS_UNUSED)
         {
             empty = dirent;
             break;
         }
 
         // Record the first invalid block we find (used, but then deleted).
-        if ((dirent->flags & MBFS_DIRECTORY_ENTRY_VALID) == 0 && invalid == NULL)
+        if ((d.flags & MBFS_DIRECTORY_ENTRY_VALID) == 0 && invalid == 0)
             invalid = dirent;
 
         // Move onto the next entry.
-        dirent++;
+        dirent += sizeof(DirectoryEntry);
     }
 
 
     // Now choose the best available slot, giving preference to entries that would avoid a FLASH page erase opreation.
-    dirent = NULL;
+    dirent = 0;
 
     // Ideally, choose an unused entry within an existing block.
     if (empty)
@@ -629,10 +1057,11 @@ DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directo
         // Allocate a new logical block
         uint16_t newBlock = getFreeBlock();
         if (newBlock == 0)
-            return NULL;
+            return 0;
 
         // Append this to the directory
-        uint16_t lastBlock = directory->first_block;
+        readFlash(directory, &d, sizeof(DirectoryEntry));
+        uint16_t lastBlock = d.first_block;
         while (getNextFileBlock(lastBlock) != MBFS_EOF)
             lastBlock = getNextFileBlock(lastBlock);
 
@@ -640,7 +1069,7 @@ DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directo
         fileTableWrite(lastBlock, newBlock);
         fileTableWrite(newBlock, MBFS_EOF);
 
-        dirent = (DirectoryEntry *)getBlock(newBlock);
+        dirent = getBlock(newBlock);
     }
 
     return dirent;
@@ -653,12 +1082,12 @@ DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directo
   * @param directory The directory in which to create the entry
   * @param isDirectory true if the entry being created is itself a directory
   *
-  * @return A pointer to the new DirectoryEntry for the given file, or NULL if it was not possible to allocated resources.
+  * @return The address of the new DirectoryEntry for the given file, or zero if it was not possible to allocated resources.
   */
-DirectoryEntry* MicroBitFileSystem::createFile(char const * filename, DirectoryEntry *directory, bool isDirectory)
+uint32_t MicroBitFileSystem::createFile(char const * filename, uint32_t directory, bool isDirectory)
 {
     char const *file;
-    DirectoryEntry *dirent;
+    uint32_t dirent;
 
     // Determine the filename from the (potentially) fully qualified filename.
     file = filename + strlen(filename);
@@ -668,13 +1097,13 @@ DirectoryEntry* MicroBitFileSystem::createFile(char const * filename, DirectoryE
 
     // Allocate a directory entry for our new file.
     dirent = createDirectoryEntry(directory);
-    if (dirent == NULL)
-        return NULL;
+    if (dirent == 0)
+        return 0;
 
     // Create a new block to represent the file.
     uint16_t newBlock = getFreeBlock();
     if (newBlock == 0)
-        return NULL;
+        return 0;
 
     // Populate our assigned Directory Entry.
     DirectoryEntry d;
@@ -695,7 +1124,7 @@ DirectoryEntry* MicroBitFileSystem::createFile(char const * filename, DirectoryE
     }
 
     // Push the new data back to FLASH memory
-    flash.flash_write(dirent, &d, sizeof(DirectoryEntry));
+    writeFlash(dirent, &d, sizeof(DirectoryEntry));
     fileTableWrite(d.first_block, MBFS_EOF);
     return dirent;
 }
@@ -742,8 +1171,20 @@ FileDescriptor* MicroBitFileSystem::getFileDescriptor(int fd, bool remove)
   */
 int MicroBitFileSystem::createDirectory(char const *name)
 {
-    DirectoryEntry* directory;        // Directory holding this file.
-    DirectoryEntry* dirent;            // Entry in the direcoty of this file.
+    lock();
+    int r = _createDirectory(name);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of createDirectory(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_createDirectory(char const *name)
+{
+    uint32_t directory;                 // Directory holding this file.
+    uint32_t dirent;                    // Entry in the direcoty of this file.
 
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
@@ -756,7 +1197,7 @@ int MicroBitFileSystem::createDirectory(char const *name)
     // Determine the directory for this file.
     directory = getDirectoryOf(name);
 
-    if (directory == NULL)
+    if (directory == 0)
         return MICROBIT_INVALID_PARAMETER;
 
     // Find the DirectoryEntry associated with the given name (if it exists).
@@ -767,7 +1208,7 @@ int MicroBitFileSystem::createDirectory(char const *name)
         return MICROBIT_INVALID_PARAMETER;
 
     dirent = createFile(name, directory, true);
-    if (dirent == NULL)
+    if (dirent == 0)
         return MICROBIT_NO_RESOURCES;
 
     return MICROBIT_OK;
@@ -786,9 +1227,11 @@ int MicroBitFileSystem::createDirectory(char const *name)
   *
   * @param filename name of the file to open, must contain only printable characters.
   * @param flags One or more of MB_READ, MB_WRITE or MB_CREAT. 
+  * @param bufferSize The size of the writeback cache to use for this file, in bytes. Writes smaller than this
+  *        are held in RAM and written back to FLASH together. Zero disables the cache. Defaults to MBFS_CACHE_SIZE.
   * @return return the file handle,MICROBIT_NOT_SUPPORTED if the file system has
   *         not been initialised MICROBIT_INVALID_PARAMETER if the filename is
-  *         too large, MICROBIT_NO_RESOURCES if the file system is full.
+  *         too large or the bufferSize is invalid, MICROBIT_NO_RESOURCES if the file system is full.
   *
   * @code
   * MicroBitFileSystem f();
@@ -797,25 +1240,38 @@ int MicroBitFileSystem::createDirectory(char const *name)
   *    print("file open error");
   * @endcode
   */
-int MicroBitFileSystem::open(char const * filename, uint32_t flags)
+int MicroBitFileSystem::open(char const * filename, uint32_t flags, int bufferSize)
+{
+    lock();
+    int r = _open(filename, flags, bufferSize);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of open(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_open(char const * filename, uint32_t flags, int bufferSize)
 {
     FileDescriptor *file;               // File Descriptor of this file.
-    DirectoryEntry* directory;          // Directory holding this file.
-    DirectoryEntry* dirent;             // Entry in the direcoty of this file.
+    uint32_t directory;                 // Directory holding this file.
+    uint32_t dirent;                    // Entry in the direcoty of this file.
+    DirectoryEntry d;                   // Contents of the entry.
     int id;                             // FileDescriptor id to be return to the caller.
 
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
         return MICROBIT_NOT_SUPPORTED;
 
-    // Reject invalid filenames.
-    if(!isValidFilename(filename))
+    // Reject invalid filenames and buffer sizes.
+    if(!isValidFilename(filename) || bufferSize < 0 || bufferSize > 0xFFFF)
         return MICROBIT_INVALID_PARAMETER;
 
     // Determine the directory for this file.
     directory = getDirectoryOf(filename);
 
-    if (directory == NULL)
+    if (directory == 0)
         return MICROBIT_INVALID_PARAMETER;
 
     // Find the DirectoryEntry assoviate with the given file (if it exists).
@@ -826,9 +1282,9 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
     file = openFiles;
     id = 0;
     
-    while (file && dirent)
+    while (file)
     {
-        if (file->dirent == dirent)
+        if (dirent && file->dirent == dirent)
             return MICROBIT_NOT_SUPPORTED;
 
         if (file->id == id)
@@ -841,14 +1297,14 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
         file = file->next;
     }
 
-    if (dirent == NULL)
+    if (dirent == 0)
     {
         // If the file doesn't exist, and we haven't been asked to create it, then there's nothing we can do.
         if (!(flags & MB_CREAT))
             return MICROBIT_INVALID_PARAMETER;
 
         dirent = createFile(filename, directory, false);
-        if (dirent == NULL)
+        if (dirent == 0)
             return MICROBIT_NO_RESOURCES;
     }
 
@@ -857,14 +1313,30 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
     if (file == NULL)
         return MICROBIT_NO_RESOURCES;
 
+    file->cache = NULL;
+    if (bufferSize)
+    {
+        file->cache = new uint8_t[bufferSize];
+        if (file->cache == NULL)
+        {
+            delete file;
+            return MICROBIT_NO_RESOURCES;
+        }
+    }
+
     // Populate the FileDescriptor
     file->flags = (flags & ~(MB_CREAT));
     file->id = id;
-    file->length = dirent->flags == MBFS_DIRECTORY_ENTRY_NEW ? 0 : dirent->length;
+    readFlash(dirent, &d, sizeof(DirectoryEntry));
+
+    file->length = d.flags == MBFS_DIRECTORY_ENTRY_NEW ? 0 : d.length;
     file->seek = (flags & MB_APPEND) ? file->length : 0;
     file->dirent = dirent;
     file->directory = directory;
     file->cacheLength = 0;
+    file->cacheSize = bufferSize;
+    file->asyncPending = 0;
+    file->asyncResult = MICROBIT_OK;
 
     // Add the file descriptor to the chain of open files.
     file->next = openFiles;
@@ -882,7 +1354,8 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
   * @param fd file descriptor - obtained with open().
   * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not
   *         been initialised, MICROBIT_INVALID_PARAMETER if the given file handle
-  *         is invalid.
+  *         is invalid, MICROBIT_NO_RESOURCES if the file system is too full to
+  *         record the new length of the file.
   *
   * @code
   * MicroBitFileSystem f();
@@ -894,6 +1367,18 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
   * @endcode
   */
 int MicroBitFileSystem::flush(int fd)
+{
+    lock();
+    int r = _flush(fd);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of flush(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_flush(int fd)
 {
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
@@ -905,32 +1390,55 @@ int MicroBitFileSystem::flush(int fd)
     if(file == NULL)
         return MICROBIT_INVALID_PARAMETER;
 
+    waitForAsync(file);
+
+    return flushFile(file);
+}
+
+/**
+  * Write back all state associated with the given file to FLASH memory.
+  *
+  * @param file FileDescriptor of the file to flush.
+  * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if the file system is too full to
+  *         record the new length of the file.
+  */
+int MicroBitFileSystem::flushFile(FileDescriptor *file)
+{
     // Flush any data in the writeback cache.
     writeBack(file);
 
     // If the file has changed size, create an updated directory entry for the file, reflecting it's new length.
-    if (file->dirent->length != file->length)
+    DirectoryEntry d;
+    readFlash(file->dirent, &d, sizeof(DirectoryEntry));
+
+    if (d.length != file->length)
     {
-        DirectoryEntry d = *file->dirent;
         d.length = file->length;
 
         // Do some optimising to reduce FLASH churn if this is the first write to a file. No need then to create a new dirent...
-        if (file->dirent->flags == MBFS_DIRECTORY_ENTRY_NEW)
+        if (d.flags == MBFS_DIRECTORY_ENTRY_NEW)
         {
             d.flags = MBFS_DIRECTORY_ENTRY_VALID;
-            flash.flash_write(file->dirent, &d, sizeof(DirectoryEntry));
+            writeFlash(file->dirent, &d, sizeof(DirectoryEntry));
         }
 
         // Otherwise, replace the dirent with a freshly allocated one, and mark the other as INVALID.
         else
         {
-            DirectoryEntry *newDirent;
+            uint32_t newDirent;
             uint16_t value = MBFS_DELETED;
 
             // invalidate the old directory entry and create a new one with the updated data.
-            flash.flash_write(&file->dirent->flags, &value, 2);
+            writeFlash(file->dirent + offsetof(DirectoryEntry, flags), &value, 2);
+            invalidateDirectoryCache();
+            status |= MBFS_STATUS_COMPACT_DIRECTORIES;
+
             newDirent = createDirectoryEntry(file->directory);
-            flash.flash_write(newDirent, &d, sizeof(DirectoryEntry));
+            if (newDirent == 0)
+                return MICROBIT_NO_RESOURCES;
+
+            writeFlash(newDirent, &d, sizeof(DirectoryEntry));
+            file->dirent = newDirent;
         }
     }
 
@@ -938,20 +1446,66 @@ int MicroBitFileSystem::flush(int fd)
 }
 
 /**
-  * Close the specified file handle.
-  * File handle resources are then made available for future open() calls.
+  * Writes back all state associated with the given file to FLASH memory asynchronously.
   *
-  * close() must be called at some point to ensure the filesize in the
-  * FT is synced with the cached value in the FD.
-  *
-  * @warning if close() is not called, the FT may not be correct,
-  * leading to data loss.
+  * The flush is performed by a background fiber once any operations already queued for the file
+  * are complete. MBFS_EVT_ASYNC_COMPLETE(fd) is then raised on DEVICE_ID_FILE_SYSTEM, and the
+  * result of the flush (as returned by flush()) can be obtained with getAsyncResult().
   *
   * @param fd file descriptor - obtained with open().
-  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not
-  *         been initialised, MICROBIT_INVALID_PARAMETER if the given file handle
-  *         is invalid.
-  *
+  * @return MICROBIT_OK if the flush was queued, MICROBIT_NOT_SUPPORTED if the file system has not
+  *         been initialised or the scheduler is not running, MICROBIT_INVALID_PARAMETER if the given
+  *         file handle is invalid, or MICROBIT_NO_RESOURCES if there is not enough memory to queue it.
+  */
+int MicroBitFileSystem::flushAsync(int fd)
+{
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    FileDescriptor *file = getFileDescriptor(fd);
+
+    // Ensure the file is open.
+    if(file == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    return queueAsync(file, NULL, 0);
+}
+
+/**
+  * Determine the result of the last asynchronous operation to complete on the given file.
+  *
+  * @param fd file descriptor - obtained with open().
+  * @return MICROBIT_BUSY if asynchronous operations are still queued for the file, MICROBIT_INVALID_PARAMETER
+  *         if the given file handle is invalid, otherwise the value that write() or flush() would have returned
+  *         for the last operation (MICROBIT_OK if there has been none).
+  */
+int MicroBitFileSystem::getAsyncResult(int fd)
+{
+    FileDescriptor *file = getFileDescriptor(fd);
+
+    if(file == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    return file->asyncPending ? MICROBIT_BUSY : file->asyncResult;
+}
+
+/**
+  * Close the specified file handle.
+  * File handle resources are then made available for future open() calls.
+  *
+  * close() must be called at some point to ensure the filesize in the
+  * FT is synced with the cached value in the FD. Any asynchronous
+  * operations queued for the file are completed first.
+  *
+  * @warning if close() is not called, the FT may not be correct,
+  * leading to data loss.
+  *
+  * @param fd file descriptor - obtained with open().
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not
+  *         been initialised, MICROBIT_INVALID_PARAMETER if the given file handle
+  *         is invalid.
+  *
   * @code
   * MicroBitFileSystem f();
   * int fd = f.open("test.txt", MB_READ);
@@ -960,9 +1514,21 @@ int MicroBitFileSystem::flush(int fd)
   * @endcode
   */
 int MicroBitFileSystem::close(int fd)
+{
+    lock();
+    int r = _close(fd);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of close(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_close(int fd)
 {
     // Firstly, ensure all unwritten data is flushed.
-    int r = flush(fd);
+    int r = _flush(fd);
 
     // If the flush called failed on validation, pass the error code onto the caller.
     if (r != MICROBIT_OK)
@@ -970,7 +1536,10 @@ int MicroBitFileSystem::close(int fd)
 
     // Remove the file descriptor from the list of open files, and free it.
     // n.b. we know this is safe, as flush() validates this.
-    delete getFileDescriptor(fd, true);
+    FileDescriptor *file = getFileDescriptor(fd, true);
+
+    delete[] file->cache;
+    delete file;
 
     return MICROBIT_OK;
 }
@@ -999,6 +1568,18 @@ int MicroBitFileSystem::close(int fd)
   * @endcode
   */
 int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
+{
+    lock();
+    int r = _seek(fd, offset, flags);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of seek(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_seek(int fd, int offset, uint8_t flags)
 {
     FileDescriptor *file;
     int position;
@@ -1012,6 +1593,8 @@ int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
 
     if (file == NULL)
         return MICROBIT_INVALID_PARAMETER;
+
+    waitForAsync(file);
     
     // Flush any data in the writeback cache.
     writeBack(file);
@@ -1058,11 +1641,23 @@ int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
   * @endcode
   */
 int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
+{
+    lock();
+    int r = _read(fd, buffer, size);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of read(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_read(int fd, uint8_t* buffer, int size)
 {
     FileDescriptor *file;
     uint16_t block;
-    uint8_t *readPointer;
     uint8_t *writePointer;
+    DirectoryEntry d;
 
     uint32_t offset;
     uint32_t position = 0;
@@ -1079,6 +1674,8 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     if (file == NULL || buffer == NULL || size == 0)
         return MICROBIT_INVALID_PARAMETER;
 
+    waitForAsync(file);
+
     // Flush any data in the writeback cache before we change the seek pointer.
     writeBack(file);
 
@@ -1086,7 +1683,8 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     size = min(size, file->length - file->seek);
 
     // Find the read position.
-    block = file->dirent->first_block; 
+    readFlash(file->dirent, &d, sizeof(DirectoryEntry));
+    block = d.first_block; 
 
     // Walk the file table until we reach the start block
     while (file->seek - position > MBFS_BLOCK_SIZE)
@@ -1103,11 +1701,10 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     while (bytesCopied < size)
     {
         // First, determine if we need to write a partial block.
-        readPointer = (uint8_t *)getBlock(block) + offset;
         segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
 
         if(segmentLength > 0)
-            memcpy(writePointer, readPointer, segmentLength);
+            readFlash(getBlock(block) + offset, writePointer, segmentLength);
 
         bytesCopied += segmentLength;
         writePointer += segmentLength;
@@ -1125,6 +1722,145 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     return bytesCopied;
 }
 
+/**
+  * Read data from the file, without copying it.
+  *
+  * Provides the address in memory mapped FLASH of the data at the current seek
+  * position of the file, and the number of bytes that can be read contiguously from there.
+  * This is limited to the end of the current run of physically contiguous blocks (see map()),
+  * so the data of a whole file may take several calls to obtain. The seek position of the file
+  * handle is incremented by the number of bytes returned.
+  *
+  * @param fd File handle, obtained with open()
+  * @param data set to the address of the data on success.
+  * @param size maximum number of bytes to read
+  * @return number of bytes available at data on success (zero at end of file), MICROBIT_NOT_SUPPORTED
+  *         if the file system is not initialised, or MICROBIT_INVALID_PARAMETER if the given file handle is invalid.
+  */
+int MicroBitFileSystem::readInPlace(int fd, const uint8_t **data, int size)
+{
+    lock();
+    int r = _readInPlace(fd, data, size);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of readInPlace(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_readInPlace(int fd, const uint8_t **data, int size)
+{
+    FileDescriptor *file;
+    uint32_t length;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL || data == NULL || size < 0)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Any data in the writeback cache must be in FLASH before we can point at it.
+    // n.b. this may also move the seek position.
+    writeBack(file);
+
+    int r = _map(fd, file->seek, data, &length);
+    if (r != MICROBIT_OK)
+        return r;
+
+    size = min((uint32_t)size, length);
+    file->seek += size;
+
+    return size;
+}
+
+/**
+  * Map part of a file into memory, without copying it.
+  *
+  * Provides the address in memory mapped FLASH of the data at the given offset in the file,
+  * and the number of bytes that can be read contiguously from there. Consecutive blocks of a
+  * file are usually stored next to each other, so this typically spans many blocks.
+  * When the file's blocks are not contiguous, the data of a whole file may take several calls to obtain.
+  * The seek position of the file handle is not changed.
+  *
+  * The data remains valid until the file is next written or removed.
+  *
+  * @param fd File handle, obtained with open()
+  * @param offset The offset in the file, in bytes.
+  * @param data set to the address of the data on success.
+  * @param length set to the number of bytes available at data on success (zero at end of file).
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+  *         or MICROBIT_INVALID_PARAMETER if the given file handle is invalid or the offset is beyond the end of the file.
+  */
+int MicroBitFileSystem::map(int fd, uint32_t offset, const uint8_t **data, uint32_t *length)
+{
+    lock();
+    int r = _map(fd, offset, data, length);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of map(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_map(int fd, uint32_t offset, const uint8_t **data, uint32_t *length)
+{
+    FileDescriptor *file;
+    uint16_t block;
+    uint32_t position = 0;
+    DirectoryEntry d;
+
+    // Protect against accidental re-initialisation. Only memory mapped FLASH can be pointed at directly.
+    if ((status & MBFS_STATUS_INITIALISED) == 0 || cache)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL || data == NULL || length == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Any data in the writeback cache must be in FLASH before we can point at it.
+    writeBack(file);
+
+    if (offset > file->length)
+        return MICROBIT_INVALID_PARAMETER;
+
+    *length = 0;
+    if (offset == file->length)
+        return MICROBIT_OK;
+
+    // Walk the file table until we reach the block holding the given offset.
+    readFlash(file->dirent, &d, sizeof(DirectoryEntry));
+    block = d.first_block;
+
+    while (offset - position >= MBFS_BLOCK_SIZE)
+    {
+        block = getNextFileBlock(block);
+        position += MBFS_BLOCK_SIZE;
+    }
+
+    *data = (uint8_t *)getBlock(block) + (offset - position);
+
+    // Extend the run for as long as the following blocks of the file are physically adjacent.
+    position += MBFS_BLOCK_SIZE;
+
+    while (position < file->length && getNextFileBlock(block) == block + 1)
+    {
+        block++;
+        position += MBFS_BLOCK_SIZE;
+    }
+
+    *length = min(position, file->length) - offset;
+
+    return MICROBIT_OK;
+}
+
 /**
   * Flush a given file's cache back to FLASH memory.
   *
@@ -1146,6 +1882,7 @@ int MicroBitFileSystem::writeBack(FileDescriptor *file)
 
 /**
   * Write a given buffer to the file provided.
+  * Physically adjacent blocks on the same FLASH page are written in a single operation.
   *
   * @param file FileDescriptor of the file to write
   * @param buffer The start of the buffer to write
@@ -1153,55 +1890,60 @@ int MicroBitFileSystem::writeBack(FileDescriptor *file)
   */
 int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int size)
 {
-    uint16_t block, newBlock;
-    uint8_t *readPointer;
-    uint8_t *writePointer;
+    uint16_t block, next;
+    DirectoryEntry d;
 
     uint32_t offset;
     uint32_t position = 0;
     int bytesCopied = 0;
     int segmentLength;
 
-    // Find the read position.
-    block = file->dirent->first_block;
+    // Find the write position.
+    readFlash(file->dirent, &d, sizeof(DirectoryEntry));
+    block = d.first_block;
 
-    // Walk the file table until we reach the start block
-    while (file->seek - position > MBFS_BLOCK_SIZE)
+    // Walk the file table until we reach the start block, extending the file if we're at the end of its last block.
+    while (file->seek - position >= MBFS_BLOCK_SIZE)
     {
-        block = getNextFileBlock(block);
+        block = getNextWriteBlock(block);
+        if (block == 0)
+            return 0;
+
         position += MBFS_BLOCK_SIZE;
     }
 
     // Once we have the correct start block, handle the byte offset.
     offset = file->seek - position;
-    writePointer = (uint8_t *)getBlock(block) + offset;
 
     // Now, start copying bytes from the requested buffer.
-    readPointer = buffer;
     while (bytesCopied < size)
     {
-        // First, determine if we need to write a partial block.
+        uint32_t address = getBlock(block) + offset;
         segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
+        next = 0;
 
-        if (segmentLength != 0)
-            flash.flash_write(writePointer, readPointer, segmentLength, file->seek + bytesCopied < file->length ? getFreePage() : NULL);
+        // Coalesce the following blocks into the same write, for as long as they are physically adjacent and on the same page.
+        while (bytesCopied + segmentLength < size)
+        {
+            next = getNextWriteBlock(block);
+            if (next != block + 1 || getPage(next) != getPage(block))
+                break;
 
-        offset += segmentLength;
+            block = next;
+            next = 0;
+            segmentLength += min(size - bytesCopied - segmentLength, MBFS_BLOCK_SIZE);
+        }
+
+        writeFlash(address, buffer + bytesCopied, segmentLength, file->seek + bytesCopied < file->length ? getFreePage() : 0);
         bytesCopied += segmentLength;
-        readPointer += segmentLength;
 
-        if (offset == MBFS_BLOCK_SIZE && bytesCopied < size)
+        // Move on to the next block, if there is more to write. We may have run out of space while looking for it.
+        if (bytesCopied < size)
         {
-            newBlock = getFreeBlock();
-            if (newBlock == 0)
+            if (next == 0)
                 break;
 
-            fileTableWrite(newBlock, MBFS_EOF);
-            fileTableWrite(block, newBlock);
-
-            block = newBlock;
-
-            writePointer = (uint8_t *)getBlock(block);
+            block = next;
             offset = 0;
         }
     }
@@ -1213,6 +1955,30 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
     return bytesCopied;
 }
 
+/**
+  * Determine the block that follows the given block of a file being written,
+  * extending the file with a newly allocated block if the given block is the last.
+  *
+  * @param block A valid block number of the file.
+  * @return The next block of the file, or zero if the file could not be extended.
+  */
+uint16_t MicroBitFileSystem::getNextWriteBlock(uint16_t block)
+{
+    uint16_t next = getNextFileBlock(block);
+
+    if (next == MBFS_EOF)
+    {
+        next = getFreeBlock();
+        if (next == 0)
+            return 0;
+
+        fileTableWrite(next, MBFS_EOF);
+        fileTableWrite(block, next);
+    }
+
+    return next;
+}
+
 /**
   * Determines if the given filename is a valid filename for use in MicroBitFileSystem. 
   * valid filenames must be >0 characters in lenght, NULL temrinated and contain
@@ -1261,10 +2027,20 @@ bool MicroBitFileSystem::isValidFilename(const char *name)
   * @endcode
   */
 int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
+{
+    lock();
+    int r = _write(fd, buffer, size);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of write(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_write(int fd, uint8_t* buffer, int size)
 {
     FileDescriptor *file;
-    int bytesCopied = 0;
-    int segmentSize;
 
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
@@ -1276,20 +2052,81 @@ int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
     if (file == NULL || buffer == NULL || size == 0)
         return MICROBIT_INVALID_PARAMETER;
 
+    waitForAsync(file);
+
+    return writeFile(file, buffer, size);
+}
+
+/**
+  * Write data to the file asynchronously.
+  *
+  * The data is copied into a queue, and written at the current seek position by a background fiber,
+  * so the caller does not wait for FLASH to be erased or programmed. MBFS_EVT_ASYNC_COMPLETE(fd) is
+  * raised on DEVICE_ID_FILE_SYSTEM once the data has been written, and the number of bytes written
+  * can then be obtained with getAsyncResult(). Operations queued for a file are performed in order,
+  * and any other call on the same file (such as read(), write() or close()) first waits for them to complete.
+  *
+  * @param fd File handle
+  * @param buffer the buffer from which to write data. This may be reused as soon as the call returns.
+  * @param size number of bytes to write
+  * @return MICROBIT_OK if the data was queued, MICROBIT_NOT_SUPPORTED if the file system has not been
+  *         initialised or the scheduler is not running, MICROBIT_INVALID_PARAMETER if the given file
+  *         handle is invalid, or MICROBIT_NO_RESOURCES if more than MBFS_ASYNC_QUEUE_SIZE bytes
+  *         would be queued, or there is not enough memory to queue the data.
+  *
+  * @code
+  * MicroBitFileSystem f();
+  * int fd = f.open("test.txt", MB_WRITE);
+  * f.writeAsync(fd, (uint8_t *)"hello!", 7);
+  * fiber_wait_for_event(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_COMPLETE(fd));
+  * if(f.getAsyncResult(fd) != 7)
+  *    print("error writing");
+  * @endcode
+  */
+int MicroBitFileSystem::writeAsync(int fd, uint8_t* buffer, int size)
+{
+    FileDescriptor *file;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL || buffer == NULL || size <= 0)
+        return MICROBIT_INVALID_PARAMETER;
+
+    return queueAsync(file, buffer, size);
+}
+
+/**
+  * Write data to the given file, via its writeback cache if it has one.
+  *
+  * @param file FileDescriptor of the file to write
+  * @param buffer The start of the buffer to write
+  * @param size The number of bytes to write
+  * @return The number of bytes written.
+  */
+int MicroBitFileSystem::writeFile(FileDescriptor *file, uint8_t* buffer, int size)
+{
+    int bytesCopied = 0;
+    int segmentSize;
+
     // Determine how to handle the write. If the buffer size is less than our cache size, 
     // write the data via the cache. Otherwise, a direct write through is likely more efficient.
     // This may take a few iterations if the cache is already quite full.
-    if (size < MBFS_CACHE_SIZE)
+    if (size < file->cacheSize)
     {
         while (bytesCopied < size)
         {
-            segmentSize = min(size, MBFS_CACHE_SIZE - file->cacheLength);
-            memcpy(&file->cache[file->cacheLength], buffer, segmentSize);
+            segmentSize = min(size - bytesCopied, file->cacheSize - file->cacheLength);
+            memcpy(&file->cache[file->cacheLength], buffer + bytesCopied, segmentSize);
 
             file->cacheLength += segmentSize;
             bytesCopied += segmentSize;
             
-            if (file->cacheLength == MBFS_CACHE_SIZE)
+            if (file->cacheLength == file->cacheSize)
                 writeBack(file);
 
 
@@ -1320,9 +2157,22 @@ int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
   */
 int MicroBitFileSystem::remove(char const * filename)
 {
-    int fd = open(filename, MB_READ);
+    lock();
+    int r = _remove(filename);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of remove(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_remove(char const * filename)
+{
+    int fd = _open(filename, MB_READ);
     uint16_t block, nextBlock;
     uint16_t value;
+    DirectoryEntry d;
 
     // If the file can't be opened, then it is impossible to delete. Pass through any error codes.
     if (fd < 0)
@@ -1332,21 +2182,372 @@ int MicroBitFileSystem::remove(char const * filename)
 
     // To erase a file, all we need to do is mark its directory entry and data blocks as INVALID.
     // First mark the file table
-    block = file->dirent->first_block;
+    readFlash(file->dirent, &d, sizeof(DirectoryEntry));
+    block = d.first_block;
     while (block != MBFS_EOF)
     {
-        nextBlock = fileSystemTable[block];
+        nextBlock = getNextFileBlock(block);
         fileTableWrite(block, MBFS_DELETED);
         block = nextBlock;
     }
 
     // Mark the directory entry of this file as invalid.
     value = MBFS_DIRECTORY_ENTRY_DELETED;
-    flash.flash_write(&file->dirent->flags, &value, 2);
+    writeFlash(file->dirent + offsetof(DirectoryEntry, flags), &value, 2);
+    invalidateDirectoryCache();
+    status |= MBFS_STATUS_COMPACT_DIRECTORIES;
 
     // release file metadata
+    delete[] file->cache;
     delete file;
 
     return MICROBIT_OK;
 }
 
+/**
+  * Determine the amount of space available for file data.
+  * This includes blocks released by deleted files, which are recycled on demand.
+  *
+  * @return the number of bytes available, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+  *         or MICROBIT_NO_RESOURCES if there is not enough memory to track free blocks.
+  *
+  * @code
+  * MicroBitFileSystem f;
+  * if (f.getFreeSpace() < 1024)
+  *     print("file system nearly full");
+  * @endcode
+  */
+int MicroBitFileSystem::getFreeSpace()
+{
+    lock();
+    int r = _getFreeSpace();
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of getFreeSpace(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_getFreeSpace()
+{
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (freeBlockMap == NULL && buildFreeBlockMap() != MICROBIT_OK)
+        return MICROBIT_NO_RESOURCES;
+
+    return (freeBlockCount + deletedBlockCount) * MBFS_BLOCK_SIZE;
+}
+
+/**
+  * Determine how many times a physical page of the file system has been erased since it was mounted.
+  * Erase counts are held in RAM only, and restart from zero each time the file system is mounted.
+  *
+  * @param page The page to query, counting from zero at the start of the file system.
+  *
+  * @return the number of erases, MICROBIT_INVALID_PARAMETER if the page is out of range,
+  *         or MICROBIT_NOT_SUPPORTED if the file system is not initialised or erase counts are not available.
+  */
+int MicroBitFileSystem::getEraseCount(int page)
+{
+    if ((status & MBFS_STATUS_INITIALISED) == 0 || pageEraseCount == NULL)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (page < 0 || page >= fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE))
+        return MICROBIT_INVALID_PARAMETER;
+
+    return pageEraseCount[page];
+}
+
+/**
+  * Recycle the first block of the given directory (or its subdirectories) that holds deleted entries but no free ones.
+  *
+  * @param directory The address of the directory to compact.
+  * @return true if a block was recycled, false if there was nothing to do.
+  */
+bool MicroBitFileSystem::compactDirectory(uint32_t directory)
+{
+    DirectoryEntry d;
+    readFlash(directory, &d, sizeof(DirectoryEntry));
+
+    uint16_t block = d.first_block;
+
+    while (block != MBFS_EOF)
+    {
+        bool deleted = false;
+        bool free = false;
+
+        for (uint16_t entry = 0; entry < MBFS_BLOCK_SIZE / sizeof(DirectoryEntry); entry++)
+        {
+            uint32_t dirent = getBlock(block) + entry * sizeof(DirectoryEntry);
+            readFlash(dirent, &d, sizeof(DirectoryEntry));
+
+            if (d.flags & MBFS_DIRECTORY_ENTRY_FREE)
+                free = true;
+
+            else if ((d.flags & MBFS_DIRECTORY_ENTRY_VALID) == 0)
+                deleted = true;
+
+            else if (d.flags & MBFS_DIRECTORY_ENTRY_DIRECTORY && compactDirectory(dirent))
+                return true;
+        }
+
+        // A block with free entries is used up before deleted entries are reused, so there's no need to recycle it yet.
+        if (deleted && !free)
+        {
+            recycleBlock(block, MBFS_BLOCK_TYPE_DIRECTORY);
+            return true;
+        }
+
+        block = getNextFileBlock(block);
+    }
+
+    return false;
+}
+
+/**
+  * Perform one unit of compaction work, by recycling a directory block, a page of deleted blocks or the file table.
+  *
+  * @param reclaimBlocks true if deleted blocks should be recycled, false if only directories should be compacted.
+  * @return true if any work was done, false if there was nothing to do.
+  */
+bool MicroBitFileSystem::compactStep(bool reclaimBlocks)
+{
+    int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+    // Directories are only revisited after an entry has been deleted.
+    if (status & MBFS_STATUS_COMPACT_DIRECTORIES)
+    {
+        if (compactDirectory(rootDirectory))
+            return true;
+
+        status &= ~MBFS_STATUS_COMPACT_DIRECTORIES;
+    }
+
+    // Nothing more to do if no blocks are marked as DELETED.
+    if (!reclaimBlocks || deletedBlockCount == 0)
+        return false;
+
+    // Look for the next page holding a DELETED block whose data has not yet been erased.
+    // Blocks are only recycled to UNUSED once their data is erased, so the compactor must revisit any page
+    // holding a block deleted since it last looked, which we detect by looking at the data itself.
+    for (int page = 0; page < fileSystemSize / blocksPerPage; page++)
+    {
+        uint16_t block = compactionBlock;
+        compactionBlock = (compactionBlock + blocksPerPage) % fileSystemSize;
+
+        for (int i = 0; i < blocksPerPage; i++)
+        {
+            if (getNextFileBlock(block + i) == MBFS_DELETED && !isErased(block + i))
+            {
+                recycleBlock(block + i);
+                return true;
+            }
+        }
+    }
+
+    // The data of every DELETED block is erased, so mark them all as UNUSED.
+    for (uint16_t block = 0; getPage(block) < rootDirectory; block += blocksPerPage)
+        recycleBlock(block, MBFS_BLOCK_TYPE_FILETABLE);
+
+    return true;
+}
+
+/**
+  * Recycle blocks and directory entries released by deleted files, such that later writes need not do so.
+  *
+  * Directory blocks full of deleted entries are recycled first. Then each physical page holding the data of
+  * deleted files is erased in turn, and the file table is recycled once they all have been.
+  * This continues until nothing is left to compact, or the given time has passed.
+  * At least one page is processed, and a page erase can not be interrupted, so the budget may be exceeded.
+  *
+  * @param budget The time to spend compacting, in milliseconds.
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system is not initialised,
+  *         or MICROBIT_NO_RESOURCES if there is not enough memory to track free blocks.
+  */
+int MicroBitFileSystem::compact(uint32_t budget)
+{
+    lock();
+    int r = _compact(budget);
+    unlock();
+
+    return r;
+}
+
+/**
+  * Implementation of compact(), called with the file system lock held.
+  */
+int MicroBitFileSystem::_compact(uint32_t budget)
+{
+    CODAL_TIMESTAMP start = system_timer_current_time();
+
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (freeBlockMap == NULL && buildFreeBlockMap() != MICROBIT_OK)
+        return MICROBIT_NO_RESOURCES;
+
+    while (compactStep(true) && system_timer_current_time() - start < budget);
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Define how long the file system may spend compacting deleted blocks each time the processor is idle.
+  *
+  * @param budget The time to spend compacting, in milliseconds, or zero to disable idle compaction.
+  *
+  * @note Idle compaction is not available on a memory controller, whose I/O may block the idle thread
+  * or interleave with a foreground operation. Call compact() from a fiber instead.
+  */
+void MicroBitFileSystem::setCompactionBudget(uint32_t budget)
+{
+    // The idle thread must never block, so idle compaction is limited to internal flash.
+    compactionBudget = nvm ? 0 : budget;
+
+    if (compactionBudget)
+        status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    else
+        status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+}
+
+/**
+  * Add an operation to the asynchronous queue, waking the background worker if necessary.
+  *
+  * @param file FileDescriptor of the file to operate on.
+  * @param buffer The data to write, or NULL to flush the file.
+  * @param size The number of bytes to write.
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the scheduler is not running,
+  *         or MICROBIT_NO_RESOURCES if the queue is full.
+  */
+int MicroBitFileSystem::queueAsync(FileDescriptor *file, uint8_t* buffer, int size)
+{
+    // The background worker runs as an event handler, so needs both the scheduler and the message bus.
+    if (!fiber_scheduler_running() || EventModel::defaultEventBus == NULL)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (size > MBFS_ASYNC_QUEUE_SIZE - asyncQueueLength)
+        return MICROBIT_NO_RESOURCES;
+
+    MBFSAsyncRequest *request = (MBFSAsyncRequest *) malloc(sizeof(MBFSAsyncRequest) + size);
+    if (request == NULL)
+        return MICROBIT_NO_RESOURCES;
+
+    request->file = file;
+    request->next = NULL;
+    request->length = buffer ? size : -1;
+
+    if (buffer)
+        memcpy(request->data, buffer, size);
+
+    // Add the request to the end of the queue, such that operations are performed in order.
+    MBFSAsyncRequest **tail = &asyncQueue;
+    while (*tail)
+        tail = &(*tail)->next;
+
+    *tail = request;
+    asyncQueueLength += size;
+    file->asyncPending++;
+
+    if (!(status & MBFS_STATUS_ASYNC_LISTENING))
+    {
+        EventModel::defaultEventBus->listen(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_QUEUED, this, &MicroBitFileSystem::onAsyncRequest);
+        status |= MBFS_STATUS_ASYNC_LISTENING;
+    }
+
+    // Wake the background worker, if it isn't already running.
+    if (!(status & MBFS_STATUS_ASYNC_RUNNING))
+    {
+        status |= MBFS_STATUS_ASYNC_RUNNING;
+        Event(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_QUEUED);
+    }
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Block the calling fiber until all asynchronous operations queued for the given file are complete.
+  * Must be called with the file system lock held, which is released while waiting.
+  *
+  * @param file FileDescriptor of the file.
+  */
+void MicroBitFileSystem::waitForAsync(FileDescriptor *file)
+{
+    // The background worker needs the lock to make progress, so release it while waiting.
+    while (file->asyncPending)
+    {
+        unlock();
+        fiber_wait_for_event(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_COMPLETE(file->id));
+        lock();
+    }
+}
+
+/**
+  * Obtain exclusive access to the file system, blocking the calling fiber until any other operation is complete.
+  */
+void MicroBitFileSystem::lock()
+{
+    mutex.wait();
+    status |= MBFS_STATUS_LOCKED;
+}
+
+/**
+  * Release exclusive access to the file system, obtained with lock().
+  */
+void MicroBitFileSystem::unlock()
+{
+    status &= ~MBFS_STATUS_LOCKED;
+    mutex.notify();
+}
+
+/**
+  * Background worker. Performs queued asynchronous operations in order,
+  * raising MBFS_EVT_ASYNC_COMPLETE(fd) as each completes.
+  */
+void MicroBitFileSystem::onAsyncRequest(Event)
+{
+    while (asyncQueue)
+    {
+        // Leave the request at the head of the queue until it is complete, so that later requests are queued behind it.
+        MBFSAsyncRequest *request = asyncQueue;
+        FileDescriptor *file = request->file;
+
+        lock();
+
+        if (request->length < 0)
+            file->asyncResult = flushFile(file);
+        else
+            file->asyncResult = writeFile(file, request->data, request->length);
+
+        unlock();
+
+        asyncQueue = request->next;
+        asyncQueueLength -= max(request->length, 0);
+        file->asyncPending--;
+
+        Event(DEVICE_ID_FILE_SYSTEM, MBFS_EVT_ASYNC_COMPLETE(file->id));
+        free(request);
+
+        // Let any waiting fibers run before performing the next operation.
+        schedule();
+    }
+
+    status &= ~MBFS_STATUS_ASYNC_RUNNING;
+}
+
+/**
+  * Periodic callback from the scheduler idle thread.
+  * Compacts deleted blocks, within the compaction budget.
+  */
+void MicroBitFileSystem::idleCallback()
+{
+    // Leave the file system alone while a fiber or the background worker is part way through an operation.
+    if ((status & MBFS_STATUS_INITIALISED) == 0 || (status & (MBFS_STATUS_ASYNC_RUNNING | MBFS_STATUS_LOCKED)) || (freeBlockMap == NULL && buildFreeBlockMap() != MICROBIT_OK))
+        return;
+
+    CODAL_TIMESTAMP start = system_timer_current_time();
+    bool reclaimBlocks = freeBlockCount * 100 < fileSystemSize * MBFS_COMPACTION_RESERVE;
+
+    while (compactStep(reclaimBlocks) && system_timer_current_time() - start < compactionBudget);
+}
@@ -24,9 +24,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDevice.h"
 #include "ErrorNo.h"                
 
-#ifdef SOFTDEVICE_PRESENT
-#include "nrf_sdh_soc.h"
-#endif
+#include "NRF52FlashManager.h"
 
 using namespace codal;
 
@@ -34,6 +32,10 @@ using namespace codal;
 #define MIN(a,b) ((a)<(b)?(a):(b))
 #endif
 
+#ifndef MAX
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#endif
+
 #define WORD_ADDR(x) (((uint32_t)x) & 0xFFFFFFFC)
 
 /*
@@ -58,26 +60,6 @@ extern "C" void btle_set_user_evt_handler(void (*func)(uint32_t));
 //#pragma GCC diagnostic pop
 //#endif
 
-static volatile bool flash_op_complete = false;
-
-/*
- * When SoftDevice is present,
- * define an observer to receive system events.
- * Events are delivered here via nrf_sdh and nrf_sdh_soc
- * See NRF_SDH_DISPATCH_MODEL
- */
-#ifdef SOFTDEVICE_PRESENT
-
-static void nvmc_event_handler(uint32_t sys_evt, void *)
-{
-    if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS)
-        flash_op_complete = true;
-}
-
-NRF_SDH_SOC_OBSERVER( microbitflash_soc_observer, 0, nvmc_event_handler, NULL);
-
-#endif
-
 /**
   * Default Constructor
   */
@@ -115,35 +97,8 @@ int MicroBitFlash::need_erase(uint8_t* source, uint8_t* flash_addr, int len)
   */
 void MicroBitFlash::erase_page(uint32_t* pg_addr)
 {
-#ifdef SOFTDEVICE_PRESENT
-    if (ble_running())
-    {
-        flash_op_complete = false;
-        while(1)
-        {
-            if (sd_flash_page_erase(((uint32_t)pg_addr)/MICROBIT_CODEPAGESIZE) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else
-#endif
-    {
-        // Turn on flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
-
-        // Erase page:
-        NRF_NVMC->ERASEPAGE = (uint32_t)pg_addr;
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
-
-        // Turn off flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
-    }
+    // Scheduled through the SoftDevice when BLE is running, so that it doesn't disturb radio activity.
+    NRF52FlashManager::erasePage((uint32_t)pg_addr);
 }
 
 /**
@@ -157,41 +112,8 @@ void MicroBitFlash::erase_page(uint32_t* pg_addr)
   */
 void MicroBitFlash::flash_burn(uint32_t* addr, uint32_t* buffer, int size)
 {
-#ifdef SOFTDEVICE_PRESENT
-    if (ble_running())
-    {
-        // Schedule SoftDevice to write this memory for us, and wait for it to complete.
-        // This happens ASYNCHRONOUSLY when SD is enabled (and synchronously if disabled!!)
-        flash_op_complete = false;
-
-        while(1)
-        {
-            if (sd_flash_write(addr, buffer, size) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else
-#endif
-    {
-        // Turn on flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
-
-        for(int i=0;i<size;i++)
-        {
-            *(addr+i) = *(buffer+i);
-            while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
-        }
-
-        // Turn off flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
-    }
+    // Scheduled through the SoftDevice when BLE is running, so that it doesn't disturb radio activity.
+    NRF52FlashManager::program(addr, buffer, size);
 }
 
 /**
@@ -213,6 +135,30 @@ void MicroBitFlash::flash_burn(uint32_t* addr, uint32_t* buffer, int size)
   */
 int MicroBitFlash::flash_write(void* address, void* from_buffer,
                                int length, void* scratch_addr)
+{
+    MicroBitFlashSegment segment;
+
+    segment.address = address;
+    segment.buffer = from_buffer;
+    segment.length = length;
+
+    return flash_write(&segment, 1, scratch_addr);
+}
+
+/**
+  * Writes a number of regions of a single page of flash memory.
+  * Only the words changed are programmed. If any bit needs to be set, the page is
+  * rewritten once via the scratch page, however many of the regions need it.
+  * Where regions overlap, the last one given takes precedence.
+  *
+  * @param segments the regions to write. All must lie within the same page.
+  * @param count the number of regions.
+  * @param scratch_addr if specified, scratch page to use. Use default
+  *                     otherwise.
+  * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER.
+  */
+int MicroBitFlash::flash_write(MicroBitFlashSegment* segments, int count,
+                               void* scratch_addr)
 {
     // If no scratch_addr has been supplied use the default
     if(scratch_addr == NULL)
@@ -223,17 +169,31 @@ int MicroBitFlash::flash_write(void* address, void* from_buffer,
     if((uint32_t)scratch_addr & (MICROBIT_CODEPAGESIZE - 1))
         return MICROBIT_INVALID_PARAMETER;
 
+    if (count <= 0)
+        return MICROBIT_OK;
+
     // Locate the hardware FLASH page used by this operation.
-    int page = (uint32_t)address / MICROBIT_CODEPAGESIZE;
+    int page = (uint32_t)segments[0].address / MICROBIT_CODEPAGESIZE;
     uint32_t* pgAddr = (uint32_t*)(page * MICROBIT_CODEPAGESIZE);
 
-    // offset to write from within page.
-    int offset = (uint32_t)address % MICROBIT_CODEPAGESIZE;
+    // Determine the range of the page written, and whether we need to erase it.
+    int start = MICROBIT_CODEPAGESIZE;
+    int end = 0;
+    int erase = 0;
+
+    for (int s = 0; s < count; s++)
+    {
+        int offset = (uint32_t)segments[s].address - (uint32_t)pgAddr;
+
+        if (offset < 0 || segments[s].length < 0 || offset + segments[s].length > (int)MICROBIT_CODEPAGESIZE)
+            return MICROBIT_INVALID_PARAMETER;
+
+        start = MIN(start, (int) WORD_ADDR(offset));
+        end = MAX(end, (int) WORD_ADDR(offset + segments[s].length + 3));
+        erase |= need_erase((uint8_t *)segments[s].buffer, (uint8_t *)segments[s].address, segments[s].length);
+    }
 
     uint8_t* writeFrom = (uint8_t*)pgAddr;
-    int start = WORD_ADDR(offset);
-    int end = WORD_ADDR((offset+length+4));
-    int erase = need_erase((uint8_t *)from_buffer, (uint8_t *)address, length);
 
     // Preserve the data by writing to the scratch page.
     if(erase)
@@ -241,38 +201,74 @@ int MicroBitFlash::flash_write(void* address, void* from_buffer,
         if (!scratch_addr)
             return MICROBIT_INVALID_PARAMETER;
 
-        this->erase_page((uint32_t *)scratch_addr);
+        // The scratch page is often blank already (e.g. a free page provided by the file system), so only erase it if needed.
+        for (uint32_t *p = (uint32_t *)scratch_addr; p < (uint32_t *)scratch_addr + MICROBIT_CODEPAGESIZE/4; p++)
+        {
+            if (*p != 0xFFFFFFFF)
+            {
+                this->erase_page((uint32_t *)scratch_addr);
+                break;
+            }
+        }
 
-        this->flash_burn((uint32_t*)scratch_addr, pgAddr, MICROBIT_CODEPAGESIZE/4);
+        this->flash_update((uint32_t*)scratch_addr, pgAddr, MICROBIT_CODEPAGESIZE/4);
         this->erase_page(pgAddr);
         writeFrom = (uint8_t*)scratch_addr;
         start = 0;
         end = MICROBIT_CODEPAGESIZE;
     }
 
-    uint32_t writeWord = 0;
+    // Merge the new data with the old a few words at a time, and program any words that have changed.
+    uint32_t words[MICROBIT_FLASH_BURN_WORDS];
 
-    for(int i=start;i<end;i++)
+    for (int i = start; i < end; i += sizeof(words))
     {
-        int byteOffset = i%4;
+        int l = MIN((int)sizeof(words), end - i);
+        uint8_t *merged = (uint8_t *)words;
 
-        if(i >= offset && i < (offset + length))
-        {
-            // Write from buffer.
-            writeWord |= (((uint8_t *)from_buffer)[i-offset] << ((byteOffset)*8));
-        }
-        else
-        {
-            writeWord |= (writeFrom[i] << ((byteOffset)*8));
-        }
+        memcpy(merged, writeFrom + i, l);
 
-        if( ((i+1)%4) == 0)
+        for (int s = 0; s < count; s++)
         {
-            this->flash_burn(pgAddr + (i/4), &writeWord, 1);
-            writeWord = 0;
+            int offset = (uint32_t)segments[s].address - (uint32_t)pgAddr;
+            int from = MAX(offset, i);
+            int to = MIN(offset + segments[s].length, i + l);
+
+            if (from < to)
+                memcpy(merged + from - i, (uint8_t *)segments[s].buffer + from - offset, to - from);
         }
+
+        this->flash_update(pgAddr + i/4, words, l/4);
     }
 
     return MICROBIT_OK;
 }
 
+/**
+  * Write to flash memory, assuming that a write is valid (using need_erase),
+  * programming only the words that differ from the data already held.
+  * Consecutive words that differ are programmed in a single operation.
+  *
+  * @param addr address of memory to write to. Must be word aligned.
+  * @param buffer address to write from, must be word-aligned.
+  * @param len number of uint32_t words to write.
+  */
+void MicroBitFlash::flash_update(uint32_t* addr, uint32_t* buffer, int len)
+{
+    int i = 0;
+
+    while (i < len)
+    {
+        if (addr[i] == buffer[i])
+        {
+            i++;
+            continue;
+        }
+
+        int run = i;
+        while (i < len && addr[i] != buffer[i])
+            i++;
+
+        this->flash_burn(addr + run, buffer + run, i - run);
+    }
+}
@@ -52,14 +52,159 @@ static void writeNum(char *buf, uint32_t n)
     buf[i] = 0;
 }
 
+// Unsigned integers in binary records are stored in base 127, least significant digit first.
+// Every digit but the last has its top bit set. Hence no byte is ever 0xFF, which marks unused flash.
+static int writeVarint(uint8_t *buf, uint32_t v)
+{
+    int i = 0;
+    while (v >= 127)
+    {
+        buf[i++] = 0x80 | (v % 127);
+        v /= 127;
+    }
+    buf[i++] = v;
+
+    return i;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Render a fixed point number, with the given number of decimal places. buf must hold at least 24 characters.
+static int renderNumber(char *buf, int32_t mantissa, int decimals)
+{
+    char digits[12];
+    int n = 0;
+    int l = 0;
+    uint32_t u = mantissa < 0 ? -(uint32_t)mantissa : (uint32_t)mantissa;
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    while (n <= decimals)
+        digits[n++] = '0';
+
+    if (mantissa < 0)
+        buf[l++] = '-';
+
+    while (n)
+    {
+        if (n == decimals)
+            buf[l++] = '.';
+        buf[l++] = digits[--n];
+    }
+
+    return l;
+}
+
+// Render an unsigned 64 bit timestamp, with the given number of decimal places. buf must hold at least 24 characters.
+static int renderTimestamp(char *buf, uint64_t t, int decimals)
+{
+    char digits[21];
+    int n = 0;
+    int l = 0;
+
+    do {
+        digits[n++] = '0' + t % 10;
+        t /= 10;
+    } while (t);
+
+    while (n <= decimals)
+        digits[n++] = '0';
+
+    while (n)
+    {
+        if (n == decimals)
+            buf[l++] = '.';
+        buf[l++] = digits[--n];
+    }
+
+    return l;
+}
+
+// Determine if the given text is a number that renderNumber() would reproduce exactly, and if so parse it.
+static bool parseNumber(const char *s, int len, int32_t &mantissa, int &decimals)
+{
+    int64_t m = 0;
+    int dp = -1;
+    int i = 0;
+    char buf[24];
+
+    if (len == 0 || len > 12)
+        return false;
+
+    if (s[0] == '-')
+        i++;
+
+    for (; i < len; i++)
+    {
+        if (s[i] == '.' && dp < 0)
+        {
+            dp = 0;
+            continue;
+        }
+
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+
+        m = m * 10 + (s[i] - '0');
+        if (dp >= 0)
+            dp++;
+
+        if (m > 0x7FFFFFFF)
+            return false;
+    }
+
+    if (dp == 0)
+        return false;
+
+    mantissa = s[0] == '-' ? -(int32_t)m : (int32_t)m;
+    decimals = dp < 0 ? 0 : dp;
+
+    // Reject anything that doesn't round trip, such as leading zeroes or "-0".
+    return renderNumber(buf, mantissa, decimals) == len && memcmp(buf, s, len) == 0;
+}
+
+// FNV-1a hash of a column heading.
+static uint32_t hashKey(const char *s, uint32_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (uint32_t i=0; i<len; i++)
+    {
+        h ^= (uint8_t) s[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
 /**
  * Constructor.
  */
-MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, NRF52Serial &serial) : flash(flash), power(power), serial(serial), cache(flash, CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE, 4)
+MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &power, NRF52Serial &serial) : MicroBitMemoryConsumer("log"), flash(flash), power(power), serial(serial), cache(flash, CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE, 4)
 {
+    cache.setWriteBack(CONFIG_MICROBIT_LOG_CACHE_WRITE_BACK);
+    cache.setReadAhead(CONFIG_MICROBIT_LOG_CACHE_READ_AHEAD);
+
     this->journalPages = 0;
     this->status = 0;
     this->journalHead = 0;
+    this->journalCommitted = 0;
+    this->journalRows = 0;
+    this->journalTime = 0;
+    this->journalCommitBytes = CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_BYTES;
+    this->journalCommitRows = CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_ROWS;
+    this->journalCommitPeriod = CONFIG_MICROBIT_LOG_JOURNAL_COMMIT_PERIOD;
     this->startAddress = 0;
     this->journalStart = 0;
     this->dataStart = 0;
@@ -70,7 +215,42 @@ MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &p
     this->headingsChanged = false;
     this->timeStampChanged = false;
     this->rowData = NULL;
+    this->columnCapacity = 0;
+    this->columnIndex = NULL;
+    this->columnIndexSize = 0;
     this->timeStampFormat = TimeStampFormat::None;
+    this->storageFormat = StorageFormat::Text;
+    this->retention = RetentionPolicy::StopWhenFull;
+    this->ringSize = 0;
+    this->ringBase = 0;
+    this->ringSkipFrom = 0;
+    this->ringSkip = 0;
+    this->mirrorPolicy = SerialMirrorPolicy::Block;
+    this->mirroredRows = 0;
+    this->droppedRows = 0;
+    this->syncPending = false;
+    this->csvLengthValid = false;
+    this->csvLength = 0;
+    this->readAddress = 0;
+    this->readOffset = 0;
+    this->readBase = NULL;
+    this->readBaseCount = 0;
+    this->exportFormat = DataFormat::CSV;
+    this->exportLength = 0;
+    this->exportIndex = 0;
+    this->exportBuffer = NULL;
+    this->exportBufferStart = 0;
+    this->exportBufferLength = 0;
+    this->queue = NULL;
+    this->queueSize = CONFIG_MICROBIT_LOG_QUEUE_SIZE;
+    this->queueHead = 0;
+    this->queueLength = 0;
+    this->indexStart = 0;
+    this->indexCount = 0;
+    this->indexInterval = 0;
+    this->indexLast = 0;
+    this->indexSession = 0;
+    this->indexOpen = false;
 }
 
 /**
@@ -78,6 +258,9 @@ MicroBitLog::MicroBitLog(MicroBitUSBFlashManager &flash, MicroBitPowerManager &p
  */
 void MicroBitLog::init()
 {
+    // Complete any deferred invalidation before the log is used.
+    _invalidatePending();
+
     // If we're already initialized, do nothing. 
     if (status & MICROBIT_LOG_STATUS_INITIALIZED)
         return;
@@ -85,44 +268,22 @@ void MicroBitLog::init()
     if (_isPresent())
     {
         // We have a valid file system.
-        JournalEntry j;
+        storageFormat = metaData.version[MICROBIT_LOG_VERSION_FORMAT_INDEX] == MICROBIT_LOG_VERSION_BINARY[MICROBIT_LOG_VERSION_FORMAT_INDEX] ? StorageFormat::Binary : StorageFormat::Text;
+        retention = metaData.version[MICROBIT_LOG_VERSION_FORMAT_INDEX] == MICROBIT_LOG_VERSION_CIRCULAR[MICROBIT_LOG_VERSION_FORMAT_INDEX] ? RetentionPolicy::OverwriteOldest : RetentionPolicy::StopWhenFull;
         journalPages = (dataStart - journalStart) / flash.getPageSize();
         journalHead = journalStart;
         dataEnd = dataStart;
+        ringSize = ((logEnd - dataStart) / flash.getPageSize()) * flash.getPageSize();
+        ringSkipFrom = 0;
 
-        // Load the last entry in the journal.
-        uint32_t journalEntryAddress = journalHead;
-        bool valid = false;
-
-        while(journalEntryAddress < dataStart)
-        {
-            cache.read(journalEntryAddress, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
-
-            // If we have a valid reading follwed by an unused entry, we're done.
-            if (j.containsOnly(0xFF) && valid)
-                break;
-
-            // Parse valid entries. We continue processing to the last valid entry, just in case.
-            if (!j.containsOnly(0x00))
-            {
-                journalHead = journalEntryAddress;
-                dataEnd = dataStart + strtoul(j.length, NULL, 16);
-                valid = true;
-            }
-
-            journalEntryAddress += MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
-        }
+        // Load the last entry in the journal, then find the end of any data written after it.
+        _mountJournal();
 
-        // Walk the page indicated by dataEnd, and increment until an unused byte (0xFF) is found.
-        uint8_t d = 0;
-        while(dataEnd < logEnd)
-        {
-            cache.read(dataEnd, &d, 1);
-            if (d == 0xFF)
-                break;
+        journalRows = 0;
+        journalTime = system_timer_current_time();
 
-            dataEnd++;
-        }
+        _mountData();
+        _mountIndex();
 
         // Determine if we have any column headers defined
         // If so, parse them.
@@ -147,11 +308,13 @@ void MicroBitLog::init()
 
         headingLength = (int)(end-start);
 
+        // Any headings logged later follow those zeroed, even if there are none in use.
+        headingStart = start;
+
         // If we have a valid set of headers recorded, parse them in.
         if (headingLength > 0)
         {
-            headingStart = start;
-            headingCount = 0;
+            uint32_t count = 0;
 
             char *headers = (char *) malloc(headingLength);
             cache.read(start, headers, headingLength);
@@ -163,25 +326,34 @@ void MicroBitLog::init()
                 if (headers[i] == ',' || headers[i] == '\n')
                 {
                     headers[i] = 0;
-                    headingCount++;
+                    count++;
                 }
             }
 
             // Allocate a RAM buffer to hold key/value pairs matching those defined
-            rowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * headingCount);
+            _reserveColumns(count);
 
             // Populate each entry.
             int i=0;
-            for (uint32_t h=0; h<headingCount; h++)
+            for (uint32_t h=0; h<count; h++)
             {
-                new (&rowData[h]) ColumnEntry;
                 rowData[h].key = ManagedString(&headers[i]);
+                rowData[h].hash = hashKey(rowData[h].key.toCharArray(), rowData[h].key.length());
                 i = i + rowData[h].key.length() + 1;
             }
 
+            headingCount = count;
+            _indexColumns();
+
             free(headers);
         }
 
+        // Delta encoding bases aren't persisted, so restart them before logging any further binary rows.
+        // The CSV length of binary data is only calculated if it is needed.
+        syncPending = true;
+        csvLengthValid = false;
+        _resetReader();
+
         // We may be full here, but this is still a valid state.
         status |= MICROBIT_LOG_STATUS_INITIALIZED;
         return;
@@ -229,6 +401,8 @@ void MicroBitLog::_setVisibility(bool visible)
         return;
 
     // Otherwise update the configuration and remount the drive to ensure the user view is up to date.
+    // The interface chip serves the file directly from flash, so write back anything still cached first.
+    cache.flush();
     flash.setConfiguration(config, true);
     flash.remount();
 }
@@ -244,662 +418,2463 @@ void MicroBitLog::clear(bool fullErase)
 }
 
 /**
- * Reset all data stored in persistent storage.
+ * Locate the most recent journal entry, and set journalHead and dataEnd from it.
+ *
+ * Entries are written in order through each journal page, and each one is zeroed once its successor
+ * is written. So every page is either fully used (zeroes, with perhaps a valid last entry), or holds
+ * zeroes, then the latest valid entry, then unused (0xFF) entries. The first unused entry of the
+ * current page is found by binary search, and the entry before it is the latest.
  */
-void MicroBitLog::_clear(bool fullErase)
+void MicroBitLog::_mountJournal()
 {
-    // Calculate where our metadata should start.
-    startAddress = sizeof(header);
-    journalPages = CONFIG_MICROBIT_LOG_JOURNAL_SIZE / flash.getPageSize();
-    journalStart = startAddress + CONFIG_MICROBIT_LOG_METADATA_SIZE;
+    JournalEntry j;
+    uint32_t entriesPerPage = flash.getPageSize() / MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+
+    uint32_t length = 0;
+
     journalHead = journalStart;
-    dataStart = journalStart + CONFIG_MICROBIT_LOG_JOURNAL_SIZE;
-    dataEnd = dataStart;
-    logEnd = flash.getFlashEnd() - sizeof(uint32_t);
-    status &= MICROBIT_LOG_STATUS_SERIAL_MIRROR;
-    
-    // Remove any cached state around column headings
-    headingsChanged = false;
-    timeStampChanged = false;
-    headingStart = 0;
-    headingCount = 0;
-    headingLength = 0;
 
-    if (rowData)
+    for (uint32_t page = journalStart; page < dataStart; page += flash.getPageSize())
     {
-        free(rowData);
-        rowData = NULL;
-    }
+        // A page whose last entry is in use holds the latest entry only if that entry is valid.
+        cache.read(page + (entriesPerPage - 1) * MICROBIT_LOG_JOURNAL_ENTRY_SIZE, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
 
-    // Erase block associated with the FULL indicator. We don't perform a pag eerase here to reduce flash wear.
-    uint32_t zero = 0x00000000;
-    flash.write(logEnd, &zero, 1);
+        if (!j.containsOnly(0xFF))
+        {
+            if (!j.containsOnly(0x00))
+            {
+                journalHead = page + (entriesPerPage - 1) * MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+                length = strtoul(j.length, NULL, 16);
+            }
 
-    // Erase all pages associated with the header, all meta data and the first page of data storage.
-    cache.clear();
-    for (uint32_t p = flash.getFlashStart(); p <= (fullErase ? logEnd : dataStart); p += flash.getPageSize())
-        flash.erase(p);
+            continue;
+        }
 
-    // Serialise and write header (if we have one)
-    // n.b. we use flash.write() here to avoid unecessary preheating of the cache.
-    flash.write(flash.getFlashStart(), (uint32_t *)header, sizeof(header)/4);
+        // Find the first unused entry in this page.
+        uint32_t low = 0;
+        uint32_t high = entriesPerPage - 1;
 
-    // Generate and write FS metadata
-    memcpy(metaData.version, MICROBIT_LOG_VERSION, 18);
-    memcpy(metaData.dataStart, "0x00000000\0", 11);
-    memcpy(metaData.logEnd, "0x00000000\0", 11);
-    memcpy(metaData.daplinkVersion, "0000\0", 5);
+        while (low < high)
+        {
+            uint32_t mid = (low + high) / 2;
+            cache.read(page + mid * MICROBIT_LOG_JOURNAL_ENTRY_SIZE, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
 
-    MicroBitVersion versions = power.getVersion();
-    ManagedString verStr = padString(versions.daplink > 9999 ? 9999 : versions.daplink, 4);
-    memcpy(metaData.daplinkVersion, verStr.toCharArray(), 4);
-    writeNum(metaData.dataStart+2, dataStart);
-    writeNum(metaData.logEnd+2, logEnd);
+            if (j.containsOnly(0xFF))
+                high = mid;
+            else
+                low = mid + 1;
+        }
 
-    cache.write(startAddress, &metaData, sizeof(metaData));
+        // The entry before it is the latest. If the page is entirely unused, the latest entry (if any) was the last one of the previous page.
+        if (low > 0)
+        {
+            cache.read(page + (low - 1) * MICROBIT_LOG_JOURNAL_ENTRY_SIZE, j.length, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
 
-    // Record that the log is empty
-    JournalEntry je;
-    cache.write(journalHead, &je, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+            if (!j.containsOnly(0x00))
+            {
+                journalHead = page + (low - 1) * MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+                length = strtoul(j.length, NULL, 16);
+            }
+        }
 
-    // Update physical file size and visibility information.
-    // If we're doing a full erase, remove the file from view.
-    _setVisibility(!fullErase);
+        break;
+    }
 
-    status |= MICROBIT_LOG_STATUS_INITIALIZED;
+    // The journal records the logical length of the data. In a circular log, this includes every lap of the ring.
+    journalCommitted = length;
+    ringBase = 0;
 
-    // Refresh timestamp settings, to inject the timestamp field into the key value pairs.
-    _setTimeStamp(this->timeStampFormat);
-}
+    if (retention == RetentionPolicy::OverwriteOldest)
+    {
+        ringBase = length - (length % ringSize);
+        length = length % ringSize;
+    }
 
-/**
- * Determines the format of the timestamp data to be added (if any).
- * If requested, time stamps will be automatically added to each row of data
- * as an integer value rounded down to the unit specified.
- * 
- * @param format The format of timestamp to use. 
- */
-void MicroBitLog::setTimeStamp(TimeStampFormat format)
-{
-    mutex.wait();
-    _setTimeStamp(format);
-    mutex.notify();
+    dataEnd = dataStart + length;
 }
 
 /**
- * Determines the format of the timestamp data to be added (if any).
- * If requested, time stamps will be automatically added to each row of data
- * as an integer value rounded down to the unit specified.
- * 
- * @param format The format of timestamp to use. 
+ * Move dataEnd on from the position recorded in the journal to the first unused (0xFF) byte of the data section.
+ *
+ * Stored data never contains 0xFF, and the page after the current one is erased before data is written
+ * to it. So any page whose last byte is still in use is full, and in the page holding the end, used
+ * bytes are followed only by unused ones. Full pages are skipped with a single read, and the end is found
+ * by binary search within its page. A circular log is searched in the same way, wrapping around the ring.
  */
-void MicroBitLog::_setTimeStamp(TimeStampFormat format)
+void MicroBitLog::_mountData()
 {
-    init();
+    bool circular = retention == RetentionPolicy::OverwriteOldest;
+    uint32_t limit = circular ? dataStart + ringSize : logEnd;
+    uint8_t d;
 
-    // Optimize out null operations.
-    if (timeStampFormat == format && timeStampFormat == TimeStampFormat::None)
-        return;
+    // A circular log always has an unused page ahead of the data, so one lap of the ring is enough to find the end.
+    for (uint32_t pages = 0; pages <= (limit - dataStart) / flash.getPageSize() + 1; pages++)
+    {
+        // In a circular log, data continues from the start of the ring.
+        if (circular && dataEnd >= limit)
+        {
+            dataEnd = dataStart;
+            ringBase += ringSize;
+        }
 
-    // If we do not have a timestamp column associated with the requested time unit, create one.
-    ManagedString units;
+        if (dataEnd >= limit)
+            break;
 
-    switch (format) {
+        uint32_t pageEnd = min((dataEnd / flash.getPageSize() + 1) * flash.getPageSize(), limit);
 
-    case TimeStampFormat::None:
-        break;
+        cache.read(pageEnd - 1, &d, 1);
 
-    case TimeStampFormat::Milliseconds:
-        units = "milliseconds";
-        break;
+        if (d != 0xFF)
+        {
+            dataEnd = pageEnd;
+            continue;
+        }
 
-    case TimeStampFormat::Seconds:
-        units = "seconds";
-        break;
+        // Find the first unused byte in [dataEnd, pageEnd).
+        uint32_t high = pageEnd - 1;
 
-    case TimeStampFormat::Minutes:
-        units = "minutes";
-        break;
+        while (dataEnd < high)
+        {
+            uint32_t mid = (dataEnd + high) / 2;
+            cache.read(mid, &d, 1);
 
-    case TimeStampFormat::Hours:
-        units = "hours";
-        break;
+            if (d == 0xFF)
+                high = mid;
+            else
+                dataEnd = mid + 1;
+        }
 
-    case TimeStampFormat::Days:
-        units = "days";
         break;
     }
+}
 
-    timeStampHeading = "Time (" + units + ")";
+/**
+ * Load the time index, invalidating any entries that refer to data which never reached flash.
+ */
+void MicroBitLog::_mountIndex()
+{
+    uint32_t capacity = CONFIG_MICROBIT_LOG_INDEX_SIZE / sizeof(MicroBitLogIndexEntry);
+    MicroBitLogIndexEntry e;
 
-    // Special case for selecting timestamp headings before the first data is logged.
-    // Here, we permit rewriting of Timestamp columns to promote simplicity.
-    if (dataStart == dataEnd && headingCount > 0)
+    indexCount = 0;
+    indexInterval = max((uint32_t) CONFIG_MICROBIT_LOG_INDEX_INTERVAL, (logEnd - dataStart) / (capacity / 2 + 1));
+    indexLast = 0;
+    indexSession = 0;
+    indexOpen = false;
+
+    // Logs formatted without an index use the whole of the flash for data. Circular logs are never indexed.
+    indexStart = logEnd + sizeof(uint32_t);
+
+    if (CONFIG_MICROBIT_LOG_INDEX_SIZE == 0 || indexStart + CONFIG_MICROBIT_LOG_INDEX_SIZE != flash.getFlashEnd() || retention == RetentionPolicy::OverwriteOldest)
     {
-        // If this timestamp has already been added. If so, nothing to do.
-        if (rowData[0].key == timeStampHeading)
-            return;
+        indexStart = 0;
+        return;
+    }
 
-        // If we've already defined a timestamp heading, remove that timestamp from the list of headings.
-        if (this->timeStampFormat != TimeStampFormat::None)
-        {
-            // Remove the Timestamp column from the list of headings.
-            for (uint32_t i=1; i<headingCount; i++)
-                rowData[i-1].key = rowData[i].key;
+    while (indexCount < capacity)
+    {
+        _readIndex(indexCount, e);
+
+        if (e.offset == 0xFFFFFFFF && e.address == 0xFFFFFFFF && e.time == 0xFFFFFFFF && e.session == 0xFFFFFFFF)
+            break;
 
-            headingCount--;
+        // An entry is written before its row, so may refer to data lost in a reset, or have been only partly written.
+        // Zero it, so that it isn't mistaken for the start of the data logged after it.
+        if (e.address != 0 && (e.address < dataStart || e.address > dataEnd || e.session == 0xFFFFFFFF))
+        {
+            memclr(&e, sizeof(e));
+            cache.write(indexStart + indexCount * sizeof(MicroBitLogIndexEntry), &e, sizeof(e));
         }
-    }
 
-    // Update our record of the latest timestamp format that we are using.
-    this->timeStampFormat = format;
+        if (e.address)
+            indexSession = e.session + 1;
 
-    // Indicate that we should update column headers the next time a row is logged.
-    this->timeStampChanged = true;
+        indexCount++;
+    }
 }
 
 /**
- * Defines if data logging should also be streamed over the serial port.
- *
- * @param enable True to enable serial port streaming, false to disable.
+ * Record the start of the row about to be written in the time index, if it is due an entry.
+ * The first row of each session is always indexed, so that seekToTime() can tell where the session starts.
  */
-void MicroBitLog::setSerialMirroring(bool enable)
+void MicroBitLog::_indexRow()
 {
-    if (enable)
-        status |= MICROBIT_LOG_STATUS_SERIAL_MIRROR;
+    MicroBitLogIndexEntry e;
+    uint32_t address = dataEnd + queueLength;
+
+    if (indexStart == 0 || indexCount >= CONFIG_MICROBIT_LOG_INDEX_SIZE / sizeof(MicroBitLogIndexEntry))
+        return;
+
+    if (indexOpen && address - indexLast < indexInterval)
+        return;
+
+    if (storageFormat == StorageFormat::Binary)
+    {
+        // The CSV length of binary data is only calculated if it is needed. It is here, once per session.
+        if (!csvLengthValid)
+        {
+            _flush();
+            _getCsvLength();
+            address = dataEnd;
+        }
+
+        // Restart the delta encoding bases, so that rows can be expanded from this one without reading those before it.
+        for (uint32_t i=0; i<headingCount; i++)
+            rowData[i].previous = 0;
+
+        syncPending = true;
+        e.offset = csvLength;
+    }
     else
-        status &= ~MICROBIT_LOG_STATUS_SERIAL_MIRROR;
+    {
+        e.offset = address - dataStart;
+    }
+
+    e.address = address;
+    e.time = (uint32_t) system_timer_current_time();
+    e.session = indexSession;
+
+    cache.write(indexStart + indexCount * sizeof(MicroBitLogIndexEntry), &e, sizeof(e));
+
+    indexCount++;
+    indexLast = address;
+    indexOpen = true;
 }
 
 /**
- * Creates a new row in the log, ready to be populated by logData()
- * 
- * @return DEVICE_OK on success.
+ * Read the given entry of the time index.
  */
-int MicroBitLog::beginRow()
+void MicroBitLog::_readIndex(uint32_t entry, MicroBitLogIndexEntry &e)
 {
-    int r;
-
-    mutex.wait();
-    r = _beginRow();
-    mutex.notify();
-
-    return r;
+    cache.read(indexStart + entry * sizeof(MicroBitLogIndexEntry), &e, sizeof(e));
 }
 
-
 /**
- * Creates a new row in the log, ready to be populated by logData()
- * 
- * @return DEVICE_OK on success.
+ * Find the last valid entry of the time index at or before the given offset in the CSV data.
+ * @return true if such an entry was found, false otherwise.
  */
-int MicroBitLog::_beginRow()
+bool MicroBitLog::_findIndex(uint32_t offset, MicroBitLogIndexEntry &e)
 {
-    init();
+    MicroBitLogIndexEntry m;
+    uint32_t low = 0;
+    uint32_t high = indexStart ? indexCount : 0;
+    bool found = false;
 
-    // If beginRow is called during an open transaction, implicity perform an endRow before proceeding.
+    // Entries are in order of offset. Any invalidated when the log was mounted are zeroed, and skipped over.
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        uint32_t valid = mid;
+
+        _readIndex(valid, m);
+        while (m.address == 0 && valid > low)
+            _readIndex(--valid, m);
+
+        if (m.address == 0)
+        {
+            low = mid + 1;
+        }
+        else if (m.offset <= offset)
+        {
+            e = m;
+            found = true;
+            low = mid + 1;
+        }
+        else
+        {
+            high = valid;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Position the binary reader at or before the given offset in the CSV data, moving it on to the nearest
+ * indexed row if that is closer than the current position.
+ */
+void MicroBitLog::_seekReader(uint32_t offset)
+{
+    MicroBitLogIndexEntry e;
+
+    if (offset < readOffset)
+        _resetReader();
+
+    if (_findIndex(offset, e) && e.offset > readOffset)
+    {
+        // Each indexed row starts with a MICROBIT_LOG_RECORD_SYNC, so the bases are zero there.
+        readAddress = e.address;
+        readOffset = e.offset;
+        readRecord = ManagedString::EmptyString;
+
+        if (readBase)
+            memset(readBase, 0, readBaseCount * sizeof(int32_t));
+    }
+}
+
+/**
+ * Determines if the header and metadata held in flash match header[] and metaData, so need not be written again.
+ */
+bool MicroBitLog::_headerMatches()
+{
+    uint32_t block[CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE / sizeof(uint32_t)];
+    MicroBitLogMetaData m;
+
+    // n.b. we use flash.read() here to avoid unecessary preheating of the cache.
+    for (uint32_t i = 0; i < sizeof(header); i += sizeof(block))
+    {
+        uint32_t l = min(sizeof(block), sizeof(header) - i);
+
+        flash.read(block, flash.getFlashStart() + i, l / 4);
+        if (memcmp(block, &header[i], l) != 0)
+            return false;
+    }
+
+    flash.read((uint32_t *)&m, startAddress, sizeof(m)/4);
+    return memcmp(&m, &metaData, (sizeof(m)/4)*4) == 0;
+}
+
+/**
+ * Reset all data stored in persistent storage.
+ *
+ * If the log is mounted, only what has changed is rewritten. The header and metadata are kept if they already
+ * match, an empty journal entry is appended rather than the journal being erased, and data pages are erased
+ * ahead of the data as it is written, as usual. A full erase of the rest of the data is queued in the background.
+ */
+void MicroBitLog::_clear(bool fullErase)
+{
+    // Mount any existing log first, so that whatever it already holds in flash can be reused.
+    if (!(status & (MICROBIT_LOG_STATUS_INITIALIZED | MICROBIT_LOG_STATUS_INVALIDATE_PENDING)) && _isPresent())
+        init();
+
+    // Note the layout of the log being replaced, if it's mounted.
+    uint32_t oldDataStart = dataStart;
+    uint32_t oldLogEnd = logEnd;
+    uint32_t oldHeadingEnd = headingStart ? headingStart + headingLength : sizeof(header) + sizeof(MicroBitLogMetaData);
+    uint32_t oldIndexEnd = indexStart + indexCount * sizeof(MicroBitLogIndexEntry);
+    bool mounted = status & MICROBIT_LOG_STATUS_INITIALIZED;
+
+    // Calculate where our metadata should start.
+    startAddress = sizeof(header);
+    journalPages = CONFIG_MICROBIT_LOG_JOURNAL_SIZE / flash.getPageSize();
+    journalStart = startAddress + CONFIG_MICROBIT_LOG_METADATA_SIZE;
+    dataStart = journalStart + CONFIG_MICROBIT_LOG_JOURNAL_SIZE;
+    dataEnd = dataStart;
+
+    // The time index takes the end of the flash, followed by the FULL indicator.
+    // (It is kept clear of the journal and the data, so that they remain where the HTML viewer expects them).
+    indexStart = CONFIG_MICROBIT_LOG_INDEX_SIZE ? flash.getFlashEnd() - CONFIG_MICROBIT_LOG_INDEX_SIZE : flash.getFlashEnd();
+    logEnd = indexStart - sizeof(uint32_t);
+    ringSize = ((logEnd - dataStart) / flash.getPageSize()) * flash.getPageSize();
+    ringBase = 0;
+    ringSkipFrom = 0;
+    status &= (MICROBIT_LOG_STATUS_SERIAL_MIRROR | MICROBIT_LOG_STATUS_QUEUE_LISTENING | MICROBIT_LOG_STATUS_QUEUE_DRAINING);
+
+    // The journal and any old headings can only be reused if they are where this log expects them.
+    mounted = mounted && oldDataStart == dataStart && oldLogEnd == logEnd;
+
+    // Discard any data still waiting to be written.
+    queueHead = 0;
+    queueLength = 0;
+
+    // Any export in progress now has nothing to export.
+    exportLength = 0;
+    exportIndex = 0;
+    exportBufferLength = 0;
+    
+    // Remove any cached state around column headings
+    headingsChanged = false;
+    timeStampChanged = false;
+    headingStart = 0;
+    headingCount = 0;
+    headingLength = 0;
+
+    _freeColumns();
+
+    // Erase block associated with the FULL indicator. We don't perform a pag eerase here to reduce flash wear.
+    uint32_t zero = 0x00000000;
+    flash.write(logEnd, &zero, 1);
+
+    // Generate FS metadata
+    if (retention == RetentionPolicy::OverwriteOldest)
+        memcpy(metaData.version, MICROBIT_LOG_VERSION_CIRCULAR, 18);
+    else
+        memcpy(metaData.version, storageFormat == StorageFormat::Binary ? MICROBIT_LOG_VERSION_BINARY : MICROBIT_LOG_VERSION, 18);
+    memcpy(metaData.dataStart, "0x00000000\0", 11);
+    memcpy(metaData.logEnd, "0x00000000\0", 11);
+    memcpy(metaData.daplinkVersion, "0000\0", 5);
+
+    MicroBitVersion versions = power.getVersion();
+    ManagedString verStr = padString(versions.daplink > 9999 ? 9999 : versions.daplink, 4);
+    memcpy(metaData.daplinkVersion, verStr.toCharArray(), 4);
+    writeNum(metaData.dataStart+2, dataStart);
+    writeNum(metaData.logEnd+2, logEnd);
+
+    // The header page need only be erased if its contents differ, or if there's little space left for headings.
+    // Old headings are otherwise zeroed, and skipped over when the log is mounted.
+    bool rewrite = !mounted || oldHeadingEnd + CONFIG_MICROBIT_LOG_METADATA_SIZE / 2 > journalStart || !_headerMatches();
+
+    cache.clear();
+
+    if (rewrite)
+    {
+        for (uint32_t p = flash.getFlashStart(); p < journalStart; p += flash.getPageSize())
+            flash.erase(p);
+
+        // Serialise and write header (if we have one)
+        // n.b. we use flash.write() here to avoid unecessary preheating of the cache.
+        flash.write(flash.getFlashStart(), (uint32_t *)header, sizeof(header)/4);
+        cache.write(startAddress, &metaData, sizeof(metaData));
+    }
+    else
+    {
+        ManagedBuffer cleared(oldHeadingEnd - (startAddress + sizeof(MicroBitLogMetaData)));
+
+        cache.write(startAddress + sizeof(MicroBitLogMetaData), &cleared[0], cleared.length());
+        headingStart = oldHeadingEnd;
+    }
+
+    // Erase the first page of data storage, so that the end of the (empty) data is found when the log is next mounted.
+    // Have the next page erased in the background, or the rest of the log if a full erase was requested.
+    flash.erase(dataStart);
+
+    uint32_t eraseEnd = fullErase ? ((logEnd + sizeof(uint32_t) + flash.getPageSize() - 1) / flash.getPageSize()) * flash.getPageSize() : dataStart + 2 * flash.getPageSize();
+
+    if (flash.eraseAhead(dataStart + flash.getPageSize(), (eraseEnd - dataStart - flash.getPageSize()) / sizeof(uint32_t)) != DEVICE_OK && fullErase)
+    {
+        for (uint32_t p = dataStart + flash.getPageSize(); p < eraseEnd; p += flash.getPageSize())
+            flash.erase(p);
+    }
+
+    // Only the pages of the index that have been used need erasing.
+    if (!mounted)
+        oldIndexEnd = flash.getFlashEnd();
+
+    for (uint32_t p = indexStart; p < oldIndexEnd && p < flash.getFlashEnd(); p += flash.getPageSize())
+        flash.erase(p);
+
+    // Circular logs are not indexed, as their oldest rows are overwritten.
+    if (CONFIG_MICROBIT_LOG_INDEX_SIZE == 0 || retention == RetentionPolicy::OverwriteOldest)
+        indexStart = 0;
+
+    indexCount = 0;
+    indexInterval = max((uint32_t) CONFIG_MICROBIT_LOG_INDEX_INTERVAL, (logEnd - dataStart) / (CONFIG_MICROBIT_LOG_INDEX_SIZE / sizeof(MicroBitLogIndexEntry) / 2 + 1));
+    indexLast = 0;
+    indexSession = 0;
+    indexOpen = false;
+
+    // Record that the log is empty. If the journal is in use, this is its next entry, with the journal erased
+    // a page at a time as it fills, as usual. Otherwise the journal is erased, and this is its first entry.
+    if (mounted)
+    {
+        _commitJournal();
+    }
+    else
+    {
+        for (uint32_t p = journalStart; p < dataStart; p += flash.getPageSize())
+            flash.erase(p);
+
+        JournalEntry je;
+        journalHead = journalStart;
+        cache.write(journalHead, &je, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+    }
+
+    journalCommitted = 0;
+    journalRows = 0;
+    journalTime = system_timer_current_time();
+
+    // Update physical file size and visibility information.
+    // If we're doing a full erase, remove the file from view.
+    _setVisibility(!fullErase);
+
+    // The log is empty, so there is nothing to expand.
+    syncPending = false;
+    csvLength = 0;
+    csvLengthValid = true;
+    _resetReader();
+
+    status |= MICROBIT_LOG_STATUS_INITIALIZED;
+
+    // Refresh timestamp settings, to inject the timestamp field into the key value pairs.
+    _setTimeStamp(this->timeStampFormat);
+}
+
+/**
+ * Determines the format of the timestamp data to be added (if any).
+ * If requested, time stamps will be automatically added to each row of data
+ * as an integer value rounded down to the unit specified.
+ * 
+ * @param format The format of timestamp to use. 
+ */
+void MicroBitLog::setTimeStamp(TimeStampFormat format)
+{
+    mutex.wait();
+    _setTimeStamp(format);
+    mutex.notify();
+}
+
+/**
+ * Determines the format of the timestamp data to be added (if any).
+ * If requested, time stamps will be automatically added to each row of data
+ * as an integer value rounded down to the unit specified.
+ * 
+ * @param format The format of timestamp to use. 
+ */
+void MicroBitLog::_setTimeStamp(TimeStampFormat format)
+{
+    init();
+
+    // Optimize out null operations.
+    if (timeStampFormat == format && timeStampFormat == TimeStampFormat::None)
+        return;
+
+    // If we do not have a timestamp column associated with the requested time unit, create one.
+    ManagedString units;
+
+    switch (format) {
+
+    case TimeStampFormat::None:
+        break;
+
+    case TimeStampFormat::Milliseconds:
+        units = "milliseconds";
+        break;
+
+    case TimeStampFormat::Seconds:
+        units = "seconds";
+        break;
+
+    case TimeStampFormat::Minutes:
+        units = "minutes";
+        break;
+
+    case TimeStampFormat::Hours:
+        units = "hours";
+        break;
+
+    case TimeStampFormat::Days:
+        units = "days";
+        break;
+    }
+
+    timeStampHeading = "Time (" + units + ")";
+
+    // Special case for selecting timestamp headings before the first data is logged.
+    // Here, we permit rewriting of Timestamp columns to promote simplicity.
+    if (_isEmpty() && headingCount > 0)
+    {
+        // If this timestamp has already been added. If so, nothing to do.
+        if (rowData[0].key == timeStampHeading)
+            return;
+
+        // If we've already defined a timestamp heading, remove that timestamp from the list of headings.
+        if (this->timeStampFormat != TimeStampFormat::None)
+        {
+            // Remove the Timestamp column from the list of headings.
+            for (uint32_t i=1; i<headingCount; i++)
+            {
+                rowData[i-1].key = rowData[i].key;
+                rowData[i-1].hash = rowData[i].hash;
+            }
+
+            rowData[--headingCount].key = ManagedString::EmptyString;
+            _indexColumns();
+        }
+    }
+
+    // Update our record of the latest timestamp format that we are using.
+    this->timeStampFormat = format;
+
+    // Indicate that we should update column headers the next time a row is logged.
+    this->timeStampChanged = true;
+}
+
+/**
+ * Defines if data logging should also be streamed over the serial port.
+ *
+ * With SerialMirrorPolicy::DropRow, each row is queued for transmission only if it fits in the serial
+ * transmit buffer in full, so the serial port never limits the rate of logging. Rows that do not fit
+ * are counted by getSerialMirrorDropped(). The default transmit buffer (CODAL_SERIAL_DEFAULT_BUFFER_SIZE,
+ * 20 bytes) is smaller than most rows, so enlarge it with uBit.serial.setTxBufferSize() to hold the
+ * longest row plus two bytes for its line ending. Rows too long for even an empty buffer are truncated
+ * to fit once the buffer has drained, rather than always dropped.
+ *
+ * @param enable True to enable serial port streaming, false to disable.
+ * @param policy What to do with a row when the serial port cannot accept it immediately.
+ */
+void MicroBitLog::setSerialMirroring(bool enable, SerialMirrorPolicy policy)
+{
+    mutex.wait();
+
+    mirrorPolicy = policy;
+
+    if (enable)
+        status |= MICROBIT_LOG_STATUS_SERIAL_MIRROR;
+    else
+        status &= ~MICROBIT_LOG_STATUS_SERIAL_MIRROR;
+
+    mutex.notify();
+}
+
+/**
+ * Determines the number of rows sent to the serial port since the counters were last reset.
+ * @return The number of rows mirrored.
+ */
+uint32_t MicroBitLog::getSerialMirrorCount()
+{
+    return mirroredRows;
+}
+
+/**
+ * Determines the number of rows not sent to the serial port, because its transmit buffer was full.
+ * @return The number of rows dropped.
+ */
+uint32_t MicroBitLog::getSerialMirrorDropped()
+{
+    return droppedRows;
+}
+
+/**
+ * Resets the serial mirroring counters to zero.
+ */
+void MicroBitLog::resetSerialMirrorCounters()
+{
+    mutex.wait();
+    mirroredRows = 0;
+    droppedRows = 0;
+    mutex.notify();
+}
+
+/**
+ * Send a line of text to the serial port, according to the mirroring policy.
+ * @param s the line to send, ending in a newline, which is sent as "\r\n".
+ * @param l the length of the line, in bytes.
+ */
+void MicroBitLog::_mirror(const char *s, uint32_t l)
+{
+    if (l == 0)
+        return;
+
+    if (mirrorPolicy == SerialMirrorPolicy::DropRow)
+    {
+        // Only queue whole lines, so the receiver never sees a partial row.
+        // The transmit buffer is circular, so holds one byte less than its size.
+        int capacity = serial.getTxBufferSize() - 1;
+        int space = capacity - serial.txBufferedSize();
+
+        // A row too long to ever fit is truncated instead, but only into an empty buffer, so it still starts a line.
+        bool fits = space >= (int)l + 1;
+        bool truncate = !fits && space == capacity && capacity >= 3;
+
+        if (serial.txInUse() || !(fits || truncate))
+        {
+            droppedRows++;
+            return;
+        }
+
+        serial.send((uint8_t *)s, min((int)l - 1, space - 2), ASYNC);
+        serial.send((uint8_t *)"\r\n", 2, ASYNC);
+    }
+    else
+    {
+        serial.send((uint8_t *)s, l-1);
+        serial.send((uint8_t *)"\r\n", 2);
+    }
+
+    mirroredRows++;
+}
+
+/**
+ * Defines how rows are stored in flash.
+ *
+ * @param format The format to store rows in.
+ * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the log already contains data, or DEVICE_NOT_SUPPORTED
+ * if the format cannot be used with the current retention policy.
+ */
+int MicroBitLog::setStorageFormat(StorageFormat format)
+{
+    int r = DEVICE_OK;
+
+    mutex.wait();
+    init();
+
+    if (format != storageFormat)
+    {
+        if (format == StorageFormat::Binary && retention == RetentionPolicy::OverwriteOldest)
+        {
+            r = DEVICE_NOT_SUPPORTED;
+        }
+        else if (_isEmpty())
+        {
+            // The format is recorded in the metadata, which can only be rewritten by erasing it.
+            storageFormat = format;
+            _clear(false);
+        }
+        else
+        {
+            r = DEVICE_INVALID_STATE;
+        }
+    }
+
+    mutex.notify();
+    return r;
+}
+
+/**
+ * Determines how rows are stored in flash.
+ * @return The current storage format.
+ */
+StorageFormat MicroBitLog::getStorageFormat()
+{
+    StorageFormat f;
+
+    mutex.wait();
+    init();
+    f = storageFormat;
+    mutex.notify();
+
+    return f;
+}
+
+/**
+ * Defines what happens when the log is full.
+ *
+ * With RetentionPolicy::OverwriteOldest, the data section is used as a ring of flash pages. The page ahead
+ * of the data is erased as the data reaches it, so logging never stops and the log holds the most recent
+ * data. getDataLength() and readData() present the retained rows in order, following the latest column
+ * headings. As with StorageFormat::Binary, MY_DATA.HTM on the MICROBIT drive is served directly from
+ * flash, so shows no data in this mode. Only StorageFormat::Text is supported.
+ *
+ * The policy can only be changed while the log is empty. It is recorded in the log, so persists
+ * across a reset, and is retained when the log is cleared.
+ *
+ * @param policy The retention policy to use.
+ * @return DEVICE_OK on success, DEVICE_INVALID_STATE if the log already contains data, or
+ * DEVICE_NOT_SUPPORTED if the policy cannot be used with the current storage format or flash size.
+ */
+int MicroBitLog::setRetention(RetentionPolicy policy)
+{
+    int r = DEVICE_OK;
+
+    mutex.wait();
+    init();
+
+    if (policy != retention)
+    {
+        // A ring needs a page being written, a page erased ahead of it, and at least one page of retained data.
+        if (policy == RetentionPolicy::OverwriteOldest && (storageFormat == StorageFormat::Binary || ringSize < 3 * flash.getPageSize()))
+        {
+            r = DEVICE_NOT_SUPPORTED;
+        }
+        else if (_isEmpty())
+        {
+            // The policy is recorded in the metadata, which can only be rewritten by erasing it.
+            retention = policy;
+            _clear(false);
+        }
+        else
+        {
+            r = DEVICE_INVALID_STATE;
+        }
+    }
+
+    mutex.notify();
+    return r;
+}
+
+/**
+ * Determines what happens when the log is full.
+ * @return The current retention policy.
+ */
+RetentionPolicy MicroBitLog::getRetention()
+{
+    RetentionPolicy p;
+
+    mutex.wait();
+    init();
+    p = retention;
+    mutex.notify();
+
+    return p;
+}
+
+/**
+ * Creates a new row in the log, ready to be populated by logData()
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::beginRow()
+{
+    int r;
+
+    mutex.wait();
+    r = _beginRow();
+    mutex.notify();
+
+    return r;
+}
+
+
+/**
+ * Creates a new row in the log, ready to be populated by logData()
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_beginRow()
+{
+    init();
+
+    // If beginRow is called during an open transaction, implicity perform an endRow before proceeding.
     if (status & MICROBIT_LOG_STATUS_ROW_STARTED)
         _endRow();
 
-    // Reset all values, ready to populate with a new row.
-    for (uint32_t i=0; i<headingCount; i++)
-        rowData[i].value = ManagedString();
+    // Reset all values, ready to populate with a new row.
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        rowData[i].value = ManagedString();
+        rowData[i].numeric = false;
+    }
+
+    // indicate that we've started a new row.
+    status |= MICROBIT_LOG_STATUS_ROW_STARTED;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ * 
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, const char *value)
+{
+    return logData(ManagedString(key), ManagedString(value));
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(ManagedString key, ManagedString value)
+{
+    int r;
+
+    mutex.wait();
+    r = _logData(key, value);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key/value pair.
+ * @param key the name of the key column) to set.
+ * @param value the value to insert 
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_logData(ManagedString key, ManagedString value)
+{
+    // Perform lazy instatiation if necessary.
+    init();
+
+    // If logData is called before explicitly beginning a row, do so implicitly.
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    ManagedString k = cleanBuffer(key.toCharArray(), key.length());
+    ManagedString v = cleanBuffer(value.toCharArray(), value.length());
+
+    if (k.length())
+        key = k;
+
+    if (v.length())
+        value = v;
+
+    // Add the given key/value pair into our cumulative row data. 
+    int c = _findColumn(key.toCharArray(), key.length());
+
+    if (c >= 0)
+    {
+        rowData[c].value = value;
+        rowData[c].numeric = false;
+    }
+    else
+    {
+        // If the requested heading is not available, add it.
+        addHeading(key, value);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Populates the current row with the given key and integer value.
+ * The value is stored as a number, and only formatted when the row is committed (or read, in binary format),
+ * so once the column exists no heap memory is allocated.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the value to insert
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, int value)
+{
+    int r;
+
+    mutex.wait();
+    r = _logData(key, value, 0);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key and floating point value.
+ * The value is stored as a fixed point number with the given number of decimal places, and only formatted
+ * when the row is committed (or read, in binary format), so once the column exists no heap memory is allocated.
+ *
+ * @param key the name of the key column) to set.
+ * @param value the value to insert
+ * @param precision the number of decimal places to record, up to MICROBIT_LOG_MAX_PRECISION. Fewer are
+ * recorded if the value would not otherwise fit in 32 bits.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::logData(const char *key, float value, int precision)
+{
+    static const float scales[MICROBIT_LOG_MAX_PRECISION + 1] = {1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f, 100000.0f, 1000000.0f};
+    int r;
+
+    if (precision < 0)
+        precision = 0;
+
+    if (precision > MICROBIT_LOG_MAX_PRECISION)
+        precision = MICROBIT_LOG_MAX_PRECISION;
+
+    // Convert to fixed point, dropping decimal places (and ultimately saturating) if the value is too large.
+    float scaled = value * scales[precision];
+
+    while (precision > 0 && (scaled > 2147483520.0f || scaled < -2147483520.0f))
+        scaled = value * scales[--precision];
+
+    int32_t number;
+
+    if (scaled > 2147483520.0f)
+        number = 2147483520;
+    else if (scaled < -2147483520.0f)
+        number = -2147483520;
+    else
+        number = (int32_t) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+
+    mutex.wait();
+    r = _logData(key, number, precision);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Populates the current row with the given key and floating point value.
+ * Equivalent to logData(const char *, float, int), provided so that double arguments are not ambiguous.
+ */
+int MicroBitLog::logData(const char *key, double value, int precision)
+{
+    return logData(key, (float) value, precision);
+}
+
+/**
+ * Populates the current row with the given key and fixed point value.
+ * @param key the name of the key column) to set.
+ * @param number the value to insert, scaled by 10^decimals.
+ * @param decimals the number of decimal places in the value.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_logData(const char *key, int32_t number, int decimals)
+{
+    // Perform lazy instatiation if necessary.
+    init();
+
+    // If logData is called before explicitly beginning a row, do so implicitly.
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        _beginRow();
+
+    // Update the column directly if it exists, without creating any strings.
+    int c = _findColumn(key, strlen(key));
+
+    if (c >= 0)
+    {
+        rowData[c].value = ManagedString::EmptyString;
+        rowData[c].number = number;
+        rowData[c].decimals = decimals;
+        rowData[c].numeric = true;
+        return DEVICE_OK;
+    }
+
+    // Otherwise, this is a new (or uncleaned) key. Take the general path, which stores the value as text.
+    char text[24];
+    return _logData(ManagedString(key), ManagedString(text, renderNumber(text, number, decimals)));
+}
+
+/**
+ * Complete a row in the log, and pushes to persistent storage.
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::endRow()
+{
+    int r;
+
+    mutex.wait();
+    r = _endRow();
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Complete a row in the log, and pushes to persistent storage.
+ * @return DEVICE_OK on success.
+ */
+int MicroBitLog::_endRow()
+{
+    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
+        return DEVICE_INVALID_STATE;
+
+    init();
+
+    // Add the timestamp column, if we need one and it does not already exist.
+    // Add at the front, unless data has already been written.
+    if (timeStampChanged)
+    {
+        timeStampChanged = false;
+        if (timeStampFormat != TimeStampFormat::None)
+            addHeading(timeStampHeading, ManagedString::EmptyString, _isEmpty());
+    }
+
+    // Special case the condition where no values are present.
+    // We suppress injecting a pointless timestamp in these cases.
+    bool validData = false;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        if(rowData[i].hasValue())
+        {
+            validData = true;
+            break;
+        }
+    }
+
+    // Insert timestamp field if requested.
+    if (validData && timeStampFormat != TimeStampFormat::None)
+    {
+        // handle 32 bit overflow and fractional components of timestamp
+        CODAL_TIMESTAMP t = system_timer_current_time() / (CODAL_TIMESTAMP)timeStampFormat;
+
+        // Typically the timestamp fits in 32 bits, so can be stored as a number. Anything other than
+        // milliseconds has two decimal places.
+        if (t <= (CODAL_TIMESTAMP) 0x7FFFFFFF)
+            _logData(timeStampHeading.toCharArray(), (int32_t) t, (int)timeStampFormat > 1 ? 2 : 0);
+        else
+        {
+            // Too large for a 32 bit column. Anything other than milliseconds has two decimal places.
+            char text[24];
+            _logData(timeStampHeading, ManagedString(text, renderTimestamp(text, t, (int)timeStampFormat > 1 ? 2 : 0)));
+        }
+    }
+
+    // If new columns have been added since the last row, update persistent storage accordingly.
+    if (headingsChanged)
+    {
+        // If this is the first time we have logged any headings, place them just after the metadata block
+        if (headingStart == 0)
+            headingStart = startAddress + sizeof(MicroBitLogMetaData);
+
+        // Build the headings in a single allocation, and keep them until the columns next change.
+        uint32_t length = headingCount;
+
+        for (uint32_t i=0; i<headingCount;i++)
+            length += rowData[i].key.length();
+
+        char *h = (char *) malloc(length + 1);
+
+        if (h != NULL)
+        {
+            uint32_t l = 0;
+
+            for (uint32_t i=0; i<headingCount;i++)
+            {
+                memcpy(&h[l], rowData[i].key.toCharArray(), rowData[i].key.length());
+                l += rowData[i].key.length();
+                h[l++] = i + 1 != headingCount ? ',' : '\n';
+            }
+            h[l] = 0;
+
+            headings = ManagedString(h, l);
+            free(h);
+        }
+
+        ManagedBuffer zero(headingLength);
+
+        cache.write(headingStart, &zero[0], headingLength);
+        headingStart += headingLength;
+        cache.write(headingStart, headings.toCharArray(), headings.length());
+        headingLength = headings.length();
+
+        _logString(headings);
+
+        headingsChanged = false;
+    }
+
+    if (validData)
+        _indexRow();
+
+    if (storageFormat == StorageFormat::Binary)
+        _logRow();
+    else
+        _logRowText();
+
+    status &= ~MICROBIT_LOG_STATUS_ROW_STARTED;
+
+    if (status & MICROBIT_LOG_STATUS_FULL)
+        return DEVICE_NO_RESOURCES;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Clean the given buffer of invalid LogFS symbols ("-->" and optionally ",\t\n")
+ *
+ * @param s the data to clean
+ * @param len the number of characters to clean
+ * @param removeSeperators if set to false, only "-->" symbols are erased, otherwise ",\t\n" characters are also removed.
+ * @return a cleaned version of the string supplied, if any changes are necessary. Otherwise, an empty string is returned.
+ */
+ManagedString MicroBitLog::cleanBuffer(const char *s, int len, bool removeSeparators)
+{
+    ManagedString out;
+
+    for (int i=0; i<len; i++)
+    {
+        if (i+2 < len && s[i] == '-' && s[i+1] == '-' && s[i+2] == '>')
+        {
+            if (out.length() == 0)
+                out = ManagedString(s, len);
+            *(char *)(out.toCharArray()+i) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
+            *(char *)(out.toCharArray()+i+1) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
+            *(char *)(out.toCharArray()+i+2) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
+        }
+
+        if (s[i] == '\t' || (removeSeparators && (s[i] == ',' || s[i] == '\n')))
+        {
+            if (out.length() == 0)
+                out = ManagedString(s, len);
+            *(char *)(out.toCharArray()+i) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
+        }
+    }
+    return out;
+}
+
+/**
+ * Serialise the current row as a line of CSV, and append it to the log.
+ * The row is formatted in a stack buffer where it fits, and is written to the log in one operation.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_logRowText()
+{
+    uint32_t maxLength = _rowTextLength();
+
+    if (maxLength == 0)
+        return DEVICE_OK;
+
+    char stackRow[CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE];
+    char *row = maxLength <= sizeof(stackRow) ? stackRow : (char *) malloc(maxLength);
+
+    if (row == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    int r = _logString(row, _renderRow(row));
+
+    if (row != stackRow)
+        free(row);
+
+    return r;
+}
+
+/**
+ * Determines the worst case length of the current row, when serialised as a line of CSV.
+ * @return the maximum length in bytes, or zero if the row holds no values.
+ */
+uint32_t MicroBitLog::_rowTextLength()
+{
+    // Allow for separators and the line ending.
+    uint32_t maxLength = headingCount + 1;
+    bool empty = true;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        maxLength += rowData[i].numeric ? 24 : rowData[i].value.length();
+
+        if (rowData[i].hasValue())
+            empty = false;
+    }
+
+    return empty ? 0 : maxLength;
+}
+
+/**
+ * Serialise the current row as a line of CSV.
+ * @param row the buffer to write into, of at least _rowTextLength() bytes.
+ * @return the length of the line, in bytes, including its line ending.
+ */
+uint32_t MicroBitLog::_renderRow(char *row)
+{
+    uint32_t l = 0;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        if (rowData[i].numeric)
+        {
+            l += renderNumber(&row[l], rowData[i].number, rowData[i].decimals);
+        }
+        else
+        {
+            memcpy(&row[l], rowData[i].value.toCharArray(), rowData[i].value.length());
+            l += rowData[i].value.length();
+        }
+
+        if (i + 1 != headingCount)
+            row[l++] = ',';
+    }
+    row[l++] = '\n';
+
+    return l;
+}
+
+/**
+ * Inject the given row into the log as text, ignoring key/value pairs.
+ * @param s the string to inject.
+ */
+int MicroBitLog::logString(const char *s)
+{
+    int r;
+
+    mutex.wait();
+    r = _logString(s);
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Inject the given row into the log as text, ignoring key/value pairs.
+ * @param s the string to inject.
+ */
+int MicroBitLog::_logString(const char *s)
+{
+    return _logString(s, strlen(s));
+}
+
+/**
+ * Inject the given text into the log, ignoring key/value pairs.
+ * @param s the text to inject. This need not be NULL terminated.
+ * @param l the length of the text, in bytes.
+ */
+int MicroBitLog::_logString(const char *s, uint32_t l)
+{
+    init();
+
+    const char *data = s;
+
+    // If this is the first log entry written, ensure that the file visibility is activated.
+    // (it may have been disabled following a full erase)
+    if (_isEmpty())
+        _setVisibility(true);
+
+    ManagedString cleaned = cleanBuffer(data, l, false);
+    if (cleaned.length())
+        data = cleaned.toCharArray();
+
+    // In binary format, text is stored as a record holding its length and the text itself.
+    uint8_t stackRecord[CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE];
+    uint8_t *record = NULL;
+    uint32_t size = l;
+
+    if (storageFormat == StorageFormat::Binary)
+    {
+        record = l + 6 <= sizeof(stackRecord) ? stackRecord : (uint8_t *) malloc(l + 6);
+        if (record == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        size = 0;
+        record[size++] = MICROBIT_LOG_RECORD_TEXT;
+        size += writeVarint(&record[size], l);
+
+        for (uint32_t i = 0; i < l; i++)
+            record[size++] = data[i] == (char)0xFF ? CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE : data[i];
+    }
+
+    // If requested, log the data over the serial port
+    if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR && size <= _freeSpace() - queueLength)
+        _mirror(data, l);
 
-    // indicate that we've started a new row.
-    status |= MICROBIT_LOG_STATUS_ROW_STARTED;
+    int r;
+
+    if (record)
+    {
+        r = _append(record, size);
+
+        if (record != stackRecord)
+            free(record);
+    }
+    else
+    {
+        r = _append(data, l);
+    }
+
+    if (r == DEVICE_OK)
+        csvLength += l;
+
+    return r;
+}
+
+/**
+ * Append raw data to the data section, maintaining the journal.
+ * @param data the data to write.
+ * @param len the number of bytes to write.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_append(const void *buffer, uint32_t len)
+{
+    journalRows++;
+
+    // Write directly to flash if there is no queue, or the data could never fit in it.
+    // Likewise if the log is about to fill, so that it is marked as full in the usual way.
+    // Anything already queued is written first, to preserve ordering.
+    if (queueSize == 0 || len > queueSize || len > _freeSpace() - queueLength)
+    {
+        int r = _flush();
+        return r == DEVICE_OK ? _write(buffer, len) : r;
+    }
+
+    if (queue == NULL)
+    {
+        queue = (uint8_t *) malloc(queueSize);
+        queueHead = 0;
+        queueLength = 0;
+
+        if (queue == NULL)
+            return _write(buffer, len);
+    }
+
+    if (!(status & MICROBIT_LOG_STATUS_QUEUE_LISTENING) && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_QUEUE_DRAIN, this, &MicroBitLog::onQueueDrain);
+        status |= MICROBIT_LOG_STATUS_QUEUE_LISTENING;
+    }
+
+    // If the background writer has fallen behind, make space by writing out the oldest data ourselves.
+    if (len > queueSize - queueLength)
+        _drainQueue(len - (queueSize - queueLength));
+
+    // Copy the data into the ring, wrapping around the end of the buffer if necessary.
+    uint32_t tail = (queueHead + queueLength) % queueSize;
+    uint32_t l = min(len, queueSize - tail);
+
+    memcpy(&queue[tail], buffer, l);
+    memcpy(queue, (const uint8_t *)buffer + l, len - l);
+    queueLength += len;
+
+    if (!(status & MICROBIT_LOG_STATUS_QUEUE_HIGH) && queueLength * 100 >= queueSize * CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK)
+    {
+        status |= MICROBIT_LOG_STATUS_QUEUE_HIGH;
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_QUEUE_HIGH);
+    }
+
+    // Wake the background writer, if it isn't already running.
+    if (!(status & MICROBIT_LOG_STATUS_QUEUE_DRAINING) && (status & MICROBIT_LOG_STATUS_QUEUE_LISTENING))
+    {
+        status |= MICROBIT_LOG_STATUS_QUEUE_DRAINING;
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_QUEUE_DRAIN);
+    }
 
     return DEVICE_OK;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
- * 
- * @return DEVICE_OK on success.
+ * Write up to the given number of bytes from the front of the queue to flash.
+ * @param len the maximum number of bytes to write.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
  */
-int MicroBitLog::logData(const char *key, const char *value)
+int MicroBitLog::_drainQueue(uint32_t len)
 {
-    return logData(ManagedString(key), ManagedString(value));
+    int r = DEVICE_OK;
+
+    while (len > 0 && queueLength > 0 && r == DEVICE_OK)
+    {
+        uint32_t l = min(min(len, queueLength), queueSize - queueHead);
+
+        r = _write(&queue[queueHead], l);
+
+        queueHead = (queueHead + l) % queueSize;
+        queueLength -= l;
+        len -= l;
+    }
+
+    // Space is checked before data is queued, so this only happens if flash was lost. Nothing more can be stored.
+    if (r != DEVICE_OK)
+    {
+        queueHead = 0;
+        queueLength = 0;
+    }
+
+    // Rearm the high watermark event once the queue has half emptied.
+    if (queueLength * 200 < queueSize * CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK)
+        status &= ~MICROBIT_LOG_STATUS_QUEUE_HIGH;
+
+    return r;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
+ * Write all queued data to flash.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::_flush()
+{
+    return _drainQueue(queueLength);
+}
+
+/**
+ * Writes any queued data to flash, returning once it has been stored.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::flush()
+{
+    int r;
+
+    mutex.wait();
+    r = _flush();
+    mutex.notify();
+
+    return r;
+}
+
+/**
+ * Sets the size of the RAM queue used to write committed rows to flash in the background.
+ * With a queue, endRow() and logString() return once the data is queued. A background fiber then
+ * writes it out, so the caller does not wait for the flash. If the queue fills, the caller writes
+ * the queue to flash itself, so no data is lost. MICROBIT_LOG_EVT_QUEUE_HIGH is raised when the queue
+ * passes CONFIG_MICROBIT_LOG_QUEUE_HIGH_WATERMARK percent full.
  *
+ * @param size the size of the queue in bytes, or zero to write rows to flash before endRow() returns.
  * @return DEVICE_OK on success.
+ *
+ * @note queued data is lost if the device is reset before it is written. Use flush() where this matters.
  */
-int MicroBitLog::logData(ManagedString key, ManagedString value)
+int MicroBitLog::setQueueSize(uint32_t size)
+{
+    mutex.wait();
+
+    if (size != queueSize)
+    {
+        _flush();
+
+        free(queue);
+        queue = NULL;
+        queueSize = size;
+        queueHead = 0;
+        queueLength = 0;
+    }
+
+    mutex.notify();
+    return DEVICE_OK;
+}
+
+/**
+ * Background writer. Drains the queue in blocks, releasing the mutex between each one.
+ */
+void MicroBitLog::onQueueDrain(Event)
+{
+    while (true)
+    {
+        mutex.wait();
+
+        if (queueLength == 0)
+        {
+            status &= ~MICROBIT_LOG_STATUS_QUEUE_DRAINING;
+            mutex.notify();
+            return;
+        }
+
+        _drainQueue(CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
+        mutex.notify();
+
+        // Let any waiting logger run before writing the next block.
+        schedule();
+    }
+}
+
+/**
+ * Write raw data to the end of the data section, maintaining the journal.
+ * @param data the data to write.
+ * @param len the number of bytes to write.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_write(const void *buffer, uint32_t len)
+{
+    uint32_t l = len;
+    const uint8_t *data = (const uint8_t *) buffer;
+
+    bool circular = retention == RetentionPolicy::OverwriteOldest;
+
+    // If we can't write a whole line of data, then treat the log as full.
+    if (l > _freeSpace())
+    {
+        if (!(status & MICROBIT_LOG_STATUS_FULL))
+        {
+            cache.write(logEnd+1, "FUL", 3);
+            status |= MICROBIT_LOG_STATUS_FULL;
+        }
+
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_LOG_FULL);
+        return DEVICE_NO_RESOURCES;
+    }
+
+    while (l > 0)
+    {
+        uint32_t spaceOnPage = flash.getPageSize() - (dataEnd % flash.getPageSize());
+        //DMESG("SPACE_ON_PAGE: %d", spaceOnPage);
+        int lengthToWrite = min(l, spaceOnPage);
+
+        // If we're going to fill (or overspill) the current page, erase the next one ready for use.
+        // In a circular log, the next page may be at the start of the ring, and holds the oldest data.
+        if (spaceOnPage <= l && (circular || dataEnd+spaceOnPage < logEnd))
+        {
+            uint32_t nextPage = ((dataEnd / flash.getPageSize()) + 1) * flash.getPageSize();
+
+            if (circular && nextPage == dataStart + ringSize)
+                nextPage = dataStart;
+
+            //DMESG("   ERASING PAGE %p", nextPage);
+            for (uint32_t b = 0; b < flash.getPageSize(); b += CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE)
+                cache.erase(nextPage + b);
+
+            flash.erase(nextPage);
+
+            // Have the page after that erased in the background, so that the next page boundary doesn't stall the logger.
+            // (In a circular log it holds retained data, so is only erased when we reach it).
+            if (!circular && nextPage + flash.getPageSize() < logEnd)
+                flash.eraseAhead(nextPage + flash.getPageSize());
+        }
+
+        // Perform a write through cache update
+        //DMESG("   WRITING [ADDRESS: %p] [LENGTH: %d] ", dataEnd, lengthToWrite);
+        cache.write(dataEnd, data, lengthToWrite);
+
+        // move on pointers
+        dataEnd += lengthToWrite;
+        data += lengthToWrite;
+        l -= lengthToWrite;
+
+        if (circular && dataEnd == dataStart + ringSize)
+        {
+            dataEnd = dataStart;
+            ringBase += ringSize;
+        }
+    }
+
+    // Record our progress in the journal, if the commit policy requires it.
+    // A circular log is journalled at least once per page, so that the number of laps of the ring is never lost.
+    uint32_t uncommitted = _dataLength() - journalCommitted;
+
+    if (uncommitted && ((journalCommitBytes && uncommitted >= journalCommitBytes) || (journalCommitRows && journalRows >= journalCommitRows) ||
+        (journalCommitPeriod && system_timer_current_time() - journalTime >= journalCommitPeriod) || (circular && uncommitted >= flash.getPageSize())))
+        _commitJournal();
+
+    // Return NO_RESOURCES if we ran out of FLASH space.
+    if (l == 0)
+        return DEVICE_OK;
+
+    Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_LOG_FULL);
+    return DEVICE_NO_RESOURCES;
+}
+
+/**
+ * Write a journal entry recording the current end of the data.
+ */
+void MicroBitLog::_commitJournal()
+{
+    uint32_t oldJournalHead = journalHead;
+
+    // The journal must never refer to data that is not yet in flash.
+    cache.flush();
+
+    // Record that we've moved on the journal log by one entry
+    journalHead += MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+
+    // If we've moved onto another page, ensure it is erased.
+    if (journalHead % flash.getPageSize() == 0)
+    {
+        //DMESG("JOURNAL PAGE BOUNDARY: %p", journalHead);
+        // If we've rolled over the last page, cycle around.
+        if (journalHead == dataStart)
+        {
+            //DMESG("JOURNAL WRAPAROUND");
+            journalHead = journalStart;
+        }
+
+        //DMESG("ERASING JOURNAL PAGE: %p", journalHead);
+        for (uint32_t b = 0; b < flash.getPageSize(); b += CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE)
+            cache.erase(journalHead + b);
+
+        flash.erase(journalHead);
+    }
+
+    // Write journal entry
+    JournalEntry je;
+    writeNum(je.length, _dataLength());
+    cache.write(journalHead, &je, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+
+    // Invalidate the old one, unless it was held on the page we've just erased.
+    // (Zeroing it there would leave an unwritable slot in the fresh page).
+    if (oldJournalHead / flash.getPageSize() != journalHead / flash.getPageSize() || journalHead % flash.getPageSize() != 0)
+    {
+        JournalEntry empty;
+        empty.clear();
+        //DMESG("   INVALIDATING: %p", oldJournalHead);
+        cache.write(oldJournalHead, &empty, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+    }
+
+    cache.flush();
+
+    journalCommitted = _dataLength();
+    journalRows = 0;
+    journalTime = system_timer_current_time();
+}
+
+/**
+ * Defines how often the journal is updated. A journal entry is written once any enabled limit is reached.
+ * Fewer entries reduce flash writes. Data written since the last entry is never lost, but has to
+ * be found by scanning when the log is next mounted.
+ *
+ * @param bytes the number of bytes of data to write between journal entries, or zero to disable.
+ * @param rows the number of rows to write between journal entries, or zero to disable.
+ * @param period the time in ms between journal entries, or zero to disable. Only checked as data is written.
+ */
+void MicroBitLog::setJournalPolicy(uint32_t bytes, uint32_t rows, uint32_t period)
+{
+    mutex.wait();
+    journalCommitBytes = bytes;
+    journalCommitRows = rows;
+    journalCommitPeriod = period;
+    mutex.notify();
+}
+
+/**
+ * Writes any queued data to flash, and records the end of the data in the journal.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::sync()
 {
     int r;
 
     mutex.wait();
-    r = _logData(key, value);
+    r = _sync();
     mutex.notify();
 
     return r;
 }
 
 /**
- * Populates the current row with the given key/value pair.
- * @param key the name of the key column) to set.
- * @param value the value to insert 
+ * Retrieves the usage counters of the log's flash cache, such as hits, misses and the number of operations
+ * issued to the interface chip. Useful when tuning CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE and the cache size.
+ * @return a copy of the counters.
+ */
+FSCacheStatistics MicroBitLog::getCacheStatistics()
+{
+    FSCacheStatistics s;
+
+    mutex.wait();
+    s = cache.getStatistics();
+    mutex.notify();
+
+    return s;
+}
+
+/**
+ * Resets the usage counters of the log's flash cache to zero.
+ */
+void MicroBitLog::resetCacheStatistics()
+{
+    mutex.wait();
+    cache.resetStatistics();
+    mutex.notify();
+}
+
+/**
+ * Determines the heap memory committed by the log: its flash cache, column table, write queue and export buffer.
  *
- * @return DEVICE_OK on success.
+ * @return The number of bytes currently allocated.
  */
-int MicroBitLog::_logData(ManagedString key, ManagedString value)
+uint32_t MicroBitLog::getMemoryUsage()
 {
-    // Perform lazy instatiation if necessary.
-    init();
+    uint32_t usage = cache.getMemoryUsage();
 
-    // If logData is called before explicitly beginning a row, do so implicitly.
-    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
-        _beginRow();
+    if (rowData)
+        usage += sizeof(ColumnEntry) * columnCapacity;
 
-    ManagedString k = cleanBuffer(key.toCharArray(), key.length());
-    ManagedString v = cleanBuffer(value.toCharArray(), value.length());
+    if (columnIndex)
+        usage += sizeof(uint16_t) * columnIndexSize;
 
-    if (k.length())
-        key = k;
+    if (queue)
+        usage += queueSize;
+
+    if (exportBuffer)
+        usage += CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE;
+
+    return usage;
+}
+
+/**
+ * Frees the unmodified blocks held by the flash cache, the write queue while it is empty, and the
+ * export buffer if no export is in progress. Each is allocated again when next needed.
+ *
+ * @return The number of bytes returned to the heap.
+ */
+uint32_t MicroBitLog::releaseMemory()
+{
+    uint32_t released;
+
+    mutex.wait();
+
+    // This also releases blocks held by any other caches, which are only ever of use when reading flash.
+    released = FSCache::releaseMemory();
+
+    if (queue && queueLength == 0)
+    {
+        free(queue);
+        queue = NULL;
+        released += queueSize;
+    }
+
+    if (exportBuffer && exportLength == 0)
+    {
+        free(exportBuffer);
+        exportBuffer = NULL;
+        exportBufferLength = 0;
+        released += CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE;
+    }
+
+    mutex.notify();
+
+    return released;
+}
+
+/**
+ * Write all queued data to flash, and record the end of the data in the journal.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log became full.
+ */
+int MicroBitLog::_sync()
+{
+    if (!(status & MICROBIT_LOG_STATUS_INITIALIZED))
+        return DEVICE_OK;
 
-    if (v.length())
-        value = v;
+    int r = _flush();
 
-    // Add the given key/value pair into our cumulative row data. 
-    bool added = false;
-    for (uint32_t i=0; i<headingCount; i++)
-    {
-        if(rowData[i].key == key)
-        {
-            rowData[i].value = value;
-            added = true;
-            break;
-        }
-    }
+    if (_dataLength() != journalCommitted)
+        _commitJournal();
 
-    // If the requested heading is not available, add it.
-    if (!added)
-        addHeading(key, value);
+    // Headings and metadata may also be held in the cache.
+    cache.flush();
 
-    return DEVICE_OK;
+    return r;
 }
 
 /**
- * Complete a row in the log, and pushes to persistent storage.
- * @return DEVICE_OK on success.
+ * Inject the given row into the log as text, ignoring key/value pairs.
+ * @param s the string to inject.
  */
-int MicroBitLog::endRow()
+int MicroBitLog::logString(ManagedString s)
 {
     int r;
 
     mutex.wait();
-    r = _endRow();
+    r = _logString(s);
     mutex.notify();
 
     return r;
 }
 
 /**
- * Complete a row in the log, and pushes to persistent storage.
- * @return DEVICE_OK on success.
+ * Inject the given row into the log as text, ignoring key/value pairs.
+ * @param s the string to inject.
  */
-int MicroBitLog::_endRow()
+int MicroBitLog::_logString(ManagedString s)
 {
-    if (!(status & MICROBIT_LOG_STATUS_ROW_STARTED))
-        return DEVICE_INVALID_STATE;
+    return _logString(s.toCharArray(), s.length());
+}
 
-    init();
+/**
+ * Encode the current row as a binary record, and append it to the log.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the log is full.
+ */
+int MicroBitLog::_logRow()
+{
+    // Determine the worst case size of the record, and the length of its CSV equivalent.
+    uint32_t maxSize = 2 + 5 + (headingCount + 2) / 3;
+    uint32_t textLength = headingCount;
+    bool empty = true;
 
-    // Add the timestamp column, if we need one and it does not already exist.
-    // Add at the front, unless data has already been written.
-    if (timeStampChanged)
+    for (uint32_t i=0; i<headingCount; i++)
     {
-        timeStampChanged = false;
-        if (timeStampFormat != TimeStampFormat::None)
-            addHeading(timeStampHeading, ManagedString::EmptyString, dataStart == dataEnd);
+        uint32_t l = rowData[i].value.length();
+
+        maxSize += 6 + l;
+        textLength += l;
+
+        if (rowData[i].hasValue())
+            empty = false;
     }
 
-    // Special case the condition where no values are present.
-    // We suppress injecting a pointless timestamp in these cases.
-    bool validData = false;
+    if (empty)
+        return DEVICE_OK;
+
+    uint8_t stackRecord[CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE];
+    uint8_t *record = maxSize <= sizeof(stackRecord) ? stackRecord : (uint8_t *) malloc(maxSize);
+    uint32_t size = 0;
+
+    if (record == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    if (syncPending)
+        record[size++] = MICROBIT_LOG_RECORD_SYNC;
+
+    record[size++] = MICROBIT_LOG_RECORD_ROW;
+    size += writeVarint(&record[size], headingCount);
+
+    uint8_t *types = &record[size];
+    char text[24];
+    memset(types, 0, (headingCount + 2) / 3);
+    size += (headingCount + 2) / 3;
 
     for (uint32_t i=0; i<headingCount; i++)
     {
-        if(rowData[i].value != ManagedString::EmptyString)
+        const char *v = rowData[i].value.toCharArray();
+        int l = rowData[i].value.length();
+        int32_t mantissa = 0;
+        int decimals = 0;
+        int type = MICROBIT_LOG_COLUMN_EMPTY;
+
+        if (rowData[i].numeric)
         {
-            validData = true;
-            break;
+            mantissa = rowData[i].number;
+            decimals = rowData[i].decimals;
+            textLength += renderNumber(text, mantissa, decimals);
         }
-    }
-
-    // Insert timestamp field if requested.
-    if (validData && timeStampFormat != TimeStampFormat::None)
-    {
-        // handle 32 bit overflow and fractional components of timestamp
-        CODAL_TIMESTAMP t = system_timer_current_time() / (CODAL_TIMESTAMP)timeStampFormat;
-        int billions = t / (CODAL_TIMESTAMP) 1000000000;
-        int units = t % (CODAL_TIMESTAMP) 1000000000;
-        int fraction = 0;
 
-        if ((int)timeStampFormat > 1)
+        if (!rowData[i].numeric && l == 0)
         {
-            fraction = units % 100;
-            units = units / 100;
-            billions = billions / 100;
+            // Nothing to store.
         }
+        else if (rowData[i].numeric || parseNumber(v, l, mantissa, decimals))
+        {
+            type = decimals ? MICROBIT_LOG_COLUMN_DECIMAL : MICROBIT_LOG_COLUMN_INTEGER;
 
-        ManagedString u(units);
-        ManagedString f(fraction);
-        ManagedString s;
-        f = padString(f, 2);
+            if (decimals)
+                record[size++] = decimals;
 
-        if (billions)
+            size += writeVarint(&record[size], zigzag((int32_t)((uint32_t)mantissa - (uint32_t)rowData[i].previous)));
+            rowData[i].previous = mantissa;
+        }
+        else
         {
-            s = s + billions;
-            u = padString(u, 9);
+            type = MICROBIT_LOG_COLUMN_STRING;
+            size += writeVarint(&record[size], l);
+
+            for (int c = 0; c < l; c++)
+                record[size++] = v[c] == (char)0xFF ? CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE : v[c];
         }
 
-        s = s + u;
+        types[i / 3] |= type << (2 * (i % 3));
+    }
+
+    // If requested, log the data over the serial port
+    if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR && size <= _freeSpace() - queueLength)
+    {
+        char stackRow[CONFIG_MICROBIT_LOG_ROW_BUFFER_SIZE];
+        uint32_t maxLength = _rowTextLength();
+        char *row = maxLength <= sizeof(stackRow) ? stackRow : (char *) malloc(maxLength);
 
-        // Add two decimal places for anything other than milliseconds.
-        if ((int)timeStampFormat > 1)
-            s = s + "." + f;
+        if (row)
+        {
+            _mirror(row, _renderRow(row));
 
-        _logData(timeStampHeading, s);
+            if (row != stackRow)
+                free(row);
+        }
     }
 
-    // If new columns have been added since the last row, update persistent storage accordingly.
-    ManagedString sep = ",";
+    int r = _append(record, size);
 
-    if (headingsChanged)
-    {
-        // If this is the first time we have logged any headings, place them just after the metadata block
-        if (headingStart == 0)
-            headingStart = startAddress + sizeof(MicroBitLogMetaData);
+    if (record != stackRecord)
+        free(record);
 
-        // create new headers
-        ManagedString h;
-        ManagedBuffer zero(headingLength);
+    if (r == DEVICE_OK)
+    {
+        syncPending = false;
+        csvLength += textLength;
+    }
+    else
+    {
+        // The bases were moved on, but the row wasn't stored. Start afresh with the next row.
+        for (uint32_t i=0; i<headingCount; i++)
+            rowData[i].previous = 0;
 
-        for (uint32_t i=0; i<headingCount;i++)
-        {
-            h = h + rowData[i].key;
-            if (i + 1 != headingCount)
-                h = h + sep;
-        }
-        h = h + "\n";
-        
-        cache.write(headingStart, &zero[0], headingLength);
-        headingStart += headingLength;
-        cache.write(headingStart, h.toCharArray(), h.length());
-        headingLength = h.length();
+        syncPending = true;
+    }
 
-        _logString(h);
+    return r;
+}
 
-        headingsChanged = false;
+/**
+ * Determine the length of the stored data, when expanded to CSV.
+ */
+uint32_t MicroBitLog::_getCsvLength()
+{
+    if (retention == RetentionPolicy::OverwriteOldest)
+    {
+        uint32_t first = _ringFirstRow();
+        return (first ? headingLength : 0) + _dataLength() - first;
     }
 
-    // Serialize data to CSV
-    ManagedString row;
-    bool empty = true;
+    if (storageFormat != StorageFormat::Binary)
+        return dataEnd - dataStart;
 
-    for (uint32_t i=0; i<headingCount;i++)
+    if (!csvLengthValid)
     {
-        row = row + rowData[i].value;
-         
-        if (rowData[i].value.length())
-            empty = false;
+        uint32_t total = 0;
 
-        if (i + 1 != headingCount)
-            row = row + sep;
+        _resetReader();
+        while (_expandRecord() == DEVICE_OK)
+            total += readRecord.length();
+
+        csvLength = total;
+        csvLengthValid = true;
+        _resetReader();
     }
-    row = row + "\n";
 
-    if (!empty)
-        _logString(row);
+    return csvLength;
+}
 
-    status &= ~MICROBIT_LOG_STATUS_ROW_STARTED;
+/**
+ * Determines if the log holds no data, including any waiting in the queue.
+ */
+bool MicroBitLog::_isEmpty()
+{
+    return dataStart == dataEnd && ringBase == 0 && queueLength == 0;
+}
 
-    if (status & MICROBIT_LOG_STATUS_FULL)
-        return DEVICE_NO_RESOURCES;
+/**
+ * Determine the logical length of the data written, including any data overwritten in a circular log.
+ */
+uint32_t MicroBitLog::_dataLength()
+{
+    return ringBase + dataEnd - dataStart;
+}
 
-    return DEVICE_OK;
+/**
+ * Determine the number of bytes that can still be written in one go.
+ */
+uint32_t MicroBitLog::_freeSpace()
+{
+    // A circular log is never full, but the page being written and the one erased ahead of it can't be overwritten.
+    if (retention == RetentionPolicy::OverwriteOldest)
+        return ringSize - 2 * flash.getPageSize();
+
+    return logEnd - dataEnd;
 }
 
 /**
- * Clean the given buffer of invalid LogFS symbols ("-->" and optionally ",\t\n")
+ * Determine the logical offset of the first complete row retained in a circular log.
  *
- * @param s the data to clean
- * @param len the number of characters to clean
- * @param removeSeperators if set to false, only "-->" symbols are erased, otherwise ",\t\n" characters are also removed.
- * @return a cleaned version of the string supplied, if any changes are necessary. Otherwise, an empty string is returned.
+ * The ring holds every page but the one erased ahead of the data, so the oldest retained page follows
+ * from the logical length alone. Its first row is likely to have started on the page before, so
+ * the retained data starts after the first newline.
  */
-ManagedString MicroBitLog::cleanBuffer(const char *s, int len, bool removeSeparators)
+uint32_t MicroBitLog::_ringFirstRow()
 {
-    ManagedString out;
+    uint32_t pageSize = flash.getPageSize();
+    uint32_t pages = _dataLength() / pageSize + 1;
+    uint32_t ringPages = ringSize / pageSize;
 
-    for (int i=0; i<len; i++)
+    if (pages <= ringPages)
+        return 0;
+
+    uint32_t start = (pages - ringPages) * pageSize;
+
+    if (start != ringSkipFrom)
     {
-        if (i+2 < len && s[i] == '-' && s[i+1] == '-' && s[i+2] == '>')
-        {
-            if (out.length() == 0)
-                out = ManagedString(s, len);
-            *(char *)(out.toCharArray()+i) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
-            *(char *)(out.toCharArray()+i+1) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
-            *(char *)(out.toCharArray()+i+2) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
-        }
+        uint32_t end = _dataLength();
+        uint32_t first = start;
+        uint8_t c;
 
-        if (s[i] == '\t' || (removeSeparators && (s[i] == ',' || s[i] == '\n')))
+        // If power was lost just after the page was erased ahead of the data, the oldest page is already gone.
+        cache.read(dataStart + first % ringSize, &c, 1);
+        if (c == 0xFF)
+            first += pageSize;
+
+        while (first < end)
         {
-            if (out.length() == 0)
-                out = ManagedString(s, len);
-            *(char *)(out.toCharArray()+i) = CONFIG_MICROBIT_LOG_INVALID_CHAR_VALUE;
+            cache.read(dataStart + first % ringSize, &c, 1);
+            first++;
+
+            if (c == '\n')
+                break;
         }
+
+        ringSkipFrom = start;
+        ringSkip = first - start;
     }
-    return out;
+
+    return ringSkipFrom + ringSkip;
 }
 
 /**
- * Inject the given row into the log as text, ignoring key/value pairs.
- * @param s the string to inject.
+ * Read retained data from a circular log, preceded by the latest column headings if older rows have been overwritten.
+ * Parameters are as for _readSource().
  */
-int MicroBitLog::logString(const char *s)
+int MicroBitLog::_readCircular( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen)
 {
-    int r;
+    int r = DEVICE_OK;
+    uint32_t first = _ringFirstRow();
 
-    mutex.wait();
-    r = _logString(s);
-    mutex.notify();
+    if (first && headingLength)
+    {
+        uint32_t l = min(headingLength, srcLen);
+
+        r = _readSource( data, index, len, srcIndex, NULL, headingStart, l);
+        srcLen -= l;
+    }
+
+    // The retained data may wrap around the end of the ring.
+    uint32_t address = dataStart + first % ringSize;
+    uint32_t l = min(_dataLength() - first, srcLen);
+    uint32_t l1 = min(l, dataStart + ringSize - address);
+
+    if (r == DEVICE_OK)
+        r = _readSource( data, index, len, srcIndex, NULL, address, l1);
+
+    if (r == DEVICE_OK)
+        r = _readSource( data, index, len, srcIndex, NULL, dataStart, l - l1);
 
     return r;
 }
 
 /**
- * Inject the given row into the log as text, ignoring key/value pairs.
- * @param s the string to inject.
+ * Restart expansion of binary records from the start of the data section.
  */
-int MicroBitLog::_logString(const char *s)
-{  
-    init();
+void MicroBitLog::_resetReader()
+{
+    readAddress = dataStart;
+    readOffset = 0;
+    readRecord = ManagedString::EmptyString;
 
-    uint32_t oldDataEnd = dataEnd;
-    uint32_t l = strlen(s);
-    const char *data = s;
+    if (readBase)
+        memset(readBase, 0, readBaseCount * sizeof(int32_t));
+}
 
-    // If this is the first log entry written, ensure that the file visibility is activated.
-    // (it may have been disabled following a full erase)
-    if (dataStart == dataEnd)
-        _setVisibility(true);
+/**
+ * Read an unsigned integer stored in base 127 from the given address, and move the address on past it.
+ */
+uint32_t MicroBitLog::_readVarint(uint32_t &address)
+{
+    uint32_t v = 0;
+    uint32_t scale = 1;
+    uint8_t b;
 
-    // If we can't write a whole line of data, then treat the log as full.
-    if (l > logEnd - dataEnd)
+    do {
+        cache.read(address++, &b, 1);
+        v += (b & 0x7F) * scale;
+        scale *= 127;
+    } while ((b & 0x80) && address < dataEnd);
+
+    return v;
+}
+
+/**
+ * Expand the binary record at readAddress into readRecord, and move readAddress on to the next record.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if there are no more records.
+ */
+int MicroBitLog::_expandRecord()
+{
+    uint8_t tag;
+
+    readOffset += readRecord.length();
+    readRecord = ManagedString::EmptyString;
+
+    while (readAddress < dataEnd)
     {
-        if (!(status & MICROBIT_LOG_STATUS_FULL))
+        cache.read(readAddress++, &tag, 1);
+
+        if (tag == MICROBIT_LOG_RECORD_SYNC)
         {
-            cache.write(logEnd+1, "FUL", 3);
-            status |= MICROBIT_LOG_STATUS_FULL;
+            if (readBase)
+                memset(readBase, 0, readBaseCount * sizeof(int32_t));
+            continue;
         }
 
-        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_LOG_FULL);
-        return DEVICE_NO_RESOURCES;
-    }
+        if (tag == MICROBIT_LOG_RECORD_TEXT)
+        {
+            uint32_t l = _readVarint(readAddress);
+            char *text = (char *) malloc(l);
 
-    ManagedString cleaned = cleanBuffer(data, l, false);
-    if (cleaned.length())
-        data = cleaned.toCharArray();
+            if (text == NULL || readAddress + l > dataEnd)
+            {
+                free(text);
+                return DEVICE_INVALID_PARAMETER;
+            }
 
-    // If requested, log the data over the serial port
-    if (status & MICROBIT_LOG_STATUS_SERIAL_MIRROR && l > 0)
-    {
-        serial.send((uint8_t *)data, l-1);
-        serial.send((uint8_t *)"\r\n", 2);
-    }
+            cache.read(readAddress, text, l);
+            readAddress += l;
+            readRecord = ManagedString(text, l);
+            free(text);
 
-    while (l > 0)
-    {
-        uint32_t spaceOnPage = flash.getPageSize() - (dataEnd % flash.getPageSize());
-        //DMESG("SPACE_ON_PAGE: %d", spaceOnPage);
-        int lengthToWrite = min(l, spaceOnPage);
+            return DEVICE_OK;
+        }
 
-        // If we're going to fill (or overspill) the current page, erase the next one ready for use.
-        if (spaceOnPage <= l && dataEnd+spaceOnPage < logEnd)
+        if (tag == MICROBIT_LOG_RECORD_ROW)
         {
-            uint32_t nextPage = ((dataEnd / flash.getPageSize()) + 1) * flash.getPageSize();
+            uint32_t n = _readVarint(readAddress);
+            uint32_t typeBytes = (n + 2) / 3;
 
-            //DMESG("   ERASING PAGE %p", nextPage);
-            flash.erase(nextPage);
-        }
+            if (n > readBaseCount)
+            {
+                int32_t *b = (int32_t *) realloc(readBase, n * sizeof(int32_t));
+                if (b == NULL)
+                    return DEVICE_INVALID_PARAMETER;
 
-        // Perform a write through cache update
-        //DMESG("   WRITING [ADDRESS: %p] [LENGTH: %d] ", dataEnd, lengthToWrite);
-        cache.write(dataEnd, data, lengthToWrite);
+                memset(&b[readBaseCount], 0, (n - readBaseCount) * sizeof(int32_t));
+                readBase = b;
+                readBaseCount = n;
+            }
 
-        // move on pointers
-        dataEnd += lengthToWrite;
-        data += lengthToWrite;
-        l -= lengthToWrite;
-    }
+            uint8_t *types = (uint8_t *) malloc(typeBytes);
+            if (types == NULL || readAddress + typeBytes > dataEnd)
+            {
+                free(types);
+                return DEVICE_INVALID_PARAMETER;
+            }
 
-    // Write a new entry into the log journal if we crossed a cache block boundary
-    if ((dataEnd / CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE) != (oldDataEnd / CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE))
-    {
-        uint32_t oldJournalHead = journalHead;
-        oldDataEnd = dataEnd;
+            cache.read(readAddress, types, typeBytes);
+            readAddress += typeBytes;
 
-        // Record that we've moved on the journal log by one entry
-        journalHead += MICROBIT_LOG_JOURNAL_ENTRY_SIZE;
+            ManagedString row;
+            ManagedString sep = ",";
+            char number[24];
+            int r = DEVICE_OK;
 
-        // If we've moved onto another page, ensure it is erased.
-        if (journalHead % flash.getPageSize() == 0)
-        {
-            //DMESG("JOURNAL PAGE BOUNDARY: %p", journalHead);
-            // If we've rolled over the last page, cycle around.
-            if (journalHead == dataStart)
+            for (uint32_t i=0; i<n && r == DEVICE_OK; i++)
             {
-                //DMESG("JOURNAL WRAPAROUND");
-                journalHead = journalStart;
+                int type = (types[i / 3] >> (2 * (i % 3))) & 0x03;
+                uint8_t decimals = 0;
+
+                switch (type)
+                {
+                    case MICROBIT_LOG_COLUMN_DECIMAL:
+                        cache.read(readAddress++, &decimals, 1);
+                        if (decimals > 10)
+                        {
+                            r = DEVICE_INVALID_PARAMETER;
+                            break;
+                        }
+                        // Fall through
+
+                    case MICROBIT_LOG_COLUMN_INTEGER:
+                        readBase[i] = (int32_t)((uint32_t)readBase[i] + (uint32_t)unzigzag(_readVarint(readAddress)));
+                        row = row + ManagedString(number, renderNumber(number, readBase[i], decimals));
+                        break;
+
+                    case MICROBIT_LOG_COLUMN_STRING:
+                    {
+                        uint32_t l = _readVarint(readAddress);
+                        char *text = (char *) malloc(l);
+
+                        if (text == NULL || readAddress + l > dataEnd)
+                        {
+                            free(text);
+                            r = DEVICE_INVALID_PARAMETER;
+                            break;
+                        }
+
+                        cache.read(readAddress, text, l);
+                        readAddress += l;
+                        row = row + ManagedString(text, l);
+                        free(text);
+                        break;
+                    }
+
+                    default:
+                        break;
+                }
+
+                if (i + 1 != n)
+                    row = row + sep;
             }
 
-            //DMESG("ERASING JOURNAL PAGE: %p", journalHead);
-            cache.erase(journalHead);
-            flash.erase(journalHead);
+            free(types);
+
+            if (r != DEVICE_OK)
+                return r;
+
+            readRecord = row + "\n";
+            return DEVICE_OK;
+        }
+
+        // Unused flash, or something we don't understand.
+        break;
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Add the given heading to the list of headings in use. If the heading already exists,
+ * this method has no effect.
+ * 
+ * @param key the heading to add
+ * @param value the initial value to add, or ManagedString::EmptyString
+ * @param head true to add the given field at the front of the list, false to add at the end.
+ */
+void MicroBitLog::addHeading(ManagedString key, ManagedString value, bool head)
+{
+    if (_findColumn(key.toCharArray(), key.length()) >= 0)
+        return;
+
+    _reserveColumns(headingCount + 1);
+
+    int newColumn = head ? 0 : headingCount;
+
+    // Make space at the front of the list if necessary.
+    if (head)
+    {
+        for (uint32_t i=headingCount; i>0; i--)
+        {
+            rowData[i].key = rowData[i-1].key;
+            rowData[i].value = rowData[i-1].value;
+            rowData[i].number = rowData[i-1].number;
+            rowData[i].decimals = rowData[i-1].decimals;
+            rowData[i].numeric = rowData[i-1].numeric;
+            rowData[i].previous = rowData[i-1].previous;
+            rowData[i].hash = rowData[i-1].hash;
         }
+    }
 
-        // Write journal entry
-        JournalEntry je;
-        writeNum(je.length, ((dataEnd-dataStart) / CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE) * CONFIG_MICROBIT_LOG_CACHE_BLOCK_SIZE);
-        cache.write(journalHead, &je, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+    rowData[newColumn].key = key;
+    rowData[newColumn].value = value;
+    rowData[newColumn].number = 0;
+    rowData[newColumn].decimals = 0;
+    rowData[newColumn].numeric = false;
+    rowData[newColumn].previous = 0;
+    rowData[newColumn].hash = hashKey(key.toCharArray(), key.length());
+    headingCount++;
 
-        // Invalidate the old one
-        JournalEntry empty;
-        empty.clear();
-        //DMESG("   INVALIDATING: %p", oldJournalHead);
-        cache.write(oldJournalHead, &empty, MICROBIT_LOG_JOURNAL_ENTRY_SIZE);
+    // Columns at the end can simply be added to the index. Otherwise every column has moved.
+    if (head)
+    {
+        _indexColumns();
     }
+    else
+    {
+        uint32_t mask = columnIndexSize - 1;
+        uint32_t slot = rowData[newColumn].hash & mask;
 
-    // Return NO_RESOURCES if we ran out of FLASH space.
-    if (l == 0)
-        return DEVICE_OK;
+        while (columnIndex[slot])
+            slot = (slot + 1) & mask;
 
-    Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_LOG_FULL);
-    return DEVICE_NO_RESOURCES;
+        columnIndex[slot] = newColumn + 1;
+    }
+
+    headingsChanged = true;
 }
 
 /**
- * Inject the given row into the log as text, ignoring key/value pairs.
- * @param s the string to inject.
+ * Locate the column with the given heading.
+ *
+ * @param key the heading to find.
+ * @param length the length of key, in bytes.
+ * @return the index of the column in rowData, or -1 if no such column exists.
  */
-int MicroBitLog::logString(ManagedString s)
+int MicroBitLog::_findColumn(const char *key, uint32_t length)
 {
-    int r;
+    if (headingCount == 0)
+        return -1;
 
-    mutex.wait();
-    r = _logString(s);
-    mutex.notify();
+    uint32_t hash = hashKey(key, length);
+    uint32_t mask = columnIndexSize - 1;
+    uint32_t slot = hash & mask;
 
-    return r;
+    while (columnIndex[slot])
+    {
+        ColumnEntry &c = rowData[columnIndex[slot] - 1];
+
+        // Headings are interned in rowData, so callers reusing the same ManagedString match without a string compare.
+        if (c.hash == hash && c.key.length() == (int)length && (c.key.toCharArray() == key || memcmp(c.key.toCharArray(), key, length) == 0))
+            return columnIndex[slot] - 1;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
 }
 
 /**
- * Inject the given row into the log as text, ignoring key/value pairs.
- * @param s the string to inject.
+ * Ensure rowData has space for at least the given number of columns, preserving any existing columns.
+ * @param count the number of columns required.
  */
-int MicroBitLog::_logString(ManagedString s)
+void MicroBitLog::_reserveColumns(uint32_t count)
 {
-    return _logString(s.toCharArray());
+    if (count <= columnCapacity)
+        return;
+
+    uint32_t capacity = columnCapacity ? columnCapacity : CONFIG_MICROBIT_LOG_COLUMN_CAPACITY;
+    while (capacity < count)
+        capacity = capacity * 2;
+
+    ColumnEntry* newRowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * capacity);
+
+    for (uint32_t i=0; i<capacity; i++)
+        new (&newRowData[i]) ColumnEntry;
+
+    for (uint32_t i=0; i<headingCount; i++)
+    {
+        newRowData[i].key = rowData[i].key;
+        newRowData[i].value = rowData[i].value;
+        newRowData[i].number = rowData[i].number;
+        newRowData[i].decimals = rowData[i].decimals;
+        newRowData[i].numeric = rowData[i].numeric;
+        newRowData[i].previous = rowData[i].previous;
+        newRowData[i].hash = rowData[i].hash;
+    }
+
+    _freeColumns();
+
+    rowData = newRowData;
+    columnCapacity = capacity;
+
+    // The index is probed with a mask, so round it up to a power of two, whatever the configured capacity.
+    columnIndexSize = 1;
+    while (columnIndexSize < capacity * 2)
+        columnIndexSize = columnIndexSize * 2;
+
+    columnIndex = (uint16_t *) malloc(sizeof(uint16_t) * columnIndexSize);
+
+    _indexColumns();
 }
 
 /**
- * Add the given heading to the list of headings in use. If the heading already exists,
- * this method has no effect.
- * 
- * @param key the heading to add
- * @param value the initial value to add, or ManagedString::EmptyString
- * @param head true to add the given field at the front of the list, false to add at the end.
+ * Rebuild the column index from the headings in rowData.
  */
-void MicroBitLog::addHeading(ManagedString key, ManagedString value, bool head)
+void MicroBitLog::_indexColumns()
 {
-    for (uint32_t i=0; i<headingCount; i++)
-        if (rowData[i].key == key)
-            return;
+    if (columnIndex == NULL)
+        return;
 
-    ColumnEntry* newRowData = (ColumnEntry *) malloc(sizeof(ColumnEntry) * (headingCount+1));
-    int columnShift = head ? 1 : 0;
-    int newColumn = head ? 0 : headingCount;
+    uint32_t mask = columnIndexSize - 1;
+    memclr(columnIndex, sizeof(uint16_t) * columnIndexSize);
 
     for (uint32_t i=0; i<headingCount; i++)
     {
-        new (&newRowData[i+columnShift]) ColumnEntry;
-        newRowData[i+columnShift].key = rowData[i].key;
-        newRowData[i+columnShift].value = rowData[i].value;
-        rowData[i].key = ManagedString::EmptyString;
-        rowData[i].value = ManagedString::EmptyString;
-    }   
-    
+        uint32_t slot = rowData[i].hash & mask;
+
+        while (columnIndex[slot])
+            slot = (slot + 1) & mask;
+
+        columnIndex[slot] = i + 1;
+    }
+}
+
+/**
+ * Release all column headings and the column index.
+ */
+void MicroBitLog::_freeColumns()
+{
     if (rowData)
+    {
+        for (uint32_t i=0; i<columnCapacity; i++)
+            rowData[i].~ColumnEntry();
+
         free(rowData);
+        rowData = NULL;
+    }
 
-    new (&newRowData[newColumn]) ColumnEntry;
-    newRowData[newColumn].key = key;
-    newRowData[newColumn].value = value;
-    headingCount++;
+    if (columnIndex)
+    {
+        free(columnIndex);
+        columnIndex = NULL;
+    }
 
-    rowData = newRowData;
-    headingsChanged = true;
+    columnCapacity = 0;
+    columnIndexSize = 0;
+    headings = ManagedString::EmptyString;
 }
 
 /**
  * Marks an existing Log as invalid. The log will be cleared with the default settings the next time
  * a user attempts to use it. If no valid log is present, this method has no effect.
+ *
+ * @param deferred If true, return at once, and invalidate the log in the background once the scheduler is running.
+ * The log is still invalidated before any other use of it. Defaults to false.
  */
-void MicroBitLog::invalidate()
+void MicroBitLog::invalidate(bool deferred)
 {
+    if (deferred && EventModel::defaultEventBus)
+    {
+        // Writing to the interface chip's flash takes a while, so leave it to a background fiber.
+        // Any other use of the log finishes the job first.
+        if (!(status & MICROBIT_LOG_STATUS_INVALIDATE_LISTENING))
+        {
+            EventModel::defaultEventBus->listen(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_INVALIDATE, this, &MicroBitLog::onInvalidate);
+            status |= MICROBIT_LOG_STATUS_INVALIDATE_LISTENING;
+        }
+
+        status |= MICROBIT_LOG_STATUS_INVALIDATE_PENDING;
+        Event(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_INVALIDATE);
+        return;
+    }
+
     mutex.wait();
+    status &= ~MICROBIT_LOG_STATUS_INVALIDATE_PENDING;
     _invalidate();
     mutex.notify();
 }
 
+/**
+ * Background invalidation, requested by invalidate(true).
+ */
+void MicroBitLog::onInvalidate(Event)
+{
+    mutex.wait();
+    _invalidatePending();
+    mutex.notify();
+}
+
+/**
+ * Invalidates the log now if invalidate(true) has been called, and it has not been done yet.
+ */
+void MicroBitLog::_invalidatePending()
+{
+    if (status & MICROBIT_LOG_STATUS_INVALIDATE_PENDING)
+    {
+        status &= ~MICROBIT_LOG_STATUS_INVALIDATE_PENDING;
+        _invalidate();
+    }
+}
+
 
 /**
  * Marks an existing Log as invalid. The log will be cleared with the default settings the next time
@@ -921,6 +2896,10 @@ void MicroBitLog::_invalidate()
         flash.write(logEnd, (uint32_t *) &m, 1);
     }
 
+    // Anything still queued belongs to the invalidated log.
+    queueHead = 0;
+    queueLength = 0;
+
     status &= ~MICROBIT_LOG_STATUS_INITIALIZED; 
 }
 
@@ -933,6 +2912,7 @@ bool MicroBitLog::isPresent()
 {
     bool r;
     mutex.wait();
+    _invalidatePending();
     r = _isPresent();
     mutex.notify();
 
@@ -999,12 +2979,21 @@ bool MicroBitLog::isFull()
  */
 uint32_t MicroBitLog::getDataLength(DataFormat format)
 {
-    uint32_t r = 0;
+    uint32_t r;
     mutex.wait();
+    r = _getDataLength(format);
+    mutex.notify();
+    return r;
+}
+
+uint32_t MicroBitLog::_getDataLength(DataFormat format)
+{
+    uint32_t r = 0;
     init();
+    _flush();
     uint32_t hdr = sizeof(header);
     uint32_t mtr = sizeof(MicroBitLogMetaData);
-    uint32_t csv = dataEnd - dataStart;
+    uint32_t csv = _getCsvLength();
     switch (format)
     {
         case DataFormat::HTMLHeader:
@@ -1017,7 +3006,6 @@ uint32_t MicroBitLog::getDataLength(DataFormat format)
             r = csv;
             break;
     }
-    mutex.notify();
     return r;
 }
 
@@ -1042,17 +3030,237 @@ int MicroBitLog::readData(void *data, uint32_t index, uint32_t len, DataFormat f
     return r;
 }
 
+/**
+ * Finds where the rows logged since a given time start in the CSV data, using the time index, so that a
+ * partial export takes the same time however long the log is. The offset returned is that of an indexed row
+ * logged no later than the time given, so up to one index interval (at least CONFIG_MICROBIT_LOG_INDEX_INTERVAL
+ * bytes) of earlier rows may precede the first one wanted. Only rows logged since the micro:bit last started are
+ * considered, and rows are indexed as endRow() writes them, so text added by logString() is never the start of an
+ * indexed range.
+ *
+ * @param time the time in ms since the micro:bit started, as given by system_timer_current_time().
+ * @return the offset into the CSV data from which readRange() should read, which is the length of the data
+ * if no rows have been logged since the micro:bit started, or DEVICE_NOT_SUPPORTED if the log has no index
+ * (such as a log formatted without one, or a circular log).
+ */
+int MicroBitLog::seekToTime(uint32_t time)
+{
+    int r;
+    mutex.wait();
+    r = _seekToTime(time);
+    mutex.notify();
+    return r;
+}
+
+int MicroBitLog::_seekToTime(uint32_t time)
+{
+    MicroBitLogIndexEntry e;
+    uint32_t length = _getDataLength(DataFormat::CSV);
+    int r = (int) length;
+
+    if (indexStart == 0)
+        return DEVICE_NOT_SUPPORTED;
+
+    // Entries of this session are the most recent ones, so search back until one is early enough, or the session began.
+    for (uint32_t i = indexCount; i > 0 && indexOpen; i--)
+    {
+        _readIndex(i - 1, e);
+
+        if (e.address == 0)
+            continue;
+
+        if (e.session != indexSession)
+            break;
+
+        r = (int) e.offset;
+
+        if (e.time <= time)
+            break;
+    }
+
+    return r;
+}
+
+/**
+ * Reads part of the recorded data as CSV, such as from the offset given by seekToTime().
+ * In a binary log, rows are expanded from the nearest indexed row before the offset, rather than from the start.
+ *
+ * @param data pointer to memory to store the data.
+ * @param index the offset into the CSV data of the first byte to read.
+ * @param len the maximum number of bytes to read.
+ * @return the number of bytes read, zero if index is at or past the end of the data, or DEVICE_INVALID_PARAMETER
+ * if the data could not be read.
+ */
+int MicroBitLog::readRange(void *data, uint32_t index, uint32_t len)
+{
+    int r;
+    mutex.wait();
+    r = _readRange((uint8_t *) data, index, len);
+    mutex.notify();
+    return r;
+}
+
+int MicroBitLog::_readRange(uint8_t *data, uint32_t index, uint32_t len)
+{
+    uint32_t length = _getDataLength(DataFormat::CSV);
+
+    if (index >= length)
+        return 0;
+
+    len = min(len, length - index);
+
+    int r = _readData(data, index, len, DataFormat::CSV, length);
+    return r == DEVICE_OK ? (int) len : r;
+}
+
+/**
+ * Starts a sequential export of the recorded data, such as a transfer over BLE or serial.
+ * Unlike readData(), the export keeps its position between calls and reads ahead from flash in blocks of
+ * CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE bytes, so the whole log is exported in linear time however small
+ * the chunks requested. The export covers the data recorded when it is started. Rows logged afterwards
+ * are not included. Starting a new export abandons any export in progress.
+ *
+ * @param format the data format to export.
+ * @return the total length of the export in bytes, or DEVICE_NO_RESOURCES if the read ahead buffer could not
+ * be allocated.
+ */
+int MicroBitLog::beginExport(DataFormat format)
+{
+    int r;
+
+    mutex.wait();
+
+    if (exportBuffer == NULL)
+        exportBuffer = (uint8_t *) malloc(CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE);
+
+    if (exportBuffer == NULL)
+    {
+        r = DEVICE_NO_RESOURCES;
+    }
+    else
+    {
+        exportFormat = format;
+        exportLength = _getDataLength(format);
+        exportIndex = 0;
+        exportBufferStart = 0;
+        exportBufferLength = 0;
+        r = exportLength;
+    }
+
+    mutex.notify();
+    return r;
+}
+
+/**
+ * Reads the next part of the export started by beginExport().
+ *
+ * @param data pointer to memory to store the data.
+ * @param len the maximum number of bytes to read.
+ * @return the number of bytes read, zero at the end of the export (or if no export is in progress, or the log
+ * has been cleared since it started), or DEVICE_INVALID_PARAMETER if the data could not be read.
+ */
+int MicroBitLog::readExport(void *data, uint32_t len)
+{
+    uint8_t *out = (uint8_t *) data;
+    uint32_t done = 0;
+    int r = DEVICE_OK;
+
+    mutex.wait();
+
+    if (exportBuffer == NULL)
+        len = 0;
+    else if (len > exportLength - exportIndex)
+        len = exportLength - exportIndex;
+
+    while (done < len)
+    {
+        // Refill the read ahead buffer once it has been consumed.
+        if (exportIndex >= exportBufferStart + exportBufferLength)
+        {
+            exportBufferStart = exportIndex;
+            exportBufferLength = min(exportLength - exportIndex, (uint32_t) CONFIG_MICROBIT_LOG_EXPORT_BUFFER_SIZE);
+
+            r = _readData(exportBuffer, exportBufferStart, exportBufferLength, exportFormat, exportLength);
+
+            if (r != DEVICE_OK)
+            {
+                exportBufferLength = 0;
+                break;
+            }
+        }
+
+        uint32_t n = min(len - done, exportBufferStart + exportBufferLength - exportIndex);
+        memcpy(out + done, exportBuffer + (exportIndex - exportBufferStart), n);
+
+        done += n;
+        exportIndex += n;
+    }
+
+    mutex.notify();
+
+    return r == DEVICE_OK ? (int) done : r;
+}
+
+/**
+ * Moves the position of the export started by beginExport(), such as to resume an interrupted transfer.
+ *
+ * @param index the offset into the export to continue from.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no export is in progress or the index is beyond its end.
+ */
+int MicroBitLog::seekExport(uint32_t index)
+{
+    int r = DEVICE_OK;
+
+    mutex.wait();
+
+    if (exportBuffer == NULL || index > exportLength)
+    {
+        r = DEVICE_INVALID_PARAMETER;
+    }
+    else
+    {
+        // Refill the read ahead buffer from the new position, unless it is already held.
+        if (index < exportBufferStart || index >= exportBufferStart + exportBufferLength)
+        {
+            exportBufferStart = index;
+            exportBufferLength = 0;
+        }
+
+        exportIndex = index;
+    }
+
+    mutex.notify();
+    return r;
+}
+
+/**
+ * Ends the export started by beginExport(), and releases its read ahead buffer.
+ */
+void MicroBitLog::endExport()
+{
+    mutex.wait();
+
+    free(exportBuffer);
+    exportBuffer = NULL;
+    exportLength = 0;
+    exportIndex = 0;
+    exportBufferLength = 0;
+
+    mutex.notify();
+}
+
 int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataFormat format, uint32_t length)
 {
     int r = DEVICE_OK;
     
     init();
+    _flush();
     
     uint32_t hdr = sizeof(header);
     uint32_t mtr = sizeof(MicroBitLogMetaData);
 
     // Check if there is less data than expected
-    uint32_t dataMax = dataEnd - dataStart;
+    uint32_t dataMax = _getCsvLength();
     uint32_t dataLen = dataMax;
     switch (format)
     {
@@ -1075,6 +3283,11 @@ int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataForm
     writeNum(meta.dataStart+2, hdr + mtr);
     writeNum(meta.logEnd+2, logEnd - (dataStart - hdr - mtr));
 
+    // Binary data is presented as text.
+    bool binary = storageFormat == StorageFormat::Binary;
+    bool circular = retention == RetentionPolicy::OverwriteOldest;
+    meta.version[MICROBIT_LOG_VERSION_FORMAT_INDEX] = MICROBIT_LOG_VERSION[MICROBIT_LOG_VERSION_FORMAT_INDEX];
+
     uint8_t end = 0xFF;
     
     uint32_t pos = 0;
@@ -1089,12 +3302,22 @@ int MicroBitLog::_readData(uint8_t *data, uint32_t index, uint32_t len, DataForm
         case DataFormat::HTML:
             _readSource( data, index, len, pos, header, 0, hdr);
             _readSource( data, index, len, pos, &meta,  0, mtr);
-            r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
+            if (binary)
+                r = _readExpanded( data, index, len, pos, dataLen);
+            else if (circular)
+                r = _readCircular( data, index, len, pos, dataLen);
+            else
+                r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
             if (r == DEVICE_OK)
               _readSource( data, index, len, pos, &end, 0, sizeof(end));
             break;
         case DataFormat::CSV:
-            r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
+            if (binary)
+                r = _readExpanded( data, index, len, pos, dataLen);
+            else if (circular)
+                r = _readCircular( data, index, len, pos, dataLen);
+            else
+                r = _readSource( data, index, len, pos, NULL, dataStart, dataLen);
             break;
     }
     return r;
@@ -1139,12 +3362,73 @@ int MicroBitLog::_readSource( uint8_t *&data, uint32_t &index, uint32_t &len, ui
     return r;
 }
 
+/**
+ * Read data stored in StorageFormat::Binary, expanded to CSV.
+ * @param data pointer reference to memory to store the data
+ * @param index  reference to the index into the data
+ * @param len reference to the length of the data to fetch
+ * @param srcIndex reference to the index where the expanded data should begin
+ * @param srcLen the length of the expanded data
+ * @return DEVICE_OK on success; DEVICE_INVALID_PARAMETER if data is not available for the request
+ * @note On success, the referenced pointers, indices and lengths are updated ready for the next call
+ */
+int MicroBitLog::_readExpanded( uint8_t *&data, uint32_t &index, uint32_t &len, uint32_t &srcIndex, uint32_t srcLen)
+{
+    uint32_t next = srcIndex + srcLen;
+    uint32_t length = index < next ? next - index : 0;
+    if ( length > len)
+        length = len;
+
+    uint32_t offset = index - srcIndex;
+    uint32_t done = 0;
+
+    // Reads are typically sequential, so carry on from the last record expanded where possible.
+    // Otherwise, start from the nearest indexed row.
+    if ( length && (offset < readOffset || offset - readOffset >= indexInterval))
+        _seekReader(offset);
+
+    while ( done < length)
+    {
+        uint32_t recordLength = readRecord.length();
+
+        if ( offset + done < readOffset + recordLength)
+        {
+            uint32_t start = offset + done - readOffset;
+            uint32_t n = min(recordLength - start, length - done);
+
+            memcpy(data + done, readRecord.toCharArray() + start, n);
+            done += n;
+        }
+        else if ( _expandRecord() != DEVICE_OK)
+        {
+            return DEVICE_INVALID_PARAMETER;
+        }
+    }
+
+    data    += length;
+    index   += length;
+    len     -= length;
+
+    srcIndex = next;
+    return DEVICE_OK;
+}
+
 /**
  * Destructor.
  */
 MicroBitLog::~MicroBitLog()
 {
+    if (status & MICROBIT_LOG_STATUS_QUEUE_LISTENING)
+        EventModel::defaultEventBus->ignore(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_QUEUE_DRAIN, this, &MicroBitLog::onQueueDrain);
+
+    if (status & MICROBIT_LOG_STATUS_INVALIDATE_LISTENING)
+        EventModel::defaultEventBus->ignore(MICROBIT_ID_LOG, MICROBIT_LOG_EVT_INVALIDATE, this, &MicroBitLog::onInvalidate);
 
+    _sync();
+    free(queue);
+    _freeColumns();
+    free(readBase);
+    free(exportBuffer);
 }
 
 const uint8_t MicroBitLog::header[2048] = {0x3c,0x6d,0x65,0x74,0x61,0x20,0x63,0x68,0x61,0x72,0x73,0x65,0x74,0x3d,0x75,0x74,0x66,0x2d,0x38,0x3e,0x3c,0x73,0x74,0x79,0x6c,0x65,0x3e,0x2e,0x62,0x62,0x7b,0x64,0x69,0x73,0x70,0x6c,0x61,0x79,0x3a,0x66,0x6c,0x65,0x78,0x7d,0x2e,0x62,0x62,0x3e,0x2a,0x2b,0x2a,0x7b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x2d,0x6c,0x65,0x66,0x74,0x3a,0x31,0x30,0x70,0x78,0x7d,0x62,0x6f,0x64,0x79,0x7b,0x66,0x6f,0x6e,0x74,0x2d,0x66,0x61,0x6d,0x69,0x6c,0x79,0x3a,0x73,0x61,0x6e,0x73,0x2d,0x73,0x65,0x72,0x69,0x66,0x3b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x3a,0x31,0x65,0x6d,0x7d,0x74,0x61,0x62,0x6c,0x65,0x7b,0x62,0x6f,0x72,0x64,0x65,0x72,0x2d,0x63,0x6f,0x6c,0x6c,0x61,0x70,0x73,0x65,0x3a,0x63,0x6f,0x6c,0x6c,0x61,0x70,0x73,0x65,0x3b,0x6d,0x61,0x72,0x67,0x69,0x6e,0x2d,0x74,0x6f,0x70,0x3a,0x31,0x65,0x6d,0x3b,0x74,0x65,0x78,0x74,0x2d,0x61,0x6c,0x69,0x67,0x6e,0x3a,0x72,0x69,0x67,0x68,0x74,0x7d,0x74,0x72,0x3a,0x66,0x69,0x72,0x73,0x74,0x2d,0x63,0x68,0x69,0x6c,0x64,0x7b,0x66,0x6f,0x6e,0x74,0x2d,0x77,0x65,0x69,0x67,0x68,0x74,0x3a,0x37,0x30,0x30,0x7d,0x74,0x64,0x7b,0x62,0x6f,0x72,0x64,0x65,0x72,0x3a,0x31,0x70,0x78,0x20,0x73,0x6f,0x6c,0x69,0x64,0x20,0x23,0x64,0x64,0x64,0x3b,0x70,0x61,0x64,0x64,0x69,0x6e,0x67,0x3a,0x38,0x70,0x78,0x3b,0x6d,0x69,0x6e,0x2d,0x77,0x69,0x64,0x74,0x68,0x3a,0x38,0x63,0x68,0x7d,0x69,0x66,0x72,0x61,0x6d,0x65,0x7b,0x64,0x69,0x73,0x70,0x6c,0x61,0x79,0x3a,0x6e,0x6f,0x6e,0x65,0x7d,0x3c,0x2f,0x73,0x74,0x79,0x6c,0x65,0x3e,0x3c,0x6c,0x69,0x6e,0x6b,0x20,0x72,0x65,0x6c,0x3d,0x73,0x74,0x79,0x6c,0x65,0x73,0x68,0x65,0x65,0x74,0x20,0x68,0x72,0x65,0x66,0x3d,0x68,0x74,0x74,0x70,0x73,0x3a,0x2f,0x2f,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x6f,0x72,0x67,0x2f,0x64,0x6c,0x2f,0x32,0x2f,0x64,0x6c,0x2e,0x63,0x73,0x73,0x3e,0x3c,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x6c,0x65,0x74,0x20,0x77,0x3d,0x77,0x69,0x6e,0x64,0x6f,0x77,0x2c,0x64,0x3d,0x64,0x6f,0x63,0x75,0x6d,0x65,0x6e,0x74,0x2c,0x6c,0x3d,0x77,0x2e,0x6c,0x6f,0x63,0x61,0x74,0x69,0x6f,0x6e,0x2c,0x6e,0x3d,0x6e,0x75,0x6c,0x6c,0x2c,0x63,0x73,0x76,0x3d,0x22,0x22,0x2c,0x74,0x61,0x67,0x3d,0x64,0x2e,0x63,0x72,0x65,0x61,0x74,0x65,0x45,0x6c,0x65,0x6d,0x65,0x6e,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x64,0x29,0x3b,0x77,0x2e,0x64,0x6c,0x3d,0x7b,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6c,0x65,0x74,0x20,0x65,0x3d,0x74,0x61,0x67,0x28,0x22,0x61,0x22,0x29,0x3b,0x65,0x2e,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3d,0x22,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x63,0x73,0x76,0x22,0x2c,0x65,0x2e,0x68,0x72,0x65,0x66,0x3d,0x55,0x52,0x4c,0x2e,0x63,0x72,0x65,0x61,0x74,0x65,0x4f,0x62,0x6a,0x65,0x63,0x74,0x55,0x52,0x4c,0x28,0x6e,0x65,0x77,0x20,0x42,0x6c,0x6f,0x62,0x28,0x5b,0x63,0x73,0x76,0x5d,0x2c,0x7b,0x74,0x79,0x70,0x65,0x3a,0x22,0x74,0x65,0x78,0x74,0x2f,0x70,0x6c,0x61,0x69,0x6e,0x22,0x7d,0x29,0x29,0x2c,0x65,0x2e,0x63,0x6c,0x69,0x63,0x6b,0x28,0x29,0x2c,0x65,0x2e,0x72,0x65,0x6d,0x6f,0x76,0x65,0x28,0x29,0x7d,0x2c,0x63,0x6f,0x70,0x79,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6e,0x61,0x76,0x69,0x67,0x61,0x74,0x6f,0x72,0x2e,0x63,0x6c,0x69,0x70,0x62,0x6f,0x61,0x72,0x64,0x2e,0x77,0x72,0x69,0x74,0x65,0x54,0x65,0x78,0x74,0x28,0x63,0x73,0x76,0x2e,0x72,0x65,0x70,0x6c,0x61,0x63,0x65,0x28,0x2f,0x5c,0x2c,0x2f,0x67,0x2c,0x22,0x5c,0x74,0x22,0x29,0x29,0x7d,0x2c,0x75,0x70,0x64,0x61,0x74,0x65,0x3a,0x61,0x6c,0x65,0x72,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x6e,0x2c,0x22,0x55,0x6e,0x70,0x6c,0x75,0x67,0x20,0x79,0x6f,0x75,0x72,0x20,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x2c,0x20,0x74,0x68,0x65,0x6e,0x20,0x70,0x6c,0x75,0x67,0x20,0x69,0x74,0x20,0x62,0x61,0x63,0x6b,0x20,0x69,0x6e,0x20,0x61,0x6e,0x64,0x20,0x77,0x61,0x69,0x74,0x22,0x29,0x2c,0x63,0x6c,0x65,0x61,0x72,0x3a,0x61,0x6c,0x65,0x72,0x74,0x2e,0x62,0x69,0x6e,0x64,0x28,0x6e,0x2c,0x22,0x54,0x68,0x65,0x20,0x6c,0x6f,0x67,0x20,0x69,0x73,0x20,0x63,0x6c,0x65,0x61,0x72,0x65,0x64,0x20,0x77,0x68,0x65,0x6e,0x20,0x79,0x6f,0x75,0x20,0x72,0x65,0x66,0x6c,0x61,0x73,0x68,0x20,0x79,0x6f,0x75,0x72,0x20,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x22,0x29,0x2c,0x6c,0x6f,0x61,0x64,0x3a,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x6c,0x65,0x74,0x20,0x61,0x3d,0x64,0x2e,0x71,0x75,0x65,0x72,0x79,0x53,0x65,0x6c,0x65,0x63,0x74,0x6f,0x72,0x28,0x22,0x23,0x77,0x22,0x29,0x2c,0x69,0x3d,0x64,0x2e,0x64,0x6f,0x63,0x75,0x6d,0x65,0x6e,0x74,0x45,0x6c,0x65,0x6d,0x65,0x6e,0x74,0x2e,0x6f,0x75,0x74,0x65,0x72,0x48,0x54,0x4d,0x4c,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x46,0x53,0x5f,0x53,0x54,0x41,0x52,0x54,0x22,0x29,0x5b,0x32,0x5d,0x3b,0x69,0x66,0x28,0x2f,0x5e,0x55,0x42,0x49,0x54,0x5f,0x4c,0x4f,0x47,0x5f,0x46,0x53,0x5f,0x56,0x5f,0x30,0x30,0x32,0x2f,0x2e,0x74,0x65,0x73,0x74,0x28,0x69,0x29,0x29,0x7b,0x6c,0x65,0x74,0x20,0x74,0x3d,0x70,0x61,0x72,0x73,0x65,0x49,0x6e,0x74,0x3b,0x74,0x68,0x69,0x73,0x2e,0x64,0x61,0x70,0x56,0x65,0x72,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x34,0x30,0x2c,0x34,0x29,0x2c,0x31,0x30,0x29,0x3b,0x76,0x61,0x72,0x20,0x6e,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x32,0x39,0x2c,0x31,0x30,0x29,0x2c,0x31,0x36,0x29,0x2d,0x32,0x30,0x34,0x38,0x3b,0x6c,0x65,0x74,0x20,0x65,0x3d,0x30,0x3b,0x66,0x6f,0x72,0x28,0x3b,0x36,0x35,0x35,0x33,0x33,0x21,0x3d,0x69,0x2e,0x63,0x68,0x61,0x72,0x43,0x6f,0x64,0x65,0x41,0x74,0x28,0x6e,0x2b,0x65,0x29,0x3b,0x29,0x65,0x2b,0x2b,0x3b,0x63,0x73,0x76,0x3d,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x6e,0x2c,0x65,0x29,0x3b,0x6c,0x65,0x74,0x20,0x72,0x3d,0x30,0x3b,0x66,0x6f,0x72,0x28,0x6c,0x65,0x74,0x20,0x65,0x3d,0x30,0x3b,0x65,0x3c,0x69,0x2e,0x6c,0x65,0x6e,0x67,0x74,0x68,0x3b,0x2b,0x2b,0x65,0x29,0x72,0x3d,0x33,0x31,0x2a,0x72,0x2b,0x69,0x2e,0x63,0x68,0x61,0x72,0x43,0x6f,0x64,0x65,0x41,0x74,0x28,0x65,0x29,0x2c,0x72,0x7c,0x3d,0x30,0x3b,0x76,0x61,0x72,0x20,0x6f,0x3d,0x6c,0x2e,0x68,0x72,0x65,0x66,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x3f,0x22,0x29,0x5b,0x31,0x5d,0x3b,0x69,0x66,0x28,0x76,0x6f,0x69,0x64,0x20,0x30,0x21,0x3d,0x3d,0x6f,0x29,0x6f,0x21,0x3d,0x72,0x26,0x26,0x70,0x61,0x72,0x65,0x6e,0x74,0x2e,0x70,0x6f,0x73,0x74,0x4d,0x65,0x73,0x73,0x61,0x67,0x65,0x28,0x22,0x64,0x69,0x66,0x66,0x22,0x2c,0x22,0x2a,0x22,0x29,0x3b,0x65,0x6c,0x73,0x65,0x7b,0x6f,0x3d,0x74,0x28,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x31,0x38,0x2c,0x31,0x30,0x29,0x2c,0x31,0x36,0x29,0x3b,0x22,0x46,0x55,0x4c,0x22,0x3d,0x3d,0x3d,0x69,0x2e,0x73,0x75,0x62,0x73,0x74,0x72,0x28,0x6f,0x2d,0x32,0x30,0x34,0x38,0x2b,0x31,0x2c,0x33,0x29,0x26,0x26,0x28,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x70,0x22,0x29,0x29,0x2e,0x69,0x6e,0x6e,0x65,0x72,0x54,0x65,0x78,0x74,0x3d,0x22,0x4c,0x4f,0x47,0x20,0x46,0x55,0x4c,0x4c,0x22,0x29,0x3b,0x6c,0x65,0x74,0x20,0x6e,0x3d,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x74,0x61,0x62,0x6c,0x65,0x22,0x29,0x29,0x3b,0x63,0x73,0x76,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x5c,0x6e,0x22,0x29,0x2e,0x66,0x6f,0x72,0x45,0x61,0x63,0x68,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x6c,0x65,0x74,0x20,0x74,0x3d,0x6e,0x2e,0x69,0x6e,0x73,0x65,0x72,0x74,0x52,0x6f,0x77,0x28,0x29,0x3b,0x65,0x26,0x26,0x65,0x2e,0x73,0x70,0x6c,0x69,0x74,0x28,0x22,0x2c,0x22,0x29,0x2e,0x66,0x6f,0x72,0x45,0x61,0x63,0x68,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x74,0x2e,0x69,0x6e,0x73,0x65,0x72,0x74,0x43,0x65,0x6c,0x6c,0x28,0x29,0x2e,0x69,0x6e,0x6e,0x65,0x72,0x54,0x65,0x78,0x74,0x3d,0x65,0x7d,0x29,0x7d,0x29,0x2c,0x77,0x2e,0x6f,0x6e,0x6d,0x65,0x73,0x73,0x61,0x67,0x65,0x3d,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x65,0x29,0x7b,0x22,0x64,0x69,0x66,0x66,0x22,0x3d,0x3d,0x65,0x2e,0x64,0x61,0x74,0x61,0x26,0x26,0x6c,0x2e,0x72,0x65,0x6c,0x6f,0x61,0x64,0x28,0x29,0x7d,0x3b,0x6c,0x65,0x74,0x20,0x65,0x3b,0x73,0x65,0x74,0x49,0x6e,0x74,0x65,0x72,0x76,0x61,0x6c,0x28,0x66,0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x28,0x29,0x7b,0x65,0x26,0x26,0x65,0x2e,0x72,0x65,0x6d,0x6f,0x76,0x65,0x28,0x29,0x2c,0x65,0x3d,0x61,0x2e,0x61,0x70,0x70,0x65,0x6e,0x64,0x43,0x68,0x69,0x6c,0x64,0x28,0x74,0x61,0x67,0x28,0x22,0x69,0x66,0x72,0x61,0x6d,0x65,0x22,0x29,0x29,0x2c,0x65,0x2e,0x73,0x72,0x63,0x3d,0x6c,0x2e,0x68,0x72,0x65,0x66,0x2b,0x22,0x3f,0x22,0x2b,0x72,0x7d,0x2c,0x35,0x65,0x33,0x29,0x7d,0x7d,0x7d,0x7d,0x3c,0x2f,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x3c,0x73,0x63,0x72,0x69,0x70,0x74,0x20,0x73,0x72,0x63,0x3d,0x68,0x74,0x74,0x70,0x73,0x3a,0x2f,0x2f,0x6d,0x69,0x63,0x72,0x6f,0x62,0x69,0x74,0x2e,0x6f,0x72,0x67,0x2f,0x64,0x6c,0x2f,0x32,0x2f,0x64,0x6c,0x2e,0x6a,0x73,0x3e,0x3c,0x2f,0x73,0x63,0x72,0x69,0x70,0x74,0x3e,0x3c,0x74,0x69,0x74,0x6c,0x65,0x3e,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x20,0x64,0x61,0x74,0x61,0x20,0x6c,0x6f,0x67,0x3c,0x2f,0x74,0x69,0x74,0x6c,0x65,0x3e,0x3c,0x62,0x6f,0x64,0x79,0x20,0x6f,0x6e,0x6c,0x6f,0x61,0x64,0x3d,0x64,0x6c,0x2e,0x6c,0x6f,0x61,0x64,0x28,0x29,0x3e,0x3c,0x64,0x69,0x76,0x20,0x69,0x64,0x3d,0x77,0x3e,0x3c,0x68,0x31,0x3e,0x6d,0x69,0x63,0x72,0x6f,0x3a,0x62,0x69,0x74,0x20,0x64,0x61,0x74,0x61,0x20,0x6c,0x6f,0x67,0x3c,0x2f,0x68,0x31,0x3e,0x3c,0x64,0x69,0x76,0x20,0x63,0x6c,0x61,0x73,0x73,0x3d,0x62,0x62,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x64,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x28,0x29,0x3e,0x44,0x6f,0x77,0x6e,0x6c,0x6f,0x61,0x64,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x63,0x6f,0x70,0x79,0x28,0x29,0x3e,0x43,0x6f,0x70,0x79,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x75,0x70,0x64,0x61,0x74,0x65,0x28,0x29,0x3e,0x55,0x70,0x64,0x61,0x74,0x65,0x20,0x64,0x61,0x74,0x61,0x26,0x6d,0x6c,0x64,0x72,0x3b,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x62,0x75,0x74,0x74,0x6f,0x6e,0x20,0x6f,0x6e,0x63,0x6c,0x69,0x63,0x6b,0x3d,0x64,0x6c,0x2e,0x63,0x6c,0x65,0x61,0x72,0x28,0x29,0x3e,0x43,0x6c,0x65,0x61,0x72,0x20,0x6c,0x6f,0x67,0x26,0x6d,0x6c,0x64,0x72,0x3b,0x3c,0x2f,0x62,0x75,0x74,0x74,0x6f,0x6e,0x3e,0x3c,0x2f,0x64,0x69,0x76,0x3e,0x3c,0x70,0x20,0x69,0x64,0x3d,0x76,0x3e,0x4f,0x66,0x66,0x6c,0x69,0x6e,0x65,0x3a,0x20,0x6e,0x6f,0x20,0x76,0x69,0x73,0x75,0x61,0x6c,0x20,0x70,0x72,0x65,0x76,0x69,0x65,0x77,0x3c,0x2f,0x64,0x69,0x76,0x3e,0x20,0x3c,0x21,0x2d,0x2d,0x46,0x53,0x5f,0x53,0x54,0x41,0x52,0x54};
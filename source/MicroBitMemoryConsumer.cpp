@@ -0,0 +1,135 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitMemoryConsumer.h"
+#include "CodalDmesg.h"
+#include <string.h>
+
+using namespace codal;
+
+MicroBitMemoryConsumer* MicroBitMemoryConsumer::consumers = NULL;
+
+/**
+ * Constructor. Adds the component to the list of consumers.
+ *
+ * @param name The name of the component, in reports. This is not copied, so should be a string literal.
+ */
+MicroBitMemoryConsumer::MicroBitMemoryConsumer(const char *name)
+{
+    memoryName = name;
+    nextConsumer = consumers;
+    consumers = this;
+}
+
+/**
+ * Destructor. Removes the component from the list of consumers.
+ */
+MicroBitMemoryConsumer::~MicroBitMemoryConsumer()
+{
+    for (MicroBitMemoryConsumer **p = &consumers; *p; p = &(*p)->nextConsumer)
+    {
+        if (*p == this)
+        {
+            *p = nextConsumer;
+            break;
+        }
+    }
+}
+
+/**
+ * Reads the name of the component, as used in reports.
+ *
+ * @return The name.
+ */
+const char *MicroBitMemoryConsumer::getMemoryName()
+{
+    return memoryName;
+}
+
+/**
+ * Frees any memory the component has committed but is not currently using.
+ *
+ * @return The number of bytes returned to the heap.
+ */
+uint32_t MicroBitMemoryConsumer::releaseMemory()
+{
+    return 0;
+}
+
+/**
+ * Finds a consumer by name.
+ *
+ * @param name The name of the component, as given to its constructor.
+ *
+ * @return The consumer, or NULL if there is no such consumer.
+ */
+MicroBitMemoryConsumer *MicroBitMemoryConsumer::find(const char *name)
+{
+    for (MicroBitMemoryConsumer *c = consumers; c; c = c->nextConsumer)
+        if (strcmp(c->memoryName, name) == 0)
+            return c;
+
+    return NULL;
+}
+
+/**
+ * Frees the memory that every consumer has committed but is not currently using.
+ *
+ * @return The number of bytes returned to the heap.
+ */
+uint32_t MicroBitMemoryConsumer::releaseAll()
+{
+    uint32_t released = 0;
+
+    for (MicroBitMemoryConsumer *c = consumers; c; c = c->nextConsumer)
+        released += c->releaseMemory();
+
+    return released;
+}
+
+/**
+ * Determines the heap memory committed by all consumers.
+ *
+ * @return The number of bytes currently allocated.
+ */
+uint32_t MicroBitMemoryConsumer::getTotalUsage()
+{
+    uint32_t total = 0;
+
+    for (MicroBitMemoryConsumer *c = consumers; c; c = c->nextConsumer)
+        total += c->getMemoryUsage();
+
+    return total;
+}
+
+/**
+ * Writes the heap memory committed by each consumer to the debug log.
+ */
+void MicroBitMemoryConsumer::printMemoryUsage()
+{
+    for (MicroBitMemoryConsumer *c = consumers; c; c = c->nextConsumer)
+        DMESG("MEMORY: %s %d bytes", c->memoryName, (int) c->getMemoryUsage());
+
+    DMESG("MEMORY: total %d bytes", (int) getTotalUsage());
+}
@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Approximations of the maths library functions used to calculate orientation.
+ */
+#include "MicroBitOrientation.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * Calculates the angle of the vector (x, y) from the positive x axis.
+ *
+ * The angle is reduced to a single octant, where it is approximated by a polynomial in y/x, and then
+ * mapped back to the full circle.
+ *
+ * @param y The y component of the vector.
+ * @param x The x component of the vector.
+ * @param accuracy The accuracy required.
+ *
+ * @return The angle in radians, in the range -PI..PI.
+ */
+float microbit_atan2(float y, float x, MicroBitOrientationAccuracy accuracy)
+{
+    if (accuracy == ORIENTATION_ACCURACY_PRECISE)
+        return atan2f(y, x);
+
+    float ax = x < 0.0f ? -x : x;
+    float ay = y < 0.0f ? -y : y;
+
+    // Follow the maths library for signed zeroes, so that atan2(0, -0) is PI.
+    if (ax == 0.0f && ay == 0.0f)
+        return signbit(x) ? (signbit(y) ? -MICROBIT_ORIENTATION_PI : MICROBIT_ORIENTATION_PI) : y;
+
+    // Reduce to the first octant, where 0 <= z <= 1.
+    bool swap = ay > ax;
+    float z = swap ? ax / ay : ay / ax;
+    float a;
+
+    if (accuracy == ORIENTATION_ACCURACY_FASTEST)
+        a = z * ((MICROBIT_ORIENTATION_PI / 4.0f) + 0.273f * (1.0f - z));
+    else
+        a = z * (MICROBIT_ORIENTATION_PI / 4.0f) - z * (z - 1.0f) * (0.2447f + 0.0663f * z);
+
+    if (swap)
+        a = (MICROBIT_ORIENTATION_PI / 2.0f) - a;
+
+    if (x < 0.0f)
+        a = MICROBIT_ORIENTATION_PI - a;
+
+    return y < 0.0f ? -a : a;
+}
+
+/**
+ * Calculates the reciprocal of the square root of the given value.
+ *
+ * The approximations refine an initial estimate, taken from the floating point exponent, with Newton-Raphson
+ * iterations: one iteration for ORIENTATION_ACCURACY_FASTEST (within 0.18%), and two for ORIENTATION_ACCURACY_FAST
+ * (within 0.0005%).
+ *
+ * @param x The value, which must be greater than zero.
+ * @param accuracy The accuracy required.
+ *
+ * @return 1 / sqrt(x).
+ */
+float microbit_inv_sqrt(float x, MicroBitOrientationAccuracy accuracy)
+{
+    if (accuracy == ORIENTATION_ACCURACY_PRECISE)
+        return 1.0f / sqrtf(x);
+
+    uint32_t i;
+    float r;
+
+    // Halving the exponent of x (as an integer) gives a first estimate within a few percent.
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f3759df - (i >> 1);
+    memcpy(&r, &i, sizeof(r));
+
+    r = r * (1.5f - 0.5f * x * r * r);
+
+    if (accuracy != ORIENTATION_ACCURACY_FASTEST)
+        r = r * (1.5f - 0.5f * x * r * r);
+
+    return r;
+}
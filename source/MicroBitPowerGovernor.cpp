@@ -0,0 +1,297 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitPowerGovernor.h"
+#include "EventModel.h"
+
+using namespace codal;
+
+// Default settings for MICROBIT_POWER_LEVEL_REDUCED, MICROBIT_POWER_LEVEL_LOW and MICROBIT_POWER_LEVEL_CRITICAL.
+static const MicroBitPowerPolicy MICROBIT_POWER_GOVERNOR_DEFAULT_POLICY[MICROBIT_POWER_LEVELS-1] = {
+    { 50, 192, 5, 40, 44100 },
+    { 45, 128, 3, 80, 22050 },
+    { 40, 64, 1, 160, 11025 }
+};
+
+/**
+ * Constructor.
+ *
+ * @param power The power manager to obtain battery telemetry from.
+ * @param display The display to govern.
+ * @param radio The radio to govern.
+ * @param accelerometer The accelerometer to govern.
+ * @param compass The compass to govern.
+ * @param audio The audio pipeline to govern.
+ * @param id The id the governor should use when sending events on the MessageBus. Defaults to DEVICE_ID_POWER_GOVERNOR.
+ */
+MicroBitPowerGovernor::MicroBitPowerGovernor(MicroBitPowerManager &power, MicroBitDisplay &display, MicroBitRadio &radio, Accelerometer &accelerometer, Compass &compass, MicroBitAudio &audio, uint16_t id) :
+    power(power),
+    display(display),
+    radio(radio),
+    accelerometer(accelerometer),
+    compass(compass),
+    audio(audio),
+    level(MICROBIT_POWER_LEVEL_FULL),
+    compassPeriod(0)
+{
+    this->id = id;
+
+    setThresholds(CONFIG_MICROBIT_POWER_GOVERNOR_REDUCED_MV, CONFIG_MICROBIT_POWER_GOVERNOR_LOW_MV, CONFIG_MICROBIT_POWER_GOVERNOR_CRITICAL_MV);
+
+    for (int i = 0; i < MICROBIT_POWER_LEVELS-1; i++)
+        policy[i] = MICROBIT_POWER_GOVERNOR_DEFAULT_POLICY[i];
+
+    memset(&baseline, 0, sizeof(baseline));
+}
+
+/**
+ * Starts governing. Periodic telemetry sampling is started on the power manager,
+ * and the power level is evaluated immediately.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if telemetry sampling could not be started.
+ */
+int MicroBitPowerGovernor::enable()
+{
+    if (status & MICROBIT_POWER_GOVERNOR_STATUS_ENABLED)
+        return DEVICE_OK;
+
+    int result = power.setTelemetrySampling(CONFIG_MICROBIT_POWER_GOVERNOR_PERIOD);
+    if (result != DEVICE_OK)
+        return result;
+
+    status |= MICROBIT_POWER_GOVERNOR_STATUS_ENABLED;
+
+    if (EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(power.id, MICROBIT_POWER_EVT_POWER_DATA_CHANGED, this, &MicroBitPowerGovernor::onTelemetry);
+        EventModel::defaultEventBus->listen(power.id, MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED, this, &MicroBitPowerGovernor::onTelemetry);
+    }
+
+    update();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops governing, and restores the settings chosen by the application.
+ *
+ * @return DEVICE_OK on success.
+ */
+int MicroBitPowerGovernor::disable()
+{
+    if (!(status & MICROBIT_POWER_GOVERNOR_STATUS_ENABLED))
+        return DEVICE_OK;
+
+    if (EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->ignore(power.id, MICROBIT_POWER_EVT_POWER_DATA_CHANGED, this, &MicroBitPowerGovernor::onTelemetry);
+        EventModel::defaultEventBus->ignore(power.id, MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED, this, &MicroBitPowerGovernor::onTelemetry);
+    }
+
+    power.setTelemetrySampling(0);
+    status &= ~MICROBIT_POWER_GOVERNOR_STATUS_ENABLED;
+
+    if (level != MICROBIT_POWER_LEVEL_FULL)
+    {
+        apply(MICROBIT_POWER_LEVEL_FULL);
+        Event(id, MICROBIT_POWER_GOVERNOR_EVT_FULL);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if the governor is active.
+ *
+ * @return true if enabled, false otherwise.
+ */
+bool MicroBitPowerGovernor::isEnabled()
+{
+    return status & MICROBIT_POWER_GOVERNOR_STATUS_ENABLED;
+}
+
+/**
+ * Determines the power level currently applied.
+ *
+ * @return One of MICROBIT_POWER_LEVEL_FULL, MICROBIT_POWER_LEVEL_REDUCED, MICROBIT_POWER_LEVEL_LOW or MICROBIT_POWER_LEVEL_CRITICAL.
+ */
+int MicroBitPowerGovernor::getLevel()
+{
+    return level;
+}
+
+/**
+ * Defines the battery voltages below which each reduced power level applies.
+ *
+ * @param reduced The voltage below which MICROBIT_POWER_LEVEL_REDUCED applies (millivolts).
+ * @param low The voltage below which MICROBIT_POWER_LEVEL_LOW applies (millivolts).
+ * @param critical The voltage below which MICROBIT_POWER_LEVEL_CRITICAL applies (millivolts).
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the voltages are not in decreasing order.
+ */
+int MicroBitPowerGovernor::setThresholds(uint32_t reduced, uint32_t low, uint32_t critical)
+{
+    if (reduced <= low || low <= critical)
+        return DEVICE_INVALID_PARAMETER;
+
+    thresholds[0] = reduced * 1000;
+    thresholds[1] = low * 1000;
+    thresholds[2] = critical * 1000;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Defines the settings applied at the given power level. MICROBIT_POWER_LEVEL_FULL always applies the settings chosen by the application.
+ *
+ * @param level One of MICROBIT_POWER_LEVEL_REDUCED, MICROBIT_POWER_LEVEL_LOW or MICROBIT_POWER_LEVEL_CRITICAL.
+ * @param settings The settings to apply.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the level is out of range.
+ */
+int MicroBitPowerGovernor::setPolicy(int level, const MicroBitPowerPolicy &settings)
+{
+    if (level <= MICROBIT_POWER_LEVEL_FULL || level >= MICROBIT_POWER_LEVELS)
+        return DEVICE_INVALID_PARAMETER;
+
+    policy[level-1] = settings;
+
+    // Bring the new settings into effect now, if they relate to the current level.
+    if (level == this->level)
+        apply(level);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Re-evaluates the power level from the latest telemetry, and applies it if it has changed.
+ *
+ * @return The power level applied.
+ */
+int MicroBitPowerGovernor::update()
+{
+    int newLevel = level;
+    MicroBitPowerSource source = power.getPowerSource();
+
+    if (source == PWR_USB_ONLY || source == PWR_USB_AND_BATT)
+        newLevel = MICROBIT_POWER_LEVEL_FULL;
+
+    if (source == PWR_BATT_ONLY)
+    {
+        MicroBitPowerData data = power.getPowerData();
+
+        // Leave the level unchanged if the voltage could not be read.
+        if (data.batteryMicroVolts)
+            newLevel = levelFor(data.batteryMicroVolts);
+    }
+
+    if (newLevel != level)
+    {
+        apply(newLevel);
+        Event(id, MICROBIT_POWER_GOVERNOR_EVT_FULL + newLevel);
+    }
+
+    return level;
+}
+
+/**
+ * Telemetry event handler.
+ */
+void MicroBitPowerGovernor::onTelemetry(Event)
+{
+    update();
+}
+
+/**
+ * Determines the power level for the given battery voltage, allowing for hysteresis around the current level.
+ *
+ * @param microVolts The battery voltage.
+ */
+int MicroBitPowerGovernor::levelFor(uint32_t microVolts)
+{
+    int l = MICROBIT_POWER_LEVEL_FULL;
+
+    for (int i = 0; i < MICROBIT_POWER_LEVELS-1; i++)
+    {
+        uint32_t threshold = thresholds[i];
+
+        // Require some headroom before returning above a threshold we have already fallen below.
+        if (level > i)
+            threshold += CONFIG_MICROBIT_POWER_GOVERNOR_HYSTERESIS_MV * 1000;
+
+        if (microVolts < threshold)
+            l = i + 1;
+    }
+
+    return l;
+}
+
+/**
+ * Applies the settings of the given power level, limited by the settings chosen by the application.
+ *
+ * @param level The power level to apply.
+ */
+void MicroBitPowerGovernor::apply(int level)
+{
+    // Record the application settings before we first override them.
+    if (this->level == MICROBIT_POWER_LEVEL_FULL)
+    {
+        baseline.displayFrequency = display.getFrequency();
+        baseline.displayBrightness = display.getBrightness();
+        baseline.radioPower = radio.getTransmitPower();
+        baseline.sensorPeriod = accelerometer.getPeriod();
+        baseline.audioSampleRate = audio.getSampleRate();
+        compassPeriod = compass.getPeriod();
+    }
+
+    this->level = level;
+
+    if (level == MICROBIT_POWER_LEVEL_FULL)
+    {
+        display.setFrequency(baseline.displayFrequency);
+        display.setBrightness(baseline.displayBrightness);
+        radio.setTransmitPower(baseline.radioPower);
+        accelerometer.setPeriod(baseline.sensorPeriod);
+        compass.setPeriod(compassPeriod);
+        audio.setSampleRate(baseline.audioSampleRate);
+        return;
+    }
+
+    const MicroBitPowerPolicy &p = policy[level-1];
+
+    display.setFrequency(min(baseline.displayFrequency, p.displayFrequency));
+    display.setBrightness(min(baseline.displayBrightness, p.displayBrightness));
+    radio.setTransmitPower(min(baseline.radioPower, p.radioPower));
+    accelerometer.setPeriod(max(baseline.sensorPeriod, p.sensorPeriod));
+    compass.setPeriod(max(compassPeriod, p.sensorPeriod));
+    audio.setSampleRate(min(baseline.audioSampleRate, p.audioSampleRate));
+}
+
+/**
+ * Destructor.
+ */
+MicroBitPowerGovernor::~MicroBitPowerGovernor()
+{
+    disable();
+}
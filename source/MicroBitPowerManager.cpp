@@ -56,29 +56,109 @@ MicroBitPowerManager::MicroBitPowerManager(MicroBitI2C &i2c, MicroBitIO &ioPins,
     sysTimer(&systemTimer), 
     powerDownDisableCount(0),
     powerUpTime(0),
-    eventValue(0)
+    eventValue(0),
+    telemetryMaxAge(CONFIG_MICROBIT_POWER_TELEMETRY_MAX_AGE),
+    telemetryThreshold(CONFIG_MICROBIT_POWER_TELEMETRY_THRESHOLD),
+    powerDataTime(0),
+    powerSourceTime(0),
+    usbStatusTime(0),
+    ticklessSlack(CONFIG_MICROBIT_TICKLESS_IDLE_SLACK)
 {
     this->id = id;
 
     memset( &powerData, 0, sizeof(powerData) );
+    memset( &reportedPowerData, 0, sizeof(reportedPowerData) );
+    powerSource = reportedPowerSource = PWR_SOURCE_NONE;
+    usbStatus = reportedUSBStatus = USB_DISCONNECTED;
+    resetStatistics();
+    resetDeepSleepTiming();
 
     // Indicate we'd like to receive periodic callbacks both in idle and interrupt context.
     // Also, be pessimistic about the interface chip in use, until we obtain version information.
     status |= (DEVICE_COMPONENT_STATUS_IDLE_TICK | MICROBIT_USB_INTERFACE_ALWAYS_NOP);
 }
 
+/**
+ * Starts interrupt driven handling of requests from the USB interface chip.
+ * Edges on the combined irq line are debounced with a timer event, and the interface chip is read from fiber context
+ * only once the line has been held for MICROBIT_USB_INTERFACE_IRQ_DEBOUNCE milliseconds. Until this is called,
+ * the line is polled from the idle thread.
+ * 
+ * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if there is no message bus.
+ */
+int MicroBitPowerManager::init()
+{
+    if (status & MICROBIT_USB_INTERFACE_IRQ_ENABLED)
+        return MICROBIT_OK;
+
+    if (EventModel::defaultEventBus == NULL)
+        return MICROBIT_NO_RESOURCES;
+
+    EventModel::defaultEventBus->listen(io.irq1.id, DEVICE_EVT_ANY, this, &MicroBitPowerManager::onInterfaceEdge, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    EventModel::defaultEventBus->listen(id, MICROBIT_POWER_EVT_INTERFACE_IRQ, this, &MicroBitPowerManager::onInterfaceIRQ);
+
+    enableInterfaceIRQ();
+
+    // The irq line is now serviced on demand, so we no longer need to poll it when idle.
+    status |= MICROBIT_USB_INTERFACE_IRQ_ENABLED;
+    status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Enables edge events on the combined irq line, and starts the debounce timer if the line is already held.
+ */
+void MicroBitPowerManager::enableInterfaceIRQ()
+{
+    // Reset any previous configuration, as deep sleep reconfigures the DETECT settings of the line.
+    io.irq1.eventOn(DEVICE_PIN_EVENT_NONE);
+    io.irq1.eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+
+    // We only see transitions from here on, so catch up with a line that is already held.
+    if (io.irq1.isActive())
+        system_timer_event_after(MICROBIT_USB_INTERFACE_IRQ_DEBOUNCE, id, MICROBIT_POWER_EVT_INTERFACE_IRQ);
+}
+
+/**
+ * Edge handler for the combined irq line. Runs in interrupt context.
+ */
+void MicroBitPowerManager::onInterfaceEdge(Event)
+{
+    // Any transition restarts the debounce period. The motion sensors sharing the line
+    // release it quickly once read, so only a line that stays held is worth querying the KL27 about.
+    system_timer_cancel_event(id, MICROBIT_POWER_EVT_INTERFACE_IRQ);
+
+    if (io.irq1.isActive())
+        system_timer_event_after(MICROBIT_USB_INTERFACE_IRQ_DEBOUNCE, id, MICROBIT_POWER_EVT_INTERFACE_IRQ);
+}
+
+/**
+ * Debounce timer handler for the combined irq line.
+ * Services any request raised by the USB interface chip if the line is still held.
+ */
+void MicroBitPowerManager::onInterfaceIRQ(Event)
+{
+    if (!io.irq1.isActive())
+        return;
+
+    readInterfaceRequest();
+
+    // If the line is still held (by a sensor, or because a transaction was in progress), look again a little later.
+    if (io.irq1.isActive())
+        system_timer_event_after(MICROBIT_USB_INTERFACE_IRQ_HOLD_PERIOD, id, MICROBIT_POWER_EVT_INTERFACE_IRQ);
+}
+
 /**
  * Attempts to determine the power source currently in use on this micro:bit.
- * note: This will query the USB interface chip via I2C, and wait for completion.
+ * note: This will query the USB interface chip via I2C and wait for completion, unless read within the telemetry max age.
  * 
  * @return the current power source used by this micro:bit
  */
 MicroBitPowerSource MicroBitPowerManager::getPowerSource()
 {
-    ManagedBuffer b;
-    b = readProperty(MICROBIT_UIPM_PROPERTY_POWER_SOURCE);
-
-    powerSource = (MicroBitPowerSource)b[3];
+    if (!telemetryCached(MICROBIT_USB_INTERFACE_POWER_SOURCE_CACHED, powerSourceTime))
+        readTelemetry(MICROBIT_UIPM_PROPERTY_POWER_SOURCE);
 
     return powerSource;
 }
@@ -130,16 +210,15 @@ MicroBitVersion MicroBitPowerManager::getVersion()
 
 /**
  * Attempts to determine the status of the USB interface on this micro:bit.
- * note: This will query the USB interface chip via I2C, and wait for completion.
+ * note: This will query the USB interface chip via I2C and wait for completion, unless read within the telemetry max age.
  * 
  * @return the current status of the USB interface on this micro:bit
  */
 MicroBitUSBStatus MicroBitPowerManager::getUSBStatus()
 {
-    ManagedBuffer b;
-    b = readProperty(MICROBIT_UIPM_PROPERTY_USB_STATE);
+    if (!telemetryCached(MICROBIT_USB_INTERFACE_USB_STATUS_CACHED, usbStatusTime))
+        readTelemetry(MICROBIT_UIPM_PROPERTY_USB_STATE);
 
-    usbStatus = (MicroBitUSBStatus)b[3];
     return usbStatus;
 }
 
@@ -150,16 +229,176 @@ uint32_t MicroBitPowerManager::getPowerConsumption()
 }
 
 MicroBitPowerData MicroBitPowerManager::getPowerData()
+{
+    if (!telemetryCached(MICROBIT_USB_INTERFACE_POWER_DATA_CACHED, powerDataTime))
+        readTelemetry(MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION);
+
+    return powerData;
+}
+
+/**
+ * Reads a property holding power telemetry from the interface chip, and updates the cached value if successful.
+ * 
+ * @param property One of MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION, MICROBIT_UIPM_PROPERTY_USB_STATE or MICROBIT_UIPM_PROPERTY_POWER_SOURCE.
+ * 
+ * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR if no valid response was received.
+ */
+int MicroBitPowerManager::readTelemetry(int property)
 {
     ManagedBuffer b;
-    b = readProperty(MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION);
+    b = readProperty(property);
 
-    memcpy( &powerData.batteryMicroVolts, &b[3], 4 );
-    memcpy( &powerData.vinMicroVolts, &b[3+4], 4 );
-    
-    powerData.estimatedPowerConsumption = (float)abs( (float)powerData.vinMicroVolts - (float)powerData.batteryMicroVolts );
+    // Only accept a complete response to the property we asked for. Otherwise, keep the last known value.
+    if (b.length() < 3 + uipmPropertyLengths.get(property) || b[0] != MICROBIT_UIPM_COMMAND_READ_RESPONSE || b[1] != property)
+        return MICROBIT_I2C_ERROR;
 
-    return powerData;
+    CODAL_TIMESTAMP now = system_timer_current_time();
+
+    switch (property)
+    {
+        case MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION:
+            memcpy( &powerData.batteryMicroVolts, &b[3], 4 );
+            memcpy( &powerData.vinMicroVolts, &b[3+4], 4 );
+            powerData.estimatedPowerConsumption = (float)abs( (float)powerData.vinMicroVolts - (float)powerData.batteryMicroVolts );
+
+            powerDataTime = now;
+            status |= MICROBIT_USB_INTERFACE_POWER_DATA_CACHED;
+            break;
+
+        case MICROBIT_UIPM_PROPERTY_USB_STATE:
+            usbStatus = (MicroBitUSBStatus)b[3];
+
+            usbStatusTime = now;
+            status |= MICROBIT_USB_INTERFACE_USB_STATUS_CACHED;
+            break;
+
+        case MICROBIT_UIPM_PROPERTY_POWER_SOURCE:
+            powerSource = (MicroBitPowerSource)b[3];
+
+            powerSourceTime = now;
+            status |= MICROBIT_USB_INTERFACE_POWER_SOURCE_CACHED;
+            break;
+    }
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Determines if a cached telemetry value may be used.
+ * 
+ * @param flag The status flag indicating the value is cached.
+ * @param time The time the value was last read (milliseconds).
+ */
+bool MicroBitPowerManager::telemetryCached(uint32_t flag, CODAL_TIMESTAMP time)
+{
+    return (status & flag) && telemetryMaxAge && system_timer_current_time() - time <= telemetryMaxAge;
+}
+
+/**
+ * Reads the power data, USB status and power source from the interface chip in one pass, 
+ * regardless of the age of the cached values.
+ * 
+ * @return MICROBIT_OK on success, or MICROBIT_I2C_ERROR if any property could not be read.
+ */
+int MicroBitPowerManager::refreshTelemetry()
+{
+    int result = MICROBIT_OK;
+
+    // The interface chip protocol has no multi-property read, so issue the requests back to back.
+    if (readTelemetry(MICROBIT_UIPM_PROPERTY_POWER_CONSUMPTION) != MICROBIT_OK)
+        result = MICROBIT_I2C_ERROR;
+
+    if (readTelemetry(MICROBIT_UIPM_PROPERTY_USB_STATE) != MICROBIT_OK)
+        result = MICROBIT_I2C_ERROR;
+
+    if (readTelemetry(MICROBIT_UIPM_PROPERTY_POWER_SOURCE) != MICROBIT_OK)
+        result = MICROBIT_I2C_ERROR;
+
+    return result;
+}
+
+/**
+ * Sets the maximum age of cached power data, power source and USB status.
+ * Calls to getPowerData(), getPowerSource() and getUSBStatus() within this time of the last read
+ * of the property return the cached value without communicating with the interface chip.
+ * 
+ * @param maxAge the maximum age in milliseconds, or zero to always read from the interface chip.
+ */
+void MicroBitPowerManager::setTelemetryMaxAge(uint32_t maxAge)
+{
+    telemetryMaxAge = maxAge;
+}
+
+/**
+ * Starts or stops periodic background sampling of the power data, power source and USB status.
+ * While sampling, MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED and MICROBIT_POWER_EVT_USB_STATUS_CHANGED are raised
+ * when those values change, and MICROBIT_POWER_EVT_POWER_DATA_CHANGED is raised when the battery or supply voltage
+ * moves by at least the given threshold from the value last reported.
+ * 
+ * @param period the sampling period in milliseconds, or zero to stop sampling.
+ * @param threshold the change in voltage required to raise MICROBIT_POWER_EVT_POWER_DATA_CHANGED, in microvolts.
+ * 
+ * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if a timer event could not be allocated.
+ */
+int MicroBitPowerManager::setTelemetrySampling(uint32_t period, uint32_t threshold)
+{
+    telemetryThreshold = threshold;
+
+    system_timer_cancel_event(id, MICROBIT_POWER_EVT_TELEMETRY_SAMPLE);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, MICROBIT_POWER_EVT_TELEMETRY_SAMPLE, this, &MicroBitPowerManager::onTelemetrySample);
+
+    // The first sample after (re)starting establishes the values that changes are measured against.
+    status &= ~MICROBIT_USB_INTERFACE_TELEMETRY_BASELINE;
+
+    if (period == 0)
+        return MICROBIT_OK;
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, MICROBIT_POWER_EVT_TELEMETRY_SAMPLE, this, &MicroBitPowerManager::onTelemetrySample);
+
+    if (system_timer_event_every(period, id, MICROBIT_POWER_EVT_TELEMETRY_SAMPLE) != DEVICE_OK)
+        return MICROBIT_NO_RESOURCES;
+
+    return MICROBIT_OK;
+}
+
+/**
+ * Periodic telemetry sample handler.
+ */
+void MicroBitPowerManager::onTelemetrySample(Event)
+{
+    if (refreshTelemetry() != MICROBIT_OK)
+        return;
+
+    if (!(status & MICROBIT_USB_INTERFACE_TELEMETRY_BASELINE))
+    {
+        reportedPowerData = powerData;
+        reportedPowerSource = powerSource;
+        reportedUSBStatus = usbStatus;
+        status |= MICROBIT_USB_INTERFACE_TELEMETRY_BASELINE;
+        return;
+    }
+
+    if (powerSource != reportedPowerSource)
+    {
+        reportedPowerSource = powerSource;
+        Event(id, MICROBIT_POWER_EVT_POWER_SOURCE_CHANGED);
+    }
+
+    if (usbStatus != reportedUSBStatus)
+    {
+        reportedUSBStatus = usbStatus;
+        Event(id, MICROBIT_POWER_EVT_USB_STATUS_CHANGED);
+    }
+
+    if ((uint32_t) abs((int)(powerData.batteryMicroVolts - reportedPowerData.batteryMicroVolts)) >= telemetryThreshold ||
+        (uint32_t) abs((int)(powerData.vinMicroVolts - reportedPowerData.vinMicroVolts)) >= telemetryThreshold)
+    {
+        reportedPowerData = powerData;
+        Event(id, MICROBIT_POWER_EVT_POWER_DATA_CHANGED);
+    }
 }
 
 /**
@@ -178,6 +417,34 @@ void MicroBitPowerManager::nop()
     }
 }
 
+/**
+ * Waits for the USB interface chip to come online, as it does some time after a hard power-on reset,
+ * by polling until it acknowledges its I2C address.
+ *
+ * @param timeout The longest time to wait, in milliseconds.
+ *
+ * @return MICROBIT_OK once the interface chip responds, or MICROBIT_BUSY if it did not respond within the timeout.
+ *
+ * @note This does not use the scheduler, so may be called before it is running.
+ */
+int MicroBitPowerManager::awaitInterface(int timeout)
+{
+    CODAL_TIMESTAMP start = system_timer_current_time();
+    uint8_t unused = 0;
+
+    while (true)
+    {
+        // The interface chip only acknowledges its address once its firmware is running.
+        if (i2cBus.write(MICROBIT_UIPM_I2C_ADDRESS, &unused, 0, false) == MICROBIT_OK)
+            return MICROBIT_OK;
+
+        if (system_timer_current_time() - start >= (CODAL_TIMESTAMP) timeout)
+            return MICROBIT_BUSY;
+
+        target_wait(MICROBIT_UIPM_READY_POLL_PERIOD);
+    }
+}
+
 /**
  * Attempts to issue a control packet to the USB interface chip.
  * @param packet The data to send
@@ -227,7 +494,8 @@ ManagedBuffer MicroBitPowerManager::awaitUIPMPacket()
     // Retry until we get a valid response or we time out.
     while( attempts++ < MICROBIT_UIPM_MAX_RETRIES )
     {
-        target_wait(1);
+        // Keep sensors sharing the bus sampling while we wait.
+        i2cBus.wait(1000, MICROBIT_I2C_PRIORITY_DEFAULT);
 
         // Try to read a response from the KL27
         response = recvUIPMPacket();
@@ -235,19 +503,32 @@ ManagedBuffer MicroBitPowerManager::awaitUIPMPacket()
         // If we receive an INCOMPLETE response, then the KL27 is still working on our request, so wait a little longer and try again.
         // Similarly, if the I2C transaction fails, retry.
         if( response.length() == 0 )
+        {
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+            transaction.polls++;
+#endif
             continue;
+        }
         
         if( response[0] == MICROBIT_UIPM_COMMAND_ERROR_RESPONSE )
         {
             // Is the KL27 still busy processing something? If so, reset the retries and go again.
             if( (status & MICROBIT_USB_INTERFACE_BUSY_FLAG_SUPPORTED) == MICROBIT_USB_INTERFACE_BUSY_FLAG_SUPPORTED && response[1] == MICROBIT_UIPM_BUSY )
             {
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+                transaction.busy++;
+#endif
                 attempts = 0;
                 continue;
             }
 
             if( response[1] == MICROBIT_UIPM_INCOMPLETE_CMD )
+            {
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+                transaction.polls++;
+#endif
                 continue;
+            }
         }
 
         // Sanitize the length of the packet to meet specification and return it.
@@ -277,10 +558,24 @@ ManagedBuffer MicroBitPowerManager::writeProperty(ManagedBuffer request, bool ac
 {
     ManagedBuffer response;
 
-    if (sendUIPMPacket(request) == MICROBIT_OK && ack)
-    {
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+    transaction.clear();
+#endif
+
+    int result = sendUIPMPacket(request);
+
+    if (result == MICROBIT_OK && ack)
         response = awaitUIPMPacket();
-    }
+
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    if (result != MICROBIT_OK)
+        transaction.i2cErrors++;
+
+    // A write without acknowledgement succeeds once sent. Otherwise we need a response that isn't an error.
+    bool success = result == MICROBIT_OK && (!ack || (response.length() > 1 && response[0] != MICROBIT_UIPM_COMMAND_ERROR_RESPONSE));
+    recordTransaction(request.length() > 1 ? request[1] : 0, start, success);
+#endif
 
     return response;
 }
@@ -298,11 +593,67 @@ ManagedBuffer MicroBitPowerManager::readProperty(int property)
     request[0] = MICROBIT_UIPM_COMMAND_READ_REQUEST;
     request[1] = property;
 
-    if (sendUIPMPacket(request) == MICROBIT_OK)
-        response = awaitUIPMPacket();
-    
+    response = writeProperty(request, true);
+
     return response;
 }
+
+/**
+ * Records the statistics of a completed transaction with the interface chip.
+ * @param property The property the transaction related to.
+ * @param start The time at which the transaction started (microseconds).
+ * @param success true if a valid response was received, false otherwise.
+ */
+void MicroBitPowerManager::recordTransaction(int property, CODAL_TIMESTAMP start, bool success)
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    uint32_t time = system_timer_current_time_us() - start;
+    statistics[0].add(transaction, time, success);
+
+    if (property > 0 && property <= MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT)
+        statistics[property].add(transaction, time, success);
+#endif
+}
+
+/**
+ * Determines the statistics recorded for transactions with the interface chip.
+ * Statistics are only recorded if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS is enabled.
+ * 
+ * @param property the property of the transactions (e.g. MICROBIT_UIPM_PROPERTY_POWER_SOURCE), or zero for the total of all properties.
+ * 
+ * @return the statistics, or NULL if none are recorded for the given property.
+ */
+const MicroBitUSBInterfaceStatistics *MicroBitPowerManager::getStatistics(int property)
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    if (property >= 0 && property <= MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT)
+        return &statistics[property];
+#endif
+
+    return NULL;
+}
+
+/**
+ * Resets the statistics recorded for transactions with the interface chip.
+ */
+void MicroBitPowerManager::resetStatistics()
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    for (int i = 0; i <= MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT; i++)
+        statistics[i].clear();
+#endif
+}
+
+/**
+ * Outputs the statistics recorded for transactions with the interface chip over DMESG.
+ */
+void MicroBitPowerManager::printStatistics()
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    for (int i = 0; i <= MICROBIT_UIPM_PROPERTY_KL27_USER_EVENT; i++)
+        statistics[i].dmesg("UIPM", i);
+#endif
+}
         
 /**
  * Powers down the CPU and USB interface and enters OFF state. All user code and peripherals will cease operation. 
@@ -534,7 +885,10 @@ bool MicroBitPowerManager::deepSleep(uint32_t milliSeconds, bool interruptable )
             return false;
         }
 
-        eventValue++;
+        // Keep clear of the values used for the power manager's own events.
+        if (++eventValue >= MICROBIT_POWER_EVT_RESERVED)
+            eventValue = 1;
+
         int result = system_timer_event_after( milliSeconds, id, eventValue, CODAL_TIMER_EVENT_FLAGS_WAKEUP);
         if ( result == DEVICE_OK)
         {
@@ -613,6 +967,64 @@ void MicroBitPowerManager::powerDownDisable()
     powerDownDisableCount++;
 }
 
+/**
+  * Sets how long the scheduler tick may be suppressed when the scheduler is idle.
+  * While suppressed, the CPU sleeps until the next wake up timer event or interrupt, so fibers sleeping 
+  * and button presses are noticed up to this much later than usual.
+  *
+  * @param slack the maximum time to suppress the scheduler tick for in milliseconds, or zero to disable tickless idle.
+  */
+void MicroBitPowerManager::setTicklessIdle(uint32_t slack)
+{
+    ticklessSlack = slack;
+}
+
+/**
+  * For library use.
+  * Sleeps the CPU with the scheduler tick suppressed, until the next wake up timer event, an interrupt or the tickless idle slack expires.
+  * Nothing is powered down, so peripherals continue to operate.
+  *
+  * @return DEVICE_OK if the tick was suppressed, DEVICE_NOT_SUPPORTED if tickless idle is disabled or busy,
+  * or DEVICE_INVALID_STATE if the next wake up is too soon to be worthwhile.
+  */
+int MicroBitPowerManager::ticklessIdle()
+{
+    if (ticklessSlack == 0 || !fiber_scheduler_running() || (status & MICROBIT_USB_INTERFACE_AWAITING_RESPONSE))
+        return DEVICE_NOT_SUPPORTED;
+
+    CODAL_TIMESTAMP timeEntry = system_timer_current_time_us();
+    CODAL_TIMESTAMP wakeUpTime = timeEntry + (CODAL_TIMESTAMP) 1000 * ticklessSlack;
+    CODAL_TIMESTAMP eventTime = 0;
+
+    if (system_timer_deepsleep_wakeup_time(eventTime) && eventTime < wakeUpTime)
+        wakeUpTime = eventTime;
+
+    if (wakeUpTime < timeEntry || wakeUpTime - timeEntry < (CODAL_TIMESTAMP) 1000 * CONFIG_MICROBIT_TICKLESS_IDLE_MINIMUM)
+        return DEVICE_INVALID_STATE;
+
+    timedSleep( true /*wakeOnTime*/, wakeUpTime, timeEntry, false /*deep*/, false /*wakeUpSources*/, NULL /*wakeUpPin*/);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Provides the entry and wake latency of deep sleep, measured since start up or the last call to resetDeepSleepTiming().
+ *
+ * @return The deep sleep timing record.
+ */
+const MicroBitDeepSleepTiming &MicroBitPowerManager::getDeepSleepTiming()
+{
+    return deepSleepTiming;
+}
+
+/**
+ * Clears the deep sleep timing record.
+ */
+void MicroBitPowerManager::resetDeepSleepTiming()
+{
+    memset( &deepSleepTiming, 0, sizeof(deepSleepTiming) );
+}
+
 /**
   * Determine if power down during deepSleep is enabled
 */
@@ -790,12 +1202,59 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     if ( can != DEVICE_OK)
         return can;
 
+    // Short timed sleeps leave the power LED alone, rather than wait on the interface chip twice.
+    bool updateLED = !wakeOnTime || wakeUpTime - timeEntry >= (CODAL_TIMESTAMP) 1000 * CONFIG_MICROBIT_POWER_LED_SLEEP_THRESHOLD;
+
     // Configure for sleep mode
-    setPowerLED( true /*doSleep*/);
+    if (updateLED)
+        setPowerLED( true /*doSleep*/);
 
     // Update peripheral drivers
     CodalComponent::deepSleepAll( wakeUpSources ? deepSleepCallbackBeginWithWakeUps : deepSleepCallbackBegin, NULL);
 
+    CODAL_TIMESTAMP timeSleep = system_timer_current_time_us();
+
+    timedSleep( wakeOnTime, wakeUpTime, timeEntry, true /*deep*/, wakeUpSources, wakeUpPin);
+
+    CODAL_TIMESTAMP timeWake = system_timer_current_time_us();
+
+    // Configure for running mode.
+    CodalComponent::deepSleepAll( wakeUpSources ? deepSleepCallbackEndWithWakeUps : deepSleepCallbackEnd, NULL);
+
+    // Restore edge events on the KL27 interrupt line, as we used its DETECT setting as a wake up source.
+    if (status & MICROBIT_USB_INTERFACE_IRQ_ENABLED)
+        enableInterfaceIRQ();
+
+    if (updateLED)
+        setPowerLED(false /*doSleep*/);
+
+    CODAL_TIMESTAMP timeReady = system_timer_current_time_us();
+
+    deepSleepTiming.cycles++;
+    deepSleepTiming.entryLatency = (uint32_t) (timeSleep - timeEntry);
+    deepSleepTiming.wakeLatency = (uint32_t) (timeReady - timeWake);
+    deepSleepTiming.sleepTime += timeWake - timeSleep;
+    if (deepSleepTiming.wakeLatency > deepSleepTiming.maxWakeLatency)
+        deepSleepTiming.maxWakeLatency = deepSleepTiming.wakeLatency;
+
+    powerUpTime = system_timer_current_time();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Suspends timer events and sleeps the CPU until the given time, or until an interrupt other than the system timer occurs.
+ * The system timer keeps counting throughout, and timer events that fall due in the meantime are processed on return.
+ *
+ * @param wakeOnTime    Set to true to wake up at time wakeUpTime
+ * @param wakeUpTime    Time to trigger wake up. Ignored if wakeOnTime == false;
+ * @param timeEntry     Time the sleep was requested, used to compensate for the time taken to enter and leave it.
+ * @param deep          Set to true to enable wake up from the KL27 interrupt line and the wake up pin, as needed by deep sleep.
+ * @param wakeUpSources Set to true to use wake up sources externally configured by, for example, pin->wakeOnActive(true)
+ * @param wakeUpPin     Pin to trigger wake up. Ignored if wakeUpSources == true.
+ */
+void MicroBitPowerManager::timedSleep( bool wakeOnTime, CODAL_TIMESTAMP wakeUpTime, CODAL_TIMESTAMP timeEntry, bool deep, bool wakeUpSources, NRF52Pin *wakeUpPin)
+{
     CODAL_TIMESTAMP tickStart;
     CODAL_TIMESTAMP timeStart = system_timer_deepsleep_begin( tickStart);
 
@@ -813,7 +1272,7 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     uint32_t ticksPerMS  = 1000;
     uint32_t ticksMax    = 0xFFFFFFFFul - ticksPerMS * 1000; // approx 71min
 
-    if ( !wakeUpSources)
+    if ( deep && !wakeUpSources)
     {
         if ( wakeUpPin)
         {
@@ -826,8 +1285,11 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     }
 
     // Enable wakeup from the the KL27 interrupt line.
-    io.irq1.setDetect(GPIO_PIN_CNF_SENSE_Low);
-    NVIC_EnableIRQ(GPIOTE_IRQn);
+    if ( deep)
+    {
+        io.irq1.setDetect(GPIO_PIN_CNF_SENSE_Low);
+        NVIC_EnableIRQ(GPIOTE_IRQn);
+    }
 
     sysTimer->setCompare( channel, tickStart);
     sysTimer->enableIRQ();
@@ -885,9 +1347,10 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
     }
 
     // Disable DETECT events 
-    io.irq1.setDetect(GPIO_PIN_CNF_SENSE_Disabled);
+    if ( deep)
+        io.irq1.setDetect(GPIO_PIN_CNF_SENSE_Disabled);
 
-    if ( !wakeUpSources)
+    if ( deep && !wakeUpSources)
     {
         if ( wakeUpPin)
             wakeUpPin->setDetect(GPIO_PIN_CNF_SENSE_Disabled);
@@ -907,13 +1370,4 @@ int MicroBitPowerManager::simpleDeepSleep( bool wakeOnTime, CODAL_TIMESTAMP wake
 #endif
 
     sysTimer->timer->INTENSET = saveIntenset;
-
-    // Configure for running mode.
-    CodalComponent::deepSleepAll( wakeUpSources ? deepSleepCallbackEndWithWakeUps : deepSleepCallbackEnd, NULL);
-
-    setPowerLED(false /*doSleep*/);
-
-    powerUpTime = system_timer_current_time();
-
-    return DEVICE_OK;
 }
@@ -0,0 +1,250 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitPowerProfiler.h"
+#include "MicroBitPowerManager.h"
+#include "CodalDmesg.h"
+#include "Timer.h"
+
+#if CONFIG_MICROBIT_POWER_PROFILER
+
+static const char *profileNames[MICROBIT_POWER_PROFILE_COUNT] = {"DISPLAY", "RADIO", "SPEAKER", "MICROPHONE", "BLE_ADV", "BLE_CONN"};
+
+static uint32_t profileCurrent[MICROBIT_POWER_PROFILE_COUNT + 1] = {
+    MICROBIT_POWER_PROFILE_DISPLAY_CURRENT,
+    MICROBIT_POWER_PROFILE_RADIO_CURRENT,
+    MICROBIT_POWER_PROFILE_SPEAKER_CURRENT,
+    MICROBIT_POWER_PROFILE_MICROPHONE_CURRENT,
+    MICROBIT_POWER_PROFILE_BLE_ADVERTISING_CURRENT,
+    MICROBIT_POWER_PROFILE_BLE_CONNECTED_CURRENT,
+    MICROBIT_POWER_PROFILE_BASELINE_CURRENT
+};
+
+static CODAL_TIMESTAMP profileActiveTime[MICROBIT_POWER_PROFILE_COUNT];    // Accumulated active time (microseconds), up to the last transition.
+static CODAL_TIMESTAMP profileActiveSince[MICROBIT_POWER_PROFILE_COUNT];   // Time of the last activation, if active.
+static uint32_t profileActivations[MICROBIT_POWER_PROFILE_COUNT];
+static uint8_t profileActive[MICROBIT_POWER_PROFILE_COUNT];
+static CODAL_TIMESTAMP profileStart;
+
+/**
+ * Determines the active time of a peripheral up to the given time, including any current activation.
+ */
+static CODAL_TIMESTAMP activeTime(int peripheral, CODAL_TIMESTAMP now)
+{
+    CODAL_TIMESTAMP t = profileActiveTime[peripheral];
+
+    if (profileActive[peripheral])
+        t += now - (profileActiveSince[peripheral] > profileStart ? profileActiveSince[peripheral] : profileStart);
+
+    return t;
+}
+
+/**
+ * Records a change in the power state of a peripheral. May be called from interrupt context.
+ *
+ * @param peripheral the peripheral, e.g. MICROBIT_POWER_PROFILE_RADIO.
+ * @param active true if the peripheral is now powered, false otherwise.
+ */
+void MicroBitPowerProfiler::setActive(int peripheral, bool active)
+{
+    if (peripheral < 0 || peripheral >= MICROBIT_POWER_PROFILE_COUNT)
+        return;
+
+    target_disable_irq();
+
+    if (active != (bool) profileActive[peripheral])
+    {
+        CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+        if (active)
+        {
+            profileActiveSince[peripheral] = now;
+            profileActivations[peripheral]++;
+        }
+        else
+        {
+            profileActiveTime[peripheral] = activeTime(peripheral, now);
+        }
+
+        profileActive[peripheral] = active;
+    }
+
+    target_enable_irq();
+}
+
+#endif
+
+/**
+ * Sets the current model of a peripheral.
+ *
+ * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL to set the baseline current of the board.
+ * @param microAmps the average current drawn while the peripheral is active.
+ *
+ * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER or MICROBIT_NOT_SUPPORTED if the profiler is disabled.
+ */
+int MicroBitPowerProfiler::setCurrent(int peripheral, uint32_t microAmps)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    if (peripheral < 0 || peripheral > MICROBIT_POWER_PROFILE_TOTAL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    profileCurrent[peripheral] = microAmps;
+    return MICROBIT_OK;
+#else
+    return MICROBIT_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Restarts profiling from now. Peripherals that are active remain so.
+ */
+void MicroBitPowerProfiler::reset()
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    target_disable_irq();
+
+    profileStart = system_timer_current_time_us();
+
+    for (int i = 0; i < MICROBIT_POWER_PROFILE_COUNT; i++)
+    {
+        profileActiveTime[i] = 0;
+        profileActivations[i] = profileActive[i] ? 1 : 0;
+    }
+
+    target_enable_irq();
+#endif
+}
+
+/**
+ * Determines the time a peripheral has been active since profiling started.
+ *
+ * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL for the time since profiling started.
+ *
+ * @return the time in milliseconds.
+ */
+uint32_t MicroBitPowerProfiler::getActiveTime(int peripheral)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    if (peripheral == MICROBIT_POWER_PROFILE_TOTAL)
+        return (now - profileStart) / 1000;
+
+    if (peripheral >= 0 && peripheral < MICROBIT_POWER_PROFILE_COUNT)
+        return activeTime(peripheral, now) / 1000;
+#endif
+
+    return 0;
+}
+
+/**
+ * Determines the proportion of time a peripheral has been active since profiling started.
+ *
+ * @param peripheral the peripheral.
+ *
+ * @return the duty cycle in parts per thousand.
+ */
+int MicroBitPowerProfiler::getDutyCycle(int peripheral)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    if (peripheral >= 0 && peripheral < MICROBIT_POWER_PROFILE_COUNT)
+    {
+        CODAL_TIMESTAMP now = system_timer_current_time_us();
+        CODAL_TIMESTAMP elapsed = now - profileStart;
+
+        if (elapsed > 0)
+            return (int) ((activeTime(peripheral, now) * 1000) / elapsed);
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Determines the number of times a peripheral has been activated since profiling started.
+ *
+ * @param peripheral the peripheral.
+ */
+uint32_t MicroBitPowerProfiler::getActivations(int peripheral)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    if (peripheral >= 0 && peripheral < MICROBIT_POWER_PROFILE_COUNT)
+        return profileActivations[peripheral];
+#endif
+
+    return 0;
+}
+
+/**
+ * Estimates the average current drawn since profiling started, from the duty cycle and current model.
+ *
+ * @param peripheral the peripheral, or MICROBIT_POWER_PROFILE_TOTAL for the whole board, including the baseline current.
+ *
+ * @return the estimated average current in microamps.
+ */
+uint32_t MicroBitPowerProfiler::getAverageCurrent(int peripheral)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    if (peripheral == MICROBIT_POWER_PROFILE_TOTAL)
+    {
+        uint32_t total = profileCurrent[MICROBIT_POWER_PROFILE_TOTAL];
+
+        for (int i = 0; i < MICROBIT_POWER_PROFILE_COUNT; i++)
+            total += getAverageCurrent(i);
+
+        return total;
+    }
+
+    if (peripheral >= 0 && peripheral < MICROBIT_POWER_PROFILE_COUNT)
+        return (uint32_t) (((uint64_t) profileCurrent[peripheral] * getDutyCycle(peripheral)) / 1000);
+#endif
+
+    return 0;
+}
+
+/**
+ * Outputs the profile over DMESG: the active time, duty cycle, activations and estimated current of each peripheral.
+ *
+ * @param power if provided, the interface chip power measurements are read and reported alongside the estimate.
+ */
+void MicroBitPowerProfiler::printReport(MicroBitPowerManager *power)
+{
+#if CONFIG_MICROBIT_POWER_PROFILER
+    DMESG("POWER_PROFILE: [TIME: %d ms]", getActiveTime(MICROBIT_POWER_PROFILE_TOTAL));
+
+    for (int i = 0; i < MICROBIT_POWER_PROFILE_COUNT; i++)
+        DMESG("POWER_PROFILE: [%s] [ACTIVE: %d ms] [DUTY: %d/1000] [ACTIVATIONS: %d] [CURRENT: %d uA]",
+            profileNames[i], getActiveTime(i), getDutyCycle(i), getActivations(i), getAverageCurrent(i));
+
+    DMESG("POWER_PROFILE: [ESTIMATED: %d uA] [BASELINE: %d uA]", getAverageCurrent(MICROBIT_POWER_PROFILE_TOTAL), profileCurrent[MICROBIT_POWER_PROFILE_TOTAL]);
+
+    if (power)
+    {
+        MicroBitPowerData data = power->getPowerData();
+        DMESG("POWER_PROFILE: [MEASURED] [BATTERY: %d uV] [VIN: %d uV] [CONSUMPTION: %d]", data.batteryMicroVolts, data.vinMicroVolts, (int) data.estimatedPowerConsumption);
+    }
+#else
+    (void) power;
+#endif
+}
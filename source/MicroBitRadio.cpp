@@ -28,12 +28,38 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "ErrorNo.h"
 #include "CodalFiber.h"
+#include "MicroBitPowerProfiler.h"
+#include "MicroBitTrace.h"
+#include "EventModel.h"
+#include "Timer.h"
 #include "nrf.h"
 
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_soc.h"
+#include "nrf_sdh_soc.h"
+#endif
+
+// The RADIO can be shared with the BLE stack only where the SoftDevice provides its timeslot API.
+#if defined(SOFTDEVICE_PRESENT) && CONFIG_MICROBIT_RADIO_TIMESLOT
+#define MICROBIT_RADIO_TIMESLOT_SUPPORTED   1
+#else
+#define MICROBIT_RADIO_TIMESLOT_SUPPORTED   0
+#endif
+
 using namespace codal;
 
 const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xD8, 0xEC, 0xF0, 0xF4, 0xF8, 0xFC, 0x00, 0x03, 0x04};
 
+// RADIO MODE and PCNF0 register values for each of the MICROBIT_RADIO_PHY_* physical layers. All use an 8 bit length field.
+// 2Mbps uses the recommended 16 bit preamble, and the coded PHYs need the long range preamble, coding indicator and TERM fields.
+const uint8_t MICROBIT_RADIO_PHY_MODE[] = {RADIO_MODE_MODE_Nrf_1Mbit, RADIO_MODE_MODE_Nrf_2Mbit, RADIO_MODE_MODE_Ble_LR500Kbit, RADIO_MODE_MODE_Ble_LR125Kbit};
+const uint32_t MICROBIT_RADIO_PHY_PCNF0[] = {
+    0x00000008,
+    0x00000008 | (RADIO_PCNF0_PLEN_16bit << RADIO_PCNF0_PLEN_Pos),
+    0x00000008 | (RADIO_PCNF0_PLEN_LongRange << RADIO_PCNF0_PLEN_Pos) | (2 << RADIO_PCNF0_CILEN_Pos) | (3 << RADIO_PCNF0_TERMLEN_Pos),
+    0x00000008 | (RADIO_PCNF0_PLEN_LongRange << RADIO_PCNF0_PLEN_Pos) | (2 << RADIO_PCNF0_CILEN_Pos) | (3 << RADIO_PCNF0_TERMLEN_Pos)
+};
+
 /**
   * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
   *
@@ -48,9 +74,9 @@ const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xD8, 0xEC, 0xF0, 0xF4, 0xF8
   * TODO: Meshing should also be considered - again a GLOSSY approach may be effective here, and highly complementary to
   * the master/slave arachitecture of BLE.
   *
-  * TODO: This implementation may only operated whilst the BLE stack is disabled. The nrf51822 provides a timeslot API to allow
-  * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
-  * creation of wireless BLE bridges.
+  * If the BLE stack is running when the radio is enabled, the RADIO is shared with it through the SoftDevice timeslot API
+  * (c.f. CONFIG_MICROBIT_RADIO_TIMESLOT). Packets are then sent and received only within the timeslots granted to us,
+  * which may allow for the creation of wireless BLE bridges.
   *
   * NOTE: This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
   * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
@@ -59,8 +85,164 @@ const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xD8, 0xEC, 0xF0, 0xF4, 0xF8
 
 MicroBitRadio* MicroBitRadio::instance = NULL;
 
-extern "C" void RADIO_IRQHandler(void)
+/**
+ * Yields while waiting for the transmit queue, or spins if the scheduler isn't running.
+ */
+static void txWait()
+{
+    if (fiber_scheduler_running())
+        fiber_sleep(1);
+}
+
+#if CONFIG_MICROBIT_RADIO_RX_POOL_SIZE > 32 || CONFIG_MICROBIT_RADIO_RX_POOL_SIZE < 2
+#error "CONFIG_MICROBIT_RADIO_RX_POOL_SIZE must be in the range 2..32"
+#endif
+
+#if CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE > 100 || CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE < MICROBIT_RADIO_MAXIMUM_RX_BUFFERS
+#error "CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE must be in the range MICROBIT_RADIO_MAXIMUM_RX_BUFFERS..100"
+#endif
+
+// The number of words needed to track the largest receive pool that setReceiveQueueSize() may allocate.
+#define MICROBIT_RADIO_RX_POOL_WORDS    ((CONFIG_MICROBIT_RADIO_RX_POOL_SIZE + 2 * (CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE - MICROBIT_RADIO_MAXIMUM_RX_BUFFERS) + 31) / 32)
+
+// Receive buffers, allocated when the radio is first enabled, and the set of those not in use (one bit per buffer).
+// The set is updated with exclusive accesses, so buffers may be taken in the RADIO IRQ and returned from any context without locking.
+static FrameBuffer *rxPool = NULL;
+static int rxPoolSize = 0;
+static volatile uint32_t rxPoolFree[MICROBIT_RADIO_RX_POOL_WORDS];
+
+/**
+  * Determines the number of receive buffers needed to support a receive queue of the given depth.
+  */
+static int rxPoolSizeFor(int queueSize)
+{
+    int size = CONFIG_MICROBIT_RADIO_RX_POOL_SIZE + 2 * (queueSize - MICROBIT_RADIO_MAXIMUM_RX_BUFFERS);
+    return size < 2 ? 2 : size;
+}
+
+/**
+  * Allocate a receive pool of the given size, with every buffer free.
+  *
+  * @return true on success, false if the memory could not be allocated.
+  */
+static bool rxPoolCreate(int size)
+{
+    rxPool = new FrameBuffer[size];
+
+    if (rxPool == NULL)
+        return false;
+
+    rxPoolSize = size;
+
+    for (int i = 0; i < MICROBIT_RADIO_RX_POOL_WORDS; i++)
+    {
+        int bits = size - i * 32;
+        rxPoolFree[i] = bits >= 32 ? 0xFFFFFFFF : bits > 0 ? (1UL << bits) - 1 : 0;
+    }
+
+    return true;
+}
+
+/**
+  * Determines the number of buffers in the receive pool that are not in use.
+  */
+static int rxPoolAvailable()
+{
+    int count = 0;
+
+    for (int i = 0; i < MICROBIT_RADIO_RX_POOL_WORDS; i++)
+        for (uint32_t mask = rxPoolFree[i]; mask; mask &= mask - 1)
+            count++;
+
+    return count;
+}
+
+/**
+  * Take a buffer from the receive pool.
+  *
+  * @return the buffer, or NULL if all are in use.
+  */
+static FrameBuffer *rxPoolAlloc()
+{
+    for (int i = 0; i < MICROBIT_RADIO_RX_POOL_WORDS; i++)
+    {
+        uint32_t mask;
+        uint32_t slot;
+
+        do {
+            mask = __LDREXW(&rxPoolFree[i]);
+            if (mask == 0)
+            {
+                __CLREX();
+                break;
+            }
+
+            slot = __CLZ(__RBIT(mask));
+        } while (__STREXW(mask & ~(1UL << slot), &rxPoolFree[i]));
+
+        if (mask)
+            return &rxPool[i * 32 + slot];
+    }
+
+    return NULL;
+}
+
+/**
+  * Return a buffer to the receive pool.
+  *
+  * @return true if the buffer belongs to the pool, false otherwise.
+  */
+static bool rxPoolRelease(FrameBuffer *p)
+{
+    if (rxPool == NULL || p < rxPool || p >= rxPool + rxPoolSize)
+        return false;
+
+    int index = p - rxPool;
+    volatile uint32_t *word = &rxPoolFree[index / 32];
+    uint32_t bit = 1UL << (index % 32);
+    uint32_t mask;
+
+    do {
+        mask = __LDREXW(word);
+    } while (__STREXW(mask | bit, word));
+
+    return true;
+}
+
+/**
+  * Returns buffers from the receive pool to the pool, and frees any others.
+  * This allows packets returned by MicroBitRadio::recv() to be deleted as usual.
+  */
+void FrameBuffer::operator delete(void *p)
+{
+    if (!rxPoolRelease((FrameBuffer *) p))
+        ::operator delete(p);
+}
+
+// Shortcuts used while receiving, once sendAsync() has been used, and while working through the transmit queue.
+// While transmitting, END→DISABLE ends each packet, and DISABLED→TXEN or DISABLED→RXEN chooses what follows it.
+#define MICROBIT_RADIO_SHORTS_RX    (RADIO_SHORTS_ADDRESS_RSSISTART_Msk | RADIO_SHORTS_READY_START_Msk)
+#define MICROBIT_RADIO_SHORTS_TX    (MICROBIT_RADIO_SHORTS_RX | RADIO_SHORTS_END_DISABLE_Msk)
+
+extern "C" MICROBIT_RAMFUNC void RADIO_IRQHandler(void)
 {
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_RADIO_IRQ);
+
+    // While working through the transmit queue, the shortcuts start and end each packet, and DISABLED events move on to the next.
+    if (MicroBitRadio::instance->isTransmitting())
+    {
+        NRF_RADIO->EVENTS_READY = 0;
+        NRF_RADIO->EVENTS_END = 0;
+
+        if (NRF_RADIO->EVENTS_DISABLED)
+        {
+            NRF_RADIO->EVENTS_DISABLED = 0;
+            MicroBitRadio::instance->txDisabled();
+        }
+
+        return;
+    }
+
     if(NRF_RADIO->EVENTS_READY)
     {
         NRF_RADIO->EVENTS_READY = 0;
@@ -90,6 +272,7 @@ extern "C" void RADIO_IRQHandler(void)
         else
         {
             MicroBitRadio::instance->setRSSI(0);
+            MicroBitRadio::instance->crcError();
         }
 
         // Start listening and wait for the END event
@@ -97,6 +280,18 @@ extern "C" void RADIO_IRQHandler(void)
     }
 }
 
+/**
+  * Bottom half of the RADIO interrupt, used to dispatch packets when low latency dispatch is enabled,
+  * and to report packets sent within timeslots.
+  */
+extern "C" MICROBIT_RAMFUNC void SWI3_EGU3_IRQHandler(void)
+{
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_RADIO_DISPATCH);
+
+    if (MicroBitRadio::instance)
+        MicroBitRadio::instance->deferredCallback();
+}
+
 /**
   * Constructor.
   *
@@ -105,15 +300,36 @@ extern "C" void RADIO_IRQHandler(void)
   * @note This class is demand activated, as a result most resources are only
   *       committed if send/recv or event registrations calls are made.
   */
-MicroBitRadio::MicroBitRadio(uint16_t id) : datagram(*this), event (*this)
+MicroBitRadio::MicroBitRadio(uint16_t id) : MicroBitMemoryConsumer("radio"), datagram(*this), event (*this), bulk(*this), link(*this), tdma(*this)
 {
     this->id = id;
     this->status = 0;
 	this->group = MICROBIT_RADIO_DEFAULT_GROUP;
-	this->queueDepth = 0;
+    this->groups[0] = MICROBIT_RADIO_DEFAULT_GROUP;
+    this->groupMask = 1;
     this->rssi = 0;
+    this->txPower = MICROBIT_RADIO_DEFAULT_TX_POWER;
+    this->frequency = MICROBIT_RADIO_DEFAULT_FREQUENCY;
+    this->frameSize = MICROBIT_RADIO_MAX_PACKET_SIZE;
+    this->phy = MICROBIT_RADIO_PHY_1MBIT;
+    this->rxHead = 0;
+    this->rxTail = 0;
+    this->rxQueueSize = MICROBIT_RADIO_MAXIMUM_RX_BUFFERS;
     this->rxQueue = NULL;
     this->rxBuf = NULL;
+    this->txQueue = NULL;
+    this->txHead = 0;
+    this->txTail = 0;
+    this->txActive = false;
+    this->txSending = false;
+    this->txGate = true;
+    this->txBackoff = false;
+    this->ccaThreshold = 0;
+    this->txStarted = 0;
+    this->txCompleted = 0;
+    this->txReported = 0;
+
+    memset(&stats, 0, sizeof(stats));
 
     instance = this;
 }
@@ -130,28 +346,46 @@ int MicroBitRadio::setTransmitPower(int power)
     if (power < 0 || power >= MICROBIT_RADIO_POWER_LEVELS)
         return DEVICE_INVALID_PARAMETER;
 
-    NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[power];
+    txPower = power;
+
+    // While the BLE stack owns the RADIO, this is applied at the start of our next timeslot.
+    if (!ble_running())
+        NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[power];
 
     return DEVICE_OK;
 }
 
+/**
+ * Determines the output power level of the transmitter.
+ *
+ * @return a value in the range 0..7, where 0 is the lowest power and 7 is the highest.
+ */
+int MicroBitRadio::getTransmitPower()
+{
+    return txPower;
+}
+
 /**
   * Change the transmission and reception band of the radio to the given channel
   *
   * @param band a frequency band in the range 0 - 100. Each step is 1MHz wide, based at 2400MHz.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the value is out of range,
-  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
   */
 int MicroBitRadio::setFrequencyBand(int band)
 {
-    if (ble_running())
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
         return DEVICE_NOT_SUPPORTED;
 
     if (band < 0 || band > 100)
         return DEVICE_INVALID_PARAMETER;
 
-    NRF_RADIO->FREQUENCY = (uint32_t)band;
+    frequency = band;
+
+    // While the BLE stack owns the RADIO, this is applied at the start of our next timeslot.
+    if (!ble_running())
+        NRF_RADIO->FREQUENCY = (uint32_t)band;
 
     return DEVICE_OK;
 }
@@ -169,49 +403,61 @@ FrameBuffer* MicroBitRadio::getRxBuf()
 
 /**
   * Attempt to queue a buffer received by the radio hardware, if sufficient space is available.
+  * The replacement receive buffer is taken from a pool allocated by enable(), so no memory is allocated here.
   *
-  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if a replacement receiver buffer
-  *         could not be allocated (either by policy or memory exhaustion).
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the queue is full or no replacement
+  *         receive buffer is free in the pool.
   */
 int MicroBitRadio::queueRxBuf()
 {
     if (rxBuf == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (queueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
-        return DEVICE_NO_RESOURCES;
+    uint8_t tail = rxTail;
+    uint8_t next = (tail + 1) % (rxQueueSize + 1);
 
-    // Store the received RSSI value in the frame
-    rxBuf->rssi = getRSSI();
+    if (next == rxHead)
+    {
+        stats.queueFull++;
+        return DEVICE_NO_RESOURCES;
+    }
 
     // Ensure that a replacement buffer is available before queuing.
-    FrameBuffer *newRxBuf = new FrameBuffer();
+    FrameBuffer *newRxBuf = rxPoolAlloc();
 
     if (newRxBuf == NULL)
+    {
+        stats.noBuffer++;
         return DEVICE_NO_RESOURCES;
+    }
 
-    // We add to the tail of the queue to preserve causal ordering.
+    // Store the received RSSI value, group, physical layer and time of arrival in the frame
+    rxBuf->rssi = getRSSI();
+    rxBuf->group = groups[NRF_RADIO->RXMATCH & (MICROBIT_RADIO_MAX_GROUPS - 1)];
+    rxBuf->phy = phy;
+    rxBuf->timestamp = (uint32_t) system_timer_current_time_us();
     rxBuf->next = NULL;
 
-    if (rxQueue == NULL)
-    {
-        rxQueue = rxBuf;
-    }
-    else
-    {
-        FrameBuffer *p = rxQueue;
-        while (p->next != NULL)
-            p = p->next;
-
-        p->next = rxBuf;
-    }
+    int band = (-rxBuf->rssi - 30) / 10;
+    stats.rssi[band < 0 ? 0 : band >= MICROBIT_RADIO_RSSI_BUCKETS ? MICROBIT_RADIO_RSSI_BUCKETS - 1 : band]++;
+    stats.rxPackets++;
 
-    // Increase our received packet count
-    queueDepth++;
+    // We add to the tail of the queue to preserve causal ordering.
+    // The packet must be in place before recv() can see the new tail.
+    rxQueue[tail] = rxBuf;
+    __DMB();
+    rxTail = next;
 
-    // Allocate a new buffer for the receiver hardware to use. the old on will be passed on to higher layer protocols/apps.
+    // Use the new buffer for the receiver hardware. the old one will be passed on to higher layer protocols/apps.
     rxBuf = newRxBuf;
 
+    // Have the idle thread pass the packet on to its protocol handler.
+    fiber_wake_idle_component(this);
+
+    // Have the dispatch interrupt pass the packet on as soon as we return, if low latency dispatch is enabled.
+    if (status & MICROBIT_RADIO_STATUS_LOW_LATENCY)
+        NVIC_SetPendingIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+
     return DEVICE_OK;
 }
 
@@ -234,6 +480,105 @@ int MicroBitRadio::setRSSI(int rssi)
     return DEVICE_OK;
 }
 
+/**
+  * Records a packet dropped because its CRC was invalid.
+  *
+  * @note should only be called from RADIO_IRQHandler...
+  */
+void MicroBitRadio::crcError()
+{
+    stats.crcErrors++;
+}
+
+/**
+  * Retrieve the usage counters of the radio, since it was created or resetStatistics() was last called.
+  *
+  * @return a copy of the counters.
+  */
+MicroBitRadioStatistics MicroBitRadio::getStatistics()
+{
+    // The counters are updated by the RADIO interrupt, so take a consistent snapshot.
+    target_disable_irq();
+    MicroBitRadioStatistics s = stats;
+    target_enable_irq();
+
+    return s;
+}
+
+/**
+  * Reset all usage counters to zero.
+  */
+void MicroBitRadio::resetStatistics()
+{
+    target_disable_irq();
+    memset(&stats, 0, sizeof(stats));
+    target_enable_irq();
+}
+
+/**
+ * Determines the heap memory committed by the radio: its receive buffers and queue, and its transmit queue.
+ *
+ * @return The number of bytes currently allocated.
+ */
+uint32_t MicroBitRadio::getMemoryUsage()
+{
+    uint32_t usage = 0;
+
+    if (rxPool)
+        usage += sizeof(FrameBuffer) * rxPoolSize;
+
+    if (rxQueue)
+        usage += sizeof(FrameBuffer *) * (rxQueueSize + 1);
+
+    if (txQueue)
+        usage += sizeof(FrameBuffer) * (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+
+    return usage;
+}
+
+/**
+ * Frees the receive buffers and queue, and the transmit queue, while the radio is disabled (other than for deep sleep) and none of them hold a packet.
+ * They are allocated again when the radio is next enabled or used.
+ *
+ * @return The number of bytes returned to the heap.
+ */
+uint32_t MicroBitRadio::releaseMemory()
+{
+    uint32_t released = 0;
+
+    // Reception resumes into rxBuf when we wake from deep sleep, so it is kept until then.
+    if (status & (MICROBIT_RADIO_STATUS_INITIALISED | MICROBIT_RADIO_STATUS_DEEPSLEEP_STATE))
+        return 0;
+
+    if (txQueue && txHead == txTail)
+    {
+        delete[] txQueue;
+        txQueue = NULL;
+        released += sizeof(FrameBuffer) * (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+    }
+
+    // Only free the receive buffers if nothing is queued, and the application holds none of them.
+    if (rxPool && rxHead == rxTail && rxPoolAvailable() == rxPoolSize - (rxBuf ? 1 : 0))
+    {
+        released += sizeof(FrameBuffer) * rxPoolSize;
+
+        delete[] rxPool;
+        rxPool = NULL;
+        rxPoolSize = 0;
+        rxBuf = NULL;
+
+        if (rxQueue)
+        {
+            released += sizeof(FrameBuffer *) * (rxQueueSize + 1);
+
+            delete[] rxQueue;
+            rxQueue = NULL;
+        }
+    }
+
+    return released;
+}
+
 /**
   * Retrieves the current RSSI for the most recent packet.
   * The return value is measured in -dbm. The higher the value, the stronger the signal.
@@ -250,40 +595,17 @@ int MicroBitRadio::getRSSI()
 }
 
 /**
-  * Initialises the radio for use as a multipoint sender/receiver
-  *
-  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * Writes our configuration into the RADIO module. Used by enable(), and at the start of each timeslot
+  * while sharing the RADIO with the BLE stack.
   */
-int MicroBitRadio::enable()
+void MicroBitRadio::configure()
 {
-    // If the device is already initialised, then there's nothing to do.
-    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
-        return DEVICE_OK;
-
-    // Only attempt to enable this radio mode if BLE is disabled.
-    if (ble_running())
-        return DEVICE_NOT_SUPPORTED;
-
-    // If this is the first time we've been enable, allocate out receive buffers.
-    if (rxBuf == NULL)
-        rxBuf = new FrameBuffer();
-
-    if (rxBuf == NULL)
-        return DEVICE_NO_RESOURCES;
-
-    // Enable the High Frequency clock on the processor. This is a pre-requisite for
-    // the RADIO module. Without this clock, no communication is possible.
-    NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
-    NRF_CLOCK->TASKS_HFCLKSTART = 1;
-    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+    NRF_RADIO->TXPOWER = (uint32_t)MICROBIT_RADIO_POWER_LEVEL[txPower];
+    NRF_RADIO->FREQUENCY = (uint32_t)frequency;
 
-    // Bring up the nrf51822 RADIO module in Nordic's proprietary 1MBps packet radio mode.
-    setTransmitPower(MICROBIT_RADIO_DEFAULT_TX_POWER);
-    setFrequencyBand(MICROBIT_RADIO_DEFAULT_FREQUENCY);
-
-    // Configure for 1Mbps throughput.
+    // Configure for 1Mbps throughput, unless another physical layer has been selected with setPHY().
     // This may sound excessive, but running a high data rates reduces the chances of collisions...
-    NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_1Mbit;
+    NRF_RADIO->MODE = MICROBIT_RADIO_PHY_MODE[phy];
 
     // Configure the addresses we use for this protocol. We run ANONYMOUSLY at the core.
     // A 40 bit addresses is used. The first 32 bits match the ASCII character code for "uBit".
@@ -291,20 +613,20 @@ int MicroBitRadio::enable()
     // We also map the assigned 8-bit GROUP id into the PREFIX field. This allows the RADIO hardware to perform
     // address matching for us, and only generate an interrupt when a packet matching our group is received.
     NRF_RADIO->BASE0 = MICROBIT_RADIO_BASE_ADDRESS;
+    NRF_RADIO->BASE1 = MICROBIT_RADIO_BASE_ADDRESS;
 
-    // Join the default group. This will configure the remaining byte in the RADIO hardware module.
-    setGroup(this->group);
+    // Join our groups. This will configure the remaining byte of each address in the RADIO hardware module.
+    writeAddresses();
 
-    // The RADIO hardware module supports the use of multiple addresses, but as we're running anonymously, we only need one.
-    // Configure the RADIO module to use the default address (address 0) for both send and receive operations.
+    // The RADIO hardware module supports the use of multiple addresses. We send using our group's address (address 0),
+    // and also receive on addresses 1..7 for any groups added with addGroup(), which share the same base address.
     NRF_RADIO->TXADDRESS = 0;
-    NRF_RADIO->RXADDRESSES = 1;
 
     // Packet layout configuration. The nrf51822 has a highly capable and flexible RADIO module that, in addition to transmission
     // and reception of data, also contains a LENGTH field, two optional additional 1 byte fields (S0 and S1) and a CRC calculation.
     // Configure the packet format for a simple 8 bit length field and no additional fields.
-    NRF_RADIO->PCNF0 = 0x00000008;
-    NRF_RADIO->PCNF1 = 0x02040000 | MICROBIT_RADIO_MAX_PACKET_SIZE;
+    NRF_RADIO->PCNF0 = MICROBIT_RADIO_PHY_PCNF0[phy];
+    NRF_RADIO->PCNF1 = 0x02040000 | frameSize;
 
     // Most communication channels contain some form of checksum - a mathematical calculation taken based on all the data
     // in a packet, that is also sent as part of the packet. When received, this calculation can be repeated, and the results
@@ -318,6 +640,61 @@ int MicroBitRadio::enable()
 
     // Set the start random value of the data whitening algorithm. This can be any non zero number.
     NRF_RADIO->DATAWHITEIV = 0x18;
+}
+
+/**
+  * Initialises the radio for use as a multipoint sender/receiver
+  *
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+  */
+int MicroBitRadio::enable()
+{
+    // If the device is already initialised, then there's nothing to do.
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+        return DEVICE_OK;
+
+    // Only attempt to enable this radio mode if BLE is disabled, or we can share the RADIO with it.
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
+        return DEVICE_NOT_SUPPORTED;
+
+    // If this is the first time we've been enable, allocate out receive buffers and queue.
+    if (rxPool == NULL)
+        rxPoolCreate(rxPoolSizeFor(rxQueueSize));
+
+    if (rxQueue == NULL)
+        rxQueue = new FrameBuffer *[rxQueueSize + 1];
+
+    if (rxBuf == NULL && rxPool != NULL)
+        rxBuf = rxPoolAlloc();
+
+    if (rxBuf == NULL || rxQueue == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    txPower = MICROBIT_RADIO_DEFAULT_TX_POWER;
+    frequency = MICROBIT_RADIO_DEFAULT_FREQUENCY;
+
+    // If the BLE stack is running, it owns the RADIO and the clocks. We configure the RADIO at the start of each timeslot instead.
+    if (ble_running())
+    {
+        int result = timeslotOpen();
+
+        if (result != DEVICE_OK)
+            return result;
+
+        component_status_set(this, DEVICE_COMPONENT_STATUS_IDLE_TICK | MICROBIT_RADIO_STATUS_INITIALISED);
+        MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_RADIO, true);
+
+        return DEVICE_OK;
+    }
+
+    // Enable the High Frequency clock on the processor. This is a pre-requisite for
+    // the RADIO module. Without this clock, no communication is possible.
+    NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+    NRF_CLOCK->TASKS_HFCLKSTART = 1;
+    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+
+    // Bring up the nrf51822 RADIO module in Nordic's proprietary 1MBps packet radio mode.
+    configure();
 
     // Set up the RADIO module to read and write from our internal buffer.
     NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
@@ -337,11 +714,12 @@ int MicroBitRadio::enable()
     NRF_RADIO->EVENTS_END = 0;
     NRF_RADIO->TASKS_START = 1;
 
-    // register ourselves for a callback event, in order to empty the receive queue.
-    status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    // register ourselves for a callback event, in order to empty the receive queue. We sleep again once it is empty.
+    component_status_set(this, DEVICE_COMPONENT_STATUS_IDLE_TICK);
 
     // Done. Record that our RADIO is configured.
-    status |= MICROBIT_RADIO_STATUS_INITIALISED;
+    component_status_set(this, MICROBIT_RADIO_STATUS_INITIALISED);
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_RADIO, true);
 
     return DEVICE_OK;
 }
@@ -349,17 +727,29 @@ int MicroBitRadio::enable()
 /**
   * Disables the radio for use as a multipoint sender/receiver.
   *
-  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
   */
 int MicroBitRadio::disable()
 {
     // Only attempt to enable.disable the radio if the protocol is alreayd running.
-    if (ble_running())
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
         return DEVICE_NOT_SUPPORTED;
 
     if (!(status & MICROBIT_RADIO_STATUS_INITIALISED))
         return DEVICE_OK;
 
+    // If we're sharing the RADIO, hand it back to the BLE stack. Anything still queued is abandoned.
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+    {
+        timeslotClose();
+        txHead = txTail;
+
+        component_status_clear(this, DEVICE_COMPONENT_STATUS_IDLE_TICK | MICROBIT_RADIO_STATUS_INITIALISED);
+        MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_RADIO, false);
+
+        return DEVICE_OK;
+    }
+
     // Disable interrupts and STOP any ongoing packet reception.
     NVIC_DisableIRQ(RADIO_IRQn);
 
@@ -367,11 +757,28 @@ int MicroBitRadio::disable()
     NRF_RADIO->TASKS_DISABLE = 1;
     while(NRF_RADIO->EVENTS_DISABLED == 0);
 
+    // Abandon any packets awaiting transmission, and return the RADIO to its receive configuration.
+    if (txActive)
+    {
+        txActive = false;
+        txSending = false;
+        txHead = txTail;
+
+        NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk;
+        NRF_RADIO->SHORTS = MICROBIT_RADIO_SHORTS_RX;
+        NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
+    }
+
     // deregister ourselves from the callback event used to empty the receive queue.
-    status &= ~DEVICE_COMPONENT_STATUS_IDLE_TICK;
+    component_status_clear(this, DEVICE_COMPONENT_STATUS_IDLE_TICK);
 
     // record that the radio is now disabled
-    status &= ~MICROBIT_RADIO_STATUS_INITIALISED;
+    component_status_clear(this, MICROBIT_RADIO_STATUS_INITIALISED);
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_RADIO, false);
+
+#if CONFIG_ENABLED(CONFIG_MICROBIT_RADIO_RELEASE_ON_DISABLE)
+    releaseMemory();
+#endif
 
     return DEVICE_OK;
 }
@@ -379,67 +786,751 @@ int MicroBitRadio::disable()
 /**
   * Sets the radio to listen to packets sent with the given group id.
   *
-  * @param group The group to join. A micro:bit can only listen to one group ID at any time.
+  * @param group The group to join. A micro:bit sends to one group at a time, but may receive others added with addGroup().
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
   */
 int MicroBitRadio::setGroup(uint8_t group)
 {
-    if (ble_running())
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
         return DEVICE_NOT_SUPPORTED;
 
     // Record our group id locally
     this->group = group;
+    this->groups[0] = group;
+
+    // We now receive this group on address 0, so drop any other address added for it.
+    for (int i = 1; i < MICROBIT_RADIO_MAX_GROUPS; i++)
+        if (groups[i] == group)
+            groupMask &= ~(1 << i);
 
     // Also append it to the address of this device, to allow the RADIO module to filter for us.
-    NRF_RADIO->PREFIX0 = (uint32_t)group;
+    if (!ble_running())
+        writeAddresses();
 
     return DEVICE_OK;
 }
 
 /**
-  * A background, low priority callback that is triggered whenever the processor is idle.
-  * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
+  * Additionally receives packets sent to the given group, using the RADIO's hardware address matching.
+  * Packets are still sent to the group last set by setGroup(). Each received packet records the group
+  * it was sent to in FrameBuffer::group.
+  *
+  * @param group The group to receive.
+  *
+  * @return DEVICE_OK on success, DEVICE_NO_RESOURCES if MICROBIT_RADIO_MAX_GROUPS groups are already
+  *         being received, or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
   */
-void MicroBitRadio::idleCallback()
+int MicroBitRadio::addGroup(uint8_t group)
 {
-    // Walk the list of packets and process each one.
-    while(rxQueue)
-    {
-        FrameBuffer *p = rxQueue;
-
-        switch (p->protocol)
-        {
-            case MICROBIT_RADIO_PROTOCOL_DATAGRAM:
-                datagram.packetReceived();
-                break;
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
+        return DEVICE_NOT_SUPPORTED;
 
-            case MICROBIT_RADIO_PROTOCOL_EVENTBUS:
-                event.packetReceived();
-                break;
+    int free = -1;
 
-            default:
-                Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
+    for (int i = 0; i < MICROBIT_RADIO_MAX_GROUPS; i++)
+    {
+        if (groupMask & (1 << i))
+        {
+            if (groups[i] == group)
+                return DEVICE_OK;
         }
-
-        // If the packet was processed, it will have been recv'd, and taken from the queue.
-        // If this was a packet for an unknown protocol, it will still be there, so simply free it.
-        if (p == rxQueue)
+        else if (free < 0)
         {
-            recv();
-            delete p;
+            free = i;
         }
     }
+
+    if (free < 0)
+        return DEVICE_NO_RESOURCES;
+
+    groups[free] = group;
+    groupMask |= 1 << free;
+
+    if (!ble_running())
+        writeAddresses();
+
+    return DEVICE_OK;
 }
 
 /**
-  * Determines the number of packets ready to be processed.
+  * Stops receiving packets sent to a group added with addGroup().
+  *
+  * @param group The group to stop receiving.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the group was not added with addGroup(),
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+  */
+int MicroBitRadio::removeGroup(uint8_t group)
+{
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
+        return DEVICE_NOT_SUPPORTED;
+
+    for (int i = 1; i < MICROBIT_RADIO_MAX_GROUPS; i++)
+    {
+        if ((groupMask & (1 << i)) && groups[i] == group)
+        {
+            groupMask &= ~(1 << i);
+
+            if (!ble_running())
+                writeAddresses();
+
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+  * Writes the groups we receive into the PREFIX and RXADDRESSES registers.
+  */
+void MicroBitRadio::writeAddresses()
+{
+    // Each logical address takes its prefix from one byte of PREFIX0 (addresses 0..3) or PREFIX1 (addresses 4..7).
+    NRF_RADIO->PREFIX0 = groups[0] | (groups[1] << 8) | (groups[2] << 16) | ((uint32_t)groups[3] << 24);
+    NRF_RADIO->PREFIX1 = groups[4] | (groups[5] << 8) | (groups[6] << 16) | ((uint32_t)groups[7] << 24);
+    NRF_RADIO->RXADDRESSES = groupMask;
+}
+
+/**
+  * Sets the number of received packets that may be queued awaiting processing. Packets arriving while the
+  * queue is full are dropped, so a deeper queue allows bursts to be absorbed between idle passes of the scheduler.
+  *
+  * Each entry costs two receive buffers of sizeof(FrameBuffer) bytes (one queued, and one held by a protocol
+  * such as MicroBitRadioDatagram awaiting recv()), plus a pointer. getReceiveMemory() reports the total.
+  *
+  * @param size The depth of the queue, in the range 1..CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the size is out of range,
+  *         DEVICE_INVALID_STATE if the radio is enabled, DEVICE_BUSY if received packets have not yet been deleted,
+  *         or DEVICE_NO_RESOURCES if the memory could not be allocated.
+  */
+int MicroBitRadio::setReceiveQueueSize(int size)
+{
+    if (size < 1 || size > CONFIG_MICROBIT_RADIO_MAX_RX_QUEUE_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    // The RADIO IRQ uses the queue and the pool while the radio is enabled.
+    if (status & MICROBIT_RADIO_STATUS_INITIALISED)
+        return DEVICE_INVALID_STATE;
+
+    if (size == rxQueueSize)
+        return DEVICE_OK;
+
+    // If nothing has been allocated yet, enable() will allocate the new size.
+    if (rxPool == NULL)
+    {
+        rxQueueSize = size;
+        return DEVICE_OK;
+    }
+
+    // Packets that have been received point into the pool, so it can only be replaced once they have all been deleted.
+    if (rxPoolAvailable() != rxPoolSize - (rxBuf ? 1 : 0))
+        return DEVICE_BUSY;
+
+    delete[] rxPool;
+    delete[] rxQueue;
+    rxPool = NULL;
+    rxQueue = NULL;
+    rxBuf = NULL;
+    rxHead = 0;
+    rxTail = 0;
+
+    if (!rxPoolCreate(rxPoolSizeFor(size)))
+        return DEVICE_NO_RESOURCES;
+
+    rxQueueSize = size;
+    rxQueue = new FrameBuffer *[size + 1];
+    rxBuf = rxPoolAlloc();
+
+    if (rxQueue == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the number of received packets that may be queued awaiting processing.
+  *
+  * @return The depth last set by setReceiveQueueSize(), or MICROBIT_RADIO_MAXIMUM_RX_BUFFERS by default.
+  */
+int MicroBitRadio::getReceiveQueueSize()
+{
+    return rxQueueSize;
+}
+
+/**
+  * Determines the memory allocated for receive buffers and the receive queue.
+  *
+  * @return The number of bytes allocated, or zero if the radio has not yet been enabled.
+  */
+int MicroBitRadio::getReceiveMemory()
+{
+    if (rxPool == NULL)
+        return 0;
+
+    return rxPoolSize * sizeof(FrameBuffer) + (rxQueueSize + 1) * sizeof(FrameBuffer *);
+}
+
+/**
+  * Selects the physical layer (modulation and data rate) used to send and receive packets.
+  *
+  * MICROBIT_RADIO_PHY_1MBIT is understood by all micro:bits. MICROBIT_RADIO_PHY_2MBIT halves the time on air for each
+  * packet, while the BLE coded PHYs (MICROBIT_RADIO_PHY_LR500 and MICROBIT_RADIO_PHY_LR125) trade throughput for range.
+  * Only peers using the same PHY will receive our packets.
+  *
+  * @param phy The physical layer to use, one of the MICROBIT_RADIO_PHY_* values.
+  *
+  * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the value is out of range,
+  *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT, or MICROBIT_BUSY if called from an
+  *         interrupt while packets queued by sendAsync() are being transmitted.
+  */
+int MicroBitRadio::setPHY(int phy)
+{
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (phy < 0 || phy >= MICROBIT_RADIO_PHY_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    // If we're not yet running, enable() will apply the configuration, as will the start of our next timeslot.
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED) || ble_running())
+    {
+        this->phy = phy;
+        return DEVICE_OK;
+    }
+
+    // The RADIO must be disabled to change its mode, so let any queued packets go first.
+    if (txActive)
+    {
+        if (__get_IPSR())
+            return DEVICE_BUSY;
+
+        while (txActive);
+    }
+
+    this->phy = phy;
+
+    NVIC_DisableIRQ(RADIO_IRQn);
+
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+    NRF_RADIO->MODE = MICROBIT_RADIO_PHY_MODE[phy];
+    NRF_RADIO->PCNF0 = MICROBIT_RADIO_PHY_PCNF0[phy];
+
+    // Start listening for the next packet
+    NRF_RADIO->EVENTS_READY = 0;
+    NRF_RADIO->TASKS_RXEN = 1;
+    while(NRF_RADIO->EVENTS_READY == 0);
+
+    NRF_RADIO->EVENTS_END = 0;
+    NRF_RADIO->TASKS_START = 1;
+
+    NVIC_ClearPendingIRQ(RADIO_IRQn);
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the physical layer used to send and receive packets.
+  *
+  * @return The MICROBIT_RADIO_PHY_* value last set by setPHY(), or MICROBIT_RADIO_PHY_1MBIT by default.
+  */
+int MicroBitRadio::getPHY()
+{
+    return phy;
+}
+
+/**
+  * Sets the maximum size of the frames sent and received by the radio.
+  *
+  * Frames no larger than MICROBIT_RADIO_LEGACY_PACKET_SIZE can be exchanged with all micro:bits.
+  * Larger frames carry far more data per transmission, but are only received by peers using the same frame size,
+  * and are marked as MICROBIT_RADIO_FRAME_VERSION_LARGE.
+  *
+  * @param size The maximum frame size, in the range MICROBIT_RADIO_LEGACY_PACKET_SIZE..MICROBIT_RADIO_MAX_PACKET_SIZE.
+  *
+  * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the size is out of range,
+  *         or MICROBIT_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
+  */
+int MicroBitRadio::setFrameSize(int size)
+{
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (size < MICROBIT_RADIO_LEGACY_PACKET_SIZE || size > MICROBIT_RADIO_MAX_PACKET_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->frameSize = size;
+
+    // The RADIO module discards any frame longer than MAXLEN, and will truncate any we try to send.
+    if (!ble_running())
+        NRF_RADIO->PCNF1 = (NRF_RADIO->PCNF1 & ~RADIO_PCNF1_MAXLEN_Msk) | (uint32_t)size;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Determines the maximum size of the frames sent and received by the radio.
+  *
+  * @return The frame size last set by setFrameSize(), or MICROBIT_RADIO_MAX_PACKET_SIZE by default.
+  */
+int MicroBitRadio::getFrameSize()
+{
+    return frameSize;
+}
+
+/**
+  * A background, low priority callback that is triggered when the processor is idle and a packet has been queued.
+  * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
+  */
+void MicroBitRadio::idleCallback()
+{
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_RADIO_IDLE);
+
+    // Go back to sleep until the next packet is queued. Anything queued while we dispatch wakes us again.
+    fiber_idle_component_done(this);
+
+    // While low latency dispatch is enabled, keep the interrupt from taking packets from the queue at the same time.
+    bool lowLatency = status & MICROBIT_RADIO_STATUS_LOW_LATENCY;
+
+    if (lowLatency)
+        NVIC_DisableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+
+    dispatch(false);
+
+    // Acknowledge everything received in this batch at once, rather than transmitting over the frames that follow.
+    link.sendAcks();
+
+    if (lowLatency)
+        NVIC_EnableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+}
+
+/**
+  * Passes queued packets to their protocol handlers.
+  *
+  * @param interrupt true if called from the dispatch interrupt, in which case only datagrams and events are handled,
+  *        stopping at the first packet of another protocol, which is left for idleCallback().
+  *
+  * @note should only be called from idleCallback() or the dispatch interrupt...
+  */
+void MicroBitRadio::dispatch(bool interrupt)
+{
+    // Walk the list of packets and process each one.
+    while(rxHead != rxTail)
+    {
+        uint8_t head = rxHead;
+        FrameBuffer *p = rxQueue[head];
+
+        // Other protocols transmit or allocate memory as they handle packets, so are only handled from the idle callback.
+        if (interrupt && p->protocol != MICROBIT_RADIO_PROTOCOL_DATAGRAM && p->protocol != MICROBIT_RADIO_PROTOCOL_EVENTBUS &&
+            p->protocol != MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED)
+            return;
+
+        switch (p->protocol)
+        {
+            case MICROBIT_RADIO_PROTOCOL_DATAGRAM:
+                datagram.packetReceived();
+                break;
+
+            case MICROBIT_RADIO_PROTOCOL_EVENTBUS:
+            case MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED:
+                event.packetReceived();
+                break;
+
+            case MICROBIT_RADIO_PROTOCOL_BULK:
+                bulk.packetReceived();
+                break;
+
+            case MICROBIT_RADIO_PROTOCOL_LINK:
+                link.packetReceived();
+                break;
+
+            case MICROBIT_RADIO_PROTOCOL_TDMA:
+                tdma.packetReceived();
+                break;
+
+            default:
+                Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
+        }
+
+        // If the packet was processed, it will have been recv'd, and taken from the queue.
+        // If this was a packet for an unknown protocol, it will still be there, so simply free it.
+        if (rxHead == head)
+        {
+            recv();
+            delete p;
+        }
+    }
+}
+
+/**
+  * Enables or disables low latency dispatch. When enabled, datagrams and events are passed to their protocol handlers
+  * from a low priority interrupt as soon as they are received, rather than waiting for the scheduler to go idle.
+  * MICROBIT_RADIO_EVT_DATAGRAM and forwarded events are then raised within microseconds, however busy the fibers are.
+  * Other protocols, and any packets queued behind them, are still handled by idleCallback().
+  *
+  * @param enable true to dispatch from the interrupt, false to dispatch only when the processor is idle.
+  *
+  * @return DEVICE_OK on success.
+  *
+  * @note Listeners registered with MESSAGE_BUS_LISTENER_IMMEDIATE run in interrupt context while this is enabled.
+  */
+int MicroBitRadio::setLowLatency(bool enable)
+{
+    if (enable)
+    {
+        NVIC_SetPriority(MICROBIT_RADIO_DISPATCH_IRQn, CONFIG_MICROBIT_RADIO_DISPATCH_PRIORITY);
+        NVIC_ClearPendingIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+        NVIC_EnableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+        component_status_set(this, MICROBIT_RADIO_STATUS_LOW_LATENCY);
+
+        // Pick up anything already waiting.
+        NVIC_SetPendingIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+    }
+    else
+    {
+        component_status_clear(this, MICROBIT_RADIO_STATUS_LOW_LATENCY);
+
+        // Timeslots also use the interrupt to report completed transmissions.
+        if (!(status & MICROBIT_RADIO_STATUS_TIMESLOT))
+            NVIC_DisableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Bottom half of the RADIO and timeslot interrupts. Raises MICROBIT_RADIO_EVT_TX_COMPLETE for packets sent
+  * within timeslots, and dispatches received packets if low latency dispatch is enabled.
+  *
+  * @note should only be called from the dispatch interrupt...
+  */
+void MicroBitRadio::deferredCallback()
+{
+    while (txReported != txCompleted)
+    {
+        txReported++;
+        Event(id, MICROBIT_RADIO_EVT_TX_COMPLETE);
+    }
+
+    if (status & MICROBIT_RADIO_STATUS_LOW_LATENCY)
+        dispatch(true);
+}
+
+#if MICROBIT_RADIO_TIMESLOT_SUPPORTED
+
+// Airtime of each byte of a frame on each of the MICROBIT_RADIO_PHY_* physical layers, and of the ramp up, preamble and
+// address that precede it (in microseconds). Used to decide whether a packet will fit in what remains of a timeslot.
+static const uint8_t MICROBIT_RADIO_PHY_BYTE_US[] = {8, 4, 16, 64};
+static const uint16_t MICROBIT_RADIO_PHY_OVERHEAD_US[] = {200, 200, 600, 900};
+
+static nrf_radio_request_t timeslotRequest;
+static nrf_radio_signal_callback_return_param_t timeslotReturn;
+
+/**
+  * Called by the SoftDevice, at the highest interrupt priority, for each signal while we hold a timeslot.
+  */
+static nrf_radio_signal_callback_return_param_t *timeslotCallback(uint8_t signal)
+{
+    timeslotReturn.callback_action = (uint8_t) MicroBitRadio::instance->timeslotSignal(signal);
+
+    if (timeslotReturn.callback_action == NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END)
+        timeslotReturn.params.request.p_next = &timeslotRequest;
+
+    if (timeslotReturn.callback_action == NRF_RADIO_SIGNAL_CALLBACK_ACTION_EXTEND)
+        timeslotReturn.params.extend.length_us = CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+
+    return &timeslotReturn;
+}
+
+/*
+ * SoC events are delivered here via nrf_sdh and nrf_sdh_soc, including those reporting on our timeslot requests.
+ */
+static void timeslot_event_handler(uint32_t sys_evt, void *)
+{
+    if (MicroBitRadio::instance)
+        MicroBitRadio::instance->timeslotEvent(sys_evt);
+}
+
+NRF_SDH_SOC_OBSERVER( microbit_radio_soc_observer, 0, timeslot_event_handler, NULL);
+
+/**
+  * Opens a SoftDevice timeslot session and requests the first timeslot.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the session could not be opened.
+  */
+int MicroBitRadio::timeslotOpen()
+{
+    // Ask for each timeslot as soon as the BLE stack can spare it.
+    timeslotRequest.request_type = NRF_RADIO_REQ_TYPE_EARLIEST;
+    timeslotRequest.params.earliest.hfclk = NRF_RADIO_HFCLK_CFG_XTAL_GUARANTEED;
+    timeslotRequest.params.earliest.priority = NRF_RADIO_PRIORITY_NORMAL;
+    timeslotRequest.params.earliest.length_us = CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+    timeslotRequest.params.earliest.timeout_us = CONFIG_MICROBIT_RADIO_TIMESLOT_TIMEOUT_US;
+
+    // Completed transmissions are reported through the dispatch interrupt.
+    NVIC_SetPriority(MICROBIT_RADIO_DISPATCH_IRQn, CONFIG_MICROBIT_RADIO_DISPATCH_PRIORITY);
+    NVIC_ClearPendingIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+    NVIC_EnableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+
+    if (sd_radio_session_open(timeslotCallback) != NRF_SUCCESS)
+        return DEVICE_NOT_SUPPORTED;
+
+    component_status_set(this, MICROBIT_RADIO_STATUS_TIMESLOT);
+
+    if (sd_radio_request(&timeslotRequest) != NRF_SUCCESS)
+    {
+        timeslotClose();
+        return DEVICE_NOT_SUPPORTED;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Closes our SoftDevice timeslot session, handing the RADIO back to the BLE stack.
+  */
+void MicroBitRadio::timeslotClose()
+{
+    // Any timeslot in progress ends at its next signal.
+    component_status_clear(this, MICROBIT_RADIO_STATUS_TIMESLOT);
+    sd_radio_session_close();
+
+    if (!(status & MICROBIT_RADIO_STATUS_LOW_LATENCY))
+        NVIC_DisableIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+}
+
+/**
+  * Handles a signal from the SoftDevice while we hold (or have asked for) a timeslot.
+  *
+  * Each timeslot starts by configuring the RADIO and sending whatever is in the transmit queue,
+  * then listens for the remainder of the slot. Shortly before the slot ends, we ask to extend it by another
+  * CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US, so reception continues unbroken while the BLE stack can spare the RADIO.
+  * Once it can't, the RADIO is handed back and the next slot requested.
+  *
+  * @param signal The NRF_RADIO_CALLBACK_SIGNAL_TYPE_* received.
+  *
+  * @return The NRF_RADIO_SIGNAL_CALLBACK_ACTION_* to take.
+  *
+  * @note should only be called from the timeslot signal callback...
+  */
+int MicroBitRadio::timeslotSignal(uint8_t signal)
+{
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+    {
+        if (signal == NRF_RADIO_CALLBACK_SIGNAL_TYPE_START)
+        {
+            // TIMER0 runs from zero at the start of the slot. Have it tell us when it's time to hand the RADIO back.
+            NRF_TIMER0->CC[0] = CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US - CONFIG_MICROBIT_RADIO_TIMESLOT_MARGIN_US;
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+
+            configure();
+            NVIC_EnableIRQ(RADIO_IRQn);
+
+            timeslotTransmit();
+            timeslotListen();
+
+            return NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+        }
+
+        if (signal == NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO && NRF_RADIO->EVENTS_END)
+        {
+            NRF_RADIO->EVENTS_END = 0;
+
+            if(NRF_RADIO->CRCSTATUS == 1)
+            {
+                setRSSI(-(int)NRF_RADIO->RSSISAMPLE);
+                queueRxBuf();
+                NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
+            }
+            else
+            {
+                setRSSI(0);
+                crcError();
+            }
+
+            // Send anything queued since the start of the slot, while we have the chance.
+            if (txHead != txTail && txGate)
+            {
+                timeslotTransmit();
+                timeslotListen();
+            }
+            else
+            {
+                NRF_RADIO->TASKS_START = 1;
+            }
+
+            return NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+        }
+
+        if (signal == NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO)
+            return NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+        // The end of the slot is near. Ask to keep the RADIO, leaving the receiver running.
+        // The SoftDevice answers at once, with EXTEND_SUCCEEDED or EXTEND_FAILED.
+        if (signal == NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0)
+        {
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            return NRF_RADIO_SIGNAL_CALLBACK_ACTION_EXTEND;
+        }
+
+        // TIMER0 keeps counting from the start of the slot, so move the deadline on by the length of the extension.
+        if (signal == NRF_RADIO_CALLBACK_SIGNAL_TYPE_EXTEND_SUCCEEDED)
+        {
+            NRF_TIMER0->CC[0] += CONFIG_MICROBIT_RADIO_TIMESLOT_LENGTH_US;
+
+            // Anything left for lack of time can now be sent.
+            if (txHead != txTail && txGate)
+            {
+                timeslotTransmit();
+                timeslotListen();
+            }
+
+            return NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+        }
+    }
+
+    // The slot is over, as it couldn't be extended (or we're closing the session). Leave the RADIO and TIMER0 as we found them.
+    NRF_TIMER0->INTENCLR = TIMER_INTENCLR_COMPARE0_Msk;
+    NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+
+    NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+    NRF_RADIO->SHORTS = 0;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+    if (!(status & MICROBIT_RADIO_STATUS_TIMESLOT))
+        return NRF_RADIO_SIGNAL_CALLBACK_ACTION_END;
+
+    return NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+}
+
+/**
+  * Handles a SoC event from the SoftDevice, requesting another timeslot if our session has gone idle.
+  *
+  * @param evt The NRF_EVT_* received.
+  */
+void MicroBitRadio::timeslotEvent(uint32_t evt)
+{
+    if (!(status & MICROBIT_RADIO_STATUS_TIMESLOT))
+        return;
+
+    // If the BLE stack couldn't spare a slot in time, or turned down our request, simply ask again.
+    if (evt == NRF_EVT_RADIO_BLOCKED || evt == NRF_EVT_RADIO_CANCELED || evt == NRF_EVT_RADIO_SESSION_IDLE || evt == NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN)
+        sd_radio_request(&timeslotRequest);
+}
+
+/**
+  * Transmits packets from the transmit queue for as long as the current timeslot allows.
+  * CCA is not applied here, as the slot is ours for its duration.
+  *
+  * @note should only be called from the timeslot signal callback...
+  */
+void MicroBitRadio::timeslotTransmit()
+{
+    // Turn off the receiver. Each packet is then sent with the hardware starting it once ready, and turning the transmitter off after it.
+    NRF_RADIO->INTENCLR = RADIO_INTENCLR_END_Msk;
+    NRF_RADIO->SHORTS = 0;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+    while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+    NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk;
+
+    while (txHead != txTail && txGate)
+    {
+        FrameBuffer *buffer = &txQueue[txHead];
+        uint32_t airtime = MICROBIT_RADIO_PHY_OVERHEAD_US[phy] + (buffer->length + 3) * MICROBIT_RADIO_PHY_BYTE_US[phy];
+
+        // Leave anything that won't fit for the next slot.
+        NRF_TIMER0->TASKS_CAPTURE[1] = 1;
+        uint32_t started = NRF_TIMER0->CC[1];
+
+        if (started + airtime > NRF_TIMER0->CC[0])
+            break;
+
+        NRF_RADIO->PACKETPTR = (uint32_t) buffer;
+        NRF_RADIO->EVENTS_DISABLED = 0;
+        NRF_RADIO->TASKS_TXEN = 1;
+        while(NRF_RADIO->EVENTS_DISABLED == 0);
+
+        NRF_TIMER0->TASKS_CAPTURE[1] = 1;
+
+        stats.txPackets++;
+        stats.txTime += NRF_TIMER0->CC[1] - started;
+
+        txHead = (txHead + 1) % (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+        txCompleted++;
+    }
+
+    NRF_RADIO->EVENTS_END = 0;
+
+    // Raise MICROBIT_RADIO_EVT_TX_COMPLETE once we've returned from the timeslot.
+    if (txCompleted != txReported)
+        NVIC_SetPendingIRQ(MICROBIT_RADIO_DISPATCH_IRQn);
+}
+
+/**
+  * Starts listening for the next packet for the rest of the current timeslot.
+  *
+  * @note should only be called from the timeslot signal callback...
+  */
+void MicroBitRadio::timeslotListen()
+{
+    NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
+    NRF_RADIO->SHORTS = MICROBIT_RADIO_SHORTS_RX;
+    NRF_RADIO->EVENTS_READY = 0;
+    NRF_RADIO->EVENTS_END = 0;
+    NRF_RADIO->INTENSET = RADIO_INTENSET_END_Msk;
+    NRF_RADIO->TASKS_RXEN = 1;
+}
+
+#else
+
+int MicroBitRadio::timeslotOpen()
+{
+    return DEVICE_NOT_SUPPORTED;
+}
+
+void MicroBitRadio::timeslotClose()
+{
+}
+
+int MicroBitRadio::timeslotSignal(uint8_t)
+{
+    return 0;
+}
+
+void MicroBitRadio::timeslotEvent(uint32_t)
+{
+}
+
+void MicroBitRadio::timeslotTransmit()
+{
+}
+
+void MicroBitRadio::timeslotListen()
+{
+}
+
+#endif
+
+/**
+  * Determines the number of packets ready to be processed.
   *
   * @return The number of packets in the receive buffer.
   */
 int MicroBitRadio::dataReady()
 {
-    return queueDepth;
+    return (rxTail + rxQueueSize + 1 - rxHead) % (rxQueueSize + 1);
 }
 
 /**
@@ -454,19 +1545,16 @@ int MicroBitRadio::dataReady()
   */
 FrameBuffer* MicroBitRadio::recv()
 {
-    FrameBuffer *p = rxQueue;
-
-    if (p)
-    {
-         // Protect shared resource from ISR activity
-        NVIC_DisableIRQ(RADIO_IRQn);
+    uint8_t head = rxHead;
 
-        rxQueue = rxQueue->next;
-        queueDepth--;
+    if (head == rxTail)
+        return NULL;
 
-        // Allow ISR access to shared resource
-        NVIC_EnableIRQ(RADIO_IRQn);
-    }
+    // Only the RADIO IRQ moves the tail, and only we move the head, so no locking is needed.
+    // The packet must be read before the IRQ can see its slot is free.
+    FrameBuffer *p = rxQueue[head];
+    __DMB();
+    rxHead = (head + 1) % (rxQueueSize + 1);
 
     return p;
 }
@@ -475,24 +1563,72 @@ FrameBuffer* MicroBitRadio::recv()
   * Transmits the given buffer onto the broadcast radio.
   * The call will wait until the transmission of the packet has completed before returning.
   *
+  * While transmissions are gated or subject to clear channel assessment, the packet is sent through the
+  * transmit queue, and the call waits for the queue to drain.
+  *
   * @param data The packet contents to transmit.
   *
-  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT.
   */
 int MicroBitRadio::send(FrameBuffer *buffer)
 {
-    if (ble_running())
+    if (ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED)
         return DEVICE_NOT_SUPPORTED;
 
     if (buffer == NULL)
         return DEVICE_INVALID_PARAMETER;
 
-    if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+    if (buffer->length > frameSize + MICROBIT_RADIO_HEADER_SIZE - 1)
         return DEVICE_INVALID_PARAMETER;
 
+    // While transmissions are gated, subject to clear channel assessment or confined to timeslots,
+    // join the transmit queue and wait for it to drain.
+    if (!txGate || ccaThreshold || (status & MICROBIT_RADIO_STATUS_TIMESLOT))
+    {
+        int result;
+
+        while ((result = sendAsync(buffer)) == DEVICE_BUSY && !__get_IPSR())
+            txWait();
+
+        if (result != DEVICE_OK || __get_IPSR())
+            return result;
+
+        while (txPending())
+            txWait();
+
+        return DEVICE_OK;
+    }
+
+    // Let any packets queued by sendAsync() go first. We can't wait for the RADIO interrupt to send them
+    // from inside another interrupt, so in that case this packet simply joins the queue.
+    if (txActive)
+    {
+        if (__get_IPSR())
+            return sendAsync(buffer);
+
+        while (txActive);
+    }
+
+    return transmit(buffer);
+}
+
+/**
+  * Transmits the given buffer immediately, bypassing the transmit queue, gate and clear channel assessment.
+  * The call will wait until the transmission of the packet has completed before returning.
+  */
+int MicroBitRadio::transmit(FrameBuffer *buffer)
+{
+    // Within timeslots, packets can only be sent by the timeslot callback.
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+        return sendAsync(buffer);
+
     // Firstly, disable the Radio interrupt. We want to wait until the trasmission completes.
     NVIC_DisableIRQ(RADIO_IRQn);
 
+    // The transmit queue leaves READY→START enabled for the receiver. Start each step by hand here instead.
+    uint32_t shorts = NRF_RADIO->SHORTS;
+    NRF_RADIO->SHORTS = shorts & RADIO_SHORTS_ADDRESS_RSSISTART_Msk;
+
     // Turn off the transceiver.
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->TASKS_DISABLE = 1;
@@ -502,6 +1638,7 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     NRF_RADIO->PACKETPTR = (uint32_t) buffer;
 
     // Turn on the transmitter, and wait for it to signal that it's ready to use.
+    uint32_t started = (uint32_t) system_timer_current_time_us();
     NRF_RADIO->EVENTS_READY = 0;
     NRF_RADIO->TASKS_TXEN = 1;
     while (NRF_RADIO->EVENTS_READY == 0);
@@ -519,6 +1656,9 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     NRF_RADIO->TASKS_DISABLE = 1;
     while(NRF_RADIO->EVENTS_DISABLED == 0);
 
+    stats.txPackets++;
+    stats.txTime += (uint32_t) system_timer_current_time_us() - started;
+
     // Start listening for the next packet
     NRF_RADIO->EVENTS_READY = 0;
     NRF_RADIO->TASKS_RXEN = 1;
@@ -527,6 +1667,8 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     NRF_RADIO->EVENTS_END = 0;
     NRF_RADIO->TASKS_START = 1;
 
+    NRF_RADIO->SHORTS = shorts;
+
     // Re-enable the Radio interrupt.
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_EnableIRQ(RADIO_IRQn);
@@ -534,6 +1676,251 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     return DEVICE_OK;
 }
 
+/**
+  * Queues the given buffer for transmission onto the broadcast radio, and returns immediately.
+  * The buffer is copied, so may be reused as soon as the call returns.
+  *
+  * Queued packets are sent back to back, with the RADIO interrupt and hardware shortcuts moving between
+  * transmit and receive, and the receiver is restarted as soon as the queue is empty.
+  * A MICROBIT_RADIO_EVT_TX_COMPLETE event is raised as each packet is transmitted.
+  *
+  * @param buffer The packet contents to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_BUSY if CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE packets are already queued,
+  *         DEVICE_INVALID_PARAMETER if the buffer is invalid, DEVICE_NO_RESOURCES if the queue could not be allocated,
+  *         or DEVICE_NOT_SUPPORTED if the BLE stack is running without CONFIG_MICROBIT_RADIO_TIMESLOT or the radio is not enabled.
+  */
+int MicroBitRadio::sendAsync(FrameBuffer *buffer)
+{
+    if ((ble_running() && !MICROBIT_RADIO_TIMESLOT_SUPPORTED) || !(status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return DEVICE_NOT_SUPPORTED;
+
+    if (buffer == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (buffer->length > frameSize + MICROBIT_RADIO_HEADER_SIZE - 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (txQueue == NULL)
+        txQueue = new FrameBuffer[CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1];
+
+    if (txQueue == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    // Packets may be queued from any context, so claim the entry at the tail with interrupts disabled.
+    target_disable_irq();
+
+    uint8_t tail = txTail;
+    uint8_t next = (tail + 1) % (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+
+    if (next == txHead)
+    {
+        target_enable_irq();
+        return DEVICE_BUSY;
+    }
+
+    memcpy(&txQueue[tail], buffer, sizeof(FrameBuffer));
+    __DMB();
+    txTail = next;
+
+    // Start transmitting, unless the RADIO interrupt is already working through the queue.
+    if (!txActive)
+        tryStartTx();
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+  * Holds back, or releases, packets queued by sendAsync(). While closed, packets wait in the transmit queue,
+  * and a burst already on air finishes with the packet being transmitted. Used by MicroBitRadioTDMA to confine
+  * transmissions to our slot.
+  *
+  * @param open false to hold packets back, true to release them.
+  */
+void MicroBitRadio::setTransmitGate(bool open)
+{
+    txGate = open;
+
+    if (open)
+    {
+        target_disable_irq();
+
+        if (!txActive)
+            tryStartTx();
+
+        target_enable_irq();
+    }
+}
+
+/**
+  * Enables clear channel assessment. Before each burst of queued packets, the signal strength on the channel is
+  * measured, and transmission is deferred for a short, random period while it is above the given threshold.
+  *
+  * @param threshold The signal strength (in dBm) above which the channel is considered busy, in the range -100..-30,
+  *        or 0 to disable clear channel assessment.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the threshold is out of range.
+  *
+  * @note The RADIO's own CCA is only available in IEEE 802.15.4 mode, so this measures RSSI while receiving instead.
+  */
+int MicroBitRadio::setClearChannelAssessment(int threshold)
+{
+    if (threshold != 0 && (threshold < -100 || threshold > -30))
+        return DEVICE_INVALID_PARAMETER;
+
+    if (threshold && !(status & MICROBIT_RADIO_STATUS_CCA_LISTENER) && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_RADIO_EVT_TX_BACKOFF, this, &MicroBitRadio::onBackoff, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        component_status_set(this, MICROBIT_RADIO_STATUS_CCA_LISTENER);
+    }
+
+    ccaThreshold = threshold;
+
+    return DEVICE_OK;
+}
+
+/**
+  * Measures the signal strength currently on the channel.
+  *
+  * @return The signal strength in dBm, or DEVICE_INVALID_STATE if the radio is not receiving, or is sharing the RADIO with the BLE stack.
+  */
+int MicroBitRadio::getChannelRSSI()
+{
+    if (!(status & MICROBIT_RADIO_STATUS_INITIALISED) || txActive || (status & MICROBIT_RADIO_STATUS_TIMESLOT))
+        return DEVICE_INVALID_STATE;
+
+    NRF_RADIO->EVENTS_RSSIEND = 0;
+    NRF_RADIO->TASKS_RSSISTART = 1;
+    while (NRF_RADIO->EVENTS_RSSIEND == 0);
+
+    return -(int)NRF_RADIO->RSSISAMPLE;
+}
+
+/**
+  * Starts transmitting the packets in the transmit queue, if the gate is open and the channel is clear.
+  * Called with interrupts disabled.
+  */
+void MicroBitRadio::tryStartTx()
+{
+    // Within timeslots, the queue is sent at the start of each slot instead.
+    if (status & MICROBIT_RADIO_STATUS_TIMESLOT)
+        return;
+
+    if (!txGate || txBackoff || txHead == txTail)
+        return;
+
+    if (ccaThreshold && getChannelRSSI() > ccaThreshold)
+    {
+        txBackoff = true;
+        system_timer_event_after_us(CONFIG_MICROBIT_RADIO_CCA_BACKOFF_US + microbit_random(CONFIG_MICROBIT_RADIO_CCA_BACKOFF_US), id, MICROBIT_RADIO_EVT_TX_BACKOFF);
+        return;
+    }
+
+    startTx();
+}
+
+/**
+  * Retries transmission once the clear channel assessment backoff period has passed.
+  */
+void MicroBitRadio::onBackoff(Event)
+{
+    target_disable_irq();
+
+    txBackoff = false;
+
+    if (!txActive)
+        tryStartTx();
+
+    target_enable_irq();
+}
+
+/**
+  * Determines the number of packets queued by sendAsync() that are yet to be transmitted.
+  *
+  * @return The number of packets awaiting transmission, including any being transmitted.
+  */
+int MicroBitRadio::txPending()
+{
+    return (txTail + CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1 - txHead) % (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+}
+
+/**
+  * Determines if the RADIO is being driven through the transmit queue, rather than receiving.
+  *
+  * @return true if packets queued by sendAsync() are being transmitted.
+  */
+bool MicroBitRadio::isTransmitting()
+{
+    return txActive;
+}
+
+/**
+  * Switches the RADIO from receiving to transmitting the packet at the head of the transmit queue.
+  * Called with the RADIO interrupt disabled, or from the RADIO IRQ.
+  */
+void MicroBitRadio::startTx()
+{
+    txActive = true;
+    txSending = false;
+
+    // Turn off the receiver, and have the hardware turn on the transmitter as soon as it is off.
+    // txDisabled() points the RADIO at the packet while the transmitter ramps up.
+    NRF_RADIO->SHORTS = MICROBIT_RADIO_SHORTS_TX | RADIO_SHORTS_DISABLED_TXEN_Msk;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+    NRF_RADIO->TASKS_DISABLE = 1;
+}
+
+/**
+  * Moves the RADIO on to the next packet in the transmit queue, or back to receiving when the queue is empty.
+  *
+  * @note should only be called from RADIO_IRQHandler, on the DISABLED event...
+  */
+void MicroBitRadio::txDisabled()
+{
+    if (txSending)
+    {
+        txSending = false;
+        txHead = (txHead + 1) % (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1);
+
+        stats.txPackets++;
+        stats.txTime += (uint32_t) system_timer_current_time_us() - txStarted;
+
+        Event(id, MICROBIT_RADIO_EVT_TX_COMPLETE);
+    }
+
+    if (NRF_RADIO->SHORTS & RADIO_SHORTS_DISABLED_TXEN_Msk)
+    {
+        // The transmitter is ramping up, and READY→START will send this packet once it is ready.
+        NRF_RADIO->PACKETPTR = (uint32_t) &txQueue[txHead];
+        txSending = true;
+        txStarted = (uint32_t) system_timer_current_time_us();
+
+        // Have the hardware go back to receiving after this packet, unless there is another behind it that we may send.
+        if ((txHead + 1) % (CONFIG_MICROBIT_RADIO_TX_QUEUE_SIZE + 1) == txTail || !txGate)
+            NRF_RADIO->SHORTS = MICROBIT_RADIO_SHORTS_TX | RADIO_SHORTS_DISABLED_RXEN_Msk;
+
+        return;
+    }
+
+    // The receiver is ramping up, and READY→START will start listening once it is ready.
+    NRF_RADIO->PACKETPTR = (uint32_t) rxBuf;
+
+    // Go round again if more packets were queued while the last was on air.
+    // The channel is already ours, so there's no need to assess it again.
+    if (txHead != txTail && txGate)
+    {
+        startTx();
+        return;
+    }
+
+    NRF_RADIO->SHORTS = MICROBIT_RADIO_SHORTS_RX;
+    NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk;
+    txActive = false;
+}
+
 /**
  * Puts the component in (or out of) sleep (low power) mode.
  */
@@ -546,28 +1933,109 @@ int MicroBitRadio::setSleep(bool doSleep)
     {
         if ( status & MICROBIT_RADIO_STATUS_INITIALISED)
         {
+            component_status_set(this, MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT | MICROBIT_RADIO_STATUS_DEEPSLEEP_STATE);
             disable();
-            status |= MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT;
+            saveState();
         }
         else if ( NVIC_GetEnableIRQ(RADIO_IRQn))
         {
-            status |=  MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ;
+            component_status_set(this, MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ);
             NVIC_DisableIRQ(RADIO_IRQn);
         }
     }
     else
     {
-        if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT)
+        if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_STATE)
+        {
+            component_status_clear(this, MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT | MICROBIT_RADIO_STATUS_DEEPSLEEP_STATE);
+
+            // If our buffers were released while asleep, there's nothing to resume into, so start afresh.
+            if (rxBuf == NULL)
+                enable();
+            else
+                restoreState();
+        }
+        else if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT)
         {
-            status &= ~MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT;
+            component_status_clear(this, MICROBIT_RADIO_STATUS_DEEPSLEEP_INIT);
             enable();
         }
         else if ( status & MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ)
         {
-            status &= ~MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ;
+            component_status_clear(this, MICROBIT_RADIO_STATUS_DEEPSLEEP_IRQ);
             NVIC_EnableIRQ(RADIO_IRQn);
         }
     }
    
     return DEVICE_OK;
 }
+
+/**
+  * Records the configuration of the RADIO module, once it has been disabled for deep sleep.
+  */
+void MicroBitRadio::saveState()
+{
+    sleepState.frequency = NRF_RADIO->FREQUENCY;
+    sleepState.txpower = NRF_RADIO->TXPOWER;
+    sleepState.mode = NRF_RADIO->MODE;
+    sleepState.base0 = NRF_RADIO->BASE0;
+    sleepState.base1 = NRF_RADIO->BASE1;
+    sleepState.prefix0 = NRF_RADIO->PREFIX0;
+    sleepState.prefix1 = NRF_RADIO->PREFIX1;
+    sleepState.pcnf0 = NRF_RADIO->PCNF0;
+    sleepState.pcnf1 = NRF_RADIO->PCNF1;
+    sleepState.crccnf = NRF_RADIO->CRCCNF;
+    sleepState.crcinit = NRF_RADIO->CRCINIT;
+    sleepState.crcpoly = NRF_RADIO->CRCPOLY;
+    sleepState.datawhiteiv = NRF_RADIO->DATAWHITEIV;
+    sleepState.shorts = NRF_RADIO->SHORTS;
+}
+
+/**
+  * Reinstates the configuration recorded by saveState() and resumes reception, 
+  * without recalculating it as enable() would.
+  */
+void MicroBitRadio::restoreState()
+{
+    if (ble_running() || rxBuf == NULL)
+        return;
+
+    // Start the High Frequency clock, and reinstate our configuration while it stabilises.
+    NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+    NRF_CLOCK->TASKS_HFCLKSTART = 1;
+
+    NRF_RADIO->FREQUENCY = sleepState.frequency;
+    NRF_RADIO->TXPOWER = sleepState.txpower;
+    NRF_RADIO->MODE = sleepState.mode;
+    NRF_RADIO->BASE0 = sleepState.base0;
+    NRF_RADIO->BASE1 = sleepState.base1;
+    NRF_RADIO->PREFIX0 = sleepState.prefix0;
+    NRF_RADIO->PREFIX1 = sleepState.prefix1;
+    NRF_RADIO->TXADDRESS = 0;
+    NRF_RADIO->RXADDRESSES = groupMask;
+    NRF_RADIO->PCNF0 = sleepState.pcnf0;
+    NRF_RADIO->PCNF1 = sleepState.pcnf1;
+    NRF_RADIO->CRCCNF = sleepState.crccnf;
+    NRF_RADIO->CRCINIT = sleepState.crcinit;
+    NRF_RADIO->CRCPOLY = sleepState.crcpoly;
+    NRF_RADIO->DATAWHITEIV = sleepState.datawhiteiv;
+    NRF_RADIO->PACKETPTR = (uint32_t)rxBuf;
+    NRF_RADIO->SHORTS = sleepState.shorts;
+
+    NRF_RADIO->INTENSET = 0x00000008;
+    NVIC_ClearPendingIRQ(RADIO_IRQn);
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+
+    // Start listening for the next packet
+    NRF_RADIO->EVENTS_READY = 0;
+    NRF_RADIO->TASKS_RXEN = 1;
+    while(NRF_RADIO->EVENTS_READY == 0);
+
+    NRF_RADIO->EVENTS_END = 0;
+    NRF_RADIO->TASKS_START = 1;
+
+    component_status_set(this, DEVICE_COMPONENT_STATUS_IDLE_TICK | MICROBIT_RADIO_STATUS_INITIALISED);
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_RADIO, true);
+}
@@ -0,0 +1,269 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadio.h"
+#include "CodalFiber.h"
+#include "Timer.h"
+
+using namespace codal;
+
+/**
+  * Provides a bulk transport for messages of up to CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE bytes, built upon MicroBitRadio.
+  *
+  * Each message is split into sequence numbered fragments that fill the radio's frame size, which are queued back to back
+  * using MicroBitRadio::sendAsync(). Receivers reassemble fragments in any order, and raise MICROBIT_RADIO_EVT_BULK once
+  * a message is complete. Like datagrams, delivery is best effort: a message missing any fragment is abandoned
+  * CONFIG_MICROBIT_RADIO_BULK_TIMEOUT milliseconds after its last fragment arrived.
+  */
+
+/**
+  * Constructor.
+  *
+  * Creates an instance of a MicroBitRadioBulk which offers the ability to broadcast
+  * messages of a few kilobytes to other micro:bits in the vicinity.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitRadioBulk::MicroBitRadioBulk(MicroBitRadio &r) : radio(r)
+{
+    this->txId = 0;
+    this->rxId = 0;
+    this->rxDone = -1;
+    this->rxLast = 0;
+    this->rxRemaining = 0;
+    this->rxTime = 0;
+    this->rxHead = 0;
+    this->rxCount = 0;
+    this->dropped = 0;
+}
+
+/**
+  * Abandons any partly reassembled message once CONFIG_MICROBIT_RADIO_BULK_TIMEOUT has passed since its last fragment,
+  * and forgets the last message completed.
+  */
+void MicroBitRadioBulk::checkTimeout()
+{
+    if (system_timer_current_time() - rxTime <= CONFIG_MICROBIT_RADIO_BULK_TIMEOUT)
+        return;
+
+    if (rxBuffer.length())
+    {
+        rxBuffer = ManagedBuffer();
+        dropped++;
+    }
+
+    rxDone = -1;
+}
+
+/**
+  * Retrieves the next reassembled message.
+  *
+  * @return the message received, or an empty ManagedBuffer if no message is available.
+  */
+ManagedBuffer MicroBitRadioBulk::recv()
+{
+    // Release any stale reassembly buffer, as a sender that has gone away will never trigger packetReceived() again.
+    checkTimeout();
+
+    if (rxCount == 0)
+        return ManagedBuffer();
+
+    ManagedBuffer message = rxQueue[rxHead];
+    rxQueue[rxHead] = ManagedBuffer();
+
+    rxHead = (rxHead + 1) % CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE;
+    rxCount--;
+
+    return message;
+}
+
+/**
+  * Transmits the given buffer onto the broadcast radio, as a sequence of fragments.
+  *
+  * Fragments are queued using MicroBitRadio::sendAsync(), with the calling fiber yielding while the transmit queue is full.
+  * The call returns once the last fragment is queued. This must be called from a fiber, not an interrupt.
+  *
+  * @param buffer The message contents to transmit.
+  *
+  * @param len The number of bytes to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is invalid, the number of bytes to transmit is
+  *         greater than CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE or needs more than MICROBIT_RADIO_BULK_MAX_FRAGMENTS fragments,
+  *         or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioBulk::send(uint8_t *buffer, int len)
+{
+    if (buffer == NULL || len <= 0 || len > CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    // The RADIO truncates frames to the frame size, including the version, group and protocol bytes.
+    int chunk = radio.getFrameSize() - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_BULK_HEADER_SIZE;
+    int count = (len + chunk - 1) / chunk;
+
+    // The index of the last fragment is sent in a single byte.
+    if (count > MICROBIT_RADIO_BULK_MAX_FRAGMENTS)
+        return DEVICE_INVALID_PARAMETER;
+
+    FrameBuffer buf;
+    uint8_t id = txId++;
+
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_BULK;
+    buf.payload[0] = id;
+    buf.payload[2] = count - 1;
+    buf.payload[3] = len & 0xFF;
+    buf.payload[4] = len >> 8;
+
+    for (int i = 0; i < count; i++)
+    {
+        int offset = i * chunk;
+        int l = min(chunk, len - offset);
+
+        buf.length = l + MICROBIT_RADIO_BULK_HEADER_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+        buf.version = buf.length > MICROBIT_RADIO_LEGACY_PACKET_SIZE ? MICROBIT_RADIO_FRAME_VERSION_LARGE : MICROBIT_RADIO_FRAME_VERSION;
+        buf.payload[1] = i;
+        memcpy(buf.payload + MICROBIT_RADIO_BULK_HEADER_SIZE, buffer + offset, l);
+
+        int result;
+        while ((result = radio.sendAsync(&buf)) == DEVICE_BUSY)
+            schedule();
+
+        if (result != DEVICE_OK)
+            return result;
+
+        // Give receivers a chance to empty their receive queue.
+        if (CONFIG_MICROBIT_RADIO_BULK_BURST_GAP && (i + 1) % MICROBIT_RADIO_MAXIMUM_RX_BUFFERS == 0 && i + 1 < count)
+            fiber_sleep(CONFIG_MICROBIT_RADIO_BULK_BURST_GAP);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Transmits the given buffer onto the broadcast radio, as a sequence of fragments.
+  *
+  * Fragments are queued using MicroBitRadio::sendAsync(), with the calling fiber yielding while the transmit queue is full.
+  * The call returns once the last fragment is queued. This must be called from a fiber, not an interrupt.
+  *
+  * @param data The message contents to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the buffer is empty or its length is
+  *         greater than CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE, or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioBulk::send(ManagedBuffer data)
+{
+    return send(data.getBytes(), data.length());
+}
+
+/**
+  * Determines the number of messages abandoned with fragments missing, or dropped because the receive queue was full.
+  *
+  * @return The number of messages lost since startup.
+  */
+uint32_t MicroBitRadioBulk::getDropped()
+{
+    return dropped;
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet marked as a bulk fragment.
+  *
+  * This function places the fragment in the message being reassembled, and queues the message for user
+  * reception once it is complete.
+  */
+void MicroBitRadioBulk::packetReceived()
+{
+    FrameBuffer *packet = radio.recv();
+
+    int len = packet->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_BULK_HEADER_SIZE;
+    uint8_t id = packet->payload[0];
+    uint8_t index = packet->payload[1];
+    uint8_t last = packet->payload[2];
+    int total = packet->payload[3] | (packet->payload[4] << 8);
+
+    if (len <= 0 || index > last || total < len || total > CONFIG_MICROBIT_RADIO_BULK_MAX_SIZE)
+    {
+        delete packet;
+        return;
+    }
+
+    checkTimeout();
+
+    // Ignore repeats of the message we've just completed.
+    if (rxBuffer.length() == 0 && id == rxDone)
+    {
+        delete packet;
+        return;
+    }
+
+    // A fragment of a different message means the one we were reassembling will never complete.
+    if (rxBuffer.length() && (id != rxId || last != rxLast || total != rxBuffer.length()))
+    {
+        rxBuffer = ManagedBuffer();
+        dropped++;
+    }
+
+    if (rxBuffer.length() == 0)
+    {
+        rxBuffer = ManagedBuffer(total);
+        rxId = id;
+        rxLast = last;
+        rxRemaining = last + 1;
+        memset(rxFragments, 0, sizeof(rxFragments));
+    }
+
+    // All but the last fragment are full, so the fragment's length gives its position.
+    int offset = index == last ? total - len : index * len;
+    uint32_t bit = 1UL << (index % 32);
+
+    if (offset >= 0 && offset + len <= total && !(rxFragments[index / 32] & bit))
+    {
+        memcpy(rxBuffer.getBytes() + offset, packet->payload + MICROBIT_RADIO_BULK_HEADER_SIZE, len);
+        rxFragments[index / 32] |= bit;
+        rxRemaining--;
+    }
+
+    rxTime = system_timer_current_time();
+    delete packet;
+
+    if (rxRemaining)
+        return;
+
+    // The message is complete. Queue it for the user, if there's room.
+    rxDone = rxId;
+
+    if (rxCount < CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE)
+    {
+        rxQueue[(rxHead + rxCount) % CONFIG_MICROBIT_RADIO_BULK_RX_QUEUE_SIZE] = rxBuffer;
+        rxCount++;
+
+        Event(DEVICE_ID_RADIO, MICROBIT_RADIO_EVT_BULK);
+    }
+    else
+    {
+        dropped++;
+    }
+
+    rxBuffer = ManagedBuffer();
+}
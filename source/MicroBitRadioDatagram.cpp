@@ -69,9 +69,11 @@ int MicroBitRadioDatagram::recv(uint8_t *buf, int len)
     if (buf == NULL || rxQueue == NULL || len < 0)
         return DEVICE_INVALID_PARAMETER;
 
-    // Take the first buffer from the queue.
+    // Take the first buffer from the queue. The dispatch interrupt may be adding to it, c.f. MicroBitRadio::setLowLatency().
+    target_disable_irq();
     FrameBuffer *p = rxQueue;
     rxQueue = rxQueue->next;
+    target_enable_irq();
 
     int l = min(len, p->length - (MICROBIT_RADIO_HEADER_SIZE - 1));
 
@@ -95,8 +97,10 @@ PacketBuffer MicroBitRadioDatagram::recv()
     if (rxQueue == NULL)
         return PacketBuffer::EmptyPacket;
 
+    target_disable_irq();
     FrameBuffer *p = rxQueue;
     rxQueue = rxQueue->next;
+    target_enable_irq();
 
     PacketBuffer packet(p->payload, p->length - (MICROBIT_RADIO_HEADER_SIZE - 1), p->rssi);
 
@@ -115,17 +119,17 @@ PacketBuffer MicroBitRadioDatagram::recv()
   * @param len The number of bytes to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
   */
 int MicroBitRadioDatagram::send(uint8_t *buffer, int len)
 {
-    if (buffer == NULL || len < 0 || len > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
+    if (buffer == NULL || len < 0 || len > radio.getFrameSize() + MICROBIT_RADIO_HEADER_SIZE - 1)
         return DEVICE_INVALID_PARAMETER;
 
     FrameBuffer buf;
 
     buf.length = len + MICROBIT_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
+    buf.version = buf.length > MICROBIT_RADIO_LEGACY_PACKET_SIZE ? MICROBIT_RADIO_FRAME_VERSION_LARGE : MICROBIT_RADIO_FRAME_VERSION;
     buf.group = 0;
     buf.protocol = MICROBIT_RADIO_PROTOCOL_DATAGRAM;
     memcpy(buf.payload, buffer, len);
@@ -142,7 +146,7 @@ int MicroBitRadioDatagram::send(uint8_t *buffer, int len)
   * @param data The packet contents to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
   */
 int MicroBitRadioDatagram::send(PacketBuffer data)
 {
@@ -158,7 +162,7 @@ int MicroBitRadioDatagram::send(PacketBuffer data)
   * @param data The packet contents to transmit.
   *
   * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the buffer is invalid,
-  *         or the number of bytes to transmit is greater than `MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE`.
+  *         or the number of bytes to transmit is greater than `MicroBitRadio::getFrameSize() + MICROBIT_RADIO_HEADER_SIZE`.
   */
 int MicroBitRadioDatagram::send(ManagedString data)
 {
@@ -191,7 +195,7 @@ void MicroBitRadioDatagram::packetReceived()
             queueDepth++;
         }
 
-        if (queueDepth >= MICROBIT_RADIO_MAXIMUM_RX_BUFFERS)
+        if (queueDepth >= radio.getReceiveQueueSize())
         {
             delete packet;
             return;
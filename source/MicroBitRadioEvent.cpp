@@ -24,6 +24,9 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitRadio.h"
+#include "MicroBitDevice.h"
+#include "EventModel.h"
+#include "Timer.h"
 
 using namespace codal;
 
@@ -52,6 +55,9 @@ using namespace codal;
 MicroBitRadioEvent::MicroBitRadioEvent(MicroBitRadio &r) : radio(r)
 {
     this->suppressForwarding = false;
+    this->flushScheduled = false;
+    this->flushListener = false;
+    this->pendingCount = 0;
 }
 
 /**
@@ -96,6 +102,13 @@ int MicroBitRadioEvent::listen(uint16_t id, uint16_t value)
   */
 int MicroBitRadioEvent::listen(uint16_t id, uint16_t value, EventModel &eventBus)
 {
+    // Held back events are flushed by a system timer event, which is raised on the default EventModel.
+    if (CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US && !flushListener && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(radio.id, MICROBIT_RADIO_EVT_EVENT_FLUSH, this, &MicroBitRadioEvent::onFlush, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        flushListener = true;
+    }
+
     return eventBus.listen(id, value, this, &MicroBitRadioEvent::eventReceived, MESSAGE_BUS_LISTENER_IMMEDIATE);
 }
 
@@ -140,15 +153,31 @@ int MicroBitRadioEvent::ignore(uint16_t id, uint16_t value, EventModel &eventBus
 /**
   * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
   *
-  * This function process this packet, and fires the event contained inside onto the default EventModel.
+  * This function process this packet, and fires the event (or events, for a packed frame) contained inside onto the default EventModel.
   */
 void MicroBitRadioEvent::packetReceived()
 {
     FrameBuffer *p = radio.recv();
-    Event *e = (Event *) p->payload;
 
     suppressForwarding = true;
-    e->fire();
+
+    if (p->protocol == MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED)
+    {
+        int count = (p->length - (MICROBIT_RADIO_HEADER_SIZE - 1)) / (2 * sizeof(uint16_t));
+        uint16_t record[2];
+
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(record, &p->payload[i * sizeof(record)], sizeof(record));
+            Event(record[0], record[1]);
+        }
+    }
+    else
+    {
+        Event *e = (Event *) p->payload;
+        e->fire();
+    }
+
     suppressForwarding = false;
 
     delete p;
@@ -158,19 +187,146 @@ void MicroBitRadioEvent::packetReceived()
   * Event handler callback. This is called whenever an event is received matching one of those registered through
   * the registerEvent() method described above. Upon receiving such an event, it is wrapped into
   * a radio packet and transmitted to any other micro:bits in the same group.
+  *
+  * If CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US is set, events are held back for up to that long, so that a burst
+  * of them can share a frame. Events are queued for transmission rather than waiting for the radio.
   */
 void MicroBitRadioEvent::eventReceived(Event e)
 {
     if(suppressForwarding)
         return;
 
+    // Don't forward our own timer, should we be listening to every event.
+    if (e.source == radio.id && e.value == MICROBIT_RADIO_EVT_EVENT_FLUSH)
+        return;
+
+    int capacity = frameCapacity();
+    FrameBuffer full;
+    int taken = 0;
+
+    // Events may be raised from any context, so add to the frame with interrupts disabled.
+    // If an interrupt filled the frame since we last looked, take its events first, so that pending never overflows.
+    target_disable_irq();
+
+    if (pendingCount >= capacity)
+        taken = takePending(full, capacity);
+
+    pending[2 * pendingCount] = e.source;
+    pending[2 * pendingCount + 1] = e.value;
+    pendingCount++;
+
+    bool now = !flushListener || pendingCount >= capacity;
+    bool schedule = !now && !flushScheduled;
+
+    if (schedule)
+        flushScheduled = true;
+
+    target_enable_irq();
+
+    if (taken)
+        sendFrame(full);
+
+    if (now)
+        flush();
+    else if (schedule)
+        system_timer_event_after_us(CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US, radio.id, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+}
+
+/**
+  * Transmits the events held back by eventReceived(), if any.
+  *
+  * A single event is sent as a MICROBIT_RADIO_PROTOCOL_EVENTBUS frame, understood by all micro:bits.
+  * Several events are packed into one MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED frame.
+  */
+void MicroBitRadioEvent::flush()
+{
     FrameBuffer buf;
+    int capacity = frameCapacity();
+
+    // More events may be held back than fit in a frame if the frame size has been reduced, so send as many as it takes.
+    while (true)
+    {
+        target_disable_irq();
+        int count = takePending(buf, capacity);
+        target_enable_irq();
+
+        if (count == 0)
+            return;
+
+        sendFrame(buf);
+    }
+}
+
+/**
+  * Determines the number of events that fit in one frame, at the radio's current frame size.
+  * This is always one unless coalescing is enabled, so that only frames understood by every micro:bit are sent.
+  */
+int MicroBitRadioEvent::frameCapacity()
+{
+    if (!CONFIG_MICROBIT_RADIO_EVENT_COALESCE_US)
+        return 1;
+
+    int capacity = (radio.getFrameSize() - (MICROBIT_RADIO_HEADER_SIZE - 1)) / (2 * sizeof(uint16_t));
+
+    if (capacity > CONFIG_MICROBIT_RADIO_EVENT_MAX_PACKED)
+        capacity = CONFIG_MICROBIT_RADIO_EVENT_MAX_PACKED;
+
+    return capacity < 1 ? 1 : capacity;
+}
 
-    buf.length = sizeof(Event) + MICROBIT_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
+/**
+  * Moves up to the given number of held back events into a frame. Must be called with interrupts disabled.
+  *
+  * @param buf the frame to fill.
+  * @param capacity the maximum number of events to take.
+  * @return the number of events taken.
+  */
+int MicroBitRadioEvent::takePending(FrameBuffer &buf, int capacity)
+{
+    int count = min((int) pendingCount, capacity);
+
+    buf.version = MICROBIT_RADIO_FRAME_VERSION;
     buf.group = 0;
-    buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS;
-    memcpy(buf.payload, (const uint8_t *)&e, sizeof(Event));
 
-    radio.send(&buf);
+    if (count == 1)
+    {
+        Event e(pending[0], pending[1], CREATE_ONLY);
+
+        buf.length = sizeof(Event) + MICROBIT_RADIO_HEADER_SIZE - 1;
+        buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS;
+        memcpy(buf.payload, (const uint8_t *)&e, sizeof(Event));
+    }
+    else
+    {
+        buf.length = count * 2 * sizeof(uint16_t) + MICROBIT_RADIO_HEADER_SIZE - 1;
+        buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS_PACKED;
+        memcpy(buf.payload, pending, count * 2 * sizeof(uint16_t));
+    }
+
+    // Keep any events that didn't fit for the next frame.
+    pendingCount -= count;
+    memmove(pending, &pending[2 * count], pendingCount * 2 * sizeof(uint16_t));
+
+    return count;
+}
+
+/**
+  * Transmits a frame filled by takePending(), waiting for the radio only if the transmit queue is full.
+  */
+void MicroBitRadioEvent::sendFrame(FrameBuffer &buf)
+{
+    if (buf.length > MICROBIT_RADIO_LEGACY_PACKET_SIZE)
+        buf.version = MICROBIT_RADIO_FRAME_VERSION_LARGE;
+
+    if (radio.sendAsync(&buf) == DEVICE_BUSY)
+        radio.send(&buf);
+}
+
+/**
+  * Transmits the held back events once the coalescing delay has passed.
+  */
+void MicroBitRadioEvent::onFlush(Event)
+{
+    flushScheduled = false;
+    flush();
 }
@@ -0,0 +1,649 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadio.h"
+#include "MicroBitDevice.h"
+#include "EventModel.h"
+#include "CodalFiber.h"
+#include "Timer.h"
+
+using namespace codal;
+
+/**
+  * Provides an acknowledged, unicast link between micro:bits identified by serial number, built upon MicroBitRadio.
+  *
+  * Up to CONFIG_MICROBIT_RADIO_LINK_WINDOW messages may await acknowledgement at once. Receivers acknowledge each message
+  * as soon as it is processed, using the transmit queue's turnaround onto the air, with a bitmap that lets the sender
+  * retransmit only the messages that were lost. Unacknowledged messages are retransmitted with exponential, randomised backoff.
+  * Messages are delivered to the receiver once, and in order.
+  */
+
+static void writeSerial(uint8_t *p, uint32_t serial)
+{
+    p[0] = serial;
+    p[1] = serial >> 8;
+    p[2] = serial >> 16;
+    p[3] = serial >> 24;
+}
+
+static uint32_t readSerial(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+  * Constructor.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitRadioLink::MicroBitRadioLink(MicroBitRadio &r) : radio(r)
+{
+    memset(peers, 0, sizeof(peers));
+    memset(slots, 0, sizeof(slots));
+
+    this->rxQueue = NULL;
+    this->maxPower = MICROBIT_RADIO_DEFAULT_TX_POWER;
+    this->adaptivePower = false;
+    this->listening = false;
+    this->ticking = false;
+    this->retransmissions = 0;
+    this->failures = 0;
+}
+
+/**
+  * Finds the given peer in the peer table, optionally adding it.
+  *
+  * @param serial The serial number of the peer.
+  *
+  * @param create true to add the peer if it is not already known, replacing the least recently heard idle peer if necessary.
+  *
+  * @return The index of the peer, or -1 if it is not known and could not be added.
+  */
+int MicroBitRadioLink::findPeer(uint32_t serial, bool create)
+{
+    int victim = -1;
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_PEERS; i++)
+    {
+        if (peers[i].serial == serial)
+            return i;
+
+        if (!create)
+            continue;
+
+        // Peers with messages in flight can't be replaced.
+        bool idle = true;
+        for (int s = 0; s < CONFIG_MICROBIT_RADIO_LINK_WINDOW; s++)
+            if (slots[s].frame && slots[s].peer == i)
+                idle = false;
+
+        // Prefer an unused entry, then the one we've heard from least recently.
+        if (idle && (victim < 0 || peers[i].serial == 0 || (peers[victim].serial != 0 && peers[i].lastHeard < peers[victim].lastHeard)))
+            victim = i;
+    }
+
+    if (victim < 0)
+        return -1;
+
+    MicroBitRadioLinkPeer &p = peers[victim];
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+        delete p.rxHeld[i];
+
+    memset(&p, 0, sizeof(p));
+    p.serial = serial;
+    p.power = maxPower;
+
+    // Our sequence numbers start again from zero, so start a new session that the peer won't mistake for the last one.
+    p.txSession = microbit_random(256);
+    p.lastHeard = system_timer_current_time();
+
+    return victim;
+}
+
+/**
+  * Sets the transmit power to that chosen for the given peer, if adaptive power is enabled and the transmit queue is idle.
+  */
+void MicroBitRadioLink::applyPower(int peer)
+{
+    // TXPOWER applies to every packet in the transmit queue, so only change it between bursts.
+    if (adaptivePower && !radio.isTransmitting() && radio.getTransmitPower() != peers[peer].power)
+        radio.setTransmitPower(peers[peer].power);
+}
+
+/**
+  * Transmits the message in the given slot, refreshing the oldest sequence number awaiting acknowledgement.
+  *
+  * @return DEVICE_OK on success, or the error returned by MicroBitRadio::sendAsync().
+  */
+int MicroBitRadioLink::transmit(MicroBitRadioLinkSlot &slot)
+{
+    uint8_t seq = slot.frame->payload[9];
+    uint8_t base = seq;
+
+    // Tell the receiver the oldest message we're still trying to deliver, so it can skip any we've abandoned.
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+        if (slots[i].frame && slots[i].peer == slot.peer && (uint8_t)(seq - slots[i].frame->payload[9]) < 128)
+            if ((uint8_t)(base - slots[i].frame->payload[9]) < 128)
+                base = slots[i].frame->payload[9];
+
+    slot.frame->payload[10] = base;
+
+    applyPower(slot.peer);
+
+    return radio.sendAsync(slot.frame);
+}
+
+/**
+  * Sends an acknowledgement of the messages received so far from the given peer.
+  */
+void MicroBitRadioLink::sendAck(int peer)
+{
+    MicroBitRadioLinkPeer &p = peers[peer];
+    FrameBuffer buf;
+    uint8_t mask = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW - 1; i++)
+        if (p.rxHeld[(uint8_t)(p.rxNext + 1 + i) % CONFIG_MICROBIT_RADIO_LINK_WINDOW])
+            mask |= 1 << i;
+
+    buf.length = MICROBIT_RADIO_LINK_HEADER_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = MICROBIT_RADIO_FRAME_VERSION;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_LINK;
+    buf.payload[0] = MICROBIT_RADIO_LINK_TYPE_ACK;
+    writeSerial(&buf.payload[1], microbit_serial_number());
+    writeSerial(&buf.payload[5], p.serial);
+    buf.payload[9] = p.rxNext;
+    buf.payload[10] = mask;
+    buf.payload[11] = p.rxSession;
+
+    applyPower(peer);
+    radio.sendAsync(&buf);
+}
+
+/**
+  * Places the given message at the tail of the receive queue.
+  */
+void MicroBitRadioLink::deliver(FrameBuffer *frame)
+{
+    frame->next = NULL;
+
+    if (rxQueue == NULL)
+    {
+        rxQueue = frame;
+    }
+    else
+    {
+        FrameBuffer *p = rxQueue;
+        while (p->next != NULL)
+            p = p->next;
+
+        p->next = frame;
+    }
+
+    Event(DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_DATA);
+}
+
+/**
+  * Delivers held messages from the given peer that are now in order, while there is room in the receive queue.
+  */
+void MicroBitRadioLink::deliverHeld(int peer)
+{
+    MicroBitRadioLinkPeer &p = peers[peer];
+
+    while (true)
+    {
+        int depth = 0;
+        for (FrameBuffer *f = rxQueue; f != NULL; f = f->next)
+            depth++;
+
+        FrameBuffer *&held = p.rxHeld[p.rxNext % CONFIG_MICROBIT_RADIO_LINK_WINDOW];
+
+        if (held == NULL || held->payload[9] != p.rxNext || depth >= radio.getReceiveQueueSize())
+            return;
+
+        deliver(held);
+        held = NULL;
+        p.rxNext++;
+    }
+}
+
+/**
+  * Retransmission timer handler. Retransmits messages whose deadline has passed, and abandons those that have run out of retries.
+  */
+void MicroBitRadioLink::onTimer(Event)
+{
+    CODAL_TIMESTAMP now = system_timer_current_time();
+    bool active = false;
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+    {
+        MicroBitRadioLinkSlot &slot = slots[i];
+
+        if (slot.frame == NULL)
+            continue;
+
+        if (now >= slot.deadline)
+        {
+            if (slot.retries >= CONFIG_MICROBIT_RADIO_LINK_MAX_RETRIES)
+            {
+                delete slot.frame;
+                slot.frame = NULL;
+                failures++;
+
+                Event(DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_FAILED);
+                continue;
+            }
+
+            // A lost message suggests the peer needs more power.
+            MicroBitRadioLinkPeer &p = peers[slot.peer];
+            if (adaptivePower && p.power < maxPower)
+                p.power++;
+
+            if (transmit(slot) == DEVICE_OK)
+            {
+                slot.retries++;
+                slot.fastRetry = false;
+                retransmissions++;
+
+                // Back off exponentially, with some jitter so that colliding senders don't collide again.
+                slot.deadline = now + (CONFIG_MICROBIT_RADIO_LINK_RETRY_TIMEOUT << slot.retries) + microbit_random(CONFIG_MICROBIT_RADIO_LINK_RETRY_TIMEOUT);
+            }
+        }
+
+        if (slot.frame)
+            active = true;
+    }
+
+    if (!active)
+    {
+        system_timer_cancel_event(DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_TIMER);
+        ticking = false;
+    }
+}
+
+/**
+  * Transmits the given buffer to the micro:bit with the given serial number.
+  *
+  * Waits for a free place in the window if CONFIG_MICROBIT_RADIO_LINK_WINDOW messages already await acknowledgement,
+  * then returns once the message has been queued. Its outcome is reported by a MICROBIT_RADIO_LINK_EVT_DELIVERED
+  * or MICROBIT_RADIO_LINK_EVT_FAILED event. This must be called from a fiber, not an interrupt.
+  *
+  * @param destination The serial number of the recipient, as returned by microbit_serial_number().
+  *
+  * @param buffer The message contents to transmit.
+  *
+  * @param len The number of bytes to transmit, at most getFrameSize() - MICROBIT_RADIO_HEADER_SIZE + 1 - MICROBIT_RADIO_LINK_HEADER_SIZE.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_NO_RESOURCES
+  *         if the peer table is full of peers with messages in flight, or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioLink::send(uint32_t destination, uint8_t *buffer, int len)
+{
+    if (buffer == NULL || len < 0 || destination == 0 || destination == microbit_serial_number())
+        return DEVICE_INVALID_PARAMETER;
+
+    if (len > radio.getFrameSize() - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_LINK_HEADER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!listening && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_TIMER, this, &MicroBitRadioLink::onTimer, MESSAGE_BUS_LISTENER_DROP_IF_BUSY);
+        listening = true;
+    }
+
+    // Wait for room in the window. Slots are freed by acknowledgements, or by the timer once retries run out.
+    int slot = -1;
+    while (true)
+    {
+        for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW && slot < 0; i++)
+            if (slots[i].frame == NULL)
+                slot = i;
+
+        if (slot >= 0)
+            break;
+
+        fiber_sleep(CONFIG_MICROBIT_RADIO_LINK_TICK);
+    }
+
+    int peer = findPeer(destination, true);
+    if (peer < 0)
+        return DEVICE_NO_RESOURCES;
+
+    MicroBitRadioLinkPeer &p = peers[peer];
+    FrameBuffer *frame = new FrameBuffer();
+
+    frame->length = len + MICROBIT_RADIO_LINK_HEADER_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+    frame->version = frame->length > MICROBIT_RADIO_LEGACY_PACKET_SIZE ? MICROBIT_RADIO_FRAME_VERSION_LARGE : MICROBIT_RADIO_FRAME_VERSION;
+    frame->group = 0;
+    frame->protocol = MICROBIT_RADIO_PROTOCOL_LINK;
+    frame->payload[0] = MICROBIT_RADIO_LINK_TYPE_DATA;
+    writeSerial(&frame->payload[1], microbit_serial_number());
+    writeSerial(&frame->payload[5], destination);
+    frame->payload[9] = p.txSeq;
+    frame->payload[11] = p.txSession;
+    memcpy(&frame->payload[MICROBIT_RADIO_LINK_HEADER_SIZE], buffer, len);
+
+    MicroBitRadioLinkSlot &s = slots[slot];
+    s.frame = frame;
+    s.peer = peer;
+    s.retries = 0;
+    s.fastRetry = false;
+
+    int result = transmit(s);
+    if (result != DEVICE_OK && result != DEVICE_BUSY)
+    {
+        delete frame;
+        s.frame = NULL;
+        return result;
+    }
+
+    // A full transmit queue just means the first attempt is made by the timer.
+    p.txSeq++;
+    p.lastHeard = system_timer_current_time();
+    s.deadline = p.lastHeard + (result == DEVICE_OK ? CONFIG_MICROBIT_RADIO_LINK_RETRY_TIMEOUT : 0);
+
+    if (!ticking)
+    {
+        ticking = true;
+        system_timer_event_every(CONFIG_MICROBIT_RADIO_LINK_TICK, DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_TIMER);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+  * Transmits the given buffer to the micro:bit with the given serial number.
+  *
+  * @param destination The serial number of the recipient, as returned by microbit_serial_number().
+  *
+  * @param data The message contents to transmit.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are invalid, DEVICE_NO_RESOURCES
+  *         if the peer table is full of peers with messages in flight, or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioLink::send(uint32_t destination, PacketBuffer data)
+{
+    return send(destination, data.getBytes(), data.length());
+}
+
+/**
+  * Retrieves the next message received.
+  *
+  * @param source If not NULL, set to the serial number of the sender.
+  *
+  * @return the message received, or an empty PacketBuffer if no message is available.
+  */
+PacketBuffer MicroBitRadioLink::recv(uint32_t *source)
+{
+    if (rxQueue == NULL)
+        return PacketBuffer::EmptyPacket;
+
+    FrameBuffer *p = rxQueue;
+    rxQueue = rxQueue->next;
+
+    if (source)
+        *source = readSerial(&p->payload[1]);
+
+    PacketBuffer packet(&p->payload[MICROBIT_RADIO_LINK_HEADER_SIZE], p->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_LINK_HEADER_SIZE, p->rssi);
+
+    // Make room for any messages held back because the queue was full.
+    int peer = findPeer(readSerial(&p->payload[1]), false);
+    delete p;
+
+    if (peer >= 0)
+        deliverHeld(peer);
+
+    return packet;
+}
+
+/**
+  * Determines the number of messages awaiting acknowledgement.
+  *
+  * @return The number of messages in flight.
+  */
+int MicroBitRadioLink::pending()
+{
+    int count = 0;
+
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+        if (slots[i].frame)
+            count++;
+
+    return count;
+}
+
+/**
+  * Enables or disables adaptation of the transmit power to the signal strength of each peer's acknowledgements.
+  * The transmit power in use when enabled is used as a ceiling, and restored when disabled.
+  *
+  * @param enabled true to adapt the transmit power.
+  */
+void MicroBitRadioLink::setAdaptivePower(bool enabled)
+{
+    if (enabled == adaptivePower)
+        return;
+
+    if (enabled)
+    {
+        maxPower = radio.getTransmitPower();
+
+        for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_PEERS; i++)
+            peers[i].power = maxPower;
+    }
+    else
+    {
+        radio.setTransmitPower(maxPower);
+    }
+
+    adaptivePower = enabled;
+}
+
+/**
+  * Determines the number of retransmissions made since startup.
+  */
+uint32_t MicroBitRadioLink::getRetransmissions()
+{
+    return retransmissions;
+}
+
+/**
+  * Determines the number of messages abandoned without acknowledgement since startup.
+  */
+uint32_t MicroBitRadioLink::getFailures()
+{
+    return failures;
+}
+
+/**
+  * Sends any acknowledgements owed for messages received. Called by MicroBitRadio once its receive queue is empty,
+  * so that a burst of messages is acknowledged once, after it has finished arriving.
+  */
+void MicroBitRadioLink::sendAcks()
+{
+    for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_PEERS; i++)
+    {
+        if (peers[i].ackPending)
+        {
+            peers[i].ackPending = false;
+            sendAck(i);
+        }
+    }
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet marked as a link frame.
+  *
+  * Messages addressed to us are acknowledged and queued for user reception in order. Acknowledgements
+  * release the messages they cover from the window.
+  */
+void MicroBitRadioLink::packetReceived()
+{
+    FrameBuffer *packet = radio.recv();
+
+    int len = packet->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_LINK_HEADER_SIZE;
+    uint8_t type = packet->payload[0];
+    uint32_t source = readSerial(&packet->payload[1]);
+    uint32_t destination = readSerial(&packet->payload[5]);
+
+    if (len < 0 || source == 0 || destination != microbit_serial_number())
+    {
+        delete packet;
+        return;
+    }
+
+    if (type == MICROBIT_RADIO_LINK_TYPE_ACK)
+    {
+        int peer = findPeer(source, false);
+        uint8_t next = packet->payload[9];
+        uint8_t mask = packet->payload[10];
+        uint8_t session = packet->payload[11];
+        int rssi = packet->rssi;
+
+        delete packet;
+
+        if (peer < 0)
+            return;
+
+        MicroBitRadioLinkPeer &p = peers[peer];
+
+        // Ignore acknowledgements of an earlier session, and of sequence numbers we haven't sent yet.
+        if (session != p.txSession || (uint8_t)(p.txSeq - next) >= 128)
+            return;
+
+        p.lastHeard = system_timer_current_time();
+
+        // Use the least power that still gives a comfortable signal at the peer.
+        if (adaptivePower && rssi > CONFIG_MICROBIT_RADIO_LINK_RSSI_STRONG && p.power > 0)
+            p.power--;
+
+        if (adaptivePower && rssi < CONFIG_MICROBIT_RADIO_LINK_RSSI_WEAK && p.power < maxPower)
+            p.power++;
+
+        for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+        {
+            MicroBitRadioLinkSlot &slot = slots[i];
+
+            if (slot.frame == NULL || slot.peer != peer)
+                continue;
+
+            uint8_t seq = slot.frame->payload[9];
+            uint8_t offset = seq - next - 1;
+
+            // Acknowledged: either cumulatively, or selectively by the bitmap of later frames.
+            if ((uint8_t)(next - seq - 1) < 128 || (offset < 8 && (mask & (1 << offset))))
+            {
+                delete slot.frame;
+                slot.frame = NULL;
+
+                Event(DEVICE_ID_RADIO_LINK, MICROBIT_RADIO_LINK_EVT_DELIVERED);
+                continue;
+            }
+
+            // Later frames have arrived without this one, so it was lost. Retransmit it now, rather than waiting for its deadline.
+            if (seq == next && mask && !slot.fastRetry && transmit(slot) == DEVICE_OK)
+            {
+                slot.fastRetry = true;
+                retransmissions++;
+            }
+        }
+
+        return;
+    }
+
+    if (type != MICROBIT_RADIO_LINK_TYPE_DATA)
+    {
+        delete packet;
+        return;
+    }
+
+    int peer = findPeer(source, true);
+
+    if (peer < 0)
+    {
+        delete packet;
+        return;
+    }
+
+    MicroBitRadioLinkPeer &p = peers[peer];
+    uint8_t seq = packet->payload[9];
+    uint8_t base = packet->payload[10];
+    uint8_t session = packet->payload[11];
+
+    // A sender that has restarted, or forgotten us, numbers its messages afresh. Discard what it sent before and start again.
+    if (p.synced && session != p.rxSession)
+    {
+        for (int i = 0; i < CONFIG_MICROBIT_RADIO_LINK_WINDOW; i++)
+        {
+            delete p.rxHeld[i];
+            p.rxHeld[i] = NULL;
+        }
+
+        p.synced = false;
+    }
+
+    // A new peer starts from the oldest message it's trying to deliver. If the sender has since abandoned messages, skip past them.
+    if (!p.synced)
+    {
+        p.rxNext = base;
+        p.rxSession = session;
+        p.synced = true;
+    }
+
+    while ((uint8_t)(base - p.rxNext) < 128 && base != p.rxNext)
+    {
+        FrameBuffer *&held = p.rxHeld[p.rxNext % CONFIG_MICROBIT_RADIO_LINK_WINDOW];
+
+        if (held)
+        {
+            if (held->payload[9] == p.rxNext)
+                deliver(held);
+            else
+                delete held;
+
+            held = NULL;
+        }
+
+        p.rxNext++;
+    }
+
+    p.lastHeard = system_timer_current_time();
+
+    // Hold the message until those before it arrive. Duplicates, and messages beyond the window, are simply acknowledged.
+    uint8_t offset = seq - p.rxNext;
+    FrameBuffer *&held = p.rxHeld[seq % CONFIG_MICROBIT_RADIO_LINK_WINDOW];
+
+    if (offset < CONFIG_MICROBIT_RADIO_LINK_WINDOW && held == NULL)
+    {
+        held = new FrameBuffer();
+        memcpy(held, packet, sizeof(FrameBuffer));
+    }
+
+    delete packet;
+
+    // If the receive queue is full, the next message stays held, and unacknowledged until recv() makes room for it.
+    deliverHeld(peer);
+    p.ackPending = true;
+}
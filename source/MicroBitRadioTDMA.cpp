@@ -0,0 +1,436 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadio.h"
+#include "MicroBitDevice.h"
+#include "EventModel.h"
+#include "Timer.h"
+
+using namespace codal;
+
+/**
+  * Provides beacon synchronised, slotted access to the radio for large groups.
+  *
+  * A coordinator divides time into superframes: a beacon slot, one slot per member, and a final contention slot.
+  * Members without a slot ask for one in the contention slot, and learn their assignment from later beacons.
+  * Each member then releases packets queued by MicroBitRadio::sendAsync() (and so MicroBitRadio::send(),
+  * MicroBitRadioBulk and MicroBitRadioLink) only during its own slot, timed from the arrival of each beacon.
+  * Clear channel assessment guards every burst, and is the only protection when beacons stop arriving.
+  */
+
+static void writeSerial(uint8_t *p, uint32_t serial)
+{
+    p[0] = serial;
+    p[1] = serial >> 8;
+    p[2] = serial >> 16;
+    p[3] = serial >> 24;
+}
+
+static uint32_t readSerial(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+  * Constructor.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitRadioTDMA::MicroBitRadioTDMA(MicroBitRadio &r) : radio(r)
+{
+    this->mode = MICROBIT_RADIO_TDMA_OFF;
+    this->epoch = 0;
+    this->slots = CONFIG_MICROBIT_RADIO_TDMA_SLOTS;
+    this->slot = 0;
+    this->slotLength = CONFIG_MICROBIT_RADIO_TDMA_SLOT_LENGTH_US;
+    this->synced = false;
+    this->listening = false;
+    this->members = NULL;
+    this->announce = 0;
+    this->joined = -1;
+}
+
+/**
+  * Stops all of the scheduler's timers.
+  */
+void MicroBitRadioTDMA::cancelTimers()
+{
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_BEACON);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_START);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_END);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_CONTENTION);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SYNC_LOST);
+}
+
+/**
+  * Schedules our slot in the superframe that started with a beacon at the given time.
+  *
+  * @param beacon The time (in microseconds, modulo 2^32) at which the beacon finished.
+  */
+void MicroBitRadioTDMA::scheduleSlots(uint32_t beacon)
+{
+    uint32_t elapsed = (uint32_t) system_timer_current_time_us() - beacon;
+
+    // Members without a slot share the contention slot at the end of the superframe.
+    uint32_t start = (slot ? slot : slots + 1) * (uint32_t) slotLength;
+    uint32_t end = start + slotLength - CONFIG_MICROBIT_RADIO_TDMA_GUARD_US;
+
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_START);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_END);
+    system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_CONTENTION);
+
+    // If the beacon was processed too late to use this superframe's slot, wait for the next beacon.
+    if (elapsed >= start)
+        return;
+
+    if (slot)
+    {
+        system_timer_event_after_us(start - elapsed, DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_START);
+    }
+    else
+    {
+        // Start at a random point in the first half of the slot, so that contending members don't all start together.
+        system_timer_event_after_us(start - elapsed + microbit_random(slotLength / 2), DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_CONTENTION);
+    }
+
+    system_timer_event_after_us(end - elapsed, DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_END);
+}
+
+/**
+  * Builds and transmits a beacon, then schedules our own slot from it.
+  */
+void MicroBitRadioTDMA::sendBeacon()
+{
+    // If our last burst has overrun, skip this beacon rather than transmitting over it.
+    if (radio.isTransmitting())
+        return;
+
+    FrameBuffer buf;
+    int capacity = (radio.getFrameSize() - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE) / MICROBIT_RADIO_TDMA_ENTRY_SIZE;
+    int count = 0;
+    int first = joined;
+
+    buf.payload[0] = MICROBIT_RADIO_TDMA_TYPE_BEACON;
+    buf.payload[1] = epoch;
+    buf.payload[2] = slots;
+    buf.payload[3] = slotLength & 0xFF;
+    buf.payload[4] = slotLength >> 8;
+
+    // Announce the newest member first, so it can start using its slot straight away, then work through the rest in turn.
+    for (int i = 0; i <= slots && count < capacity; i++)
+    {
+        int index;
+
+        if (i == 0)
+        {
+            if (joined < 0)
+                continue;
+
+            index = joined;
+            joined = -1;
+        }
+        else
+        {
+            index = announce;
+            announce = (announce + 1) % slots;
+        }
+
+        if (members[index] == 0 || (i && index == first))
+            continue;
+
+        uint8_t *entry = &buf.payload[MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE + count * MICROBIT_RADIO_TDMA_ENTRY_SIZE];
+        writeSerial(entry, members[index]);
+        entry[4] = index + 1;
+        count++;
+    }
+
+    buf.length = MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE + count * MICROBIT_RADIO_TDMA_ENTRY_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = MICROBIT_RADIO_FRAME_VERSION;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_TDMA;
+
+    // Members time their slots from the end of the beacon, which is when transmit() returns.
+    radio.transmit(&buf);
+    scheduleSlots((uint32_t) system_timer_current_time_us());
+}
+
+/**
+  * Handles the scheduler's timer events.
+  */
+void MicroBitRadioTDMA::onTimer(Event e)
+{
+    switch (e.value)
+    {
+        case MICROBIT_RADIO_TDMA_EVT_BEACON:
+            if (mode == MICROBIT_RADIO_TDMA_COORDINATOR)
+                sendBeacon();
+            break;
+
+        case MICROBIT_RADIO_TDMA_EVT_SLOT_START:
+            radio.setTransmitGate(true);
+            break;
+
+        case MICROBIT_RADIO_TDMA_EVT_CONTENTION:
+            // Ask for a slot, ahead of anything else we have to send.
+            if (mode == MICROBIT_RADIO_TDMA_MEMBER && slot == 0)
+            {
+                FrameBuffer buf;
+
+                buf.length = 5 + MICROBIT_RADIO_HEADER_SIZE - 1;
+                buf.version = MICROBIT_RADIO_FRAME_VERSION;
+                buf.group = 0;
+                buf.protocol = MICROBIT_RADIO_PROTOCOL_TDMA;
+                buf.payload[0] = MICROBIT_RADIO_TDMA_TYPE_JOIN;
+                writeSerial(&buf.payload[1], microbit_serial_number());
+
+                if (!radio.isTransmitting() && radio.getChannelRSSI() <= CONFIG_MICROBIT_RADIO_TDMA_CCA_THRESHOLD)
+                    radio.transmit(&buf);
+            }
+
+            radio.setTransmitGate(true);
+            break;
+
+        case MICROBIT_RADIO_TDMA_EVT_SLOT_END:
+            radio.setTransmitGate(false);
+            break;
+
+        case MICROBIT_RADIO_TDMA_EVT_SYNC_LOST:
+            // Fall back to unsynchronised transmission, with clear channel assessment. We keep our slot, in case the coordinator returns.
+            if (mode == MICROBIT_RADIO_TDMA_MEMBER)
+            {
+                synced = false;
+                radio.setTransmitGate(true);
+            }
+            break;
+    }
+}
+
+/**
+  * Starts coordinating the group: sending a beacon at the start of each superframe, and assigning slots to members
+  * (taking the first for ourselves).
+  *
+  * @param slots The number of assignable slots, in the range 1..254.
+  *
+  * @param slotLength The length of each slot, in microseconds, at least twice CONFIG_MICROBIT_RADIO_TDMA_GUARD_US.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the parameters are out of range,
+  *         DEVICE_NO_RESOURCES if the slot table could not be allocated, or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioTDMA::startCoordinator(int slots, int slotLength)
+{
+    if (slots < 1 || slots > 254 || slotLength < 2 * CONFIG_MICROBIT_RADIO_TDMA_GUARD_US || slotLength > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!(radio.status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return DEVICE_NOT_SUPPORTED;
+
+    stop();
+
+    members = new uint32_t[slots];
+    if (members == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    memset(members, 0, slots * sizeof(uint32_t));
+    members[0] = microbit_serial_number();
+
+    this->slots = slots;
+    this->slotLength = slotLength;
+    this->slot = 1;
+    this->epoch = microbit_random(255) + 1;
+    this->announce = 0;
+    this->joined = -1;
+    this->synced = true;
+    this->mode = MICROBIT_RADIO_TDMA_COORDINATOR;
+
+    if (!listening && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(DEVICE_ID_RADIO_TDMA, DEVICE_EVT_ANY, this, &MicroBitRadioTDMA::onTimer, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        listening = true;
+    }
+
+    radio.setTransmitGate(false);
+    radio.setClearChannelAssessment(CONFIG_MICROBIT_RADIO_TDMA_CCA_THRESHOLD);
+
+    // Each superframe holds the beacon slot, one slot per member, and the contention slot.
+    system_timer_event_every_us((slots + 2) * (uint32_t) slotLength, DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_BEACON);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Starts following a coordinator's beacons. Until the first beacon arrives, transmissions are unsynchronised,
+  * with clear channel assessment.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the radio is not enabled.
+  */
+int MicroBitRadioTDMA::startMember()
+{
+    if (!(radio.status & MICROBIT_RADIO_STATUS_INITIALISED))
+        return DEVICE_NOT_SUPPORTED;
+
+    stop();
+
+    this->slot = 0;
+    this->epoch = 0;
+    this->synced = false;
+    this->mode = MICROBIT_RADIO_TDMA_MEMBER;
+
+    if (!listening && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(DEVICE_ID_RADIO_TDMA, DEVICE_EVT_ANY, this, &MicroBitRadioTDMA::onTimer, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        listening = true;
+    }
+
+    radio.setClearChannelAssessment(CONFIG_MICROBIT_RADIO_TDMA_CCA_THRESHOLD);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Stops the scheduler, returning the radio to unrestricted transmission.
+  */
+void MicroBitRadioTDMA::stop()
+{
+    if (mode == MICROBIT_RADIO_TDMA_OFF)
+        return;
+
+    mode = MICROBIT_RADIO_TDMA_OFF;
+    cancelTimers();
+
+    delete[] members;
+    members = NULL;
+
+    slot = 0;
+    synced = false;
+
+    radio.setClearChannelAssessment(0);
+    radio.setTransmitGate(true);
+}
+
+/**
+  * Determines the role of this micro:bit in the scheduler.
+  *
+  * @return One of the MICROBIT_RADIO_TDMA_* modes.
+  */
+int MicroBitRadioTDMA::getMode()
+{
+    return mode;
+}
+
+/**
+  * Determines the slot assigned to us.
+  *
+  * @return Our slot, in the range 1..slots, or 0 if we don't have one.
+  */
+int MicroBitRadioTDMA::getSlot()
+{
+    return slot;
+}
+
+/**
+  * Determines if we are following a coordinator's beacons.
+  *
+  * @return true if a beacon has been received within the last CONFIG_MICROBIT_RADIO_TDMA_MAX_MISSED superframes,
+  *         or if we are the coordinator.
+  */
+bool MicroBitRadioTDMA::isSynchronised()
+{
+    return synced;
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a beacon or join request.
+  */
+void MicroBitRadioTDMA::packetReceived()
+{
+    FrameBuffer *packet = radio.recv();
+    int len = packet->length - (MICROBIT_RADIO_HEADER_SIZE - 1);
+    uint8_t type = packet->payload[0];
+
+    if (type == MICROBIT_RADIO_TDMA_TYPE_JOIN && mode == MICROBIT_RADIO_TDMA_COORDINATOR && len >= 5)
+    {
+        uint32_t serial = readSerial(&packet->payload[1]);
+        int free = -1;
+
+        for (int i = 0; i < slots; i++)
+        {
+            // A member that missed its assignment asks again, so just announce it again.
+            if (members[i] == serial)
+            {
+                joined = i;
+                free = -1;
+                break;
+            }
+
+            if (members[i] == 0 && free < 0)
+                free = i;
+        }
+
+        if (free >= 0)
+        {
+            members[free] = serial;
+            joined = free;
+        }
+    }
+
+    if (type == MICROBIT_RADIO_TDMA_TYPE_BEACON && mode == MICROBIT_RADIO_TDMA_MEMBER && len >= MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE)
+    {
+        uint16_t length = packet->payload[3] | (packet->payload[4] << 8);
+
+        // A new epoch means the coordinator has restarted, and forgotten its assignments.
+        if (packet->payload[1] != epoch)
+        {
+            epoch = packet->payload[1];
+            slot = 0;
+        }
+
+        slots = packet->payload[2];
+        slotLength = length;
+
+        uint32_t serial = microbit_serial_number();
+        int count = (len - MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE) / MICROBIT_RADIO_TDMA_ENTRY_SIZE;
+
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t *entry = &packet->payload[MICROBIT_RADIO_TDMA_BEACON_HEADER_SIZE + i * MICROBIT_RADIO_TDMA_ENTRY_SIZE];
+
+            if (readSerial(entry) == serial && entry[4] != slot && entry[4] <= slots)
+            {
+                slot = entry[4];
+                Event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SLOT_ASSIGNED);
+            }
+        }
+
+        // Hold transmissions back until our slot comes round.
+        synced = true;
+        radio.setTransmitGate(false);
+        scheduleSlots(packet->timestamp);
+
+        // If beacons stop, fall back to unsynchronised transmission.
+        system_timer_cancel_event(DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SYNC_LOST);
+        system_timer_event_after_us((CONFIG_MICROBIT_RADIO_TDMA_MAX_MISSED + 1) * (slots + 2) * (uint32_t) slotLength, DEVICE_ID_RADIO_TDMA, MICROBIT_RADIO_TDMA_EVT_SYNC_LOST);
+    }
+
+    delete packet;
+}
@@ -0,0 +1,176 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Class definition for MicroBitSampleBuffer.
+ *
+ * A fixed size ring buffer of timestamped sensor samples.
+ */
+#include "MicroBitSampleBuffer.h"
+
+/**
+ * Constructor.
+ *
+ * @param size The number of samples the buffer can hold. This is rounded up to a power of two.
+ */
+MicroBitSampleBuffer::MicroBitSampleBuffer(int size)
+{
+    // A power of two size keeps sequence numbers and ring indexes consistent when the sequence number wraps.
+    this->size = 1;
+    while ((int)this->size < size)
+        this->size <<= 1;
+
+    this->samples = new MicroBitSample[this->size];
+    this->written = 0;
+
+    open(reader);
+}
+
+/**
+ * Adds a sample to the buffer, overwriting the oldest sample if the buffer is full.
+ *
+ * @param sample The sample to add.
+ * @param timestamp The time the sample was taken, in milliseconds.
+ */
+void MicroBitSampleBuffer::push(Sample3D sample, CODAL_TIMESTAMP timestamp)
+{
+    MicroBitSample &s = samples[written & (size - 1)];
+
+    s.sample = sample;
+    s.timestamp = timestamp;
+    written++;
+}
+
+/**
+ * Initialises a cursor, so that it reads the samples pushed from now on.
+ *
+ * @param cursor The cursor to initialise.
+ */
+void MicroBitSampleBuffer::open(MicroBitSampleCursor &cursor)
+{
+    cursor.position = written;
+    cursor.overruns = 0;
+}
+
+/**
+ * Moves a cursor that has fallen behind on to the oldest sample still held, counting the samples it missed.
+ */
+void MicroBitSampleBuffer::catchUp(MicroBitSampleCursor &cursor)
+{
+    if (written - cursor.position > size)
+    {
+        cursor.overruns += written - size - cursor.position;
+        cursor.position = written - size;
+    }
+}
+
+/**
+ * Reads samples from the buffer, oldest first, and advances the given cursor past them.
+ *
+ * @param cursor The reader's cursor.
+ * @param buffer The memory to read the samples into.
+ * @param count The maximum number of samples to read.
+ *
+ * @return The number of samples read.
+ */
+int MicroBitSampleBuffer::read(MicroBitSampleCursor &cursor, MicroBitSample *buffer, int count)
+{
+    int n = 0;
+
+    catchUp(cursor);
+
+    while (n < count && cursor.position != written)
+        buffer[n++] = samples[cursor.position++ & (size - 1)];
+
+    return n;
+}
+
+/**
+ * Determines the number of samples waiting to be read through the given cursor.
+ *
+ * @param cursor The reader's cursor.
+ *
+ * @return The number of unread samples.
+ */
+int MicroBitSampleBuffer::available(MicroBitSampleCursor &cursor)
+{
+    catchUp(cursor);
+
+    return written - cursor.position;
+}
+
+/**
+ * Determines the number of samples that were overwritten before they were read through the given cursor.
+ *
+ * @param cursor The reader's cursor.
+ *
+ * @return The total number of samples lost by this reader.
+ */
+uint32_t MicroBitSampleBuffer::getOverruns(MicroBitSampleCursor &cursor)
+{
+    catchUp(cursor);
+
+    return cursor.overruns;
+}
+
+/**
+ * Reads samples from the buffer, oldest first, using the buffer's own cursor.
+ *
+ * @param buffer The memory to read the samples into.
+ * @param count The maximum number of samples to read.
+ *
+ * @return The number of samples read.
+ */
+int MicroBitSampleBuffer::read(MicroBitSample *buffer, int count)
+{
+    return read(reader, buffer, count);
+}
+
+/**
+ * Determines the number of samples waiting to be read using the buffer's own cursor.
+ *
+ * @return The number of unread samples.
+ */
+int MicroBitSampleBuffer::available()
+{
+    return available(reader);
+}
+
+/**
+ * Determines the number of samples that were overwritten before they were read using the buffer's own cursor.
+ *
+ * @return The total number of samples lost.
+ */
+uint32_t MicroBitSampleBuffer::getOverruns()
+{
+    return getOverruns(reader);
+}
+
+/**
+ * Destructor.
+ */
+MicroBitSampleBuffer::~MicroBitSampleBuffer()
+{
+    delete[] samples;
+}
@@ -0,0 +1,115 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitSensorDemand.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Constructor. Creates a record with no consumers.
+ */
+MicroBitSensorDemand::MicroBitSensorDemand()
+{
+    for (int i = 0; i < MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS; i++)
+        consumers[i].id = 0;
+}
+
+/**
+ * Records the sample period a consumer requires, replacing any it previously requested.
+ *
+ * @param id The id of the consuming component, e.g. MICROBIT_ID_GESTURE.
+ *
+ * @param period The longest time between samples the consumer can accept, in milliseconds.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the id is zero or the period is not positive,
+ * or DEVICE_NO_RESOURCES if MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS consumers are already registered.
+ */
+int MicroBitSensorDemand::request(uint16_t id, int period)
+{
+    int slot = -1;
+
+    if (id == 0 || period <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS; i++)
+    {
+        if (consumers[i].id == id)
+        {
+            slot = i;
+            break;
+        }
+
+        if (consumers[i].id == 0 && slot < 0)
+            slot = i;
+    }
+
+    if (slot < 0)
+        return DEVICE_NO_RESOURCES;
+
+    consumers[slot].id = id;
+    consumers[slot].period = period;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Removes the sample period a consumer requested.
+ *
+ * @param id The id of the consuming component.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the consumer has no request recorded.
+ */
+int MicroBitSensorDemand::release(uint16_t id)
+{
+    if (id == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    for (int i = 0; i < MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS; i++)
+    {
+        if (consumers[i].id == id)
+        {
+            consumers[i].id = 0;
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Determines the sample period that satisfies every consumer.
+ *
+ * @return The shortest period requested, in milliseconds, or zero if there are no consumers.
+ */
+int MicroBitSensorDemand::getPeriod()
+{
+    int period = 0;
+
+    for (int i = 0; i < MICROBIT_SENSOR_DEMAND_MAX_CONSUMERS; i++)
+        if (consumers[i].id != 0 && (period == 0 || consumers[i].period < period))
+            period = consumers[i].period;
+
+    return period;
+}
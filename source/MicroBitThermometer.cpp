@@ -22,6 +22,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitThermometer.h"
 #include "codal-core/inc/driver-models/Timer.h"
 #include "nrf.h"
+#include "MicroBitTrace.h"
 
 #ifdef SOFTDEVICE_PRESENT
 #include "MicroBitDevice.h"
@@ -31,6 +32,23 @@ DEALINGS IN THE SOFTWARE.
 
 using namespace codal;
 
+MicroBitThermometer* MicroBitThermometer::instance = NULL;
+
+extern "C" void TEMP_IRQHandler(void)
+{
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_TEMP_IRQ);
+
+    if (NRF_TEMP->EVENTS_DATARDY)
+    {
+        NRF_TEMP->EVENTS_DATARDY = 0;
+        int32_t raw = NRF_TEMP->TEMP;
+        NRF_TEMP->TASKS_STOP = 1;
+
+        if (MicroBitThermometer::instance)
+            MicroBitThermometer::instance->conversionComplete(raw);
+    }
+}
+
 /*
  * The underlying Nordic libraries that support BLE do not compile cleanly with the stringent GCC settings we employ
  * If we're compiling under GCC, then we suppress any warnings generated from this code (but not the rest of the DAL)
@@ -53,8 +71,17 @@ MicroBitThermometer::MicroBitThermometer(uint16_t id)
     this->id = id;
     this->samplePeriod = MICROBIT_THERMOMETER_PERIOD;
     this->sampleTime = 0;
+    this->maxAge = MICROBIT_THERMOMETER_MAX_AGE;
     this->offset = 0;
     this->temperature = 0;
+    this->lastSample = 0;
+    this->sampled = false;
+    this->converting = false;
+    this->converted = false;
+    this->conversion = 0;
+    this->conversionStart = 0;
+
+    instance = this;
 }
 
 /**
@@ -69,6 +96,11 @@ MicroBitThermometer::MicroBitThermometer(uint16_t id)
 int MicroBitThermometer::getTemperature()
 {
     updateSample();
+
+    // Only wait for a measurement if the latest is too old.
+    if (!sampled || system_timer_current_time() - lastSample > maxAge)
+        measure();
+
     return temperature - offset;
 }
 
@@ -87,10 +119,27 @@ int MicroBitThermometer::updateSample()
     // Ensure we're registered for a background processing callbacks.
     status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
 
+    // Report the result of any background conversion that has completed.
+    if (converted)
+    {
+        converted = false;
+        record(conversion, conversionStart);
+    }
+
+#ifdef SOFTDEVICE_PRESENT
+    // The SoftDevice takes the TEMP peripheral when Bluetooth is enabled, so abandon any conversion it interrupted.
+    if (converting && ble_running())
+    {
+        NVIC_DisableIRQ(TEMP_IRQn);
+        converting = false;
+    }
+#endif
+
     // check if we need to update our sample...
-    if(isSampleNeeded())
+    if(isSampleNeeded() && !converting)
     {
-        int32_t processorTemperature = 0;
+        // Schedule our next sample.
+        sampleTime = system_timer_current_time() + samplePeriod;
 
         // For now, we just rely on the nrf senesor to be the most accurate.
         // The compass module also has a temperature sensor, and has the lowest power consumption, so will run the cooler...
@@ -100,34 +149,116 @@ int MicroBitThermometer::updateSample()
         if ( ble_running())
         {
             // If Bluetooth is enabled, we need to go through the Nordic software to safely do this
+            int32_t processorTemperature = 0;
             sd_temp_get(&processorTemperature);
+            record(processorTemperature, system_timer_current_time());
         }
         else
 #endif
         {
-            // Othwerwise, we access the information directly...
-            NRF_TEMP->TASKS_START = 1;
-            while (NRF_TEMP->EVENTS_DATARDY == 0);
+            // Othwerwise, we start a conversion, and collect its result when the TEMP interrupt fires.
+            startConversion();
+        }
+    }
+
+    return DEVICE_OK;
+};
+
+/**
+  * Records the result of a background conversion.
+  *
+  * @param raw The value of the TEMP register, in quarters of a degree celsius.
+  *
+  * @note should only be called from TEMP_IRQHandler...
+  */
+void MicroBitThermometer::conversionComplete(int32_t raw)
+{
+    conversion = raw;
+    converted = true;
+    converting = false;
+}
+
+/**
+  * Starts a background conversion, with its result collected by the TEMP interrupt.
+  */
+void MicroBitThermometer::startConversion()
+{
+    NRF_TEMP->EVENTS_DATARDY = 0;
+    NRF_TEMP->INTENSET = TEMP_INTENSET_DATARDY_Msk;
+
+    NVIC_SetPriority(TEMP_IRQn, CONFIG_MICROBIT_THERMOMETER_IRQ_PRIORITY);
+    NVIC_ClearPendingIRQ(TEMP_IRQn);
+    NVIC_EnableIRQ(TEMP_IRQn);
+
+    conversionStart = system_timer_current_time();
+    converting = true;
+
+    NRF_TEMP->TASKS_START = 1;
+}
+
+/**
+  * Measures the temperature now, waiting for the conversion to complete.
+  */
+void MicroBitThermometer::measure()
+{
+    int32_t processorTemperature = 0;
+
+#ifdef SOFTDEVICE_PRESENT
+    if ( ble_running())
+    {
+        sd_temp_get(&processorTemperature);
+    }
+    else
+#endif
+    {
+        // Collect the result here rather than in the interrupt, completing any background conversion already under way.
+        // A conversion takes around 36us.
+        NVIC_DisableIRQ(TEMP_IRQn);
+
+        if (!converting)
+        {
             NRF_TEMP->EVENTS_DATARDY = 0;
+            NRF_TEMP->TASKS_START = 1;
+        }
 
-            processorTemperature = NRF_TEMP->TEMP;
+        while (NRF_TEMP->EVENTS_DATARDY == 0 && !converted);
 
+        if (converted)
+        {
+            processorTemperature = conversion;
+        }
+        else
+        {
+            NRF_TEMP->EVENTS_DATARDY = 0;
+            processorTemperature = NRF_TEMP->TEMP;
             NRF_TEMP->TASKS_STOP = 1;
         }
 
+        NVIC_ClearPendingIRQ(TEMP_IRQn);
+        converting = false;
+        converted = false;
+    }
 
-        // Record our reading...
-        temperature = processorTemperature / 4;
-
-        // Schedule our next sample.
-        sampleTime = system_timer_current_time() + samplePeriod;
+    record(processorTemperature, system_timer_current_time());
+}
 
-        // Send an event to indicate that we'e updated our temperature.
-        Event e(id, MICROBIT_THERMOMETER_EVT_UPDATE);
-    }
+/**
+  * Records a new temperature reading, and sends an event to indicate that it has been updated.
+  *
+  * @param raw The measured temperature, in quarters of a degree celsius.
+  *
+  * @param t The time at which the temperature was measured.
+  */
+void MicroBitThermometer::record(int32_t raw, CODAL_TIMESTAMP t)
+{
+    // Record our reading...
+    temperature = raw / 4;
+    lastSample = t;
+    sampled = true;
 
-    return DEVICE_OK;
-};
+    // Send an event to indicate that we'e updated our temperature.
+    Event e(id, MICROBIT_THERMOMETER_EVT_UPDATE);
+}
 
 /**
   * Periodic callback from MicroBit idle thread.
@@ -173,6 +304,38 @@ int MicroBitThermometer::getPeriod()
     return samplePeriod;
 }
 
+/**
+  * Sets the maximum age of the temperature returned by getTemperature() (in ms).
+  *
+  * Temperatures are measured in the background every sample period, without waiting for the conversion
+  * to complete, and getTemperature() returns the most recent of these. Only if it is older than the
+  * maximum age does getTemperature() wait for a new measurement.
+  *
+  * The default maximum age is MICROBIT_THERMOMETER_MAX_AGE. An age of zero measures the temperature whenever it is read, at most once a millisecond.
+  *
+  * @param age the maximum age of a temperature reading, in milliseconds.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the age is negative.
+  */
+int MicroBitThermometer::setMaxAge(int age)
+{
+    if (age < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    maxAge = age;
+    return DEVICE_OK;
+}
+
+/**
+  * Reads the maximum age of the temperature returned by getTemperature().
+  *
+  * @return The maximum age, in milliseconds.
+  */
+int MicroBitThermometer::getMaxAge()
+{
+    return maxAge;
+}
+
 /**
   * Set the value that is used to offset the raw silicon temperature.
   *
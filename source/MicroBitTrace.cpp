@@ -0,0 +1,280 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitTrace.h"
+#include "CodalDmesg.h"
+#include "nrf.h"
+#include <string.h>
+
+using namespace codal;
+
+// Only reserve the trace buffer and running totals if trace points are compiled in.
+#if CONFIG_ENABLED(CONFIG_MICROBIT_TRACE)
+#define MICROBIT_TRACE_ENTRIES      MICROBIT_TRACE_BUFFER_SIZE
+#define MICROBIT_TRACE_POINTS       MICROBIT_TRACE_MAX_POINTS
+#else
+#define MICROBIT_TRACE_ENTRIES      1
+#define MICROBIT_TRACE_POINTS       1
+#endif
+
+static MicroBitTraceEntry traceBuffer[MICROBIT_TRACE_ENTRIES];
+
+static volatile uint32_t traceHead = 0;         // The total number of entries recorded.
+static volatile uint32_t traceTail = 0;         // The total number of entries read or discarded.
+static uint32_t traceDropped = 0;
+static uint32_t traceEntered[MICROBIT_TRACE_POINTS];                // When each trace point was last entered.
+static MicroBitTraceSummary traceTotals[MICROBIT_TRACE_POINTS];     // The running total for each trace point.
+static bool traceEnabled = false;
+
+/**
+ * Starts the CPU cycle counter and clears the trace buffer.
+ * This is done automatically when the first entry is recorded.
+ */
+void MicroBitTrace::enable()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    clear();
+    traceEnabled = true;
+}
+
+/**
+ * Records an entry in the trace buffer, overwriting the oldest if it is full.
+ *
+ * @param point The trace point entered or left.
+ *
+ * @param exit true if the trace point was left, false if it was entered.
+ */
+void MicroBitTrace::record(uint16_t point, bool exit)
+{
+    if (!CONFIG_ENABLED(CONFIG_MICROBIT_TRACE))
+        return;
+
+    if (!traceEnabled)
+        enable();
+
+    // We may be interrupted by a trace point of higher priority, and may ourselves be running in an interrupt.
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    MicroBitTraceEntry *e = &traceBuffer[traceHead & (MICROBIT_TRACE_ENTRIES - 1)];
+    e->cycles = DWT->CYCCNT;
+    e->point = point;
+    e->flags = exit ? MICROBIT_TRACE_FLAG_EXIT : 0;
+
+    traceHead = traceHead + 1;
+
+    if (point < MICROBIT_TRACE_POINTS)
+    {
+        if (!exit)
+        {
+            traceEntered[point] = e->cycles;
+        }
+        else
+        {
+            MicroBitTraceSummary *t = &traceTotals[point];
+            uint32_t cycles = e->cycles - traceEntered[point];
+
+            t->count++;
+            t->total += cycles;
+            if (cycles > t->max)
+                t->max = cycles;
+        }
+    }
+
+    if (traceHead - traceTail > MICROBIT_TRACE_ENTRIES)
+    {
+        traceTail = traceTail + 1;
+        traceDropped++;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+/**
+ * Removes entries from the trace buffer, oldest first.
+ *
+ * @param buffer The memory to copy the entries into, as a sequence of MicroBitTraceEntry.
+ *
+ * @param length The size of the buffer, in bytes. Only whole entries are copied.
+ *
+ * @return The number of bytes copied, which is zero once the trace buffer is empty.
+ */
+int MicroBitTrace::read(uint8_t *buffer, int length)
+{
+    MicroBitTraceEntry *out = (MicroBitTraceEntry *) buffer;
+    int count = 0;
+
+    if (!CONFIG_ENABLED(CONFIG_MICROBIT_TRACE) || buffer == NULL)
+        return 0;
+
+    while (length >= (int) sizeof(MicroBitTraceEntry))
+    {
+        __disable_irq();
+
+        if (traceTail == traceHead)
+        {
+            __enable_irq();
+            break;
+        }
+
+        memcpy(&out[count++], &traceBuffer[traceTail & (MICROBIT_TRACE_ENTRIES - 1)], sizeof(MicroBitTraceEntry));
+        traceTail = traceTail + 1;
+
+        __enable_irq();
+
+        length -= sizeof(MicroBitTraceEntry);
+    }
+
+    return count * sizeof(MicroBitTraceEntry);
+}
+
+/**
+ * Reads the number of entries overwritten before they could be read, since the trace buffer was last cleared.
+ *
+ * @return The number of entries lost.
+ */
+uint32_t MicroBitTrace::getDropped()
+{
+    return traceDropped;
+}
+
+/**
+ * Summarises the time spent within a trace point, from the entries currently held in the trace buffer.
+ * Each pair of matching entries is counted, and the time includes that spent in any nested trace points.
+ *
+ * @param point The trace point to summarise.
+ *
+ * @return The summary, which has a count of zero if the trace point was not entered and left.
+ */
+MicroBitTraceSummary MicroBitTrace::getSummary(uint16_t point)
+{
+    MicroBitTraceSummary s;
+    uint32_t entered = 0;
+    bool inside = false;
+
+    s.count = 0;
+    s.total = 0;
+    s.max = 0;
+
+    if (!CONFIG_ENABLED(CONFIG_MICROBIT_TRACE))
+        return s;
+
+    // Take a stable view of the buffer. Entries recorded while we walk it may overwrite the oldest, which we accept.
+    uint32_t head = traceHead;
+    uint32_t tail = traceTail;
+
+    for (uint32_t i = tail; i != head; i++)
+    {
+        MicroBitTraceEntry *e = &traceBuffer[i & (MICROBIT_TRACE_ENTRIES - 1)];
+
+        if (e->point != point)
+            continue;
+
+        if (!(e->flags & MICROBIT_TRACE_FLAG_EXIT))
+        {
+            entered = e->cycles;
+            inside = true;
+        }
+        else if (inside)
+        {
+            // The cycle counter wraps every few tens of seconds, which unsigned arithmetic handles for us.
+            uint32_t cycles = e->cycles - entered;
+
+            s.count++;
+            s.total += cycles;
+            if (cycles > s.max)
+                s.max = cycles;
+
+            inside = false;
+        }
+    }
+
+    return s;
+}
+
+/**
+ * Reads the running total of time spent within a trace point, since the totals were last reset.
+ * The time includes that spent in any nested trace points.
+ *
+ * @param point The trace point, which must be less than MICROBIT_TRACE_MAX_POINTS.
+ *
+ * @return The running total, which has a count of zero if the trace point has not been entered and left.
+ */
+MicroBitTraceSummary MicroBitTrace::getTotal(uint16_t point)
+{
+    MicroBitTraceSummary s;
+
+    s.count = 0;
+    s.total = 0;
+    s.max = 0;
+
+    if (point >= MICROBIT_TRACE_POINTS)
+        return s;
+
+    __disable_irq();
+    s = traceTotals[point];
+    __enable_irq();
+
+    return s;
+}
+
+/**
+ * Resets the running totals of every trace point to zero.
+ */
+void MicroBitTrace::resetTotals()
+{
+    __disable_irq();
+    memset(traceTotals, 0, sizeof(traceTotals));
+    __enable_irq();
+}
+
+/**
+ * Discards all entries held in the trace buffer.
+ */
+void MicroBitTrace::clear()
+{
+    __disable_irq();
+    traceTail = traceHead;
+    traceDropped = 0;
+    __enable_irq();
+}
+
+/**
+ * Writes a summary of each trace point found in the trace buffer to the debug log, one line per point:
+ * TRACE,point,count,total_cycles,max_cycles
+ */
+void MicroBitTrace::print()
+{
+    for (int point = 0; point < MICROBIT_TRACE_MAX_POINTS; point++)
+    {
+        MicroBitTraceSummary s = getSummary(point);
+
+        if (s.count)
+            DMESG("TRACE,%d,%d,%d,%d", point, (int) s.count, (int) s.total, (int) s.max);
+    }
+
+    DMESG("TRACE,dropped,%d", (int) traceDropped);
+}
@@ -49,6 +49,15 @@ MicroBitUSBFlashManager::MicroBitUSBFlashManager(MicroBitI2C &i2c, MicroBitIO &i
 {
     this->id = id;
     this->maxWriteLength = 64;
+    this->maxReadLength = MICROBIT_USB_FLASH_MAX_READ_LENGTH;
+    this->geometry.blockSize = 0;
+    this->geometry.blockCount = 0;
+
+    resetStatistics();
+
+    // Nothing is known about the state of the storage until we erase it.
+    memset(erasedBlocks, 0, sizeof(erasedBlocks));
+    memset(eraseAheadBlocks, 0, sizeof(eraseAheadBlocks));
 
     // Be pessimistic about the interface chip in use, until we obtain version information.
     status = (MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY | MICROBIT_USB_FLASH_USE_NULL_TRANSACTION);
@@ -226,15 +235,23 @@ MicroBitUSBFlashGeometry MicroBitUSBFlashManager::getGeometry()
                 case 2:
                 default:
                     // Apply/disable workarounds for KL27/NRF528xx rev2 release.
-                    maxWriteLength = 64;
+                    maxWriteLength = MICROBIT_USB_FLASH_MAX_WRITE_LENGTH;
                     status &= ~MICROBIT_USB_FLASH_USE_NULL_TRANSACTION;
                     status |= MICROBIT_USB_FLASH_BUSY_FLAG_SUPPORTED;
+#if MICROBIT_USB_FLASH_MULTI_PAGE_ERASE
+                    status &= ~MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY;
+                    status |= MICROBIT_USB_FLASH_POLL_ERASE;
+#else
                     status |= MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY;
+#endif
             }
 
             // If we have a V2.2 NRF52 based DAPLink revision, apply an additional 100ms delay following a FLASH_ERASE command.
             if (v.board == 0x9905 || v.board == 0x9906)
+            {
                 status |= MICROBIT_USB_FLASH_100MS_AFTER_ERASE;
+                status &= ~MICROBIT_USB_FLASH_POLL_ERASE;
+            }
         }
 
         // Ensure we don't cache invalid state.
@@ -277,6 +294,7 @@ int MicroBitUSBFlashManager::eraseConfig()
 
 /**
  * Reads data from the specified location in the USB file staorage area.
+ * Long reads are streamed as a sequence of the largest transactions supported by the interface chip.
  * 
  * @param address the logical address of the memory to read.
  * @param length the number of 32-bit words to read.
@@ -286,48 +304,56 @@ int MicroBitUSBFlashManager::eraseConfig()
 ManagedBuffer 
 MicroBitUSBFlashManager::read(uint32_t address, uint32_t length)
 {
-    ManagedBuffer request(8);
-    ManagedBuffer response;
+    ManagedBuffer response(length * sizeof(uint32_t));
 
-    // Convert length parameter from 32-bit count to a byte count.
-    length = length * sizeof(uint32_t);
-
-    uint32_t *p = (uint32_t *) &request[0];
-    *p++ = htonl((uint32_t) address | (MICROBIT_USB_FLASH_READ_CMD << 24));
-    *p++ = htonl(length);
+    if (length == 0 || read((uint32_t *) &response[0], address, length) != DEVICE_OK)
+        return ManagedBuffer();
 
-    response = transact(request, length + 8);
-
-    // If we have a valid repsonse, strip off the KL27 I2C Header
-    if (response.length() > 8)
-    {
-        response.shift(8);
-        response.truncate(response.length() - 8);
-    }
-    else
-    {
-        response = ManagedBuffer();
-    }
-    
     return response;
 }
 
 /**
  * Reads a block of memory from non-volatile memory into RAM
+ * Long reads are streamed as a sequence of the largest transactions supported by the interface chip.
  * 
  * @param dest The address in RAM in which to store the result of the read operation
  * @param address The logical address in non-voltile memory to read from
  * @param length The number 32-bit words to read.
+ * @return DEVICE_OK on success, or DEVICE_NO_DATA if the data could not be read.
  */ 
 int 
 MicroBitUSBFlashManager::read(uint32_t* dest, uint32_t address, uint32_t length)
 {
-    ManagedBuffer b = read(address, length);
+    ManagedBuffer request(8);
+    ManagedBuffer response;
+
+    // Convert length parameter from 32-bit count to a byte count.
+    length = length * sizeof(uint32_t);
+
+    uint8_t *data = (uint8_t *) dest;
+    uint32_t segmentLength;
+
+    while (length > 0)
+    {
+        segmentLength = min(maxReadLength, length);
+
+        uint32_t *p = (uint32_t *) &request[0];
+        *p++ = htonl((uint32_t) address | (MICROBIT_USB_FLASH_READ_CMD << 24));
+        *p++ = htonl(segmentLength);
+
+        response = transact(request, segmentLength + 8);
+
+        // If we have a valid repsonse, strip off the KL27 I2C Header
+        if (response.length() < (int) segmentLength + 8)
+            return DEVICE_NO_DATA;
+
+        memcpy(data, &response[8], segmentLength);
+
+        data += segmentLength;
+        address += segmentLength;
+        length -= segmentLength;
+    }
 
-    if (b.length() == 0)
-        return DEVICE_NO_DATA;
-    
-    memcpy(dest, &b[0], length * sizeof(uint32_t));
     return DEVICE_OK;
 }
 
@@ -345,6 +371,9 @@ int MicroBitUSBFlashManager::write(uint32_t address, uint32_t *data, uint32_t le
     // Convert length parameter from 32-bit count to a byte count.
     length = length * sizeof(uint32_t);
 
+    // The blocks written to are no longer erased, and must not be erased in the background.
+    setErased(address, length, false);
+
     ManagedBuffer response;
 
     ManagedBuffer request(min(maxWriteLength, length) + 8);
@@ -374,6 +403,9 @@ int MicroBitUSBFlashManager::write(uint32_t address, uint32_t *data, uint32_t le
         p+= segmentLength;
     }
 
+    // Discard any record of a concurrent erase of these blocks that completed while we were writing.
+    setErased(address, length, false);
+
     return DEVICE_OK;
 }
 
@@ -398,6 +430,7 @@ int MicroBitUSBFlashManager::write(ManagedBuffer data, uint32_t address)
  * If the specified region is not aligned to physical block boundaries as
  * defined by the disks geometry, areas in an overlapping block outside the given 
  * range will be automatically read, erased and rewritten. 
+ * Blocks known to be erased already (see eraseAhead()) are not erased again.
  * 
  * @param address the logical address of the memory to start the erase operation.
  * @param length the number of 32-bit words to erase.
@@ -406,8 +439,6 @@ int MicroBitUSBFlashManager::write(ManagedBuffer data, uint32_t address)
  */
 int MicroBitUSBFlashManager::erase(uint32_t address, uint32_t length)
 {
-    ManagedBuffer request(8);
-    ManagedBuffer response;
     ManagedBuffer restoreBuffer1;
     ManagedBuffer restoreBuffer2;
 
@@ -431,45 +462,23 @@ int MicroBitUSBFlashManager::erase(uint32_t address, uint32_t length)
     {
         // We need to take the slow path, and save/restore some data...
         // We also need to ensure our data is on a 32 bit boundary.
+        // Blocks that are already erased hold nothing worth restoring, and are not erased again.
         int restoreLength1 = address - eraseStart;
         int restoreLength2 = (geometry.blockSize - ((address + length) % geometry.blockSize)) % geometry.blockSize;
 
-        if (restoreLength1 > 0)
+        if (restoreLength1 > 0 && !isErased(eraseStart))
             restoreBuffer1 = read(eraseStart, restoreLength1/sizeof(uint32_t));
 
-        if (restoreLength2 > 0)
+        if (restoreLength2 > 0 && !isErased(address + length))
             restoreBuffer2 = read(address + length, restoreLength2/sizeof(uint32_t));
     }
 
-    if (status & MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY)
-    {
-        for (uint32_t page = eraseStart; page <= eraseEnd; page += geometry.blockSize)
-        {
-            uint32_t *p = (uint32_t *) &request[0];
-            *p++ = htonl(page | (MICROBIT_USB_FLASH_ERASE_CMD << 24));
-            *p++ = htonl(page);
-
-            response = transact(request, 1);
-            if (response.length() == 0)
-            {
-                DMESG("ERROR ERASING");
-                return DEVICE_I2C_ERROR;
-            }
-        }
-    }
-    else
-    {
-        uint32_t *p = (uint32_t *) &request[0];
-        *p++ = htonl(eraseStart | (MICROBIT_USB_FLASH_ERASE_CMD << 24));
-        *p++ = htonl(eraseEnd);
+    lock(MICROBIT_USB_FLASH_ERASE_CMD);
+    int result = eraseBlocks(eraseStart, eraseEnd);
+    transactionLock.notify();
 
-        response = transact(request, 1);
-        if (response.length() == 0)
-        {
-            DMESG("ERROR ERASING");
-            return DEVICE_I2C_ERROR;
-        }
-    }
+    if (result != DEVICE_OK)
+        return result;
 
     // Restore any saved data if necessary
     if (restoreBuffer1.length() > 0)
@@ -493,6 +502,202 @@ MicroBitUSBFlashManager::erase(uint32_t page)
     return erase(page, geometry.blockSize/4);
 }
 
+/**
+ * Queues one or more physical blocks in the USB file storage area to be erased in the background.
+ * Once erased, a subsequent erase() of the block completes without communicating with the interface
+ * chip, so callers that know which pages they will need next (such as a log approaching a page boundary)
+ * can avoid waiting for the erase. Any data in the given blocks is lost.
+ * 
+ * @param address the logical address of the first block to erase. Must be block aligned.
+ * @param length the number of 32-bit words to erase. Defaults to a single block.
+ * 
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the region is not block aligned or out of range,
+ * DEVICE_I2C_ERROR if the geometry could not be read,
+ * or DEVICE_NOT_SUPPORTED if the scheduler is not running.
+ */
+int MicroBitUSBFlashManager::eraseAhead(uint32_t address, uint32_t length)
+{
+    // Ensure we know the device geometry
+    getGeometry();
+
+    if (!(status & MICROBIT_USB_FLASH_GEOMETRY_LOADED))
+        return DEVICE_I2C_ERROR;
+
+    // Convert length parameter from 32-bit count to a byte count.
+    length = length ? length * sizeof(uint32_t) : geometry.blockSize;
+
+    // Only blocks that fit in the bitmap can be queued.
+    uint32_t blocks = min((int) geometry.blockCount, MICROBIT_USB_FLASH_MAX_BLOCKS);
+
+    if (address % geometry.blockSize != 0 || length % geometry.blockSize != 0 || length > geometry.blockSize * blocks || address > geometry.blockSize * blocks - length)
+        return DEVICE_INVALID_PARAMETER;
+
+    // The erase is performed by a message bus listener, so we need the scheduler to be running.
+    if (!fiber_scheduler_running() || EventModel::defaultEventBus == NULL)
+        return DEVICE_NOT_SUPPORTED;
+
+    for (uint32_t block = address / geometry.blockSize; block < (address + length) / geometry.blockSize; block++)
+    {
+        if (!isErased(block * geometry.blockSize))
+            eraseAheadBlocks[block / 8] |= (1 << (block % 8));
+    }
+
+    if (!(status & MICROBIT_USB_FLASH_ERASE_AHEAD_LISTENING))
+    {
+        EventModel::defaultEventBus->listen(id, MICROBIT_USB_FLASH_EVT_ERASE_AHEAD, this, &MicroBitUSBFlashManager::onEraseAhead);
+        status |= MICROBIT_USB_FLASH_ERASE_AHEAD_LISTENING;
+    }
+
+    if (!(status & MICROBIT_USB_FLASH_ERASE_AHEAD_RUNNING))
+    {
+        status |= MICROBIT_USB_FLASH_ERASE_AHEAD_RUNNING;
+        Event(id, MICROBIT_USB_FLASH_EVT_ERASE_AHEAD);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if a physical block in the USB file storage area is known to be erased,
+ * as a result of an earlier erase() or eraseAhead() with no write to the block since.
+ * 
+ * @param address the logical address of the block.
+ * 
+ * @return true if the block is known to be erased, false otherwise.
+ */
+bool MicroBitUSBFlashManager::isErased(uint32_t address)
+{
+    // Blocks are only ever marked as erased once the geometry is known.
+    if (!(status & MICROBIT_USB_FLASH_GEOMETRY_LOADED))
+        return false;
+
+    uint32_t block = address / geometry.blockSize;
+
+    return block < MICROBIT_USB_FLASH_MAX_BLOCKS && (erasedBlocks[block / 8] & (1 << (block % 8)));
+}
+
+/**
+ * Erases the inclusive range of physical blocks given, batching them into a single transaction if permitted.
+ * Blocks already known to be erased are skipped. The caller must hold the transaction lock.
+ * @param eraseStart The logical address of the first block to erase.
+ * @param eraseEnd The logical address of the last block to erase.
+ * @return DEVICE_OK on success, or DEVICE_I2C_ERROR.
+ */
+int MicroBitUSBFlashManager::eraseBlocks(uint32_t eraseStart, uint32_t eraseEnd)
+{
+    ManagedBuffer request(8);
+    ManagedBuffer response;
+
+    uint32_t page = eraseStart;
+
+    while (page <= eraseEnd)
+    {
+        if (isErased(page))
+        {
+            page += geometry.blockSize;
+            continue;
+        }
+
+        // Extend the erase over as many following blocks as we can.
+        uint32_t last = page;
+
+        if (!(status & MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY))
+        {
+            while (last + geometry.blockSize <= eraseEnd && !isErased(last + geometry.blockSize))
+                last += geometry.blockSize;
+        }
+
+        uint32_t *p = (uint32_t *) &request[0];
+        *p++ = htonl(page | (MICROBIT_USB_FLASH_ERASE_CMD << 24));
+        *p++ = htonl(last);
+
+        response = exchange(request, 1);
+        if (response.length() == 0)
+        {
+            DMESG("ERROR ERASING");
+            return DEVICE_I2C_ERROR;
+        }
+
+        setErased(page, last + geometry.blockSize - page, true);
+        page = last + geometry.blockSize;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Updates the erased and erase ahead state of the blocks overlapping the given region.
+ * @param address The logical address of the start of the region.
+ * @param length The length of the region in bytes.
+ * @param erased true if the blocks have been erased, false if they may hold data.
+ */
+void MicroBitUSBFlashManager::setErased(uint32_t address, uint32_t length, bool erased)
+{
+    // Nothing is recorded about any block until the geometry is known.
+    if (!(status & MICROBIT_USB_FLASH_GEOMETRY_LOADED) || length == 0)
+        return;
+
+    for (uint32_t block = address / geometry.blockSize; block <= (address + length - 1) / geometry.blockSize && block < MICROBIT_USB_FLASH_MAX_BLOCKS; block++)
+    {
+        uint8_t mask = 1 << (block % 8);
+
+        eraseAheadBlocks[block / 8] &= ~mask;
+
+        if (erased)
+            erasedBlocks[block / 8] |= mask;
+        else
+            erasedBlocks[block / 8] &= ~mask;
+    }
+}
+
+/**
+ * Background eraser. Erases the blocks queued by eraseAhead(), releasing the transaction lock between each batch.
+ */
+void MicroBitUSBFlashManager::onEraseAhead(Event)
+{
+    while (true)
+    {
+        // Blocks queued are checked with the lock held, so that no other fiber can write to them before they're erased.
+        lock(MICROBIT_USB_FLASH_ERASE_CMD);
+
+        int blocks = min((int) geometry.blockCount, MICROBIT_USB_FLASH_MAX_BLOCKS);
+        int first = -1;
+        for (int block = 0; block < blocks; block++)
+        {
+            if (eraseAheadBlocks[block / 8] & (1 << (block % 8)))
+            {
+                first = block;
+                break;
+            }
+        }
+
+        if (first < 0)
+        {
+            status &= ~MICROBIT_USB_FLASH_ERASE_AHEAD_RUNNING;
+            transactionLock.notify();
+            return;
+        }
+
+        int last = first;
+        if (!(status & MICROBIT_USB_FLASH_SINGLE_PAGE_ERASE_ONLY))
+        {
+            while (last + 1 < blocks && (eraseAheadBlocks[(last + 1) / 8] & (1 << ((last + 1) % 8))))
+                last++;
+        }
+
+        // Dequeue the batch. Any blocks that fail to erase will be erased on demand instead.
+        for (int block = first; block <= last; block++)
+            eraseAheadBlocks[block / 8] &= ~(1 << (block % 8));
+
+        eraseBlocks(first * geometry.blockSize, last * geometry.blockSize);
+
+        transactionLock.notify();
+
+        // Let any other users of the interface chip run before erasing the next batch.
+        schedule();
+    }
+}
+
 /**
  * Determines the logical address of the start of non-volatile memory region
  * 
@@ -551,6 +756,21 @@ MicroBitUSBFlashManager::getFlashSize()
  * @return a buffer containing the response to the request, or a zero length buffer on failure.
  */
 ManagedBuffer MicroBitUSBFlashManager::transact(ManagedBuffer request, int responseLength)
+{
+    lock(request[0]);
+    ManagedBuffer response = exchange(request, responseLength);
+    transactionLock.notify();
+
+    return response;
+}
+
+/**
+ * Performs a flash storage transaction with the interface chip. The caller must hold the transaction lock.
+ * @param packet The data to write to the interface chip as a request operation.
+ * @param responseLength The length of the expected reponse packet.
+ * @return a buffer containing the response to the request, or a zero length buffer on failure.
+ */
+ManagedBuffer MicroBitUSBFlashManager::exchange(ManagedBuffer request, int responseLength)
 {
     power.nop();
 
@@ -577,6 +797,11 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
 
     ManagedBuffer b(max(responseLength, 3));
 
+    // Statistics of this transaction, for instrumentation.
+    MicroBitUSBInterfaceStatistics transaction;
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+    transaction.clear();
+
     while(tx_attempts < MICROBIT_USB_FLASH_MAX_TX_RETRIES)
     {
         rx_attempts = 0;
@@ -587,21 +812,21 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
         if (i2cBus.write(MICROBIT_USB_FLASH_I2C_ADDRESS, &request[0], request.length(), false) != DEVICE_OK)
         {
             DMESG("TRANSACT: [I2C WRITE ERROR]");
+            transaction.i2cErrors++;
             fiber_sleep(1);
             continue;
         }
 
         // if we have an erase request, ensure sufficient time is left to process it before checking for a response.
-        // (DAPLink workaround)
-        if (request[0] == MICROBIT_USB_FLASH_ERASE_CMD)
+        // (DAPLink workaround). Interface chips that report their busy status may instead be polled until the erase completes.
+        if (request[0] == MICROBIT_USB_FLASH_ERASE_CMD && !(status & MICROBIT_USB_FLASH_POLL_ERASE))
             fiber_sleep(status & MICROBIT_USB_FLASH_100MS_AFTER_ERASE ? 100 : 20);
-        else
-            fiber_sleep(1);
+
+        // Other requests are normally answered quickly, so poll for a response without sleeping for a short while.
+        CODAL_TIMESTAMP sent = system_timer_current_time_us();
 
         while(rx_attempts < MICROBIT_USB_FLASH_MAX_RX_RETRIES)
         {
-            rx_attempts++;
-
             if(io.irq1.isActive())
             {
                 b.fill(0);
@@ -614,6 +839,9 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
                         // We have a valid response. Consume it, and we're done.
                         power.awaitingPacket(false);
                         b.truncate(responseLength);
+
+                        transaction.retries = tx_attempts - 1;
+                        recordTransaction(request[0], transaction, start, true);
                         return b;
                     }
                     else
@@ -624,7 +852,10 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
                         bool busy = (status & MICROBIT_USB_FLASH_BUSY_FLAG_SUPPORTED) ? b[0] == 0x20 && b[1] == 0x39 : b[0] == 0x00 || (b[0] == 0x20 && (b[1] == request[0] || b[1] == 0x00));
 
                         if (busy)
+                        {
                             rx_attempts = 0;
+                            transaction.busy++;
+                        }
                         else
                             break;
                     }
@@ -632,16 +863,33 @@ ManagedBuffer MicroBitUSBFlashManager::_transact(ManagedBuffer request, int resp
                 else
                 {
                     DMESG("TRANSACT: [I2C READ ERROR: %d]",r);
+                    transaction.i2cErrors++;
                     break;
                 }
             }
+            else
+            {
+                transaction.polls++;
+            }
 
-            fiber_sleep(1);
+            if (system_timer_current_time_us() - sent < MICROBIT_USB_FLASH_POLL_TIME)
+            {
+                i2cBus.wait(MICROBIT_USB_FLASH_POLL_PERIOD, MICROBIT_I2C_PRIORITY_STORAGE);
+            }
+            else
+            {
+                rx_attempts++;
+                fiber_sleep(1);
+            }
         }
     }
 
     DMESG("USB_FLASH: Transaction Failed.");
     power.awaitingPacket(false);
+
+    transaction.retries = tx_attempts - 1;
+    recordTransaction(request[0], transaction, start, false);
+
     return ManagedBuffer();
 }
 
@@ -659,10 +907,90 @@ ManagedBuffer MicroBitUSBFlashManager::transact(int command)
     return transact(request, usbFlashPropertyLength.get(command));
 }
 
+/**
+ * Acquires the transaction lock, recording the time spent waiting for other users of the interface chip.
+ * @param command The command code of the transaction to be performed.
+ */
+void MicroBitUSBFlashManager::lock(int command)
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+    transactionLock.wait();
+
+    uint32_t time = system_timer_current_time_us() - start;
+    statistics[0].waitTime += time;
+
+    if (command > 0 && command <= MICROBIT_USB_FLASH_ERASE_CMD)
+        statistics[command].waitTime += time;
+#else
+    transactionLock.wait();
+#endif
+}
+
+/**
+ * Records the statistics of a completed transaction with the interface chip.
+ * @param command The command code of the transaction.
+ * @param transaction The retries, polls, busy responses, errors and wait time of the transaction.
+ * @param start The time at which the transaction started (microseconds).
+ * @param success true if a valid response was received, false otherwise.
+ */
+void MicroBitUSBFlashManager::recordTransaction(int command, const MicroBitUSBInterfaceStatistics &transaction, CODAL_TIMESTAMP start, bool success)
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    uint32_t time = system_timer_current_time_us() - start;
+    statistics[0].add(transaction, time, success);
+
+    if (command > 0 && command <= MICROBIT_USB_FLASH_ERASE_CMD)
+        statistics[command].add(transaction, time, success);
+#endif
+}
+
+/**
+ * Determines the statistics recorded for transactions with the interface chip.
+ * Statistics are only recorded if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS is enabled.
+ * 
+ * @param command the command code of the transactions (e.g. MICROBIT_USB_FLASH_READ_CMD), or zero for the total of all commands.
+ * 
+ * @return the statistics, or NULL if none are recorded for the given command.
+ */
+const MicroBitUSBInterfaceStatistics *MicroBitUSBFlashManager::getStatistics(int command)
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    if (command >= 0 && command <= MICROBIT_USB_FLASH_ERASE_CMD)
+        return &statistics[command];
+#endif
+
+    return NULL;
+}
+
+/**
+ * Resets the statistics recorded for transactions with the interface chip.
+ */
+void MicroBitUSBFlashManager::resetStatistics()
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    for (int i = 0; i <= MICROBIT_USB_FLASH_ERASE_CMD; i++)
+        statistics[i].clear();
+#endif
+}
+
+/**
+ * Outputs the statistics recorded for transactions with the interface chip over DMESG.
+ */
+void MicroBitUSBFlashManager::printStatistics()
+{
+#if CONFIG_MICROBIT_USB_INTERFACE_STATISTICS
+    for (int i = 0; i <= MICROBIT_USB_FLASH_ERASE_CMD; i++)
+        statistics[i].dmesg("USB_FLASH", i);
+#endif
+}
+
 /**
  * Destructor.
  */
 MicroBitUSBFlashManager::~MicroBitUSBFlashManager()
 {
+    if (status & MICROBIT_USB_FLASH_ERASE_AHEAD_LISTENING)
+        EventModel::defaultEventBus->ignore(id, MICROBIT_USB_FLASH_EVT_ERASE_AHEAD, this, &MicroBitUSBFlashManager::onEraseAhead);
 
 }
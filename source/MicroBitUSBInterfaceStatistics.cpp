@@ -0,0 +1,85 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitUSBInterfaceStatistics.h"
+#include "CodalDmesg.h"
+#include <string.h>
+
+/**
+ * Resets all statistics to zero.
+ */
+void MicroBitUSBInterfaceStatistics::clear()
+{
+    memset(this, 0, sizeof(MicroBitUSBInterfaceStatistics));
+}
+
+/**
+ * Adds the statistics of a completed transaction.
+ *
+ * @param transaction the retries, polls, busy responses, errors and wait time of the transaction.
+ * @param time the duration of the transaction.
+ * @param success true if a valid response was received, false otherwise.
+ */
+void MicroBitUSBInterfaceStatistics::add(const MicroBitUSBInterfaceStatistics &transaction, uint32_t time, bool success)
+{
+    count++;
+
+    if (!success)
+        failures++;
+
+    i2cErrors += transaction.i2cErrors;
+    retries += transaction.retries;
+    polls += transaction.polls;
+    busy += transaction.busy;
+    waitTime += transaction.waitTime;
+    totalTime += time;
+
+    if (time > maxTime)
+        maxTime = time;
+
+    int bucket = 0;
+    while (bucket < MICROBIT_USB_INTERFACE_LATENCY_BUCKETS - 1 && time >= ((uint32_t) MICROBIT_USB_INTERFACE_LATENCY_BASE << bucket))
+        bucket++;
+
+    latency[bucket]++;
+}
+
+/**
+ * Outputs the statistics over DMESG, if there is anything to report.
+ *
+ * @param name a name identifying the component.
+ * @param command the command code the statistics relate to, or zero for the total of all commands.
+ */
+void MicroBitUSBInterfaceStatistics::dmesg(const char *name, int command) const
+{
+    if (count == 0)
+        return;
+
+    DMESG("%s [CMD: %d] [COUNT: %d] [FAIL: %d] [I2C_ERR: %d] [RETRY: %d] [POLL: %d] [BUSY: %d] [WAIT: %d] [AVG: %d] [MAX: %d]",
+        name, command, count, failures, i2cErrors, retries, polls, busy, waitTime, totalTime / count, maxTime);
+
+    DMESG("%s [CMD: %d] [LATENCY: %d %d %d %d %d %d %d %d %d %d %d %d]", name, command,
+        latency[0], latency[1], latency[2], latency[3], latency[4], latency[5],
+        latency[6], latency[7], latency[8], latency[9], latency[10], latency[11]);
+}
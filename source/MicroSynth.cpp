@@ -23,23 +23,25 @@ SOFTWARE.
 */
 
 #include "MicroSynth.h"
+#include "AudioBufferPool.h"
 
 #if CONFIG_ENABLED(CODAL_POLYSYNTH)
 
 #include <limits>
 #include <cstring>
 
-bool SynthTables::inited_ = false;
-float SynthTables::notetab_[129];
+// Reads the CPU cycle counter, used to keep rendering within its cycle budget.
+static inline uint32_t synth_cycles()
+{
+#ifdef DWT
+    return DWT->CYCCNT;
+#else
+    return 0;
+#endif
+}
 
 void SynthTables::init()
 {
-    // singletons are bad, but assume no race conditions, true for microbit use
-    if (inited_) return;
-    for (int i = 0; i < 128; ++i)
-        notetab_[i] = powf(2.f, (i - 69)/12.f);
-    notetab_[128] = notetab_[127];
-    inited_ = true;
 }
 
 inline float SynthTables::noteToScaler(float ind)
@@ -49,37 +51,45 @@ inline float SynthTables::noteToScaler(float ind)
     return (1.f - frac)*notetab_[i] + frac*notetab_[i + 1];
 }
 
-inline float StateVariableFilter::tan(float x)
+int SynthTables::wavetableLevel(float delta)
 {
-    // x in range from 0 up to somewhat below 0.5 (gets mutiplied by pi here)
-    // From Mutable Instruments:
-    // https://github.com/pichenettes/stmlib/blob/master/dsp/filter.h
-    // This is for 48 kHz, but works well for 44.1 as well.
-    const float pi_two = _PI*_PI;
-    const float pi_three = pi_two*_PI;
-    const float pi_five = pi_three*pi_two;
-    const float a = 3.260e-01f*pi_three;
-    const float b = 1.823e-01f*pi_five;
-    const float f2 = x*x;
-    return x*(_PI + f2*(a + b*f2));
+    // a full cycle spans a phase of 2, so 1/delta harmonics fit below nyquist
+    int level = 0;
+    while (level < SynthWavetableLevels - 1 && ((SynthWavetableSize/2) >> level)*delta > 1.f)
+        ++level;
+    return level;
 }
 
-StateVariableFilter::StateVariableFilter()
+StateVariableFilter::StateVariableFilter() : g_(0.f), g1_(2.f), d_(1.f), tg_(0.f), tg1_(2.f), td_(1.f), cutoff_(0.f), res_(0.f)
 {
     reset();
 }
 
 inline void StateVariableFilter::set(float cutoff, float res)
 {
-    // cutoff should be clipped, but we know we'll never exceed limits
-    const float r = 1.f - res;
-    g_ = tan(cutoff);
-    g1_ = 2.f*r + g_;
-    d_ = 1.f/(1.f + 2.f*r*g_ + g_*g_);
+    if (cutoff != cutoff_ || res != res_) {
+        cutoff_ = cutoff;
+        res_ = res;
+        // interpolate tan() from the table. cutoff should be clipped, but we know we'll never exceed limits
+        const float pos = min(max(cutoff, 0.f), 0.5f)*(2*SynthFilterTableSize);
+        const int i = min(static_cast<int>(pos), SynthFilterTableSize - 1);
+        const float frac = pos - i;
+        const float g = (1.f - frac)*SynthTables::svftab_[i] + frac*SynthTables::svftab_[i + 1];
+        const float r = 1.f - res;
+        tg_ = g;
+        tg1_ = 2.f*r + g;
+        td_ = 1.f/(1.f + 2.f*r*g + g*g);
+    }
+    if (!ramp_) {
+        g_ = tg_; g1_ = tg1_; d_ = td_;
+        ramp_ = true;
+    }
 }
 
 inline float StateVariableFilter::process(float x, FilterType f)
 {
+    // per sample use applies new coefficients immediately
+    g_ = tg_; g1_ = tg1_; d_ = td_;
     const float hp = (x - g1_*s1_ - s2_)*d_;
     const float v1 = g_*hp;
     const float bp = v1 + s1_;
@@ -98,9 +108,51 @@ inline float StateVariableFilter::process(float x, FilterType f)
     }
 }
 
+// block version of process(), with the filter type resolved outside the sample loop.
+// coefficients ramp linearly from their current values to the targets across the block
+template <FilterType F>
+static void svf_block(float* buf, int num, float& g, float& g1, float& d, float tg, float tg1, float td, float& s1, float& s2)
+{
+    float z1 = s1, z2 = s2;
+    const float r = 1.f/num;
+    const float dg = (tg - g)*r, dg1 = (tg1 - g1)*r, dd = (td - d)*r;
+    for (int i = 0; i < num; ++i) {
+        g += dg; g1 += dg1; d += dd;
+        const float hp = (buf[i] - g1*z1 - z2)*d;
+        const float v1 = g*hp;
+        const float bp = v1 + z1;
+        z1 = bp + v1;
+        const float v2 = g*bp;
+        const float lp = v2 + z2;
+        z2 = lp + v2;
+        buf[i] = F == FilterType::HPF ? hp : F == FilterType::BPF ? bp : lp;
+    }
+    // land exactly on the targets, free of accumulated rounding
+    g = tg; g1 = tg1; d = td;
+    s1 = z1;
+    s2 = z2;
+}
+
+void StateVariableFilter::process(float* buf, int num, FilterType f)
+{
+    switch (f) {
+    case FilterType::LPF:
+    default:
+        svf_block<FilterType::LPF>(buf, num, g_, g1_, d_, tg_, tg1_, td_, s1_, s2_);
+        break;
+    case FilterType::BPF:
+        svf_block<FilterType::BPF>(buf, num, g_, g1_, d_, tg_, tg1_, td_, s1_, s2_);
+        break;
+    case FilterType::HPF:
+        svf_block<FilterType::HPF>(buf, num, g_, g1_, d_, tg_, tg1_, td_, s1_, s2_);
+        break;
+    }
+}
+
 void StateVariableFilter::reset()
 {
     s1_ = s2_ = 0.f;
+    ramp_ = false;
 }
 
 ADSREnv::ADSREnv()
@@ -108,7 +160,7 @@ ADSREnv::ADSREnv()
     reset();
 }
 
-inline float ADSREnv::process()
+inline float ADSREnv::process(int num)
 {
     if (state_ == State::Done) return 0.f;
     if (phase_ >= 1.f) {
@@ -116,12 +168,18 @@ inline float ADSREnv::process()
         // yeah, maybe enum class isn't the right choice
         int next_state = static_cast<int>(state_) + 1;
         state_ = static_cast<State>(next_state);
+        if (state_ == State::Done) {
+            cur_ = 0.f;
+            return cur_;
+        }
         start_val_ = levels_[next_state];
         phase_inc_ = inc_[static_cast<int>(state_)];
     }
-    phase_ += phase_inc_;
+    // when advancing by more than one sample, hold at the end of the segment until the next call
+    phase_ += phase_inc_*num;
+    const float phase = phase_ > 1.f ? 1.f : phase_;
 
-    cur_ = start_val_ + (levels_[static_cast<int>(state_) + 1] - start_val_)*phase_;
+    cur_ = start_val_ + (levels_[static_cast<int>(state_) + 1] - start_val_)*phase;
     return cur_;
 }
 
@@ -162,49 +220,73 @@ inline float ADSREnv::value() const
     return cur_;
 }
 
+inline float Oscillator::lookup(float phase) const
+{
+    // phase in range [-1, 1] maps onto a whole table. guard point covers phase == 1
+    const float pos = (phase + 1.f)*(SynthWavetableSize/2);
+    const int i = static_cast<int>(pos);
+    const float frac = pos - i;
+    return ((1.f - frac)*table_[i] + frac*table_[i + 1])*(1.f/16384.f);
+}
+
+inline float Oscillator::output(float phase) const
+{
+    if (wave_ != OscType::Pulse) return lookup(phase);
+    // pulse is the difference of two saws, offset by the pulse width. this also carries
+    // the same dc correction as the naive pulse
+    float shifted = phase + 1.f - pw_;
+    if (shifted >= 1.f) shifted -= 2.f;
+    else if (shifted < -1.f) shifted += 2.f;
+    return lookup(phase) - lookup(shifted);
+}
+
+void Oscillator::select_table()
+{
+    const int level = SynthTables::wavetableLevel(fabsf(delta_));
+    table_ = wave_ == OscType::Triangle ? SynthTables::tritab_[level] : SynthTables::sawtab_[level];
+}
+
 inline float Oscillator::process()
 {
-    float out = acc_;
+    float out = output(acc_);
     acc_ += delta_;
     // wrap phase back to [0, 1]. assumes delta is within proper bounds, or we'd need a while loop
     if (acc_ > 1.f) acc_ -= 2.f;
-    switch (wave_) {
-    case OscType::Saw:
-        return out;
-    case OscType::Pulse:
-        return (out > pw_ ? 1.f : -1.f) + pw_;  // remove dc offset
-    case OscType::Triangle:
-    default:
-        return fabsf(out)*2.f - 1.f;
-    }
+    return out;
 }
 
 inline float Oscillator::processPM(float pm)
 {
-    float out = acc_;
+    float out = output(acc_);
     acc_ += delta_ + pm;
     // same as in process(), but now delta can also be negative due to modulation
     if (acc_ > 1.f) acc_ -= 2.f;
     else if (acc_ < -1.f) acc_ += 2.f;
-    switch (wave_) {
-    case OscType::Saw:
-        return out;
-    case OscType::Pulse:
-        return (out > pw_ ? 1.f : -1.f) + pw_;
-    case OscType::Triangle:
-    default:
-        return fabsf(out)*2.f - 1.f;
-    }
+    return out;
+}
+
+void Oscillator::process(float* buf, int num)
+{
+    for (int i = 0; i < num; ++i)
+        buf[i] = process();
+}
+
+void Oscillator::processPM(float* buf, const float* pm, float amount, int num)
+{
+    for (int i = 0; i < num; ++i)
+        buf[i] = processPM(amount*pm[i]);
 }
 
 inline void Oscillator::setFreq(float f)
 {
     delta_ = 2.f*f/SynthSampleRate_f;
+    select_table();
 }
 
 void Oscillator::setType(OscType t)
 {
     wave_ = t;
+    select_table();
 }
 
 inline void Oscillator::setPW(float pw)
@@ -219,7 +301,7 @@ void Voice::apply_preset()
     osc_[0].setPW(p.osc1Pw); osc_[1].setPW(p.osc2Pw);
     osc_[0].setType(p.osc1Shape); osc_[1].setType(p.osc2Shape);
     lfo_.setType(p.lfoShape);
-    lfo_.setFreq(preset_->lfoFreq*SynthBlockSize);
+    lfo_.setFreq(preset_->lfoFreq*SynthControlBlockSize);
     env_.set(p.envA, p.envD, p.envS, p.envR);
     filter_.set(p.filterCutoff, p.filterReso);
 }
@@ -237,26 +319,9 @@ Voice::Voice()
     vibLfo_.setType(OscType::Triangle);
 }
 
-inline float Voice::process()
+void Voice::update_controls()
 {
-    const float env = env_.process();
-    const float osc1 = osc_[0].process();
-    const float gate = stopping_ ? 0.f : 1.f;
-
-    smoothedGate_ += (gate - smoothedGate_)*0.005f;
-    const float amp_env = preset_->ampGate ? smoothedGate_ : env;
-    auto oscs = osc1*preset_->osc1Vol + osc_[1].processPM(preset_->fmAmount*osc1)*preset_->osc2Vol;
-    noise_ = 1664525*noise_ + 1013904223;
-    const float noise = preset_->noise*noise_*1.f/std::numeric_limits<int32_t>::max();
-    auto out = gain_*amp_env*filter_.process(oscs + noise, preset_->filterType);
-    return out;
-}
-
-void Voice::process(float* buf, int num)
-{
-    if (preset_ == nullptr) return;
     const float lfo = lfo_.process();
-    vibLfo_.setFreq(preset_->vibFreq*SynthBlockSize);
     const float vib = vibLfo_.process()*preset_->vibAmount;
     const float lfo_flt = preset_->filterLfo*lfo*40.f;
     const float env_flt = preset_->filterEnv*env_.value()*80.f;
@@ -267,11 +332,52 @@ void Voice::process(float* buf, int num)
     filter_.set(filt_freq, preset_->filterReso);
     osc_[0].setPW(preset_->osc1Pw + preset_->osc1Pwm*lfo);
     osc_[1].setPW(preset_->osc2Pw + preset_->osc2Pwm*lfo);
+}
+
+void Voice::render(float* buf, int num)
+{
+    const SynthPreset& p = *preset_;
+    float osc1[SynthControlBlockSize];
+    float mix[SynthControlBlockSize];
+
+    osc_[0].process(osc1, num);
+    osc_[1].processPM(mix, osc1, p.fmAmount, num);
+    const float noise_scale = p.noise*(1.f/std::numeric_limits<int32_t>::max());
     for (int i = 0; i < num; ++i) {
-        buf[i] += process();
+        noise_ = 1664525u*noise_ + 1013904223u;
+        mix[i] = osc1[i]*p.osc1Vol + mix[i]*p.osc2Vol + static_cast<int32_t>(noise_)*noise_scale;
+    }
+    filter_.process(mix, num, p.filterType);
+
+    // amplitude is the envelope or smoothed gate, ramped linearly across the block
+    const float env_start = env_.value();
+    const float env_end = env_.process(num);
+    const float gate = stopping_ ? 0.f : 1.f;
+    const float gate_start = smoothedGate_;
+    // equivalent to running smoothedGate_ += (gate - smoothedGate_)*0.005f once per sample
+    const float decay = num == SynthControlBlockSize ? 0.922931f : powf(0.995f, static_cast<float>(num));
+    smoothedGate_ = gate + (smoothedGate_ - gate)*decay;
+    const float start = p.ampGate ? gate_start : env_start;
+    const float end = p.ampGate ? smoothedGate_ : env_end;
+
+    float amp = gain_*start;
+    const float step = gain_*(end - start)/num;
+    for (int i = 0; i < num; ++i) {
+        amp += step;
+        buf[i] += mix[i]*amp;
+    }
+}
+
+void Voice::process(float* buf, int num)
+{
+    if (preset_ == nullptr) return;
+    vibLfo_.setFreq(preset_->vibFreq*SynthControlBlockSize);
+    for (int i = 0; i < num; i += SynthControlBlockSize) {
+        update_controls();
+        render(buf + i, min(num - i, SynthControlBlockSize));
     }
     // check if it's time to move amp envelope to release
-    if (gateLength_ >= 0) gateLength_ -= min(gateLength_, SynthBlockSize);
+    if (gateLength_ >= 0) gateLength_ -= min(gateLength_, num);
     if (!stopping_ && gateLength_ == 0) detrig();
     // check if amp envelope has died out and deactivate voice if so
     if (env_.done() || (preset_->ampGate && smoothedGate_ < 1e-3)) note_ = -1;
@@ -306,6 +412,18 @@ bool Voice::isStopping() const
     return stopping_;
 }
 
+float Voice::getLevel() const
+{
+    if (note_ == -1) return 0.f;
+    return gain_*(preset_->ampGate ? smoothedGate_ : env_.value());
+}
+
+void Voice::kill()
+{
+    env_.reset();
+    note_ = -1;
+}
+
 int PolySynth::findVoice(int8_t note)
 {
     for (int i = 0; i < numVoices_; ++i) {
@@ -314,25 +432,110 @@ int PolySynth::findVoice(int8_t note)
     return -1;
 }
 
+int PolySynth::countVoices() const
+{
+    int active = 0;
+    for (int i = 0; i < numVoices_; ++i) {
+        if (voice_[i].getNote() != -1) ++active;
+    }
+    return active;
+}
+
+int PolySynth::steal() const
+{
+    // prefer voices already releasing, then the quietest, then the oldest
+    int best = -1;
+    for (int i = 0; i < numVoices_; ++i) {
+        const Voice& v = voice_[i];
+        if (v.getNote() == -1) continue;
+        if (best == -1) { best = i; continue; }
+        const Voice& b = voice_[best];
+        if (v.isStopping() != b.isStopping()) {
+            if (v.isStopping()) best = i;
+            continue;
+        }
+        const float lv = v.getLevel(), lb = b.getLevel();
+        if (lv < lb || (lv == lb && started_[i] - started_[best] > 0x80000000u)) best = i;
+    }
+    return best == -1 ? 0 : best;
+}
+
 Voice& PolySynth::alloc(int /*note*/)
 {
-    // find first free note
+    // find first free note, as long as we're within the current polyphony
+    int free = -1;
+    int active = 0;
     for (int i = 0; i < numVoices_; ++i) {
-        if (voice_[i].getNote() == -1) return voice_[i];
+        if (voice_[i].getNote() != -1) ++active;
+        else if (free == -1) free = i;
     }
-    // or else we steal the first voice. should probably do something better...
-    return voice_[0];
+    int ind = free != -1 && active < polyphony_ ? free : steal();
+    started_[ind] = serial_++;
+    return voice_[ind];
 }
 
-PolySynth::PolySynth(int num_voices) : numVoices_(num_voices)
+PolySynth::PolySynth(int num_voices) : numVoices_(num_voices), polyphony_(num_voices), cycleBudget_(CONFIG_POLYSYNTH_CYCLE_BUDGET)
 {
     voice_ = new Voice[numVoices_];
-    SynthTables::init();
+    started_ = new uint32_t[numVoices_]();
+#ifdef DWT
+    // ensure the cycle counter is running
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 }
 
 PolySynth::~PolySynth()
 {
     delete[] voice_;
+    delete[] started_;
+}
+
+void PolySynth::setCycleBudget(uint32_t cycles)
+{
+    cycleBudget_ = cycles;
+    voiceCycles_ = 0;
+    if (cycles == 0) polyphony_ = numVoices_;
+}
+
+uint32_t PolySynth::getCycleBudget() const
+{
+    return cycleBudget_;
+}
+
+int PolySynth::getPolyphony() const
+{
+    return polyphony_;
+}
+
+int PolySynth::getActiveVoices() const
+{
+    return countVoices();
+}
+
+uint32_t PolySynth::getLastCycles() const
+{
+    return lastCycles_;
+}
+
+void PolySynth::adapt(uint32_t cycles, int active, int num)
+{
+    if (cycleBudget_ == 0 || cycles == 0 || active == 0 || num == 0) return;
+
+    // track the cost of a single voice for a whole block, to predict how many fit in the budget
+    const uint32_t per_voice = static_cast<uint32_t>(static_cast<uint64_t>(cycles)*SynthBlockSize/num/active);
+    voiceCycles_ = voiceCycles_ ? (voiceCycles_*7 + per_voice)/8 : per_voice;
+    const int fit = max(1, min(numVoices_, static_cast<int>(cycleBudget_/max(voiceCycles_, 1u))));
+    const uint32_t budget = static_cast<uint32_t>(static_cast<uint64_t>(cycleBudget_)*num/SynthBlockSize);
+
+    if (cycles > budget) {
+        // over budget: shed the least audible voices straight away
+        polyphony_ = max(1, min(fit, active - 1));
+        while (countVoices() > polyphony_) voice_[steal()].kill();
+    } else if (polyphony_ < fit) {
+        // grow back one voice at a time, so a single cheap block doesn't cause another overrun
+        ++polyphony_;
+    }
 }
 
 void PolySynth::noteOn(int8_t note, float velocity, float duration, const SynthPreset* preset)
@@ -350,6 +553,9 @@ void PolySynth::noteOff(int8_t note)
 
 void PolySynth::process_noclip(float* buf, int num)
 {
+    const uint32_t start = synth_cycles();
+    int active = 0;
+
     // clear mixing buffer
     memset(buf, 0, num*sizeof(float));
 
@@ -357,7 +563,11 @@ void PolySynth::process_noclip(float* buf, int num)
         Voice& v = voice_[i];
         if (v.getNote() == -1) continue;
         v.process(buf, num);
+        ++active;
     }
+
+    lastCycles_ = synth_cycles() - start;
+    adapt(lastCycles_, active, num);
 }
 
 void PolySynth::process(float* buf, int num)
@@ -406,7 +616,7 @@ int PolySynthSource::getFormat()
 
 ManagedBuffer PolySynthSource::pull()
 {
-    ManagedBuffer buf(512);
+    ManagedBuffer buf = AudioBufferPool::getDefault().allocate(512);
     uint16_t* out = reinterpret_cast<uint16_t*>(&buf[0]);
     synth_.process(out, 256);
     downStream_->pullRequest();
@@ -0,0 +1,423 @@
+/*
+MIT License
+
+Copyright (c) 2022 Thom Johansen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "MicroSynth.h"
+
+#if CONFIG_ENABLED(CODAL_POLYSYNTH)
+
+/*
+ * Precalculated synthesizer tables, held in flash.
+ *
+ * notetab_[i] = 2^((i - 69)/12) for MIDI notes 0 to 127, plus a guard point.
+ *
+ * Each wavetable holds one period of SynthWavetableSize samples, plus a guard point for interpolation,
+ * in Q14 fixed point. Level k of each set contains the first (SynthWavetableSize/2) >> k harmonics only:
+ *
+ *   saw(p)      = -(2/pi) * sum(n = 1..h) sin(2*pi*n*p) / n
+ *   triangle(p) = (8/pi^2) * sum(odd n = 1..h) cos(2*pi*n*p) / n^2
+ *
+ * matching the phase of the naive oscillator waveforms, where p = (phase + 1) / 2.
+ *
+ * svftab_[i] holds the state variable filter gain g = tan(pi*c) for cutoff c = i/(2*SynthFilterTableSize),
+ * using the polynomial approximation from Mutable Instruments (https://github.com/pichenettes/stmlib),
+ * c*(pi + c^2*(0.326*pi^3 + 0.1823*pi^5*c^2)), which is tuned for 48 kHz but works well for 44.1 kHz too.
+ */
+
+const float SynthTables::notetab_[129] = {
+    0.0185813612f, 0.0196862664f, 0.0208568727f, 0.0220970869f, 0.0234110481f, 0.0248031414f,
+    0.026278013f, 0.0278405849f, 0.0294960723f, 0.03125f, 0.0331082217f, 0.035076939f,
+    0.0371627223f, 0.0393725328f, 0.0417137454f, 0.0441941738f, 0.0468220962f, 0.0496062829f,
+    0.052556026f, 0.0556811699f, 0.0589921445f, 0.0625f, 0.0662164434f, 0.070153878f,
+    0.0743254447f, 0.0787450656f, 0.0834274909f, 0.0883883476f, 0.0936441923f, 0.0992125657f,
+    0.105112052f, 0.11136234f, 0.117984289f, 0.125f, 0.132432887f, 0.140307756f,
+    0.148650889f, 0.157490131f, 0.166854982f, 0.176776695f, 0.187288385f, 0.198425131f,
+    0.210224104f, 0.22272468f, 0.235968578f, 0.25f, 0.264865774f, 0.280615512f,
+    0.297301779f, 0.314980262f, 0.333709964f, 0.353553391f, 0.374576769f, 0.396850263f,
+    0.420448208f, 0.445449359f, 0.471937156f, 0.5f, 0.529731547f, 0.561231024f,
+    0.594603558f, 0.629960525f, 0.667419927f, 0.707106781f, 0.749153538f, 0.793700526f,
+    0.840896415f, 0.890898718f, 0.943874313f, 1.f, 1.05946309f, 1.12246205f,
+    1.18920712f, 1.25992105f, 1.33483985f, 1.41421356f, 1.49830708f, 1.58740105f,
+    1.68179283f, 1.78179744f, 1.88774863f, 2.f, 2.11892619f, 2.2449241f,
+    2.37841423f, 2.5198421f, 2.66967971f, 2.82842712f, 2.99661415f, 3.1748021f,
+    3.36358566f, 3.56359487f, 3.77549725f, 4.f, 4.23785238f, 4.48984819f,
+    4.75682846f, 5.0396842f, 5.33935942f, 5.65685425f, 5.99322831f, 6.34960421f,
+    6.72717132f, 7.12718975f, 7.5509945f, 8.f, 8.47570475f, 8.97969639f,
+    9.51365692f, 10.0793684f, 10.6787188f, 11.3137085f, 11.9864566f, 12.6992084f,
+    13.4543426f, 14.2543795f, 15.101989f, 16.f, 16.9514095f, 17.9593928f,
+    19.0273138f, 20.1587368f, 21.3574377f, 22.627417f, 23.9729132f, 25.3984168f,
+    26.9086853f, 28.508759f, 28.508759f,
+};
+
+const int16_t SynthTables::sawtab_[SynthWavetableLevels][SynthWavetableSize + 1] = {
+    // 128 harmonics
+    {
+        0, -19188, -14536, -17084, -15052, -16402, -15067, -15959, -14948, -15598, -14774, -15275, -14574, -14973, -14357, -14683,
+        -14131, -14400, -13899, -14123, -13661, -13851, -13421, -13580, -13178, -13313, -12933, -13046, -12686, -12782, -12438, -12518,
+        -12190, -12255, -11940, -11993, -11690, -11731, -11439, -11471, -11188, -11210, -10936, -10950, -10684, -10690, -10432, -10431,
+        -10179, -10171, -9926, -9912, -9673, -9654, -9420, -9395, -9166, -9136, -8913, -8878, -8659, -8620, -8405, -8362,
+        -8151, -8104, -7897, -7846, -7643, -7588, -7389, -7330, -7135, -7073, -6880, -6815, -6626, -6557, -6371, -6300,
+        -6117, -6043, -5862, -5785, -5608, -5528, -5353, -5270, -5098, -5013, -4843, -4756, -4589, -4499, -4334, -4241,
+        -4079, -3984, -3824, -3727, -3569, -3470, -3315, -3213, -3060, -2956, -2805, -2699, -2550, -2442, -2295, -2185,
+        -2040, -1928, -1785, -1671, -1530, -1414, -1275, -1157, -1020, -900, -765, -643, -510, -386, -255, -129,
+        0, 129, 255, 386, 510, 643, 765, 900, 1020, 1157, 1275, 1414, 1530, 1671, 1785, 1928,
+        2040, 2185, 2295, 2442, 2550, 2699, 2805, 2956, 3060, 3213, 3315, 3470, 3569, 3727, 3824, 3984,
+        4079, 4241, 4334, 4499, 4589, 4756, 4843, 5013, 5098, 5270, 5353, 5528, 5608, 5785, 5862, 6043,
+        6117, 6300, 6371, 6557, 6626, 6815, 6880, 7073, 7135, 7330, 7389, 7588, 7643, 7846, 7897, 8104,
+        8151, 8362, 8405, 8620, 8659, 8878, 8913, 9136, 9166, 9395, 9420, 9654, 9673, 9912, 9926, 10171,
+        10179, 10431, 10432, 10690, 10684, 10950, 10936, 11210, 11188, 11471, 11439, 11731, 11690, 11993, 11940, 12255,
+        12190, 12518, 12438, 12782, 12686, 13046, 12933, 13313, 13178, 13580, 13421, 13851, 13661, 14123, 13899, 14400,
+        14131, 14683, 14357, 14973, 14574, 15275, 14774, 15598, 14948, 15959, 15067, 16402, 15052, 17084, 14536, 19188,
+        0,
+    },
+    // 64 harmonics
+    {
+        0, -14251, -19060, -16311, -14281, -15669, -16698, -15489, -14542, -15263, -15760, -14929, -14302, -14777, -15060, -14401,
+        -13928, -14275, -14442, -13882, -13499, -13768, -13862, -13367, -13044, -13259, -13302, -12853, -12573, -12748, -12755, -12339,
+        -12091, -12237, -12216, -11826, -11604, -11726, -11682, -11314, -11112, -11215, -11152, -10801, -10616, -10703, -10625, -10289,
+        -10118, -10192, -10100, -9776, -9618, -9680, -9576, -9264, -9117, -9168, -9054, -8752, -8614, -8656, -8534, -8240,
+        -8111, -8144, -8014, -7728, -7606, -7632, -7494, -7216, -7101, -7120, -6976, -6704, -6596, -6609, -6457, -6191,
+        -6090, -6097, -5940, -5679, -5583, -5585, -5422, -5167, -5076, -5073, -4905, -4655, -4569, -4561, -4388, -4143,
+        -4062, -4049, -3871, -3631, -3555, -3537, -3355, -3119, -3047, -3025, -2839, -2607, -2540, -2513, -2322, -2095,
+        -2032, -2001, -1806, -1583, -1524, -1489, -1290, -1071, -1016, -977, -774, -559, -508, -465, -258, -47,
+        0, 47, 258, 465, 508, 559, 774, 977, 1016, 1071, 1290, 1489, 1524, 1583, 1806, 2001,
+        2032, 2095, 2322, 2513, 2540, 2607, 2839, 3025, 3047, 3119, 3355, 3537, 3555, 3631, 3871, 4049,
+        4062, 4143, 4388, 4561, 4569, 4655, 4905, 5073, 5076, 5167, 5422, 5585, 5583, 5679, 5940, 6097,
+        6090, 6191, 6457, 6609, 6596, 6704, 6976, 7120, 7101, 7216, 7494, 7632, 7606, 7728, 8014, 8144,
+        8111, 8240, 8534, 8656, 8614, 8752, 9054, 9168, 9117, 9264, 9576, 9680, 9618, 9776, 10100, 10192,
+        10118, 10289, 10625, 10703, 10616, 10801, 11152, 11215, 11112, 11314, 11682, 11726, 11604, 11826, 12216, 12237,
+        12091, 12339, 12755, 12748, 12573, 12853, 13302, 13259, 13044, 13367, 13862, 13768, 13499, 13882, 14442, 14275,
+        13928, 14401, 15060, 14777, 14302, 14929, 15760, 15263, 14542, 15489, 16698, 15669, 14281, 16311, 19060, 14251,
+        0,
+    },
+    // 32 harmonics
+    {
+        0, -7904, -14204, -17875, -18802, -17722, -15846, -14315, -13773, -14208, -15110, -15827, -15924, -15376, -14512, -13790,
+        -13526, -13744, -14191, -14515, -14469, -14042, -13440, -12953, -12778, -12918, -13193, -13360, -13254, -12880, -12400, -12027,
+        -11896, -11996, -12180, -12260, -12120, -11778, -11370, -11064, -10960, -11035, -11161, -11186, -11023, -10702, -10342, -10082,
+        -9996, -10054, -10139, -10125, -9947, -9641, -9316, -9090, -9018, -9062, -9117, -9073, -8884, -8589, -8290, -8090,
+        -8029, -8063, -8094, -8027, -7828, -7542, -7265, -7087, -7034, -7060, -7071, -6984, -6777, -6499, -6241, -6080,
+        -6035, -6054, -6047, -5944, -5730, -5458, -5216, -5072, -5033, -5045, -5024, -4905, -4685, -4420, -4192, -4062,
+        -4029, -4035, -4000, -3868, -3642, -3382, -3168, -3050, -3023, -3024, -2976, -2832, -2601, -2346, -2144, -2038,
+        -2016, -2012, -1952, -1796, -1560, -1310, -1120, -1026, -1008, -1000, -928, -761, -520, -275, -96, -13,
+        0, 13, 96, 275, 520, 761, 928, 1000, 1008, 1026, 1120, 1310, 1560, 1796, 1952, 2012,
+        2016, 2038, 2144, 2346, 2601, 2832, 2976, 3024, 3023, 3050, 3168, 3382, 3642, 3868, 4000, 4035,
+        4029, 4062, 4192, 4420, 4685, 4905, 5024, 5045, 5033, 5072, 5216, 5458, 5730, 5944, 6047, 6054,
+        6035, 6080, 6241, 6499, 6777, 6984, 7071, 7060, 7034, 7087, 7265, 7542, 7828, 8027, 8094, 8063,
+        8029, 8090, 8290, 8589, 8884, 9073, 9117, 9062, 9018, 9090, 9316, 9641, 9947, 10125, 10139, 10054,
+        9996, 10082, 10342, 10702, 11023, 11186, 11161, 11035, 10960, 11064, 11370, 11778, 12120, 12260, 12180, 11996,
+        11896, 12027, 12400, 12880, 13254, 13360, 13193, 12918, 12778, 12953, 13440, 14042, 14469, 14515, 14191, 13744,
+        13526, 13790, 14512, 15376, 15924, 15827, 15110, 14208, 13773, 14315, 15846, 17722, 18802, 17875, 14204, 7904,
+        0,
+    },
+    // 16 harmonics
+    {
+        0, -4058, -7890, -11295, -14108, -16224, -17601, -18259, -18282, -17796, -16962, -15948, -14917, -14007, -13315, -12899,
+        -12765, -12882, -13182, -13582, -13990, -14323, -14516, -14533, -14364, -14032, -13580, -13068, -12560, -12115, -11778, -11575,
+        -11511, -11566, -11706, -11883, -12048, -12155, -12169, -12074, -11869, -11570, -11210, -10828, -10464, -10155, -9929, -9796,
+        -9755, -9788, -9868, -9958, -10026, -10039, -9978, -9833, -9611, -9329, -9012, -8693, -8400, -8161, -7991, -7896,
+        -7867, -7888, -7934, -7976, -7988, -7946, -7840, -7667, -7435, -7162, -6872, -6592, -6346, -6151, -6018, -5947,
+        -5927, -5940, -5963, -5972, -5944, -5865, -5727, -5533, -5294, -5028, -4758, -4507, -4294, -4133, -4028, -3975,
+        -3961, -3968, -3974, -3956, -3898, -3789, -3626, -3416, -3171, -2911, -2657, -2430, -2245, -2111, -2029, -1992,
+        -1983, -1985, -1975, -1935, -1852, -1716, -1532, -1306, -1056, -801, -562, -356, -196, -88, -27, -3,
+        0, 3, 27, 88, 196, 356, 562, 801, 1056, 1306, 1532, 1716, 1852, 1935, 1975, 1985,
+        1983, 1992, 2029, 2111, 2245, 2430, 2657, 2911, 3171, 3416, 3626, 3789, 3898, 3956, 3974, 3968,
+        3961, 3975, 4028, 4133, 4294, 4507, 4758, 5028, 5294, 5533, 5727, 5865, 5944, 5972, 5963, 5940,
+        5927, 5947, 6018, 6151, 6346, 6592, 6872, 7162, 7435, 7667, 7840, 7946, 7988, 7976, 7934, 7888,
+        7867, 7896, 7991, 8161, 8400, 8693, 9012, 9329, 9611, 9833, 9978, 10039, 10026, 9958, 9868, 9788,
+        9755, 9796, 9929, 10155, 10464, 10828, 11210, 11570, 11869, 12074, 12169, 12155, 12048, 11883, 11706, 11566,
+        11511, 11575, 11778, 12115, 12560, 13068, 13580, 14032, 14364, 14533, 14516, 14323, 13990, 13582, 13182, 12882,
+        12765, 12899, 13315, 14007, 14917, 15948, 16962, 17796, 18282, 18259, 17601, 16224, 14108, 11295, 7890, 4058,
+        0,
+    },
+    // 8 harmonics
+    {
+        0, -2043, -4054, -6004, -7863, -9605, -11207, -12648, -13912, -14988, -15868, -16551, -17039, -17338, -17458, -17415,
+        -17226, -16910, -16490, -15989, -15430, -14837, -14232, -13635, -13066, -12540, -12071, -11669, -11340, -11089, -10914, -10814,
+        -10782, -10811, -10890, -11008, -11153, -11312, -11471, -11620, -11746, -11840, -11893, -11901, -11860, -11766, -11622, -11430,
+        -11194, -10920, -10616, -10291, -9954, -9613, -9279, -8959, -8662, -8393, -8159, -7962, -7804, -7687, -7607, -7563,
+        -7550, -7561, -7591, -7632, -7678, -7719, -7750, -7763, -7753, -7716, -7647, -7546, -7411, -7244, -7046, -6822,
+        -6575, -6311, -6037, -5759, -5483, -5216, -4963, -4729, -4520, -4337, -4184, -4060, -3966, -3899, -3856, -3834,
+        -3828, -3833, -3841, -3849, -3849, -3837, -3807, -3756, -3680, -3577, -3447, -3289, -3105, -2898, -2671, -2429,
+        -2177, -1919, -1662, -1411, -1172, -949, -746, -567, -413, -286, -185, -110, -57, -25, -7, -1,
+        0, 1, 7, 25, 57, 110, 185, 286, 413, 567, 746, 949, 1172, 1411, 1662, 1919,
+        2177, 2429, 2671, 2898, 3105, 3289, 3447, 3577, 3680, 3756, 3807, 3837, 3849, 3849, 3841, 3833,
+        3828, 3834, 3856, 3899, 3966, 4060, 4184, 4337, 4520, 4729, 4963, 5216, 5483, 5759, 6037, 6311,
+        6575, 6822, 7046, 7244, 7411, 7546, 7647, 7716, 7753, 7763, 7750, 7719, 7678, 7632, 7591, 7561,
+        7550, 7563, 7607, 7687, 7804, 7962, 8159, 8393, 8662, 8959, 9279, 9613, 9954, 10291, 10616, 10920,
+        11194, 11430, 11622, 11766, 11860, 11901, 11893, 11840, 11746, 11620, 11471, 11312, 11153, 11008, 10890, 10811,
+        10782, 10814, 10914, 11089, 11340, 11669, 12071, 12540, 13066, 13635, 14232, 14837, 15430, 15989, 16490, 16910,
+        17226, 17415, 17458, 17338, 17039, 16551, 15868, 14988, 13912, 12648, 11207, 9605, 7863, 6004, 4054, 2043,
+        0,
+    },
+    // 4 harmonics
+    {
+        0, -1023, -2042, -3051, -4047, -5024, -5980, -6908, -7806, -8670, -9496, -10281, -11022, -11716, -12362, -12957,
+        -13499, -13987, -14421, -14799, -15122, -15390, -15602, -15761, -15867, -15921, -15926, -15884, -15796, -15666, -15496, -15289,
+        -15049, -14778, -14481, -14160, -13819, -13461, -13091, -12711, -12325, -11937, -11548, -11164, -10785, -10416, -10058, -9714,
+        -9386, -9076, -8784, -8513, -8264, -8037, -7832, -7650, -7491, -7354, -7240, -7146, -7073, -7018, -6981, -6960,
+        -6954, -6960, -6976, -7002, -7034, -7070, -7109, -7149, -7187, -7222, -7251, -7274, -7287, -7291, -7282, -7261,
+        -7226, -7176, -7110, -7029, -6931, -6816, -6686, -6539, -6376, -6199, -6007, -5802, -5585, -5356, -5118, -4872,
+        -4619, -4360, -4098, -3835, -3570, -3308, -3048, -2792, -2543, -2301, -2067, -1844, -1632, -1431, -1243, -1069,
+        -908, -762, -630, -512, -409, -319, -243, -179, -127, -86, -54, -32, -16, -7, -2, 0,
+        0, 0, 2, 7, 16, 32, 54, 86, 127, 179, 243, 319, 409, 512, 630, 762,
+        908, 1069, 1243, 1431, 1632, 1844, 2067, 2301, 2543, 2792, 3048, 3308, 3570, 3835, 4098, 4360,
+        4619, 4872, 5118, 5356, 5585, 5802, 6007, 6199, 6376, 6539, 6686, 6816, 6931, 7029, 7110, 7176,
+        7226, 7261, 7282, 7291, 7287, 7274, 7251, 7222, 7187, 7149, 7109, 7070, 7034, 7002, 6976, 6960,
+        6954, 6960, 6981, 7018, 7073, 7146, 7240, 7354, 7491, 7650, 7832, 8037, 8264, 8513, 8784, 9076,
+        9386, 9714, 10058, 10416, 10785, 11164, 11548, 11937, 12325, 12711, 13091, 13461, 13819, 14160, 14481, 14778,
+        15049, 15289, 15496, 15666, 15796, 15884, 15926, 15921, 15867, 15761, 15602, 15390, 15122, 14799, 14421, 13987,
+        13499, 12957, 12362, 11716, 11022, 10281, 9496, 8670, 7806, 6908, 5980, 5024, 4047, 3051, 2042, 1023,
+        0,
+    },
+    // 2 harmonics
+    {
+        0, -512, -1023, -1533, -2040, -2544, -3044, -3540, -4031, -4515, -4993, -5463, -5925, -6379, -6822, -7256,
+        -7679, -8091, -8491, -8878, -9253, -9614, -9962, -10295, -10613, -10916, -11204, -11476, -11732, -11972, -12195, -12401,
+        -12591, -12763, -12918, -13057, -13178, -13282, -13368, -13438, -13491, -13527, -13546, -13549, -13535, -13506, -13460, -13400,
+        -13324, -13234, -13129, -13011, -12879, -12734, -12576, -12407, -12226, -12034, -11831, -11619, -11398, -11167, -10929, -10683,
+        -10430, -10171, -9907, -9637, -9363, -9085, -8804, -8520, -8234, -7947, -7659, -7371, -7084, -6797, -6512, -6229,
+        -5949, -5671, -5398, -5128, -4863, -4602, -4347, -4098, -3854, -3617, -3387, -3164, -2948, -2739, -2538, -2345,
+        -2160, -1983, -1815, -1654, -1502, -1358, -1223, -1096, -977, -866, -763, -668, -581, -501, -428, -363,
+        -304, -252, -205, -165, -130, -101, -76, -56, -39, -26, -17, -10, -5, -2, -1, 0,
+        0, 0, 1, 2, 5, 10, 17, 26, 39, 56, 76, 101, 130, 165, 205, 252,
+        304, 363, 428, 501, 581, 668, 763, 866, 977, 1096, 1223, 1358, 1502, 1654, 1815, 1983,
+        2160, 2345, 2538, 2739, 2948, 3164, 3387, 3617, 3854, 4098, 4347, 4602, 4863, 5128, 5398, 5671,
+        5949, 6229, 6512, 6797, 7084, 7371, 7659, 7947, 8234, 8520, 8804, 9085, 9363, 9637, 9907, 10171,
+        10430, 10683, 10929, 11167, 11398, 11619, 11831, 12034, 12226, 12407, 12576, 12734, 12879, 13011, 13129, 13234,
+        13324, 13400, 13460, 13506, 13535, 13549, 13546, 13527, 13491, 13438, 13368, 13282, 13178, 13057, 12918, 12763,
+        12591, 12401, 12195, 11972, 11732, 11476, 11204, 10916, 10613, 10295, 9962, 9614, 9253, 8878, 8491, 8091,
+        7679, 7256, 6822, 6379, 5925, 5463, 4993, 4515, 4031, 3540, 3044, 2544, 2040, 1533, 1023, 512,
+        0,
+    },
+    // 1 harmonic
+    {
+        0, -256, -512, -767, -1022, -1277, -1530, -1783, -2035, -2285, -2534, -2782, -3028, -3272, -3514, -3754,
+        -3992, -4227, -4460, -4690, -4917, -5141, -5362, -5580, -5795, -6006, -6213, -6417, -6617, -6813, -7005, -7192,
+        -7375, -7554, -7728, -7898, -8063, -8223, -8378, -8528, -8673, -8812, -8946, -9075, -9199, -9317, -9429, -9536,
+        -9636, -9731, -9821, -9904, -9981, -10053, -10118, -10177, -10230, -10277, -10317, -10352, -10380, -10402, -10418, -10427,
+        -10430, -10427, -10418, -10402, -10380, -10352, -10317, -10277, -10230, -10177, -10118, -10053, -9981, -9904, -9821, -9731,
+        -9636, -9536, -9429, -9317, -9199, -9075, -8946, -8812, -8673, -8528, -8378, -8223, -8063, -7898, -7728, -7554,
+        -7375, -7192, -7005, -6813, -6617, -6417, -6213, -6006, -5795, -5580, -5362, -5141, -4917, -4690, -4460, -4227,
+        -3992, -3754, -3514, -3272, -3028, -2782, -2534, -2285, -2035, -1783, -1530, -1277, -1022, -767, -512, -256,
+        0, 256, 512, 767, 1022, 1277, 1530, 1783, 2035, 2285, 2534, 2782, 3028, 3272, 3514, 3754,
+        3992, 4227, 4460, 4690, 4917, 5141, 5362, 5580, 5795, 6006, 6213, 6417, 6617, 6813, 7005, 7192,
+        7375, 7554, 7728, 7898, 8063, 8223, 8378, 8528, 8673, 8812, 8946, 9075, 9199, 9317, 9429, 9536,
+        9636, 9731, 9821, 9904, 9981, 10053, 10118, 10177, 10230, 10277, 10317, 10352, 10380, 10402, 10418, 10427,
+        10430, 10427, 10418, 10402, 10380, 10352, 10317, 10277, 10230, 10177, 10118, 10053, 9981, 9904, 9821, 9731,
+        9636, 9536, 9429, 9317, 9199, 9075, 8946, 8812, 8673, 8528, 8378, 8223, 8063, 7898, 7728, 7554,
+        7375, 7192, 7005, 6813, 6617, 6417, 6213, 6006, 5795, 5580, 5362, 5141, 4917, 4690, 4460, 4227,
+        3992, 3754, 3514, 3272, 3028, 2782, 2534, 2285, 2035, 1783, 1530, 1277, 1022, 767, 512, 256,
+        0,
+    },
+};
+
+const int16_t SynthTables::tritab_[SynthWavetableLevels][SynthWavetableSize + 1] = {
+    // 128 harmonics
+    {
+        16332, 16134, 15870, 15617, 15359, 15104, 14848, 14592, 14336, 14080, 13824, 13568, 13312, 13056, 12800, 12544,
+        12288, 12032, 11776, 11520, 11264, 11008, 10752, 10496, 10240, 9984, 9728, 9472, 9216, 8960, 8704, 8448,
+        8192, 7936, 7680, 7424, 7168, 6912, 6656, 6400, 6144, 5888, 5632, 5376, 5120, 4864, 4608, 4352,
+        4096, 3840, 3584, 3328, 3072, 2816, 2560, 2304, 2048, 1792, 1536, 1280, 1024, 768, 512, 256,
+        0, -256, -512, -768, -1024, -1280, -1536, -1792, -2048, -2304, -2560, -2816, -3072, -3328, -3584, -3840,
+        -4096, -4352, -4608, -4864, -5120, -5376, -5632, -5888, -6144, -6400, -6656, -6912, -7168, -7424, -7680, -7936,
+        -8192, -8448, -8704, -8960, -9216, -9472, -9728, -9984, -10240, -10496, -10752, -11008, -11264, -11520, -11776, -12032,
+        -12288, -12544, -12800, -13056, -13312, -13568, -13824, -14080, -14336, -14592, -14848, -15104, -15359, -15617, -15870, -16134,
+        -16332, -16134, -15870, -15617, -15359, -15104, -14848, -14592, -14336, -14080, -13824, -13568, -13312, -13056, -12800, -12544,
+        -12288, -12032, -11776, -11520, -11264, -11008, -10752, -10496, -10240, -9984, -9728, -9472, -9216, -8960, -8704, -8448,
+        -8192, -7936, -7680, -7424, -7168, -6912, -6656, -6400, -6144, -5888, -5632, -5376, -5120, -4864, -4608, -4352,
+        -4096, -3840, -3584, -3328, -3072, -2816, -2560, -2304, -2048, -1792, -1536, -1280, -1024, -768, -512, -256,
+        0, 256, 512, 768, 1024, 1280, 1536, 1792, 2048, 2304, 2560, 2816, 3072, 3328, 3584, 3840,
+        4096, 4352, 4608, 4864, 5120, 5376, 5632, 5888, 6144, 6400, 6656, 6912, 7168, 7424, 7680, 7936,
+        8192, 8448, 8704, 8960, 9216, 9472, 9728, 9984, 10240, 10496, 10752, 11008, 11264, 11520, 11776, 12032,
+        12288, 12544, 12800, 13056, 13312, 13568, 13824, 14080, 14336, 14592, 14848, 15104, 15359, 15617, 15870, 16134,
+        16332,
+    },
+    // 64 harmonics
+    {
+        16280, 16161, 15884, 15598, 15356, 15116, 14850, 14583, 14335, 14087, 13825, 13562, 13311, 13061, 12800, 12540,
+        12288, 12036, 11776, 11516, 11264, 11011, 10752, 10493, 10240, 9987, 9728, 9469, 9216, 8962, 8704, 8446,
+        8192, 7938, 7680, 7422, 7168, 6914, 6656, 6398, 6144, 5890, 5632, 5374, 5120, 4866, 4608, 4350,
+        4096, 3842, 3584, 3326, 3072, 2818, 2560, 2302, 2048, 1794, 1536, 1278, 1024, 770, 512, 254,
+        0, -254, -512, -770, -1024, -1278, -1536, -1794, -2048, -2302, -2560, -2818, -3072, -3326, -3584, -3842,
+        -4096, -4350, -4608, -4866, -5120, -5374, -5632, -5890, -6144, -6398, -6656, -6914, -7168, -7422, -7680, -7938,
+        -8192, -8446, -8704, -8962, -9216, -9469, -9728, -9987, -10240, -10493, -10752, -11011, -11264, -11516, -11776, -12036,
+        -12288, -12540, -12800, -13061, -13311, -13562, -13825, -14087, -14335, -14583, -14850, -15116, -15356, -15598, -15884, -16161,
+        -16280, -16161, -15884, -15598, -15356, -15116, -14850, -14583, -14335, -14087, -13825, -13562, -13311, -13061, -12800, -12540,
+        -12288, -12036, -11776, -11516, -11264, -11011, -10752, -10493, -10240, -9987, -9728, -9469, -9216, -8962, -8704, -8446,
+        -8192, -7938, -7680, -7422, -7168, -6914, -6656, -6398, -6144, -5890, -5632, -5374, -5120, -4866, -4608, -4350,
+        -4096, -3842, -3584, -3326, -3072, -2818, -2560, -2302, -2048, -1794, -1536, -1278, -1024, -770, -512, -254,
+        0, 254, 512, 770, 1024, 1278, 1536, 1794, 2048, 2302, 2560, 2818, 3072, 3326, 3584, 3842,
+        4096, 4350, 4608, 4866, 5120, 5374, 5632, 5890, 6144, 6398, 6656, 6914, 7168, 7422, 7680, 7938,
+        8192, 8446, 8704, 8962, 9216, 9469, 9728, 9987, 10240, 10493, 10752, 11011, 11264, 11516, 11776, 12036,
+        12288, 12540, 12800, 13061, 13311, 13562, 13825, 14087, 14335, 14583, 14850, 15116, 15356, 15598, 15884, 16161,
+        16280,
+    },
+    // 32 harmonics
+    {
+        16177, 16114, 15937, 15680, 15384, 15087, 14811, 14561, 14328, 14094, 13849, 13587, 13316, 13045, 12782, 12530,
+        12286, 12041, 11791, 11531, 11266, 11000, 10740, 10487, 10239, 9991, 9739, 9480, 9217, 8954, 8694, 8441,
+        8191, 7942, 7689, 7430, 7168, 6906, 6648, 6394, 6144, 5893, 5640, 5381, 5120, 4859, 4601, 4347,
+        4096, 3845, 3591, 3333, 3072, 2811, 2553, 2299, 2048, 1797, 1543, 1285, 1024, 763, 506, 251,
+        0, -251, -506, -763, -1024, -1285, -1543, -1797, -2048, -2299, -2553, -2811, -3072, -3333, -3591, -3845,
+        -4096, -4347, -4601, -4859, -5120, -5381, -5640, -5893, -6144, -6394, -6648, -6906, -7168, -7430, -7689, -7942,
+        -8191, -8441, -8694, -8954, -9217, -9480, -9739, -9991, -10239, -10487, -10740, -11000, -11266, -11531, -11791, -12041,
+        -12286, -12530, -12782, -13045, -13316, -13587, -13849, -14094, -14328, -14561, -14811, -15087, -15384, -15680, -15937, -16114,
+        -16177, -16114, -15937, -15680, -15384, -15087, -14811, -14561, -14328, -14094, -13849, -13587, -13316, -13045, -12782, -12530,
+        -12286, -12041, -11791, -11531, -11266, -11000, -10740, -10487, -10239, -9991, -9739, -9480, -9217, -8954, -8694, -8441,
+        -8191, -7942, -7689, -7430, -7168, -6906, -6648, -6394, -6144, -5893, -5640, -5381, -5120, -4859, -4601, -4347,
+        -4096, -3845, -3591, -3333, -3072, -2811, -2553, -2299, -2048, -1797, -1543, -1285, -1024, -763, -506, -251,
+        0, 251, 506, 763, 1024, 1285, 1543, 1797, 2048, 2299, 2553, 2811, 3072, 3333, 3591, 3845,
+        4096, 4347, 4601, 4859, 5120, 5381, 5640, 5893, 6144, 6394, 6648, 6906, 7168, 7430, 7689, 7942,
+        8191, 8441, 8694, 8954, 9217, 9480, 9739, 9991, 10239, 10487, 10740, 11000, 11266, 11531, 11791, 12041,
+        12286, 12530, 12782, 13045, 13316, 13587, 13849, 14094, 14328, 14561, 14811, 15087, 15384, 15680, 15937, 16114,
+        16177,
+    },
+    // 16 harmonics
+    {
+        15970, 15938, 15844, 15692, 15491, 15249, 14976, 14685, 14384, 14083, 13789, 13506, 13237, 12982, 12738, 12503,
+        12272, 12040, 11806, 11564, 11315, 11057, 10792, 10521, 10248, 9974, 9703, 9437, 9177, 8923, 8674, 8430,
+        8188, 7946, 7701, 7453, 7201, 6943, 6680, 6414, 6146, 5879, 5613, 5350, 5091, 4837, 4587, 4340,
+        4095, 3849, 3602, 3352, 3099, 2841, 2579, 2315, 2049, 1783, 1518, 1256, 998, 744, 494, 246,
+        0, -246, -494, -744, -998, -1256, -1518, -1783, -2049, -2315, -2579, -2841, -3099, -3352, -3602, -3849,
+        -4095, -4340, -4587, -4837, -5091, -5350, -5613, -5879, -6146, -6414, -6680, -6943, -7201, -7453, -7701, -7946,
+        -8188, -8430, -8674, -8923, -9177, -9437, -9703, -9974, -10248, -10521, -10792, -11057, -11315, -11564, -11806, -12040,
+        -12272, -12503, -12738, -12982, -13237, -13506, -13789, -14083, -14384, -14685, -14976, -15249, -15491, -15692, -15844, -15938,
+        -15970, -15938, -15844, -15692, -15491, -15249, -14976, -14685, -14384, -14083, -13789, -13506, -13237, -12982, -12738, -12503,
+        -12272, -12040, -11806, -11564, -11315, -11057, -10792, -10521, -10248, -9974, -9703, -9437, -9177, -8923, -8674, -8430,
+        -8188, -7946, -7701, -7453, -7201, -6943, -6680, -6414, -6146, -5879, -5613, -5350, -5091, -4837, -4587, -4340,
+        -4095, -3849, -3602, -3352, -3099, -2841, -2579, -2315, -2049, -1783, -1518, -1256, -998, -744, -494, -246,
+        0, 246, 494, 744, 998, 1256, 1518, 1783, 2049, 2315, 2579, 2841, 3099, 3352, 3602, 3849,
+        4095, 4340, 4587, 4837, 5091, 5350, 5613, 5879, 6146, 6414, 6680, 6943, 7201, 7453, 7701, 7946,
+        8188, 8430, 8674, 8923, 9177, 9437, 9703, 9974, 10248, 10521, 10792, 11057, 11315, 11564, 11806, 12040,
+        12272, 12503, 12738, 12982, 13237, 13506, 13789, 14083, 14384, 14685, 14976, 15249, 15491, 15692, 15844, 15938,
+        15970,
+    },
+    // 8 harmonics
+    {
+        15558, 15542, 15494, 15416, 15306, 15169, 15003, 14813, 14600, 14366, 14115, 13848, 13569, 13280, 12984, 12683,
+        12380, 12078, 11777, 11479, 11187, 10900, 10621, 10348, 10083, 9825, 9573, 9328, 9088, 8853, 8621, 8392,
+        8163, 7935, 7705, 7474, 7239, 7001, 6759, 6512, 6260, 6003, 5742, 5477, 5208, 4935, 4660, 4383,
+        4106, 3828, 3552, 3277, 3004, 2734, 2468, 2205, 1947, 1692, 1442, 1195, 952, 711, 473, 236,
+        0, -236, -473, -711, -952, -1195, -1442, -1692, -1947, -2205, -2468, -2734, -3004, -3277, -3552, -3828,
+        -4106, -4383, -4660, -4935, -5208, -5477, -5742, -6003, -6260, -6512, -6759, -7001, -7239, -7474, -7705, -7935,
+        -8163, -8392, -8621, -8853, -9088, -9328, -9573, -9825, -10083, -10348, -10621, -10900, -11187, -11479, -11777, -12078,
+        -12380, -12683, -12984, -13280, -13569, -13848, -14115, -14366, -14600, -14813, -15003, -15169, -15306, -15416, -15494, -15542,
+        -15558, -15542, -15494, -15416, -15306, -15169, -15003, -14813, -14600, -14366, -14115, -13848, -13569, -13280, -12984, -12683,
+        -12380, -12078, -11777, -11479, -11187, -10900, -10621, -10348, -10083, -9825, -9573, -9328, -9088, -8853, -8621, -8392,
+        -8163, -7935, -7705, -7474, -7239, -7001, -6759, -6512, -6260, -6003, -5742, -5477, -5208, -4935, -4660, -4383,
+        -4106, -3828, -3552, -3277, -3004, -2734, -2468, -2205, -1947, -1692, -1442, -1195, -952, -711, -473, -236,
+        0, 236, 473, 711, 952, 1195, 1442, 1692, 1947, 2205, 2468, 2734, 3004, 3277, 3552, 3828,
+        4106, 4383, 4660, 4935, 5208, 5477, 5742, 6003, 6260, 6512, 6759, 7001, 7239, 7474, 7705, 7935,
+        8163, 8392, 8621, 8853, 9088, 9328, 9573, 9825, 10083, 10348, 10621, 10900, 11187, 11479, 11777, 12078,
+        12380, 12683, 12984, 13280, 13569, 13848, 14115, 14366, 14600, 14813, 15003, 15169, 15306, 15416, 15494, 15542,
+        15558,
+    },
+    // 4 harmonics
+    {
+        14756, 14748, 14724, 14684, 14628, 14557, 14471, 14369, 14252, 14121, 13976, 13817, 13645, 13460, 13263, 13054,
+        12834, 12604, 12364, 12115, 11857, 11591, 11319, 11039, 10754, 10464, 10170, 9872, 9570, 9267, 8961, 8654,
+        8347, 8040, 7733, 7428, 7124, 6821, 6522, 6225, 5931, 5640, 5354, 5071, 4792, 4517, 4247, 3981,
+        3719, 3462, 3208, 2959, 2714, 2473, 2236, 2002, 1771, 1543, 1318, 1095, 873, 654, 435, 217,
+        0, -217, -435, -654, -873, -1095, -1318, -1543, -1771, -2002, -2236, -2473, -2714, -2959, -3208, -3462,
+        -3719, -3981, -4247, -4517, -4792, -5071, -5354, -5640, -5931, -6225, -6522, -6821, -7124, -7428, -7733, -8040,
+        -8347, -8654, -8961, -9267, -9570, -9872, -10170, -10464, -10754, -11039, -11319, -11591, -11857, -12115, -12364, -12604,
+        -12834, -13054, -13263, -13460, -13645, -13817, -13976, -14121, -14252, -14369, -14471, -14557, -14628, -14684, -14724, -14748,
+        -14756, -14748, -14724, -14684, -14628, -14557, -14471, -14369, -14252, -14121, -13976, -13817, -13645, -13460, -13263, -13054,
+        -12834, -12604, -12364, -12115, -11857, -11591, -11319, -11039, -10754, -10464, -10170, -9872, -9570, -9267, -8961, -8654,
+        -8347, -8040, -7733, -7428, -7124, -6821, -6522, -6225, -5931, -5640, -5354, -5071, -4792, -4517, -4247, -3981,
+        -3719, -3462, -3208, -2959, -2714, -2473, -2236, -2002, -1771, -1543, -1318, -1095, -873, -654, -435, -217,
+        0, 217, 435, 654, 873, 1095, 1318, 1543, 1771, 2002, 2236, 2473, 2714, 2959, 3208, 3462,
+        3719, 3981, 4247, 4517, 4792, 5071, 5354, 5640, 5931, 6225, 6522, 6821, 7124, 7428, 7733, 8040,
+        8347, 8654, 8961, 9267, 9570, 9872, 10170, 10464, 10754, 11039, 11319, 11591, 11857, 12115, 12364, 12604,
+        12834, 13054, 13263, 13460, 13645, 13817, 13976, 14121, 14252, 14369, 14471, 14557, 14628, 14684, 14724, 14748,
+        14756,
+    },
+    // 2 harmonics
+    {
+        13280, 13276, 13264, 13244, 13216, 13180, 13137, 13085, 13025, 12958, 12882, 12799, 12709, 12610, 12504, 12390,
+        12269, 12141, 12005, 11862, 11712, 11555, 11391, 11220, 11042, 10858, 10667, 10470, 10266, 10056, 9840, 9618,
+        9391, 9157, 8919, 8674, 8425, 8171, 7911, 7647, 7378, 7105, 6827, 6546, 6260, 5971, 5678, 5382,
+        5082, 4780, 4474, 4166, 3855, 3542, 3227, 2910, 2591, 2270, 1949, 1626, 1302, 977, 652, 326,
+        0, -326, -652, -977, -1302, -1626, -1949, -2270, -2591, -2910, -3227, -3542, -3855, -4166, -4474, -4780,
+        -5082, -5382, -5678, -5971, -6260, -6546, -6827, -7105, -7378, -7647, -7911, -8171, -8425, -8674, -8919, -9157,
+        -9391, -9618, -9840, -10056, -10266, -10470, -10667, -10858, -11042, -11220, -11391, -11555, -11712, -11862, -12005, -12141,
+        -12269, -12390, -12504, -12610, -12709, -12799, -12882, -12958, -13025, -13085, -13137, -13180, -13216, -13244, -13264, -13276,
+        -13280, -13276, -13264, -13244, -13216, -13180, -13137, -13085, -13025, -12958, -12882, -12799, -12709, -12610, -12504, -12390,
+        -12269, -12141, -12005, -11862, -11712, -11555, -11391, -11220, -11042, -10858, -10667, -10470, -10266, -10056, -9840, -9618,
+        -9391, -9157, -8919, -8674, -8425, -8171, -7911, -7647, -7378, -7105, -6827, -6546, -6260, -5971, -5678, -5382,
+        -5082, -4780, -4474, -4166, -3855, -3542, -3227, -2910, -2591, -2270, -1949, -1626, -1302, -977, -652, -326,
+        0, 326, 652, 977, 1302, 1626, 1949, 2270, 2591, 2910, 3227, 3542, 3855, 4166, 4474, 4780,
+        5082, 5382, 5678, 5971, 6260, 6546, 6827, 7105, 7378, 7647, 7911, 8171, 8425, 8674, 8919, 9157,
+        9391, 9618, 9840, 10056, 10266, 10470, 10667, 10858, 11042, 11220, 11391, 11555, 11712, 11862, 12005, 12141,
+        12269, 12390, 12504, 12610, 12709, 12799, 12882, 12958, 13025, 13085, 13137, 13180, 13216, 13244, 13264, 13276,
+        13280,
+    },
+    // 1 harmonic
+    {
+        13280, 13276, 13264, 13244, 13216, 13180, 13137, 13085, 13025, 12958, 12882, 12799, 12709, 12610, 12504, 12390,
+        12269, 12141, 12005, 11862, 11712, 11555, 11391, 11220, 11042, 10858, 10667, 10470, 10266, 10056, 9840, 9618,
+        9391, 9157, 8919, 8674, 8425, 8171, 7911, 7647, 7378, 7105, 6827, 6546, 6260, 5971, 5678, 5382,
+        5082, 4780, 4474, 4166, 3855, 3542, 3227, 2910, 2591, 2270, 1949, 1626, 1302, 977, 652, 326,
+        0, -326, -652, -977, -1302, -1626, -1949, -2270, -2591, -2910, -3227, -3542, -3855, -4166, -4474, -4780,
+        -5082, -5382, -5678, -5971, -6260, -6546, -6827, -7105, -7378, -7647, -7911, -8171, -8425, -8674, -8919, -9157,
+        -9391, -9618, -9840, -10056, -10266, -10470, -10667, -10858, -11042, -11220, -11391, -11555, -11712, -11862, -12005, -12141,
+        -12269, -12390, -12504, -12610, -12709, -12799, -12882, -12958, -13025, -13085, -13137, -13180, -13216, -13244, -13264, -13276,
+        -13280, -13276, -13264, -13244, -13216, -13180, -13137, -13085, -13025, -12958, -12882, -12799, -12709, -12610, -12504, -12390,
+        -12269, -12141, -12005, -11862, -11712, -11555, -11391, -11220, -11042, -10858, -10667, -10470, -10266, -10056, -9840, -9618,
+        -9391, -9157, -8919, -8674, -8425, -8171, -7911, -7647, -7378, -7105, -6827, -6546, -6260, -5971, -5678, -5382,
+        -5082, -4780, -4474, -4166, -3855, -3542, -3227, -2910, -2591, -2270, -1949, -1626, -1302, -977, -652, -326,
+        0, 326, 652, 977, 1302, 1626, 1949, 2270, 2591, 2910, 3227, 3542, 3855, 4166, 4474, 4780,
+        5082, 5382, 5678, 5971, 6260, 6546, 6827, 7105, 7378, 7647, 7911, 8171, 8425, 8674, 8919, 9157,
+        9391, 9618, 9840, 10056, 10266, 10470, 10667, 10858, 11042, 11220, 11391, 11555, 11712, 11862, 12005, 12141,
+        12269, 12390, 12504, 12610, 12709, 12799, 12882, 12958, 13025, 13085, 13137, 13180, 13216, 13244, 13264, 13276,
+        13280,
+    },
+};
+
+const float SynthTables::svftab_[SynthFilterTableSize + 1] = {
+    0.f, 0.0122724488f, 0.0245485141f, 0.0368318184f, 0.0491259963f, 0.0614347009f,
+    0.0737616094f, 0.0861104298f, 0.0984849061f, 0.110888825f, 0.123326023f, 0.13580039f,
+    0.148315878f, 0.160876504f, 0.17348636f, 0.186149616f, 0.198870529f, 0.211653445f,
+    0.224502808f, 0.237423168f, 0.250419181f, 0.26349562f, 0.276657382f, 0.289909488f,
+    0.303257095f, 0.316705501f, 0.330260148f, 0.343926632f, 0.357710706f, 0.371618288f,
+    0.385655466f, 0.399828506f, 0.414143855f, 0.42860815f, 0.443228222f, 0.458011102f,
+    0.47296403f, 0.488094459f, 0.503410059f, 0.518918728f, 0.534628594f, 0.550548021f,
+    0.56668562f, 0.583050249f, 0.599651022f, 0.616497316f, 0.633598775f, 0.650965316f,
+    0.668607139f, 0.686534727f, 0.704758857f, 0.723290605f, 0.742141349f, 0.76132278f,
+    0.780846904f, 0.800726049f, 0.820972876f, 0.841600375f, 0.862621881f, 0.884051075f,
+    0.905901992f, 0.928189023f, 0.950926928f, 0.974130837f, 0.997816257f, 1.02199908f,
+    1.04669558f, 1.07192245f, 1.09769675f, 1.12403598f, 1.15095803f, 1.17848123f,
+    1.20662431f, 1.23540647f, 1.26484732f, 1.29496691f, 1.32578577f, 1.35732486f,
+    1.3896056f, 1.42264992f, 1.45648017f, 1.49111921f, 1.5265904f, 1.56291755f,
+    1.60012502f, 1.63823764f, 1.67728077f, 1.71728027f, 1.75826254f, 1.8002545f,
+    1.84328362f, 1.88737789f, 1.93256586f, 1.97887663f, 2.02633988f, 2.07498582f,
+    2.12484527f, 2.1759496f, 2.22833077f, 2.28202135f, 2.33705448f, 2.39346392f,
+    2.45128403f, 2.51054979f, 2.57129681f, 2.63356131f, 2.69738014f, 2.76279081f,
+    2.82983147f, 2.89854091f, 2.96895858f, 3.0411246f, 3.11507976f, 3.19086552f,
+    3.26852403f, 3.34809812f, 3.42963132f, 3.51316785f, 3.59875265f, 3.68643136f,
+    3.77625035f, 3.86825671f, 3.96249826f, 4.05902356f, 4.15788189f, 4.25912332f,
+    4.36279864f, 4.46895942f, 4.57765799f,
+};
+
+#endif // CONFIG
@@ -0,0 +1,212 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicrophoneFilter.h"
+#include "AudioBufferPool.h"
+#include "ErrorNo.h"
+
+using namespace codal;
+
+/**
+ * Filter a block of samples, emitting every decimation'th filtered sample.
+ * Samples are converted to signed 16 bit values (with the bias removed, and 8 bit values scaled up),
+ * so that the filter state and coefficients are the same whatever the format.
+ *
+ * @return a pointer to the sample after the last one written.
+ */
+template <typename T>
+static T *microphone_filter_apply(const T *in, int samples, T *out, int bias, int shift, int32_t beta, int decimation, int &phase, int32_t &value, bool &primed)
+{
+    int32_t scale = 256 << shift;
+
+    if (!primed && samples)
+    {
+        value = ((int32_t) in[0] - bias) * scale;
+        primed = true;
+    }
+
+    for (int i = 0; i < samples; i++)
+    {
+        int32_t x = ((int32_t) in[i] - bias) * scale;
+        value += (int32_t) (((int64_t) (x - value) * beta) >> 16);
+
+        if (--phase == 0)
+        {
+            *out++ = (T) ((value >> (8 + shift)) + bias);
+            phase = decimation;
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Constructor.
+ * Connects to the given stream straight away.
+ *
+ * @param source The stream to filter.
+ * @param beta The smoothing factor, from 0 (no output) to 1 (no filtering).
+ * @param decimation The number of input samples filtered into each output sample.
+ */
+MicrophoneFilter::MicrophoneFilter(DataSource &source, float beta, int decimation) : upstream(source)
+{
+    this->downStream = NULL;
+    this->decimation = 1;
+    this->phase = 1;
+    this->value = 0;
+    this->primed = false;
+
+    setBeta(beta);
+    setDecimation(decimation);
+
+    upstream.connect(*this);
+}
+
+/**
+ * Destructor.
+ */
+MicrophoneFilter::~MicrophoneFilter()
+{
+    upstream.disconnect();
+}
+
+/**
+ * Define the smoothing factor of the filter.
+ *
+ * @param beta The smoothing factor, from 0 (no output) to 1 (no filtering).
+ */
+void MicrophoneFilter::setBeta(float beta)
+{
+    if (beta < 0.0f)
+        beta = 0.0f;
+
+    if (beta > 1.0f)
+        beta = 1.0f;
+
+    this->beta = (int32_t) (beta * 65536.0f);
+}
+
+/**
+ * Define the number of input samples filtered into each output sample.
+ *
+ * @param decimation The decimation factor, from 1 upwards.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the factor is less than 1.
+ */
+int MicrophoneFilter::setDecimation(int decimation)
+{
+    if (decimation < 1)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->decimation = decimation;
+    this->phase = decimation;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the number of input samples filtered into each output sample.
+ */
+int MicrophoneFilter::getDecimation()
+{
+    return decimation;
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int MicrophoneFilter::pullRequest()
+{
+    if (downStream)
+        return downStream->pullRequest();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @sink The component that data will be delivered to, when it is availiable
+ */
+void MicrophoneFilter::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+}
+
+/**
+ *  Determine the data format of the buffers streamed out of this component.
+ */
+int MicrophoneFilter::getFormat()
+{
+    return upstream.getFormat();
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer MicrophoneFilter::pull()
+{
+    ManagedBuffer input = upstream.pull();
+    int format = upstream.getFormat();
+
+    if (format != DATASTREAM_FORMAT_8BIT_SIGNED && format != DATASTREAM_FORMAT_8BIT_UNSIGNED &&
+        format != DATASTREAM_FORMAT_16BIT_SIGNED && format != DATASTREAM_FORMAT_16BIT_UNSIGNED)
+        return input;
+
+    int bytesPerSample = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+    int samples = input.length() / bytesPerSample;
+
+    // The number of times phase reaches zero over this block.
+    int outputs = samples >= phase ? 1 + (samples - phase) / decimation : 0;
+
+    if (outputs == 0)
+    {
+        phase -= samples;
+        return ManagedBuffer();
+    }
+
+    ManagedBuffer output = AudioBufferPool::getDefault().allocate(outputs * bytesPerSample);
+    uint8_t *in = &input[0];
+    uint8_t *out = &output[0];
+
+    switch (format)
+    {
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            microphone_filter_apply((const int8_t *) in, samples, (int8_t *) out, 0, 8, beta, decimation, phase, value, primed);
+            break;
+
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            microphone_filter_apply((const uint8_t *) in, samples, (uint8_t *) out, 128, 8, beta, decimation, phase, value, primed);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            microphone_filter_apply((const int16_t *) in, samples, (int16_t *) out, 0, 0, beta, decimation, phase, value, primed);
+            break;
+
+        default:
+            microphone_filter_apply((const uint16_t *) in, samples, (uint16_t *) out, 32768, 0, beta, decimation, phase, value, primed);
+            break;
+    }
+
+    return output;
+}
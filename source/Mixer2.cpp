@@ -23,12 +23,291 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "Mixer2.h"
+#include "AudioBufferPool.h"
 #include "StreamNormalizer.h"
 #include "ErrorNo.h"
 #include "CodalDmesg.h"
+#include "Timer.h"
+#include "MicroBitTrace.h"
+#include "MicroBitConfig.h"
+#include "nrf.h"
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 
 using namespace codal;
 
+//
+// Saturating arithmetic used by the fixed point mixing path.
+// Use the Cortex-M4 DSP extensions where available, and portable equivalents otherwise.
+//
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define MIXER_QADD16(a, b)      __QADD16(a, b)
+#define MIXER_SSAT16(a)         __SSAT(a, 16)
+#define MIXER_SMLAD(a, b, c)    ((int32_t) __SMLAD(a, b, c))
+#else
+static MICROBIT_FORCE_INLINE int32_t MIXER_SMLAD(uint32_t a, uint32_t b, int32_t c)
+{
+    return c + (int16_t)(a & 0xFFFF) * (int16_t)(b & 0xFFFF) + (int16_t)(a >> 16) * (int16_t)(b >> 16);
+}
+
+static MICROBIT_FORCE_INLINE int32_t MIXER_SSAT16(int32_t a)
+{
+    return a < -32768 ? -32768 : a > 32767 ? 32767 : a;
+}
+
+static MICROBIT_FORCE_INLINE uint32_t MIXER_QADD16(uint32_t a, uint32_t b)
+{
+    int32_t l = MIXER_SSAT16((int16_t)(a & 0xFFFF) + (int16_t)(b & 0xFFFF));
+    int32_t h = MIXER_SSAT16((int16_t)(a >> 16) + (int16_t)(b >> 16));
+
+    return ((uint32_t)l & 0xFFFF) | ((uint32_t)h << 16);
+}
+#endif
+
+/**
+ * Reads the CPU cycle counter, used to measure the cost of each pull().
+ */
+static inline uint32_t mixer_cycles()
+{
+#if CONFIG_ENABLED(CONFIG_MIXER_STATISTICS) && defined(DWT)
+    return DWT->CYCCNT;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Scale one input sample into the Q15 accumulator range.
+ */
+static MICROBIT_FORCE_INLINE int32_t mixer_scale_fixed(int32_t v, int32_t offset, int shift, int32_t gain)
+{
+    v = (v + offset) >> shift;
+    return MIXER_SSAT16((int32_t)(((int64_t)v * gain) >> MIXER_FIXED_POINT_BITS));
+}
+
+/**
+ * Reads one sample of the given type
+ */
+template <typename T>
+static MICROBIT_FORCE_INLINE int32_t mixer_read_fixed(uint8_t *in, int32_t position, int)
+{
+    return ((T *)in)[position >> MIXER_FIXED_POINT_BITS];
+}
+
+/**
+ * Reads one sample of any format, via the StreamNormalizer lookup table.
+ */
+static MICROBIT_FORCE_INLINE int32_t mixer_read_generic(uint8_t *in, int32_t position, int format)
+{
+    return StreamNormalizer::readSample[format](in + (position >> MIXER_FIXED_POINT_BITS) * DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format));
+}
+
+/**
+ * Accumulates len samples into the given Q15 buffer, two at a time where alignment permits.
+ */
+template <int32_t (*read)(uint8_t *, int32_t, int)>
+MICROBIT_RAMFUNC static void mixer_mix_fixed(int16_t *out, int len, uint8_t *in, int32_t &position, int32_t step, int32_t offset, int shift, int32_t gain, int format)
+{
+    // Bring the output pointer onto a word boundary, so we can operate on two samples at once.
+    if (((uintptr_t) out & 0x02) && len)
+    {
+        *out = MIXER_SSAT16(*out + mixer_scale_fixed(read(in, position, format), offset, shift, gain));
+        position += step;
+        out++;
+        len--;
+    }
+
+    while (len >= 2)
+    {
+        uint32_t acc;
+        uint32_t a = mixer_scale_fixed(read(in, position, format), offset, shift, gain);
+        position += step;
+        uint32_t b = mixer_scale_fixed(read(in, position, format), offset, shift, gain);
+        position += step;
+
+        memcpy(&acc, out, sizeof(acc));
+        acc = MIXER_QADD16(acc, (a & 0xFFFF) | (b << 16));
+        memcpy(out, &acc, sizeof(acc));
+
+        out += 2;
+        len -= 2;
+    }
+
+    if (len)
+    {
+        *out = MIXER_SSAT16(*out + mixer_scale_fixed(read(in, position, format), offset, shift, gain));
+        position += step;
+    }
+}
+
+/**
+ * Accumulates len samples of the given input format into the Q15 buffer.
+ * Common formats are read directly, avoiding an indirect call per sample.
+ */
+MICROBIT_RAMFUNC static void mixSamplesFixed(int format, int16_t *out, int len, uint8_t *in, int32_t &position, int32_t step, int32_t offset, int shift, int32_t gain)
+{
+    switch (format)
+    {
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            mixer_mix_fixed<mixer_read_fixed<uint8_t>>(out, len, in, position, step, offset, shift, gain, format);
+            break;
+
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            mixer_mix_fixed<mixer_read_fixed<int8_t>>(out, len, in, position, step, offset, shift, gain, format);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_UNSIGNED:
+            mixer_mix_fixed<mixer_read_fixed<uint16_t>>(out, len, in, position, step, offset, shift, gain, format);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            mixer_mix_fixed<mixer_read_fixed<int16_t>>(out, len, in, position, step, offset, shift, gain, format);
+            break;
+
+        default:
+            mixer_mix_fixed<mixer_read_generic>(out, len, in, position, step, offset, shift, gain, format);
+            break;
+    }
+}
+
+/**
+ * Converts n samples of the given type to offset, 16 bit signed values.
+ */
+template <typename T>
+static void mixer_convert(int16_t *out, uint8_t *in, int n, int32_t offset, int shift, int)
+{
+    T *src = (T *) in;
+
+    while (n--)
+        *out++ = MIXER_SSAT16((*src++ + offset) >> shift);
+}
+
+/**
+ * Converts n samples of any format to offset, 16 bit signed values, via the StreamNormalizer lookup table.
+ */
+static void mixer_convert_generic(int16_t *out, uint8_t *in, int n, int32_t offset, int shift, int format)
+{
+    int bytesPerSample = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+
+    while (n--)
+    {
+        *out++ = MIXER_SSAT16((StreamNormalizer::readSample[format](in) + offset) >> shift);
+        in += bytesPerSample;
+    }
+}
+
+/**
+ * Converts n samples of the given input format to offset, 16 bit signed values.
+ */
+static void convertSamples(int format, int16_t *out, uint8_t *in, int n, int32_t offset, int shift)
+{
+    switch (format)
+    {
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            mixer_convert<uint8_t>(out, in, n, offset, shift, format);
+            break;
+
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            mixer_convert<int8_t>(out, in, n, offset, shift, format);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_UNSIGNED:
+            mixer_convert<uint16_t>(out, in, n, offset, shift, format);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            mixer_convert<int16_t>(out, in, n, offset, shift, format);
+            break;
+
+        default:
+            mixer_convert_generic(out, in, n, offset, shift, format);
+            break;
+    }
+}
+
+/**
+ * Applies one phase of the polyphase FIR filter to MIXER_RESAMPLER_TAPS consecutive samples,
+ * two taps at a time.
+ *
+ * @param x The first (oldest) sample to filter.
+ * @param h The coefficients of the phase to apply.
+ * @return The filtered sample, as a 16 bit signed value.
+ */
+static MICROBIT_FORCE_INLINE int32_t mixer_fir(const int16_t *x, const int16_t *h)
+{
+    uint32_t xw, hw;
+    int32_t acc = 0;
+
+    for (int i = 0; i < MIXER_RESAMPLER_TAPS; i += 2)
+    {
+        memcpy(&xw, &x[i], sizeof(xw));
+        memcpy(&hw, &h[i], sizeof(hw));
+        acc = MIXER_SMLAD(xw, hw, acc);
+    }
+
+    return MIXER_SSAT16(acc >> 15);
+}
+
+/**
+ * Scales, clamps and writes out len samples from the Q15 buffer, in the given type.
+ */
+template <typename T>
+MICROBIT_RAMFUNC static void mixer_write_fixed(uint8_t *w, int16_t *r, int len, int32_t scale, int shift, int32_t offset, int32_t lo, int32_t hi, uint32_t orMask)
+{
+    T *out = (T *) w;
+
+    while (len--)
+    {
+        int32_t s = ((*r++ * scale) >> shift) + offset;
+        s = s < lo ? lo : s > hi ? hi : s;
+        *out++ = (T) (s | orMask);
+    }
+}
+
+/**
+ * Scales, clamps and writes out len samples from the Q15 buffer, in the given output format.
+ */
+MICROBIT_RAMFUNC static void writeOutputFixed(int format, uint8_t *w, int16_t *r, int len, int32_t scale, int shift, int32_t offset, int32_t lo, int32_t hi, uint32_t orMask)
+{
+    switch (format)
+    {
+        case DATASTREAM_FORMAT_8BIT_UNSIGNED:
+            mixer_write_fixed<uint8_t>(w, r, len, scale, shift, offset, lo, hi, orMask);
+            break;
+
+        case DATASTREAM_FORMAT_8BIT_SIGNED:
+            mixer_write_fixed<int8_t>(w, r, len, scale, shift, offset, lo, hi, orMask);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_UNSIGNED:
+            mixer_write_fixed<uint16_t>(w, r, len, scale, shift, offset, lo, hi, orMask);
+            break;
+
+        case DATASTREAM_FORMAT_16BIT_SIGNED:
+            mixer_write_fixed<int16_t>(w, r, len, scale, shift, offset, lo, hi, orMask);
+            break;
+    }
+}
+
+/**
+ * Fills the output buffer with a single, precomputed sample value in the given output format.
+ */
+MICROBIT_RAMFUNC static void fillOutput(int format, uint8_t *w, int len, int32_t s)
+{
+    if (DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format) == 1)
+    {
+        memset(w, s, len);
+        return;
+    }
+
+    uint16_t *out = (uint16_t *) w;
+    uint16_t v = (uint16_t) s;
+
+    while (len--)
+        *out++ = v;
+}
+
 
 /**
  * Constructor.
@@ -44,10 +323,29 @@ Mixer2::Mixer2(float sampleRate, int sampleRange, int format)
     this->downStream = NULL;
     this->outputFormat = DATASTREAM_FORMAT_16BIT_UNSIGNED;
     this->bytesPerSampleOut = 2;
+    this->outputRate = sampleRate;
+    this->bufferSize = CONFIG_MIXER_BUFFER_SIZE / 2;
+    this->requestedBufferSize = 0;
     this->volume = 1.0f;
     this->orMask = 0;
     this->silenceLevel = 0.0f;
     this->silent = true;
+    this->mode = CONFIG_MIXER_DEFAULT_MODE;
+    this->silentBuffers = 0;
+    this->autoSuspend = CONFIG_MIXER_AUTO_SUSPEND_BUFFERS;
+    this->suspended = false;
+    this->limiterThreshold = 0;
+    this->limiterReleaseTime = CONFIG_MIXER_LIMITER_RELEASE;
+    this->limiterRelease = 0;
+    this->limiterGain = 1 << MIXER_FIXED_POINT_BITS;
+
+    resetStatistics();
+
+#if CONFIG_ENABLED(CONFIG_MIXER_STATISTICS) && defined(DWT)
+    // Ensure the cycle counter is running.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 
     // Attempt to configure output format to requested value
     this->setFormat(format);
@@ -66,6 +364,12 @@ Mixer2::~Mixer2()
     }
 }
 
+MixerChannel::~MixerChannel()
+{
+    free(resampleTable);
+    free(resampleWork);
+}
+
 void Mixer2::configureChannel(MixerChannel *c)
 {
     c->volume = 1.0f;
@@ -77,6 +381,113 @@ void Mixer2::configureChannel(MixerChannel *c)
 
     if (c->format == DATASTREAM_FORMAT_8BIT_UNSIGNED || c->format == DATASTREAM_FORMAT_16BIT_UNSIGNED)
         c->offset = c->range * -0.5f;       
+
+    // Precalculate the fixed point equivalents. Wide input formats are shifted down to 16 bits before scaling.
+    uint32_t r = c->range > 1.0f ? (uint32_t) c->range : 1;
+
+    c->ioffset = (int) c->offset;
+    c->ishift = 0;
+
+    while ((r >> c->ishift) > 65536)
+        c->ishift++;
+
+    c->igain = (2.0f * MIXER_FIXED_FULL_SCALE * (1 << MIXER_FIXED_POINT_BITS)) / (float)(r >> c->ishift);
+
+    configureResampler(c);
+}
+
+/**
+ * Calculates the polyphase FIR coefficients for the given channel's (input rate, output rate) pair,
+ * or releases them if the channel does not need to be resampled.
+ *
+ * Each phase is a Hann windowed sinc, with its cutoff at the lower of the input and output Nyquist
+ * frequencies, normalised to unity gain. Output samples are delayed by MIXER_RESAMPLER_TAPS/2 input
+ * samples, so that only samples already received are needed.
+ */
+void Mixer2::configureResampler(MixerChannel *c)
+{
+    if (c->resampler != MIXER_RESAMPLER_POLYPHASE || c->rate == outputRate || c->format == DATASTREAM_FORMAT_UNKNOWN)
+    {
+        free(c->resampleTable);
+        c->resampleTable = NULL;
+        return;
+    }
+
+    if (c->resampleTable == NULL)
+        c->resampleTable = (int16_t *) malloc(sizeof(int16_t) * MIXER_RESAMPLER_PHASES * MIXER_RESAMPLER_TAPS);
+
+    if (c->resampleTable == NULL)
+        return;
+
+    const float pi = 3.14159265359f;
+    float cutoff = c->rate > outputRate ? outputRate / c->rate : 1.0f;
+
+    for (int p = 0; p < MIXER_RESAMPLER_PHASES; p++)
+    {
+        float h[MIXER_RESAMPLER_TAPS];
+        float sum = 0.0f;
+        float f = (float) p / MIXER_RESAMPLER_PHASES;
+
+        for (int k = 0; k < MIXER_RESAMPLER_TAPS; k++)
+        {
+            // Distance from the interpolated point to tap k, in input samples.
+            float d = f + (MIXER_RESAMPLER_TAPS/2 - 1) - k;
+            float x = pi * d * cutoff;
+            float sinc = x == 0.0f ? 1.0f : sinf(x) / x;
+            float window = 0.5f * (1.0f + cosf(2.0f * pi * d / MIXER_RESAMPLER_TAPS));
+
+            h[k] = sinc * window;
+            sum += h[k];
+        }
+
+        for (int k = 0; k < MIXER_RESAMPLER_TAPS; k++)
+        {
+            int32_t v = (int32_t) (32767.0f * h[k] / sum + 0.5f);
+            c->resampleTable[p * MIXER_RESAMPLER_TAPS + k] = MIXER_SSAT16(v);
+        }
+    }
+
+    // Ensure the current buffer is converted before use.
+    c->resampleLength = -1;
+}
+
+/**
+ * Converts the channel's current input buffer into its resampling work buffer, retaining the
+ * last few samples of the previous buffer as filter history.
+ */
+void Mixer2::loadResampler(MixerChannel *c)
+{
+    const int history = MIXER_RESAMPLER_TAPS - 1;
+    int samples = c->buffer.length() / c->bytesPerSample;
+    bool first = c->resampleLength < 0;
+
+    if (samples + history > c->resampleWorkSize)
+    {
+        int16_t *work = (int16_t *) malloc(sizeof(int16_t) * (samples + history));
+
+        if (work == NULL)
+        {
+            c->resampleLength = 0;
+            return;
+        }
+
+        if (c->resampleWork && !first)
+            memcpy(work, &c->resampleWork[c->resampleLength], sizeof(int16_t) * history);
+
+        free(c->resampleWork);
+        c->resampleWork = work;
+        c->resampleWorkSize = samples + history;
+    }
+    else if (!first)
+    {
+        memmove(c->resampleWork, &c->resampleWork[c->resampleLength], sizeof(int16_t) * history);
+    }
+
+    if (first)
+        memset(c->resampleWork, 0, sizeof(int16_t) * history);
+
+    convertSamples(c->format, &c->resampleWork[history], c->in, samples, c->ioffset, c->ishift);
+    c->resampleLength = samples;
 }
 
 /**
@@ -96,6 +507,14 @@ MixerChannel *Mixer2::addChannel(DataSource &stream, float sampleRate, int sampl
     c->in = NULL;
     c->end = NULL;
     c->position = 0;
+    c->resampler = CONFIG_MIXER_DEFAULT_RESAMPLER;
+    c->resampleTable = NULL;
+    c->resampleWork = NULL;
+    c->resampleWorkSize = 0;
+    c->resampleLength = -1;
+    c->mixer = this;
+    c->buffers = 0;
+    c->underruns = 0;
 
     configureChannel(c);
 
@@ -115,89 +534,101 @@ int Mixer2::removeChannel( MixerChannel * channel )
 }
 
 ManagedBuffer Mixer2::pull() 
+{
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_MIXER_PULL);
+
+#if CONFIG_ENABLED(CONFIG_MIXER_STATISTICS)
+    uint32_t start = mixer_cycles();
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    // If the sink has asked for this buffer after the ones it already holds should have finished playing, it has run dry.
+    if (lastPullTime && now - lastPullTime > (CODAL_TIMESTAMP) getOutputLatency())
+        underruns++;
+
+    ManagedBuffer output = generate();
+
+    lastCycles = mixer_cycles() - start;
+    maxCycles = max(maxCycles, lastCycles);
+    totalCycles += lastCycles;
+    pulls++;
+    lastPullTime = suspended ? 0 : now;
+
+    return output;
+#else
+    return generate();
+#endif
+}
+
+/**
+ * Generate the next output buffer.
+ */
+ManagedBuffer Mixer2::generate()
 {
     // If we have no channels, just return an empty buffer.
     if (!channels)
     {
+        ManagedBuffer empty = AudioBufferPool::getDefault().allocate(bufferSize * bytesPerSampleOut);
+        memset(&empty[0], 0, empty.length());
+
         downStream->pullRequest();
-        return ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
+        return empty;
     }
 
-    // Clear the accumulator buffer
-    for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
-        mix[i] = 0.0f;
-
     MixerChannel *next;
     bool silence = true;
+    bool idle = true;
 
-    for (MixerChannel *ch = channels; ch; ch = next) {
-        next = ch->next; // save next in case the current channel gets deleted
-
-        // Attempt to discover the stream format if it is not already defined.
-        if (ch->format == DATASTREAM_FORMAT_UNKNOWN)
+    // Channels that have consumed their last buffer and have nothing pending cannot contribute to this
+    // buffer, so if that is true of every channel we can skip mixing altogether.
+    for (MixerChannel *ch = channels; ch; ch = ch->next)
+    {
+        if (ch->format == DATASTREAM_FORMAT_UNKNOWN || hasData(ch))
         {
-            configureChannel(ch);
-
-            // If we still don't know, skip this channel until it decides what it is generating...
-            if (ch->format == DATASTREAM_FORMAT_UNKNOWN)      
-                continue;
+            idle = false;
+            break;
         }
+    }
 
-        float *out = &mix[0];
-        float *end = &mix[CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut];
-        int inputFormat = ch->format;
-
-        while (out < end)
+    if (!idle)
+    {
+        // Clear the accumulator buffer
+        if (mode == MIXER_MODE_FIXED)
         {
-            // precalculate the maximum number of samples the we can process with the current buffer allocations.
-            // choose the minimum between the available samples in the input buffer and the space in the output buffer.
-            int outLen = (int) (end - out);
-            int inLen = ((ch->buffer.length() / ch->bytesPerSample) - ch->position) / ch->skip;
-            int len =  min(outLen, inLen);
-
-            if (len)
-                silence = false;
+            memset(qmix, 0, bufferSize * sizeof(int16_t));
+        }
+        else
+        {
+            for (int i=0; i<bufferSize; i++)
+                mix[i] = 0.0f;
+        }
 
-            uint8_t *d = ch->in;
+        for (MixerChannel *ch = channels; ch; ch = next) {
+            next = ch->next; // save next in case the current channel gets deleted
 
-            while(len--)
+            // Attempt to discover the stream format if it is not already defined.
+            if (ch->format == DATASTREAM_FORMAT_UNKNOWN)
             {
-                float v = StreamNormalizer::readSample[inputFormat](d);
-                v += ch->offset;
-                v *= ch->gain;    
-                v *= ch->volume;    
-                *out += v;
- 
-                ch->position += ch->skip;
-                d = ch->in + (int)(ch->position * ch->bytesPerSample);
-
-                out++;
+                configureChannel(ch);
+
+                // If we still don't know, skip this channel until it decides what it is generating...
+                if (ch->format == DATASTREAM_FORMAT_UNKNOWN)      
+                    continue;
             }
 
-            // Check if we've completed an input buffer. If so, pull down another if available.
-            // if no buffer is available, then move on to the next channel.
-            if (inLen <= outLen)
-            {
-                if (ch->pullRequests == 0)
-                    break;
-
-                ch->pullRequests--;
-                ch->buffer = ch->stream->pull();
-                ch->in = &ch->buffer[0];
-                ch->position = 0;
-                ch->end = ch->in + ch->buffer.length();
-
-                if (ch->buffer.length() == 0)
-                    break;
-            }                
-        }
-    }       
+            // Skip channels with nothing to give.
+            if (!hasData(ch))
+                continue;
 
-    // If we have silence, set output level to predefined value.
-    if (silence && silenceLevel != 0.0f)
-    {
-        for (int i=0; i<CONFIG_MIXER_BUFFER_SIZE/bytesPerSampleOut; i++)
-            mix[i] = silenceLevel;
+            bool active;
+
+            if (ch->resampleTable)
+                active = mixChannelResampled(ch);
+            else
+                active = mode == MIXER_MODE_FIXED ? mixChannelFixed(ch) : mixChannel(ch);
+
+            if (active)
+                silence = false;
+        }
     }
 
     if ( this->silent != silence)
@@ -206,24 +637,149 @@ ManagedBuffer Mixer2::pull()
         Event(DEVICE_ID_MIXER, this->silent ? DEVICE_MIXER_EVT_SILENCE : DEVICE_MIXER_EVT_SOUND);
     }
 
+    // Update the limiter envelope with the peak level of this buffer.
+    if (limiterThreshold)
+        updateLimiter(silence ? 0 : bufferSize);
+
     // Scale and pack to our output format
-    ManagedBuffer output = ManagedBuffer(CONFIG_MIXER_BUFFER_SIZE);
-    uint8_t *w = &output[0];
-    float *r = mix;
+    ManagedBuffer output = AudioBufferPool::getDefault().allocate(bufferSize * bytesPerSampleOut);
+
+    if (mode == MIXER_MODE_FIXED)
+        renderOutputFixed(&output[0], bufferSize, silence);
+    else
+        renderOutput(&output[0], bufferSize, silence);
+
+    silentBuffers = silence ? silentBuffers + 1 : 0;
+
+    // If we've been silent for long enough, stop driving our output until there is something to play.
+    if (autoSuspend && silentBuffers >= autoSuspend)
+    {
+        suspended = true;
+        Event(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_SUSPEND);
+        return output;
+    }
+
+    // Return the buffer and we're done.
+    downStream->pullRequest();
+    return output;
+}
+
+/**
+ * Determines if the given channel has any samples left to mix, either in its current buffer
+ * or pending from its DataSource.
+ */
+bool Mixer2::hasData(MixerChannel *ch)
+{
+    if (ch->pullRequests > 0)
+        return true;
+
+    if (ch->bytesPerSample == 0)
+        return false;
+
+    return ch->position < (float) (ch->buffer.length() / ch->bytesPerSample);
+}
+
+/**
+ * Accumulate samples from the given channel into the floating point mix buffer,
+ * pulling further buffers from the channel's DataSource as needed.
+ *
+ * @param ch The channel to mix.
+ * @return true if any samples were mixed, false if the channel was silent.
+ */
+bool Mixer2::mixChannel(MixerChannel *ch)
+{
+    float *out = &mix[0];
+    float *end = &mix[bufferSize];
+    int inputFormat = ch->format;
+    bool active = false;
+
+    while (out < end)
+    {
+        // precalculate the maximum number of samples the we can process with the current buffer allocations.
+        // choose the minimum between the available samples in the input buffer and the space in the output buffer.
+        int outLen = (int) (end - out);
+        int inLen = ((ch->buffer.length() / ch->bytesPerSample) - ch->position) / ch->skip;
+        int len =  min(outLen, inLen);
+
+        if (len)
+            active = true;
+
+        uint8_t *d = ch->in;
+
+        while(len--)
+        {
+            float v = StreamNormalizer::readSample[inputFormat](d);
+            v += ch->offset;
+            v *= ch->gain;    
+            v *= ch->volume;    
+            *out += v;
+
+            ch->position += ch->skip;
+            d = ch->in + (int)ch->position * ch->bytesPerSample;
+
+            out++;
+        }
+
+        // Check if we've completed an input buffer. If so, pull down another if available.
+        // if no buffer is available, then move on to the next channel.
+        if (inLen <= outLen)
+        {
+            if (ch->pullRequests == 0)
+            {
+                if (active && out < end)
+                    ch->underruns++;
+                break;
+            }
+
+            ch->pullRequests--;
+            ch->buffers++;
+            ch->buffer = ch->stream->pull();
+            ch->in = &ch->buffer[0];
+            ch->position = 0;
+            ch->end = ch->in + ch->buffer.length();
+
+            if (ch->buffer.length() == 0)
+                break;
+        }                
+    }
+
+    return active;
+}
 
-    int len = output.length() / bytesPerSampleOut;
+/**
+ * Scale and pack the floating point mix buffer into the given output buffer.
+ *
+ * @param w The output buffer to write to.
+ * @param len The number of samples to write.
+ * @param silence true if no channels contributed to this buffer.
+ */
+void Mixer2::renderOutput(uint8_t *w, int len, bool silence)
+{
+    float *r = mix;
     float scale = volume * outputRange / CONFIG_MIXER_INTERNAL_RANGE;
     int offset = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? outputRange/2 : 0;
     float lo = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? 0 : -outputRange/2;
     float hi = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED) ? outputRange : outputRange/2;
 
+    // If we have silence, every sample is the predefined silence level, so calculate it once.
+    if (silence)
+    {
+        float sample = silenceLevel * scale + offset;
+        sample = sample < lo ? lo : sample > hi ? hi : sample;
+        fillOutput(outputFormat, w, len, (int)sample | orMask);
+        return;
+    }
+
+    if (limiterThreshold)
+        scale = scale * limiterGain / (1 << MIXER_FIXED_POINT_BITS);
+
     while(len--)
     {
         float sample = *r * scale;
         sample += offset;
         
-        // Clamp output range. Would be nice to use apply some compression here, 
-        // but we don't really want ot use more CPU than we already do.
+        // Clamp output range. Any compression is applied by the limiter through the scale factor,
+        // so this only catches residual peaks.
         if (sample < lo)
             sample = lo;
 
@@ -239,15 +795,310 @@ ManagedBuffer Mixer2::pull()
         w += bytesPerSampleOut;
         r++;
     }
+}
 
-    // Return the buffer and we're done.
-    downStream->pullRequest();
-    return output;
+/**
+ * Accumulate samples from the given channel into the Q15 mix buffer,
+ * pulling further buffers from the channel's DataSource as needed.
+ *
+ * @param ch The channel to mix.
+ * @return true if any samples were mixed, false if the channel was silent.
+ */
+MICROBIT_RAMFUNC bool Mixer2::mixChannelFixed(MixerChannel *ch)
+{
+    int16_t *out = &qmix[0];
+    int16_t *end = &qmix[bufferSize];
+    int32_t gain = (int32_t) (ch->igain * ch->volume);
+    int32_t step = (int32_t) (ch->skip * (1 << MIXER_FIXED_POINT_BITS));
+    int32_t position = (int32_t) (ch->position * (1 << MIXER_FIXED_POINT_BITS));
+    bool active = false;
+
+    if (step <= 0)
+        step = 1;
+
+    while (out < end)
+    {
+        // Determine how many output samples the current input buffer can supply, rounding up so that
+        // any fractional position is carried over into the next buffer rather than discarded.
+        int outLen = (int) (end - out);
+        int32_t available = ((ch->buffer.length() / ch->bytesPerSample) << MIXER_FIXED_POINT_BITS) - position;
+        int inLen = available > 0 ? (available + step - 1) / step : 0;
+        int len = min(outLen, inLen);
+
+        if (len)
+        {
+            active = true;
+            mixSamplesFixed(ch->format, out, len, ch->in, position, step, ch->ioffset, ch->ishift, gain);
+            out += len;
+        }
+
+        // Check if we've completed an input buffer. If so, pull down another if available.
+        // if no buffer is available, then move on to the next channel.
+        if (inLen <= outLen)
+        {
+            if (ch->pullRequests == 0)
+            {
+                if (active && out < end)
+                    ch->underruns++;
+                break;
+            }
+
+            ch->pullRequests--;
+            ch->buffers++;
+            position -= (ch->buffer.length() / ch->bytesPerSample) << MIXER_FIXED_POINT_BITS;
+            ch->buffer = ch->stream->pull();
+            ch->in = &ch->buffer[0];
+            ch->end = ch->in + ch->buffer.length();
+
+            if (position < 0 || ch->buffer.length() == 0)
+                position = 0;
+
+            if (ch->buffer.length() == 0)
+                break;
+        }
+    }
+
+    ch->position = (float) position / (1 << MIXER_FIXED_POINT_BITS);
+    return active;
+}
+
+/**
+ * Accumulate samples from the given channel into the active mix buffer, using the channel's polyphase
+ * FIR resampler, and pulling further buffers from the channel's DataSource as needed.
+ *
+ * Input buffers are converted to 16 bit in a single pass when received, so the per sample work is
+ * limited to the phase accumulator, the FIR and the accumulation itself.
+ *
+ * @param ch The channel to mix.
+ * @return true if any samples were mixed, false if the channel was silent.
+ */
+bool Mixer2::mixChannelResampled(MixerChannel *ch)
+{
+    int outLen = bufferSize;
+    int written = 0;
+    int32_t gain = (int32_t) (ch->igain * ch->volume);
+    int32_t step = (int32_t) (ch->skip * (1 << MIXER_FIXED_POINT_BITS));
+    int32_t position = (int32_t) (ch->position * (1 << MIXER_FIXED_POINT_BITS));
+    float toFloat = (float) CONFIG_MIXER_INTERNAL_RANGE / (2 * MIXER_FIXED_FULL_SCALE);
+    bool active = false;
+
+    if (step <= 0)
+        step = 1;
+
+    if (ch->resampleLength < 0)
+        loadResampler(ch);
+
+    while (written < outLen)
+    {
+        int remaining = outLen - written;
+        int32_t available = (ch->resampleLength << MIXER_FIXED_POINT_BITS) - position;
+        int inLen = available > 0 ? (available + step - 1) / step : 0;
+        int len = min(remaining, inLen);
+
+        if (len)
+        {
+            active = true;
+
+            if (mode == MIXER_MODE_FIXED)
+            {
+                int16_t *out = &qmix[written];
+
+                for (int i = 0; i < len; i++)
+                {
+                    const int16_t *h = &ch->resampleTable[((position >> (MIXER_FIXED_POINT_BITS - MIXER_RESAMPLER_PHASE_BITS)) & (MIXER_RESAMPLER_PHASES - 1)) * MIXER_RESAMPLER_TAPS];
+                    int32_t v = mixer_fir(&ch->resampleWork[position >> MIXER_FIXED_POINT_BITS], h);
+
+                    v = (int32_t)(((int64_t)v * gain) >> MIXER_FIXED_POINT_BITS);
+                    out[i] = MIXER_SSAT16(out[i] + MIXER_SSAT16(v));
+                    position += step;
+                }
+            }
+            else
+            {
+                float *out = &mix[written];
+
+                for (int i = 0; i < len; i++)
+                {
+                    const int16_t *h = &ch->resampleTable[((position >> (MIXER_FIXED_POINT_BITS - MIXER_RESAMPLER_PHASE_BITS)) & (MIXER_RESAMPLER_PHASES - 1)) * MIXER_RESAMPLER_TAPS];
+                    int32_t v = mixer_fir(&ch->resampleWork[position >> MIXER_FIXED_POINT_BITS], h);
+
+                    v = (int32_t)(((int64_t)v * gain) >> MIXER_FIXED_POINT_BITS);
+                    out[i] += (float) MIXER_SSAT16(v) * toFloat;
+                    position += step;
+                }
+            }
+
+            written += len;
+        }
+
+        // Check if we've completed an input buffer. If so, pull down another if available.
+        // if no buffer is available, then move on to the next channel.
+        if (inLen <= remaining)
+        {
+            if (ch->pullRequests == 0)
+            {
+                if (active && written < outLen)
+                    ch->underruns++;
+                break;
+            }
+
+            ch->pullRequests--;
+            ch->buffers++;
+            position -= ch->resampleLength << MIXER_FIXED_POINT_BITS;
+            ch->buffer = ch->stream->pull();
+            ch->in = &ch->buffer[0];
+            ch->end = ch->in + ch->buffer.length();
+
+            if (position < 0 || ch->buffer.length() == 0)
+                position = 0;
+
+            loadResampler(ch);
+
+            if (ch->buffer.length() == 0)
+                break;
+        }
+    }
+
+    ch->position = (float) position / (1 << MIXER_FIXED_POINT_BITS);
+    return active;
+}
+
+/**
+ * Scale and pack the Q15 mix buffer into the given output buffer.
+ *
+ * @param w The output buffer to write to.
+ * @param len The number of samples to write.
+ * @param silence true if no channels contributed to this buffer.
+ */
+MICROBIT_RAMFUNC void Mixer2::renderOutputFixed(uint8_t *w, int len, bool silence)
+{
+    bool isUnsigned = (outputFormat == DATASTREAM_FORMAT_16BIT_UNSIGNED || outputFormat == DATASTREAM_FORMAT_8BIT_UNSIGNED);
+    int32_t offset = isUnsigned ? (int32_t) outputRange/2 : 0;
+    int32_t lo = isUnsigned ? 0 : (int32_t) -outputRange/2;
+    int32_t hi = isUnsigned ? (int32_t) outputRange : (int32_t) outputRange/2;
+
+    // Choose the largest shift that keeps the product of a Q15 sample and the scale factor within 32 bits.
+    float f = volume * outputRange / (2 * MIXER_FIXED_FULL_SCALE);
+
+    if (limiterThreshold)
+        f = f * limiterGain / (1 << MIXER_FIXED_POINT_BITS);
+
+    int shift = 30;
+    while (shift > 0 && f * (float)(1 << shift) >= 65536.0f)
+        shift--;
+
+    int32_t scale = (int32_t) (f * (float)(1 << shift));
+
+    // If we have silence, the output is a single constant level, so calculate it once.
+    if (silence)
+    {
+        int32_t s = (int32_t) (silenceLevel * volume * outputRange / CONFIG_MIXER_INTERNAL_RANGE) + offset;
+        s = s < lo ? lo : s > hi ? hi : s;
+        fillOutput(outputFormat, w, len, s | orMask);
+        return;
+    }
+
+    writeOutputFixed(outputFormat, w, qmix, len, scale, shift, offset, lo, hi, orMask);
+}
+
+/**
+ * Updates the limiter envelope from the peak level of the current mix buffer.
+ * Gain is reduced immediately when the peak exceeds the threshold (attack), and recovers
+ * exponentially towards unity otherwise (release). Only one in CONFIG_MIXER_LIMITER_PEAK_STRIDE
+ * samples is inspected, with the output clamp catching any peaks that fall between them.
+ *
+ * @param len The number of samples in the mix buffer, or zero if the buffer is silent.
+ */
+void Mixer2::updateLimiter(int len)
+{
+    float peak = 0.0f;
+
+    if (mode == MIXER_MODE_FIXED)
+    {
+        int32_t p = 0;
+
+        for (int i = 0; i < len; i += CONFIG_MIXER_LIMITER_PEAK_STRIDE)
+        {
+            int32_t v = qmix[i];
+            v = v < 0 ? -v : v;
+            p = v > p ? v : p;
+        }
+
+        peak = (float) p * volume * outputRange / (2 * MIXER_FIXED_FULL_SCALE);
+    }
+    else
+    {
+        float p = 0.0f;
+
+        for (int i = 0; i < len; i += CONFIG_MIXER_LIMITER_PEAK_STRIDE)
+        {
+            float v = mix[i] < 0.0f ? -mix[i] : mix[i];
+            p = v > p ? v : p;
+        }
+
+        peak = p * volume * outputRange / CONFIG_MIXER_INTERNAL_RANGE;
+    }
+
+    // Determine the gain needed to keep this peak at or below the threshold.
+    float limit = (float) limiterThreshold * outputRange / (2 * CONFIG_MIXER_INTERNAL_RANGE);
+    int32_t target = 1 << MIXER_FIXED_POINT_BITS;
+
+    if (peak > limit)
+        target = (int32_t) (target * limit / peak);
+
+    if (target < limiterGain)
+        limiterGain = target;
+    else
+        limiterGain += (int32_t) (((int64_t)(target - limiterGain) * limiterRelease) >> MIXER_FIXED_POINT_BITS);
+}
+
+/**
+ * Calculates the per buffer release coefficient of the limiter from its release time.
+ */
+void Mixer2::configureLimiter()
+{
+    float bufferTime = (1000.0f * bufferSize) / outputRate;
+    float release = limiterReleaseTime > 0 ? 1.0f - expf(-bufferTime / limiterReleaseTime) : 1.0f;
+
+    limiterRelease = (int32_t) (release * (1 << MIXER_FIXED_POINT_BITS));
+}
+
+/**
+ * Determine the statistics gathered for this channel.
+ * @return A snapshot of this channel's counters.
+ */
+MixerChannelStatistics MixerChannel::getStatistics()
+{
+    MixerChannelStatistics s;
+
+    s.buffers = buffers;
+    s.underruns = underruns;
+    s.queueDepth = pullRequests;
+
+    return s;
+}
+
+/**
+ * Determine the play time of the input data currently buffered by this channel.
+ * @return the time required to consume the unread samples in the current buffer, in microseconds.
+ */
+int MixerChannel::getLatency()
+{
+    if (bytesPerSample == 0 || rate <= 0.0f)
+        return 0;
+
+    float unread = (float) (buffer.length() / bytesPerSample) - position;
+
+    return unread > 0.0f ? (int) (unread * 1000000.0f / rate) : 0;
 }
 
 int MixerChannel::pullRequest()
 {
     pullRequests++;
+
+    if (mixer && mixer->isSuspended())
+        mixer->resume();
+
     return DEVICE_OK;
 }
 
@@ -269,6 +1120,13 @@ int Mixer2::setFormat(int format)
         this->outputFormat = format;
         this->bytesPerSampleOut = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
 
+        // Unless a specific buffer size has been requested, fill CONFIG_MIXER_BUFFER_SIZE bytes per buffer.
+        if (requestedBufferSize == 0)
+        {
+            this->bufferSize = CONFIG_MIXER_BUFFER_SIZE / bytesPerSampleOut;
+            configureLimiter();
+        }
+
         return DEVICE_OK;
     }
 
@@ -323,7 +1181,12 @@ int Mixer2::setSampleRate(float sampleRate)
     
     // Recompute the sub/super sampling constants for each channel.    
     for (MixerChannel *c = channels; c; c=c->next)
+    {
         c->skip = c->rate / outputRate;
+        configureResampler(c);
+    }
+
+    configureLimiter();
 
     return DEVICE_OK;
 }
@@ -385,3 +1248,208 @@ bool Mixer2::isSilent()
 {
   return silent;
 }
+
+/**
+ * Selects the arithmetic used to mix channels together.
+ *
+ * @param mode MIXER_MODE_FLOAT (default) or MIXER_MODE_FIXED. Fixed point mode accumulates saturating
+ * Q15 samples using the Cortex-M4 DSP extensions, and writes the output format directly.
+ * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+ */
+int Mixer2::setMode(int mode)
+{
+    if (mode != MIXER_MODE_FLOAT && mode != MIXER_MODE_FIXED)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->mode = mode;
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the arithmetic used to mix channels together.
+ * @return MIXER_MODE_FLOAT or MIXER_MODE_FIXED.
+ */
+int Mixer2::getMode()
+{
+    return mode;
+}
+
+/**
+ * Selects the algorithm used to convert the given channel to the mixer's output sample rate.
+ * This has no effect on channels whose sample rate matches that of the mixer.
+ *
+ * @param channel The channel to configure.
+ * @param resampler MIXER_RESAMPLER_NEAREST or MIXER_RESAMPLER_POLYPHASE.
+ * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+ */
+int Mixer2::setResampler(MixerChannel *channel, int resampler)
+{
+    if (channel == NULL || (resampler != MIXER_RESAMPLER_NEAREST && resampler != MIXER_RESAMPLER_POLYPHASE))
+        return DEVICE_INVALID_PARAMETER;
+
+    channel->resampler = resampler;
+    configureResampler(channel);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures the mixer to stop driving its output after a period of silence.
+ * Once the given number of consecutive silent buffers have been generated, the mixer stops issuing pull requests
+ * to its downstream sink and raises DEVICE_MIXER_EVT_SUSPEND, allowing the output hardware to be powered down.
+ * The mixer resumes, raising DEVICE_MIXER_EVT_RESUME, as soon as any channel has data available or resume() is called.
+ *
+ * @param silentBuffers The number of silent buffers to wait for before suspending, or zero to disable auto-suspend.
+ * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+ */
+int Mixer2::setAutoSuspend(int silentBuffers)
+{
+    if (silentBuffers < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    autoSuspend = silentBuffers;
+
+    if (autoSuspend == 0)
+        resume();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if the mixer has suspended its output.
+ * @return true if the mixer is suspended.
+ */
+bool Mixer2::isSuspended()
+{
+    return suspended;
+}
+
+/**
+ * Restarts a suspended mixer, by issuing a pull request to the downstream sink.
+ * Has no effect if the mixer is not suspended.
+ */
+void Mixer2::resume()
+{
+    if (!suspended)
+        return;
+
+    suspended = false;
+    silentBuffers = 0;
+    lastPullTime = 0;
+
+    Event(DEVICE_ID_MIXER, DEVICE_MIXER_EVT_RESUME);
+
+    if (downStream)
+        downStream->pullRequest();
+}
+
+/**
+ * Configures an optional peak limiter on the mixer output.
+ * When enabled, the combined output of all channels is measured once per buffer, and the output gain is reduced
+ * immediately whenever a buffer would exceed the threshold, then allowed to recover over the release time. This
+ * avoids the harsh distortion of clipping when several loud channels play at once.
+ *
+ * @param threshold The output level at which limiting begins, in the range 1..1023 (full scale), or zero to disable the limiter.
+ * @param releaseTime The time taken for the gain to recover after a peak, in milliseconds.
+ * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+ */
+int Mixer2::setLimiter(int threshold, int releaseTime)
+{
+    if (threshold < 0 || threshold > CONFIG_MIXER_INTERNAL_RANGE || releaseTime < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    limiterThreshold = threshold;
+    limiterReleaseTime = releaseTime;
+    limiterGain = 1 << MIXER_FIXED_POINT_BITS;
+    configureLimiter();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the gain currently applied by the output limiter.
+ * @return the gain in the range 0..1023, where 1023 indicates no gain reduction.
+ */
+int Mixer2::getLimiterGain()
+{
+    return (int) (((int64_t) limiterGain * CONFIG_MIXER_INTERNAL_RANGE) >> MIXER_FIXED_POINT_BITS);
+}
+
+/**
+ * Determine the statistics gathered for this mixer.
+ * @return A snapshot of the mixer's counters.
+ */
+MixerStatistics Mixer2::getStatistics()
+{
+    MixerStatistics s;
+
+    s.pulls = pulls;
+    s.underruns = underruns;
+    s.maxCycles = maxCycles;
+    s.lastCycles = lastCycles;
+    s.averageCycles = pulls ? (uint32_t) (totalCycles / pulls) : 0;
+
+    return s;
+}
+
+/**
+ * Resets the statistics of this mixer and all of its channels.
+ */
+void Mixer2::resetStatistics()
+{
+    pulls = 0;
+    underruns = 0;
+    maxCycles = 0;
+    lastCycles = 0;
+    totalCycles = 0;
+    lastPullTime = 0;
+
+    for (MixerChannel *c = channels; c; c = c->next)
+    {
+        c->buffers = 0;
+        c->underruns = 0;
+    }
+}
+
+/**
+ * Determine the time taken for a sample generated now to reach the output, based on the buffers held by
+ * the mixer and its downstream sink. Add MixerChannel::getLatency() to obtain the latency from a given source.
+ *
+ * @return The output latency, in microseconds.
+ */
+int Mixer2::getOutputLatency()
+{
+    float samples = (float) (CONFIG_MIXER_SINK_BUFFERS * bufferSize);
+    return (int) (samples * 1000000.0f / outputRate);
+}
+
+/**
+ * Defines the number of samples generated by each pull() operation.
+ * Smaller buffers reduce the time between a sound being requested and it reaching the output,
+ * at the cost of more frequent processing. The downstream sink continues to double buffer,
+ * requesting the next buffer as each one starts to play.
+ *
+ * @param samples The number of samples per buffer, in the range 1..CONFIG_MIXER_BUFFER_SIZE, or zero to
+ * restore the default of CONFIG_MIXER_BUFFER_SIZE bytes per buffer.
+ * @return DEVICE_OK on success or DEVICE_INVALID_PARAMETER.
+ */
+int Mixer2::setBufferSize(int samples)
+{
+    if (samples < 0 || samples > CONFIG_MIXER_BUFFER_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    requestedBufferSize = samples;
+    bufferSize = samples ? samples : CONFIG_MIXER_BUFFER_SIZE / bytesPerSampleOut;
+    configureLimiter();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the number of samples generated by each pull() operation.
+ * @return The number of samples per buffer.
+ */
+int Mixer2::getBufferSize()
+{
+    return bufferSize;
+}
@@ -33,6 +33,8 @@ DEALINGS IN THE SOFTWARE.
 
 using namespace codal;
 
+FiberLock NRF52FlashManager::flashLock;
+
 /*
  * The underlying Nordic libraries that support BLE do not compile cleanly with the stringent GCC settings we employ
  * If we're compiling under GCC, then we suppress any warnings generated from this code (but not the rest of the DAL)
@@ -41,7 +43,15 @@ using namespace codal;
  */
 extern "C" void btle_set_user_evt_handler(void (*func)(uint32_t));
 
-static volatile bool flash_op_complete = false;
+#ifdef SOFTDEVICE_PRESENT
+
+// State of the FLASH operation scheduled through the SoftDevice, if any.
+#define NRF52_FLASH_OP_IDLE         0
+#define NRF52_FLASH_OP_PENDING      1
+#define NRF52_FLASH_OP_SUCCESS      2
+#define NRF52_FLASH_OP_ERROR        3
+
+static volatile int flash_op_state = NRF52_FLASH_OP_IDLE;
 
 /*
  * When SoftDevice is present,
@@ -49,18 +59,150 @@ static volatile bool flash_op_complete = false;
  * Events are delivered here via nrf_sdh and nrf_sdh_soc
  * See NRF_SDH_DISPATCH_MODEL
  */
-#ifdef SOFTDEVICE_PRESENT
-
 static void nvmc_event_handler(uint32_t sys_evt, void *)
 {
+    // Operations scheduled by other modules (such as the BLE bond store) raise the same events, so ignore any we're not waiting for.
+    if (flash_op_state != NRF52_FLASH_OP_PENDING)
+        return;
+
     if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS)
-        flash_op_complete = true;
+        flash_op_state = NRF52_FLASH_OP_SUCCESS;
+
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)
+        flash_op_state = NRF52_FLASH_OP_ERROR;
 }
 
 NRF_SDH_SOC_OBSERVER( nrf52flash_soc_observer, 0, nvmc_event_handler, NULL);
 
+/**
+ * Determine if FLASH operations must be scheduled through the SoftDevice.
+ */
+static bool softdevice_enabled()
+{
+    uint8_t sd_enabled = 0;
+    sd_softdevice_is_enabled(&sd_enabled);
+
+    return sd_enabled != 0;
+}
+
+/**
+ * Wait for the SoftDevice to complete the FLASH operation scheduled.
+ * The calling fiber yields while it waits if NRF52_FLASH_YIELD_WHEN_BUSY is set, unless called from an interrupt.
+ * @return true if the operation succeeded, false if the SoftDevice could not find time to perform it.
+ */
+static bool softdevice_wait()
+{
+    while (flash_op_state == NRF52_FLASH_OP_PENDING)
+    {
+#if NRF52_FLASH_YIELD_WHEN_BUSY
+        if (fiber_scheduler_running() && __get_IPSR() == 0)
+            schedule();
+#endif
+    }
+
+    bool success = flash_op_state == NRF52_FLASH_OP_SUCCESS;
+    flash_op_state = NRF52_FLASH_OP_IDLE;
+
+    return success;
+}
+
+#endif
+
+/**
+ * Erases a page of internal FLASH memory.
+ * When the SoftDevice is enabled, the erase is scheduled through it, such that radio activity is not disturbed,
+ * and completes on NRF_EVT_FLASH_OPERATION_SUCCESS. The erase is retried if the SoftDevice reports that it
+ * could not be performed. Otherwise the NVMC is used directly.
+ *
+ * @param address The physical address of the start of the page.
+ */
+void NRF52FlashManager::erasePage(uint32_t address)
+{
+#ifdef SOFTDEVICE_PRESENT
+    if (softdevice_enabled())
+    {
+        // Only one fiber may wait for the SoftDevice at a time.
+        flashLock.wait();
+
+        do
+        {
+            // The state is set first, as the SoftDevice may complete the operation before the call returns.
+            flash_op_state = NRF52_FLASH_OP_PENDING;
+            while (sd_flash_page_erase(address / NRF_FICR->CODEPAGESIZE) != NRF_SUCCESS)
+            {
+                system_timer_wait_ms(10);
+                flash_op_state = NRF52_FLASH_OP_PENDING;
+            }
+        } while (!softdevice_wait());
+
+        flashLock.notify();
+    }
+    else
+#endif
+    {
+        // Turn on flash erase enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+        
+        // Erase page:
+        NRF_NVMC->ERASEPAGE = address;
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+
+        // Turn off flash erase enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+    }
+}
+
+/**
+ * Programs words of internal FLASH memory, which must already be erased (or have only bits cleared).
+ * When the SoftDevice is enabled, the write is scheduled through it, such that radio activity is not disturbed,
+ * and completes on NRF_EVT_FLASH_OPERATION_SUCCESS. The write is retried if the SoftDevice reports that it
+ * could not be performed. Otherwise the NVMC is used directly.
+ *
+ * @param address The physical address to write to. Must be word aligned.
+ * @param data The data to write. Must be word aligned.
+ * @param length The number of 32-bit words to write.
+ */
+void NRF52FlashManager::program(uint32_t *address, uint32_t *data, uint32_t length)
+{
+#ifdef SOFTDEVICE_PRESENT
+    if (softdevice_enabled())
+    {
+        // Only one fiber may wait for the SoftDevice at a time.
+        flashLock.wait();
+
+        do
+        {
+            // The state is set first, as the SoftDevice may complete the operation before the call returns.
+            flash_op_state = NRF52_FLASH_OP_PENDING;
+            while (sd_flash_write(address, data, length) != NRF_SUCCESS)
+            {
+                system_timer_wait_ms(10);
+                flash_op_state = NRF52_FLASH_OP_PENDING;
+            }
+        } while (!softdevice_wait());
+
+        flashLock.notify();
+    }
+    else
 #endif
+    {
+        // Turn on flash write enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+
+        for(uint32_t i=0;i<length;i++)
+        {
+            *(address+i) = *(data+i);
+            while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+        }
 
+        // Turn off flash write enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+    }
+}
 
 /**
  * Constructor.
@@ -106,48 +248,7 @@ NRF52FlashManager::read(uint32_t* dest, uint32_t address, uint32_t length)
 int 
 NRF52FlashManager::write(uint32_t address, uint32_t *data, uint32_t length)
 {
-    address += startAddress;
-
-#ifdef SOFTDEVICE_PRESENT
-    // Schedule SoftDevice to write this memory for us, and wait for it to complete.
-    // This happens ASYNCHRONOUSLY when SD is enabled (and synchronously if disabled!!)
-    uint8_t sd_enabled = 0;
-    sd_softdevice_is_enabled(&sd_enabled);
-
-    if (sd_enabled)
-    {
-        flash_op_complete = false;
-
-        while(1)
-        {
-            if (sd_flash_write((uint32_t *) address, data, length) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else
-#endif
-    {
-        uint32_t *addr = (uint32_t *) address;
-
-        // Turn on flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-
-        for(uint32_t i=0;i<length;i++)
-        {
-            *(addr+i) = *(data+i);
-            while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-        }
-
-        // Turn off flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-    }
+    program((uint32_t *) (startAddress + address), data, length);
     return DEVICE_OK;
 }
 
@@ -159,40 +260,7 @@ NRF52FlashManager::write(uint32_t address, uint32_t *data, uint32_t length)
 int
 NRF52FlashManager::erase(uint32_t page)
 {
-    page += startAddress;
-
-#ifdef SOFTDEVICE_PRESENT
-    uint8_t sd_enabled = 0;
-    sd_softdevice_is_enabled(&sd_enabled);
-    
-    if (sd_enabled)
-    {
-        flash_op_complete = false;
-        while(1)
-        {
-            if (sd_flash_page_erase(page / pageSize) == NRF_SUCCESS)
-                break;
-
-            system_timer_wait_ms(10);
-        }
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else   
-#endif
-    {
-        // Turn on flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-        
-        // Erase page:
-        NRF_NVMC->ERASEPAGE = page;
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-
-        // Turn off flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-    }
+    erasePage(startAddress + page);
     return DEVICE_OK;
 }
 
@@ -244,6 +312,22 @@ NRF52FlashManager::getFlashSize()
     return pageCount * pageSize;
 }
 
+/**
+ * Determines the memory mapped address of the given logical address.
+ * Internal FLASH can be read in place, avoiding a copy into RAM.
+ *
+ * @param address The logical address in non-volatile memory.
+ * @return A pointer to the data at the given address, or NULL if the address is out of range.
+ */
+const uint8_t *
+NRF52FlashManager::getMemoryAddress(uint32_t address)
+{
+    if (address >= getFlashSize())
+        return NULL;
+
+    return (const uint8_t *) (startAddress + address);
+}
+
 /**
  * Destructor.
  */
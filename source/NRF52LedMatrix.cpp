@@ -31,10 +31,16 @@ DEALINGS IN THE SOFTWARE.
 #include "NRF52Pin.h"
 #include "CodalDmesg.h"
 #include "ErrorNo.h"
+#include "MicroBitConfig.h"
+#include "MicroBitPowerProfiler.h"
+#include "MicroBitTrace.h"
+#include "Timer.h"
+#include <string.h>
 
 using namespace codal;
 
 static NRF52LEDMatrix *instance = NULL;
+static NRF_PWM_Type * const pwmInstance[NRF52_LEDMATRIX_PWM_INSTANCES] = { NRF52_LEDMATRIX_PWM_INSTANCE_0, NRF52_LEDMATRIX_PWM_INSTANCE_1 };
 
 static void display_irq(uint16_t mask)
 {
@@ -53,18 +59,29 @@ static void display_irq(uint16_t mask)
  * @param id The id the display should use when sending events on the MessageBus. Defaults to DEVICE_ID_DISPLAY.
  * @param mode The DisplayMode to use. Default: DISPLAY_MODE_BLACK_AND_WHITE.
  */
-NRF52LEDMatrix::NRF52LEDMatrix(NRFLowLevelTimer &displayTimer, const MatrixMap &map, uint16_t id, DisplayMode mode) : Display(map.width, map.height, id), matrixMap(map), timer(displayTimer)
+NRF52LEDMatrix::NRF52LEDMatrix(NRFLowLevelTimer &displayTimer, const MatrixMap &map, uint16_t id, DisplayMode mode) : Display(map.width, map.height, id), matrixMap(map), timer(displayTimer), backBuffer(map.width, map.height)
 {
     rotation = MATRIX_DISPLAY_ROTATION_0;
     enabled = false;
     strobeRow = 0;
     instance = this;
     lightLevel = 0;
+    frequency = NRF52_LED_MATRIX_FREQUENCY;
+    hardwareRefresh = NRF52_LED_MATRIX_HARDWARE_REFRESH;
+    pwmPrescaler = 0;
+    pwmBuffer = 0;
+    presentPending = false;
+    frameLit = 0;
+    lightSenseRequested = false;
+    lightSensePeriod = NRF52_LED_MATRIX_LIGHTSENSE_PERIOD;
+    lightSenseTime = 0;
     this->mode = mode;
 
     // Validate that we can deliver the requested display.
-    if (matrixMap.columns <= NRF52_LED_MATRIX_MAXIMUM_COLUMNS)
+    if (matrixMap.columns <= NRF52_LED_MATRIX_MAXIMUM_COLUMNS && matrixMap.rows <= NRF52_LED_MATRIX_MAXIMUM_ROWS)
     {
+        updatePixelIndex();
+
         // Configure as a fixed period timer
         timer.setMode(TimerMode::TimerModeTimer);
         timer.setClockSpeed(NRF52_LED_MATRIX_CLOCK_FREQUENCY/1000);
@@ -86,6 +103,23 @@ NRF52LEDMatrix::NRF52LEDMatrix(NRFLowLevelTimer &displayTimer, const MatrixMap &
  */
 void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
 {
+    // Resume refresh, if it was suspended while the display was blank.
+    if (status & NRF52_LEDMATRIX_STATUS_SUSPENDED)
+    {
+        status &= ~(NRF52_LEDMATRIX_STATUS_SUSPENDED | DEVICE_COMPONENT_STATUS_IDLE_TICK);
+
+        // Start the next frame from the first row.
+        strobeRow = timeslots - 1;
+        frameLit = 0;
+
+        if (enabled)
+            timer.timer->TASKS_START = 1;
+    }
+
+    // Return the hardware to the per-row interrupt configuration, if it is being refreshed in hardware.
+    if (status & NRF52_LEDMATRIX_STATUS_SEQUENCED)
+        stopSequence();
+
     // Allocate GPIOTE and PPI channels
     // TODO: use a global allocator here, rather than static allocation.
     if (!enabled || (status & NRF52_LEDMATRIX_STATUS_RESET))
@@ -95,7 +129,9 @@ void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
             gpiote[channel] = NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE + channel;
             ppi[channel] = NRF52_LEDMATRIX_PPI_CHANNEL_BASE + channel;
 
-            NRF_GPIOTE->CONFIG[gpiote[channel]] = 0x00010003 | (matrixMap.columnPins[channel]->name << 8);
+            gpioteConfig[channel] = 0x00010003 | (matrixMap.columnPins[channel]->name << 8);
+
+            NRF_GPIOTE->CONFIG[gpiote[channel]] = gpioteConfig[channel];
             NRF_PPI->CH[ppi[channel]].EEP = (uint32_t) &timer.timer->EVENTS_COMPARE[channel+1];
             NRF_PPI->CH[ppi[channel]].TEP = (uint32_t) &NRF_GPIOTE->TASKS_SET[gpiote[channel]];
             NRF_PPI->CHENSET = 1 << ppi[channel];
@@ -103,19 +139,253 @@ void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
         status &= ~NRF52_LEDMATRIX_STATUS_RESET;
     }
 
-    // Determine the number of timeslots we'll need.
+    // Determine the number of timeslots we'll need. Light sense slots are only added on demand, so aren't included.
     timeslots = matrixMap.rows;
 
-    if (mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE || mode == DISPLAY_MODE_GREYSCALE_LIGHT_SENSE)
-        timeslots++;
-
-    timerPeriod = NRF52_LED_MATRIX_CLOCK_FREQUENCY / (NRF52_LED_MATRIX_FREQUENCY * timeslots);
+    timerPeriod = NRF52_LED_MATRIX_CLOCK_FREQUENCY / (frequency * timeslots);
     quantum = (timerPeriod * brightness) / (256 * 255);
-    
+    this->mode = mode;
+
+    // Light sensing needs the per-row interrupt, so only refresh in hardware when not in a light sense mode.
+    // If another driver holds one of our PWM instances, carry on with the per-row interrupt instead.
+    if (hardwareRefresh && mode != DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE && mode != DISPLAY_MODE_GREYSCALE_LIGHT_SENSE && startSequence())
+        return;
+
     timer.setCompare(0, timerPeriod);
     timer.timer->TASKS_CLEAR = 1;
+}
 
-    this->mode = mode;
+/**
+ * Hands the refresh of the display over to the PWM, PPI and GPIOTE hardware.
+ *
+ * Each column is driven by a PWM channel, whose compare value is streamed by EasyDMA from a sequence holding
+ * one entry per row. Every PWM period end is counted by the display timer through PPI, and each count
+ * compare event sets the GPIO of the next row and clears the previous one through GPIOTE. The rows follow
+ * the PWM periods exactly, so the two can never drift apart. The only interrupt is the wrap at the end of
+ * each frame, where the sequence is rebuilt from the current image.
+ *
+ * @return true on success, or false if one of the PWM instances is in use by another driver.
+ */
+bool NRF52LEDMatrix::startSequence()
+{
+    // An instance is only left enabled by us while sequenced, so any other that is enabled belongs to another driver.
+    for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+        if (pwmInstance[i]->ENABLE)
+            return false;
+
+    // Find the smallest PWM prescaler that fits a row period into the 15 bit PWM counter.
+    pwmPrescaler = 0;
+    while ((timerPeriod >> pwmPrescaler) > 0x7FFF && pwmPrescaler < 7)
+        pwmPrescaler++;
+
+    timerPeriod = (timerPeriod >> pwmPrescaler) << pwmPrescaler;
+    quantum = (timerPeriod * brightness) / (256 * 255);
+
+    updateSequence();
+
+    // Count PWM periods, rather than clock ticks. The count resets at the end of each frame.
+    timer.timer->TASKS_STOP = 1;
+    timer.setMode(TimerMode::TimerModeCounter);
+    timer.timer->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+
+    // Release the GPIOTE and PPI channels used to drive the columns. These are reused to drive the rows.
+    for (int column = 0; column < matrixMap.columns; column++)
+    {
+        NRF_PPI->CHENCLR = 1 << ppi[column];
+        NRF_GPIOTE->CONFIG[gpiote[column]] = 0;
+    }
+
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        int channel = NRF52_LEDMATRIX_PPI_CHANNEL_BASE + row;
+        int previous = NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE + (row + matrixMap.rows - 1) % matrixMap.rows;
+
+        // Row GPIO is driven by GPIOTE tasks, starting low.
+        matrixMap.rowPins[row]->setDigitalValue(0);
+        NRF_GPIOTE->CONFIG[NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE + row] = 0x00000003 | (matrixMap.rowPins[row]->name << 8);
+
+        // Row 0 starts once the final row of the previous frame has been shown.
+        if (row == 0)
+            timer.setCompare(0, matrixMap.rows);
+        else
+            timer.timer->CC[row] = row;
+
+        NRF_PPI->CH[channel].EEP = (uint32_t) &timer.timer->EVENTS_COMPARE[row];
+        NRF_PPI->CH[channel].TEP = (uint32_t) &NRF_GPIOTE->TASKS_SET[NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE + row];
+        NRF_PPI->FORK[channel].TEP = (uint32_t) &NRF_GPIOTE->TASKS_CLR[previous];
+        NRF_PPI->CHENSET = 1 << channel;
+    }
+
+    NRF_PPI->CH[NRF52_LEDMATRIX_PPI_SYNC_CHANNEL].EEP = (uint32_t) &pwmInstance[0]->EVENTS_PWMPERIODEND;
+    NRF_PPI->CH[NRF52_LEDMATRIX_PPI_SYNC_CHANNEL].TEP = (uint32_t) &timer.timer->TASKS_COUNT;
+    NRF_PPI->CHENSET = 1 << NRF52_LEDMATRIX_PPI_SYNC_CHANNEL;
+
+    timer.timer->TASKS_CLEAR = 1;
+    timer.timer->TASKS_START = 1;
+
+    for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+    {
+        NRF_PWM_Type *pwm = pwmInstance[i];
+
+        // Column GPIO defaults HIGH (off) whenever the PWM is not driving it.
+        for (int channel = 0; channel < NRF52_LEDMATRIX_PWM_CHANNELS; channel++)
+        {
+            int column = i * NRF52_LEDMATRIX_PWM_CHANNELS + channel;
+
+            if (column < matrixMap.columns)
+            {
+                matrixMap.columnPins[column]->setDigitalValue(1);
+                pwm->PSEL.OUT[channel] = matrixMap.columnPins[column]->name;
+            }
+            else
+            {
+                pwm->PSEL.OUT[channel] = 0xFFFFFFFF;
+            }
+        }
+
+        pwm->ENABLE = 1;
+        pwm->MODE = PWM_MODE_UPDOWN_Up;
+        pwm->COUNTERTOP = timerPeriod >> pwmPrescaler;
+        pwm->PRESCALER = pwmPrescaler;
+        pwm->DECODER = (PWM_DECODER_LOAD_Individual << PWM_DECODER_LOAD_Pos) | (PWM_DECODER_MODE_RefreshCount << PWM_DECODER_MODE_Pos);
+
+        // Play the same sequence as SEQ0 and SEQ1, looping seamlessly.
+        for (int seq = 0; seq < 2; seq++)
+        {
+            pwm->SEQ[seq].PTR = (uint32_t) pwmSequence[pwmBuffer][i];
+            pwm->SEQ[seq].CNT = matrixMap.rows * NRF52_LEDMATRIX_PWM_CHANNELS;
+            pwm->SEQ[seq].REFRESH = 0;
+            pwm->SEQ[seq].ENDDELAY = 0;
+        }
+
+        pwm->LOOP = PWM_LOOP_CNT_Msk;
+        pwm->SHORTS = PWM_SHORTS_LOOPSDONE_SEQSTART0_Msk;
+    }
+
+    // Start all column PWMs together, so that they share the same period boundaries.
+    for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+        pwmInstance[i]->TASKS_SEQSTART[0] = 1;
+
+    status |= NRF52_LEDMATRIX_STATUS_SEQUENCED;
+
+    return true;
+}
+
+/**
+ * Determines if a PWM instance is still configured to drive our columns.
+ *
+ * @param instance The index of the instance, in the range 0..NRF52_LEDMATRIX_PWM_INSTANCES-1.
+ *
+ * @return true if the instance drives our columns, false if another driver has taken it over.
+ */
+bool NRF52LEDMatrix::ownsPwm(int instance)
+{
+    int column = instance * NRF52_LEDMATRIX_PWM_CHANNELS;
+
+    if (column >= matrixMap.columns)
+        return true;
+
+    return pwmInstance[instance]->ENABLE && pwmInstance[instance]->PSEL.OUT[0] == matrixMap.columnPins[column]->name;
+}
+
+/**
+ * Returns the refresh of the display to the per-row timer interrupt.
+ */
+void NRF52LEDMatrix::stopSequence()
+{
+    NRF_PPI->CHENCLR = 1 << NRF52_LEDMATRIX_PPI_SYNC_CHANNEL;
+
+    for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+    {
+        NRF_PWM_Type *pwm = pwmInstance[i];
+
+        // Leave an instance that another driver has taken over to that driver.
+        if (!ownsPwm(i))
+            continue;
+
+        pwm->SHORTS = 0;
+        pwm->TASKS_STOP = 1;
+        while (pwm->ENABLE && pwm->EVENTS_STOPPED == 0);
+        pwm->EVENTS_STOPPED = 0;
+        pwm->ENABLE = 0;
+
+        for (int channel = 0; channel < NRF52_LEDMATRIX_PWM_CHANNELS; channel++)
+            pwm->PSEL.OUT[channel] = 0xFFFFFFFF;
+    }
+
+    timer.timer->TASKS_STOP = 1;
+    timer.timer->SHORTS = 0;
+    timer.setMode(TimerMode::TimerModeTimer);
+
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        NRF_PPI->CHENCLR = 1 << (NRF52_LEDMATRIX_PPI_CHANNEL_BASE + row);
+        NRF_PPI->FORK[NRF52_LEDMATRIX_PPI_CHANNEL_BASE + row].TEP = 0;
+        NRF_GPIOTE->CONFIG[NRF52_LEDMATRIX_GPIOTE_CHANNEL_BASE + row] = 0;
+        matrixMap.rowPins[row]->setDigitalValue(0);
+
+        if (row > 0)
+            timer.timer->CC[row] = 0;
+    }
+
+    timer.timer->TASKS_CLEAR = 1;
+    timer.timer->TASKS_START = 1;
+
+    // Reallocate the GPIOTE and PPI channels for the column outputs on the next mode change.
+    strobeRow = 0;
+    status |= NRF52_LEDMATRIX_STATUS_RESET;
+    status &= ~NRF52_LEDMATRIX_STATUS_SEQUENCED;
+}
+
+/**
+ * Rebuilds the PWM compare values streamed to the columns from the current image.
+ *
+ * The values are built in the half of pwmSequence not being streamed, and the sequence pointers then moved to it.
+ * Each PWM latches its pointer as a sequence starts, during the last row of a frame, so the frame in progress
+ * is never rewritten and the new one is shown whole from its first row.
+ *
+ * @return Non-zero if any of the compare values lights an LED.
+ */
+uint32_t NRF52LEDMatrix::updateSequence()
+{
+    uint8_t next = pwmBuffer ^ 1;
+    uint32_t lit = 0;
+    uint8_t *screenBuffer = image.getBitmap();
+    bool clip = (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE);
+    uint32_t full = 255 * quantum;
+
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        const uint8_t *index = pixelIndex[row];
+
+        for (int column = 0; column < matrixMap.columns; column++)
+        {
+            uint32_t value = screenBuffer[index[column]];
+
+            if (clip)
+                value = value ? full : 0;
+            else
+                value = value * quantum;
+
+            // Columns are active LOW, so each period starts low and rises at the compare value (POLARITY RisingEdge).
+            value = value >> pwmPrescaler;
+            pwmSequence[next][column / NRF52_LEDMATRIX_PWM_CHANNELS][row * NRF52_LEDMATRIX_PWM_CHANNELS + column % NRF52_LEDMATRIX_PWM_CHANNELS] = value;
+            lit |= value;
+        }
+    }
+
+    pwmBuffer = next;
+
+    if (status & NRF52_LEDMATRIX_STATUS_SEQUENCED)
+    {
+        for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+        {
+            pwmInstance[i]->SEQ[0].PTR = (uint32_t) pwmSequence[next][i];
+            pwmInstance[i]->SEQ[1].PTR = (uint32_t) pwmSequence[next][i];
+        }
+    }
+
+    return lit;
 }
 
 /**
@@ -140,6 +410,42 @@ DisplayMode NRF52LEDMatrix::getDisplayMode()
 void NRF52LEDMatrix::rotateTo(DisplayRotation rotation)
 {
     this->rotation = rotation;
+    updatePixelIndex();
+}
+
+/**
+ * Rebuilds the table of image offsets strobed for each row and column, following a change of rotation.
+ */
+void NRF52LEDMatrix::updatePixelIndex()
+{
+    for (int row = 0; row < matrixMap.rows; row++)
+    {
+        MatrixPoint *p = (MatrixPoint *)matrixMap.map + row;
+
+        for (int column = 0; column < matrixMap.columns; column++)
+        {
+            uint8_t index;
+
+            switch (this->rotation)
+            {
+              case MATRIX_DISPLAY_ROTATION_90:
+                index = p->x * width + width - 1 - p->y;
+                break;
+              case MATRIX_DISPLAY_ROTATION_180:
+                index = (height - 1 - p->y) * width + width - 1 - p->x;
+                break;
+              case MATRIX_DISPLAY_ROTATION_270:
+                index = (height - 1 - p->x) * width + p->y;
+                break;
+              default:
+                index = p->y * width + p->x;
+                break;
+            }
+
+            pixelIndex[row][column] = index;
+            p += matrixMap.rows;
+        }
+    }
 }
 
 /**
@@ -171,6 +477,7 @@ void NRF52LEDMatrix::enable()
     timer.enableIRQ();
 
     enabled = true;
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_DISPLAY, true);
 }
 
 /**
@@ -187,6 +494,11 @@ void NRF52LEDMatrix::disable()
     if (!enabled)
         return;
 
+    if (status & NRF52_LEDMATRIX_STATUS_SEQUENCED)
+        stopSequence();
+
+    status &= ~(NRF52_LEDMATRIX_STATUS_SUSPENDED | DEVICE_COMPONENT_STATUS_IDLE_TICK);
+
     // Disable the timer that drivers the display
     timer.disable();
     timer.disableIRQ();
@@ -205,16 +517,40 @@ void NRF52LEDMatrix::disable()
     status &= ~NRF52_LEDMATRIX_STATUS_LIGHTREADY;
 
     enabled = false;
+    MicroBitPowerProfiler::setActive(MICROBIT_POWER_PROFILE_DISPLAY, false);
 }
 
 /**
  * Configure the next frame to be drawn.
  */
-void NRF52LEDMatrix::render()
+MICROBIT_RAMFUNC void NRF52LEDMatrix::render()
 {
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_LEDMATRIX_RENDER);
+
     uint8_t *screenBuffer = image.getBitmap();
     uint32_t value;
 
+    // When refreshed in hardware, we are only interrupted at the end of each frame to pick up the latest image.
+    if (status & NRF52_LEDMATRIX_STATUS_SEQUENCED)
+    {
+        // If another driver (such as neopixel) has taken over one of our PWM instances, fall back on the per-row interrupt.
+        for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+        {
+            if (!ownsPwm(i))
+            {
+                setDisplayMode(mode);
+                return;
+            }
+        }
+
+        bool presented = endFrame();
+
+        if (!updateSequence() && !presented)
+            suspend();
+
+        return;
+    }
+
     if (strobeRow < matrixMap.rows)
     {
         // We just completed a normal diplay strobe. 
@@ -226,6 +562,7 @@ void NRF52LEDMatrix::render()
         // We just completed a light sense strobe. Record the light level sensed.
         lightLevel = 255 - ((255 * timer.timer->CC[1]) / (timerPeriod * NRF52_LED_MATRIX_LIGHTSENSE_STROBES));
         status |= NRF52_LEDMATRIX_STATUS_LIGHTREADY;
+        lightSenseRequested = false;
 
         // Restore the hardware configuration into LED drive mode.
         status |= NRF52_LEDMATRIX_STATUS_RESET;
@@ -235,49 +572,49 @@ void NRF52LEDMatrix::render()
     // Stop the timer temporarily, to avoid possible race conditions.
     timer.timer->TASKS_STOP = 1;
 
-    // Move on to the next row.
-    strobeRow = (strobeRow + 1) % timeslots;
+    // Move on to the next row, or to a light sense slot after the last row if a reading has been requested.
+    strobeRow++;
+
+    if (strobeRow > timeslots || (strobeRow == timeslots && !lightSenseRequested))
+        strobeRow = 0;
+
+    if (strobeRow == 0)
+    {
+        uint32_t lit = frameLit;
+        frameLit = 0;
+
+        // Stop refreshing a blank display, unless a light sense slot is requested.
+        if (!endFrame() && !lit && !lightSenseRequested)
+        {
+            suspend();
+            return;
+        }
+    }
 
     if(strobeRow < matrixMap.rows)
     {
         // Common case - configure timer values.
-        MatrixPoint *p = (MatrixPoint *)matrixMap.map + strobeRow;
+        // The image offsets for this row are precomputed for the current rotation, and the GPIOTE configuration
+        // is written as a whole word, to keep the time spent in this interrupt to a minimum.
+        const uint8_t *index = pixelIndex[strobeRow];
+        bool clip = (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE);
+        uint32_t full = 255 * quantum;
 
         for (int column = 0; column < matrixMap.columns; column++)
         {
-            switch ( this->rotation)
-            {
-              case MATRIX_DISPLAY_ROTATION_0:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_90:
-                value = screenBuffer[ p->x * width + width - 1 - p->y];
-                break;
-              case MATRIX_DISPLAY_ROTATION_180:
-                value = screenBuffer[ (height - 1 - p->y) * width + width - 1 - p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_270:
-                value = screenBuffer[ ( height - 1 - p->x) * width + p->y];
-                break;
-              default:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-            }
+            value = screenBuffer[index[column]];
 
             // Clip pixels to full or zero brightness if in black and white mode.
-            if (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE)
-                value = value ? 255 : 0;
+            if (clip)
+                value = value ? full : 0;
+            else
+                value = value * quantum;
 
-            value = value * quantum;
             timer.timer->CC[column+1] = value;
+            frameLit |= value;
 
             // Set the initial polarity of the column output to HIGH if the pixel brightness is >0. LOW otherwise.
-            if (value)
-                NRF_GPIOTE->CONFIG[gpiote[column]] &= ~0x00100000;
-            else
-                NRF_GPIOTE->CONFIG[gpiote[column]] |= 0x00100000;
-            
-            p += matrixMap.rows;
+            NRF_GPIOTE->CONFIG[gpiote[column]] = value ? gpioteConfig[column] : gpioteConfig[column] | 0x00100000;
         }
 
         // Enable the drive pin, and start the timer.
@@ -313,6 +650,87 @@ void NRF52LEDMatrix::render()
     timer.timer->TASKS_START = 1;
 }
 
+/**
+ * Presents the back buffer, if requested. Called at the end of each frame.
+ */
+bool NRF52LEDMatrix::endFrame()
+{
+    if (!presentPending)
+        return false;
+
+    memcpy(image.getBitmap(), backBuffer.getBitmap(), width * height);
+    presentPending = false;
+
+    Event(id, NRF52_LEDMATRIX_EVT_FRAME);
+
+    return true;
+}
+
+/**
+ * Stops refreshing the display while it is blank. Called at the end of a frame that lit no LEDs.
+ */
+void NRF52LEDMatrix::suspend()
+{
+    if (!NRF52_LED_MATRIX_AUTO_SUSPEND)
+        return;
+
+    // All rows are already off (or, when refreshed in hardware, are driven against columns that are all off).
+    timer.timer->TASKS_STOP = 1;
+
+    if (status & NRF52_LEDMATRIX_STATUS_SEQUENCED)
+    {
+        for (int i = 0; i < NRF52_LEDMATRIX_PWM_INSTANCES; i++)
+            pwmInstance[i]->TASKS_STOP = 1;
+    }
+
+    // Check for a non-blank image whenever the scheduler is next idle.
+    status |= NRF52_LEDMATRIX_STATUS_SUSPENDED | DEVICE_COMPONENT_STATUS_IDLE_TICK;
+}
+
+/**
+ * Resumes refresh of a suspended display, when the image is no longer blank.
+ */
+void NRF52LEDMatrix::idleCallback()
+{
+    if (!enabled || !(status & NRF52_LEDMATRIX_STATUS_SUSPENDED) || quantum == 0)
+        return;
+
+    uint8_t *screenBuffer = image.getBitmap();
+
+    for (int i = 0; i < width * height; i++)
+    {
+        if (screenBuffer[i])
+        {
+            setDisplayMode(mode);
+            return;
+        }
+    }
+}
+
+/**
+ * Requests that the back buffer is shown, once the frame currently being displayed is complete.
+ *
+ * The back buffer is copied into the displayed image between the last row of one frame and the first row of
+ * the next, so its changes never appear mid-frame. A NRF52_LEDMATRIX_EVT_FRAME event is raised once
+ * the copy is complete, so an animation can draw its next frame into the back buffer in a listener
+ * (or after fiber_wait_for_event()), and progress at the display's frame rate without tearing.
+ *
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER if the back buffer is not the size of the display.
+ */
+int NRF52LEDMatrix::present()
+{
+    if (backBuffer.getWidth() != width || backBuffer.getHeight() != height || image.getWidth() != width || image.getHeight() != height)
+        return DEVICE_INVALID_PARAMETER;
+
+    presentPending = true;
+
+    // A disabled or suspended display is not refreshed, so present immediately.
+    if (!enabled || (status & NRF52_LEDMATRIX_STATUS_SUSPENDED))
+        endFrame();
+
+    return DEVICE_OK;
+}
+
 /**
   * Clears the display of any remaining pixels.
   *
@@ -348,7 +766,79 @@ int NRF52LEDMatrix::setBrightness(int b)
 }
 
 /**
- * Determines the last ambient light level sensed.
+ * Configures the frame update frequency of the display.
+ * Lower frequencies wake the CPU less often, at the risk of visible flicker.
+ *
+ * @param frequency The frame update frequency in Hz, in the range 1 - 255. Defaults to NRF52_LED_MATRIX_FREQUENCY.
+ *
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER
+ */
+int NRF52LEDMatrix::setFrequency(int frequency)
+{
+    if (frequency <= 0 || frequency > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->frequency = frequency;
+
+    // Recalculate our timer period and quantum. A disabled display picks up the new setting when next enabled.
+    if (enabled)
+        setDisplayMode(mode);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the frame update frequency of the display.
+ *
+ * @return The frame update frequency in Hz.
+ */
+int NRF52LEDMatrix::getFrequency()
+{
+    return frequency;
+}
+
+/**
+ * Selects how the display is refreshed.
+ *
+ * When enabled, the row strobe sequence is driven by the TIMER, PPI and GPIOTE hardware, and the column
+ * brightness by a PWM EasyDMA sequence, so the CPU is interrupted only once per frame rather than once per row.
+ * Light sense modes always use the per-row interrupt, and return to hardware refresh when light sensing ends.
+ * The per-row interrupt is also used while another driver holds NRF52_LEDMATRIX_PWM_INSTANCE_0 or _1
+ * (PWM2 is shared with neopixel), so use isHardwareRefresh() to determine which is in effect.
+ *
+ * @param enable true to refresh the display in hardware, false to use the per-row interrupt.
+ *        Defaults to NRF52_LED_MATRIX_HARDWARE_REFRESH.
+ */
+void NRF52LEDMatrix::setHardwareRefresh(bool enable)
+{
+    if (hardwareRefresh == enable)
+        return;
+
+    hardwareRefresh = enable;
+
+    // A disabled display picks up the new setting when next enabled.
+    if (enabled)
+        setDisplayMode(mode);
+}
+
+/**
+ * Determines if the display is refreshed in hardware.
+ *
+ * @return true if the display is currently refreshed by the PWM, PPI and GPIOTE hardware, false otherwise.
+ */
+bool NRF52LEDMatrix::isHardwareRefresh()
+{
+    return (status & NRF52_LEDMATRIX_STATUS_SEQUENCED) != 0;
+}
+
+/**
+ * Determines the ambient light level.
+ *
+ * Light sense modes only add a light sense slot to the end of a frame when a reading is needed, so the
+ * display keeps its full refresh time otherwise. If the last reading is older than the light sense period,
+ * a new one is taken, blocking the calling fiber for up to a few frames. Before the scheduler is running,
+ * the caller instead busy waits for up to one and a half frames. A disabled display can't sense light,
+ * so the last reading is returned at once.
  *
  * @return The light level sensed, as an unsigned 8-bit value in the range 0..255
  */
@@ -368,13 +858,66 @@ NRF52LEDMatrix::readLightLevel()
         status &= ~NRF52_LEDMATRIX_STATUS_LIGHTREADY;
     }
 
-    // if we've just enabled light sensing, ensure we have a valid reading before returning.
-    if ( ( status & NRF52_LEDMATRIX_STATUS_LIGHTREADY) == 0)
-        fiber_sleep(1500.0f/((float)NRF52_LED_MATRIX_FREQUENCY));
+    // With no frames being drawn there are no light sense slots to wait for.
+    if (!enabled)
+        return lightLevel;
+
+    // Request a light sense slot if we have no reading yet, or the last one is stale.
+    if ((status & NRF52_LEDMATRIX_STATUS_LIGHTREADY) == 0 || system_timer_current_time() - lightSenseTime >= lightSensePeriod)
+    {
+        lightSenseRequested = true;
+
+        // A suspended display needs to be refreshed to reach the light sense slot.
+        if (status & NRF52_LEDMATRIX_STATUS_SUSPENDED)
+            setDisplayMode(mode);
+
+        // The slot runs at the end of the current frame, so wait for up to three frames for the reading.
+        if (fiber_scheduler_running())
+        {
+            for (int i = 0; i < 3 && lightSenseRequested; i++)
+                fiber_sleep(1000 / frequency + 1);
+        }
+        else
+        {
+            // We can't yield, so spin while the display interrupt takes the reading.
+            CODAL_TIMESTAMP deadline = system_timer_current_time_us() + 1500000 / frequency;
+            while (lightSenseRequested && system_timer_current_time_us() < deadline);
+        }
+
+        lightSenseTime = system_timer_current_time();
+    }
 
     return lightLevel;
 }
 
+/**
+ * Configures how often the ambient light level is sensed.
+ *
+ * @param period The maximum age of a light level reading in milliseconds, before a new one is sensed.
+ *        Zero senses on every call to readLightLevel(). Defaults to NRF52_LED_MATRIX_LIGHTSENSE_PERIOD.
+ *
+ * @return DEVICE_OK, or DEVICE_INVALID_PARAMETER
+ */
+int NRF52LEDMatrix::setLightSensePeriod(int period)
+{
+    if (period < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    lightSensePeriod = period;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines how often the ambient light level is sensed.
+ *
+ * @return The maximum age of a light level reading in milliseconds.
+ */
+int NRF52LEDMatrix::getLightSensePeriod()
+{
+    return lightSensePeriod;
+}
+
 /**
  * Puts the component in (or out of) sleep (low power) mode.
  */
@@ -25,9 +25,135 @@ DEALINGS IN THE SOFTWARE.
 
 #include "PacketBuffer.h"
 #include "ErrorNo.h"
+#include "codal_target_hal.h"
 
 using namespace codal;
 
+// The largest payload held by each size class of the pool. Blocks awaiting reuse are linked through their payload,
+// which need not be word aligned, so the links are copied in and out.
+static const uint8_t packetPoolClassSize[MICROBIT_PACKET_POOL_CLASSES] = {32, 64, 128, 255};
+
+// Create the pool before the EmptyPacket, which is allocated from it.
+PacketBufferPool PacketBufferPool::pool;
+
+/**
+  * Determines the size class of the pool used for a payload of the given length.
+  */
+static int packetPoolClass(int length)
+{
+    for (int i = 0; i < MICROBIT_PACKET_POOL_CLASSES; i++)
+        if (length <= packetPoolClassSize[i])
+            return i;
+
+    return MICROBIT_PACKET_POOL_CLASSES - 1;
+}
+
+/**
+  * Constructor. Creates an empty pool.
+  */
+PacketBufferPool::PacketBufferPool() : MicroBitMemoryConsumer("packets")
+{
+    for (int i = 0; i < MICROBIT_PACKET_POOL_CLASSES; i++)
+    {
+        freeList[i] = NULL;
+        freeCount[i] = 0;
+    }
+}
+
+/**
+  * Provides a block able to hold a payload of the given length, reusing a released one if possible.
+  *
+  * @param length The length of the payload, in bytes.
+  *
+  * @return The block, which is uninitialised, or NULL if no memory is available.
+  */
+PacketData *PacketBufferPool::allocate(int length)
+{
+    int c = packetPoolClass(length);
+    PacketData *p;
+
+    target_disable_irq();
+    p = freeList[c];
+    if (p)
+    {
+        memcpy(&freeList[c], p->payload, sizeof(PacketData *));
+        freeCount[c]--;
+    }
+    target_enable_irq();
+
+    if (p == NULL)
+        p = (PacketData *) malloc(sizeof(PacketData) + packetPoolClassSize[c]);
+
+    return p;
+}
+
+/**
+  * Releases a block no longer referenced by any PacketBuffer, keeping it for reuse if there is room in its size class.
+  *
+  * @param p The block to release.
+  */
+void PacketBufferPool::release(PacketData *p)
+{
+    int c = packetPoolClass(p->length);
+
+    target_disable_irq();
+    if (freeCount[c] < MICROBIT_PACKET_POOL_DEPTH)
+    {
+        memcpy(p->payload, &freeList[c], sizeof(PacketData *));
+        freeList[c] = p;
+        freeCount[c]++;
+        p = NULL;
+    }
+    target_enable_irq();
+
+    if (p)
+        free(p);
+}
+
+/**
+  * Determines the heap memory held by blocks awaiting reuse.
+  *
+  * @return The number of bytes currently allocated.
+  */
+uint32_t PacketBufferPool::getMemoryUsage()
+{
+    uint32_t total = 0;
+
+    for (int i = 0; i < MICROBIT_PACKET_POOL_CLASSES; i++)
+        total += freeCount[i] * (sizeof(PacketData) + packetPoolClassSize[i]);
+
+    return total;
+}
+
+/**
+  * Returns all blocks awaiting reuse to the heap.
+  *
+  * @return The number of bytes returned to the heap.
+  */
+uint32_t PacketBufferPool::releaseMemory()
+{
+    uint32_t total = getMemoryUsage();
+
+    for (int i = 0; i < MICROBIT_PACKET_POOL_CLASSES; i++)
+    {
+        target_disable_irq();
+        PacketData *p = freeList[i];
+        freeList[i] = NULL;
+        freeCount[i] = 0;
+        target_enable_irq();
+
+        while (p)
+        {
+            PacketData *next;
+            memcpy(&next, p->payload, sizeof(PacketData *));
+            free(p);
+            p = next;
+        }
+    }
+
+    return total;
+}
+
 // Create the EmptyPacket reference.
 PacketBuffer PacketBuffer::EmptyPacket = PacketBuffer(1);
 
@@ -94,6 +220,8 @@ PacketBuffer::PacketBuffer(uint8_t *data, int length, int rssi)
 PacketBuffer::PacketBuffer(const PacketBuffer &buffer)
 {
     ptr = buffer.ptr;
+    offset = buffer.offset;
+    size = buffer.size;
     ptr->incr();
 }
 
@@ -111,12 +239,19 @@ void PacketBuffer::init(uint8_t *data, int length, int rssi)
     if (length < 0)
         length = 0;
 
-    ptr = (PacketData *) malloc(sizeof(PacketData) + length);
+    // Payloads are at most 255 bytes, so that they fit a size class of the pool.
+    if (length > 255)
+        length = 255;
+
+    ptr = PacketBufferPool::pool.allocate(length);
     ptr->init();
 
     ptr->length = length;
     ptr->rssi = rssi;
 
+    offset = 0;
+    size = length;
+
     // Copy in the data buffer, if provided.
     if (data)
         memcpy(ptr->payload, data, length);
@@ -129,7 +264,22 @@ void PacketBuffer::init(uint8_t *data, int length, int rssi)
   */
 PacketBuffer::~PacketBuffer()
 {
-    ptr->decr();
+    release();
+}
+
+/**
+  * Internal destructor. Drops our reference to the payload, returning it to the PacketBufferPool if it was the last.
+  */
+void PacketBuffer::release()
+{
+    if (ptr->isReadOnly())
+        return;
+
+    // A count of 3 is the encoding RefCounted uses for a single reference, which is ours.
+    if (ptr->refCount == 3)
+        PacketBufferPool::pool.release(ptr);
+    else
+        ptr->decr();
 }
 
 /**
@@ -155,12 +305,19 @@ PacketBuffer::~PacketBuffer()
 PacketBuffer& PacketBuffer::operator = (const PacketBuffer &p)
 {
     if(ptr == p.ptr)
+    {
+        offset = p.offset;
+        size = p.size;
         return *this;
+    }
 
-    ptr->decr();
+    release();
     ptr = p.ptr;
     ptr->incr();
 
+    offset = p.offset;
+    size = p.size;
+
     return *this;
 }
 
@@ -178,7 +335,7 @@ PacketBuffer& PacketBuffer::operator = (const PacketBuffer &p)
   */
 uint8_t PacketBuffer::operator [] (int i) const
 {
-    return ptr->payload[i];
+    return ptr->payload[offset + i];
 }
 
 /**
@@ -195,7 +352,7 @@ uint8_t PacketBuffer::operator [] (int i) const
   */
 uint8_t& PacketBuffer::operator [] (int i)
 {
-    return ptr->payload[i];
+    return ptr->payload[offset + i];
 }
 
 /**
@@ -219,10 +376,10 @@ uint8_t& PacketBuffer::operator [] (int i)
   */
 bool PacketBuffer::operator== (const PacketBuffer& p)
 {
-    if (ptr == p.ptr)
+    if (ptr == p.ptr && offset == p.offset && size == p.size)
         return true;
     else
-        return (ptr->length == p.ptr->length && (memcmp(ptr->payload, p.ptr->payload, ptr->length)==0));
+        return (size == p.size && (memcmp(ptr->payload + offset, p.ptr->payload + p.offset, size)==0));
 }
 
 /**
@@ -241,9 +398,9 @@ bool PacketBuffer::operator== (const PacketBuffer& p)
   */
 int PacketBuffer::setByte(int position, uint8_t value)
 {
-    if (position < ptr->length)
+    if (position >= 0 && position < size)
     {
-        ptr->payload[position] = value;
+        ptr->payload[offset + position] = value;
         return DEVICE_OK;
     }
     else
@@ -267,8 +424,8 @@ int PacketBuffer::setByte(int position, uint8_t value)
   */
 int PacketBuffer::getByte(int position)
 {
-    if (position < ptr->length)
-        return ptr->payload[position];
+    if (position >= 0 && position < size)
+        return ptr->payload[offset + position];
     else
         return DEVICE_INVALID_PARAMETER;
 }
@@ -280,7 +437,7 @@ int PacketBuffer::getByte(int position)
   */
 uint8_t*PacketBuffer::getBytes()
 {
-    return ptr->payload;
+    return ptr->payload + offset;
 }
 
 /**
@@ -295,7 +452,7 @@ uint8_t*PacketBuffer::getBytes()
   */
 int PacketBuffer::length()
 {
-    return ptr->length;
+    return size;
 }
 
 /**
@@ -326,3 +483,141 @@ void PacketBuffer::setRSSI(uint8_t rssi)
 {
     ptr->rssi = rssi;
 }
+
+/**
+  * Creates a view of part of this packet, sharing its contents rather than copying them.
+  * Changes made through either PacketBuffer are seen by the other.
+  *
+  * @param start The index of the first byte of the view, relative to the start of this PacketBuffer.
+  *
+  * @param length The number of bytes in the view, or -1 for all those from start to the end of this PacketBuffer.
+  *        The view is truncated to fit within this PacketBuffer.
+  *
+  * @return The view, which has the same signal strength as this packet.
+  *
+  * @code
+  * PacketBuffer p = uBit.radio.datagram.recv();
+  * PacketBuffer body = p.slice(2);       // Everything after a two byte header.
+  * @endcode
+  */
+PacketBuffer PacketBuffer::slice(int start, int length)
+{
+    PacketBuffer view(*this);
+
+    if (start < 0)
+        start = 0;
+
+    if (start > size)
+        start = size;
+
+    if (length < 0 || length > size - start)
+        length = size - start;
+
+    view.offset = offset + start;
+    view.size = length;
+
+    return view;
+}
+
+/**
+  * Constructor.
+  * Creates a builder with a new PacketBuffer of the given capacity to fill.
+  *
+  * @param capacity The greatest number of bytes the packet may hold.
+  */
+PacketBufferBuilder::PacketBufferBuilder(int capacity) : buffer(capacity)
+{
+    used = 0;
+}
+
+/**
+  * Reserves space for the given number of bytes at the end of the packet, to be written in place.
+  *
+  * @param length The number of bytes to reserve.
+  *
+  * @return A pointer to the reserved bytes, or NULL if the packet does not have room for them.
+  */
+uint8_t *PacketBufferBuilder::reserve(int length)
+{
+    if (length < 0 || length > buffer.length() - used)
+        return NULL;
+
+    uint8_t *p = buffer.getBytes() + used;
+    used += length;
+
+    return p;
+}
+
+/**
+  * Appends a byte to the packet.
+  *
+  * @param value The byte to append.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the packet is full.
+  */
+int PacketBufferBuilder::add(uint8_t value)
+{
+    uint8_t *p = reserve(1);
+
+    if (p == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    *p = value;
+    return DEVICE_OK;
+}
+
+/**
+  * Appends a sequence of bytes to the packet.
+  *
+  * @param data The bytes to append.
+  *
+  * @param length The number of bytes to append.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if data is NULL, or DEVICE_NO_RESOURCES if the packet does not have room for them.
+  */
+int PacketBufferBuilder::add(const uint8_t *data, int length)
+{
+    if (data == NULL)
+        return DEVICE_INVALID_PARAMETER;
+
+    uint8_t *p = reserve(length);
+
+    if (p == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    memcpy(p, data, length);
+    return DEVICE_OK;
+}
+
+/**
+  * Appends the contents of a PacketBuffer to the packet.
+  *
+  * @param data The PacketBuffer, or view of one, to append.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if the packet does not have room for it.
+  */
+int PacketBufferBuilder::add(PacketBuffer data)
+{
+    return add(data.getBytes(), data.length());
+}
+
+/**
+  * Determines the number of bytes added to the packet so far.
+  *
+  * @return The number of bytes.
+  */
+int PacketBufferBuilder::length()
+{
+    return used;
+}
+
+/**
+  * Provides the packet built so far, as a view of the builder's storage rather than a copy.
+  * Bytes added to the builder afterwards are not part of the view.
+  *
+  * @return A view of the bytes added to the packet.
+  */
+PacketBuffer PacketBufferBuilder::build()
+{
+    return buffer.slice(0, used);
+}
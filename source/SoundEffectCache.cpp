@@ -0,0 +1,376 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "SoundEffectCache.h"
+#include "MicroBitAudio.h"
+#include "AudioBufferPool.h"
+#include "ErrorNo.h"
+#include <string.h>
+
+using namespace codal;
+
+/**
+ * A DataSink that discards pull requests, used to drive the renderer synchronously.
+ */
+class SoundEffectCacheSink : public DataSink
+{
+    public:
+    virtual int pullRequest() override
+    {
+        return DEVICE_OK;
+    }
+};
+
+static SoundEffectCacheSink renderSink;
+
+/**
+ * Constructor.
+ *
+ * @param id The event ID to raise DEVICE_SOUND_EMOJI_SYNTHESIZER_EVT_DONE on when playback completes.
+ * Typically that of the SoundEmojiSynthesizer used for uncached sounds, so callers see the same events.
+ * @param maxBytes The maximum number of bytes of rendered audio to hold.
+ */
+SoundEffectCache::SoundEffectCache(uint16_t id, int maxBytes)
+{
+    this->id = id;
+    this->maxBytes = maxBytes > 0 ? maxBytes : 0;
+    this->usedBytes = 0;
+    this->useCount = 0;
+    this->hits = 0;
+    this->misses = 0;
+    this->downStream = NULL;
+    this->channel = NULL;
+    this->renderer = NULL;
+    this->playPosition = 0;
+    this->active = false;
+
+    for (int i = 0; i < CONFIG_SOUND_EFFECT_CACHE_ENTRIES; i++)
+        entries[i].lastUsed = 0;
+}
+
+/**
+ * Destructor.
+ */
+SoundEffectCache::~SoundEffectCache()
+{
+    delete renderer;
+}
+
+/**
+ * Change the maximum amount of memory the cache may use. Sounds are discarded as needed.
+ *
+ * @param bytes The maximum number of bytes of rendered audio to hold, or zero to disable the cache.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+ */
+int SoundEffectCache::setSize(int bytes)
+{
+    if (bytes < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    maxBytes = bytes;
+
+    if (maxBytes == 0)
+        flush();
+    else
+        reserve(0);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine if the cache is able to hold sounds.
+ * @return true if the cache has a non-zero size.
+ */
+bool SoundEffectCache::isEnabled()
+{
+    return maxBytes > 0;
+}
+
+/**
+ * Plays a sound from the cache, if present.
+ *
+ * @param key The sound to play.
+ * @return DEVICE_OK if playback has started, or DEVICE_NO_DATA if the sound is not held in the cache.
+ */
+int SoundEffectCache::play(ManagedString key)
+{
+    for (int i = 0; i < CONFIG_SOUND_EFFECT_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].pcm.length() > 0 && entries[i].key == key)
+        {
+            entries[i].lastUsed = ++useCount;
+            hits++;
+            start(entries[i].pcm);
+            return DEVICE_OK;
+        }
+    }
+
+    return DEVICE_NO_DATA;
+}
+
+/**
+ * Renders a sound into the cache, and starts playing it.
+ *
+ * @param key The sound being added.
+ * @param effects A buffer containing an array of one or more SoundEffects describing the sound.
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the sound has no finite duration,
+ * or DEVICE_NO_RESOURCES if it is too large to be held.
+ */
+int SoundEffectCache::add(ManagedString key, ManagedBuffer effects)
+{
+    int count = effects.length() / sizeof(SoundEffect);
+    SoundEffect *fx = (SoundEffect *) &effects[0];
+    int samples = 0;
+
+    if (count == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Determine the length of the sound, in the same way as the synthesizer. Sounds that repeat forever can't be rendered.
+    for (int i = 0; i < count; i++)
+    {
+        if (fx[i].duration < 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        samples += (int) ((float) CONFIG_SOUND_EFFECT_CACHE_SAMPLE_RATE * (fx[i].duration / 1000.0f));
+    }
+
+    if (samples == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (!reserve(samples))
+        return DEVICE_NO_RESOURCES;
+
+    if (renderer == NULL)
+    {
+        renderer = new SoundEmojiSynthesizer(DEVICE_ID_SOUND_EMOJI_SYNTHESIZER_9, CONFIG_SOUND_EFFECT_CACHE_SAMPLE_RATE);
+        renderer->allowEmptyBuffers(true);
+        renderer->connect(renderSink);
+    }
+
+    // Drive the renderer directly, converting its 10 bit output to 8 bit samples.
+    ManagedBuffer pcm(samples);
+    uint8_t *out = &pcm[0];
+    int written = 0;
+
+    renderer->play(effects);
+
+    while (true)
+    {
+        ManagedBuffer b = renderer->pull();
+        if (b.length() == 0)
+            break;
+
+        uint16_t *in = (uint16_t *) &b[0];
+        int n = min((int) (b.length() / sizeof(uint16_t)), samples - written);
+
+        for (int i = 0; i < n; i++)
+            *out++ = in[i] >> 2;
+
+        written += n;
+    }
+
+    if (written < samples)
+        memset(out, 0x80, samples - written);
+
+    // Store the result in a free entry, or the least recently used one.
+    Entry *e = &entries[0];
+    for (int i = 0; i < CONFIG_SOUND_EFFECT_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].pcm.length() == 0)
+        {
+            e = &entries[i];
+            break;
+        }
+
+        if (entries[i].lastUsed < e->lastUsed)
+            e = &entries[i];
+    }
+
+    usedBytes -= e->pcm.length();
+    usedBytes += samples;
+
+    e->key = key;
+    e->pcm = pcm;
+    e->lastUsed = ++useCount;
+    misses++;
+
+    start(pcm);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stops any sound currently being played from the cache.
+ */
+void SoundEffectCache::stop()
+{
+    bool wasPlaying;
+
+    target_disable_irq();
+    wasPlaying = playing.length() > 0;
+    playing = ManagedBuffer();
+    target_enable_irq();
+
+    if (wasPlaying)
+        Event(id, DEVICE_SOUND_EMOJI_SYNTHESIZER_EVT_DONE);
+}
+
+/**
+ * Discards all sounds held in the cache.
+ */
+void SoundEffectCache::flush()
+{
+    for (int i = 0; i < CONFIG_SOUND_EFFECT_CACHE_ENTRIES; i++)
+    {
+        entries[i].key = ManagedString();
+        entries[i].pcm = ManagedBuffer();
+        entries[i].lastUsed = 0;
+    }
+
+    usedBytes = 0;
+}
+
+/**
+ * Determine the number of plays served from the cache.
+ */
+uint32_t SoundEffectCache::getHitCount()
+{
+    return hits;
+}
+
+/**
+ * Determine the number of sounds that have been rendered into the cache.
+ */
+uint32_t SoundEffectCache::getMissCount()
+{
+    return misses;
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @sink The component that data will be delivered to, when it is availiable
+ */
+void SoundEffectCache::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+}
+
+/**
+ *  Determine the data format of the buffers streamed out of this component.
+ */
+int SoundEffectCache::getFormat()
+{
+    return DATASTREAM_FORMAT_8BIT_UNSIGNED;
+}
+
+/**
+ * Provide the next available ManagedBuffer to our downstream caller, if available.
+ */
+ManagedBuffer SoundEffectCache::pull()
+{
+    int remaining = playing.length() - playPosition;
+
+    if (remaining <= 0)
+    {
+        active = false;
+        return ManagedBuffer();
+    }
+
+    int n = min(remaining, SOUND_EFFECT_CACHE_CHUNK_SIZE);
+    ManagedBuffer out = AudioBufferPool::getDefault().allocate(n);
+    memcpy(&out[0], &playing[playPosition], n);
+    playPosition += n;
+
+    if (playPosition < playing.length())
+    {
+        downStream->pullRequest();
+    }
+    else
+    {
+        // That's the last of this sound. Leave the channel idle until the next play().
+        playing = ManagedBuffer();
+        active = false;
+        Event(id, DEVICE_SOUND_EMOJI_SYNTHESIZER_EVT_DONE);
+    }
+
+    return out;
+}
+
+/**
+ * Discard least recently used sounds until the given number of bytes can be held.
+ * @return true if enough space is available.
+ */
+bool SoundEffectCache::reserve(int bytes)
+{
+    if (bytes > maxBytes)
+        return false;
+
+    while (usedBytes + bytes > maxBytes)
+    {
+        Entry *lru = NULL;
+
+        for (int i = 0; i < CONFIG_SOUND_EFFECT_CACHE_ENTRIES; i++)
+            if (entries[i].pcm.length() > 0 && (lru == NULL || entries[i].lastUsed < lru->lastUsed))
+                lru = &entries[i];
+
+        if (lru == NULL)
+            return false;
+
+        usedBytes -= lru->pcm.length();
+        lru->key = ManagedString();
+        lru->pcm = ManagedBuffer();
+    }
+
+    return true;
+}
+
+/**
+ * Start playout of the given buffer of samples.
+ */
+void SoundEffectCache::start(ManagedBuffer pcm)
+{
+    bool idle;
+
+    // Enable audio pipeline if needed, and join the mixer on first use.
+    MicroBitAudio::requestActivation();
+
+    if (channel == NULL && MicroBitAudio::instance)
+        channel = MicroBitAudio::instance->mixer.addChannel(*this, CONFIG_SOUND_EFFECT_CACHE_SAMPLE_RATE, 256);
+
+    if (downStream == NULL)
+        return;
+
+    target_disable_irq();
+    playing = pcm;
+    playPosition = 0;
+    idle = !active;
+    active = true;
+    target_enable_irq();
+
+    // Restart the stream if it had run dry.
+    if (idle)
+        downStream->pullRequest();
+}
@@ -28,9 +28,90 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalUtil.h"
 #include "ErrorNo.h"
 #include "MicroBitAudio.h"
+#include "AudioBufferPool.h"
 
 using namespace codal;
 
+/**
+ * Tone tables for the standard Synthesizer toneprints, sampled at EMOJI_SYNTHESIZER_TONE_TABLE_SIZE points
+ * across one period, with the same 0..1023 range as the toneprint functions.
+ */
+static const uint16_t sineToneTable[EMOJI_SYNTHESIZER_TONE_TABLE_SIZE] = {
+    512, 524, 537, 549, 562, 574, 587, 599, 611, 624, 636, 648, 660, 672, 684, 696,
+    707, 719, 730, 741, 753, 764, 774, 785, 796, 806, 816, 826, 836, 846, 855, 864,
+    873, 882, 890, 899, 907, 915, 922, 930, 937, 944, 950, 957, 963, 968, 974, 979,
+    984, 989, 993, 997, 1001, 1004, 1008, 1011, 1013, 1015, 1017, 1019, 1021, 1022, 1022, 1023,
+    1023, 1023, 1022, 1022, 1021, 1019, 1017, 1015, 1013, 1011, 1008, 1004, 1001, 997, 993, 989,
+    984, 979, 974, 968, 963, 957, 950, 944, 937, 930, 922, 915, 907, 899, 890, 882,
+    873, 864, 855, 846, 836, 826, 816, 806, 796, 785, 774, 764, 753, 741, 730, 719,
+    707, 696, 684, 672, 660, 648, 636, 624, 611, 599, 587, 574, 562, 549, 537, 524,
+    512, 499, 486, 474, 461, 449, 436, 424, 412, 399, 387, 375, 363, 351, 339, 327,
+    316, 304, 293, 282, 270, 259, 249, 238, 227, 217, 207, 197, 187, 177, 168, 159,
+    150, 141, 133, 124, 116, 108, 101, 93, 86, 79, 73, 66, 60, 55, 49, 44,
+    39, 34, 30, 26, 22, 19, 15, 12, 10, 8, 6, 4, 2, 1, 1, 0,
+    0, 0, 1, 1, 2, 4, 6, 8, 10, 12, 15, 19, 22, 26, 30, 34,
+    39, 44, 49, 55, 60, 66, 73, 79, 86, 93, 101, 108, 116, 124, 133, 141,
+    150, 159, 168, 177, 187, 197, 207, 217, 227, 238, 249, 259, 270, 282, 293, 304,
+    316, 327, 339, 351, 363, 375, 387, 399, 412, 424, 436, 449, 461, 474, 486, 499,
+};
+
+static const uint16_t sawtoothToneTable[EMOJI_SYNTHESIZER_TONE_TABLE_SIZE] = {
+    0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60,
+    64, 68, 72, 76, 80, 84, 88, 92, 96, 100, 104, 108, 112, 116, 120, 124,
+    128, 132, 136, 140, 144, 148, 152, 156, 160, 164, 168, 172, 176, 180, 184, 188,
+    192, 196, 200, 204, 208, 212, 216, 220, 224, 228, 232, 236, 240, 244, 248, 252,
+    256, 260, 264, 268, 272, 276, 280, 284, 288, 292, 296, 300, 304, 308, 312, 316,
+    320, 324, 328, 332, 336, 340, 344, 348, 352, 356, 360, 364, 368, 372, 376, 380,
+    384, 388, 392, 396, 400, 404, 408, 412, 416, 420, 424, 428, 432, 436, 440, 444,
+    448, 452, 456, 460, 464, 468, 472, 476, 480, 484, 488, 492, 496, 500, 504, 508,
+    512, 516, 520, 524, 528, 532, 536, 540, 544, 548, 552, 556, 560, 564, 568, 572,
+    576, 580, 584, 588, 592, 596, 600, 604, 608, 612, 616, 620, 624, 628, 632, 636,
+    640, 644, 648, 652, 656, 660, 664, 668, 672, 676, 680, 684, 688, 692, 696, 700,
+    704, 708, 712, 716, 720, 724, 728, 732, 736, 740, 744, 748, 752, 756, 760, 764,
+    768, 772, 776, 780, 784, 788, 792, 796, 800, 804, 808, 812, 816, 820, 824, 828,
+    832, 836, 840, 844, 848, 852, 856, 860, 864, 868, 872, 876, 880, 884, 888, 892,
+    896, 900, 904, 908, 912, 916, 920, 924, 928, 932, 936, 940, 944, 948, 952, 956,
+    960, 964, 968, 972, 976, 980, 984, 988, 992, 996, 1000, 1004, 1008, 1012, 1016, 1020,
+};
+
+static const uint16_t triangleToneTable[EMOJI_SYNTHESIZER_TONE_TABLE_SIZE] = {
+    0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120,
+    128, 136, 144, 152, 160, 168, 176, 184, 192, 200, 208, 216, 224, 232, 240, 248,
+    256, 264, 272, 280, 288, 296, 304, 312, 320, 328, 336, 344, 352, 360, 368, 376,
+    384, 392, 400, 408, 416, 424, 432, 440, 448, 456, 464, 472, 480, 488, 496, 504,
+    512, 520, 528, 536, 544, 552, 560, 568, 576, 584, 592, 600, 608, 616, 624, 632,
+    640, 648, 656, 664, 672, 680, 688, 696, 704, 712, 720, 728, 736, 744, 752, 760,
+    768, 776, 784, 792, 800, 808, 816, 824, 832, 840, 848, 856, 864, 872, 880, 888,
+    896, 904, 912, 920, 928, 936, 944, 952, 960, 968, 976, 984, 992, 1000, 1008, 1016,
+    1022, 1014, 1006, 998, 990, 982, 974, 966, 958, 950, 942, 934, 926, 918, 910, 902,
+    894, 886, 878, 870, 862, 854, 846, 838, 830, 822, 814, 806, 798, 790, 782, 774,
+    766, 758, 750, 742, 734, 726, 718, 710, 702, 694, 686, 678, 670, 662, 654, 646,
+    638, 630, 622, 614, 606, 598, 590, 582, 574, 566, 558, 550, 542, 534, 526, 518,
+    510, 502, 494, 486, 478, 470, 462, 454, 446, 438, 430, 422, 414, 406, 398, 390,
+    382, 374, 366, 358, 350, 342, 334, 326, 318, 310, 302, 294, 286, 278, 270, 262,
+    254, 246, 238, 230, 222, 214, 206, 198, 190, 182, 174, 166, 158, 150, 142, 134,
+    126, 118, 110, 102, 94, 86, 78, 70, 62, 54, 46, 38, 30, 22, 14, 6,
+};
+
+static const uint16_t squareWaveToneTable[EMOJI_SYNTHESIZER_TONE_TABLE_SIZE] = {
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
 /**
   * Class definition for a Synthesizer.
   * A Synthesizer generates a tone waveform based on a number of overlapping waveforms.
@@ -39,7 +120,8 @@ SoundEmojiSynthesizer::SoundEmojiSynthesizer(uint16_t id, int sampleRate) : Coda
 {
     this->downStream = NULL;
     this->bufferSize = EMOJI_SYNTHESIZER_BUFFER_SIZE;
-    this->position = 0.0f;
+    this->position = 0;
+    this->noise = 0xACE1u;
     this->effect = NULL;
 
     this->samplesToWrite = 0;
@@ -83,7 +165,7 @@ int SoundEmojiSynthesizer::getFormat()
 */
 int SoundEmojiSynthesizer::setBufferSize(int size)
 {
-    if (bufferSize <= 0)
+    if (size <= 0)
         return DEVICE_INVALID_PARAMETER;
 
     this->bufferSize = size;
@@ -156,13 +238,13 @@ bool SoundEmojiSynthesizer::nextSoundEffect()
         // if we have an effect with a negative duration, reset the buffer (unless there is an update pending)
         effect = (SoundEffect *) &effectBuffer[0];
 
-        if (effect->duration >= 0 || lock.getWaitCount() > 0)
+        if (effectBuffer.length() == 0 || effect->duration >= 0 || lock.getWaitCount() > 0)
         {
             effect = NULL;
             effectBuffer = emptyBuffer;
             samplesWritten = 0;
             samplesToWrite = 0;
-            position = 0.0f;
+            position = 0;
             return hadEffect;
         }
     }
@@ -217,9 +299,11 @@ ManagedBuffer SoundEmojiSynthesizer::pull()
         
         // If we have something to do, ensure our buffers are created.
         // We defer creation to avoid unecessary heap allocation when genertaing silence.
+        // Release our reference to the previous buffer first, so that it can be recycled by the pool.
         if (((samplesWritten < samplesToWrite) || !(status & EMOJI_SYNTHESIZER_STATUS_OUTPUT_SILENCE_AS_EMPTY)) && sample == NULL)
         {
-            buffer = ManagedBuffer(bufferSize);
+            buffer = emptyBuffer;
+            buffer = AudioBufferPool::getDefault().allocate(bufferSize);
             sample = (uint16_t *) &buffer[0];
             bufferEnd = (uint16_t *) (&buffer[0] + buffer.length());
         }
@@ -227,9 +311,9 @@ ManagedBuffer SoundEmojiSynthesizer::pull()
         // Generate some samples with the current effect parameters.
         while(samplesWritten < samplesToWrite)
         {
-            float skip = ((EMOJI_SYNTHESIZER_TONE_WIDTH_F * frequency) / sampleRate);
+            uint32_t skip = (uint32_t) (((double) frequency * 4294967296.0) / sampleRate);
             float gain = (sampleRange * volume) / 1024.0f;
-            float offset = 512.0f - (512.0f * gain);
+            int32_t offset = (int32_t) (512.0f - (512.0f * gain));
 
             int effectStepEnd[EMOJI_SYNTHESIZER_TONE_EFFECTS];
 
@@ -244,30 +328,19 @@ ManagedBuffer SoundEmojiSynthesizer::pull()
             for (int i = 1; i < EMOJI_SYNTHESIZER_TONE_EFFECTS; i++)
                 stepEndPosition = min(stepEndPosition, effectStepEnd[i]);
 
-            // Write samples until the end of the next effect-step
-            while (samplesWritten < stepEndPosition)
+            // Write samples until the end of the next effect-step, or until we've filled the requested buffer.
+            int count = min(stepEndPosition - samplesWritten, (int) (bufferEnd - sample));
+            if (count > 0)
             {
-                // Stop processing when we've filled the requested buffer
-                if (sample == bufferEnd)
-                {
-                    downStream->pullRequest();
-                    return buffer;
-                }
-
-                // Synthesize a sample
-                float s = effect->tone.tonePrint(effect->tone.parameter, (int) position);
-
-                // Apply volume scaling and OR mask (if specified).
-                *sample = ((uint16_t) ((s * gain) + offset)) | orMask;
-
-                // Move on our pointers.
-                sample++;
-                samplesWritten++;
-                position += skip;
+                render(sample, count, skip, (int32_t) (gain * 65536.0f), offset);
+                sample += count;
+                samplesWritten += count;
+            }
 
-                // Keep our toneprint pointer in range
-                while(position > EMOJI_SYNTHESIZER_TONE_WIDTH_F)
-                    position -= EMOJI_SYNTHESIZER_TONE_WIDTH_F;
+            if (samplesWritten < stepEndPosition)
+            {
+                downStream->pullRequest();
+                return buffer;
             }
 
             // Invoke the effect function for any effects that are due.
@@ -308,6 +381,67 @@ ManagedBuffer SoundEmojiSynthesizer::pull()
     return buffer;
 }
 
+/**
+ * Synthesize samples from the current sound effect's toneprint at a fixed frequency and volume.
+ * The standard Synthesizer toneprints are rendered from tables, others via their TonePrintFunction.
+ *
+ * @param out The location to write samples to.
+ * @param count The number of samples to write.
+ * @param skip The phase increment per sample.
+ * @param gain Volume scaling, in 16.16 fixed point.
+ * @param offset DC offset added to each scaled sample.
+ */
+void SoundEmojiSynthesizer::render(uint16_t *out, int count, uint32_t skip, int32_t gain, int32_t offset)
+{
+    TonePrintFunction tonePrint = effect->tone.tonePrint;
+    const uint16_t *table = NULL;
+    uint16_t *end = out + count;
+    uint32_t p = position;
+
+    if (tonePrint == Synthesizer::SineTone)
+        table = sineToneTable;
+    else if (tonePrint == Synthesizer::SawtoothTone)
+        table = sawtoothToneTable;
+    else if (tonePrint == Synthesizer::TriangleTone)
+        table = triangleToneTable;
+    else if (tonePrint == Synthesizer::SquareWaveTone)
+        table = squareWaveToneTable;
+
+    if (table)
+    {
+        while (out < end)
+        {
+            *out++ = ((uint16_t) (((table[p >> EMOJI_SYNTHESIZER_TONE_TABLE_SHIFT] * gain) >> 16) + offset)) | orMask;
+            p += skip;
+        }
+    }
+    else if (tonePrint == Synthesizer::NoiseTone)
+    {
+        // Noise has no period, so just run a xorshift generator.
+        uint32_t n = noise;
+        while (out < end)
+        {
+            n ^= n << 13;
+            n ^= n >> 17;
+            n ^= n << 5;
+            *out++ = ((uint16_t) ((((int32_t) (n & 1023)) * gain >> 16) + offset)) | orMask;
+        }
+        noise = n;
+    }
+    else
+    {
+        void *parameter = effect->tone.parameter;
+        while (out < end)
+        {
+            int32_t s = tonePrint(parameter, p >> EMOJI_SYNTHESIZER_TONE_WIDTH_SHIFT);
+            *out++ = ((uint16_t) (((s * gain) >> 16) + offset)) | orMask;
+            p += skip;
+        }
+    }
+
+    position = p;
+}
+
 /**
  * Determine the sample rate currently in use by this Synthesizer.
  * @return the current sample rate, in Hz.
@@ -31,14 +31,20 @@ DEALINGS IN THE SOFTWARE.
 #include "SoundSynthesizerEffects.h"
 #include "ManagedString.h"
 #include "CodalDmesg.h"
+#include <string.h>
 
 #define CLAMP(lo, v, hi) ((v) = ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v)))
 
 /**
   * Default Constructor.
   */
-SoundExpressions::SoundExpressions(SoundEmojiSynthesizer &synth): synth(synth)
-{}
+SoundExpressions::SoundExpressions(SoundEmojiSynthesizer &synth): cache(synth.id), synth(synth), useCount(0)
+{
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE; ++i) {
+        compiled[i].hash = 0;
+        compiled[i].lastUsed = 0;
+    }
+}
 
 /**
   * Destructor.
@@ -56,8 +62,56 @@ void SoundExpressions::play(ManagedString sound) {
 }
 
 void SoundExpressions::playAsync(ManagedString sound) {
-    // Sound is either encoded data or a name of a built-in sound for which we have the data.
-    sound = lookupBuiltIn(sound);
+    // Replay a previously rendered copy if we have one.
+    if (cache.isEnabled() && cache.play(sound) == DEVICE_OK)
+        return;
+
+    // Sound is either encoded data or a name of a built-in sound for which we have precompiled data.
+    const CompiledSoundEffect *effects;
+    int effectCount;
+    ManagedBuffer c;
+    const uint32_t hash = soundExpressionHash(sound);
+
+    if (!lookupBuiltIn(sound, hash, effects, effectCount)) {
+        c = compile(sound, hash);
+        if (c.length() == 0) {
+            return;
+        }
+        effects = (const CompiledSoundEffect *) &c[0];
+        effectCount = c.length() / sizeof(CompiledSoundEffect);
+    }
+
+    ManagedBuffer b(sizeof(SoundEffect) * effectCount);
+    SoundEffect *fx = (SoundEffect *) &b[0];
+    bool cacheable = cache.isEnabled();
+    for (int i = 0; i < effectCount; ++i)  {
+        if (!buildSoundEffect(&effects[i], fx++)) {
+            return;
+        }
+        cacheable = cacheable && isDeterministic(&effects[i]);
+    }
+
+    // Sounds that sound the same every time can be rendered once and replayed. Fall back to live synthesis if not.
+    if (cacheable && cache.add(sound, b) == DEVICE_OK)
+        return;
+
+    synth.play(b);
+}
+
+ManagedBuffer SoundExpressions::compile(ManagedString sound, uint32_t hash) {
+    // Reuse an earlier compilation of the same expression if we have one.
+    CompiledSoundExpression *slot = &compiled[0];
+    for (int i = 0; i < CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE; ++i) {
+        CompiledSoundExpression &e = compiled[i];
+        if (e.effects.length() > 0 && e.hash == hash && e.key == sound) {
+            e.lastUsed = ++useCount;
+            return e.effects;
+        }
+        if (e.lastUsed < slot->lastUsed) {
+            slot = &e;
+        }
+    }
+
     const unsigned soundLen = sound.length();
     const char *soundChars = sound.toCharArray();
 
@@ -65,22 +119,42 @@ void SoundExpressions::playAsync(ManagedString sound) {
     const unsigned charsPerEffect = 72;
     const unsigned effectCount = (soundLen + 1) / (charsPerEffect + 1);
     const unsigned expectedLength = effectCount * (charsPerEffect + 1) - 1;
-    if (soundLen != expectedLength) {
-        return;
+    if (effectCount == 0 || soundLen != expectedLength) {
+        return ManagedBuffer();
     }
-    
-    ManagedBuffer b(sizeof(SoundEffect) * effectCount);
-    SoundEffect *fx = (SoundEffect *) &b[0];
+
+    ManagedBuffer b(sizeof(CompiledSoundEffect) * effectCount);
+    CompiledSoundEffect *fx = (CompiledSoundEffect *) &b[0];
     for (unsigned i = 0; i < effectCount; ++i)  {
         const int start = i * charsPerEffect + i;
         if (start > 0 && soundChars[start - 1] != ',') {
-            return;
+            return ManagedBuffer();
         }
-        if (!parseSoundExpression(&soundChars[start], fx++)) {
-            return;
+        if (!compileSoundExpression(&soundChars[start], fx++)) {
+            return ManagedBuffer();
         }
     }
-    synth.play(b);
+
+    // Retain the result in place of the least recently used entry.
+    if (CONFIG_SOUND_EXPRESSION_COMPILED_CACHE_SIZE > 0) {
+        slot->hash = hash;
+        slot->key = sound;
+        slot->effects = b;
+        slot->lastUsed = ++useCount;
+    }
+
+    return b;
+}
+
+uint32_t SoundExpressions::soundExpressionHash(ManagedString sound) {
+    // 32 bit FNV-1a
+    const char *p = sound.toCharArray();
+    uint32_t hash = 0x811c9dc5;
+    for (int i = 0; i < sound.length(); ++i) {
+        hash ^= (uint8_t) p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
 }
 
 int SoundExpressions::parseDigits(const char *input, const int digits) {
@@ -102,64 +176,92 @@ int SoundExpressions::parseDigits(const char *input, const int digits) {
 }
 
 void SoundExpressions::stop() {
+    cache.stop();
     synth.stop();
 }
 
+int SoundExpressions::setCacheSize(int bytes) {
+    return cache.setSize(bytes);
+}
+
 int SoundExpressions::applyRandom(int value, int rand) {
     if (value < 0 || rand < 0) {
         return -1;
     }
+    if (rand == 0) {
+        return value;
+    }
     const int delta = random(rand * 2 + 1) - rand;
     return abs(value + delta);
 }
 
-bool SoundExpressions::parseSoundExpression(const char *soundChars, SoundEffect *fx) {
+bool SoundExpressions::compileSoundExpression(const char *soundChars, CompiledSoundEffect *fx) {
     // Encoded as a sequence of zero padded decimal strings.
     // This encoding is worth reconsidering if we can!
     // The ADSR effect (and perhaps others in future) has two parameters which cannot be expressed.
 
     // 72 chars total
     //  [0] 0-4 wave
-    int wave = parseDigits(&soundChars[0], 1);
+    fx->wave = parseDigits(&soundChars[0], 1);
     //  [1] 0000-1023 volume
-    int effectVolume = parseDigits(&soundChars[1], 4);
+    fx->volume = parseDigits(&soundChars[1], 4);
     //  [5] 0000-9999 frequency
-    int frequency = parseDigits(&soundChars[5], 4);
+    fx->frequency = parseDigits(&soundChars[5], 4);
     //  [9] 0000-9999 duration
-    int duration = parseDigits(&soundChars[9], 4);
+    fx->duration = parseDigits(&soundChars[9], 4);
     // [13] 00 shape (specific known values)
-    int shape = parseDigits(&soundChars[13], 2);
+    fx->shape = parseDigits(&soundChars[13], 2);
     // [15] XXX unused/bug. This was startFrequency but we use frequency above.
     // [18] 0000-9999 end frequency
-    int endFrequency = parseDigits(&soundChars[18], 4);
+    fx->endFrequency = parseDigits(&soundChars[18], 4);
     // [22] XXXX unused. This was start volume but we use volume above.
     // [26] 0000-1023 end volume
-    int endVolume = parseDigits(&soundChars[26], 4);
+    fx->endVolume = parseDigits(&soundChars[26], 4);
     // [30] 0000-9999 steps
-    int steps = parseDigits(&soundChars[30], 4);
+    fx->steps = parseDigits(&soundChars[30], 4);
     // [34] 00-03 fx choice
-    int fxChoice = parseDigits(&soundChars[34], 2);
+    fx->fxChoice = parseDigits(&soundChars[34], 2);
     // [36] 0000-9999 fxParam
-    int fxParam = parseDigits(&soundChars[36], 4);
+    fx->fxParam = parseDigits(&soundChars[36], 4);
     // [40] 0000-9999 fxnSteps
-    int fxnSteps = parseDigits(&soundChars[40], 4);
+    fx->fxnSteps = parseDigits(&soundChars[40], 4);
 
     // Details that encoded randomness to be applied when frame is used:
-    // Can the randomness cause any parameters to go out of range?
-    // [44] 0000-9999 frequency random
-    frequency = applyRandom(frequency, parseDigits(&soundChars[44], 4));
-    // [48] 0000-9999 end frequency random
-    endFrequency = applyRandom(endFrequency, parseDigits(&soundChars[48], 4));
-    // [52] 0000-9999 volume random
-    effectVolume = applyRandom(effectVolume, parseDigits(&soundChars[52], 4));
-    // [56] 0000-9999 end volume random
-    endVolume = applyRandom(endVolume, parseDigits(&soundChars[56], 4));
-    // [60] 0000-9999 duration random
-    duration = applyRandom(duration, parseDigits(&soundChars[60], 4));
-    // [64] 0000-9999 fxParamRandom
-    fxParam = applyRandom(fxParam, parseDigits(&soundChars[64], 4));
-    // [68] 0000-9999 fxnStepsRandom
-    fxnSteps = applyRandom(fxnSteps, parseDigits(&soundChars[68], 4));
+    // [44] frequency, [48] end frequency, [52] volume, [56] end volume, [60] duration, [64] fxParam, [68] fxnSteps,
+    // each 0000-9999.
+    for (int i = 0; i < SOUND_EXPRESSION_RANDOM_FIELDS; ++i) {
+        fx->random[i] = parseDigits(&soundChars[44 + 4*i], 4);
+        if (fx->random[i] == -1) {
+            return false;
+        }
+    }
+
+    return fx->frequency != -1 && fx->endFrequency != -1 && fx->volume != -1 && fx->endVolume != -1 && fx->duration != -1 && fx->fxParam != -1 && fx->fxnSteps != -1;
+}
+
+bool SoundExpressions::isDeterministic(const CompiledSoundEffect *compiled) {
+    for (int i = 0; i < SOUND_EXPRESSION_RANDOM_FIELDS; ++i) {
+        if (compiled->random[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SoundExpressions::buildSoundEffect(const CompiledSoundEffect *compiled, SoundEffect *fx) {
+    const int wave = compiled->wave;
+    const int shape = compiled->shape;
+    const int steps = compiled->steps;
+    const int fxChoice = compiled->fxChoice;
+
+    // Apply the encoded randomness. Can the randomness cause any parameters to go out of range?
+    int frequency = applyRandom(compiled->frequency, compiled->random[0]);
+    int endFrequency = applyRandom(compiled->endFrequency, compiled->random[1]);
+    int effectVolume = applyRandom(compiled->volume, compiled->random[2]);
+    int endVolume = applyRandom(compiled->endVolume, compiled->random[3]);
+    int duration = applyRandom(compiled->duration, compiled->random[4]);
+    int fxParam = applyRandom(compiled->fxParam, compiled->random[5]);
+    int fxnSteps = applyRandom(compiled->fxnSteps, compiled->random[6]);
 
     if (frequency == -1 || endFrequency == -1 || effectVolume == -1 || endVolume == -1 || duration == -1 || fxParam == -1 || fxnSteps == -1) {
         return false;
@@ -284,48 +386,77 @@ bool SoundExpressions::parseSoundExpression(const char *soundChars, SoundEffect
     return true;
 }
 
-// Names and data for each built-in sound expression.
-static ManagedString giggle("giggle");
-static ManagedString giggleData("010230988019008440044008881023001601003300240000000000000000000000000000,110232570087411440044008880352005901003300010000000000000000010000000000,310232729021105440288908880091006300000000240700020000000000003000000000,310232729010205440288908880091006300000000240700020000000000003000000000,310232729011405440288908880091006300000000240700020000000000003000000000");
-static ManagedString happy("happy");
-static ManagedString happyData("010231992066911440044008880262002800001800020500000000000000010000000000,002322129029508440240408880000000400022400110000000000000000007500000000,000002129029509440240408880145000400022400110000000000000000007500000000");
-static ManagedString hello("hello");
-static ManagedString helloData("310230673019702440118708881023012800000000240000000000000000000000000000,300001064001602440098108880000012800000100040000000000000000000000000000,310231064029302440098108881023012800000100040000000000000000000000000000");
-static ManagedString mysterious("mysterious");
-static ManagedString mysteriousData("400002390033100440240408880477000400022400110400000000000000008000000000,405512845385000440044008880000012803010500160000000000000000085000500015");
-static ManagedString sad("sad");
-static ManagedString sadData("310232226070801440162408881023012800000100240000000000000000000000000000,310231623093602440093908880000012800000100240000000000000000000000000000");
-static ManagedString slide("slide");
-static ManagedString slideData("105202325022302440240408881023012801020000110400000000000000010000000000,010232520091002440044008881023012801022400110400000000000000010000000000");
-static ManagedString soaring("soaring");
-static ManagedString soaringData("210234009530905440599908881023002202000400020250000000000000020000000000,402233727273014440044008880000003101024400030000000000000000000000000000");
-static ManagedString spring("spring");
-static ManagedString springData("306590037116312440058708880807003400000000240000000000000000050000000000,010230037116313440058708881023003100000000240000000000000000050000000000");
-static ManagedString twinkle("twinkle");
-static ManagedString twinkleData("010180007672209440075608880855012800000000240000000000000000000000000000");
-static ManagedString yawn("yawn");
-static ManagedString yawnData("200002281133202440150008881023012801024100240400030000000000010000000000,005312520091002440044008880636012801022400110300000000000000010000000000,008220784019008440044008880681001600005500240000000000000000005000000000,004790784019008440044008880298001600000000240000000000000000005000000000,003210784019008440044008880108001600003300080000000000000000005000000000");
-
-ManagedString SoundExpressions::lookupBuiltIn(ManagedString sound) {
-    if (sound == giggle)
-        return giggleData;
-    if (sound == happy)
-        return happyData;
-    if (sound == hello)
-        return helloData;
-    if (sound == mysterious)
-        return mysteriousData;
-    if (sound == sad)
-        return sadData;
-    if (sound == slide)
-        return slideData;
-    if (sound == soaring)
-        return soaringData;
-    if (sound == spring)
-        return springData;
-    if (sound == twinkle)
-        return twinkleData;
-    if (sound == yawn)
-        return yawnData;
-    return sound;
-}
\ No newline at end of file
+// Built-in sound expressions, precompiled from their 72 character encodings.
+static const CompiledSoundEffect giggleEffects[] = {
+    {0, 8, 1, 1023, 988, 190, 440, 1023, 16, 33, 24, {0, 0, 0, 0, 0, 0, 0}},
+    {1, 11, 1, 1023, 2570, 874, 440, 352, 59, 33, 1, {0, 0, 0, 0, 100, 0, 0}},
+    {3, 5, 0, 1023, 2729, 211, 2889, 91, 63, 0, 24, {700, 200, 0, 0, 30, 0, 0}},
+    {3, 5, 0, 1023, 2729, 102, 2889, 91, 63, 0, 24, {700, 200, 0, 0, 30, 0, 0}},
+    {3, 5, 0, 1023, 2729, 114, 2889, 91, 63, 0, 24, {700, 200, 0, 0, 30, 0, 0}},
+};
+static const CompiledSoundEffect happyEffects[] = {
+    {0, 11, 0, 1023, 1992, 669, 440, 262, 28, 18, 2, {500, 0, 0, 0, 100, 0, 0}},
+    {0, 8, 0, 232, 2129, 295, 2404, 0, 4, 224, 11, {0, 0, 0, 0, 75, 0, 0}},
+    {0, 9, 0, 0, 2129, 295, 2404, 145, 4, 224, 11, {0, 0, 0, 0, 75, 0, 0}},
+};
+static const CompiledSoundEffect helloEffects[] = {
+    {3, 2, 0, 1023, 673, 197, 1187, 1023, 128, 0, 24, {0, 0, 0, 0, 0, 0, 0}},
+    {3, 2, 0, 0, 1064, 16, 981, 0, 128, 1, 4, {0, 0, 0, 0, 0, 0, 0}},
+    {3, 2, 0, 1023, 1064, 293, 981, 1023, 128, 1, 4, {0, 0, 0, 0, 0, 0, 0}},
+};
+static const CompiledSoundEffect mysteriousEffects[] = {
+    {4, 0, 0, 0, 2390, 331, 2404, 477, 4, 224, 11, {400, 0, 0, 0, 80, 0, 0}},
+    {4, 0, 3, 551, 2845, 3850, 440, 0, 128, 105, 16, {0, 0, 0, 0, 850, 50, 15}},
+};
+static const CompiledSoundEffect sadEffects[] = {
+    {3, 1, 0, 1023, 2226, 708, 1624, 1023, 128, 1, 24, {0, 0, 0, 0, 0, 0, 0}},
+    {3, 2, 0, 1023, 1623, 936, 939, 0, 128, 1, 24, {0, 0, 0, 0, 0, 0, 0}},
+};
+static const CompiledSoundEffect slideEffects[] = {
+    {1, 2, 1, 520, 2325, 223, 2404, 1023, 128, 200, 11, {400, 0, 0, 0, 100, 0, 0}},
+    {0, 2, 1, 1023, 2520, 910, 440, 1023, 128, 224, 11, {400, 0, 0, 0, 100, 0, 0}},
+};
+static const CompiledSoundEffect soaringEffects[] = {
+    {2, 5, 2, 1023, 4009, 5309, 5999, 1023, 22, 4, 2, {250, 0, 0, 0, 200, 0, 0}},
+    {4, 14, 1, 223, 3727, 2730, 440, 0, 31, 244, 3, {0, 0, 0, 0, 0, 0, 0}},
+};
+static const CompiledSoundEffect springEffects[] = {
+    {3, 12, 0, 659, 37, 1163, 587, 807, 34, 0, 24, {0, 0, 0, 0, 500, 0, 0}},
+    {0, 13, 0, 1023, 37, 1163, 587, 1023, 31, 0, 24, {0, 0, 0, 0, 500, 0, 0}},
+};
+static const CompiledSoundEffect twinkleEffects[] = {
+    {0, 9, 0, 1018, 7, 6722, 756, 855, 128, 0, 24, {0, 0, 0, 0, 0, 0, 0}},
+};
+static const CompiledSoundEffect yawnEffects[] = {
+    {2, 2, 1, 0, 2281, 1332, 1500, 1023, 128, 241, 24, {400, 300, 0, 0, 100, 0, 0}},
+    {0, 2, 1, 531, 2520, 910, 440, 636, 128, 224, 11, {300, 0, 0, 0, 100, 0, 0}},
+    {0, 8, 0, 822, 784, 190, 440, 681, 16, 55, 24, {0, 0, 0, 0, 50, 0, 0}},
+    {0, 8, 0, 479, 784, 190, 440, 298, 16, 0, 24, {0, 0, 0, 0, 50, 0, 0}},
+    {0, 8, 0, 321, 784, 190, 440, 108, 16, 33, 8, {0, 0, 0, 0, 50, 0, 0}},
+};
+
+// Precomputed soundExpressionHash() of each name.
+static const BuiltInSoundExpression builtInSounds[] = {
+    {0x33b3dba0, "giggle", giggleEffects, sizeof(giggleEffects) / sizeof(CompiledSoundEffect)},
+    {0x99863551, "happy", happyEffects, sizeof(happyEffects) / sizeof(CompiledSoundEffect)},
+    {0x4f9f2cab, "hello", helloEffects, sizeof(helloEffects) / sizeof(CompiledSoundEffect)},
+    {0x717053cb, "mysterious", mysteriousEffects, sizeof(mysteriousEffects) / sizeof(CompiledSoundEffect)},
+    {0xe61cac07, "sad", sadEffects, sizeof(sadEffects) / sizeof(CompiledSoundEffect)},
+    {0x5791e5e6, "slide", slideEffects, sizeof(slideEffects) / sizeof(CompiledSoundEffect)},
+    {0x42b330b8, "soaring", soaringEffects, sizeof(soaringEffects) / sizeof(CompiledSoundEffect)},
+    {0x63f1336c, "spring", springEffects, sizeof(springEffects) / sizeof(CompiledSoundEffect)},
+    {0x62fb976b, "twinkle", twinkleEffects, sizeof(twinkleEffects) / sizeof(CompiledSoundEffect)},
+    {0x576ecf72, "yawn", yawnEffects, sizeof(yawnEffects) / sizeof(CompiledSoundEffect)},
+};
+
+bool SoundExpressions::lookupBuiltIn(ManagedString sound, uint32_t hash, const CompiledSoundEffect *&effects, int &count) {
+    for (unsigned i = 0; i < sizeof(builtInSounds) / sizeof(BuiltInSoundExpression); ++i) {
+        const BuiltInSoundExpression &b = builtInSounds[i];
+        if (b.hash == hash && strcmp(b.name, sound.toCharArray()) == 0) {
+            effects = b.effects;
+            count = b.count;
+            return true;
+        }
+    }
+    return false;
+}
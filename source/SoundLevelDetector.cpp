@@ -0,0 +1,369 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SoundLevelDetector.h"
+#include "EventModel.h"
+#include "CodalFiber.h"
+#include "Timer.h"
+#include "ErrorNo.h"
+#include "IntegerMath.h"
+
+using namespace codal;
+
+/**
+ * Compute 200 * log10(x), i.e. the level of amplitude x in tenths of a dB, using integer arithmetic.
+ * @param x The amplitude. Must be positive.
+ * @return The level, accurate to within 0.1 dB.
+ */
+int codal::sound_level_decibels(uint32_t x)
+{
+    if (x == 0)
+        return 0;
+
+    // Split x into 2^e * (1 + f), with f in Q15.
+    int e = 31 - __builtin_clz(x);
+    int32_t f = (int32_t) (((uint64_t) x << 15 >> e) - 32768);
+
+    // log2(1 + f) ~= f + 0.3466 * f * (1 - f), within 0.005. The result is log2(x) in Q16.
+    int32_t t = (f * (32768 - f)) >> 15;
+    int32_t log2x = (e << 16) + (f << 1) + ((t * 22713) >> 15);
+
+    // 200 * log10(x) = 60.206 * log2(x).
+    return (int) (((int64_t) log2x * 60206 + (1000LL << 15)) / (1000LL << 16));
+}
+
+/**
+ * Constructor.
+ *
+ * @param source The stream of audio to measure. 8 and 16 bit signed formats are supported.
+ * @param highThreshold The level above which a SOUND_LEVEL_DETECTOR_EVT_HIGH event is raised, in dB.
+ * @param lowThreshold The level below which a SOUND_LEVEL_DETECTOR_EVT_LOW event is raised, in dB.
+ * @param sampleRate The sample rate of the stream, in Hz.
+ * @param id The event ID to raise threshold events on.
+ * @param connectImmediately If true, measurement starts immediately and persists. Otherwise it starts on first use.
+ */
+SoundLevelDetector::SoundLevelDetector(DataSource &source, int highThreshold, int lowThreshold, int sampleRate, uint16_t id, bool connectImmediately) : upstream(source)
+{
+    this->id = id;
+    this->sampleRate = sampleRate;
+    this->sumSquares = 0;
+    this->peakSample = 0;
+    this->count = 0;
+    this->rms = 0;
+    this->peak = 0;
+    this->level = 0;
+    this->calibration = CONFIG_SOUND_LEVEL_DETECTOR_CALIBRATION;
+    this->highThreshold = highThreshold;
+    this->lowThreshold = lowThreshold;
+    this->lastPoll = 0;
+
+    setWindow(CONFIG_SOUND_LEVEL_DETECTOR_WINDOW);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, SOUND_LEVEL_DETECTOR_EVT_IDLE, this, &SoundLevelDetector::onIdle);
+
+    if (connectImmediately)
+        activate(true);
+}
+
+/**
+ * Destructor.
+ */
+SoundLevelDetector::~SoundLevelDetector()
+{
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, SOUND_LEVEL_DETECTOR_EVT_IDLE, this, &SoundLevelDetector::onIdle);
+
+    deactivate();
+}
+
+/**
+ * Start measuring the audio stream, if not already doing so.
+ *
+ * @param persistent If true, measurement continues until deactivate() is called, as needed to generate
+ * threshold events. Otherwise it stops CONFIG_SOUND_LEVEL_DETECTOR_TIMEOUT ms after the last getValue().
+ * @return DEVICE_OK.
+ */
+int SoundLevelDetector::activate(bool persistent)
+{
+    lastPoll = system_timer_current_time();
+
+    target_disable_irq();
+
+    if (persistent)
+        status |= SOUND_LEVEL_DETECTOR_STATUS_PERSISTENT;
+
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_ACTIVE))
+    {
+        sumSquares = 0;
+        peakSample = 0;
+        count = 0;
+        status &= ~SOUND_LEVEL_DETECTOR_STATUS_VALID;
+        status |= SOUND_LEVEL_DETECTOR_STATUS_ACTIVE;
+    }
+
+    target_enable_irq();
+
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_CONNECTED))
+    {
+        status |= SOUND_LEVEL_DETECTOR_STATUS_CONNECTED;
+        upstream.connect(*this);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop measuring the audio stream, and disconnect from it.
+ * @return DEVICE_OK.
+ */
+int SoundLevelDetector::deactivate()
+{
+    target_disable_irq();
+    status &= ~(SOUND_LEVEL_DETECTOR_STATUS_ACTIVE | SOUND_LEVEL_DETECTOR_STATUS_PERSISTENT);
+    target_enable_irq();
+
+    if (status & SOUND_LEVEL_DETECTOR_STATUS_CONNECTED)
+    {
+        status &= ~SOUND_LEVEL_DETECTOR_STATUS_CONNECTED;
+        upstream.disconnect();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the level of the most recent integration window.
+ * If measurement was not running, it is started and this call waits for the first window to complete.
+ *
+ * @param scale SOUND_LEVEL_DETECTOR_DB for a value in dB, or SOUND_LEVEL_DETECTOR_8BIT for a value
+ * in the range 0..255.
+ * @return the level, or DEVICE_INVALID_PARAMETER if the scale is not recognised.
+ */
+int SoundLevelDetector::getValue(int scale)
+{
+    if (scale != SOUND_LEVEL_DETECTOR_DB && scale != SOUND_LEVEL_DETECTOR_8BIT)
+        return DEVICE_INVALID_PARAMETER;
+
+    activate();
+
+    // Give the first window time to complete, but don't wait forever if the stream has stalled.
+    for (int waited = 0; !(status & SOUND_LEVEL_DETECTOR_STATUS_VALID) && waited < 2 * getWindow(); waited += 10)
+        fiber_sleep(10);
+
+    int db = (level + 5) / 10 + calibration;
+
+    if (scale == SOUND_LEVEL_DETECTOR_DB)
+        return db;
+
+    if (db <= CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MIN)
+        return 0;
+
+    if (db >= CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MAX)
+        return 255;
+
+    return (db - CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MIN) * 255 / (CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MAX - CONFIG_SOUND_LEVEL_DETECTOR_8BIT_MIN);
+}
+
+/**
+ * Determine the RMS amplitude of the most recent integration window, in units of a 16 bit sample.
+ */
+int SoundLevelDetector::getRms()
+{
+    return rms;
+}
+
+/**
+ * Determine the peak amplitude of the most recent integration window, in units of a 16 bit sample.
+ */
+int SoundLevelDetector::getPeak()
+{
+    return peak;
+}
+
+/**
+ * Define the integration window.
+ * @param milliseconds The length of the window, in milliseconds.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the window is not positive.
+ */
+int SoundLevelDetector::setWindow(int milliseconds)
+{
+    if (milliseconds <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    int samples = (int) ((int64_t) milliseconds * sampleRate / 1000);
+
+    target_disable_irq();
+    windowSamples = samples > 0 ? samples : 1;
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the integration window.
+ * @return The length of the window, in milliseconds.
+ */
+int SoundLevelDetector::getWindow()
+{
+    return (int) ((int64_t) windowSamples * 1000 / sampleRate);
+}
+
+/**
+ * Define the level above which a SOUND_LEVEL_DETECTOR_EVT_HIGH event is raised.
+ * @param value The threshold, in dB.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if it is below the low threshold.
+ */
+int SoundLevelDetector::setHighThreshold(int value)
+{
+    if (value < lowThreshold)
+        return DEVICE_INVALID_PARAMETER;
+
+    highThreshold = value;
+    return DEVICE_OK;
+}
+
+/**
+ * Define the level below which a SOUND_LEVEL_DETECTOR_EVT_LOW event is raised.
+ * @param value The threshold, in dB.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if it is above the high threshold.
+ */
+int SoundLevelDetector::setLowThreshold(int value)
+{
+    if (value > highThreshold)
+        return DEVICE_INVALID_PARAMETER;
+
+    lowThreshold = value;
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the high threshold, in dB.
+ */
+int SoundLevelDetector::getHighThreshold()
+{
+    return highThreshold;
+}
+
+/**
+ * Determine the low threshold, in dB.
+ */
+int SoundLevelDetector::getLowThreshold()
+{
+    return lowThreshold;
+}
+
+/**
+ * Define the level (in dB) corresponding to an RMS amplitude of one unit of a 16 bit sample.
+ * @param offset The calibration offset, in dB.
+ */
+void SoundLevelDetector::setCalibration(int offset)
+{
+    calibration = offset;
+}
+
+/**
+ * Complete the current integration window, updating the level and raising any threshold events.
+ */
+void SoundLevelDetector::endWindow()
+{
+    rms = integer_sqrt((uint32_t) (sumSquares / count));
+    peak = peakSample;
+    level = sound_level_decibels(rms);
+
+    sumSquares = 0;
+    peakSample = 0;
+    count = 0;
+    status |= SOUND_LEVEL_DETECTOR_STATUS_VALID;
+
+    int db10 = level + calibration * 10;
+
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_HIGH) && db10 >= highThreshold * 10)
+    {
+        status |= SOUND_LEVEL_DETECTOR_STATUS_HIGH;
+        Event(id, SOUND_LEVEL_DETECTOR_EVT_HIGH);
+    }
+    else if ((status & SOUND_LEVEL_DETECTOR_STATUS_HIGH) && db10 <= lowThreshold * 10)
+    {
+        status &= ~SOUND_LEVEL_DETECTOR_STATUS_HIGH;
+        Event(id, SOUND_LEVEL_DETECTOR_EVT_LOW);
+    }
+
+    // Stop processing audio once nobody is interested. Disconnecting is left to a fiber.
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_PERSISTENT) && system_timer_current_time() - lastPoll > CONFIG_SOUND_LEVEL_DETECTOR_TIMEOUT)
+    {
+        status &= ~SOUND_LEVEL_DETECTOR_STATUS_ACTIVE;
+        Event(id, SOUND_LEVEL_DETECTOR_EVT_IDLE);
+    }
+}
+
+/**
+ * Handle internal events, on a fiber.
+ */
+void SoundLevelDetector::onIdle(Event)
+{
+    // A poll may have restarted measurement since the event was raised.
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_ACTIVE))
+        deactivate();
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int SoundLevelDetector::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    if (!(status & SOUND_LEVEL_DETECTOR_STATUS_ACTIVE))
+        return DEVICE_OK;
+
+    int format = upstream.getFormat();
+    int samples = b.length() / DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+    int shift = format == DATASTREAM_FORMAT_8BIT_SIGNED ? 8 : 0;
+    int8_t *in8 = (int8_t *) &b[0];
+    int16_t *in16 = (int16_t *) &b[0];
+
+    for (int i = 0; i < samples; i++)
+    {
+        int32_t s = shift ? in8[i] << shift : in16[i];
+
+        sumSquares += (uint32_t) (s * s);
+
+        if (s < 0)
+            s = -s;
+
+        if (s > peakSample)
+            peakSample = s;
+
+        if (++count >= windowSamples)
+        {
+            endWindow();
+
+            if (!(status & SOUND_LEVEL_DETECTOR_STATUS_ACTIVE))
+                break;
+        }
+    }
+
+    return DEVICE_OK;
+}
@@ -28,9 +28,11 @@ DEALINGS IN THE SOFTWARE.
   * Commonly represents an I/O pin on the edge connector.
   */
 #include "SoundOutputPin.h"
-#include "Synthesizer.h"
 #include "CodalDmesg.h"
+#include "EventModel.h"
+#include "Timer.h"
 #include "MicroBitAudio.h"
+#include "AudioBufferPool.h"
 
 using namespace codal;
 
@@ -41,17 +43,16 @@ using namespace codal;
  * @param id the unique EventModel id of this component.
  * @param mixer the mixer to use
  */
-SoundOutputPin::SoundOutputPin(Mixer2 &mix, int id) : codal::Pin(id, 0, PIN_CAPABILITY_ANALOG), mixer(mix), synth(DEVICE_ID_SOUND_EMOJI_SYNTHESIZER_1), outputBuffer(sizeof(SoundEffect))
+SoundOutputPin::SoundOutputPin(Mixer2 &mix, int id) : codal::Pin(id, 0, PIN_CAPABILITY_ANALOG), CodalComponent(id, 0), mixer(mix)
 {
-    this->value = 512;
+    this->value = 0;
     this->periodUs = 0;
-    this->fx = NULL;
     this->channel = NULL;
+    this->downStream = NULL;
     this->timeOfLastUpdate = 0;
-
-    // Enable lazy periodic callback and optimised silence generation.
-    CodalComponent::status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
-    synth.allowEmptyBuffers(true);
+    this->position = 0;
+    this->skip = 0;
+    this->amplitude = 0;
 }
 
 
@@ -148,45 +149,142 @@ int SoundOutputPin::getAnalogPeriod()
  */
 void SoundOutputPin::update()
 {
-    float volume = periodUs == 0.0f ? 0.0f : (4.0f * ((float)value)) / 512.0f;
-
     // Snapshot the curent time, so we can determine periods of silence.
     this->timeOfLastUpdate = system_timer_current_time();
 
-    // If this is the first time we've been asked to produce a sound, prime a SoundEffect buffer.
-    if (fx == NULL)
+    // If this is the first time we've been asked to produce a sound, join the mixer.
+    if (channel == NULL)
     {
         // Enable the audio output pipeline, if needed.
         MicroBitAudio::requestActivation();
 
-        // Create a sound effect buffer, and configure a synthesizer for a raw squarewave output into the mixer.
-        fx = (SoundEffect *)&outputBuffer[0];
-        fx->duration = -CONFIG_SOUND_OUTPUT_PIN_PERIOD;
-        fx->tone.tonePrint = Synthesizer::SquareWaveTone;
-        fx->volume = 0.0f;
-        channel = mixer.addChannel(synth);
+        if (EventModel::defaultEventBus)
+            EventModel::defaultEventBus->listen(CodalComponent::id, SOUND_OUTPUT_PIN_EVT_SILENCE_GATE, this, &SoundOutputPin::onSilenceGate, MESSAGE_BUS_LISTENER_IMMEDIATE);
+
+        channel = mixer.addChannel(*this, CONFIG_SOUND_OUTPUT_PIN_SAMPLE_RATE, SOUND_OUTPUT_PIN_SAMPLE_RANGE);
     }
 
-    // Update our parameters
-    fx->frequency = periodUs == 0 ? 6068 : 1000000.0f / (float) periodUs;
-    fx->volume = volume;
+    // Update our parameters. Each is a single word, so is safe to update while the mixer is pulling from us.
+    // The duty cycle (0..128) maps linearly onto 0..100% of the channel's range, and is clamped so the wave never leaves it.
+    uint16_t a = periodUs == 0 ? 0 : (min(value, 128) * (SOUND_OUTPUT_PIN_SAMPLE_RANGE / 2)) / 128;
+    bool restart = false;
+
+    // Frequencies above Nyquist are clamped, as they can't be represented anyway.
+    if (periodUs != 0)
+        skip = (uint32_t) min(2147483648.0, 4294967296.0 * 1000000.0 / ((double) periodUs * CONFIG_SOUND_OUTPUT_PIN_SAMPLE_RATE));
+
+    target_disable_irq();
+    amplitude = a;
+
+    if (a)
+    {
+        // Restart the stream if it had been gated.
+        CodalComponent::status &= ~SOUND_OUTPUT_PIN_STATUS_GATED;
+        if (!(CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE))
+        {
+            CodalComponent::status |= SOUND_OUTPUT_PIN_STATUS_ACTIVE;
+            restart = true;
+        }
+    }
+    target_enable_irq();
+
+    if (restart)
+        downStream->pullRequest();
+
+    // If we're now silent, let the silence gate decide when to stop generating samples.
+    if (a == 0)
+        scheduleGate(CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE);
+}
+
+/**
+ * Schedule a timer event to fire when the silence gate could next expire, unless one is already pending.
+ */
+void SoundOutputPin::scheduleGate(uint32_t delay)
+{
+    if ((CodalComponent::status & (SOUND_OUTPUT_PIN_STATUS_ACTIVE | SOUND_OUTPUT_PIN_STATUS_GATE_PENDING)) != SOUND_OUTPUT_PIN_STATUS_ACTIVE)
+        return;
+
+    CodalComponent::status |= SOUND_OUTPUT_PIN_STATUS_GATE_PENDING;
+    system_timer_event_after(delay, CodalComponent::id, SOUND_OUTPUT_PIN_EVT_SILENCE_GATE);
 }
 
 /**
- * Disable the synthesizer during long periods of silence, for efficiency.
+ * Timer event handler. Suspends audio generation if the pin has been silent for longer than the silence gate.
  */
-void SoundOutputPin::idleCallback()
+void SoundOutputPin::onSilenceGate(Event)
 {
-    if ((CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE) && (fx->volume == 0.0f) && (system_timer_current_time() - this->timeOfLastUpdate > CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE))
+    CodalComponent::status &= ~SOUND_OUTPUT_PIN_STATUS_GATE_PENDING;
+
+    uint32_t silence = system_timer_current_time() - this->timeOfLastUpdate;
+
+    target_disable_irq();
+    bool expired = amplitude == 0 && silence >= CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE;
+    if (expired)
+        CodalComponent::status |= SOUND_OUTPUT_PIN_STATUS_GATED;
+    target_enable_irq();
+
+    // The pin was updated since this event was scheduled. Wait out the remainder of the gate.
+    if (!expired && amplitude == 0)
+        scheduleGate(CONFIG_SOUND_OUTPUT_PIN_SILENCE_GATE - silence);
+}
+
+/**
+ * Define a downstream component for data stream.
+ *
+ * @sink The component that data will be delivered to, when it is availiable
+ */
+void SoundOutputPin::connect(DataSink &sink)
+{
+    this->downStream = &sink;
+}
+
+/**
+ *  Determine the data format of the buffers streamed out of this component.
+ */
+int SoundOutputPin::getFormat()
+{
+    return DATASTREAM_FORMAT_16BIT_UNSIGNED;
+}
+
+/**
+ * Provide the next block of square wave samples to our downstream caller.
+ * Once the pin has been silenced by the silence gate, an empty buffer is returned and the stream is left idle.
+ */
+ManagedBuffer SoundOutputPin::pull()
+{
+    // If the silence gate has expired, this is the last buffer until the pin is next made audible.
+    if (CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_GATED)
+        CodalComponent::status &= ~(SOUND_OUTPUT_PIN_STATUS_ACTIVE | SOUND_OUTPUT_PIN_STATUS_GATED);
+
+    if (!(CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE))
+        return ManagedBuffer();
+
+    ManagedBuffer buffer = AudioBufferPool::getDefault().allocate(SOUND_OUTPUT_PIN_BUFFER_SAMPLES * 2);
+    uint16_t *out = (uint16_t *) &buffer[0];
+    uint16_t *end = out + SOUND_OUTPUT_PIN_BUFFER_SAMPLES;
+
+    uint32_t p = position;
+    uint32_t s = skip;
+    uint16_t hi = ((SOUND_OUTPUT_PIN_SAMPLE_RANGE + 1) / 2) + amplitude;
+    uint16_t lo = ((SOUND_OUTPUT_PIN_SAMPLE_RANGE + 1) / 2) - amplitude;
+
+    if (hi == lo)
     {
-        CodalComponent::status &= ~SOUND_OUTPUT_PIN_STATUS_ACTIVE;
-        synth.stop();
+        while (out < end)
+            *out++ = hi;
     }
-
-    // If our volume is non-zero and we're not active, then restart to synthesizer.
-    if (!(CodalComponent::status & SOUND_OUTPUT_PIN_STATUS_ACTIVE) && fx && fx->volume > 0.0f)
+    else
     {
-        CodalComponent::status |= SOUND_OUTPUT_PIN_STATUS_ACTIVE;
-        synth.play(outputBuffer);
+        // The top bit of the phase accumulator is the square wave itself.
+        while (out < end)
+        {
+            *out++ = (p & 0x80000000) ? lo : hi;
+            p += s;
+        }
     }
-}
\ No newline at end of file
+
+    position = p;
+
+    downStream->pullRequest();
+    return buffer;
+}
@@ -0,0 +1,604 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SpectrumAnalyser.h"
+#include "EventModel.h"
+#include "CodalFiber.h"
+#include "ErrorNo.h"
+#include "IntegerMath.h"
+
+using namespace codal;
+
+#define SPECTRUM_SINE_TABLE_SIZE        1024
+
+/**
+ * First quadrant of a 1024 point sine wave, in Q15. Sufficient for twiddle factors and windows of FFTs up to 1024 points.
+ */
+static const int16_t spectrum_sine_table[SPECTRUM_SINE_TABLE_SIZE / 4 + 1] = {
+        0,   201,   402,   603,   804,  1005,  1206,  1407,  1608,  1809,  2009,  2210,
+     2410,  2611,  2811,  3012,  3212,  3412,  3612,  3811,  4011,  4210,  4410,  4609,
+     4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,  6393,  6590,  6786,  6983,
+     7179,  7375,  7571,  7767,  7962,  8157,  8351,  8545,  8739,  8933,  9126,  9319,
+     9512,  9704,  9896, 10087, 10278, 10469, 10659, 10849, 11039, 11228, 11417, 11605,
+    11793, 11980, 12167, 12353, 12539, 12725, 12910, 13094, 13279, 13462, 13645, 13828,
+    14010, 14191, 14372, 14553, 14732, 14912, 15090, 15269, 15446, 15623, 15800, 15976,
+    16151, 16325, 16499, 16673, 16846, 17018, 17189, 17360, 17530, 17700, 17869, 18037,
+    18204, 18371, 18537, 18703, 18868, 19032, 19195, 19357, 19519, 19680, 19841, 20000,
+    20159, 20317, 20475, 20631, 20787, 20942, 21096, 21250, 21403, 21554, 21705, 21856,
+    22005, 22154, 22301, 22448, 22594, 22739, 22884, 23027, 23170, 23311, 23452, 23592,
+    23731, 23870, 24007, 24143, 24279, 24413, 24547, 24680, 24811, 24942, 25072, 25201,
+    25329, 25456, 25582, 25708, 25832, 25955, 26077, 26198, 26319, 26438, 26556, 26674,
+    26790, 26905, 27019, 27133, 27245, 27356, 27466, 27575, 27683, 27790, 27896, 28001,
+    28105, 28208, 28310, 28411, 28510, 28609, 28706, 28803, 28898, 28992, 29085, 29177,
+    29268, 29358, 29447, 29534, 29621, 29706, 29791, 29874, 29956, 30037, 30117, 30195,
+    30273, 30349, 30424, 30498, 30571, 30643, 30714, 30783, 30852, 30919, 30985, 31050,
+    31113, 31176, 31237, 31297, 31356, 31414, 31470, 31526, 31580, 31633, 31685, 31736,
+    31785, 31833, 31880, 31926, 31971, 32014, 32057, 32098, 32137, 32176, 32213, 32250,
+    32285, 32318, 32351, 32382, 32412, 32441, 32469, 32495, 32521, 32545, 32567, 32589,
+    32609, 32628, 32646, 32663, 32678, 32692, 32705, 32717, 32728, 32737, 32745, 32752,
+    32757, 32761, 32765, 32766, 32767
+};
+
+/**
+ * Determine sin(2 * pi * k / 1024) in Q15.
+ */
+static inline int spectrum_sin(int k)
+{
+    k &= SPECTRUM_SINE_TABLE_SIZE - 1;
+
+    if (k <= 256)
+        return spectrum_sine_table[k];
+    if (k <= 512)
+        return spectrum_sine_table[512 - k];
+    if (k <= 768)
+        return -spectrum_sine_table[k - 512];
+
+    return -spectrum_sine_table[1024 - k];
+}
+
+/**
+ * Determine cos(2 * pi * k / 1024) in Q15.
+ */
+static inline int spectrum_cos(int k)
+{
+    return spectrum_sin(k + SPECTRUM_SINE_TABLE_SIZE / 4);
+}
+
+/**
+ * In place, forward complex FFT of CONFIG_SPECTRUM_ANALYSER_SIZE points, radix-4, decimation in frequency.
+ * Each stage scales by 1/4, so the output is scaled by 1/size and cannot overflow.
+ * The output is left in base-4 digit reversed order.
+ *
+ * @param data Interleaved real and imaginary Q15 values.
+ * @param size The number of points, a power of four no greater than 1024.
+ */
+void codal::spectrum_fft_radix4(int16_t *data, int size)
+{
+    for (int n1 = size; n1 > 1; n1 >>= 2)
+    {
+        int n2 = n1 >> 2;
+        int stride = SPECTRUM_SINE_TABLE_SIZE / n1;
+
+        for (int j = 0; j < n2; j++)
+        {
+            int c1 = spectrum_cos(j * stride), s1 = spectrum_sin(j * stride);
+            int c2 = spectrum_cos(2 * j * stride), s2 = spectrum_sin(2 * j * stride);
+            int c3 = spectrum_cos(3 * j * stride), s3 = spectrum_sin(3 * j * stride);
+
+            for (int i = j; i < size; i += n1)
+            {
+                int16_t *p0 = data + 2 * i;
+                int16_t *p1 = p0 + 2 * n2;
+                int16_t *p2 = p1 + 2 * n2;
+                int16_t *p3 = p2 + 2 * n2;
+
+                int ar = (p0[0] >> 2) + (p2[0] >> 2);
+                int ai = (p0[1] >> 2) + (p2[1] >> 2);
+                int br = (p0[0] >> 2) - (p2[0] >> 2);
+                int bi = (p0[1] >> 2) - (p2[1] >> 2);
+                int cr = (p1[0] >> 2) + (p3[0] >> 2);
+                int ci = (p1[1] >> 2) + (p3[1] >> 2);
+                int dr = (p1[0] >> 2) - (p3[0] >> 2);
+                int di = (p1[1] >> 2) - (p3[1] >> 2);
+                int yr, yi;
+
+                p0[0] = ar + cr;
+                p0[1] = ai + ci;
+
+                // (x0 - x2) - j(x1 - x3), rotated by W^j
+                yr = br + di;
+                yi = bi - dr;
+                p1[0] = (yr * c1 + yi * s1) >> 15;
+                p1[1] = (yi * c1 - yr * s1) >> 15;
+
+                // (x0 + x2) - (x1 + x3), rotated by W^2j
+                yr = ar - cr;
+                yi = ai - ci;
+                p2[0] = (yr * c2 + yi * s2) >> 15;
+                p2[1] = (yi * c2 - yr * s2) >> 15;
+
+                // (x0 - x2) + j(x1 - x3), rotated by W^3j
+                yr = br - di;
+                yi = bi + dr;
+                p3[0] = (yr * c3 + yi * s3) >> 15;
+                p3[1] = (yi * c3 - yr * s3) >> 15;
+            }
+        }
+    }
+}
+
+/**
+ * Determine the position in the output of spectrum_fft_radix4() of the given bin.
+ */
+int codal::spectrum_digit_reverse(int index, int size)
+{
+    int r = 0;
+
+    for (int n = size; n > 1; n >>= 2)
+    {
+        r = (r << 2) | (index & 3);
+        index >>= 2;
+    }
+
+    return r;
+}
+
+/**
+ * Constructor.
+ *
+ * @param source The stream of audio to analyse. 8 and 16 bit signed formats are supported.
+ * @param sampleRate The sample rate of the stream, in Hz.
+ * @param id The event ID to raise band events on.
+ * @param connectImmediately If true, analysis starts immediately. Otherwise it starts on first use.
+ */
+SpectrumAnalyser::SpectrumAnalyser(DataSource &source, int sampleRate, uint16_t id, bool connectImmediately) : upstream(source)
+{
+    this->id = id;
+    this->sampleRate = sampleRate;
+    this->window = NULL;
+    this->fft = NULL;
+    this->magnitude = NULL;
+    this->frameSlot = 0;
+    this->hopCount = 0;
+    this->frames = 0;
+    this->skipped = 0;
+    this->peakBin = 0;
+    this->peakFrequency = 0;
+
+    for (int i = 0; i < CONFIG_SPECTRUM_ANALYSER_BANDS; i++)
+        clearBand(i);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, SPECTRUM_ANALYSER_EVT_FRAME, this, &SpectrumAnalyser::onFrame);
+
+    if (connectImmediately)
+        activate();
+}
+
+/**
+ * Destructor.
+ */
+SpectrumAnalyser::~SpectrumAnalyser()
+{
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->ignore(id, SPECTRUM_ANALYSER_EVT_FRAME, this, &SpectrumAnalyser::onFrame);
+
+    deactivate();
+}
+
+/**
+ * Start analysing the audio stream, if not already doing so.
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if memory could not be allocated.
+ */
+int SpectrumAnalyser::activate()
+{
+    if (status & SPECTRUM_ANALYSER_STATUS_ACTIVE)
+        return DEVICE_OK;
+
+    window = (int16_t *) malloc(SPECTRUM_ANALYSER_FRAMES * CONFIG_SPECTRUM_ANALYSER_SIZE * sizeof(int16_t));
+    fft = (int16_t *) malloc(CONFIG_SPECTRUM_ANALYSER_SIZE * 2 * sizeof(int16_t));
+    magnitude = (uint16_t *) malloc(SPECTRUM_ANALYSER_BINS * sizeof(uint16_t));
+
+    if (window == NULL || fft == NULL || magnitude == NULL)
+    {
+        deactivate();
+        return DEVICE_NO_RESOURCES;
+    }
+
+    memset(window, 0, SPECTRUM_ANALYSER_FRAMES * CONFIG_SPECTRUM_ANALYSER_SIZE * sizeof(int16_t));
+    memset(magnitude, 0, SPECTRUM_ANALYSER_BINS * sizeof(uint16_t));
+
+    frameSlot = 0;
+    hopCount = 0;
+    frames = 0;
+    skipped = 0;
+    peakBin = 0;
+    peakFrequency = 0;
+
+    status &= ~(SPECTRUM_ANALYSER_STATUS_BUSY | SPECTRUM_ANALYSER_STATUS_VALID);
+    status |= SPECTRUM_ANALYSER_STATUS_ACTIVE;
+    upstream.connect(*this);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Stop analysing the audio stream, and release the memory used.
+ * @return DEVICE_OK on success.
+ */
+int SpectrumAnalyser::deactivate()
+{
+    if (status & SPECTRUM_ANALYSER_STATUS_ACTIVE)
+    {
+        target_disable_irq();
+        status &= ~SPECTRUM_ANALYSER_STATUS_ACTIVE;
+        target_enable_irq();
+
+        upstream.disconnect();
+    }
+
+    // Wait for any analysis in progress to complete before releasing its buffers.
+    while ((status & SPECTRUM_ANALYSER_STATUS_BUSY) && EventModel::defaultEventBus)
+        fiber_sleep(1);
+
+    free(window);
+    free(fft);
+    free(magnitude);
+    window = NULL;
+    fft = NULL;
+    magnitude = NULL;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the magnitude of the given bin, from the last analysed frame.
+ *
+ * @param bin The bin, in the range 0..SPECTRUM_ANALYSER_BINS-1.
+ * Bin k is centred on k * sampleRate / CONFIG_SPECTRUM_ANALYSER_SIZE Hz.
+ * @return the magnitude, or DEVICE_INVALID_PARAMETER if the bin is out of range.
+ */
+int SpectrumAnalyser::getMagnitude(int bin)
+{
+    if (bin < 0 || bin >= SPECTRUM_ANALYSER_BINS)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (activate() != DEVICE_OK)
+        return 0;
+
+    return magnitude[bin];
+}
+
+/**
+ * Determine the energy (sum of squared magnitudes) of the given range of frequencies, from the last analysed frame.
+ *
+ * @param lowFrequency The lowest frequency of interest, in Hz.
+ * @param highFrequency The highest frequency of interest, in Hz.
+ * @return the energy of the bins covering the given frequencies, or DEVICE_INVALID_PARAMETER.
+ */
+int SpectrumAnalyser::getBandEnergy(int lowFrequency, int highFrequency)
+{
+    if (lowFrequency < 0 || highFrequency < lowFrequency)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (activate() != DEVICE_OK)
+        return 0;
+
+    uint32_t e = energy(frequencyToBin(lowFrequency), frequencyToBin(highFrequency));
+
+    return e > 0x7FFFFFFF ? 0x7FFFFFFF : (int) e;
+}
+
+/**
+ * Determine the frequency of the loudest sound, from the last analysed frame.
+ * @return the frequency, in Hz.
+ */
+int SpectrumAnalyser::getPeakFrequency()
+{
+    activate();
+    return peakFrequency;
+}
+
+/**
+ * Determine the magnitude of the loudest frequency, from the last analysed frame.
+ * @return the magnitude.
+ */
+int SpectrumAnalyser::getPeakMagnitude()
+{
+    if (activate() != DEVICE_OK)
+        return 0;
+
+    return magnitude[peakBin];
+}
+
+/**
+ * Monitor a band of frequencies, raising SPECTRUM_ANALYSER_EVT_BAND_HIGH(band) and SPECTRUM_ANALYSER_EVT_BAND_LOW(band)
+ * events as its energy crosses the given thresholds. Analysis starts, if it hasn't already.
+ *
+ * @param band The band to configure, in the range 0..CONFIG_SPECTRUM_ANALYSER_BANDS-1.
+ * @param lowFrequency The lowest frequency of the band, in Hz.
+ * @param highFrequency The highest frequency of the band, in Hz.
+ * @param highThreshold The energy above which the band is considered active.
+ * @param lowThreshold The energy below which the band is considered inactive again. Defaults to half of highThreshold.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+ */
+int SpectrumAnalyser::setBand(int band, int lowFrequency, int highFrequency, uint32_t highThreshold, uint32_t lowThreshold)
+{
+    if (band < 0 || band >= CONFIG_SPECTRUM_ANALYSER_BANDS || lowFrequency < 0 || highFrequency < lowFrequency || lowThreshold > highThreshold)
+        return DEVICE_INVALID_PARAMETER;
+
+    SpectrumBand &b = bands[band];
+
+    b.lowBin = frequencyToBin(lowFrequency);
+    b.highBin = max(frequencyToBin(highFrequency), 1);
+    b.highThreshold = highThreshold;
+    b.lowThreshold = lowThreshold ? lowThreshold : highThreshold / 2;
+    b.high = false;
+
+    return activate();
+}
+
+/**
+ * Stop monitoring the given band.
+ *
+ * @param band The band to clear.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER.
+ */
+int SpectrumAnalyser::clearBand(int band)
+{
+    if (band < 0 || band >= CONFIG_SPECTRUM_ANALYSER_BANDS)
+        return DEVICE_INVALID_PARAMETER;
+
+    bands[band].lowBin = 0;
+    bands[band].highBin = 0;
+    bands[band].high = false;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the number of frames analysed since activation.
+ */
+uint32_t SpectrumAnalyser::getFrameCount()
+{
+    return frames;
+}
+
+/**
+ * Determine the number of frames skipped because analysis could not keep up.
+ */
+uint32_t SpectrumAnalyser::getSkippedFrames()
+{
+    return skipped;
+}
+
+/**
+ * Determine the heap memory held by this analyser, including its frame buffers while active.
+ * @return The size in bytes.
+ */
+int SpectrumAnalyser::getHeapUsage()
+{
+    int bytes = sizeof(SpectrumAnalyser);
+
+    if (window)
+        bytes += SPECTRUM_ANALYSER_FRAMES * CONFIG_SPECTRUM_ANALYSER_SIZE * sizeof(int16_t);
+
+    if (fft)
+        bytes += CONFIG_SPECTRUM_ANALYSER_SIZE * 2 * sizeof(int16_t);
+
+    if (magnitude)
+        bytes += SPECTRUM_ANALYSER_BINS * sizeof(uint16_t);
+
+    return bytes;
+}
+
+/**
+ * Convert a frequency to the nearest bin, clamped to the valid range.
+ */
+int SpectrumAnalyser::frequencyToBin(int frequency)
+{
+    int bin = (int) (((int64_t) frequency * CONFIG_SPECTRUM_ANALYSER_SIZE + sampleRate / 2) / sampleRate);
+
+    return min(bin, SPECTRUM_ANALYSER_BINS - 1);
+}
+
+/**
+ * Sum the squared magnitudes of the given bins, saturating.
+ */
+uint32_t SpectrumAnalyser::energy(int lowBin, int highBin)
+{
+    uint32_t e = 0;
+
+    for (int i = lowBin; i <= highBin; i++)
+    {
+        uint32_t m = magnitude[i];
+        uint32_t p = m * m;
+
+        e = (e + p < e) ? 0xFFFFFFFF : e + p;
+    }
+
+    return e;
+}
+
+/**
+ * Copy the completed frame in the given slot of window into the FFT buffer.
+ */
+void SpectrumAnalyser::loadFrame(int slot)
+{
+    int16_t *in = window + slot * CONFIG_SPECTRUM_ANALYSER_SIZE;
+    int16_t *out = fft;
+
+    for (int n = 0; n < CONFIG_SPECTRUM_ANALYSER_SIZE; n++)
+    {
+        *out++ = *in++;
+        *out++ = 0;
+    }
+}
+
+/**
+ * Analyse a frame, on a fiber.
+ */
+void SpectrumAnalyser::onFrame(Event)
+{
+    if (!(status & SPECTRUM_ANALYSER_STATUS_BUSY))
+        return;
+
+    spectrum_fft_radix4(fft, CONFIG_SPECTRUM_ANALYSER_SIZE);
+
+    int peak = 1;
+
+    for (int k = 0; k < SPECTRUM_ANALYSER_BINS; k++)
+    {
+        int16_t *x = fft + 2 * spectrum_digit_reverse(k, CONFIG_SPECTRUM_ANALYSER_SIZE);
+        int32_t re = x[0];
+        int32_t im = x[1];
+
+        // The spectrum of a real signal is symmetric, so bins other than DC and Nyquist hold half of the energy.
+        uint32_t m = integer_sqrt(re * re + im * im);
+        if (k > 0 && k < SPECTRUM_ANALYSER_BINS - 1)
+            m <<= 1;
+
+        magnitude[k] = min(m, 65535UL);
+
+        if (k > 0 && magnitude[k] > magnitude[peak])
+            peak = k;
+    }
+
+    // Refine the peak frequency by fitting a parabola through the peak bin and its neighbours.
+    int64_t f = (int64_t) peak * 2;
+    int64_t d = 2;
+
+    if (peak > 0 && peak < SPECTRUM_ANALYSER_BINS - 1)
+    {
+        int32_t l = magnitude[peak - 1];
+        int32_t c = magnitude[peak];
+        int32_t r = magnitude[peak + 1];
+        int32_t den = 2 * c - l - r;
+
+        if (den > 0)
+        {
+            f = (int64_t) peak * 2 * den + (r - l);
+            d = 2 * den;
+        }
+    }
+
+    peakBin = peak;
+    peakFrequency = (int) ((f * sampleRate) / (d * CONFIG_SPECTRUM_ANALYSER_SIZE));
+    frames++;
+
+    status |= SPECTRUM_ANALYSER_STATUS_VALID;
+
+    // Check monitored bands for threshold crossings.
+    for (int b = 0; b < CONFIG_SPECTRUM_ANALYSER_BANDS; b++)
+    {
+        SpectrumBand &band = bands[b];
+
+        if (band.highBin == 0)
+            continue;
+
+        uint32_t e = energy(band.lowBin, band.highBin);
+
+        if (!band.high && e > band.highThreshold)
+        {
+            band.high = true;
+            Event(id, SPECTRUM_ANALYSER_EVT_BAND_HIGH(b));
+        }
+        else if (band.high && e < band.lowThreshold)
+        {
+            band.high = false;
+            Event(id, SPECTRUM_ANALYSER_EVT_BAND_LOW(b));
+        }
+    }
+
+    // Let the next frame in.
+    status &= ~SPECTRUM_ANALYSER_STATUS_BUSY;
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int SpectrumAnalyser::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    if (!(status & SPECTRUM_ANALYSER_STATUS_ACTIVE))
+        return DEVICE_OK;
+
+    int format = upstream.getFormat();
+    int bytesPerSample = DATASTREAM_FORMAT_BYTES_PER_SAMPLE(format);
+    uint8_t *in = &b[0];
+    uint8_t *end = in + b.length();
+
+    int scale = SPECTRUM_SINE_TABLE_SIZE / CONFIG_SPECTRUM_ANALYSER_SIZE;
+
+    while (in < end)
+    {
+        // Leave a bit of headroom, so windowed samples fit comfortably within Q15.
+        int32_t sample;
+
+        if (format == DATASTREAM_FORMAT_8BIT_SIGNED)
+            sample = *((int8_t *)in) << 7;
+        else
+            sample = *((int16_t *)in) >> 1;
+
+        in += bytesPerSample;
+
+        // Window the sample into each frame it belongs to. Frames end a hop apart, so its position in each
+        // successive frame is a hop earlier, starting with the frame that completes at the end of this hop.
+        int n = CONFIG_SPECTRUM_ANALYSER_SIZE - CONFIG_SPECTRUM_ANALYSER_HOP + hopCount;
+        int slot = frameSlot;
+
+        while (n >= 0)
+        {
+            // Hann window: (1 - cos(2 pi n / N)) / 2
+            int w = (32767 - spectrum_cos(n * scale)) >> 1;
+
+            window[slot * CONFIG_SPECTRUM_ANALYSER_SIZE + n] = (sample * w) >> 15;
+
+            n -= CONFIG_SPECTRUM_ANALYSER_HOP;
+            slot = (slot + 1) % SPECTRUM_ANALYSER_FRAMES;
+        }
+
+        if (++hopCount >= CONFIG_SPECTRUM_ANALYSER_HOP)
+        {
+            // The completed frame's slot is reused for the frame that starts next.
+            int completed = frameSlot;
+
+            hopCount = 0;
+            frameSlot = (frameSlot + 1) % SPECTRUM_ANALYSER_FRAMES;
+
+            if (status & SPECTRUM_ANALYSER_STATUS_BUSY)
+            {
+                skipped++;
+                continue;
+            }
+
+            loadFrame(completed);
+            status |= SPECTRUM_ANALYSER_STATUS_BUSY;
+            Event(id, SPECTRUM_ANALYSER_EVT_FRAME);
+        }
+    }
+
+    return DEVICE_OK;
+}
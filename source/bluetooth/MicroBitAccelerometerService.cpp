@@ -32,10 +32,11 @@ DEALINGS IN THE SOFTWARE.
 #if CONFIG_ENABLED(DEVICE_BLE)
 
 #include "MicroBitAccelerometerService.h"
+#include "Timer.h"
 
 
 const uint16_t MicroBitAccelerometerService::serviceUUID               = 0x0753;
-const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24 };
+const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24, 0xca4c, 0xca4d };
 
 
 /**
@@ -52,6 +53,11 @@ MicroBitAccelerometerService::MicroBitAccelerometerService( BLEDevice &_ble, cod
     accelerometerDataCharacteristicBuffer[1] = 0;
     accelerometerDataCharacteristicBuffer[2] = 0;
     accelerometerPeriodCharacteristicBuffer = 0;
+    accelerometerBatchConfigCharacteristicBuffer[0] = 0;
+    accelerometerBatchConfigCharacteristicBuffer[1] = MICROBIT_ACCELEROMETER_SERVICE_BATCH_LATENCY;
+    memset( accelerometerBatchCharacteristicBuffer, 0, sizeof( accelerometerBatchCharacteristicBuffer));
+    batchCount = 0;
+    batchPending = false;
 
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -68,11 +74,50 @@ MicroBitAccelerometerService::MicroBitAccelerometerService( BLEDevice &_ble, cod
                          sizeof(accelerometerPeriodCharacteristicBuffer), sizeof(accelerometerPeriodCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE);
 
+    CreateCharacteristic( mbbs_cIdxBATCH, charUUID[ mbbs_cIdxBATCH],
+                         accelerometerBatchCharacteristicBuffer,
+                         0, sizeof(accelerometerBatchCharacteristicBuffer),
+                         microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxBATCHCONFIG, charUUID[ mbbs_cIdxBATCHCONFIG],
+                         (uint8_t *)accelerometerBatchConfigCharacteristicBuffer,
+                         sizeof(accelerometerBatchConfigCharacteristicBuffer), sizeof(accelerometerBatchConfigCharacteristicBuffer),
+                         microbit_propREAD | microbit_propWRITE);
+
     if ( getConnected())
         listen( true);
 }
 
 
+/**
+  * Configure the batch characteristic.
+  * While the connected device has enabled its notifications, samples are collected and sent together,
+  * up to as many as fit into the negotiated MTU, instead of being notified one at a time.
+  *
+  * @param samples the number of samples to send in each notification, or 0 to fill the MTU.
+  * @param latency the longest time in milliseconds to hold a sample before sending the batch, from 1 to 60000.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the values are out of range.
+  */
+int MicroBitAccelerometerService::setBatch( int samples, int latency)
+{
+    if ( samples < 0 || samples > ( MICROBIT_ACCELEROMETER_S_BATCHSIZE - MICROBIT_ACCELEROMETER_S_HEADERSIZE) / MICROBIT_ACCELEROMETER_S_SAMPLESIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Sample times are 16 bit offsets from the start of the batch.
+    if ( latency < 1 || latency > 60000)
+        return DEVICE_INVALID_PARAMETER;
+
+    accelerometerBatchConfigCharacteristicBuffer[0] = samples;
+    accelerometerBatchConfigCharacteristicBuffer[1] = latency;
+
+    if ( getConnected())
+        setChrValue( mbbs_cIdxBATCHCONFIG, (const uint8_t *)accelerometerBatchConfigCharacteristicBuffer, sizeof(accelerometerBatchConfigCharacteristicBuffer));
+
+    return DEVICE_OK;
+}
+
+
 void MicroBitAccelerometerService::readXYZ()
 {
     accelerometerDataCharacteristicBuffer[0] = accelerometer.getX();
@@ -118,6 +163,8 @@ void MicroBitAccelerometerService::onConnect( const microbit_ble_evt_t *p_ble_ev
 void MicroBitAccelerometerService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
 {
     listen( false);
+    batchCount = 0;
+    batchPending = false;
 }
 
 
@@ -136,6 +183,87 @@ void MicroBitAccelerometerService::onDataWritten( const microbit_ble_evt_write_t
         accelerometerPeriodCharacteristicBuffer = accelerometer.getPeriod();
         setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&accelerometerPeriodCharacteristicBuffer, sizeof(accelerometerPeriodCharacteristicBuffer));
     }
+
+    if (params->handle == valueHandle( mbbs_cIdxBATCHCONFIG) && params->len >= sizeof(accelerometerBatchConfigCharacteristicBuffer))
+    {
+        uint16_t config[2];
+        memcpy(config, params->data, sizeof(config));
+
+        // Keep the previous configuration if the new one is out of range, and store it for the next read.
+        setBatch( config[0], config[1]);
+        setChrValue( mbbs_cIdxBATCHCONFIG, (const uint8_t *)accelerometerBatchConfigCharacteristicBuffer, sizeof(accelerometerBatchConfigCharacteristicBuffer));
+    }
+}
+
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitAccelerometerService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( batchPending)
+        batchSend();
+}
+
+
+/**
+  * Add the latest sample to the batch, and send the batch if it is full or old enough.
+  */
+void MicroBitAccelerometerService::batchSample()
+{
+    // If the last batch is still waiting, this sample is lost.
+    if ( batchPending && !batchSend())
+        return;
+
+    uint32_t now = (uint32_t) system_timer_current_time();
+    uint32_t start;
+
+    if ( batchCount == 0)
+    {
+        memcpy( accelerometerBatchCharacteristicBuffer, &now, sizeof( now));
+        start = now;
+    }
+    else
+    {
+        memcpy( &start, accelerometerBatchCharacteristicBuffer, sizeof( start));
+    }
+
+    // Each sample holds its time in milliseconds since the start of the batch, then X, Y and Z in milli-g.
+    uint16_t sample[4];
+    sample[0] = now - start;
+    memcpy( &sample[1], accelerometerDataCharacteristicBuffer, sizeof( accelerometerDataCharacteristicBuffer));
+    memcpy( accelerometerBatchCharacteristicBuffer + MICROBIT_ACCELEROMETER_S_HEADERSIZE + batchCount * MICROBIT_ACCELEROMETER_S_SAMPLESIZE, sample, sizeof( sample));
+    batchCount++;
+
+    // Fill the negotiated MTU, unless asked for fewer samples.
+    int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+    if ( attrSize > MICROBIT_ACCELEROMETER_S_BATCHSIZE)
+        attrSize = MICROBIT_ACCELEROMETER_S_BATCHSIZE;
+
+    int samples = ( attrSize - MICROBIT_ACCELEROMETER_S_HEADERSIZE) / MICROBIT_ACCELEROMETER_S_SAMPLESIZE;
+    if ( accelerometerBatchConfigCharacteristicBuffer[0] != 0 && accelerometerBatchConfigCharacteristicBuffer[0] < samples)
+        samples = accelerometerBatchConfigCharacteristicBuffer[0];
+
+    if ( batchCount >= samples || now - start >= accelerometerBatchConfigCharacteristicBuffer[1])
+        batchSend();
+}
+
+
+/**
+  * Send the batch, if there is one.
+  * @return true if the batch was sent or is empty, false if the SoftDevice's queue is full.
+  */
+bool MicroBitAccelerometerService::batchSend()
+{
+    if ( batchCount == 0)
+        return true;
+
+    batchPending = !notifyChrValue( mbbs_cIdxBATCH, accelerometerBatchCharacteristicBuffer,
+                                    MICROBIT_ACCELEROMETER_S_HEADERSIZE + batchCount * MICROBIT_ACCELEROMETER_S_SAMPLESIZE);
+    if ( !batchPending)
+        batchCount = 0;
+
+    return !batchPending;
 }
 
 
@@ -147,7 +275,12 @@ void MicroBitAccelerometerService::accelerometerUpdate(MicroBitEvent)
     if ( getConnected())
     {
         readXYZ();
-        notifyChrValue( mbbs_cIdxDATA, (uint8_t *)accelerometerDataCharacteristicBuffer, sizeof(accelerometerDataCharacteristicBuffer));
+
+        // Batches replace single samples while their notifications are enabled.
+        if ( notifyChrValueEnabled( mbbs_cIdxBATCH))
+            batchSample();
+        else
+            queueChrValue( mbbs_cIdxDATA, (uint8_t *)accelerometerDataCharacteristicBuffer, sizeof(accelerometerDataCharacteristicBuffer));
     }
 }
 
@@ -129,6 +129,25 @@ bool MicroBitBLEChar::indicateChrValue( microbit_gaphandle_t connection, const u
     return false;
 }
                                     
+
+
+uint32_t MicroBitBLEChar::notifyCurrentValue( microbit_gaphandle_t connection, uint16_t length)
+{
+    if ( connection == BLE_CONN_HANDLE_INVALID || !cccdNotify())
+        return NRF_ERROR_INVALID_STATE;
+
+    MICROBIT_DEBUG_DMESGF( "MicroBitBLEChar::notifyCurrentValue %d", (int) handles.value);
+
+    ble_gatts_hvx_params_t hvx_params;
+    hvx_params.handle = handles.value;
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.offset = 0;
+    hvx_params.p_len  = &length;
+    hvx_params.p_data = NULL;
+
+    return MICROBIT_BLE_ECHK( sd_ble_gatts_hvx( connection, &hvx_params));
+}
+
                                                           
 bool MicroBitBLEChar::writeChrValue( microbit_gaphandle_t connection, const uint8_t *data, uint16_t length)
 {
@@ -67,8 +67,12 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFiber.h"
 #include "MicroBitSystemTimer.h"
 #include "MicroBitDevice.h"
+#include "MicroBitEntropy.h"
 #include "MicroBitEventService.h"
 #include "MicroBitPartialFlashingService.h"
+#include "MicroBitPowerProfiler.h"
+#include "MicroBitTrace.h"
+#include "CodalHeapAllocator.h"
 
 #include "CodalDmesg.h"
 #include "nrf_log_backend_dmesg.h"
@@ -128,12 +132,30 @@ MicroBitBLEManager *MicroBitBLEManager::manager = NULL; // Singleton reference t
 #define microbit_ble_OBSERVER_PRIO           3
 #define microbit_ble_CONN_CFG_TAG            1
 
+// Advertising phases, c.f. microbit_ble_startAdvertising().
+#define MICROBIT_BLE_ADV_PHASE_FAST          0
+#define MICROBIT_BLE_ADV_PHASE_SLOW          1
+#define MICROBIT_BLE_ADV_PHASE_DIRECTED      2
+
 
 static int                  m_power         = MICROBIT_BLE_DEFAULT_TX_POWER;
 static uint8_t              m_adv_handle    = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
 static uint8_t              m_enc_advdata[ BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static ble_gap_adv_params_t m_adv_params;                             // As last configured, with the interval and duration requested.
+static ble_gap_adv_data_t   m_adv_data;                               // Refers to m_enc_advdata.
+static int                  m_adv_phase     = MICROBIT_BLE_ADV_PHASE_FAST;
+static ble_gap_addr_t       m_peer_addr;                              // Identity of the last bonded central, for directed advertising.
+static bool                 m_peer_addr_valid = false;
 
 static volatile int         m_pending;
+static uint16_t             m_att_mtu       = NRF_SDH_BLE_GATT_MAX_MTU_SIZE;
+
+static ble_gap_conn_params_t m_conn_params  = { 8, 16, 0, 400 };     // Requested: 10-20ms interval, no slave latency, 4s timeout.
+static ble_gap_conn_params_t m_conn_current;                          // In use, or all zero while not connected.
+static bool                 m_conn_params_set = false;                // true once the requested parameters have been changed.
+static uint8_t              m_phys          = BLE_GAP_PHY_AUTO;       // Requested PHYs.
+static uint8_t              m_phy_current   = 0;                      // In use, or zero while not connected.
+static MicroBitBLEStatistics m_stats;                                 // Counters, c.f. getStatistics().
 
 NRF_BLE_GATT_DEF( m_gatt);
 
@@ -142,6 +164,7 @@ static void const_ascii_to_utf8(ble_srv_utf8_str_t * p_utf8, const char * p_asci
 
 static void microbit_ble_for_each_connected_disconnect( uint16_t conn_handle, void *p_context);
 static void microbit_ble_for_each_connected_tx_power_set( uint16_t conn_handle, void *p_context);
+static void microbit_ble_for_each_connected_conn_params_set( uint16_t conn_handle, void *p_context);
 
 static void bleConnectionCallback( microbit_gaphandle_t handle);
 static void passkeyDisplayCallback( microbit_gaphandle_t handle, ManagedString passKey);
@@ -153,6 +176,7 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
 static void microbit_dfu_init(void);
 
 static void microbit_ble_configureAdvertising( bool connectable, bool discoverable, bool whitelist, uint16_t interval_ms, int timeout_seconds);
+static bool microbit_ble_startAdvertising( int phase);
 
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL) || CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_UID)
 static void microbit_ble_configureAdvertising( bool connectable, bool discoverable, bool whitelist, uint16_t interval_ms, int timeout_seconds,
@@ -260,7 +284,11 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
     // Start the BLE stack.
     uint32_t ram_start = 0;
     MICROBIT_BLE_ECHK( nrf_pwr_mgmt_init());
+
+    // The SoftDevice reserves the RNG, so hand it over. Entropy is then drawn from the SoftDevice instead.
+    MicroBitEntropy::stop();
     MICROBIT_BLE_ECHK( nrf_sdh_enable_request());
+    MicroBitEntropy::start();
     MICROBIT_BLE_ECHK( nrf_sdh_ble_default_cfg_set( microbit_ble_CONN_CFG_TAG, &ram_start));
     
     // set fixed gap name
@@ -280,7 +308,44 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
     ble_cfg.gap_cfg.device_name_cfg.max_len     = gapName.length();
     MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_GAP_CFG_DEVICE_NAME, &ble_cfg, ram_start));
 
-    MICROBIT_BLE_ECHK( nrf_sdh_ble_enable(&ram_start));
+    // Let several notifications be queued for each connection event. As with the larger ATT MTU requested by
+    // nrf_sdh_ble_default_cfg_set(), the SoftDevice keeps its default if the RAM reserved for it is too small.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                               = microbit_ble_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size    = MICROBIT_BLE_HVN_TX_QUEUE_SIZE;
+    if ( MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_CONN_CFG_GATTS, &ble_cfg, ram_start)) != NRF_SUCCESS)
+        DMESG( "BLE: SoftDevice RAM too small for %d queued notifications. Raise RAM ORIGIN in the linker script", (int) MICROBIT_BLE_HVN_TX_QUEUE_SIZE);
+
+    // Determine the largest MTU the SoftDevice can accept, so we don't offer more during MTU negotiation.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                               = microbit_ble_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatt_conn_cfg.att_mtu               = NRF_SDH_BLE_GATT_MAX_MTU_SIZE;
+    if ( MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_CONN_CFG_GATT, &ble_cfg, ram_start)) != NRF_SUCCESS)
+    {
+        DMESG( "BLE: SoftDevice RAM too small for ATT MTU %d, using %d. Raise RAM ORIGIN in the linker script", (int) NRF_SDH_BLE_GATT_MAX_MTU_SIZE, (int) BLE_GATT_ATT_MTU_DEFAULT);
+        m_att_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+    }
+
+    // Size the attribute table for the services this program registers.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.gatts_cfg.attr_tab_size.attr_tab_size               = MICROBIT_BLE_GATTS_ATTR_TAB_SIZE;
+    MICROBIT_BLE_ECHK( sd_ble_cfg_set( BLE_GATTS_CFG_ATTR_TAB_SIZE, &ble_cfg, ram_start));
+
+    // On failure, ram_start is the RAM ORIGIN this configuration needs.
+    if ( MICROBIT_BLE_ECHK( nrf_sdh_ble_enable(&ram_start)) != NRF_SUCCESS)
+        DMESG( "BLE: SoftDevice needs RAM ORIGIN %x or above", (unsigned int) ram_start);
+
+    // ram_start is now the lowest address the SoftDevice needs for this configuration.
+    // Anything between that and the RAM the linker reserved for it can be used as heap.
+    uint32_t app_ram_start = 0;
+    nrf_sdh_ble_app_ram_start_get( &app_ram_start);
+    ram_start = (ram_start + 7) & ~7;
+    if ( ram_start < app_ram_start)
+    {
+        MICROBIT_DEBUG_DMESG( "SoftDevice RAM unused: %x - %x", (unsigned int) ram_start, (unsigned int) app_ram_start);
+        device_create_heap( ram_start, app_ram_start);
+    }
+
     NRF_SDH_BLE_OBSERVER( microbit_ble_observer, microbit_ble_OBSERVER_PRIO, microbit_ble_evt_handler, NULL);
 
     MICROBIT_BLE_ECHK( sd_ble_gap_appearance_set( BLE_APPEARANCE_UNKNOWN));
@@ -376,16 +441,14 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 
     // Set up GAP
     // Configure for high speed mode where possible.
-    ble_gap_conn_params_t   gap_conn_params;
-    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-    gap_conn_params.min_conn_interval = 8;      // 10 ms
-    gap_conn_params.max_conn_interval = 16;     // 20 ms
-    gap_conn_params.slave_latency     = 0;
-    gap_conn_params.conn_sup_timeout  = 400;    // 4s
-    MICROBIT_BLE_ECHK( sd_ble_gap_ppcp_set( &gap_conn_params));
+    // Our preferred connection parameters, unless changed by setConnectionParameters().
+    MICROBIT_BLE_ECHK( sd_ble_gap_ppcp_set( &m_conn_params));
     
     // Set up GATT
     MICROBIT_BLE_ECHK( nrf_ble_gatt_init( &m_gatt, NULL));
+
+    // nrf_ble_gatt negotiates the ATT MTU, and a link layer packet size to match (Data Length Extension), on each connection.
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_att_mtu_periph_set( &m_gatt, m_att_mtu));
         
     if ( enableBonding)
     {
@@ -469,12 +532,20 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 #if CONFIG_ENABLED(MICROBIT_BLE_EVENT_SERVICE)
     MICROBIT_DEBUG_DMESG( "EVENT_SERVICE");
     new MicroBitEventService( *this, messageBus);
+#endif
+
+    // Only signal Service Changed at boot if the table differs from last time, so that bonded
+    // clients can keep using the attributes they have cached rather than discovering them again.
+    if ( gattTableChanged())
+        servicesChanged();
+
+#if CONFIG_ENABLED(MICROBIT_BLE_ADVERTISING_WAKE_ON_BUTTON)
+    messageBus.listen( MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_DOWN, this, &MicroBitBLEManager::onButton, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    messageBus.listen( MICROBIT_ID_BUTTON_B, MICROBIT_BUTTON_EVT_DOWN, this, &MicroBitBLEManager::onButton, MESSAGE_BUS_LISTENER_IMMEDIATE);
 #else
     (void)messageBus;
 #endif
 
-    servicesChanged();
-    
     // Setup advertising.
     microbit_ble_configureAdvertising( connectable, discoverable, whitelist,
                                        MICROBIT_BLE_ADVERTISING_INTERVAL, MICROBIT_BLE_ADVERTISING_TIMEOUT);
@@ -484,7 +555,7 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 
     ble_conn_params_init_t cp_init;
     memset(&cp_init, 0, sizeof(cp_init));
-    cp_init.p_conn_params                  = &gap_conn_params;
+    cp_init.p_conn_params                  = &m_conn_params;
     cp_init.first_conn_params_update_delay = APP_TIMER_TICKS(5000);     // 5 seconds
     cp_init.next_conn_params_update_delay  = APP_TIMER_TICKS(30000);    // 30 seconds
     cp_init.max_conn_params_update_count   = 3;
@@ -502,7 +573,7 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
 #endif
         advertise();
 
-    this->status |= DEVICE_COMPONENT_RUNNING;
+    component_status_set(this, DEVICE_COMPONENT_RUNNING);
 }
 
 
@@ -596,8 +667,8 @@ bool MicroBitBLEManager::pairingComplete( int event)
             this->pairingStatus = MICROBIT_BLE_PAIR_COMPLETE | MICROBIT_BLE_PAIR_SUCCESSFUL;
             if ( MICROBIT_BLE_DISCONNECT_AFTER_PAIRING_DELAY > 0)
             {
-                this->status |= MICROBIT_BLE_STATUS_DISCONNECT;
-                fiber_add_idle_component(this);
+                component_status_set(this, MICROBIT_BLE_STATUS_DISCONNECT);
+                fiber_wake_idle_component(this);
             }
             break;
                 
@@ -630,7 +701,7 @@ bool MicroBitBLEManager::pairingComplete( int event)
 }
 
 /**
- * Periodic callback in thread context.
+ * Callback in thread context, made while a disconnect, services changed or shutdown request is outstanding.
  * We use this here purely to safely issue a disconnect operation after a pairing operation is complete.
  */
 void MicroBitBLEManager::idleCallback()
@@ -642,27 +713,63 @@ void MicroBitBLEManager::idleCallback()
             MICROBIT_DEBUG_DMESG( "%d:MicroBitBLEManager::idleCallback", (int)system_timer_current_time());
             MICROBIT_DEBUG_DMESG( "MICROBIT_BLE_STATUS_DISCONNECT");
             ble_conn_state_for_each_connected( microbit_ble_for_each_connected_disconnect, NULL);
-            this->status &= ~MICROBIT_BLE_STATUS_DISCONNECT;
+            component_status_clear(this, MICROBIT_BLE_STATUS_DISCONNECT);
         }
     }
 
+    if ( this->status & MICROBIT_BLE_STATUS_SERVICES_CHANGED)
+    {
+        component_status_clear(this, MICROBIT_BLE_STATUS_SERVICES_CHANGED);
+        servicesChanged();
+    }
+
     if ( this->status & MICROBIT_BLE_STATUS_SHUTDOWN)
     {
         //MICROBIT_DEBUG_DMESG( "MicroBitBLEManager::idleCallback");
         //MICROBIT_DEBUG_DMESG( "MICROBIT_BLE_STATUS_SHUTDOWN");
         nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE);
     }
+
+    // Stop being called once there is nothing left to do. Each of these requests wakes us again when it is made.
+    fiber_idle_component_done( this, MICROBIT_BLE_STATUS_DISCONNECT | MICROBIT_BLE_STATUS_SERVICES_CHANGED | MICROBIT_BLE_STATUS_SHUTDOWN);
 }
 
 
 /**
  * When called, the micro:bit will begin advertising for a predefined period,
  * MICROBIT_BLE_ADVERTISING_TIMEOUT seconds to bonded devices.
+ * Advertising backs off to MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL after MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT seconds.
  */
 void MicroBitBLEManager::advertise()
 {
     MICROBIT_DEBUG_DMESG( "advertise");
-    MICROBIT_BLE_ECHK( sd_ble_gap_adv_start( m_adv_handle, microbit_ble_CONN_CFG_TAG));
+    microbit_ble_startAdvertising( MICROBIT_BLE_ADV_PHASE_FAST);
+}
+
+
+/**
+ * Return to fast advertising, at the interval advertising was configured with, for another
+ * MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT seconds. Does nothing unless advertising has backed off
+ * to MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL.
+ */
+void MicroBitBLEManager::wakeAdvertising()
+{
+    if ( m_adv_phase != MICROBIT_BLE_ADV_PHASE_SLOW || ble_conn_state_peripheral_conn_count() > 0)
+        return;
+
+    if ( sd_ble_gap_adv_stop( m_adv_handle) == NRF_SUCCESS)
+        microbit_ble_startAdvertising( MICROBIT_BLE_ADV_PHASE_FAST);
+}
+
+
+/**
+ * Wake advertising from its slow interval when a button is pressed.
+ *
+ * @param e The button event.
+ */
+void MicroBitBLEManager::onButton(MicroBitEvent)
+{
+    wakeAdvertising();
 }
 
 
@@ -673,6 +780,7 @@ void MicroBitBLEManager::stopAdvertising()
 {
     MICROBIT_DEBUG_DMESG( "stopAdvertising");
     MICROBIT_BLE_ECHK( sd_ble_gap_adv_stop( m_adv_handle));
+    MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, false);
 }
 
 
@@ -684,12 +792,209 @@ void MicroBitBLEManager::onDisconnect()
     MICROBIT_DEBUG_DMESG( "onDisconnect");
         
     MicroBitEvent(MICROBIT_ID_BLE, MICROBIT_BLE_EVT_DISCONNECTED);
+
+    if ( ble_conn_state_peripheral_conn_count() == 0)
+        MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_CONNECTED, false);
     
     if ( advertiseOnDisconnect && ble_conn_state_peripheral_conn_count() == 0)
-        advertise();
+    {
+        // Give the central we were bonded with the chance to reconnect straight away.
+        if ( !CONFIG_ENABLED(MICROBIT_BLE_DIRECTED_ADVERTISING) || !microbit_ble_startAdvertising( MICROBIT_BLE_ADV_PHASE_DIRECTED))
+            advertise();
+    }
+}
+
+
+
+/**
+ * Request the connection parameters to use, now and for future connections.
+ * The central decides the parameters used. MICROBIT_BLE_EVT_CONNECTION_UPDATED is raised when they change.
+ *
+ * @param minInterval the shortest acceptable connection interval, in microseconds, from 7500 to 4000000.
+ * @param maxInterval the longest acceptable connection interval, in microseconds, from minInterval to 4000000.
+ * @param slaveLatency the number of connection events we may skip when we have nothing to send, from 0 to 499.
+ * @param timeout the supervision timeout, in milliseconds, from 100 to 32000. This must exceed twice the
+ *        longest interval, multiplied by one more than the slave latency.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the parameters are out of range.
+ */
+int MicroBitBLEManager::setConnectionParameters(int minInterval, int maxInterval, int slaveLatency, int timeout)
+{
+    // Intervals are in units of 1.25ms, and the timeout in units of 10ms.
+    int minUnits = ( minInterval + 1249) / 1250;
+    int maxUnits = maxInterval / 1250;
+
+    if ( minUnits < BLE_GAP_CP_MIN_CONN_INTVL_MIN || maxUnits > BLE_GAP_CP_MAX_CONN_INTVL_MAX || minUnits > maxUnits)
+        return DEVICE_INVALID_PARAMETER;
+
+    if ( slaveLatency < 0 || slaveLatency > BLE_GAP_CP_SLAVE_LATENCY_MAX)
+        return DEVICE_INVALID_PARAMETER;
+
+    if ( timeout < 100 || timeout > 32000 || (uint64_t) timeout * 1000 <= (uint64_t) 2 * maxUnits * 1250 * ( slaveLatency + 1))
+        return DEVICE_INVALID_PARAMETER;
+
+    m_conn_params.min_conn_interval = minUnits;
+    m_conn_params.max_conn_interval = maxUnits;
+    m_conn_params.slave_latency     = slaveLatency;
+    m_conn_params.conn_sup_timeout  = timeout / 10;
+    m_conn_params_set = true;
+
+    MICROBIT_BLE_ECHK( sd_ble_gap_ppcp_set( &m_conn_params));
+    ble_conn_state_for_each_connected( microbit_ble_for_each_connected_conn_params_set, NULL);
+
+    return DEVICE_OK;
 }
 
+/**
+ * Request connection parameters, and a PHY, suited to a style of use.
+ *
+ * @param profile one of MICROBIT_BLE_CONNECTION_PROFILE_DEFAULT, MICROBIT_BLE_CONNECTION_PROFILE_LOW_LATENCY,
+ *        MICROBIT_BLE_CONNECTION_PROFILE_BULK or MICROBIT_BLE_CONNECTION_PROFILE_LOW_POWER.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the profile is unknown.
+ */
+int MicroBitBLEManager::setConnectionProfile(int profile)
+{
+    switch ( profile)
+    {
+        case MICROBIT_BLE_CONNECTION_PROFILE_DEFAULT:
+            setPHY( MICROBIT_BLE_PHY_AUTO);
+            return setConnectionParameters( 10000, 20000, 0, 4000);
+
+        case MICROBIT_BLE_CONNECTION_PROFILE_LOW_LATENCY:
+            setPHY( MICROBIT_BLE_PHY_AUTO);
+            return setConnectionParameters( 7500, 15000, 0, 4000);
+
+        case MICROBIT_BLE_CONNECTION_PROFILE_BULK:
+            // If the central can't use the 2M PHY, we simply stay on 1M.
+            setPHY( MICROBIT_BLE_PHY_2M);
+            return setConnectionParameters( 15000, 30000, 0, 4000);
+
+        case MICROBIT_BLE_CONNECTION_PROFILE_LOW_POWER:
+            setPHY( MICROBIT_BLE_PHY_1M);
+            return setConnectionParameters( 100000, 200000, 4, 6000);
+    }
 
+    return DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Request the physical layer used for connections, now and in response to future requests from the central.
+ * MICROBIT_BLE_EVT_PHY_UPDATED is raised when it changes.
+ *
+ * @param phys MICROBIT_BLE_PHY_AUTO, or a combination of MICROBIT_BLE_PHY_1M, MICROBIT_BLE_PHY_2M and MICROBIT_BLE_PHY_CODED.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the value is out of range,
+ *         or DEVICE_NOT_SUPPORTED if the SoftDevice does not support the PHY requested.
+ */
+int MicroBitBLEManager::setPHY(int phys)
+{
+    if ( phys & ~( MICROBIT_BLE_PHY_1M | MICROBIT_BLE_PHY_2M | MICROBIT_BLE_PHY_CODED))
+        return DEVICE_INVALID_PARAMETER;
+
+    m_phys = phys;
+
+    ble_gap_phys_t const gap_phys = { m_phys, m_phys };
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+
+    for ( uint32_t i = 0; i < list.len; i++)
+        if ( MICROBIT_BLE_ECHK( sd_ble_gap_phy_update( list.conn_handles[i], &gap_phys)) == NRF_ERROR_NOT_SUPPORTED)
+            return DEVICE_NOT_SUPPORTED;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determine the connection interval in use.
+ * @return the interval in microseconds, or 0 if not connected
+ */
+int MicroBitBLEManager::getConnectionInterval()
+{
+    return m_conn_current.max_conn_interval * 1250;
+}
+
+/**
+ * Determine the slave latency in use.
+ * @return the number of connection events we may skip, or 0 if not connected
+ */
+int MicroBitBLEManager::getSlaveLatency()
+{
+    return m_conn_current.slave_latency;
+}
+
+/**
+ * Determine the supervision timeout in use.
+ * @return the timeout in milliseconds, or 0 if not connected
+ */
+int MicroBitBLEManager::getSupervisionTimeout()
+{
+    return m_conn_current.conn_sup_timeout * 10;
+}
+
+/**
+ * Determine the physical layer in use.
+ * @return MICROBIT_BLE_PHY_1M, MICROBIT_BLE_PHY_2M or MICROBIT_BLE_PHY_CODED, or MICROBIT_BLE_PHY_AUTO if not connected
+ */
+int MicroBitBLEManager::getPHY()
+{
+    return m_phy_current;
+}
+
+/**
+ * Determine the ATT MTU negotiated with the connected device.
+ * A notification or indication can carry up to getMTU() - 3 bytes.
+ * @return the effective MTU, or 23 (the minimum) if not connected
+ */
+int MicroBitBLEManager::getMTU()
+{
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+    return list.len ? nrf_ble_gatt_eff_mtu_get( &m_gatt, list.conn_handles[0]) : BLE_GATT_ATT_MTU_DEFAULT;
+}
+
+/**
+ * Retrieve the link statistics, with the current connection's RSSI, MTU, PHY and parameters.
+ * @return the statistics.
+ */
+MicroBitBLEStatistics MicroBitBLEManager::getStatistics()
+{
+    MicroBitBLEStatistics stats = m_stats;
+
+    stats.rssi = 0;
+    stats.phy = getPHY();
+    stats.mtu = getConnected() ? getMTU() : 0;
+    stats.slaveLatency = getSlaveLatency();
+    stats.interval = getConnectionInterval();
+
+    // RSSI measurement is started for each connection.
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+    if ( list.len)
+    {
+        int8_t  rssi;
+        uint8_t channel;
+        if ( sd_ble_gap_rssi_get( list.conn_handles[0], &rssi, &channel) == NRF_SUCCESS)
+            stats.rssi = rssi;
+    }
+
+    return stats;
+}
+
+/**
+ * Restart the link statistics' counters from zero.
+ */
+void MicroBitBLEManager::resetStatistics()
+{
+    uint8_t reason = m_stats.disconnectReason;
+    memset( &m_stats, 0, sizeof( m_stats));
+    m_stats.disconnectReason = reason;
+}
+
+/**
+ * Count a notification refused for lack of room, c.f. MicroBitBLEService::notifyChrValue().
+ */
+void MicroBitBLEManager::notificationRejected()
+{
+    m_stats.txRejected++;
+}
 
 /**
  * Determine if Bluetooth is connected
@@ -1056,6 +1361,7 @@ bool MicroBitBLEManager::prepareForShutdown()
     bool shutdownOK = true;
         
     sd_ble_gap_adv_stop( m_adv_handle);
+    MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, false);
     setAdvertiseOnDisconnect( false);
 
     if ( ble_conn_state_conn_count()) // TODO: anything else we need to wait for?
@@ -1095,6 +1401,7 @@ int MicroBitBLEManager::setSleep(bool doSleep)
         if (NVIC_GetEnableIRQ(POWER_CLOCK_IRQn))    wasEnabled |= 16;
         if (NVIC_GetEnableIRQ(RTC0_IRQn))           wasEnabled |= 32;
         if (NRF_SUCCESS == MICROBIT_BLE_ECHK( sd_ble_gap_adv_stop( m_adv_handle))) wasEnabled |= 64;
+        MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, false);
 
         if (wasEnabled & 1)    nrf_sdh_suspend();
         if (wasEnabled & 2)    NVIC_DisableIRQ(RTC1_IRQn);
@@ -1119,6 +1426,73 @@ int MicroBitBLEManager::setSleep(bool doSleep)
 }
 
 
+/**
+ * Record that a service has been added to the GATT table.
+ *
+ * Services created after init(), typically the first time a program uses one, change the
+ * attribute table a bonded client may have cached. Service Changed is then signalled from the
+ * idle callback, rather than from within the constructor of the service being added.
+ */
+void MicroBitBLEManager::serviceAdded()
+{
+    if ( !(this->status & DEVICE_COMPONENT_RUNNING))
+        return;
+
+    component_status_set(this, MICROBIT_BLE_STATUS_SERVICES_CHANGED);
+    fiber_wake_idle_component(this);
+}
+
+/**
+ * Determine whether the GATT table differs from the one built at the last boot, by comparing
+ * a hash of its handles and UUIDs with the one held in storage. The new hash is stored when it changes.
+ *
+ * @return true if the table has changed, or no previous hash is available.
+ */
+bool MicroBitBLEManager::gattTableChanged()
+{
+    // FNV-1a, over each attribute's handle, UUID (in full, for vendor specific UUIDs) and permissions.
+    uint32_t            hash = 2166136261u;
+    ble_uuid_t          uuid;
+    ble_gatts_attr_md_t md;
+    uint8_t             bytes[ 16 + 5];
+    uint8_t             len;
+
+    for ( uint16_t handle = BLE_GATT_HANDLE_START; sd_ble_gatts_attr_get( handle, &uuid, &md) == NRF_SUCCESS; handle++)
+    {
+        len = 0;
+        sd_ble_uuid_encode( &uuid, &len, bytes);
+        bytes[ len++] = handle & 0xFF;
+        bytes[ len++] = handle >> 8;
+        bytes[ len++] = ( md.read_perm.sm << 4) | md.read_perm.lv;
+        bytes[ len++] = ( md.write_perm.sm << 4) | md.write_perm.lv;
+        bytes[ len++] = md.vloc;
+
+        for ( int i = 0; i < len; i++)
+            hash = ( hash ^ bytes[i]) * 16777619u;
+    }
+
+    MICROBIT_DEBUG_DMESG( "gattTableChanged hash %x", (unsigned int) hash);
+
+    if ( storage == NULL)
+        return true;
+
+    bool changed = true;
+    KeyValuePair *stored = storage->get("bleGattHash");
+
+    if ( stored)
+    {
+        uint32_t previous;
+        memcpy( &previous, stored->value, sizeof( previous));
+        changed = previous != hash;
+        delete stored;
+    }
+
+    if ( changed)
+        storage->put("bleGattHash", (uint8_t *) &hash, sizeof( hash));
+
+    return changed;
+}
+
 /**
 * Ensure service changed indication pending for all peers
 */
@@ -1211,7 +1585,81 @@ static void microbit_ble_configureAdvertising( bool connectable, bool discoverab
     gap_adv_data.adv_data.len       = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
     MICROBIT_BLE_ECHK( ble_advdata_encode( p_advdata, gap_adv_data.adv_data.p_data, &gap_adv_data.adv_data.len));
     NRF_LOG_HEXDUMP_INFO( gap_adv_data.adv_data.p_data, gap_adv_data.adv_data.len);
-    MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, &gap_adv_params));
+
+    // Keep these, so that each advertising phase can be configured from them.
+    m_adv_params = gap_adv_params;
+    m_adv_data   = gap_adv_data;
+    m_adv_phase  = MICROBIT_BLE_ADV_PHASE_FAST;
+    MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &m_adv_data, &m_adv_params));
+}
+
+
+/**
+ * Function to start advertising, reconfiguring the advertising set for the given phase.
+ *
+ * Fast advertising uses the interval advertising was configured with. In application mode it lasts
+ * MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT seconds, then slow advertising at MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL
+ * continues for the rest of the configured timeout. Directed advertising to the last bonded central lasts 1.28s,
+ * and is followed by fast advertising. Each phase is started from BLE_GAP_EVT_ADV_SET_TERMINATED by the one before.
+ *
+ * @param phase MICROBIT_BLE_ADV_PHASE_FAST, MICROBIT_BLE_ADV_PHASE_SLOW or MICROBIT_BLE_ADV_PHASE_DIRECTED.
+ *
+ * @return true if advertising started.
+ */
+static bool microbit_ble_startAdvertising( int phase)
+{
+    ble_gap_adv_params_t    gap_adv_params  = m_adv_params;
+    ble_gap_adv_data_t      gap_adv_data    = m_adv_data;
+    uint16_t                fastDuration    = MICROBIT_BLE_ADVERTISING_FAST_TIMEOUT * 100;             // 10 ms units
+    uint32_t                slowInterval    = ( 1000 * MICROBIT_BLE_ADVERTISING_SLOW_INTERVAL) / 625;  // 625 us units
+    bool                    application     = !MicroBitBLEManager::manager || MicroBitBLEManager::manager->getCurrentMode() == MICROBIT_MODE_APPLICATION;
+
+    if ( slowInterval > BLE_GAP_ADV_INTERVAL_MAX) slowInterval = BLE_GAP_ADV_INTERVAL_MAX;
+
+    // Only back off if there's time left to do so, and it would make a difference.
+    bool backoff = application && fastDuration && slowInterval > m_adv_params.interval &&
+                   ( m_adv_params.duration == 0 || m_adv_params.duration > fastDuration);
+
+    switch ( phase)
+    {
+        case MICROBIT_BLE_ADV_PHASE_DIRECTED:
+            if ( !application || !m_peer_addr_valid || m_adv_params.properties.type != BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED)
+                return false;
+
+            gap_adv_params.properties.type  = BLE_GAP_ADV_TYPE_CONNECTABLE_NONSCANNABLE_DIRECTED_HIGH_DUTY_CYCLE;
+            gap_adv_params.p_peer_addr      = &m_peer_addr;
+            gap_adv_params.interval         = 0;                                    // Not used at high duty cycle.
+            gap_adv_params.duration         = BLE_GAP_ADV_TIMEOUT_HIGH_DUTY_MAX;
+            gap_adv_params.filter_policy    = BLE_GAP_ADV_FP_ANY;
+            memset( &gap_adv_data, 0, sizeof( gap_adv_data));                       // Directed advertising carries no data.
+            break;
+
+        case MICROBIT_BLE_ADV_PHASE_SLOW:
+            if ( !backoff)
+                return false;
+
+            gap_adv_params.interval         = slowInterval;
+            gap_adv_params.duration         = m_adv_params.duration ? m_adv_params.duration - fastDuration : 0;
+            break;
+
+        default:
+            if ( backoff)
+                gap_adv_params.duration     = fastDuration;
+            break;
+    }
+
+    MICROBIT_DEBUG_DMESG( "startAdvertising phase %d, interval %d, duration %d", phase, (int) gap_adv_params.interval, (int) gap_adv_params.duration);
+
+    if ( MICROBIT_BLE_ECHK( sd_ble_gap_adv_set_configure( &m_adv_handle, &gap_adv_data, &gap_adv_params)) != NRF_SUCCESS)
+        return false;
+
+    m_adv_phase = phase;
+
+    if ( MICROBIT_BLE_ECHK( sd_ble_gap_adv_start( m_adv_handle, microbit_ble_CONN_CFG_TAG)) != NRF_SUCCESS)
+        return false;
+
+    MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, true);
+    return true;
 }
 
 
@@ -1294,12 +1742,20 @@ static void passkeyDisplayCallback( microbit_gaphandle_t handle, ManagedString p
  */
 static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 {
+    MICROBIT_TRACE_SCOPE(MICROBIT_TRACE_BLE_EVENT);
+
     //MICROBIT_DEBUG_DMESG( "%d:microbit_ble_evt_handler %x %d", (int)system_timer_current_time(), (unsigned int) p_ble_evt->header.evt_id);
     
     switch (p_ble_evt->header.evt_id)
     {
         case BLE_GAP_EVT_DISCONNECTED:
         {
+            memset( &m_conn_current, 0, sizeof( m_conn_current));
+            m_phy_current = 0;
+            m_stats.disconnections++;
+            m_stats.disconnectReason = p_ble_evt->evt.gap_evt.params.disconnected.reason;
+            if ( m_stats.disconnectReason == BLE_HCI_CONNECTION_TIMEOUT)
+                m_stats.supervisionTimeouts++;
             if ( MicroBitBLEManager::manager)
                 MicroBitBLEManager::manager->onDisconnect();
             break;
@@ -1307,15 +1763,73 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
         case BLE_GAP_EVT_CONNECTED:
         {
             MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONNECTED %d", ble_conn_state_conn_count());
+            // Connectable advertising stops when a connection is made.
+            MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, false);
+            MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_CONNECTED, true);
+            m_conn_current = p_ble_evt->evt.gap_evt.params.connected.conn_params;
+            m_phy_current = BLE_GAP_PHY_1MBPS;
+            m_stats.connections++;
+
+            // Measure the signal strength, for getStatistics(), without raising events for it.
+            MICROBIT_BLE_ECHK( sd_ble_gap_rssi_start( p_ble_evt->evt.gap_evt.conn_handle, BLE_GAP_RSSI_THRESHOLD_INVALID, 0));
+
+            // Ask for the parameters and PHY we've been given straight away, rather than waiting for ble_conn_params.
+            if ( m_conn_params_set)
+                microbit_ble_for_each_connected_conn_params_set( p_ble_evt->evt.gap_evt.conn_handle, NULL);
+
+            if ( m_phys != BLE_GAP_PHY_AUTO)
+            {
+                ble_gap_phys_t const phys = { m_phys, m_phys };
+                MICROBIT_BLE_ECHK( sd_ble_gap_phy_update( p_ble_evt->evt.gap_evt.conn_handle, &phys));
+            }
+
             bleConnectionCallback( p_ble_evt->evt.gap_evt.conn_handle);
             break;
         }
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            m_conn_current = p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+            m_stats.connectionUpdates++;
+            MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONN_PARAM_UPDATE %d %d", (int) m_conn_current.max_conn_interval, (int) m_conn_current.slave_latency);
+            MicroBitEvent(MICROBIT_ID_BLE, MICROBIT_BLE_EVT_CONNECTION_UPDATED);
+            break;
+        }
+        case BLE_GAP_EVT_PHY_UPDATE:
+        {
+            if ( p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS)
+            {
+                m_phy_current = p_ble_evt->evt.gap_evt.params.phy_update.tx_phy;
+                m_stats.phyUpdates++;
+                MicroBitEvent(MICROBIT_ID_BLE, MICROBIT_BLE_EVT_PHY_UPDATED);
+            }
+            break;
+        }
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+        {
+            m_stats.txEvents++;
+            m_stats.txPackets += p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+            break;
+        }
+        case BLE_GAP_EVT_ADV_SET_TERMINATED:
+        {
+            MicroBitPowerProfiler::setActive( MICROBIT_POWER_PROFILE_BLE_ADVERTISING, false);
+
+            // Move on to the next advertising phase, unless it was a connection that ended this one.
+            if ( p_ble_evt->evt.gap_evt.params.adv_set_terminated.reason == BLE_GAP_EVT_ADV_SET_TERMINATED_REASON_TIMEOUT)
+            {
+                if ( m_adv_phase == MICROBIT_BLE_ADV_PHASE_DIRECTED)
+                    microbit_ble_startAdvertising( MICROBIT_BLE_ADV_PHASE_FAST);
+                else if ( m_adv_phase == MICROBIT_BLE_ADV_PHASE_FAST)
+                    microbit_ble_startAdvertising( MICROBIT_BLE_ADV_PHASE_SLOW);
+            }
+            break;
+        }
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
             ble_gap_phys_t const phys =
             {
-                .tx_phys = BLE_GAP_PHY_AUTO,
-                .rx_phys = BLE_GAP_PHY_AUTO,
+                .tx_phys = m_phys,
+                .rx_phys = m_phys,
             };
             MICROBIT_BLE_ECHK( sd_ble_gap_phy_update( p_ble_evt->evt.gap_evt.conn_handle, &phys));
             break;
@@ -1385,10 +1899,21 @@ static void microbit_ble_pm_evt_handler(pm_evt_t const * p_evt)
             break;
 
         case PM_EVT_CONN_SEC_SUCCEEDED:
+        {
             //MICROBIT_DEBUG_DMESG( "PM_EVT_CONN_SEC_SUCCEEDED");
+#if CONFIG_ENABLED(MICROBIT_BLE_DIRECTED_ADVERTISING)
+            // Remember who this is, so that directed advertising can invite them back when they disconnect.
+            pm_peer_data_bonding_t bonding;
+            if ( p_evt->peer_id != PM_PEER_ID_INVALID && pm_peer_data_bonding_load( p_evt->peer_id, &bonding) == NRF_SUCCESS)
+            {
+                m_peer_addr       = bonding.peer_ble_id.id_addr_info;
+                m_peer_addr_valid = true;
+            }
+#endif
             if ( MicroBitBLEManager::manager)
                 MicroBitBLEManager::manager->pairingComplete( MICROBIT_BLE_PAIR_UPDATE);
             break;
+        }
         
         case PM_EVT_CONN_SEC_FAILED:
             MICROBIT_DEBUG_DMESG( "PM_EVT_CONN_SEC_FAILED");
@@ -1441,6 +1966,14 @@ static void microbit_ble_for_each_connected_tx_power_set( uint16_t conn_handle,
 }
 
 
+static void microbit_ble_for_each_connected_conn_params_set( uint16_t conn_handle, void * /*p_context*/)
+{
+    MICROBIT_DEBUG_DMESGF( "microbit_ble_for_each_connected_conn_params_set conn_handle %d", (int) conn_handle);
+    // ble_conn_params keeps asking the central for these until it agrees, or gives up.
+    MICROBIT_BLE_ECHK( ble_conn_params_change_conn_params( conn_handle, &m_conn_params));
+}
+
+
 /**
  * Callback for handling shutdown preparation.
  *
@@ -1461,8 +1994,8 @@ static bool microbit_ble_shutdown_handler(nrf_pwr_mgmt_evt_t event)
             if ( MicroBitBLEManager::manager)
             {
                 // Use idleCallback rather than a timer to restart the shutdown
-                MicroBitBLEManager::manager->status |= MICROBIT_BLE_STATUS_SHUTDOWN;
-                fiber_add_idle_component( MicroBitBLEManager::manager);
+                component_status_set(MicroBitBLEManager::manager, MICROBIT_BLE_STATUS_SHUTDOWN);
+                fiber_wake_idle_component( MicroBitBLEManager::manager);
                 
                 shutdownOK = MicroBitBLEManager::manager->prepareForShutdown();
             }
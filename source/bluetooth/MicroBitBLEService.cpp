@@ -34,11 +34,13 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEServices.h"
 #include "MicroBitBLEService.h"
+#include "MicroBitBLEManager.h"
 
 #include "ble.h"
 #include "ble_srv_common.h"
 #include "ble_conn_state.h"
 #include "peer_manager.h"
+#include "app_util_platform.h"
 
 
 const uint8_t MicroBitBLEService::bs_base_uuid[ 16] =
@@ -51,7 +53,9 @@ const uint8_t MicroBitBLEService::bs_base_uuid[ 16] =
   */
 MicroBitBLEService::MicroBitBLEService() :
     bs_uuid_type(0),
-    bs_service_handle(0)
+    bs_service_handle(0),
+    bs_tx_credits(MICROBIT_BLE_SERVICE_TX_CREDITS),
+    bs_tx_in_flight(0)
 {
     MicroBitBLEServices::getShared()->AddService( this);
 }
@@ -82,11 +86,86 @@ void MicroBitBLEService::CreateService( uint16_t uuid)
     serviceUUID.uuid = uuid;
     serviceUUID.type = bs_uuid_type;
 
-    MICROBIT_BLE_ECHK( sd_ble_gatts_service_add( BLE_GATTS_SRVC_TYPE_PRIMARY, &serviceUUID, &bs_service_handle));
+    if ( MICROBIT_BLE_ECHK( sd_ble_gatts_service_add( BLE_GATTS_SRVC_TYPE_PRIMARY, &serviceUUID, &bs_service_handle)) == NRF_SUCCESS)
+        if ( MicroBitBLEManager::manager)
+            MicroBitBLEManager::manager->serviceAdded();
     
     MICROBIT_DEBUG_DMESG( "MicroBitBLEService::CreateService( %x) = %d", (unsigned int) uuid, (int) bs_service_handle);
 }
 
+
+/**
+  * Notify a value, if the SoftDevice can queue it now and this service has a credit to send it.
+  * @return true if the notification was queued. Otherwise the caller may retry in onHVNTxComplete().
+  */
+bool MicroBitBLEService::notifyChrValue( int idx, const uint8_t *data, uint16_t length)
+{
+    bool sent = false;
+
+    // Keep the SoftDevice's event handler from returning credits while we take one.
+    CRITICAL_REGION_ENTER();
+
+    if ( bs_tx_in_flight >= bs_tx_credits)
+        setChrValue( idx, data, length);
+    else if ( characteristicPtr( idx)->notifyChrValue( getConnectionHandle(), data, length))
+    {
+        MicroBitBLEServices::getShared()->txQueued( this);
+        sent = true;
+    }
+
+    if ( !sent && MicroBitBLEManager::manager && getConnected() && notifyChrValueEnabled( idx))
+        MicroBitBLEManager::manager->notificationRejected();
+
+    CRITICAL_REGION_EXIT();
+
+    return sent;
+}
+
+
+/**
+  * Notify a value, or hold it until the SoftDevice has room, in place of any value already held for
+  * the characteristic. Suits characteristics where only the latest value matters.
+  * @return true if the notification was queued or held.
+  */
+bool MicroBitBLEService::queueChrValue( int idx, const uint8_t *data, uint16_t length)
+{
+    MicroBitBLEServices *services = MicroBitBLEServices::getShared();
+    bool queued = false;
+
+    CRITICAL_REGION_ENTER();
+
+    // While an earlier value is held, replace it rather than overtake it.
+    if ( services->txHeld( this, idx))
+    {
+        setChrValue( idx, data, length);
+        queued = services->txHold( this, idx, length);
+    }
+    else if ( notifyChrValue( idx, data, length))
+        queued = true;
+    else if ( getConnected() && notifyChrValueEnabled( idx))
+        queued = services->txHold( this, idx, length);
+
+    CRITICAL_REGION_EXIT();
+
+    return queued;
+}
+
+
+/**
+  * Set the number of notifications this service may have queued in the SoftDevice at once,
+  * so that a busy service leaves room for others.
+  * @param credits from 1 to MICROBIT_BLE_HVN_TX_QUEUE_SIZE.
+  */
+void MicroBitBLEService::setTxCredits( int credits)
+{
+    if ( credits < 1)
+        credits = 1;
+    if ( credits > MICROBIT_BLE_HVN_TX_QUEUE_SIZE)
+        credits = MICROBIT_BLE_HVN_TX_QUEUE_SIZE;
+
+    bs_tx_credits = credits;
+}
+
                       
 void MicroBitBLEService::CreateCharacteristic(
     int             idx,
@@ -200,6 +279,10 @@ bool MicroBitBLEService::onBleEvent( microbit_ble_evt_t const * p_ble_evt)
           onHVC( p_ble_evt);
           break;
 
+      case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+          onHVNTxComplete( p_ble_evt);
+          break;
+
       case BLE_GATTS_EVT_WRITE:
           onWrite( p_ble_evt);
           break;
@@ -354,4 +437,8 @@ void MicroBitBLEService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 {
 }
 
+void MicroBitBLEService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+}
+
 #endif
@@ -37,6 +37,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEServices.h"
 
 #include "nrf_sdh_ble.h"
+#include "app_util_platform.h"
 
 
 /**
@@ -63,7 +64,10 @@ MicroBitBLEServices *MicroBitBLEServices::getShared()
   * @param _ble An instance of MicroBitBLEManager.
   */
 MicroBitBLEServices::MicroBitBLEServices() :
-    bs_services_count(0)
+    bs_services_count(0),
+    bs_tx_head(0),
+    bs_tx_count(0),
+    bs_held_count(0)
 {
 }
 
@@ -98,6 +102,26 @@ void MicroBitBLEServices::RemoveService( MicroBitBLEService *service)
         
         bs_services_count = count;
     }
+
+    // Drop anything the service has waiting to be sent.
+    CRITICAL_REGION_ENTER();
+
+    for ( int i = 0; i < bs_tx_count; i++)
+    {
+        int slot = ( bs_tx_head + i) % MICROBIT_BLE_HVN_TX_QUEUE_SIZE;
+        if ( bs_tx_owner[ slot] == service)
+            bs_tx_owner[ slot] = NULL;
+    }
+
+    int held = 0;
+    for ( int i = 0; i < bs_held_count; i++)
+    {
+        if ( bs_held[ i].service != service)
+            bs_held[ held++] = bs_held[ i];
+    }
+    bs_held_count = held;
+
+    CRITICAL_REGION_EXIT();
 }
 
 
@@ -105,6 +129,13 @@ void MicroBitBLEServices::onBleEvent( ble_evt_t const * p_ble_evt)
 {
     //MICROBIT_DEBUG_DMESG("MicroBitBLEServices::onBleEvent 0x%x", (unsigned int) p_ble_evt->header.evt_id);
     
+    // Send held values before the services are told there is room, so that streaming can't starve them.
+    if ( p_ble_evt->header.evt_id == BLE_GATTS_EVT_HVN_TX_COMPLETE)
+        txComplete( p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count);
+
+    if ( p_ble_evt->header.evt_id == BLE_GAP_EVT_DISCONNECTED)
+        txReset();
+
     for ( int i = 0; i < bs_services_count; i++)
     {
         if ( !bs_services[ i]->onBleEvent( p_ble_evt))
@@ -113,6 +144,119 @@ void MicroBitBLEServices::onBleEvent( ble_evt_t const * p_ble_evt)
 }
 
 
+/**
+  * Record a notification queued by a service, taking one of its credits.
+  */
+void MicroBitBLEServices::txQueued( MicroBitBLEService *service)
+{
+    if ( bs_tx_count >= MICROBIT_BLE_HVN_TX_QUEUE_SIZE)
+        return;
+
+    bs_tx_owner[ ( bs_tx_head + bs_tx_count) % MICROBIT_BLE_HVN_TX_QUEUE_SIZE] = service;
+    bs_tx_count++;
+    service->bs_tx_in_flight++;
+}
+
+
+/**
+  * Hold the latest value of a characteristic, already set in its attribute, to notify when there is room.
+  * @return true if the value is held.
+  */
+bool MicroBitBLEServices::txHold( MicroBitBLEService *service, int idx, uint16_t length)
+{
+    for ( int i = 0; i < bs_held_count; i++)
+    {
+        if ( bs_held[ i].service == service && bs_held[ i].idx == idx)
+        {
+            bs_held[ i].length = length;
+            return true;
+        }
+    }
+
+    if ( bs_held_count >= MICROBIT_BLE_SERVICES_HELD_MAX)
+        return false;
+
+    bs_held[ bs_held_count].service = service;
+    bs_held[ bs_held_count].idx = idx;
+    bs_held[ bs_held_count].length = length;
+    bs_held_count++;
+    return true;
+}
+
+
+/**
+  * Determine whether a value is held for a characteristic.
+  */
+bool MicroBitBLEServices::txHeld( MicroBitBLEService *service, int idx)
+{
+    for ( int i = 0; i < bs_held_count; i++)
+    {
+        if ( bs_held[ i].service == service && bs_held[ i].idx == idx)
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+  * Return the credits of notifications transmitted, and send held values while there is room.
+  */
+void MicroBitBLEServices::txComplete( int count)
+{
+    // The SoftDevice transmits notifications in the order they were queued.
+    while ( count > 0 && bs_tx_count > 0)
+    {
+        MicroBitBLEService *service = bs_tx_owner[ bs_tx_head];
+        if ( service && service->bs_tx_in_flight)
+            service->bs_tx_in_flight--;
+
+        bs_tx_head = ( bs_tx_head + 1) % MICROBIT_BLE_HVN_TX_QUEUE_SIZE;
+        bs_tx_count--;
+        count--;
+    }
+
+    int i = 0;
+    while ( i < bs_held_count)
+    {
+        MicroBitBLEService *service = bs_held[ i].service;
+
+        // Leave values for services without a credit, but don't let them block the others.
+        if ( service->bs_tx_in_flight >= service->bs_tx_credits)
+        {
+            i++;
+            continue;
+        }
+
+        uint32_t err = service->characteristicPtr( bs_held[ i].idx)->notifyCurrentValue( service->getConnectionHandle(), bs_held[ i].length);
+        if ( err == NRF_ERROR_RESOURCES)
+            break;
+
+        if ( err == NRF_SUCCESS)
+            txQueued( service);
+
+        // Sent, or can no longer be sent, so stop holding it.
+        for ( int j = i + 1; j < bs_held_count; j++)
+            bs_held[ j - 1] = bs_held[ j];
+        bs_held_count--;
+    }
+}
+
+
+/**
+  * Forget all queued and held notifications, as on disconnection.
+  */
+void MicroBitBLEServices::txReset()
+{
+    for ( int i = 0; i < bs_services_count; i++)
+        bs_services[ i]->bs_tx_in_flight = 0;
+
+    bs_tx_head = 0;
+    bs_tx_count = 0;
+    bs_held_count = 0;
+}
+
+
 static void microbit_ble_services_on_ble_evt( ble_evt_t const * p_ble_evt, void * p_context)
 {
     MicroBitBLEServices::getShared()->onBleEvent( p_ble_evt);
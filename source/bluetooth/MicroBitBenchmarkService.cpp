@@ -0,0 +1,327 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for the MicroBit BLE Benchmark Service.
+  * Measures BLE throughput and latency on the device itself.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBenchmarkService.h"
+#include "MicroBitSystemTimer.h"
+
+using namespace codal;
+
+
+const uint16_t MicroBitBenchmarkService::serviceUUID               = 0xa1e0;
+const uint16_t MicroBitBenchmarkService::charUUID[ mbbs_cIdxCOUNT] = { 0xa1e1, 0xa1e2, 0xa1e3 };
+
+
+/**
+  * Constructor.
+  * Create a representation of the BenchmarkService
+  * @param _ble The instance of a BLE device that we're running on.
+  */
+MicroBitBenchmarkService::MicroBitBenchmarkService( BLEDevice &_ble)
+{
+    // Initialise our characteristic values.
+    memset( controlCharacteristicBuffer, 0, sizeof( controlCharacteristicBuffer));
+    memset( dataCharacteristicBuffer, 0, sizeof( dataCharacteristicBuffer));
+    memset( resultCharacteristicBuffer, 0, sizeof( resultCharacteristicBuffer));
+    memset( &result, 0, sizeof( result));
+
+    test = 0;
+    requestTest = 0;
+    requestParameter = 0;
+    sequence = 0;
+    queued = 0;
+    startTime = 0;
+    sentTime = 0;
+    latencyTotal = 0;
+
+    // Register the base UUID and create the service.
+    RegisterBaseUUID( bs_base_uuid);
+    CreateService( serviceUUID);
+
+    // Create the data structures that represent each of our characteristics in Soft Device.
+    CreateCharacteristic( mbbs_cIdxCONTROL, charUUID[ mbbs_cIdxCONTROL],
+                         controlCharacteristicBuffer,
+                         0, sizeof(controlCharacteristicBuffer),
+                         microbit_propWRITE | microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
+                         dataCharacteristicBuffer,
+                         0, sizeof(dataCharacteristicBuffer),
+                         microbit_propWRITE_WITHOUT | microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxRESULT, charUUID[ mbbs_cIdxRESULT],
+                         resultCharacteristicBuffer,
+                         sizeof(resultCharacteristicBuffer), sizeof(resultCharacteristicBuffer),
+                         microbit_propREAD);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_BLE_BENCHMARK, MICROBIT_EVT_ANY, this, &MicroBitBenchmarkService::benchmarkServiceEvent);
+}
+
+
+/**
+  * Invoked when BLE disconnects.
+  */
+void MicroBitBenchmarkService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    finish();
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are written via BLE.
+  */
+void MicroBitBenchmarkService::onDataWritten( const microbit_ble_evt_write_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxCONTROL) && params->len >= 1)
+    {
+        uint8_t code = params->data[0];
+
+        if ( code == MICROBIT_BENCHMARK_SERVICE_STOP)
+        {
+            if ( test)
+                finish();
+            else
+                notifyControl( code, MICROBIT_BENCHMARK_SERVICE_ERROR);
+            return;
+        }
+
+        if ( code < MICROBIT_BENCHMARK_SERVICE_NOTIFY || code > MICROBIT_BENCHMARK_SERVICE_LATENCY || params->len < 3 || test)
+        {
+            notifyControl( code, MICROBIT_BENCHMARK_SERVICE_ERROR);
+            return;
+        }
+
+        requestTest = code;
+        requestParameter = params->data[1] | (params->data[2] << 8);
+        MicroBitEvent(MICROBIT_ID_BLE_BENCHMARK, MICROBIT_BENCHMARK_SERVICE_EVT_START);
+        return;
+    }
+
+    if ( params->handle != valueHandle( mbbs_cIdxDATA))
+        return;
+
+    // Time packets as soon as they arrive, rather than once a fiber gets to them.
+    uint32_t now = (uint32_t) system_timer_current_time_us();
+
+    if ( test == MICROBIT_BENCHMARK_SERVICE_WRITE)
+    {
+        if ( result.packets == 0)
+            startTime = now;
+
+        result.packets++;
+        result.bytes += params->len;
+        result.elapsed = now - startTime;
+
+        if ( result.elapsed >= (uint32_t) requestParameter * 1000)
+            finish();
+    }
+
+    if ( test == MICROBIT_BENCHMARK_SERVICE_LATENCY && params->len >= 1 && params->data[0] == sequence)
+    {
+        uint32_t rtt = now - sentTime;
+
+        if ( rtt < result.latencyMin)
+            result.latencyMin = rtt;
+        if ( rtt > result.latencyMax)
+            result.latencyMax = rtt;
+
+        latencyTotal += rtt;
+        result.packets++;
+        result.bytes += params->len;
+
+        sendPing();
+    }
+}
+
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitBenchmarkService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( test != MICROBIT_BENCHMARK_SERVICE_NOTIFY)
+        return;
+
+    // The SoftDevice reports the notifications sent at the end of each connection event.
+    uint16_t count = p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+    if ( count > result.maxPerEvent)
+        result.maxPerEvent = count;
+
+    result.packets += count;
+    result.elapsed = (uint32_t) system_timer_current_time_us() - startTime;
+
+    MicroBitEvent(MICROBIT_ID_BLE_BENCHMARK, MICROBIT_BENCHMARK_SERVICE_EVT_SEND);
+}
+
+
+/**
+  * Start tests and report their results outside of the BLE event handler.
+  */
+void MicroBitBenchmarkService::benchmarkServiceEvent( MicroBitEvent e)
+{
+    switch ( e.value)
+    {
+        case MICROBIT_BENCHMARK_SERVICE_EVT_START:
+        {
+            bool notifies = requestTest != MICROBIT_BENCHMARK_SERVICE_WRITE;
+            if ( test || !getConnected() || requestParameter == 0 || ( notifies && !notifyChrValueEnabled( mbbs_cIdxDATA)))
+            {
+                notifyControl( requestTest, MICROBIT_BENCHMARK_SERVICE_ERROR);
+                break;
+            }
+
+            memset( &result, 0, sizeof( result));
+            result.test = requestTest;
+            result.latencyMin = 0xFFFFFFFF;
+            latencyTotal = 0;
+            queued = 0;
+            startTime = (uint32_t) system_timer_current_time_us();
+            test = requestTest;
+
+            if ( test == MICROBIT_BENCHMARK_SERVICE_NOTIFY)
+                sendNext();
+
+            if ( test == MICROBIT_BENCHMARK_SERVICE_LATENCY)
+            {
+                queued = requestParameter;
+                sendPing();
+            }
+            break;
+        }
+        case MICROBIT_BENCHMARK_SERVICE_EVT_SEND:
+        {
+            sendNext();
+            break;
+        }
+        case MICROBIT_BENCHMARK_SERVICE_EVT_COMPLETE:
+        {
+            if ( getConnected())
+                notifyControl( result.test, MICROBIT_BENCHMARK_SERVICE_OK);
+            break;
+        }
+    }
+}
+
+
+/**
+  * Queue as many notifications as the SoftDevice will take, until the notify test's time is up.
+  */
+void MicroBitBenchmarkService::sendNext()
+{
+    while ( test == MICROBIT_BENCHMARK_SERVICE_NOTIFY)
+    {
+        // Once the time is up, wait for those queued to be sent.
+        if ( (uint32_t) system_timer_current_time_us() - startTime >= (uint32_t) requestParameter * 1000)
+        {
+            if ( result.packets >= queued)
+                finish();
+            return;
+        }
+
+        int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+        if ( attrSize > MICROBIT_BENCHMARK_S_ATTRSIZE)
+            attrSize = MICROBIT_BENCHMARK_S_ATTRSIZE;
+
+        // Number each notification, so the client can check for any missing.
+        memcpy( dataCharacteristicBuffer, &queued, sizeof( queued));
+        if ( !notifyChrValue( mbbs_cIdxDATA, dataCharacteristicBuffer, attrSize))
+            return;
+
+        queued++;
+        result.bytes += attrSize;
+    }
+}
+
+
+/**
+  * Send the next round trip of the latency test, or end it.
+  */
+void MicroBitBenchmarkService::sendPing()
+{
+    if ( queued == 0)
+    {
+        finish();
+        return;
+    }
+
+    queued--;
+    sequence++;
+    dataCharacteristicBuffer[0] = sequence;
+    sentTime = (uint32_t) system_timer_current_time_us();
+
+    if ( !notifyChrValue( mbbs_cIdxDATA, dataCharacteristicBuffer, 1))
+        finish();
+}
+
+
+/**
+  * End the test in progress, recording the connection it ran on.
+  */
+void MicroBitBenchmarkService::finish()
+{
+    if ( !test)
+        return;
+
+    MicroBitBLEManager *manager = MicroBitBLEManager::manager;
+    if ( manager)
+    {
+        result.phy = manager->getPHY();
+        result.mtu = manager->getMTU();
+        result.interval = manager->getConnectionInterval();
+        result.slaveLatency = manager->getSlaveLatency();
+    }
+
+    if ( test == MICROBIT_BENCHMARK_SERVICE_LATENCY)
+        result.elapsed = (uint32_t) system_timer_current_time_us() - startTime;
+
+    if ( result.packets && test == MICROBIT_BENCHMARK_SERVICE_LATENCY)
+        result.latencyMean = latencyTotal / result.packets;
+    else
+        result.latencyMin = 0;
+
+    memcpy( resultCharacteristicBuffer, &result, sizeof( result));
+    test = 0;
+
+    MicroBitEvent(MICROBIT_ID_BLE_BENCHMARK, MICROBIT_BENCHMARK_SERVICE_EVT_COMPLETE);
+}
+
+
+/**
+  * Notify the outcome of a test.
+  */
+void MicroBitBenchmarkService::notifyControl( uint8_t code, uint8_t status)
+{
+    uint8_t buffer[2] = { code, status };
+    notifyChrValue( mbbs_cIdxCONTROL, buffer, sizeof( buffer));
+}
+
+#endif
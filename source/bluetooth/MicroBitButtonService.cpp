@@ -118,19 +118,19 @@ void MicroBitButtonService::buttonAUpdate(MicroBitEvent e)
         if (e.value == MICROBIT_BUTTON_EVT_UP)
         {
             buttonADataCharacteristicBuffer = 0;
-            notifyChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
         }
 
         if (e.value == MICROBIT_BUTTON_EVT_DOWN)
         {
             buttonADataCharacteristicBuffer = 1;
-            notifyChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
         }
 
         if (e.value == MICROBIT_BUTTON_EVT_HOLD)
         {
             buttonADataCharacteristicBuffer = 2;
-            notifyChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxA, &buttonADataCharacteristicBuffer, sizeof(buttonADataCharacteristicBuffer));
         }
     }
 }
@@ -145,19 +145,19 @@ void MicroBitButtonService::buttonBUpdate(MicroBitEvent e)
         if (e.value == MICROBIT_BUTTON_EVT_UP)
         {
             buttonBDataCharacteristicBuffer = 0;
-            notifyChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
         }
 
         if (e.value == MICROBIT_BUTTON_EVT_DOWN)
         {
             buttonBDataCharacteristicBuffer = 1;
-            notifyChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
         }
 
         if (e.value == MICROBIT_BUTTON_EVT_HOLD)
         {
             buttonBDataCharacteristicBuffer = 2;
-            notifyChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
+            queueChrValue( mbbs_cIdxB, &buttonBDataCharacteristicBuffer, sizeof(buttonBDataCharacteristicBuffer));
         }
     }
 }
@@ -0,0 +1,99 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for the MicroBit BLE Diagnostics Service.
+  * Reports the link statistics kept by MicroBitBLEManager.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitDiagnosticsService.h"
+
+
+const uint16_t MicroBitDiagnosticsService::serviceUUID               = 0xa1f0;
+const uint16_t MicroBitDiagnosticsService::charUUID[ mbbs_cIdxCOUNT] = { 0xa1f1 };
+
+
+/**
+  * Constructor.
+  * Create a representation of the DiagnosticsService
+  * @param _ble The instance of a BLE device that we're running on.
+  */
+MicroBitDiagnosticsService::MicroBitDiagnosticsService( BLEDevice &_ble) :
+        ble(_ble)
+{
+    // Initialise our characteristic values.
+    memset( &statisticsCharacteristicBuffer, 0, sizeof( statisticsCharacteristicBuffer));
+
+    // Register the base UUID and create the service.
+    RegisterBaseUUID( bs_base_uuid);
+    CreateService( serviceUUID);
+
+    // Create the data structures that represent each of our characteristics in Soft Device.
+    CreateCharacteristic( mbbs_cIdxSTATISTICS, charUUID[ mbbs_cIdxSTATISTICS],
+                         (uint8_t *)&statisticsCharacteristicBuffer,
+                         0, sizeof(statisticsCharacteristicBuffer),
+                         microbit_propREAD | microbit_propWRITE | microbit_propREADAUTH);
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are written via BLE.
+  */
+void MicroBitDiagnosticsService::onDataWritten( const microbit_ble_evt_write_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxSTATISTICS))
+    {
+        ble.resetStatistics();
+
+        // Put back the statistics in place of the value written.
+        statisticsCharacteristicBuffer = ble.getStatistics();
+        setChrValue( mbbs_cIdxSTATISTICS, (const uint8_t *)&statisticsCharacteristicBuffer, sizeof(statisticsCharacteristicBuffer));
+    }
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are read via BLE.
+  */
+void MicroBitDiagnosticsService::onDataRead( microbit_onDataRead_t *params)
+{
+    if ( params->handle == valueHandle( mbbs_cIdxSTATISTICS))
+    {
+        // A long read of the value we've already returned continues from what is stored.
+        if ( params->offset > 0)
+        {
+            params->update = false;
+            return;
+        }
+
+        statisticsCharacteristicBuffer = ble.getStatistics();
+        params->data = (uint8_t *)&statisticsCharacteristicBuffer;
+        params->length = sizeof(statisticsCharacteristicBuffer);
+    }
+}
+
+#endif
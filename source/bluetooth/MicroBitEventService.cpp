@@ -38,7 +38,7 @@ DEALINGS IN THE SOFTWARE.
 
 
 const uint16_t MicroBitEventService::serviceUUID               = 0x93af;
-const uint16_t MicroBitEventService::charUUID[ mbbs_cIdxCOUNT] = { 0x9775, 0xb84c, 0x5404, 0x23c4 };
+const uint16_t MicroBitEventService::charUUID[ mbbs_cIdxCOUNT] = { 0x9775, 0xb84c, 0x5404, 0x23c4, 0xb84d };
 
 
 /**
@@ -53,17 +53,21 @@ MicroBitEventService::MicroBitEventService(BLEDevice &_ble, EventModel &_message
     // Initialise our characteristic values.
     clientEventBuffer.type = 0x00;
     clientEventBuffer.reason = 0x00;
-    microBitEventBuffer = microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
-    
+    microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
+    memset( microBitEventBuffer, 0, sizeof( microBitEventBuffer));
+    memset( microBitRequirementsBulkBuffer, 0, sizeof( microBitRequirementsBulkBuffer));
+
     messageBusListenerOffset = 0;
+    eventQueueHead = 0;
+    eventQueueTail = 0;
 
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
     CreateService( serviceUUID);
 
     CreateCharacteristic( mbbs_cIdxMEVENT, charUUID[ mbbs_cIdxMEVENT],
-                        (uint8_t *)&microBitEventBuffer,
-                         sizeof(EventServiceEvent), sizeof(EventServiceEvent),
+                        (uint8_t *)microBitEventBuffer,
+                         sizeof(EventServiceEvent), sizeof(microBitEventBuffer),
                          microbit_propREAD | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxCEVENT, charUUID[ mbbs_cIdxCEVENT],
@@ -82,7 +86,11 @@ MicroBitEventService::MicroBitEventService(BLEDevice &_ble, EventModel &_message
                          sizeof(EventServiceEvent),
                          microbit_propREAD | microbit_propNOTIFY | microbit_propREADAUTH);
 
-    fiber_add_idle_component(this);
+    CreateCharacteristic( mbbs_cIdxMREQBULK, charUUID[ mbbs_cIdxMREQBULK],
+                         (uint8_t *)microBitRequirementsBulkBuffer,
+                         0,
+                         sizeof(microBitRequirementsBulkBuffer),
+                         microbit_propREAD | microbit_propREADAUTH);
 }
 
 
@@ -126,18 +134,69 @@ void MicroBitEventService::onDataWritten( const microbit_ble_evt_write_t *params
   */
 void MicroBitEventService::onMicroBitEvent(MicroBitEvent evt)
 {
-    EventServiceEvent *e = &microBitEventBuffer;
+    if ( !getConnected() || !notifyChrValueEnabled( mbbs_cIdxMEVENT))
+        return;
+
+    // If the queue is full, this event is lost.
+    int next = ( eventQueueHead + 1) % MICROBIT_EVENT_SERVICE_QUEUE_SIZE;
+    if ( next == eventQueueTail)
+        return;
+
+    eventQueue[ eventQueueHead].type = evt.source;
+    eventQueue[ eventQueueHead].reason = evt.value;
+    eventQueueHead = next;
+
+    sendNext();
+}
+
+/**
+  * Callback. Invoked when BLE disconnects.
+  */
+void MicroBitEventService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    eventQueueHead = 0;
+    eventQueueTail = 0;
+}
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitEventService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    sendNext();
+}
+
+/**
+  * Send the queued events, as many to each notification as fit, until the SoftDevice's queue is full.
+  */
+void MicroBitEventService::sendNext()
+{
+    // Fill each notification to the negotiated MTU.
+    int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+    int maxEvents = attrSize / sizeof(EventServiceEvent);
+    if ( maxEvents > (int) MICROBIT_EVENT_SERVICE_S_EVENTS)
+        maxEvents = MICROBIT_EVENT_SERVICE_S_EVENTS;
 
-    if ( getConnected())
+    // While the SoftDevice has room, each event goes on its own, just as it arrives.
+    while ( eventQueueTail != eventQueueHead)
     {
-        e->type = evt.source;
-        e->reason = evt.value;
-        notifyChrValue( mbbs_cIdxMEVENT, (const uint8_t *)e, sizeof(EventServiceEvent));
+        int count = 0;
+        int eventQueueNext = eventQueueTail;
+        while ( count < maxEvents && eventQueueNext != eventQueueHead)
+        {
+            microBitEventBuffer[ count++] = eventQueue[ eventQueueNext];
+            eventQueueNext = ( eventQueueNext + 1) % MICROBIT_EVENT_SERVICE_QUEUE_SIZE;
+        }
+
+        if ( !notifyChrValue( mbbs_cIdxMEVENT, (const uint8_t *)microBitEventBuffer, count * sizeof(EventServiceEvent)))
+            break;
+
+        eventQueueTail = eventQueueNext;
     }
 }
 
 /**
-  * Periodic callback from MicroBit scheduler.
+  * Periodic callback from MicroBit scheduler, made while a client has read our requirements.
   * If we're no longer connected, remove any registered Message Bus listeners.
   */
 void MicroBitEventService::idleCallback()
@@ -147,6 +206,10 @@ void MicroBitEventService::idleCallback()
         messageBusListenerOffset = 0;
         messageBus.ignore(MICROBIT_ID_ANY, MICROBIT_EVT_ANY, this, &MicroBitEventService::onMicroBitEvent);
     }
+
+    // Nothing to tidy up until our requirements are read again.
+    if ( messageBusListenerOffset == 0)
+        fiber_idle_component_done(this);
 }
 
 /**
@@ -157,6 +220,9 @@ void MicroBitEventService::idleCallback()
   */
 void MicroBitEventService::onDataRead( microbit_onDataRead_t *params)
 {
+    // Watch for the client disconnecting, so any listeners it registered can be removed.
+    fiber_wake_idle_component(this);
+
     if ( params->handle == valueHandle( mbbs_cIdxMREQ))
     {
         // Walk through the list of message bus listeners.
@@ -176,6 +242,35 @@ void MicroBitEventService::onDataRead( microbit_onDataRead_t *params)
             params->length = 0;
         }
     }
+
+    if ( params->handle == valueHandle( mbbs_cIdxMREQBULK))
+    {
+        // A long read of the value we've already returned continues from what is stored.
+        if ( params->offset > 0)
+        {
+            params->update = false;
+            return;
+        }
+
+        // As above, but with as many listeners as fit into a read response, continuing from where the last read of either characteristic stopped.
+        int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 1 : BLE_GATT_ATT_MTU_DEFAULT - 1;
+        int maxEvents = attrSize / sizeof(EventServiceEvent);
+        if ( maxEvents > (int) MICROBIT_EVENT_SERVICE_S_EVENTS)
+            maxEvents = MICROBIT_EVENT_SERVICE_S_EVENTS;
+
+        int count = 0;
+        MicroBitListener *l;
+        while ( count < maxEvents && ( l = messageBus.elementAt( messageBusListenerOffset)) != NULL)
+        {
+            microBitRequirementsBulkBuffer[ count].type = l->id;
+            microBitRequirementsBulkBuffer[ count].reason = l->value;
+            messageBusListenerOffset++;
+            count++;
+        }
+
+        params->data = (uint8_t *)microBitRequirementsBulkBuffer;
+        params->length = count * sizeof(EventServiceEvent);
+    }
 }
 
 #endif
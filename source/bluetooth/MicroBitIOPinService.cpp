@@ -33,6 +33,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitIOPinService.h"
 #include "MicroBitFiber.h"
+#include "MicroBitSystemTimer.h"
+#include <stdlib.h>
 
 const uint16_t MicroBitIOPinService::serviceUUID               = 0x127b;
 const uint16_t MicroBitIOPinService::charUUID[ mbbs_cIdxCOUNT] = { 0x5899, 0xb9fe, 0xd822, 0x8d00 };
@@ -53,6 +55,12 @@ MicroBitIOPinService::MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io) :
     ioPinServiceIOCharacteristicBuffer = 0;
     memset(ioPinServiceIOData, 0, sizeof(ioPinServiceIOData));
     memset(ioPinServicePWMCharacteristicBuffer, 0, sizeof(ioPinServicePWMCharacteristicBuffer));    // Create the AD characteristic, that defines whether each pin is treated as analogue or digital
+    memset(ioPinServiceDeadband, MICROBIT_IO_PIN_SERVICE_DEADBAND, sizeof(ioPinServiceDeadband));
+    ioPinServiceChangedPins = 0;
+    ioPinServiceSentPins = 0;
+    ioPinServicePeriod = 0;
+
+    this->id = MICROBIT_ID_BLE_IO_PIN;
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -81,7 +89,67 @@ MicroBitIOPinService::MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io) :
                          0, sizeof(ioPinServiceDataCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE | microbit_propNOTIFY | microbit_propREADAUTH);
 
-    fiber_add_idle_component(this);
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(id, MICROBIT_IO_PIN_SERVICE_EVT_SAMPLE, this, &MicroBitIOPinService::onSample);
+
+    setPeriod( MICROBIT_IO_PIN_SERVICE_PERIOD);
+}
+
+
+/**
+  * Set the time between samples of the pins being monitored.
+  * All the changes found by a sample are sent in one notification, so this also limits the notification rate.
+  *
+  * @param period the time between samples, in milliseconds, or 0 to stop monitoring.
+  *
+  * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the period is negative,
+  *         or DEVICE_NO_RESOURCES if a timer event could not be allocated.
+  */
+int MicroBitIOPinService::setPeriod( int period)
+{
+    if ( period < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    system_timer_cancel_event( id, MICROBIT_IO_PIN_SERVICE_EVT_SAMPLE);
+    ioPinServicePeriod = 0;
+
+    if ( period == 0)
+        return DEVICE_OK;
+
+    if ( system_timer_event_every( period, id, MICROBIT_IO_PIN_SERVICE_EVT_SAMPLE) != DEVICE_OK)
+        return DEVICE_NO_RESOURCES;
+
+    ioPinServicePeriod = period;
+    return DEVICE_OK;
+}
+
+
+/**
+  * Determine the time between samples of the pins being monitored.
+  *
+  * @return the period in milliseconds, or 0 if monitoring is stopped.
+  */
+int MicroBitIOPinService::getPeriod()
+{
+    return ioPinServicePeriod;
+}
+
+
+/**
+  * Set the change an analog input must make, from the value last sent, before a notification is sent for it.
+  *
+  * @param pin the enumeration of the pin.
+  * @param deadband the change required, from 1 to 255, in the 8 bit units reported.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the pin or deadband is out of range.
+  */
+int MicroBitIOPinService::setDeadband( int pin, int deadband)
+{
+    if ( pin < 0 || pin >= MICROBIT_IO_PIN_SERVICE_PINCOUNT || deadband < 1 || deadband > 255)
+        return DEVICE_INVALID_PARAMETER;
+
+    ioPinServiceDeadband[ pin] = deadband;
+    return DEVICE_OK;
 }
 
 
@@ -128,36 +196,49 @@ int MicroBitIOPinService::isActiveInput(int i)
 
 /**
  * Scans through all pins that our BLE client have registered an interest in. 
- * For each pin that has changed value, update the BLE characteristic, and NOTIFY our client.
+ * For each pin that has changed value by at least its deadband, update the BLE characteristic.
+ * Changes that don't fit are held, and sent by the next call.
  */
 int MicroBitIOPinService::updateBLEInputs(bool updateAll)
 {
     int pairs = 0;
 
+    ioPinServiceChangedPins &= ioPinServiceIOCharacteristicBuffer;
+    ioPinServiceSentPins = 0;
+
     for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
     {
         if (isActiveInput(i))
         {
             uint8_t value;
+            int deadband = 1;
 
             if (isDigital(i))
                	value = edgePin(i).getDigitalValue();
             else
+            {
                	value = edgePin(i).getAnalogValue() >> 2;
+                deadband = ioPinServiceDeadband[i];
+            }
 
-            // If the data has changed, send an update.
-            if (updateAll || value != ioPinServiceIOData[i])
+            // If the data has changed, record it until it is sent.
+            if (updateAll || abs(value - ioPinServiceIOData[i]) >= deadband)
             {
                 ioPinServiceIOData[i] = value;
+                ioPinServiceChangedPins |= 1 << i;
+            }
+        }
+    }
 
-                ioPinServiceDataCharacteristicBuffer[pairs].pin = i;
-                ioPinServiceDataCharacteristicBuffer[pairs].value = value;
-
-                pairs++;
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT && pairs < MICROBIT_IO_PIN_SERVICE_DATA_SIZE; i++)
+    {
+        if (ioPinServiceChangedPins & (1 << i))
+        {
+            ioPinServiceDataCharacteristicBuffer[pairs].pin = i;
+            ioPinServiceDataCharacteristicBuffer[pairs].value = ioPinServiceIOData[i];
+            ioPinServiceSentPins |= 1 << i;
 
-                if (pairs >= MICROBIT_IO_PIN_SERVICE_DATA_SIZE)
-                    break;
-            }
+            pairs++;
         }
     }
     
@@ -272,6 +353,7 @@ void MicroBitIOPinService::onDataRead( microbit_onDataRead_t *params)
         int pairs = updateBLEInputs( true);
         if ( pairs)
         {
+            ioPinServiceChangedPins &= ~ioPinServiceSentPins;
             params->data    = (uint8_t *)ioPinServiceDataCharacteristicBuffer;
             params->length  = pairs * sizeof(IOData);
         }
@@ -280,21 +362,23 @@ void MicroBitIOPinService::onDataRead( microbit_onDataRead_t *params)
 
 
 /**
- * Periodic callback from MicroBit scheduler.
- *
- * Check if any of the pins we're watching need updating. Notify any connected
- * device with any changes.
- */
-void MicroBitIOPinService::idleCallback()
+  * Periodic sample handler.
+  *
+  * Check if any of the pins we're watching need updating. Notify any connected
+  * device with any changes.
+  */
+void MicroBitIOPinService::onSample( MicroBitEvent)
 {
-    if ( getConnected())
+    // Don't spend time, or ADC conversions, on pins no one is listening to.
+    if ( !ioPinServiceIOCharacteristicBuffer || !getConnected() || !notifyChrValueEnabled( mbbs_cIdxDATA))
+        return;
+
+    int pairs = updateBLEInputs( false);
+    // If there's any data, issue a BLE notification. Changes that can't be sent now are retried at the next sample.
+    if ( pairs)
     {
-        int pairs = updateBLEInputs( false);
-        // If there's any data, issue a BLE notification.
-        if ( pairs)
-        {
-            notifyChrValue( mbbs_cIdxDATA, (uint8_t *)ioPinServiceDataCharacteristicBuffer, pairs * sizeof(IOData));
-        }
+        if ( notifyChrValue( mbbs_cIdxDATA, (uint8_t *)ioPinServiceDataCharacteristicBuffer, pairs * sizeof(IOData)))
+            ioPinServiceChangedPins &= ~ioPinServiceSentPins;
     }
 }
 
@@ -35,7 +35,7 @@ DEALINGS IN THE SOFTWARE.
 
 
 const uint16_t MicroBitLEDService::serviceUUID               = 0xd91d;
-const uint16_t MicroBitLEDService::charUUID[ mbbs_cIdxCOUNT] = { 0x7b77, 0x93ee, 0x0d2d };
+const uint16_t MicroBitLEDService::charUUID[ mbbs_cIdxCOUNT] = { 0x7b77, 0x93ee, 0x0d2d, 0x7b78, 0x7b79 };
 
 /**
   * Constructor.
@@ -48,8 +48,11 @@ MicroBitLEDService::MicroBitLEDService( BLEDevice &_ble, MicroBitDisplay &_displ
 {
     // Initialise our characteristic values.
     memclr( matrixValue, sizeof( matrixValue));
+    memclr( frameValue, sizeof( frameValue));
+    memclr( animationValue, sizeof( animationValue));
     textValue[0]    = 0;
     speedValue      = MICROBIT_DEFAULT_SCROLL_SPEED;
+    animationInterval = 0;
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -70,6 +73,16 @@ MicroBitLEDService::MicroBitLEDService( BLEDevice &_ble, MicroBitDisplay &_displ
                          (uint8_t *)&speedValue,
                          sizeof(speedValue), sizeof(speedValue),
                          microbit_propWRITE | microbit_propREAD);
+
+    CreateCharacteristic( mbbs_cIdxFRAME,  charUUID[ mbbs_cIdxFRAME],
+                         (uint8_t *)frameValue,
+                         sizeof(frameValue), sizeof(frameValue),
+                         microbit_propWRITE | microbit_propWRITE_WITHOUT | microbit_propREAD | microbit_propREADAUTH);
+
+    CreateCharacteristic( mbbs_cIdxANIMATION, charUUID[ mbbs_cIdxANIMATION],
+                         (uint8_t *)animationValue,
+                         0, sizeof(animationValue),
+                         microbit_propWRITE | microbit_propWRITE_WITHOUT);
 }
 
 
@@ -108,6 +121,69 @@ void MicroBitLEDService::onDataWritten( const microbit_ble_evt_write_t *params)
         // We use this as the speed for all scroll operations subsquently initiated from BLE.
         memcpy(&speedValue, params->data, sizeof(speedValue));
     }
+
+    else if (params->handle == valueHandle( mbbs_cIdxFRAME) && params->len == sizeof(frameValue))
+    {
+        // interrupt any animation that might be currently going on
+        display.stopAnimation();
+        for (int y=0; y<5; y++)
+            for (int x=0; x<5; x++)
+                display.image.setPixelValue(x, y, data[y * 5 + x]);
+    }
+
+    else if (params->handle == valueHandle( mbbs_cIdxANIMATION) && params->len > 0)
+        onAnimationWritten( data, params->len);
+}
+
+
+/**
+  * Upload or play an animation, as written to the animation characteristic.
+  */
+void MicroBitLEDService::onAnimationWritten( const uint8_t *data, int length)
+{
+    switch (data[0])
+    {
+        case MICROBIT_LED_SERVICE_ANIMATION_BEGIN:
+        {
+            if (length < 4 || data[1] == 0 || data[1] > MICROBIT_BLE_MAXIMUM_ANIMATION_FRAMES)
+                return;
+
+            // Frames are held side by side, so the display can step through them.
+            animation = MicroBitImage(data[1] * 5, 5);
+            animationInterval = data[2] | (data[3] << 8);
+            break;
+        }
+
+        case MICROBIT_LED_SERVICE_ANIMATION_DATA:
+        {
+            if (length < 3)
+                return;
+
+            int offset = data[1] | (data[2] << 8);
+            int frames = animation.getWidth() / 5;
+
+            for (int i = 3; i < length && offset < frames * 25; i++, offset++)
+            {
+                int frame = offset / 25;
+                int led = offset % 25;
+                animation.setPixelValue(frame * 5 + led % 5, led / 5, data[i]);
+            }
+            break;
+        }
+
+        case MICROBIT_LED_SERVICE_ANIMATION_PLAY:
+        {
+            if (animation.getWidth() < 5)
+                return;
+
+            // interrupt any animation that might be currently going on
+            display.stopAnimation();
+
+            // Shift the strip left one frame at a time, starting at the first.
+            display.animateAsync(animation, animationInterval, -5, 0, 0);
+            break;
+        }
+    }
 }
 
 
@@ -133,6 +209,16 @@ void MicroBitLEDService::onDataRead( microbit_onDataRead_t *params)
         params->data    = matrixValue;
         params->length  = sizeof(matrixValue);
     }
+
+    if ( params->handle == valueHandle( mbbs_cIdxFRAME))
+    {
+        for (int y=0; y<5; y++)
+            for (int x=0; x<5; x++)
+                frameValue[y * 5 + x] = display.image.getPixelValue(x, y);
+
+        params->data    = frameValue;
+        params->length  = sizeof(frameValue);
+    }
 }
 
 #endif
@@ -0,0 +1,242 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for the MicroBit BLE Log Service.
+  * Exports the data recorded by MicroBitLog over BLE.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitLogService.h"
+#include "crc32.h"
+
+using namespace codal;
+
+
+const uint16_t MicroBitLogService::serviceUUID               = 0xa1d0;
+const uint16_t MicroBitLogService::charUUID[ mbbs_cIdxCOUNT] = { 0xa1d1, 0xa1d2 };
+
+
+/**
+  * Constructor.
+  * Create a representation of the LogService
+  * @param _ble The instance of a BLE device that we're running on.
+  * @param _log An instance of MicroBitLog to export.
+  */
+MicroBitLogService::MicroBitLogService( BLEDevice &_ble, MicroBitLog &_log) :
+        log(_log)
+{
+    // Initialise our characteristic values.
+    memset( controlCharacteristicBuffer, 0, sizeof( controlCharacteristicBuffer));
+    memset( dataCharacteristicBuffer, 0, sizeof( dataCharacteristicBuffer));
+
+    requestFormat = DataFormat::CSV;
+    requestOffset = 0;
+    exportOffset = 0;
+    dataLength = -1;
+    exporting = false;
+
+    // Register the base UUID and create the service.
+    RegisterBaseUUID( bs_base_uuid);
+    CreateService( serviceUUID);
+
+    // Create the data structures that represent each of our characteristics in Soft Device.
+    CreateCharacteristic( mbbs_cIdxCONTROL, charUUID[ mbbs_cIdxCONTROL],
+                         controlCharacteristicBuffer,
+                         0, sizeof(controlCharacteristicBuffer),
+                         microbit_propWRITE | microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
+                         dataCharacteristicBuffer,
+                         0, sizeof(dataCharacteristicBuffer),
+                         microbit_propNOTIFY);
+
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_BLE_LOG, MICROBIT_EVT_ANY, this, &MicroBitLogService::logServiceEvent);
+}
+
+
+/**
+  * Invoked when BLE disconnects.
+  */
+void MicroBitLogService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( exporting)
+        MicroBitEvent(MICROBIT_ID_BLE_LOG, MICROBIT_LOG_SERVICE_EVT_STOP);
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are written via BLE.
+  */
+void MicroBitLogService::onDataWritten( const microbit_ble_evt_write_t *params)
+{
+    if ( params->handle != valueHandle( mbbs_cIdxCONTROL) || params->len < 1)
+        return;
+
+    switch ( params->data[0])
+    {
+        case MICROBIT_LOG_SERVICE_START:
+        {
+            if ( params->len < 6 || params->data[1] > (uint8_t) DataFormat::CSV)
+            {
+                notifyControl( MICROBIT_LOG_SERVICE_START, MICROBIT_LOG_SERVICE_ERROR, 0);
+                break;
+            }
+
+            requestFormat = (DataFormat) params->data[1];
+            memcpy( &requestOffset, params->data + 2, sizeof( requestOffset));
+            MicroBitEvent(MICROBIT_ID_BLE_LOG, MICROBIT_LOG_SERVICE_EVT_START);
+            break;
+        }
+        case MICROBIT_LOG_SERVICE_STOP:
+        {
+            MicroBitEvent(MICROBIT_ID_BLE_LOG, MICROBIT_LOG_SERVICE_EVT_STOP);
+            break;
+        }
+    }
+}
+
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitLogService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( exporting)
+        MicroBitEvent(MICROBIT_ID_BLE_LOG, MICROBIT_LOG_SERVICE_EVT_SEND);
+}
+
+
+/**
+  * Start, stop and send the export outside of the BLE event handler, as MicroBitLog may need to wait.
+  */
+void MicroBitLogService::logServiceEvent( MicroBitEvent e)
+{
+    switch ( e.value)
+    {
+        case MICROBIT_LOG_SERVICE_EVT_START:
+        {
+            // Starting a new export abandons any in progress.
+            int length = log.beginExport( requestFormat);
+            if ( length >= 0 && log.seekExport( requestOffset) != DEVICE_OK)
+            {
+                log.endExport();
+                length = DEVICE_INVALID_PARAMETER;
+            }
+
+            exporting = length >= 0;
+            exportOffset = requestOffset;
+            dataLength = -1;
+
+            if ( !exporting)
+            {
+                notifyControl( MICROBIT_LOG_SERVICE_START, MICROBIT_LOG_SERVICE_ERROR, 0);
+                break;
+            }
+
+            notifyControl( MICROBIT_LOG_SERVICE_START, MICROBIT_LOG_SERVICE_OK, length);
+            sendNext();
+            break;
+        }
+        case MICROBIT_LOG_SERVICE_EVT_STOP:
+        {
+            if ( exporting)
+            {
+                exporting = false;
+                log.endExport();
+            }
+
+            if ( getConnected())
+                notifyControl( MICROBIT_LOG_SERVICE_STOP, MICROBIT_LOG_SERVICE_OK, exportOffset);
+            break;
+        }
+        case MICROBIT_LOG_SERVICE_EVT_SEND:
+        {
+            sendNext();
+            break;
+        }
+    }
+}
+
+
+/**
+  * Send as much of the export as the SoftDevice will queue.
+  */
+void MicroBitLogService::sendNext()
+{
+    while ( exporting && getConnected() && notifyChrValueEnabled( mbbs_cIdxDATA))
+    {
+        // Read the next part of the export, unless the last is still waiting to be sent.
+        if ( dataLength < 0)
+        {
+            int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+            if ( attrSize > MICROBIT_LOG_S_ATTRSIZE)
+                attrSize = MICROBIT_LOG_S_ATTRSIZE;
+
+            int n = log.readExport( dataCharacteristicBuffer + MICROBIT_LOG_S_HEADERSIZE, attrSize - MICROBIT_LOG_S_HEADERSIZE);
+            if ( n < 0)
+            {
+                exporting = false;
+                log.endExport();
+                notifyControl( MICROBIT_LOG_SERVICE_STOP, MICROBIT_LOG_SERVICE_ERROR, exportOffset);
+                return;
+            }
+
+            uint32_t crc = crc32_compute( dataCharacteristicBuffer + MICROBIT_LOG_S_HEADERSIZE, n, NULL);
+            memcpy( dataCharacteristicBuffer, &exportOffset, sizeof( exportOffset));
+            memcpy( dataCharacteristicBuffer + sizeof( exportOffset), &crc, sizeof( crc));
+            dataLength = MICROBIT_LOG_S_HEADERSIZE + n;
+        }
+
+        if ( !notifyChrValue( mbbs_cIdxDATA, dataCharacteristicBuffer, dataLength))
+            return;
+
+        int n = dataLength - MICROBIT_LOG_S_HEADERSIZE;
+        exportOffset += n;
+        dataLength = -1;
+
+        // The notification without data marks the end of the export.
+        if ( n == 0)
+        {
+            exporting = false;
+            log.endExport();
+        }
+    }
+}
+
+
+/**
+  * Notify the result of a control code.
+  */
+void MicroBitLogService::notifyControl( uint8_t code, uint8_t status, uint32_t length)
+{
+    uint8_t buffer[6] = { code, status };
+    memcpy( buffer + 2, &length, sizeof( length));
+    notifyChrValue( mbbs_cIdxCONTROL, buffer, status == MICROBIT_LOG_SERVICE_OK ? 6 : 2);
+}
+
+#endif
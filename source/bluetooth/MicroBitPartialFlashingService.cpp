@@ -37,6 +37,7 @@ DEALINGS IN THE SOFTWARE.
 #include "nrf_sdm.h"
 #include "nrf_dfu_types.h"
 #include "crc32.h"
+#include "app_util_platform.h"
 
 using namespace codal;
 
@@ -68,7 +69,7 @@ MicroBitPartialFlashingService::MicroBitPartialFlashingService( BLEDevice &_ble,
 
     CreateCharacteristic( mbbs_cIdxCTRL, charUUID[ mbbs_cIdxCTRL],
                          characteristicValue,
-                         sizeof(characteristicValue), sizeof(characteristicValue),
+                         20, sizeof(characteristicValue),
                          microbit_propWRITE_WITHOUT | microbit_propNOTIFY);
 
     // Set up listener for SD writing
@@ -136,9 +137,58 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           blockPacketCount = 0;
           blockNum = 0;
           offset = 0;
+          windowActive = false;
 
           break;
         }
+        case FLASH_WINDOW_INFO:
+        {
+          /*
+           * Start a windowed transfer, and return its parameters:
+           * | FLASH_WINDOW_INFO | WINDOW (packets) | PAYLOAD (2 bytes) | BLOCK SIZE (2 bytes) |
+           * WINDOW is 0 if there isn't the memory for one, and the client should use FLASH_DATA instead.
+           */
+          if ( windowBuffer == NULL)
+            windowBuffer = (uint32_t *) malloc( 2 * MICROBIT_PF_BLOCK_SIZE);
+
+          // A transfer can't be restarted while its blocks are being written.
+          if ( !windowBusy[0] && !windowBusy[1])
+          {
+            windowLength[0] = windowLength[1] = 0;
+            windowFill = windowWrite = 0;
+            windowSeq = windowAcked = 0;
+            windowActive = windowBuffer != NULL;
+          }
+          else
+          {
+            windowActive = false;
+          }
+
+          // Each packet fills the negotiated MTU.
+          int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+          if ( attrSize > MICROBIT_PF_ATTRSIZE)
+            attrSize = MICROBIT_PF_ATTRSIZE;
+
+          int payload = ( attrSize - MICROBIT_PF_WINDOW_HEADERSIZE) & ~3;
+          int window = windowActive ? MICROBIT_PF_BLOCK_SIZE / payload : 0;
+          if ( window > 127)
+            window = 127;
+
+          windowBytes = window * payload;
+
+          uint8_t buffer[] = { FLASH_WINDOW_INFO, (uint8_t) window,
+                               (uint8_t) (payload >> 8), (uint8_t) payload,
+                               (uint8_t) (MICROBIT_PF_BLOCK_SIZE >> 8), (uint8_t) MICROBIT_PF_BLOCK_SIZE };
+
+          MICROBIT_DEBUG_DMESGF( "FLASH_WINDOW_INFO window %d payload %d", window, payload);
+          notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)buffer, sizeof(buffer));
+          break;
+        }
+        case FLASH_WINDOW_DATA:
+        {
+          windowData(data, params->len);
+          break;
+        }
         case FLASH_DATA:
         {
           // Process FLASH data packet
@@ -281,6 +331,181 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
 
 }
 
+/**
+  * Process a windowed data packet, received while the previous block is being written.
+  *
+  * +-------------------+---------+-----------------------+------------------+
+  * | 1 Byte            | 1 Byte  | 4 Bytes (big endian)  | PAYLOAD Bytes    |
+  * +-------------------+---------+-----------------------+------------------+
+  * | FLASH_WINDOW_DATA | PACKET# | ADDRESS               | DATA             |
+  * +-------------------+---------+-----------------------+------------------+
+  *
+  * The address and length of the data must be multiples of 4, and a packet may not cross a block boundary.
+  * Packets are acknowledged with | FLASH_WINDOW_DATA | 0xFF | NEXT PACKET# |, after which the client may send
+  * up to WINDOW packets more. | FLASH_WINDOW_DATA | 0xAA | NEXT PACKET# | reports that the packets from
+  * NEXT PACKET# onwards were discarded, and must be sent again.
+  *
+  * @param data the packet
+  * @param len the length of the packet
+  */
+void MicroBitPartialFlashingService::windowData(uint8_t *data, int len)
+{
+    uint8_t seq = data[1];
+    uint32_t address = (data[2] << 24) | (data[3] << 16) | (data[4] << 8) | data[5];
+    int length = len - MICROBIT_PF_WINDOW_HEADERSIZE;
+
+    // Ignore packets that we've already received.
+    if ( windowActive && seq != windowSeq && (uint8_t) (windowSeq - seq) < 128)
+        return;
+
+    bool valid = windowActive && seq == windowSeq && length > 0 && (length & 3) == 0 && (address & 3) == 0 &&
+                 address / MICROBIT_PF_BLOCK_SIZE == (address + length - 1) / MICROBIT_PF_BLOCK_SIZE;
+
+    // Start a new block if this packet doesn't follow on from the last.
+    int f = windowFill;
+    if ( valid && windowLength[f] && address != windowAddress[f] + windowLength[f])
+    {
+        windowFlush();
+        f = windowFill;
+    }
+
+    // If the block is still being written, the client has overrun its window.
+    if ( !valid || windowBusy[f])
+    {
+        MICROBIT_DEBUG_DMESGF( "windowData error seq %d expected %d", (int) seq, (int) windowSeq);
+        uint8_t flashNotificationBuffer[] = {FLASH_WINDOW_DATA, 0xAA, windowSeq};
+        notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer));
+        return;
+    }
+
+    if ( windowLength[f] == 0)
+        windowAddress[f] = address;
+
+    uint8_t *block = (uint8_t *) ( windowBuffer + f * MICROBIT_PF_BLOCK_SIZE / sizeof(uint32_t));
+    memcpy( block + address % MICROBIT_PF_BLOCK_SIZE, data + MICROBIT_PF_WINDOW_HEADERSIZE, length);
+    windowLength[f] += length;
+    windowSeq++;
+
+    // Start writing each block as soon as it is full.
+    if ( ( address + length) % MICROBIT_PF_BLOCK_SIZE == 0)
+        windowFlush();
+
+    windowAcknowledge();
+}
+
+/**
+  * Hand the block being filled to be written, and start filling the other.
+  */
+void MicroBitPartialFlashingService::windowFlush()
+{
+    if ( windowLength[ windowFill] == 0)
+        return;
+
+    windowBusy[ windowFill] = true;
+    windowFill ^= 1;
+
+    MicroBitEvent evt(MICROBIT_ID_PARTIAL_FLASHING, FLASH_WINDOW_DATA);
+}
+
+/**
+  * Acknowledge the packets received, if there is room for a full window more.
+  * A window always fits into a free block, so there is room if the block being filled is free,
+  * and either it has room for the window or the other block is free too.
+  */
+void MicroBitPartialFlashingService::windowAcknowledge()
+{
+    // Called from both the BLE event handler and the writing fiber. The SoftDevice's critical region still allows calls to it.
+    CRITICAL_REGION_ENTER();
+
+    int f = windowFill;
+    int room = windowLength[f] ? MICROBIT_PF_BLOCK_SIZE - ( windowAddress[f] + windowLength[f]) % MICROBIT_PF_BLOCK_SIZE : MICROBIT_PF_BLOCK_SIZE;
+
+    if ( windowActive && windowSeq != windowAcked && !windowBusy[f] && ( room >= windowBytes || !windowBusy[f ^ 1]))
+    {
+        uint8_t flashNotificationBuffer[] = {FLASH_WINDOW_DATA, 0xFF, windowSeq};
+
+        // If the SoftDevice's queue is full, try again when there's room.
+        if ( notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer)))
+            windowAcked = windowSeq;
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+/**
+  * Write the blocks that have been filled. Called from the event handler, so that it can wait for the SoftDevice.
+  * While each block is written, the next is received into the other.
+  */
+void MicroBitPartialFlashingService::windowProgram(MicroBitFlash &flash)
+{
+    while ( windowBusy[ windowWrite])
+    {
+        int w = windowWrite;
+        uint32_t *flashPointer = (uint32_t *) windowAddress[w];
+        uint32_t *blockPointer = windowBuffer + ( w * MICROBIT_PF_BLOCK_SIZE + windowAddress[w] % MICROBIT_PF_BLOCK_SIZE) / sizeof(uint32_t);
+
+        MICROBIT_DEBUG_DMESG( "FLASH_WINDOW_DATA address %x length %d", (unsigned int) windowAddress[w], (int) windowLength[w]);
+
+        // If the pointer is on a page boundary check if it needs erasing
+        if ( !( (uint32_t) flashPointer % MICROBIT_CODEPAGESIZE))
+            erasePageIfNeeded( flash, flashPointer);
+
+        flash.flash_burn( flashPointer, blockPointer, windowLength[w] / sizeof(uint32_t));
+
+        windowLength[w] = 0;
+        windowBusy[w] = false;
+        windowWrite ^= 1;
+
+        windowAcknowledge();
+    }
+}
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitPartialFlashingService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    windowAcknowledge();
+}
+
+/**
+  * Set the flashIncomplete flag, so that we restart in BLE mode if the transfer fails,
+  * and erase the MicroPython filesystem, the first time that data is written.
+  */
+void MicroBitPartialFlashingService::markFlashIncomplete(MicroBitFlash &flash)
+{
+    KeyValuePair* flashIncomplete = storage.get("flashIncomplete");
+    if(flashIncomplete == NULL){
+
+      uint8_t flashIncompleteVal = 0x01;
+      storage.put("flashIncomplete", &flashIncompleteVal, sizeof(flashIncompleteVal));
+
+      // Check if FS exists
+      if(micropython_fs_end != 0x00) {
+         for(uint32_t *page = (uint32_t *)micropython_fs_start; page < (uint32_t *)(micropython_fs_end); page += (MICROBIT_CODEPAGESIZE / sizeof(uint32_t))) {
+             erasePageIfNeeded(flash, page);
+         }
+      }
+
+    }
+    delete flashIncomplete;
+}
+
+/**
+  * Erase the page starting at the address given, unless it is already blank.
+  */
+void MicroBitPartialFlashingService::erasePageIfNeeded(MicroBitFlash &flash, uint32_t *page)
+{
+    // Check words
+    for(uint32_t i = 0; i < (MICROBIT_CODEPAGESIZE / sizeof(uint32_t)); i++) {
+      if(*(page + i) != 0xFFFFFFFF) {
+          DMESG( "Erase page at %x", page);
+          flash.erase_page(page);
+          break; // If page has been erased we can skip the remaining bytes
+      }
+    }
+}
+
 /**
  * Ensure CRC validation settings are correct.
  */
@@ -357,42 +582,13 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
        * Set flashIncomplete flag if not already set to boot into BLE mode
        * upon a failed flash.
        */
-       
-       KeyValuePair* flashIncomplete = storage.get("flashIncomplete");
-       if(flashIncomplete == NULL){
-
-         uint8_t flashIncompleteVal = 0x01;
-         storage.put("flashIncomplete", &flashIncompleteVal, sizeof(flashIncompleteVal));
-            
-         // Check if FS exists
-         if(micropython_fs_end != 0x00) {
-            for(uint32_t *page = (uint32_t *)micropython_fs_start; page < (uint32_t *)(micropython_fs_end); page += (MICROBIT_CODEPAGESIZE / sizeof(uint32_t))) {
-                // Check if page needs erasing
-                for(uint32_t i = 0; i < 1024; i++) {
-                    if(*(page + i) != 0xFFFFFFFF) {
-                        DMESG( "Erase page at %x", page);
-                        flash.erase_page(page);
-                        break; // If page has been erased we can skip the remaining bytes
-                    }
-                }
-            }
-         }
-
-       }
-       delete flashIncomplete;
+      markFlashIncomplete(flash);
 
       uint32_t *flashPointer   = (uint32_t *)(offset);
 
       // If the pointer is on a page boundary check if it needs erasing
       if(!((uint32_t)flashPointer % MICROBIT_CODEPAGESIZE)) {
-          // Check words
-          for(uint32_t i = 0; i < (MICROBIT_CODEPAGESIZE / sizeof(uint32_t)); i++) {
-            if(*(flashPointer + i) != 0xFFFFFFFF) {
-                flash.erase_page(flashPointer);
-                break; // If page has been erased we can skip the remaining bytes
-            }
-          }
-
+          erasePageIfNeeded(flash, flashPointer);
       }
 
       // Create a pointer to the data block
@@ -407,15 +603,32 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
       notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer));
       break;
     }
+    case FLASH_WINDOW_DATA:
+    {
+      markFlashIncomplete(flash);
+      windowProgram(flash);
+      break;
+    }
     case END_OF_TRANSMISSION:
     {
       MICROBIT_DEBUG_DMESG( "END_OF_TRANSMISSION offset %x", (unsigned int) offset);
-      // Write final packet
-      uint32_t *blockPointer;
-      uint32_t *flashPointer   = (uint32_t *) offset;
-
-      blockPointer = block;
-      flash.flash_burn(flashPointer, blockPointer, 16);
+      if ( windowActive)
+      {
+        // Write the final block
+        CRITICAL_REGION_ENTER();
+        windowFlush();
+        CRITICAL_REGION_EXIT();
+        windowProgram(flash);
+      }
+      else
+      {
+        // Write final packet
+        uint32_t *blockPointer;
+        uint32_t *flashPointer   = (uint32_t *) offset;
+
+        blockPointer = block;
+        flash.flash_burn(flashPointer, blockPointer, 16);
+      }
 
       // Set no validation
       setDefaultBootloaderSettings();
@@ -0,0 +1,306 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for the MicroBit BLE Sensor Stream Service.
+  * Samples the accelerometer and compass together, and streams them in delta encoded, MTU sized notifications.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitSensorStreamService.h"
+#include "Timer.h"
+
+
+const uint16_t MicroBitSensorStreamService::serviceUUID               = 0xa1c0;
+const uint16_t MicroBitSensorStreamService::charUUID[ mbbs_cIdxCOUNT] = { 0xa1c1, 0xa1c2 };
+
+
+/**
+  * Zigzag encode a value, so that small negative values are small too, and write it as a varint.
+  * @return the number of bytes written, from 1 to 5.
+  */
+static int microbit_sensor_stream_encode( uint8_t *p, int32_t value)
+{
+    uint32_t z = ( (uint32_t) value << 1) ^ (uint32_t) ( value >> 31);
+    int n = 0;
+
+    while ( z >= 0x80)
+    {
+        p[ n++] = z | 0x80;
+        z >>= 7;
+    }
+
+    p[ n++] = z;
+    return n;
+}
+
+
+/**
+  * Constructor.
+  * Create a representation of the SensorStreamService.
+  * @param _ble The instance of a BLE device that we're running on.
+  * @param _accelerometer An instance of MicroBitAccelerometer.
+  * @param _compass An instance of MicroBitCompass.
+  */
+MicroBitSensorStreamService::MicroBitSensorStreamService( BLEDevice &_ble, codal::Accelerometer &_accelerometer, codal::Compass &_compass) :
+        accelerometer(_accelerometer), compass(_compass)
+{
+    // Initialise our characteristic values.
+    memset( sensorStreamDataCharacteristicBuffer, 0, sizeof( sensorStreamDataCharacteristicBuffer));
+    sensorStreamPeriodCharacteristicBuffer = accelerometer.getPeriod();
+    memset( previous, 0, sizeof( previous));
+    length = 0;
+    pending = false;
+
+    // Register the base UUID and create the service.
+    RegisterBaseUUID( bs_base_uuid);
+    CreateService( serviceUUID);
+
+    // Create the data structures that represent each of our characteristics in Soft Device.
+    CreateCharacteristic( mbbs_cIdxDATA, charUUID[ mbbs_cIdxDATA],
+                         sensorStreamDataCharacteristicBuffer,
+                         0, sizeof(sensorStreamDataCharacteristicBuffer),
+                         microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxPERIOD, charUUID[ mbbs_cIdxPERIOD],
+                         (uint8_t *)&sensorStreamPeriodCharacteristicBuffer,
+                         sizeof(sensorStreamPeriodCharacteristicBuffer), sizeof(sensorStreamPeriodCharacteristicBuffer),
+                         microbit_propREAD | microbit_propWRITE);
+
+    // The compass may be reconfigured whether or not we're connected.
+    if (EventModel::defaultEventBus)
+        EventModel::defaultEventBus->listen(MICROBIT_ID_BLE_SENSOR_STREAM, MICROBIT_SENSOR_STREAM_EVT_CONFIG_NEEDED, this, &MicroBitSensorStreamService::configUpdate);
+
+    if ( getConnected())
+        listen( true);
+}
+
+
+/**
+  * Set the sample period of the stream.
+  * The accelerometer chooses the nearest period it can support, and the compass is reconfigured in the background to match.
+  *
+  * @param period the requested time between samples, in milliseconds.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the period is out of range.
+  */
+int MicroBitSensorStreamService::setPeriod( int period)
+{
+    if ( period <= 0 || period > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Each notification holds a single period, so finish the current one first.
+    if ( !send())
+    {
+        length = 0;
+        pending = false;
+    }
+
+    accelerometer.setPeriod( period);
+
+    // The accelerometer will choose the nearest period to that requested that it can support
+    // Read back the ACTUAL period it is using, and store for next read.
+    sensorStreamPeriodCharacteristicBuffer = accelerometer.getPeriod();
+
+    if ( getConnected())
+        setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&sensorStreamPeriodCharacteristicBuffer, sizeof(sensorStreamPeriodCharacteristicBuffer));
+
+    MicroBitEvent evt(MICROBIT_ID_BLE_SENSOR_STREAM, MICROBIT_SENSOR_STREAM_EVT_CONFIG_NEEDED);
+    return DEVICE_OK;
+}
+
+
+/**
+  * Determine the sample period of the stream.
+  * @return the time between samples, in milliseconds.
+  */
+int MicroBitSensorStreamService::getPeriod()
+{
+    return sensorStreamPeriodCharacteristicBuffer;
+}
+
+
+/**
+  * Set up or tear down event listers
+  */
+void MicroBitSensorStreamService::listen( bool yes)
+{
+    if (EventModel::defaultEventBus)
+    {
+        if ( yes)
+        {
+            sensorStreamPeriodCharacteristicBuffer = accelerometer.getPeriod();
+            EventModel::defaultEventBus->listen(MICROBIT_ID_ACCELEROMETER, MICROBIT_ACCELEROMETER_EVT_DATA_UPDATE, this, &MicroBitSensorStreamService::sensorUpdate, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        }
+        else
+        {
+            EventModel::defaultEventBus->ignore(MICROBIT_ID_ACCELEROMETER, MICROBIT_ACCELEROMETER_EVT_DATA_UPDATE, this, &MicroBitSensorStreamService::sensorUpdate);
+        }
+    }
+}
+
+
+/**
+  * Invoked when BLE connects.
+  */
+void MicroBitSensorStreamService::onConnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    listen( true);
+}
+
+
+/**
+  * Invoked when BLE disconnects.
+  */
+void MicroBitSensorStreamService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    listen( false);
+    length = 0;
+    pending = false;
+}
+
+
+/**
+  * Callback. Invoked when any of our attributes are written via BLE.
+  */
+void MicroBitSensorStreamService::onDataWritten( const microbit_ble_evt_write_t *params)
+{
+    if (params->handle == valueHandle( mbbs_cIdxPERIOD) && params->len >= sizeof(sensorStreamPeriodCharacteristicBuffer))
+    {
+        uint16_t period;
+        memcpy(&period, params->data, sizeof(period));
+
+        if ( setPeriod( period) != DEVICE_OK)
+            setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&sensorStreamPeriodCharacteristicBuffer, sizeof(sensorStreamPeriodCharacteristicBuffer));
+    }
+}
+
+
+/**
+  * Callback. Invoked when queued notifications have been sent.
+  */
+void MicroBitSensorStreamService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( pending)
+        send();
+}
+
+
+/**
+  * Accelerometer update callback. Takes a sample from both sensors.
+  */
+void MicroBitSensorStreamService::sensorUpdate( MicroBitEvent)
+{
+    if ( !getConnected() || !notifyChrValueEnabled( mbbs_cIdxDATA))
+        return;
+
+    // If the last notification is still waiting, this sample is lost.
+    if ( pending && !send())
+        return;
+
+    int32_t sample[ MICROBIT_SENSOR_STREAM_S_VALUES] =
+    {
+        accelerometer.getX(), accelerometer.getY(), accelerometer.getZ(),
+        compass.getX(), compass.getY(), compass.getZ()
+    };
+
+    uint32_t now = (uint32_t) system_timer_current_time();
+
+    // Fill the negotiated MTU.
+    int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+    if ( attrSize > MICROBIT_SENSOR_STREAM_S_ATTRSIZE)
+        attrSize = MICROBIT_SENSOR_STREAM_S_ATTRSIZE;
+
+    uint8_t encoded[ MICROBIT_SENSOR_STREAM_S_VALUES * 5];
+    int n = 0;
+
+    // Encode the changes since the previous sample, unless they don't fit.
+    if ( length)
+    {
+        for ( int i = 0; i < MICROBIT_SENSOR_STREAM_S_VALUES; i++)
+            n += microbit_sensor_stream_encode( encoded + n, sample[ i] - previous[ i]);
+
+        if ( length + n > attrSize && !send())
+            return;
+    }
+
+    // Otherwise start a new notification, with this sample in full.
+    if ( length == 0)
+    {
+        uint16_t period = sensorStreamPeriodCharacteristicBuffer;
+        memcpy( sensorStreamDataCharacteristicBuffer, &now, sizeof( now));
+        memcpy( sensorStreamDataCharacteristicBuffer + sizeof( now), &period, sizeof( period));
+
+        n = 0;
+        for ( int i = 0; i < MICROBIT_SENSOR_STREAM_S_VALUES; i++)
+            n += microbit_sensor_stream_encode( encoded + n, sample[ i]);
+
+        // Until a larger MTU is negotiated, a complete sample might not fit.
+        if ( MICROBIT_SENSOR_STREAM_S_HEADERSIZE + n > attrSize)
+            return;
+
+        length = MICROBIT_SENSOR_STREAM_S_HEADERSIZE;
+    }
+
+    memcpy( sensorStreamDataCharacteristicBuffer + length, encoded, n);
+    length += n;
+    memcpy( previous, sample, sizeof( previous));
+
+    // Send once there is no room for even the smallest sample, or the first sample has waited long enough.
+    uint32_t start;
+    memcpy( &start, sensorStreamDataCharacteristicBuffer, sizeof( start));
+
+    if ( length + MICROBIT_SENSOR_STREAM_S_VALUES > attrSize || now - start >= MICROBIT_SENSOR_STREAM_LATENCY)
+        send();
+}
+
+
+/**
+  * Configuration callback. Reconfiguring the compass can take a long time, so it is done in the background.
+  */
+void MicroBitSensorStreamService::configUpdate( MicroBitEvent)
+{
+    compass.setPeriod( sensorStreamPeriodCharacteristicBuffer);
+}
+
+
+/**
+  * Send the notification being built, if there is one.
+  * @return true if it was sent or is empty, false if the SoftDevice's queue is full.
+  */
+bool MicroBitSensorStreamService::send()
+{
+    if ( length == 0)
+        return true;
+
+    pending = !notifyChrValue( mbbs_cIdxDATA, sensorStreamDataCharacteristicBuffer, length);
+    if ( !pending)
+        length = 0;
+
+    return !pending;
+}
+
+#endif
@@ -137,7 +137,7 @@ void MicroBitTemperatureService::temperatureUpdate(MicroBitEvent)
     if ( getConnected())
     {
         temperatureDataCharacteristicBuffer = thermometer.getTemperature();
-        notifyChrValue( mbbs_cIdxDATA, (uint8_t *)&temperatureDataCharacteristicBuffer, sizeof(temperatureDataCharacteristicBuffer));
+        queueChrValue( mbbs_cIdxDATA, (uint8_t *)&temperatureDataCharacteristicBuffer, sizeof(temperatureDataCharacteristicBuffer));
     }
 }
 
@@ -27,6 +27,10 @@ DEALINGS IN THE SOFTWARE.
   * Class definition for the custom MicroBit UART Service.
   * Provides a BLE service that acts as a UART port, enabling the reception and transmission
   * of an arbitrary number of bytes.
+  *
+  * Each indication or notification carries up to the negotiated ATT MTU less 3 bytes. If the connected
+  * device enables notifications rather than indications, several are queued for each connection event,
+  * without waiting for each to be confirmed.
   */
 
 #include "MicroBitConfig.h"
@@ -38,6 +42,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFiber.h"
 #include "ErrorNo.h"
 #include "NotifyEvents.h"
+#include "nrf_sdh_ble.h"
 
 
 const uint8_t  MicroBitUARTService::base_uuid[ 16] =
@@ -61,7 +66,8 @@ const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0003, 0x0002
 const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002, 0x0003 };
 #endif 
 
-#define MICROBIT_UART_S_ATTRSIZE            20
+// The largest value a single write, indication or notification can carry, at the largest MTU we negotiate.
+#define MICROBIT_UART_S_ATTRSIZE            (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
 
 /**
  * Constructor for the UARTService.
@@ -69,9 +75,10 @@ const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002, 0x0003
  * @param rxBufferSize the size of the rxBuffer
  * @param txBufferSize the size of the txBuffer
  *
- * @note defaults to 20
+ * @note defaults to 20. Buffers of up to 65534 bytes may be used,
+ *       and a tx buffer of several times the negotiated MTU is needed to keep a fast link busy.
  */
-MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize, uint8_t txBufferSize)
+MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint16_t rxBufferSize, uint16_t txBufferSize)
 {
     // Initialise our characteristic values.
     txBufferHead = 0;
@@ -112,7 +119,7 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
     CreateCharacteristic( mbbs_cIdxTX, charUUID[ mbbs_cIdxTX],
                           txBuffer + txBufferSize,
                           0, MICROBIT_UART_S_ATTRSIZE,
-                          microbit_propINDICATE);
+                          microbit_propINDICATE | microbit_propNOTIFY);
 }
 
 
@@ -145,6 +152,22 @@ void MicroBitUARTService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 }
 
 
+/**
+  * A callback function for whenever notifications queued with the SoftDevice have been sent
+  */
+void MicroBitUARTService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    if ( notifyChrValueEnabled( mbbs_cIdxTX))
+    {
+        // There's now room to queue more. Notifications aren't confirmed, so this is as close to empty as we get.
+        bool async = !waitingForEmpty;
+        MicroBitEvent(MICROBIT_ID_NOTIFY, MICROBIT_UART_S_EVT_TX_EMPTY);
+        if ( async)
+            sendNext();
+    }
+}
+
+
 /**
   * A callback function for whenever a Bluetooth device writes to our RX characteristic.
   */
@@ -203,7 +226,7 @@ void MicroBitUARTService::onDataWritten(const microbit_ble_evt_write_t *params)
   * @note this method assumes that the linear buffer has the appropriate amount of
   *       memory to contain the copy operation
   */
-void MicroBitUARTService::circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition)
+void MicroBitUARTService::circularCopy(uint8_t *circularBuff, uint16_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition)
 {
     int toBuffIndex = 0;
 
@@ -272,7 +295,7 @@ int MicroBitUARTService::getc(MicroBitSerialMode mode)
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::putc(char c, MicroBitSerialMode mode)
 {
@@ -297,19 +320,19 @@ int MicroBitUARTService::putc(char c, MicroBitSerialMode mode)
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::send(const uint8_t *buf, int length, MicroBitSerialMode mode)
 {
     if(length < 1 || mode == SYNC_SPINWAIT)
         return MICROBIT_INVALID_PARAMETER;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected() || !( indicateChrValueEnabled( mbbs_cIdxTX) || notifyChrValueEnabled( mbbs_cIdxTX)))
         return MICROBIT_NOT_SUPPORTED;
 
     int bytesWritten = 0;
 
-    while ( getConnected() && indicateChrValueEnabled( mbbs_cIdxTX))
+    while ( getConnected() && ( indicateChrValueEnabled( mbbs_cIdxTX) || notifyChrValueEnabled( mbbs_cIdxTX)))
     {
         // Add new data that fits in the tx buffer
         while ( bytesWritten < length)
@@ -343,7 +366,8 @@ int MicroBitUARTService::send(const uint8_t *buf, int length, MicroBitSerialMode
 }
 
 /**
-  * An internal method that sends the next block from the tx buffer.
+  * An internal method that sends the next block from the tx buffer, or if the connected device
+  * has enabled notifications, as many blocks as the SoftDevice will queue.
   * @return true if a block is sent
   */
 bool MicroBitUARTService::sendNext()
@@ -351,13 +375,48 @@ bool MicroBitUARTService::sendNext()
     if ( txValueSize != 0 || txBufferTail == txBufferHead)
         return false;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected())
         return false;
 
-    // Duplicate the next tx data into the attribute buffer
+    // Fill each block to the negotiated MTU.
+    int attrSize = MicroBitBLEManager::manager ? MicroBitBLEManager::manager->getMTU() - 3 : BLE_GATT_ATT_MTU_DEFAULT - 3;
+    if ( attrSize > MICROBIT_UART_S_ATTRSIZE)
+        attrSize = MICROBIT_UART_S_ATTRSIZE;
+
     uint8_t *value = txBuffer + txBufferSize;
+
+    // Notifications aren't confirmed, so queue as many as the SoftDevice will take for the coming connection events.
+    // The data is copied as each is queued, so the tx buffer can be released straight away.
+    if ( notifyChrValueEnabled( mbbs_cIdxTX))
+    {
+        bool sent = false;
+
+        while ( txBufferTail != txBufferHead)
+        {
+            int length = 0;
+            int txBufferNext = txBufferTail;
+            while ( length < attrSize && txBufferNext != txBufferHead)
+            {
+                value[ length++] = txBuffer[ txBufferNext];
+                txBufferNext = ( txBufferNext + 1) % txBufferSize;
+            }
+
+            if ( !notifyChrValue( mbbs_cIdxTX, value, length))
+                break;
+
+            txBufferTail = txBufferNext;
+            sent = true;
+        }
+
+        return sent;
+    }
+
+    if ( !indicateChrValueEnabled( mbbs_cIdxTX))
+        return false;
+
+    // Duplicate the next tx data into the attribute buffer
     int txBufferNext = txBufferTail;
-    while ( txValueSize < MICROBIT_UART_S_ATTRSIZE && txBufferNext != txBufferHead)
+    while ( txValueSize < attrSize && txBufferNext != txBufferHead)
     {
         value[ txValueSize++] = txBuffer[ txBufferNext];
         txBufferNext = ( txBufferNext + 1) % txBufferSize;
@@ -384,7 +443,7 @@ bool MicroBitUARTService::sendNext()
   *                         device.
   *
   * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-  *         no connected device, or the connected device has not enabled indications.
+  *         no connected device, or the connected device has not enabled indications or notifications.
   */
 int MicroBitUARTService::send(ManagedString s, MicroBitSerialMode mode)
 {
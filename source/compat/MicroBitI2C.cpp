@@ -36,6 +36,7 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(NRF52Pin &sda, NRF52Pin &scl) : NRF52I2C(sda, scl) {
+    init();
  }
 
 /**
@@ -48,6 +49,7 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(PinName sda, PinName scl) : NRF52I2C(*new NRF52Pin(sda, sda, PIN_CAPABILITY_ALL), *new NRF52Pin(scl, scl, PIN_CAPABILITY_ALL)) {
+    init();
  }
 
 /**
@@ -60,4 +62,144 @@ using namespace codal;
   * @param device
   */
  MicroBitI2C::MicroBitI2C(PinNumber sda, PinNumber scl) : NRF52I2C(*new NRF52Pin(sda, sda, PIN_CAPABILITY_ALL), *new NRF52Pin(scl, scl, PIN_CAPABILITY_ALL)) {
+    init();
  }
+
+/**
+  * Initialises the client registry.
+  */
+void MicroBitI2C::init()
+{
+    for (int i = 0; i < MICROBIT_I2C_MAX_CLIENTS; i++)
+        clients[i].component = NULL;
+
+    lastService = 0;
+    servicing = false;
+}
+
+/**
+  * Registers a component that shares this bus, so that it can be serviced while lower priority
+  * transactions wait for a peripheral to respond.
+  *
+  * A waiting transaction calls the idleCallback() of each client with a higher priority that
+  * is currently receiving idle ticks, so the client should only access the bus when it has work to do
+  * (e.g. when its interrupt line is active).
+  *
+  * @param component The component to service.
+  *
+  * @param priority The priority of the component, e.g. MICROBIT_I2C_PRIORITY_SENSOR.
+  *
+  * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the component is already registered,
+  * or MICROBIT_NO_RESOURCES if MICROBIT_I2C_MAX_CLIENTS clients are already registered.
+  */
+int MicroBitI2C::addClient(CodalComponent &component, int priority)
+{
+    int slot = -1;
+
+    for (int i = 0; i < MICROBIT_I2C_MAX_CLIENTS; i++)
+    {
+        if (clients[i].component == &component)
+            return MICROBIT_INVALID_PARAMETER;
+
+        if (clients[i].component == NULL && slot < 0)
+            slot = i;
+    }
+
+    if (slot < 0)
+        return MICROBIT_NO_RESOURCES;
+
+    clients[slot].component = &component;
+    clients[slot].priority = priority;
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Removes a component previously registered with addClient().
+  *
+  * @param component The component to remove.
+  *
+  * @return MICROBIT_OK on success, or MICROBIT_INVALID_PARAMETER if the component was not registered.
+  */
+int MicroBitI2C::removeClient(CodalComponent &component)
+{
+    for (int i = 0; i < MICROBIT_I2C_MAX_CLIENTS; i++)
+    {
+        if (clients[i].component == &component)
+        {
+            clients[i].component = NULL;
+            return MICROBIT_OK;
+        }
+    }
+
+    return MICROBIT_INVALID_PARAMETER;
+}
+
+/**
+  * Services any clients with a priority higher than that given, at most once every MICROBIT_I2C_SERVICE_PERIOD
+  * microseconds. Clients are serviced highest priority first.
+  *
+  * Does nothing in interrupt context, or while clients are already being serviced (e.g. when a client's
+  * idleCallback() itself waits on the bus), so that no idleCallback() is ever reentered.
+  *
+  * @param priority The priority of the caller.
+  */
+void MicroBitI2C::service(int priority)
+{
+    // Clients expect to be serviced in thread context.
+    if (__get_IPSR())
+        return;
+
+    CODAL_TIMESTAMP now = system_timer_current_time_us();
+
+    // Claim the clients atomically, so that only one caller services them at a time.
+    target_disable_irq();
+
+    if (servicing || now - lastService < MICROBIT_I2C_SERVICE_PERIOD)
+    {
+        target_enable_irq();
+        return;
+    }
+
+    servicing = true;
+    target_enable_irq();
+
+    lastService = now;
+
+    for (int p = MICROBIT_I2C_PRIORITY_SENSOR; p > priority; p--)
+    {
+        for (int i = 0; i < MICROBIT_I2C_MAX_CLIENTS; i++)
+        {
+            CodalComponent *c = clients[i].component;
+
+            // Only service components that are running, so that lazily started sensors stay stopped.
+            if (c && clients[i].priority == p && (c->status & DEVICE_COMPONENT_STATUS_IDLE_TICK))
+                c->idleCallback();
+        }
+    }
+
+    servicing = false;
+}
+
+/**
+  * Waits for the given time without yielding, as a transaction awaiting a response does,
+  * servicing any clients with a higher priority than the caller in the meantime.
+  *
+  * Intended to be called from a fiber (or before the scheduler starts), holding no lock that a client's
+  * idleCallback() may need. Nested calls, and calls in interrupt context, wait without servicing any clients.
+  *
+  * @param us The time to wait, in microseconds.
+  *
+  * @param priority The priority of the caller, e.g. MICROBIT_I2C_PRIORITY_STORAGE.
+  */
+void MicroBitI2C::wait(uint32_t us, int priority)
+{
+    CODAL_TIMESTAMP start = system_timer_current_time_us();
+
+    service(priority);
+
+    CODAL_TIMESTAMP elapsed = system_timer_current_time_us() - start;
+
+    if (elapsed < us)
+        target_wait_us(us - elapsed);
+}
@@ -26,6 +26,24 @@ DEALINGS IN THE SOFTWARE.
 
 using namespace codal;
 
+/**
+ * Applies the buffer sizes requested by a constructor. Buffers of the default size are left to be allocated on first use.
+ */
+void MicroBitSerial::init(uint8_t rxBufferSize, uint8_t txBufferSize)
+{
+    txAsync = false;
+    rxIdleTime = 0;
+    rxIdleReported = false;
+    rxLastSize = 0;
+    rxLastTime = 0;
+
+    if (rxBufferSize != CODAL_SERIAL_DEFAULT_BUFFER_SIZE)
+        setRxBufferSize(rxBufferSize);
+
+    if (txBufferSize != CODAL_SERIAL_DEFAULT_BUFFER_SIZE)
+        setTxBufferSize(txBufferSize);
+}
+
 /**
  * Constructor.
  * Create an instance of DeviceSerial
@@ -49,6 +67,7 @@ using namespace codal;
  */
 MicroBitSerial::MicroBitSerial(Pin& tx, Pin& rx, uint8_t rxBufferSize, uint8_t txBufferSize, uint16_t id) : NRF52Serial(tx, rx)
 {
+    init(rxBufferSize, txBufferSize);
 }
 
 /**
@@ -74,6 +93,7 @@ MicroBitSerial::MicroBitSerial(Pin& tx, Pin& rx, uint8_t rxBufferSize, uint8_t t
  */
 MicroBitSerial::MicroBitSerial(PinName tx, PinName rx, uint8_t rxBufferSize, uint8_t txBufferSize, uint16_t id) : NRF52Serial(*new NRF52Pin(tx, tx, PIN_CAPABILITY_ALL), *new NRF52Pin(rx, rx, PIN_CAPABILITY_ALL))
 {
+    init(rxBufferSize, txBufferSize);
 }
 
 
@@ -100,6 +120,7 @@ MicroBitSerial::MicroBitSerial(PinName tx, PinName rx, uint8_t rxBufferSize, uin
  */
 MicroBitSerial::MicroBitSerial(PinNumber tx, PinNumber rx, uint8_t rxBufferSize, uint8_t txBufferSize, uint16_t id) : NRF52Serial(*new NRF52Pin(tx, tx, PIN_CAPABILITY_ALL), *new NRF52Pin(rx, rx, PIN_CAPABILITY_ALL))
 {
+    init(rxBufferSize, txBufferSize);
 }
 
 /**
@@ -151,3 +172,88 @@ int MicroBitSerial::redirect(PinNumber tx, PinNumber rx) {
 
     return Serial::redirect(*oldTx, *oldRx);
 }
+
+/**
+  * Queues data for transmission, and returns without waiting for it to be sent.
+  * MICROBIT_SERIAL_EVT_TX_COMPLETE is raised on this component's id once everything queued has been transmitted.
+  *
+  * @param buffer The data to transmit. This is copied, so need not remain valid.
+  *
+  * @param length The number of bytes to transmit.
+  *
+  * @return The number of bytes queued, which may be fewer than requested if the transmit buffer is full,
+  *         CODAL_SERIAL_IN_USE if another fiber is transmitting, or DEVICE_INVALID_PARAMETER.
+  */
+int MicroBitSerial::sendAsync(const uint8_t *buffer, int length)
+{
+    if (buffer == NULL || length <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    int result = send((uint8_t *) buffer, length, ASYNC);
+
+    // Watch for the transmit buffer draining, so that completion can be reported.
+    if (result > 0)
+    {
+        txAsync = true;
+        fiber_wake_idle_component(this);
+    }
+
+    return result;
+}
+
+/**
+  * Enables detection of an idle receive line. Once received data stops arriving for the given time,
+  * MICROBIT_SERIAL_EVT_RX_IDLE is raised on this component's id, so that a complete message can be read in one go.
+  *
+  * @param ms The quiet time in milliseconds, or zero to disable detection.
+  *
+  * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the time is out of range.
+  */
+int MicroBitSerial::setRxIdleTime(int ms)
+{
+    if (ms < 0 || ms > 0xFFFF)
+        return DEVICE_INVALID_PARAMETER;
+
+    rxIdleTime = ms;
+    rxIdleReported = false;
+    rxLastSize = rxBufferedSize();
+    rxLastTime = system_timer_current_time();
+
+    if (rxIdleTime)
+        fiber_wake_idle_component(this);
+
+    return DEVICE_OK;
+}
+
+/**
+  * Periodic callback in thread context, made while an asynchronous transmission is in progress or idle line detection is enabled.
+  */
+void MicroBitSerial::idleCallback()
+{
+    if (txAsync && txBufferedSize() == 0)
+    {
+        txAsync = false;
+        Event(id, MICROBIT_SERIAL_EVT_TX_COMPLETE);
+    }
+
+    if (rxIdleTime)
+    {
+        int size = rxBufferedSize();
+        CODAL_TIMESTAMP now = system_timer_current_time();
+
+        if (size != rxLastSize)
+        {
+            rxLastSize = size;
+            rxLastTime = now;
+            rxIdleReported = false;
+        }
+        else if (size > 0 && !rxIdleReported && now - rxLastTime >= rxIdleTime)
+        {
+            rxIdleReported = true;
+            Event(id, MICROBIT_SERIAL_EVT_RX_IDLE);
+        }
+    }
+
+    if (!txAsync && rxIdleTime == 0)
+        fiber_idle_component_done(this);
+}